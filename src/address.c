@@ -39,13 +39,72 @@
 bool
 addressport_equals(address_t addr1, address_t addr2)
 {
-    return addr1.port == addr2.port && !strcmp(addr1.ip, addr2.ip);
+    return addr1.port == addr2.port && address_equals(addr1, addr2);
 }
 
 bool
 address_equals(address_t addr1, address_t addr2)
 {
-    return !strcmp(addr1.ip, addr2.ip);
+    return addr1.family == addr2.family
+           && addr1.ip.words[0] == addr2.ip.words[0]
+           && addr1.ip.words[1] == addr2.ip.words[1]
+           && addr1.ip.words[2] == addr2.ip.words[2]
+           && addr1.ip.words[3] == addr2.ip.words[3];
+}
+
+uint32_t
+address_hash(address_t addr, bool port)
+{
+    uint32_t hash = addr.family;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        hash = (hash ^ addr.ip.words[i]) * 0x01000193;
+
+    if (port)
+        hash = (hash ^ addr.port) * 0x01000193;
+
+    return hash ^ (hash >> 16);
+}
+
+void
+address_set_ip(address_t *addr, int family, const void *ip)
+{
+    memset(&addr->ip, 0, sizeof(addr->ip));
+    addr->family = family;
+    if (family == AF_INET6) {
+        memcpy(&addr->ip.v6, ip, sizeof(struct in6_addr));
+    } else {
+        memcpy(&addr->ip.v4, ip, sizeof(struct in_addr));
+    }
+}
+
+int
+address_parse_ip(address_t *addr, const char *ip)
+{
+    memset(&addr->ip, 0, sizeof(addr->ip));
+    addr->family = 0;
+
+    if (inet_pton(AF_INET, ip, &addr->ip.v4) == 1) {
+        addr->family = AF_INET;
+#ifdef USE_IPV6
+    } else if (inet_pton(AF_INET6, ip, &addr->ip.v6) == 1) {
+        addr->family = AF_INET6;
+#endif
+    } else {
+        memset(&addr->ip, 0, sizeof(addr->ip));
+        return 1;
+    }
+
+    return 0;
+}
+
+const char *
+address_get_ip(address_t addr, char *ip)
+{
+    if (!addr.family || !inet_ntop(addr.family, &addr.ip, ip, ADDRESSLEN))
+        ip[0] = '\0';
+    return ip;
 }
 
 bool
@@ -56,11 +115,7 @@ address_is_local(address_t addr)
     pcap_if_t *dev;
     pcap_addr_t *da;
     char errbuf[PCAP_ERRBUF_SIZE];
-    struct sockaddr_in *ipaddr;
-#ifdef USE_IPV6
-    struct sockaddr_in6 *ip6addr;
-#endif
-    char ip[ADDRESSLEN];
+    address_t local = {};
 
     // Get all network devices
     if (!devices) {
@@ -74,25 +129,22 @@ address_is_local(address_t addr)
             if (!da->addr)
                 continue;
 
-            // Initialize variables
-            memset(ip, 0, sizeof(ip));
-
-            // Get address representation
+            // Get address binary representation
             switch (da->addr->sa_family) {
             case AF_INET:
-                ipaddr = (struct sockaddr_in *) da->addr;
-                inet_ntop(AF_INET, &ipaddr->sin_addr, ip, sizeof(ip));
+                address_set_ip(&local, AF_INET, &((struct sockaddr_in *) da->addr)->sin_addr);
                 break;
 #ifdef USE_IPV6
             case AF_INET6:
-                ip6addr = (struct sockaddr_in6 *) da->addr;
-                inet_ntop(AF_INET, &ip6addr->sin6_addr, ip, sizeof(ip));
+                address_set_ip(&local, AF_INET6, &((struct sockaddr_in6 *) da->addr)->sin6_addr);
                 break;
 #endif
+            default:
+                continue;
             }
 
             // Check if this address matches
-            if (!strcmp(addr.ip, ip)) {
+            if (address_equals(addr, local)) {
                 return true;
             }
 
@@ -115,8 +167,8 @@ address_from_str(const char *ipport)
     strncpy(scanipport, ipport, sizeof(scanipport));
 
     if (sscanf(scanipport, "%" STRINGIFY(ADDRESSLEN) "[^:]:%d", address, &port) == 2) {
-        strncpy(ret.ip, address, sizeof(ret.ip));
-        ret.port = port;
+        if (address_parse_ip(&ret, address) == 0)
+            ret.port = port;
     }
 
     return ret;
@@ -53,12 +53,22 @@ typedef struct address address_t;
 
 /**
  * @brief Network address
+ *
+ * IP address is stored in binary form (network byte order) so addresses
+ * can be compared and hashed without formatting them. Unused bytes of
+ * IPv4 addresses are always zero.
  */
 struct address {
-    //! IP address
-    char ip[ADDRESSLEN];
+    //! Address family (AF_INET, AF_INET6 or 0 if not set)
+    uint8_t family;
     //! Port
     uint16_t port;
+    //! IP address
+    union {
+        struct in_addr v4;
+        struct in6_addr v6;
+        uint32_t words[4];
+    } ip;
 };
 
 /**
@@ -81,6 +91,48 @@ addressport_equals(address_t addr1, address_t addr2);
 bool
 address_equals(address_t addr1, address_t addr2);
 
+/**
+ * @brief Hash an address
+ *
+ * @param addr Address structure
+ * @param port Also hash address port
+ * @return address hash value
+ */
+uint32_t
+address_hash(address_t addr, bool port);
+
+/**
+ * @brief Set address IP from its binary representation
+ *
+ * @param addr Address structure
+ * @param family AF_INET or AF_INET6
+ * @param ip struct in_addr or struct in6_addr pointer
+ */
+void
+address_set_ip(address_t *addr, int family, const void *ip);
+
+/**
+ * @brief Set address IP from its text representation
+ *
+ * @param addr Address structure
+ * @param ip IPv4 or IPv6 address text
+ * @return 0 if IP has been parsed, 1 otherwise
+ */
+int
+address_parse_ip(address_t *addr, const char *ip);
+
+/**
+ * @brief Get text representation of address IP
+ *
+ * Addresses without IP are formatted as an empty string.
+ *
+ * @param addr Address structure
+ * @param ip Buffer of at least ADDRESSLEN bytes
+ * @return ip buffer
+ */
+const char *
+address_get_ip(address_t addr, char *ip);
+
 /**
  * @brief Check if a given IP address belongs to a local device
  *
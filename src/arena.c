@@ -0,0 +1,179 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file arena.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in arena.h
+ *
+ */
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+//! Alignment of every allocation
+#define ARENA_ALIGN 16
+//! Chunk header size, keeping chunk data aligned
+#define ARENA_CHUNK_HDR ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1))
+
+void
+arena_init(arena_t *arena)
+{
+    arena->chunks = NULL;
+    arena->size = 0;
+    memset(arena->tagged, 0, sizeof(arena->tagged));
+    pthread_mutex_init(&arena->lock, NULL);
+}
+
+void
+arena_release(arena_t *arena)
+{
+    arena_chunk_t *chunk, *next;
+    int tag;
+
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+
+    // Memory of all subsystems is released at once
+    for (tag = 0; tag < MEMSTAT_COUNT; tag++) {
+        if (arena->tagged[tag])
+            memstat_add(tag, -(int64_t) arena->tagged[tag]);
+        arena->tagged[tag] = 0;
+    }
+
+    arena->chunks = NULL;
+    arena->size = 0;
+    pthread_mutex_destroy(&arena->lock);
+}
+
+/**
+ * @brief Allocate a new chunk with room for at least size bytes
+ *
+ * Chunks double their size up to ARENA_CHUNK_MAX, so calls with few
+ * messages use little memory and big ones require few chunks. Bigger
+ * allocations get a chunk of their own, that is linked behind the
+ * current one so its remaining space can still be used.
+ */
+static arena_chunk_t *
+arena_chunk_add(arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk;
+    size_t chunk_size;
+
+    chunk_size = (arena->chunks) ? arena->chunks->size * 2 : ARENA_CHUNK_MIN;
+    if (chunk_size > ARENA_CHUNK_MAX)
+        chunk_size = ARENA_CHUNK_MAX;
+
+    if (size > chunk_size / 2) {
+        if (!(chunk = malloc(ARENA_CHUNK_HDR + size)))
+            return NULL;
+        chunk->size = chunk->used = size;
+        if (arena->chunks) {
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+        } else {
+            chunk->next = NULL;
+            arena->chunks = chunk;
+        }
+    } else {
+        if (!(chunk = malloc(ARENA_CHUNK_HDR + chunk_size)))
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->used = size;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    // New chunks are call memory until allocations are tagged
+    arena->size += chunk->size;
+    arena->tagged[MEMSTAT_CALLS] += chunk->size;
+    memstat_add(MEMSTAT_CALLS, chunk->size);
+    return chunk;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+    return arena_alloc_tag(arena, MEMSTAT_CALLS, size);
+}
+
+void *
+arena_alloc_tag(arena_t *arena, enum memstat_tag tag, size_t size)
+{
+    arena_chunk_t *chunk;
+    char *data;
+
+    // Keep all allocations aligned
+    size = (size + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+    if (size == 0)
+        return NULL;
+
+    pthread_mutex_lock(&arena->lock);
+    chunk = arena->chunks;
+    if (chunk && chunk->size - chunk->used >= size) {
+        data = (char *) chunk + ARENA_CHUNK_HDR + chunk->used;
+        chunk->used += size;
+    } else if ((chunk = arena_chunk_add(arena, size))) {
+        data = (char *) chunk + ARENA_CHUNK_HDR + chunk->used - size;
+    } else {
+        data = NULL;
+    }
+
+    // Move allocated bytes from call memory to their subsystem
+    if (data && tag != MEMSTAT_CALLS) {
+        arena->tagged[MEMSTAT_CALLS] -= size;
+        arena->tagged[tag] += size;
+    }
+    pthread_mutex_unlock(&arena->lock);
+
+    if (data && tag != MEMSTAT_CALLS) {
+        memstat_add(MEMSTAT_CALLS, -(int64_t) size);
+        memstat_add(tag, size);
+    }
+
+    if (data)
+        memset(data, 0, size);
+    return data;
+}
+
+void *
+arena_memdup(arena_t *arena, enum memstat_tag tag, const void *data, size_t len)
+{
+    char *copy;
+
+    if (!(copy = arena_alloc_tag(arena, tag, len + 1)))
+        return NULL;
+
+    memcpy(copy, data, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char *
+arena_strdup(arena_t *arena, const char *str)
+{
+    return arena_memdup(arena, MEMSTAT_CALLS, str, strlen(str));
+}
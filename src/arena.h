@@ -0,0 +1,140 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file arena.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to allocate memory released all at once
+ *
+ * Each call owns an arena where its messages, packets, frames, media and
+ * strings are allocated. Allocated memory can not be freed individually,
+ * all of it is released in a few large frees when the call is destroyed.
+ *
+ * Arena memory is accounted to MEMSTAT_CALLS unless allocations are tagged
+ * with other subsystem, until the arena is released.
+ *
+ */
+#ifndef __SNGREP_ARENA_H
+#define __SNGREP_ARENA_H
+
+#include "config.h"
+#include <stddef.h>
+#include <pthread.h>
+#include <stdint.h>
+#include "memstat.h"
+
+//! Size of the first arena chunk
+#define ARENA_CHUNK_MIN     2048
+//! Max size of arena chunks (bigger allocations get their own chunk)
+#define ARENA_CHUNK_MAX     65536
+
+//! Shorter declaration of arena structure
+typedef struct arena arena_t;
+//! Shorter declaration of arena_chunk structure
+typedef struct arena_chunk arena_chunk_t;
+
+/**
+ * @brief Memory block where arena allocations are made
+ */
+struct arena_chunk
+{
+    //! Previously allocated chunk
+    arena_chunk_t *next;
+    //! Usable bytes of this chunk
+    size_t size;
+    //! Already allocated bytes of this chunk
+    size_t used;
+};
+
+/**
+ * @brief Set of chunks released together
+ */
+struct arena
+{
+    //! Chunk used for new allocations (first in chunk list)
+    arena_chunk_t *chunks;
+    //! Total allocated bytes of all chunks
+    size_t size;
+    //! Accounted bytes of each subsystem
+    uint32_t tagged[MEMSTAT_COUNT];
+    //! Allocations can be done from multiple threads
+    pthread_mutex_t lock;
+};
+
+/**
+ * @brief Initialize an empty arena
+ *
+ * No memory is allocated until first allocation request.
+ */
+void
+arena_init(arena_t *arena);
+
+/**
+ * @brief Release all memory allocated in the arena
+ *
+ * Arena can not be used after this call unless initialized again.
+ */
+void
+arena_release(arena_t *arena);
+
+/**
+ * @brief Allocate zeroed memory from the arena
+ *
+ * @param arena Arena to allocate from
+ * @param size Bytes to allocate
+ * @return pointer to allocated memory or NULL on error
+ */
+void *
+arena_alloc(arena_t *arena, size_t size);
+
+/**
+ * @brief Allocate zeroed memory from the arena accounted to a subsystem
+ *
+ * @param arena Arena to allocate from
+ * @param tag Subsystem owning the allocated memory
+ * @param size Bytes to allocate
+ * @return pointer to allocated memory or NULL on error
+ */
+void *
+arena_alloc_tag(arena_t *arena, enum memstat_tag tag, size_t size);
+
+/**
+ * @brief Copy a memory block into the arena
+ *
+ * Copied block is NUL terminated, so it can be also used with strings.
+ *
+ * @param arena Arena to allocate from
+ * @param tag Subsystem owning the copy
+ * @param data Memory block to copy
+ * @param len Bytes to copy
+ * @return pointer to the copy or NULL on error
+ */
+void *
+arena_memdup(arena_t *arena, enum memstat_tag tag, const void *data, size_t len);
+
+/**
+ * @brief Copy a string into the arena
+ */
+char *
+arena_strdup(arena_t *arena, const char *str);
+
+#endif /* __SNGREP_ARENA_H */
@@ -35,10 +35,23 @@
 #include <string.h>
 #include <stdbool.h>
 #include <signal.h>
+#include <unistd.h>
+#include <sched.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include "capture.h"
 #ifdef USE_EEP
 #include "capture_eep.h"
+#include "capture_probe.h"
+#endif
+#ifdef USE_TPACKET
+#include "capture_tpacket.h"
+#endif
+#ifdef HAVE_MMAP
+#include "capture_mmap.h"
+#endif
+#ifdef HAVE_SHM_OPEN
+#include "capture_shm.h"
 #endif
 #ifdef WITH_GNUTLS
 #include "capture_gnutls.h"
@@ -48,11 +61,16 @@
 #endif
 #ifdef WITH_ZLIB
 #include <zlib.h>
+#include "gzip.h"
 #endif
 #include "sip.h"
 #include "rtp.h"
 #include "setting.h"
 #include "util.h"
+#include "storage.h"
+#include "metrics.h"
+#include "trigger.h"
+#include "thread.h"
 
 #if __STDC_VERSION__ >= 201112L && __STDC_NO_ATOMICS__ != 1
 // modern C with atomics
@@ -74,35 +92,222 @@ void sighup_handler(int signum)
     sighup_received = 1;
 }
 
-#if defined(WITH_ZLIB)
-static ssize_t
-gzip_cookie_write(void *cookie, const char *buf, size_t size)
+#if defined(HAVE_FOPENCOOKIE) && defined(WITH_ZLIB)
+/**
+ * @brief Decompressed data of a gzip input file
+ */
+typedef struct capture_gzip_block
+{
+    //! Decompressed bytes in this block
+    size_t len;
+    //! Bytes already read by the capture thread
+    size_t pos;
+    //! Decompressed data
+    char data[CAPTURE_GZIP_BLOCK_SIZE];
+} capture_gzip_block_t;
+
+/**
+ * @brief Gzip input file decompressed by its own thread
+ */
+typedef struct capture_gzip
+{
+    //! Compressed input file
+    gzFile zf;
+    //! Decompressed blocks pending to be read
+    queue_t *blocks;
+    //! Block being read by the capture thread
+    capture_gzip_block_t *current;
+    //! Decompression thread
+    pthread_t thread;
+    //! Decompression thread must keep reading
+    bool running;
+} capture_gzip_t;
+
+/**
+ * @brief Decompress a gzip input file ahead of its capture thread
+ */
+static void *
+capture_gzip_thread(void *data)
 {
-    return gzwrite((gzFile)cookie, (voidpc)buf, size);
+    capture_gzip_t *gz = (capture_gzip_t *) data;
+    capture_gzip_block_t *block;
+    int len;
+
+    while (gz->running) {
+        if (!(block = malloc(sizeof(capture_gzip_block_t))))
+            break;
+
+        if ((len = gzread(gz->zf, block->data, CAPTURE_GZIP_BLOCK_SIZE)) <= 0) {
+            free(block);
+            break;
+        }
+        block->len = len;
+        block->pos = 0;
+
+        // Wait until capture thread has read previous blocks
+        while (!queue_push(gz->blocks, block)) {
+            if (!gz->running) {
+                free(block);
+                break;
+            }
+            usleep(CAPTURE_QUEUE_WAIT);
+        }
+    }
+
+    // No more blocks will be decompressed
+    queue_close(gz->blocks);
+    return NULL;
 }
 
 static ssize_t
-gzip_cookie_read(void *cookie, char *buf, size_t size)
+capture_gzip_read(void *cookie, char *buf, size_t size)
 {
-    return gzread((gzFile)cookie, (voidp)buf, size);
+    capture_gzip_t *gz = (capture_gzip_t *) cookie;
+    size_t len;
+
+    while (!gz->current || gz->current->pos == gz->current->len) {
+        free(gz->current);
+        if (!(gz->current = queue_pop(gz->blocks))) {
+            if (queue_finished(gz->blocks))
+                return 0;
+            usleep(CAPTURE_QUEUE_WAIT);
+        }
+    }
+
+    len = gz->current->len - gz->current->pos;
+    if (len > size)
+        len = size;
+    memcpy(buf, gz->current->data + gz->current->pos, len);
+    gz->current->pos += len;
+    return len;
 }
 
 static int
-gzip_cookie_close(void *cookie)
+capture_gzip_close(void *cookie)
 {
-    return gzclose((gzFile)cookie);
+    capture_gzip_t *gz = (capture_gzip_t *) cookie;
+    capture_gzip_block_t *block;
+    int ret;
+
+    gz->running = false;
+    pthread_join(gz->thread, NULL);
+
+    while ((block = queue_pop(gz->blocks)))
+        free(block);
+    free(gz->current);
+    queue_destroy(gz->blocks);
+
+    ret = gzclose(gz->zf);
+    sng_free(gz);
+    return ret;
+}
+
+/**
+ * @brief Create a stream of decompressed data from a gzip file
+ *
+ * File is decompressed by a new thread so inflating and parsing packets
+ * of the same file can be done at the same time. Gzip file is closed when
+ * the stream is closed or on error.
+ *
+ * @param zf Opened gzip file
+ * @return stream to read decompressed data or NULL on error
+ */
+static FILE *
+capture_gzip_open(gzFile zf)
+{
+    capture_gzip_t *gz;
+    FILE *fp;
+
+    static cookie_io_functions_t cookiefuncs = {
+        capture_gzip_read, NULL, NULL, capture_gzip_close
+    };
+
+    if (!(gz = sng_malloc(sizeof(capture_gzip_t)))) {
+        gzclose(zf);
+        return NULL;
+    }
+
+    if (!(gz->blocks = queue_create(CAPTURE_GZIP_BLOCKS))) {
+        sng_free(gz);
+        gzclose(zf);
+        return NULL;
+    }
+
+    // Start decompressing before libpcap reads file header
+    gz->zf = zf;
+    gz->running = true;
+    gzbuffer(zf, CAPTURE_GZIP_BLOCK_SIZE);
+    if (thread_create(&gz->thread, THREAD_CAPTURE, "sng-gzip", capture_gzip_thread, gz) != 0) {
+        queue_destroy(gz->blocks);
+        sng_free(gz);
+        gzclose(zf);
+        return NULL;
+    }
+
+    // reroute the file access functions
+    // use the gzip read+close functions when accessing the file
+    if (!(fp = fopencookie(gz, "r", cookiefuncs))) {
+        capture_gzip_close(gz);
+        return NULL;
+    }
+
+    return fp;
+}
+#endif
+
+#ifdef USE_EEP
+/**
+ * @brief Keep a copy of HEP3 parsing setting for capture threads
+ */
+static void
+capture_eep_setting_changed(int id, void *data)
+{
+    __atomic_store_n(&capture_cfg.eep, setting_enabled(id), __ATOMIC_RELAXED);
 }
 #endif
 
 void
 capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_size)
 {
+    const char *match;
+
     capture_cfg.limit = limit;
     capture_cfg.pcap_buffer_size = pcap_buffer_size;
     capture_cfg.rtp_capture = rtp_capture;
     capture_cfg.rotate = rotate;
     capture_cfg.paused = 0;
     capture_cfg.sources = vector_create(1, 1);
+    capture_cfg.queue_size = setting_get_intvalue(SETTING_CAPTURE_QUEUE);
+    capture_cfg.ip_reasm_timeout = setting_get_intvalue(SETTING_CAPTURE_IPREASM_TIMEOUT);
+    capture_cfg.ip_reasm_memory = (size_t) setting_get_intvalue(SETTING_CAPTURE_IPREASM_MEMORY) * 1024;
+    capture_cfg.tcp_reasm_timeout = setting_get_intvalue(SETTING_CAPTURE_TCPREASM_TIMEOUT);
+    capture_cfg.tcp_reasm_memory = (size_t) setting_get_intvalue(SETTING_CAPTURE_TCPREASM_MEMORY) * 1024;
+    capture_cfg.overload = CAPTURE_OVERLOAD_NONE;
+    capture_cfg.overload_sample = setting_get_intvalue(SETTING_CAPTURE_OVERLOAD_SAMPLE);
+    if (setting_get_intvalue(SETTING_CAPTURE_REORDER_WINDOW) > 0)
+        capture_cfg.reorder_window = (uint64_t) setting_get_intvalue(SETTING_CAPTURE_REORDER_WINDOW) * 1000000;
+    capture_cfg.batch = setting_get_intvalue(SETTING_CAPTURE_BATCH);
+    if (capture_cfg.batch < 1)
+        capture_cfg.batch = 1;
+    if (capture_cfg.batch > CAPTURE_PARSE_BATCH_MAX)
+        capture_cfg.batch = CAPTURE_PARSE_BATCH_MAX;
+#ifdef USE_EEP
+    setting_observe(SETTING_CAPTURE_EEP, capture_eep_setting_changed, NULL);
+#endif
+
+    // Only keep RTP headers unless calls are locked or match configured pattern
+    if (setting_has_value(SETTING_CAPTURE_RTP_STORE, "headers")) {
+        capture_cfg.rtp_headers = true;
+        if ((match = setting_get_value(SETTING_CAPTURE_RTP_STORE_MATCH))) {
+            if (!(capture_cfg.rtp_match = match_set_create(true))
+                || match_set_add(capture_cfg.rtp_match, match) != 0
+                || match_set_compile(capture_cfg.rtp_match) != 0) {
+                fprintf(stderr, "Invalid capture.rtp.store.match expression\n");
+                match_set_destroy(capture_cfg.rtp_match);
+                capture_cfg.rtp_match = NULL;
+            }
+        }
+    }
 
     // set up SIGHUP handler
     // the handler will be served by any of the running threads
@@ -118,6 +323,10 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
         capture_cfg.storage = CAPTURE_STORAGE_MEMORY;
     } else if (setting_has_value(SETTING_CAPTURE_STORAGE, "disk")) {
         capture_cfg.storage = CAPTURE_STORAGE_DISK;
+    } else if (setting_has_value(SETTING_CAPTURE_STORAGE, "compressed")) {
+        capture_cfg.storage = CAPTURE_STORAGE_COMPRESSED;
+    } else if (setting_has_value(SETTING_CAPTURE_STORAGE, "index")) {
+        capture_cfg.storage = CAPTURE_STORAGE_INDEX;
     }
 
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
@@ -134,6 +343,14 @@ capture_init(size_t limit, bool rtp_capture, bool rotate, size_t pcap_buffer_siz
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE_NP);
 #endif
     pthread_mutex_init(&capture_cfg.lock, &attr);
+    pthread_mutex_init(&capture_cfg.output_lock, NULL);
+    pthread_mutex_init(&capture_cfg.dump_lock, NULL);
+    pthread_mutex_init(&capture_cfg.filter_lock, NULL);
+
+    // Learn media ports from SDP to keep capture filter narrow
+    if (setting_enabled(SETTING_CAPTURE_RTP_FILTER)) {
+        capture_cfg.filter_ports = calloc(UINT16_MAX + 1, sizeof(time_t));
+    }
 
 }
 
@@ -143,10 +360,27 @@ capture_deinit()
     // Close pcap handler
     capture_close();
 
+#ifdef HAVE_SHM_OPEN
+    // Remove daemon ring once sources have stopped
+    capture_shm_destroy(capture_cfg.shm);
+    capture_cfg.shm = NULL;
+#endif
+
     // Deallocate vectors
     vector_set_destroyer(capture_cfg.sources, vector_generic_destroyer);
     vector_destroy(capture_cfg.sources);
 
+    // Deallocate media ports
+    free(capture_cfg.filter_ports);
+
+    // Deallocate RTP store pattern
+    match_set_destroy(capture_cfg.rtp_match);
+    capture_cfg.rtp_match = NULL;
+
+#ifdef USE_EEP
+    setting_unobserve(SETTING_CAPTURE_EEP, capture_eep_setting_changed, NULL);
+#endif
+
     // Remove capture mutex
     pthread_mutex_destroy(&capture_cfg.lock);
 }
@@ -198,11 +432,20 @@ capture_online(const char *dev)
         return 2;
     }
 
+#ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
+    // Not all devices support nanosecond timestamps, microseconds are fine too
+    pcap_set_tstamp_precision(capinfo->handle, PCAP_TSTAMP_PRECISION_NANO);
+#endif
+
     if (pcap_activate(capinfo->handle) < 0) {
         fprintf(stderr, "Couldn't activate capture: %s\n", pcap_geterr(capinfo->handle));
         return 2;
     }
 
+#ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
+    capinfo->nsec = pcap_get_tstamp_precision(capinfo->handle) == PCAP_TSTAMP_PRECISION_NANO;
+#endif
+
     // Set capture thread function
     capinfo->capture_fn = capture_thread;
 
@@ -220,8 +463,8 @@ capture_online(const char *dev)
     }
 
     // Create Vectors for IP and TCP reassembly
-    capinfo->tcp_reasm = vector_create(0, 10);
-    capinfo->ip_reasm = vector_create(0, 10);
+    capinfo->tcp_reasm = capture_tcp_reasm_create();
+    capinfo->ip_reasm = capture_ip_reasm_create();
 
     // Add this capture information as packet source
     capture_add_source(capinfo);
@@ -229,6 +472,23 @@ capture_online(const char *dev)
     return 0;
 }
 
+/**
+ * @brief Open a pcap file requesting nanosecond timestamps if supported
+ *
+ * Microsecond files timestamps are scaled by libpcap.
+ */
+static pcap_t *
+capture_pcap_open_offline(capture_info_t *capinfo, const char *infile, char *errbuf)
+{
+#ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
+    capinfo->handle = pcap_open_offline_with_tstamp_precision(infile, PCAP_TSTAMP_PRECISION_NANO, errbuf);
+    capinfo->nsec = capinfo->handle != NULL;
+#else
+    capinfo->handle = pcap_open_offline(infile, errbuf);
+#endif
+    return capinfo->handle;
+}
+
 int
 capture_offline(const char *infile)
 {
@@ -257,27 +517,25 @@ capture_offline(const char *infile)
     capinfo->ispcap = true;
 
     // Open PCAP file
-    if ((capinfo->handle = pcap_open_offline(infile, errbuf)) == NULL) {
+    if (capture_pcap_open_offline(capinfo, infile, errbuf) == NULL) {
 #if defined(HAVE_FOPENCOOKIE) && defined(WITH_ZLIB)
         // we can't directly parse the file as pcap - could it be gzip compressed?
         gzFile zf = gzopen(infile, "rb");
         if (!zf)
             goto openerror;
 
-        static cookie_io_functions_t cookiefuncs = {
-            gzip_cookie_read, NULL, NULL, gzip_cookie_close
-        };
-
-        // reroute the file access functions
-        // use the gzip read+close functions when accessing the file
-        FILE *fp = fopencookie(zf, "r", cookiefuncs);
+        // decompress the file in its own thread, ahead of packet parsing
+        FILE *fp = capture_gzip_open(zf);
         if (!fp)
-        {
-            gzclose(zf);
             goto openerror;
-        }
 
-        if ((capinfo->handle = pcap_fopen_offline(fp, errbuf)) == NULL) {
+#ifdef HAVE_PCAP_SET_TSTAMP_PRECISION
+        capinfo->handle = pcap_fopen_offline_with_tstamp_precision(fp, PCAP_TSTAMP_PRECISION_NANO, errbuf);
+        capinfo->nsec = capinfo->handle != NULL;
+#else
+        capinfo->handle = pcap_fopen_offline(fp, errbuf);
+#endif
+        if (capinfo->handle == NULL) {
 openerror:
             fprintf(stderr, "Couldn't open pcap file %s: %s\n", infile, errbuf);
             return 1;
@@ -307,8 +565,92 @@ openerror:
     }
 
     // Create Vectors for IP and TCP reassembly
-    capinfo->tcp_reasm = vector_create(0, 10);
-    capinfo->ip_reasm = vector_create(0, 10);
+    capinfo->tcp_reasm = capture_tcp_reasm_create();
+    capinfo->ip_reasm = capture_ip_reasm_create();
+
+    // Add this capture information as packet source
+    capture_add_source(capinfo);
+
+    // Load big files using multiple capture threads
+    if (setting_get_intvalue(SETTING_CAPTURE_OFFLINE_THREADS) > 1
+            && strncmp(infile, "/dev/stdin", 10) != 0) {
+        capture_offline_split(capinfo, setting_get_intvalue(SETTING_CAPTURE_OFFLINE_THREADS));
+    }
+
+    return 0;
+}
+
+int
+capture_bench(const char *infile, double speed)
+{
+    capture_info_t *capinfo;
+    capture_bench_t *bench;
+    struct pcap_pkthdr *header;
+    const u_char *data;
+    size_t size = 0, alloc = 0;
+    int ret;
+
+    // Error text (in case of file open error)
+    char errbuf[PCAP_ERRBUF_SIZE];
+
+    // Create a new structure to handle this capture source
+    if (!(capinfo = sng_malloc(sizeof(capture_info_t)))
+        || !(bench = sng_malloc(sizeof(capture_bench_t)))) {
+        fprintf(stderr, "Can't allocate memory for capture data!\n");
+        return 1;
+    }
+
+    capinfo->capture_fn = capture_bench_thread;
+    capinfo->infile = infile;
+    capinfo->ispcap = true;
+    capinfo->bench = bench;
+    bench->speed = speed;
+
+    // Open PCAP file
+    if (capture_pcap_open_offline(capinfo, infile, errbuf) == NULL) {
+        fprintf(stderr, "Couldn't open pcap file %s: %s\n", infile, errbuf);
+        return 1;
+    }
+
+    // Get datalink to parse packets correctly
+    capinfo->link = pcap_datalink(capinfo->handle);
+
+    // Check linktypes sngrep knowns before start parsing packets
+    if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
+        fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
+        return 3;
+    }
+
+    // Load all packets in memory before replay starts
+    while ((ret = pcap_next_ex(capinfo->handle, &header, &data)) == 1) {
+        if (bench->count == alloc) {
+            alloc = alloc ? alloc * 2 : 1024;
+            bench->headers = realloc(bench->headers, sizeof(struct pcap_pkthdr) * alloc);
+            bench->offsets = realloc(bench->offsets, sizeof(size_t) * alloc);
+        }
+        if (bench->bytes + header->caplen > size) {
+            size = (size ? size * 2 : 1024 * 1024) + header->caplen;
+            bench->data = realloc(bench->data, size);
+        }
+        if (!bench->headers || !bench->offsets || !bench->data) {
+            fprintf(stderr, "Can't allocate memory to load %s\n", infile);
+            return 1;
+        }
+        bench->headers[bench->count] = *header;
+        bench->offsets[bench->count] = bench->bytes;
+        memcpy(bench->data + bench->bytes, data, header->caplen);
+        bench->bytes += header->caplen;
+        bench->count++;
+    }
+
+    if (ret == -1) {
+        fprintf(stderr, "Couldn't read pcap file %s: %s\n", infile, pcap_geterr(capinfo->handle));
+        return 1;
+    }
+
+    // Create Vectors for IP and TCP reassembly
+    capinfo->tcp_reasm = capture_tcp_reasm_create();
+    capinfo->ip_reasm = capture_ip_reasm_create();
 
     // Add this capture information as packet source
     capture_add_source(capinfo);
@@ -316,6 +658,254 @@ openerror:
     return 0;
 }
 
+const capture_bench_t *
+capture_bench_info()
+{
+    capture_info_t *capinfo;
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->bench)
+            return capinfo->bench;
+    }
+    return NULL;
+}
+
+void *
+capture_bench_thread(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_bench_t *bench = capinfo->bench;
+    struct timespec now, wait;
+    struct timeval *first;
+    // Headers subsecond units in nanoseconds
+    int64_t unit = (capinfo->nsec) ? 1 : 1000;
+    int64_t delay;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &bench->start);
+    first = (bench->count) ? &bench->headers[0].ts : NULL;
+
+    for (i = 0; i < bench->count && capinfo->running; i++) {
+        // Wait until packet recorded time, scaled by replay speed
+        if (bench->speed > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            delay = ((bench->headers[i].ts.tv_sec - first->tv_sec) * 1000000000LL
+                     + (bench->headers[i].ts.tv_usec - first->tv_usec) * unit) / bench->speed
+                    - ((now.tv_sec - bench->start.tv_sec) * 1000000000LL
+                       + now.tv_nsec - bench->start.tv_nsec);
+            if (delay > 0) {
+                wait.tv_sec = delay / 1000000000;
+                wait.tv_nsec = delay % 1000000000;
+                nanosleep(&wait, NULL);
+            }
+        }
+        parse_packet((u_char *) capinfo, &bench->headers[i], bench->data + bench->offsets[i]);
+    }
+
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
+
+    // Parsed packets are copied, preloaded data is no longer required
+    sng_free(bench->data);
+    sng_free(bench->headers);
+    sng_free(bench->offsets);
+    bench->data = NULL;
+    bench->headers = NULL;
+    bench->offsets = NULL;
+
+    return NULL;
+}
+
+/**
+ * @brief Read a 32 bits pcap header field
+ */
+static uint32_t
+capture_offline_u32(const u_char *data, bool swapped)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    if (swapped) {
+        value = ((value & 0xFF) << 24) | ((value & 0xFF00) << 8)
+                | ((value >> 8) & 0xFF00) | (value >> 24);
+    }
+    return value;
+}
+
+/**
+ * @brief Find the first pcap record header after given file offset
+ *
+ * There is no record marker in pcap files, so a position is considered a
+ * record boundary when it is followed by a chain of valid record headers.
+ *
+ * @return record offset or -1 if not found
+ */
+static off_t
+capture_offline_sync(int fd, off_t offset, off_t size, bool swapped, uint32_t snaplen, uint32_t maxfrac)
+{
+    u_char *buffer;
+    ssize_t len;
+    off_t found = -1;
+    uint32_t pos, rec, records;
+    uint32_t sec, prevsec, frac, caplen, wirelen;
+
+    if (!(buffer = malloc(CAPTURE_OFFLINE_SYNC_LEN)))
+        return -1;
+
+    if ((len = pread(fd, buffer, CAPTURE_OFFLINE_SYNC_LEN, offset)) <= 0) {
+        free(buffer);
+        return -1;
+    }
+
+    for (pos = 0; pos + sizeof(struct pcap_pkthdr) <= (uint32_t) len && found == -1; pos++) {
+        prevsec = 0;
+        for (rec = pos, records = 0; records < CAPTURE_OFFLINE_SYNC_RECORDS; records++) {
+            // Chain reached the end of file
+            if (offset + rec == size)
+                break;
+            // Chain exceeds read data
+            if (rec + 16 > (uint32_t) len)
+                break;
+            sec = capture_offline_u32(buffer + rec, swapped);
+            frac = capture_offline_u32(buffer + rec + 4, swapped);
+            caplen = capture_offline_u32(buffer + rec + 8, swapped);
+            wirelen = capture_offline_u32(buffer + rec + 12, swapped);
+            // Check record header fields
+            if (frac >= maxfrac || caplen == 0 || caplen > snaplen || caplen > wirelen)
+                break;
+            // Consecutive records can not be too far in time
+            if (prevsec && (sec + 3600 < prevsec || sec > prevsec + 86400))
+                break;
+            prevsec = sec;
+            rec += 16 + caplen;
+        }
+
+        if (records == CAPTURE_OFFLINE_SYNC_RECORDS || (records > 0 && offset + rec == size))
+            found = offset + pos;
+    }
+
+    free(buffer);
+    return found;
+}
+
+int
+capture_offline_split(capture_info_t *capinfo, int chunks)
+{
+    capture_info_t *chunk;
+    FILE *fp = pcap_file(capinfo->handle);
+    struct stat sb;
+    off_t start, offset, prev;
+    uint32_t magic, maxfrac;
+    char errbuf[PCAP_ERRBUF_SIZE];
+    bool swapped;
+    int count = 1, i;
+
+    // Compressed files can not be accessed at random positions
+    if (!fp || fstat(fileno(fp), &sb) != 0 || !S_ISREG(sb.st_mode))
+        return 1;
+
+    // Only classic pcap format can be split
+    if (pread(fileno(fp), &magic, sizeof(magic), 0) != sizeof(magic))
+        return 1;
+    if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1) {
+        maxfrac = 1000000;
+    } else if (magic == 0xa1b23c4d || magic == 0x4d3cb2a1) {
+        maxfrac = 1000000000;
+    } else {
+        return 1;
+    }
+    swapped = pcap_is_swapped(capinfo->handle);
+
+    // Dont split small files
+    start = ftell(fp);
+    if ((sb.st_size - start) / chunks < CAPTURE_OFFLINE_CHUNK_MIN)
+        chunks = (sb.st_size - start) / CAPTURE_OFFLINE_CHUNK_MIN;
+
+    prev = start;
+    for (i = 1; i < chunks; i++) {
+        offset = capture_offline_sync(fileno(fp), start + (sb.st_size - start) / chunks * i,
+                                      sb.st_size, swapped, pcap_snapshot(capinfo->handle), maxfrac);
+        if (offset <= prev)
+            continue;
+
+        // Create a new structure to handle this file chunk
+        if (!(chunk = sng_malloc(sizeof(capture_info_t))))
+            break;
+
+        if (!capture_pcap_open_offline(chunk, capinfo->infile, errbuf)) {
+            sng_free(chunk);
+            break;
+        }
+
+        // Start reading at chunk first record
+        if (fseek(pcap_file(chunk->handle), offset, SEEK_SET) != 0) {
+            pcap_close(chunk->handle);
+            sng_free(chunk);
+            break;
+        }
+
+        chunk->capture_fn = capinfo->capture_fn;
+        chunk->infile = capinfo->infile;
+        chunk->ispcap = true;
+        chunk->link = capinfo->link;
+        chunk->link_hl = capinfo->link_hl;
+        chunk->tcp_reasm = capture_tcp_reasm_create();
+        chunk->ip_reasm = capture_ip_reasm_create();
+
+        // Previous chunk ends where this one starts
+        capinfo->infile_end = offset;
+        capture_add_source(chunk);
+        capinfo = chunk;
+        prev = offset;
+        count++;
+    }
+
+    return count;
+}
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+/**
+ * @brief Hand a TCP segment to the TLS worker owning its connection
+ *
+ * Capture threads never wait for TLS workers: segments are dropped when
+ * the worker queue is full.
+ *
+ * @return 0 if the segment has been queued or dropped, 1 if it must be
+ * decrypted by the caller
+ */
+static int
+capture_tls_dispatch(capture_info_t *capinfo, packet_t *pkt, struct tcphdr *tcp)
+{
+    capture_tls_worker_t *worker;
+    capture_tls_segment_t *segment;
+    int partition;
+    bool queued;
+
+    // No worker owns this connection partition
+    partition = tls_packet_partition(pkt);
+    if (partition >= capture_cfg.tls_worker_count)
+        return 1;
+    worker = &capture_cfg.tls_workers[partition];
+
+    if (!(segment = sng_malloc(sizeof(capture_tls_segment_t))))
+        return 1;
+    segment->pkt = pkt;
+    memcpy(&segment->tcp, tcp, sizeof(struct tcphdr));
+
+    // Multiple sources may share the same worker
+    pthread_mutex_lock(&worker->lock);
+    queued = queue_push(worker->queue, segment);
+    pthread_mutex_unlock(&worker->lock);
+
+    if (!queued) {
+        capinfo->queue_drops++;
+        packet_destroy(pkt);
+        sng_free(segment);
+    }
+
+    return 0;
+}
+#endif
+
 void
 parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packet)
 {
@@ -329,21 +919,38 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     struct tcphdr *tcp;
     // TCP header size
     uint16_t tcp_off;
+    // IP reassembly buffer
+    u_char reasm[MAX_CAPTURE_LEN];
     // Packet data
-    u_char data[MAX_CAPTURE_LEN];
+    u_char *data = reasm;
     // Packet payload data
     u_char *payload = NULL;
     // Whole packet size
     uint32_t size_capture = header->caplen;
     // Packet payload size
     uint32_t size_payload =  size_capture - capinfo->link_hl;
+    // Frame header with microseconds timestamp
+    struct pcap_pkthdr frame_header;
     // Captured packet info
-    packet_t *pkt;
+    packet_t *pkt, *next;
+    // Stage timing start
+    uint64_t start;
 #ifdef USE_EEP
     // Captured HEP3 packet info
     packet_t *pkt_hep3;
 #endif
 
+    // Account all packets read from this source
+    capinfo->received++;
+
+#ifdef HAVE_SHM_OPEN
+    // Daemon frames are parsed by attached clients
+    if (capture_cfg.shm) {
+        capture_shm_publish(capture_cfg.shm, capinfo, header, packet);
+        return;
+    }
+#endif
+
     // Ignore packets while capture is paused
     if (capture_paused())
         return;
@@ -352,6 +959,7 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     if (capture_cfg.limit && sip_calls_count() >= capture_cfg.limit) {
         // If capture rotation is disabled, just skip this packet
         if (!capture_cfg.rotate) {
+            capinfo->skipped++;
             return;
         }
     }
@@ -360,13 +968,24 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
     if (header->caplen > MAX_CAPTURE_LEN)
         return;
 
-    // Copy packet payload
-    memcpy(data, packet, header->caplen);
+    // Stored frames keep microseconds, packets keep the nanoseconds time
+    if (capinfo->nsec) {
+        capinfo->ts = (uint64_t) header->ts.tv_sec * 1000000000 + header->ts.tv_usec;
+        frame_header = *header;
+        frame_header.ts.tv_usec /= 1000;
+        header = &frame_header;
+    }
 
     // Check if we have a complete IP packet
-    if (!(pkt = capture_packet_reasm_ip(capinfo, header, data, &size_payload, &size_capture)))
+    start = metrics_timing_start();
+    pkt = capture_packet_reasm_ip(capinfo, header, packet, &data, &size_payload, &size_capture);
+    metrics_timing_end(METRICS_STAGE_IP_REASM, start);
+    if (!pkt)
         return;
 
+    // Remember packet source for its counters
+    pkt->source = capinfo;
+
     // Only interested in UDP packets
     if (pkt->proto == IPPROTO_UDP) {
         // Get UDP header
@@ -388,7 +1007,7 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
 
 #ifdef USE_EEP
         // check for HEP3 header and parse payload
-        if(setting_enabled(SETTING_CAPTURE_EEP)) {
+        if (__atomic_load_n(&capture_cfg.eep, __ATOMIC_RELAXED)) {
             pkt_hep3 = capture_eep_receive_v3(payload, size_payload);
 
             if (pkt_hep3) {
@@ -430,55 +1049,206 @@ parse_packet(u_char *info, const struct pcap_pkthdr *header, const u_char *packe
         packet_set_payload(pkt, payload, size_payload);
 
         // Create a structure for this captured packet
-        if (!(pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp, payload, size_payload)))
+        start = metrics_timing_start();
+        pkt = capture_packet_reasm_tcp(capinfo, pkt, tcp, payload, size_payload);
+        metrics_timing_end(METRICS_STAGE_TCP_REASM, start);
+        if (!pkt)
             return;
 
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
         // Check if packet is TLS
         if (capture_cfg.keyfile) {
+            // Online segments are decrypted by the worker of their connection
+            if (!capinfo->infile && capture_tls_dispatch(capinfo, pkt, tcp) == 0)
+                return;
+            start = metrics_timing_start();
             tls_process_segment(pkt, tcp);
+            metrics_timing_end(METRICS_STAGE_TLS, start);
         }
 #endif
 
-        // Check if packet is WS or WSS
-        capture_ws_check_packet(pkt);
+        // Check if packet is WS or WSS, each WS message is parsed as a packet
+        while (capture_ws_check_packet(pkt, &next) && next) {
+            capture_queue_packet(capinfo, pkt);
+            pkt = next;
+        }
     } else {
         // Not handled protocol
         packet_destroy(pkt);
         return;
     }
 
-    // Avoid parsing from multiples sources.
-    // Avoid parsing while screen in being redrawn
-    capture_lock();
-    // Check if we can handle this packet
-    if (capture_packet_parse(pkt) == 0) {
-#ifdef USE_EEP
-        // Send this packet through eep
-        capture_eep_send(pkt);
-#endif
-        // Store this packets in output file
-        capture_dump_packet(pkt);;
-        // If storage is disabled, delete frames payload
-        if (capture_cfg.storage == 0) {
-            packet_free_frames(pkt);
-        }
-        // Allow Interface refresh and user input actions
-        capture_unlock();
-        return;
-    }
-
-    // Not an interesting packet ...
-    packet_destroy(pkt);
-    // Allow Interface refresh and user input actions
-    capture_unlock();
+    // Let the parser thread handle this packet
+    capture_queue_packet(capinfo, pkt);
 }
 
-packet_t *
-capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header, u_char *packet, uint32_t *size, uint32_t *caplen)
+/**
+ * @brief Hash IP datagram identifiers
+ */
+static uint32_t
+capture_ip_reasm_hash(address_t src, address_t dst, uint32_t id, uint8_t proto)
 {
-    // IP header data
-    struct ip *ip4;
+    uint32_t hash = address_hash(src, false);
+
+    hash = ((hash << 5) + hash) + address_hash(dst, false);
+    hash = ((hash << 5) + hash) + id;
+    return ((hash << 5) + hash) + proto;
+}
+
+/**
+ * @brief Add a new datagram to IP reassembly table
+ */
+static capture_ip_frag_t *
+capture_ip_reasm_add(capture_ip_reasm_t *reasm, packet_t *pkt, uint32_t hash, struct timeval ts)
+{
+    capture_ip_frag_t *frag = sng_malloc(sizeof(capture_ip_frag_t));
+    capture_ip_frag_t **bucket = &reasm->buckets[hash & (CAPTURE_IP_REASM_BUCKETS - 1)];
+
+    frag->pkt = pkt;
+    frag->hash = hash;
+    frag->ts = ts;
+
+    // Add to hash bucket
+    frag->next = *bucket;
+    *bucket = frag;
+
+    // Add to reception order list
+    frag->older = reasm->newest;
+    if (reasm->newest)
+        reasm->newest->newer = frag;
+    reasm->newest = frag;
+    if (!reasm->oldest)
+        reasm->oldest = frag;
+
+    reasm->count++;
+    return frag;
+}
+
+/**
+ * @brief Remove a datagram from IP reassembly table
+ *
+ * Datagram packet is not destroyed
+ */
+static void
+capture_ip_reasm_remove(capture_ip_reasm_t *reasm, capture_ip_frag_t *frag)
+{
+    capture_ip_frag_t **bucket = &reasm->buckets[frag->hash & (CAPTURE_IP_REASM_BUCKETS - 1)];
+
+    // Remove from hash bucket
+    while (*bucket != frag)
+        bucket = &(*bucket)->next;
+    *bucket = frag->next;
+
+    // Remove from reception order list
+    if (frag->older)
+        frag->older->newer = frag->newer;
+    else
+        reasm->oldest = frag->newer;
+    if (frag->newer)
+        frag->newer->older = frag->older;
+    else
+        reasm->newest = frag->older;
+
+    // Fragment frames are packet frames again
+    reasm->bytes -= frag->bytes;
+    memstat_add(MEMSTAT_REASM, -(int64_t) frag->bytes);
+    memstat_add(MEMSTAT_FRAMES, frag->bytes);
+    reasm->count--;
+    sng_free(frag);
+}
+
+/**
+ * @brief Discard incomplete datagrams from IP reassembly table
+ *
+ * Remove datagrams whose first fragment is older than configured timeout
+ * and oldest datagrams until there is memory for the incoming fragment.
+ *
+ * @param reasm IP reassembly table
+ * @param now Capture time of the incoming fragment
+ * @param bytes Captured bytes of the incoming fragment
+ */
+static void
+capture_ip_reasm_expire(capture_ip_reasm_t *reasm, struct timeval now, uint32_t bytes)
+{
+    capture_ip_frag_t *oldest;
+
+    while ((oldest = reasm->oldest)) {
+        if (now.tv_sec - oldest->ts.tv_sec > capture_cfg.ip_reasm_timeout) {
+            reasm->expired++;
+        } else if (reasm->bytes + bytes > capture_cfg.ip_reasm_memory) {
+            reasm->evicted++;
+        } else {
+            break;
+        }
+        packet_destroy(oldest->pkt);
+        capture_ip_reasm_remove(reasm, oldest);
+    }
+}
+
+capture_ip_reasm_t *
+capture_ip_reasm_create()
+{
+    return sng_malloc(sizeof(capture_ip_reasm_t));
+}
+
+void
+capture_ip_reasm_destroy(capture_ip_reasm_t *reasm)
+{
+    if (!reasm)
+        return;
+
+    while (reasm->oldest) {
+        packet_destroy(reasm->oldest->pkt);
+        capture_ip_reasm_remove(reasm, reasm->oldest);
+    }
+    sng_free(reasm);
+}
+
+void
+capture_ip_reasm_stats(uint32_t *pending, uint64_t *expired, uint64_t *evicted)
+{
+    capture_info_t *capinfo;
+
+    *pending = 0;
+    *expired = 0;
+    *evicted = 0;
+
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->ip_reasm) {
+            *pending += capinfo->ip_reasm->count;
+            *expired += capinfo->ip_reasm->expired;
+            *evicted += capinfo->ip_reasm->evicted;
+        }
+    }
+}
+
+/**
+ * @brief Add a frame to a packet remembering its position in mapped input file
+ */
+static frame_t *
+capture_packet_add_frame(capture_info_t *capinfo, packet_t *pkt, const struct pcap_pkthdr *header, const u_char *packet)
+{
+    frame_t *frame = packet_add_frame(pkt, header, packet);
+
+    // Frame header timestamp has lost the nanoseconds
+    if (capinfo->nsec && vector_count(pkt->frames) == 1)
+        packet_set_time(pkt, capinfo->ts);
+
+#ifdef HAVE_MMAP
+    // Indexed storage reads frame data again from the mapped file
+    if (capinfo->mmap && packet > capinfo->mmap->map
+        && packet < capinfo->mmap->map + capinfo->mmap->size)
+        frame->offset = packet - capinfo->mmap->map;
+#endif
+    return frame;
+}
+
+packet_t *
+capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header, const u_char *packet, u_char **data, uint32_t *size, uint32_t *caplen)
+{
+    // IP header data
+    struct ip *ip4;
 #ifdef USE_IPV6
     // IPv6 header data
     struct ip6_hdr *ip6;
@@ -499,6 +1269,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     uint32_t ip_id = 0;
     // Fragmentation offset
     uint16_t ip_frag_off = 0;
+    // Fragment payload length
+    uint16_t frag_len = 0;
     //! Source Address
     address_t src = { };
     //! Destination Address
@@ -507,8 +1279,13 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     vector_iter_t it;
     //! Packet containers
     packet_t *pkt;
+    //! Datagram pending reassembly
+    capture_ip_frag_t *frag;
+    uint32_t hash;
     //! Storage for IP frame
     frame_t *frame;
+    //! Assembled IP packet data
+    u_char *assembled = *data;
     uint32_t len_data = 0;
     //! Link + Extra header size
     uint16_t link_hl = capinfo->link_hl;
@@ -575,8 +1352,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 ip_frag_off = (ip_frag) ? (ip_off & IP_OFFMASK) * 8 : 0;
                 ip_id = ntohs(ip4->ip_id);
 
-                inet_ntop(AF_INET, &ip4->ip_src, src.ip, sizeof(src.ip));
-                inet_ntop(AF_INET, &ip4->ip_dst, dst.ip, sizeof(dst.ip));
+                address_set_ip(&src, AF_INET, &ip4->ip_src);
+                address_set_ip(&dst, AF_INET, &ip4->ip_dst);
                 break;
 #ifdef USE_IPV6
             case 6:
@@ -591,8 +1368,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                     ip_id = ntohl(ip6f->ip6f_ident);
                 }
 
-                inet_ntop(AF_INET6, &ip6->ip6_src, src.ip, sizeof(src.ip));
-                inet_ntop(AF_INET6, &ip6->ip6_dst, dst.ip, sizeof(dst.ip));
+                address_set_ip(&src, AF_INET6, &ip6->ip6_src);
+                address_set_ip(&dst, AF_INET6, &ip6->ip6_dst);
                 break;
 #endif
             default:
@@ -633,30 +1410,44 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
     if (ip_frag == 0) {
         // Just create a new packet with given network data
         pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
+        frame = capture_packet_add_frame(capinfo, pkt, header, packet);
+        // Parse the packet directly from its frame data
+        *data = frame->data;
         return pkt;
     }
 
-    // Look for another packet with same id in IP reassembly vector
-    it = vector_iterator(capinfo->ip_reasm);
-    while ((pkt = vector_iterator_next(&it))) {
-        if (addressport_equals(pkt->src, src)
-                && addressport_equals(pkt->dst, dst)
-                && pkt->ip_id == ip_id) {
+    // Discard incomplete datagrams that won't be completed
+    capture_ip_reasm_expire(capinfo->ip_reasm, header->ts, header->caplen);
+
+    // Look for another packet with same id in IP reassembly table
+    hash = capture_ip_reasm_hash(src, dst, ip_id, ip_proto);
+    for (frag = capinfo->ip_reasm->buckets[hash & (CAPTURE_IP_REASM_BUCKETS - 1)]; frag; frag = frag->next) {
+        if (frag->hash == hash
+                && frag->pkt->ip_id == ip_id
+                && frag->pkt->proto == ip_proto
+                && addressport_equals(frag->pkt->src, src)
+                && addressport_equals(frag->pkt->dst, dst)) {
             break;
         }
     }
 
     // If we already have this packet stored, append this frames to existing one
-    if (pkt) {
-        packet_add_frame(pkt, header, packet);
+    if (frag) {
+        pkt = frag->pkt;
+        capture_packet_add_frame(capinfo, pkt, header, packet);
     } else {
         // Add To the possible reassembly list
         pkt = packet_create(ip_ver, ip_proto, src, dst, ip_id);
-        packet_add_frame(pkt, header, packet);
-        vector_append(capinfo->ip_reasm, pkt);
+        capture_packet_add_frame(capinfo, pkt, header, packet);
+        frag = capture_ip_reasm_add(capinfo->ip_reasm, pkt, hash, header->ts);
     }
 
+    // Account fragment memory
+    frag->bytes += header->caplen;
+    capinfo->ip_reasm->bytes += header->caplen;
+    memstat_add(MEMSTAT_FRAMES, -(int64_t) header->caplen);
+    memstat_add(MEMSTAT_REASM, header->caplen);
+
     // Add this IP content length to the total captured of the packet
     pkt->ip_cap_len += ip_len - ip_hl;
 #ifdef USE_IPV6
@@ -694,7 +1485,8 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
 #ifdef USE_IPV6
                 case 6: {
                     struct ip6_hdr *frame_ip6 = (struct ip6_hdr *) (frame->data + link_hl);
-                    len_data += ntohs(frame_ip6->ip6_ctlun.ip6_un1.ip6_un1_plen);
+                    // Payload length includes fragment header
+                    len_data += ntohs(frame_ip6->ip6_ctlun.ip6_un1.ip6_un1_plen) - sizeof(struct ip6_frag);
                     break;
                 }
 #endif
@@ -704,11 +1496,20 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
         }
 
         // Check packet content length
-        if (len_data > MAX_CAPTURE_LEN)
+        *caplen = link_hl + ip_hl + len_data;
+#ifdef USE_IPV6
+        if (ip_ver == 6) {
+            *caplen += sizeof(struct ip6_frag);
+        }
+#endif
+        if (*caplen > MAX_CAPTURE_LEN) {
+            capture_ip_reasm_remove(capinfo->ip_reasm, frag);
+            packet_destroy(pkt);
             return NULL;
+        }
 
         // Initialize memory for the assembly packet
-        memset(packet, 0, link_hl + ip_hl + len_data);
+        memset(assembled, 0, link_hl + ip_hl + len_data);
 
         it = vector_iterator(pkt->frames);
         while ((frame = vector_iterator_next(&it))) {
@@ -716,9 +1517,14 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 case 4: {
                     // Get IP header
                     struct ip *frame_ip = (struct ip *) (frame->data + link_hl);
-                    memcpy(packet + link_hl + ip_hl + (ntohs(frame_ip->ip_off) & IP_OFFMASK) * 8,
+                    ip_frag_off = (ntohs(frame_ip->ip_off) & IP_OFFMASK) * 8;
+                    frag_len = ntohs(frame_ip->ip_len) - frame_ip->ip_hl * 4;
+                    // Ignore fragments overflowing datagram length
+                    if (ip_frag_off + frag_len > len_data)
+                        break;
+                    memcpy(assembled + link_hl + ip_hl + ip_frag_off,
                            frame->data + link_hl + frame_ip->ip_hl * 4,
-                           ntohs(frame_ip->ip_len) - frame_ip->ip_hl * 4);
+                           frag_len);
 
                 }
                     break;
@@ -726,11 +1532,15 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
                 case 6: {
                     struct ip6_hdr *frame_ip6 = (struct ip6_hdr*)(frame->data + link_hl);
                     struct ip6_frag *frame_ip6f = (struct ip6_frag *)(frame->data + link_hl + ip_hl);
-                    uint16_t frame_ip_frag_off = ntohs(frame_ip6f->ip6f_offlg & IP6F_OFF_MASK);
-                    memcpy(packet + link_hl + ip_hl + sizeof(struct ip6_frag) + frame_ip_frag_off,
-                            frame->data + link_hl + ip_hl + sizeof (struct ip6_frag),
-                            ntohs(frame_ip6->ip6_ctlun.ip6_un1.ip6_un1_plen));
+                    ip_frag_off = ntohs(frame_ip6f->ip6f_offlg & IP6F_OFF_MASK);
+                    frag_len = ntohs(frame_ip6->ip6_ctlun.ip6_un1.ip6_un1_plen) - sizeof(struct ip6_frag);
                     pkt->proto = frame_ip6f->ip6f_nxt;
+                    // Ignore fragments overflowing datagram length
+                    if (ip_frag_off + frag_len > len_data)
+                        break;
+                    memcpy(assembled + link_hl + ip_hl + sizeof(struct ip6_frag) + ip_frag_off,
+                            frame->data + link_hl + ip_hl + sizeof (struct ip6_frag),
+                            frag_len);
                 }
                     break;
 #endif
@@ -739,141 +1549,456 @@ capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *heade
             }
         }
 
-        *caplen = link_hl + ip_hl + len_data;
-#ifdef USE_IPV6
-        if (ip_ver == 6) {
-            *caplen += sizeof(struct ip6_frag);
-        }
-#endif
         *size = len_data;
 
         // Return the assembled IP packet
-        vector_remove(capinfo->ip_reasm, pkt);
+        capture_ip_reasm_remove(capinfo->ip_reasm, frag);
         return pkt;
     }
 
     return NULL;
 }
 
-packet_t *
-capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp, u_char *payload, int size_payload) {
+/**
+ * @brief Hash TCP flow identifiers
+ */
+static uint32_t
+capture_tcp_reasm_hash(address_t src, address_t dst)
+{
+    uint32_t hash = address_hash(src, true);
 
-    vector_iter_t it = vector_iterator(capinfo->tcp_reasm);
-    packet_t *pkt;
-    u_char *new_payload;
-    u_char full_payload[MAX_CAPTURE_LEN + 1];
+    return ((hash << 5) + hash) + address_hash(dst, true);
+}
 
-    //! Assembled
-    if ((int32_t) size_payload <= 0)
-        return packet;
+/**
+ * @brief Find a TCP flow pending reassembly
+ */
+static capture_tcp_flow_t *
+capture_tcp_reasm_find(capture_tcp_reasm_t *reasm, packet_t *packet, uint32_t hash)
+{
+    capture_tcp_flow_t *flow;
+
+    for (flow = reasm->buckets[hash & (CAPTURE_TCP_REASM_BUCKETS - 1)]; flow; flow = flow->next) {
+        if (flow->hash == hash
+                && addressport_equals(flow->pkt->src, packet->src)
+                && addressport_equals(flow->pkt->dst, packet->dst)) {
+            return flow;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Move a TCP flow to the end of activity order list
+ */
+static void
+capture_tcp_reasm_touch(capture_tcp_reasm_t *reasm, capture_tcp_flow_t *flow, struct timeval ts)
+{
+    flow->ts = ts;
+
+    if (reasm->newest == flow)
+        return;
+
+    // Remove from current position
+    if (flow->older)
+        flow->older->newer = flow->newer;
+    else if (reasm->oldest == flow)
+        reasm->oldest = flow->newer;
+    if (flow->newer)
+        flow->newer->older = flow->older;
+
+    // Add as newest flow
+    flow->newer = NULL;
+    flow->older = reasm->newest;
+    if (reasm->newest)
+        reasm->newest->newer = flow;
+    reasm->newest = flow;
+    if (!reasm->oldest)
+        reasm->oldest = flow;
+}
+
+/**
+ * @brief Add a new flow to TCP reassembly table
+ */
+static capture_tcp_flow_t *
+capture_tcp_reasm_add(capture_tcp_reasm_t *reasm, packet_t *pkt, uint32_t hash, uint32_t seq)
+{
+    capture_tcp_flow_t *flow = sng_malloc(sizeof(capture_tcp_flow_t));
+    capture_tcp_flow_t **bucket = &reasm->buckets[hash & (CAPTURE_TCP_REASM_BUCKETS - 1)];
+
+    flow->pkt = pkt;
+    flow->hash = hash;
+    flow->seq = seq;
+
+    // Add to hash bucket
+    flow->next = *bucket;
+    *bucket = flow;
+
+    // Add to activity order list
+    capture_tcp_reasm_touch(reasm, flow, packet_time(pkt));
+
+    reasm->count++;
+    return flow;
+}
+
+/**
+ * @brief Remove a flow from TCP reassembly table
+ *
+ * Flow packet is not destroyed. Flow payload buffer is released unless it
+ * has been attached to the packet.
+ */
+static void
+capture_tcp_reasm_remove(capture_tcp_reasm_t *reasm, capture_tcp_flow_t *flow)
+{
+    capture_tcp_flow_t **bucket = &reasm->buckets[flow->hash & (CAPTURE_TCP_REASM_BUCKETS - 1)];
+    capture_tcp_segment_t *segment;
+
+    // Remove from hash bucket
+    while (*bucket != flow)
+        bucket = &(*bucket)->next;
+    *bucket = flow->next;
+
+    // Remove from activity order list
+    if (flow->older)
+        flow->older->newer = flow->newer;
+    else
+        reasm->oldest = flow->newer;
+    if (flow->newer)
+        flow->newer->older = flow->older;
+    else
+        reasm->newest = flow->older;
+
+    // Remove segments after sequence gaps
+    while ((segment = flow->segments)) {
+        flow->segments = segment->next;
+        sng_free(segment);
+    }
+
+    // Packet payload must not point to flow buffer anymore
+    if (flow->data && packet_payload(flow->pkt) == flow->data)
+        packet_set_payload(flow->pkt, NULL, 0);
+
+    reasm->bytes -= flow->len + flow->segments_len;
+    memstat_add(MEMSTAT_REASM, -(int64_t) (flow->len + flow->segments_len));
+    reasm->count--;
+    sng_free(flow->data);
+    sng_free(flow);
+}
+
+/**
+ * @brief Discard incomplete flows from TCP reassembly table
+ *
+ * Remove flows without segments for more than configured timeout and
+ * least recently updated flows until there is memory for incoming payload.
+ *
+ * @param reasm TCP reassembly table
+ * @param now Capture time of the incoming segment
+ * @param bytes Payload bytes of the incoming segment
+ */
+static void
+capture_tcp_reasm_expire(capture_tcp_reasm_t *reasm, struct timeval now, uint32_t bytes)
+{
+    capture_tcp_flow_t *oldest;
 
-    while ((pkt = vector_iterator_next(&it))) {
-        if (addressport_equals(pkt->src, packet->src) &&
-                addressport_equals(pkt->dst, packet->dst)) {
+    while ((oldest = reasm->oldest)) {
+        if (now.tv_sec - oldest->ts.tv_sec > capture_cfg.tcp_reasm_timeout) {
+            reasm->expired++;
+        } else if (reasm->bytes + bytes > capture_cfg.tcp_reasm_memory) {
+            reasm->evicted++;
+        } else {
             break;
         }
+        packet_destroy(oldest->pkt);
+        capture_tcp_reasm_remove(reasm, oldest);
     }
+}
 
-    // If we already have this packet stored
-    if (pkt) {
-        frame_t *frame;
-        // Append this frames to the original packet
-        vector_iter_t frames = vector_iterator(packet->frames);
-        while ((frame = vector_iterator_next(&frames)))
-            packet_add_frame(pkt, frame->header, frame->data);
-        // Destroy current packet as its frames belong to the stored packet
-        packet_destroy(packet);
-    } else {
-        // First time this packet has been seen
-        pkt = packet;
-        // Add To the possible reassembly list
-        vector_append(capinfo->tcp_reasm, packet);
+/**
+ * @brief Append payload at the end of flow assembled data
+ *
+ * Assembled buffer size is doubled when there is no room left
+ */
+static void
+capture_tcp_flow_append(capture_tcp_reasm_t *reasm, capture_tcp_flow_t *flow, const u_char *data, uint32_t len)
+{
+    uint32_t size = (flow->size) ? flow->size : CAPTURE_TCP_FLOW_SIZE;
+
+    while (size < flow->len + len + 1)
+        size *= 2;
+
+    if (size != flow->size) {
+        flow->data = realloc(flow->data, size);
+        flow->size = size;
     }
 
-    // Store firt tcp sequence
-    if (pkt->tcp_seq == 0) {
-        pkt->tcp_seq = ntohl(tcp->th_seq);
+    memcpy(flow->data + flow->len, data, len);
+    flow->len += len;
+    flow->data[flow->len] = '\0';
+    reasm->bytes += len;
+    memstat_add(MEMSTAT_REASM, len);
+}
+
+/**
+ * @brief Add a segment payload to the flow
+ *
+ * Payload is added to the assembled data if it follows its last byte
+ * (or precedes its first byte). Payload after a sequence gap is stored
+ * until the missing segments are received.
+ *
+ * @return false if the flow exceeds the allowed size, true otherwise
+ */
+static bool
+capture_tcp_flow_add(capture_tcp_reasm_t *reasm, capture_tcp_flow_t *flow, uint32_t seq, const u_char *data, uint32_t len)
+{
+    capture_tcp_segment_t *segment, **pos;
+    uint32_t end = flow->seq + flow->len;
+    int32_t diff;
+
+    // Check payload length. Dont handle too big payload packets
+    if (flow->len + flow->segments_len + len > MAX_CAPTURE_LEN)
+        return false;
+
+    if ((int32_t) (seq - flow->seq) < 0) {
+        // Segment ends before assembled data: already parsed data
+        if ((int32_t) (seq + len - flow->seq) < 0)
+            return true;
+
+        // Prepend missing payload to the assembled data
+        diff = flow->seq - seq;
+        capture_tcp_flow_append(reasm, flow, data, diff);
+        memmove(flow->data + diff, flow->data, flow->len - diff);
+        memcpy(flow->data, data, diff);
+        flow->data[flow->len] = '\0';
+        flow->seq = seq;
+        return true;
     }
 
-    // If the first frame of this packet
-    if (vector_count(pkt->frames) == 1) {
-        // Set initial payload
-        packet_set_payload(pkt, payload, size_payload);
-    } else {
-        // Check payload length. Dont handle too big payload packets
-        if (pkt->payload_len + size_payload > MAX_CAPTURE_LEN) {
-            packet_destroy(pkt);
-            vector_remove(capinfo->tcp_reasm, pkt);
-            return NULL;
+    if ((int32_t) (seq - end) > 0) {
+        // Store segment after gap in sequence order (ignore duplicates)
+        for (pos = &flow->segments; *pos && (int32_t) ((*pos)->seq - seq) < 0; pos = &(*pos)->next);
+        if (*pos && (*pos)->seq == seq)
+            return true;
+        segment = sng_malloc(sizeof(capture_tcp_segment_t) + len);
+        segment->seq = seq;
+        segment->len = len;
+        memcpy(segment->data, data, len);
+        segment->next = *pos;
+        *pos = segment;
+        flow->segments_len += len;
+        reasm->bytes += len;
+        memstat_add(MEMSTAT_REASM, len);
+        return true;
+    }
+
+    // Append payload not already assembled (retransmissions can overlap)
+    diff = end - seq;
+    if ((uint32_t) diff < len)
+        capture_tcp_flow_append(reasm, flow, data + diff, len - diff);
+
+    // Append stored segments that are no longer after a gap
+    while ((segment = flow->segments) && (int32_t) (segment->seq - (flow->seq + flow->len)) <= 0) {
+        flow->segments = segment->next;
+        flow->segments_len -= segment->len;
+        reasm->bytes -= segment->len;
+        memstat_add(MEMSTAT_REASM, -(int64_t) segment->len);
+        diff = flow->seq + flow->len - segment->seq;
+        if ((uint32_t) diff < segment->len)
+            capture_tcp_flow_append(reasm, flow, segment->data + diff, segment->len - diff);
+        sng_free(segment);
+    }
+
+    return true;
+}
+
+capture_tcp_reasm_t *
+capture_tcp_reasm_create()
+{
+    return sng_malloc(sizeof(capture_tcp_reasm_t));
+}
+
+void
+capture_tcp_reasm_destroy(capture_tcp_reasm_t *reasm)
+{
+    packet_t *pkt;
+
+    if (!reasm)
+        return;
+
+    while (reasm->oldest) {
+        pkt = reasm->oldest->pkt;
+        capture_tcp_reasm_remove(reasm, reasm->oldest);
+        packet_destroy(pkt);
+    }
+    sng_free(reasm);
+}
+
+void
+capture_tcp_reasm_stats(uint32_t *pending, uint64_t *expired, uint64_t *evicted)
+{
+    capture_info_t *capinfo;
+
+    *pending = 0;
+    *expired = 0;
+    *evicted = 0;
+
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->tcp_reasm) {
+            *pending += capinfo->tcp_reasm->count;
+            *expired += capinfo->tcp_reasm->expired;
+            *evicted += capinfo->tcp_reasm->evicted;
         }
-        new_payload = sng_malloc(pkt->payload_len + size_payload);
-        if (pkt->tcp_seq < ntohl(tcp->th_seq)) {
-            // Append payload to the existing
-            pkt->tcp_seq =  ntohl(tcp->th_seq);
-            memcpy(new_payload, pkt->payload, pkt->payload_len);
-            memcpy(new_payload + pkt->payload_len, payload, size_payload);
-        } else {
-            // Prepend payload to the existing
-            memcpy(new_payload, payload, size_payload);
-            memcpy(new_payload + size_payload, pkt->payload, pkt->payload_len);
+    }
+}
+
+/**
+ * @brief Check if a packet contains a full SIP message measuring its time
+ */
+static int
+capture_sip_validate(packet_t *packet)
+{
+    uint64_t start = metrics_timing_start();
+    int valid = sip_validate_packet(packet);
+    metrics_timing_end(METRICS_STAGE_SIP_VALIDATE, start);
+    return valid;
+}
+
+packet_t *
+capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphdr *tcp, u_char *payload, int size_payload) {
+
+    capture_tcp_reasm_t *reasm = capinfo->tcp_reasm;
+    capture_tcp_flow_t *flow;
+    packet_t *pkt, *cont;
+    uint32_t seq = ntohl(tcp->th_seq);
+    uint32_t hash;
+    int valid;
+
+    //! Assembled
+    if ((int32_t) size_payload <= 0)
+        return packet;
+
+    // Discard incomplete flows that won't be completed
+    capture_tcp_reasm_expire(reasm, packet_time(packet), size_payload);
+
+    hash = capture_tcp_reasm_hash(packet->src, packet->dst);
+
+    // First segment of a message: most of them can be parsed directly from frame data
+    if (!(flow = capture_tcp_reasm_find(reasm, packet, hash))) {
+        // Store firt tcp sequence
+        packet->tcp_seq = seq;
+
+        valid = capture_sip_validate(packet);
+        if (valid == VALIDATE_COMPLETE_SIP) {
+            // Full SIP packet!
+            return packet;
+        } else if (valid == VALIDATE_MULTIPLE_SIP) {
+            // We have a full SIP Packet, keep the rest of the payload for next segments
+            cont = packet_clone(packet);
+            flow = capture_tcp_reasm_add(reasm, cont, hash, seq + packet->payload_len);
+            capture_tcp_flow_append(reasm, flow, payload + packet->payload_len, size_payload - packet->payload_len);
+            packet_attach_payload(cont, flow->data, flow->len, false);
+            // Return the full initial packet
+            return packet;
+        } else if (valid == VALIDATE_NOT_SIP && (tcp->th_flags & TH_PUSH)) {
+            // Not a SIP packet, nothing more to wait for
+            return packet;
         }
-        packet_set_payload(pkt, new_payload, pkt->payload_len + size_payload);
-        sng_free(new_payload);
+
+        // Add To the possible reassembly list
+        flow = capture_tcp_reasm_add(reasm, packet, hash, seq);
+        capture_tcp_flow_append(reasm, flow, payload, size_payload);
+        packet_attach_payload(packet, flow->data, flow->len, false);
+        return NULL;
     }
 
-    // Check if packet is too large after assembly
-    if (pkt->payload_len > MAX_CAPTURE_LEN) {
-        vector_remove(capinfo->tcp_reasm, pkt);
+    // Append this frames to the original packet
+    pkt = flow->pkt;
+    packet_move_frames(pkt, packet);
+    // Destroy current packet as its frames belong to the stored packet
+    packet_destroy(packet);
+    capture_tcp_reasm_touch(reasm, flow, packet_time(pkt));
+
+    // Add segment payload to the assembled data
+    if (!capture_tcp_flow_add(reasm, flow, seq, payload, size_payload)) {
+        capture_tcp_reasm_remove(reasm, flow);
+        packet_destroy(pkt);
         return NULL;
     }
 
-    // Store full payload content
-    memset(full_payload, 0, MAX_CAPTURE_LEN);
-    memcpy(full_payload, pkt->payload, pkt->payload_len);
+    // Wait until missing segments are received
+    if (flow->segments) {
+        packet_attach_payload(pkt, flow->data, flow->len, false);
+        return NULL;
+    }
 
     // This packet is ready to be parsed
-    int original_size = pkt->payload_len;
-    int valid = sip_validate_packet(pkt);
-    if (valid == VALIDATE_COMPLETE_SIP) {
-        // Full SIP packet!
-        vector_remove(capinfo->tcp_reasm, pkt);
+    packet_attach_payload(pkt, flow->data, flow->len, false);
+    valid = capture_sip_validate(pkt);
+    if (valid == VALIDATE_COMPLETE_SIP
+            || (valid == VALIDATE_NOT_SIP && (tcp->th_flags & TH_PUSH))) {
+        // Full SIP packet (or not SIP at all)! Packet keeps assembled data
+        packet_attach_payload(pkt, flow->data, flow->len, true);
+        flow->data = NULL;
+        flow->len = flow->size = 0;
+        reasm->bytes -= packet_payloadlen(pkt);
+        memstat_add(MEMSTAT_REASM, -(int64_t) packet_payloadlen(pkt));
+        capture_tcp_reasm_remove(reasm, flow);
         return pkt;
     } else if (valid == VALIDATE_MULTIPLE_SIP) {
-        vector_remove(capinfo->tcp_reasm, pkt);
-
         // We have a full SIP Packet, but do not remove everything from the reasm queue
-        packet_t *cont = packet_clone(pkt);
-        int pldiff = original_size - pkt->payload_len;
-        if (pldiff > 0 && pldiff < MAX_CAPTURE_LEN) {
-            packet_set_payload(cont, full_payload + pkt->payload_len, pldiff);
-            vector_append(capinfo->tcp_reasm, cont);
-        }
+        uint32_t first = packet_payloadlen(pkt);
+        cont = packet_clone(pkt);
+        flow->pkt = cont;
+        memmove(flow->data, flow->data + first, flow->len - first);
+        flow->len -= first;
+        flow->data[flow->len] = '\0';
+        flow->seq += first;
+        reasm->bytes -= first;
+        memstat_add(MEMSTAT_REASM, -(int64_t) first);
+        packet_attach_payload(cont, flow->data, flow->len, false);
 
         // Return the full initial packet
         return pkt;
-    } else if (valid == VALIDATE_NOT_SIP) {
-        // Not a SIP packet, store until PSH flag
-        if (tcp->th_flags & TH_PUSH) {
-            vector_remove(capinfo->tcp_reasm, pkt);
-            return pkt;
-        }
     }
 
     // An incomplete SIP Packet
     return NULL;
 }
 
+/**
+ * @brief Unmask Websocket payload data while moving it
+ *
+ * Data is unmasked in 8 bytes words using the 4 bytes key twice. Source
+ * and destination may overlap as long as destination is not after source.
+ */
+static void
+capture_ws_unmask(u_char *dst, const u_char *src, uint64_t len, const u_char *key)
+{
+    uint64_t key64, word, i = 0;
+    uint32_t key32;
+
+    memcpy(&key32, key, sizeof(key32));
+    key64 = ((uint64_t) key32 << 32) | key32;
+
+    for (; i + sizeof(word) <= len; i += sizeof(word)) {
+        memcpy(&word, src + i, sizeof(word));
+        word ^= key64;
+        memcpy(dst + i, &word, sizeof(word));
+    }
+
+    for (; i < len; i++)
+        dst[i] = src[i] ^ key[i % 4];
+}
+
 int
-capture_ws_check_packet(packet_t *packet)
+capture_ws_check_packet(packet_t *packet, packet_t **next)
 {
-    int ws_off = 0;
-    u_char ws_opcode;
-    u_char ws_mask;
-    uint8_t ws_len;
+    u_char ws_opcode, ws_fin, ws_mask;
     u_char ws_mask_key[4];
-    u_char *payload, *newpayload;
-    uint32_t size_payload;
-    int i;
+    u_char *payload, *data;
+    uint64_t ws_len, size_payload, pos = 0, len = 0;
+    uint32_t ws_off;
+    bool started = false, owned;
 
     /**
      * WSocket header definition according to RFC 6455
@@ -897,71 +2022,104 @@ capture_ws_check_packet(packet_t *packet)
      *    +---------------------------------------------------------------+
      */
 
+    *next = NULL;
+
     // Get payload from packet(s)
     size_payload = packet_payloadlen(packet);
     payload = packet_payload(packet);
 
     // Check we have enough payload (base)
-    if (size_payload == 0 || size_payload <= 2)
+    if (size_payload <= 2)
         return 0;
 
-    // Flags && Opcode
-    ws_opcode = *payload & WH_OPCODE;
-    ws_off++;
-
     // Only interested in Ws text packets
-    if (ws_opcode != WS_OPCODE_TEXT)
+    if ((*payload & WH_OPCODE) != WS_OPCODE_TEXT)
         return 0;
 
-    // Masked flag && Payload len
-    ws_mask = (*(payload + ws_off) & WH_MASK) >> 4;
-    ws_len = (*(payload + ws_off) & WH_LEN);
-    ws_off++;
+    // Payload owned by the packet is unmasked in place, frame data is never modified
+    owned = !packet->payload_ref && !packet->arena;
+    data = payload;
 
-    // Skip Payload len
-    switch (ws_len) {
-            // Extended
-        case 126:
+    // Join the frames of the first message (fragments and control frames between them)
+    while (size_payload - pos > 2) {
+        // Flags && Opcode
+        ws_fin = payload[pos] & WH_FIN;
+        ws_opcode = payload[pos] & WH_OPCODE;
+
+        // Masked flag && Payload len
+        ws_mask = payload[pos + 1] & WH_MASK;
+        ws_len = payload[pos + 1] & WH_LEN;
+        ws_off = 2;
+
+        // Extended payload len
+        if (ws_len == 126) {
+            if (size_payload - pos < ws_off + 2)
+                break;
+            ws_len = ((uint64_t) payload[pos + 2] << 8) | payload[pos + 3];
             ws_off += 2;
+        } else if (ws_len == 127) {
+            if (size_payload - pos < ws_off + 8)
+                break;
+            for (ws_len = 0; ws_off < 10; ws_off++)
+                ws_len = (ws_len << 8) | payload[pos + ws_off];
+        }
+
+        // Get Masking key if mask is enabled
+        if (ws_mask) {
+            if (size_payload - pos < ws_off + 4)
+                break;
+            memcpy(ws_mask_key, payload + pos + ws_off, 4);
+            ws_off += 4;
+        }
+
+        // Message must start with a text frame followed by continuation frames
+        if ((!started && ws_opcode != WS_OPCODE_TEXT)
+                || (started && ws_opcode != WS_OPCODE_CONTINUATION && !(ws_opcode & WS_OPCODE_CONTROL)))
             break;
-        case 127:
-            ws_off += 8;
-            break;
-        default:
-            return 0;
-    }
 
-    // Check we have enough payload (base + extended payload headers)
-    if ((int32_t) size_payload - ws_off <= 0) {
-        return 0;
-    }
+        // Last frame is truncated, use the data we have
+        if (ws_len > size_payload - pos - ws_off) {
+            ws_len = size_payload - pos - ws_off;
+            ws_fin = WH_FIN;
+        }
 
-    // Get Masking key if mask is enabled
-    if (ws_mask) {
-        // Check we have enough payload (base + extended payload headers + mask)
-        if ((int32_t) size_payload - ws_off - 4 <= 0) {
+        // First frame of a message stored in frame data, allocate the joined payload
+        if (!started && !owned && !(data = sng_malloc(size_payload + 1)))
             return 0;
+        started = true;
+
+        // Append data frames payload (unmasked if required)
+        if (!(ws_opcode & WS_OPCODE_CONTROL)) {
+            if (ws_mask) {
+                capture_ws_unmask(data + len, payload + pos + ws_off, ws_len, ws_mask_key);
+            } else {
+                memmove(data + len, payload + pos + ws_off, ws_len);
+            }
+            len += ws_len;
         }
-        memcpy(ws_mask_key, (payload + ws_off), 4);
-        ws_off += 4;
+        pos += ws_off + ws_len;
+
+        // Message is complete
+        if (ws_fin && !(ws_opcode & WS_OPCODE_CONTROL))
+            break;
     }
 
-    // Skip Websocket headers
-    size_payload -= ws_off;
-    if ((int32_t) size_payload <= 0)
+    // Not a Websocket message
+    if (!started || len == 0) {
+        if (data != payload)
+            sng_free(data);
         return 0;
+    }
 
-    newpayload = sng_malloc(size_payload);
-    memcpy(newpayload, payload + ws_off, size_payload);
-    // If mask is enabled, unmask the payload
-    if (ws_mask) {
-        for (i = 0; i < size_payload; i++)
-            newpayload[i] = newpayload[i] ^ ws_mask_key[i % 4];
+    // Following messages in the same payload are parsed in another packet
+    if (pos < size_payload) {
+        *next = packet_clone(packet);
+        packet_set_payload(*next, payload + pos, size_payload - pos);
     }
-    // Set new packet payload into the packet
-    packet_set_payload(packet, newpayload, size_payload);
-    // Free the new payload
-    sng_free(newpayload);
+
+    // Set joined messages payload into the packet
+    data[len] = '\0';
+    packet_attach_payload(packet, data, len, true);
 
     if (packet->type == PACKET_SIP_TLS) {
         packet_set_type(packet, PACKET_SIP_WSS);
@@ -972,28 +2130,99 @@ capture_ws_check_packet(packet_t *packet)
 }
 
 
-int
-capture_packet_parse(packet_t *packet)
-{
-    // Media structure for RTP packets
+/**
+ * @brief Check if full RTP packets of a call must be stored
+ *
+ * Pattern match result is cached in the call, so only its first
+ * message is checked.
+ */
+static bool
+capture_rtp_store_full(sip_call_t *call)
+{
+    sip_msg_t *msg;
+    const char *payload;
+
+    if (!capture_cfg.rtp_headers || CALL_SLOT(call, locked))
+        return true;
+
+    if (call->rtp_store == -1) {
+        call->rtp_store = capture_cfg.rtp_match
+                          && (msg = vector_first(call->msgs))
+                          && (payload = msg_get_payload(msg))
+                          && match_set_check(capture_cfg.rtp_match, payload);
+    }
+
+    return call->rtp_store;
+}
+
+/**
+ * @brief Check a SIP packet measuring its parse time
+ */
+static sip_msg_t *
+capture_sip_check(packet_t *packet)
+{
+    uint64_t start = metrics_timing_start();
+    sip_msg_t *msg = sip_check_packet(packet);
+    metrics_timing_end(METRICS_STAGE_SIP_CHECK, start);
+    return msg;
+}
+
+/**
+ * @brief Check a RTP packet measuring its parse time
+ */
+static rtp_stream_t *
+capture_rtp_check(packet_t *packet)
+{
+    uint64_t start = metrics_timing_start();
+    rtp_stream_t *stream = rtp_check_packet(packet);
+    metrics_timing_end(METRICS_STAGE_RTP_CHECK, start);
+    return stream;
+}
+
+int
+capture_packet_parse(packet_t *packet)
+{
+    // Media structure for RTP packets
     rtp_stream_t *stream;
 
+#ifdef USE_EEP
+    // Records received from probes update already stored calls
+    if (packet->type == PACKET_PROBE)
+        return capture_probe_apply(packet);
+#endif
+
     // We're only interested in packets with payload
     if (packet_payloadlen(packet)) {
-        // Parse this header and payload
-        if (sip_check_packet(packet)) {
+        // Only payloads starting with a SIP request or response line are
+        // parsed, media packets never match it and go straight to RTP
+        if (sip_scan_is_sip((const char *) packet_payload(packet)) && capture_sip_check(packet)) {
             return 0;
         }
 
         // Check if this packet belongs to a RTP stream
-        if ((stream = rtp_check_packet(packet))) {
+        if ((stream = capture_rtp_check(packet))) {
             // We have an RTP packet!
             packet_set_type(packet, PACKET_RTP);
+            // Keep this stream in capture filter
+            capture_filter_add_port(packet->dst.port, packet_time(packet).tv_sec);
             // Store this pacekt if capture rtp is enabled
             if (capture_cfg.rtp_capture) {
+                // Stream counters are updated, but only some packets are stored
+                if (capture_cfg.overload != CAPTURE_OVERLOAD_NONE
+                    && stream_get_count(stream) % capture_cfg.overload_sample != 0) {
+                    capture_cfg.overload_shed++;
+                    return 1;
+                }
+                // Packet memory is released, only its header is kept in the stream
+                if (!capture_rtp_store_full(stream_get_call(stream))) {
+                    return (stream_add_header(stream, packet) == 0) ? 2 : 1;
+                }
                 call_add_rtp_packet(stream_get_call(stream), packet);
                 return 0;
             }
+        } else if (packet->source) {
+            // Neither SIP nor RTP. Packets can be parsed by SIP workers
+            __atomic_add_fetch(&packet->source->rejected, 1, __ATOMIC_RELAXED);
         }
     }
     return 1;
@@ -1003,15 +2232,21 @@ void
 capture_close()
 {
     capture_info_t *capinfo;
+    capture_tls_worker_t *tls_worker;
+    capture_tls_segment_t *tls_segment;
+    packet_t *pkt;
+    int i;
 
     // Nothing to close
     if (vector_count(capture_cfg.sources) == 0)
         return;
 
-    // Close dump file
-    if (capture_cfg.pd) {
-        dump_close(capture_cfg.pd);
-    }
+#ifdef HAVE_MMAP
+    // Save index of completely read files before unmapping them
+    pthread_mutex_lock(&capture_cfg.output_lock);
+    capture_mmap_index_save(capture_cfg.sources);
+    pthread_mutex_unlock(&capture_cfg.output_lock);
+#endif
 
     // Stop all captures
     vector_iter_t it = vector_iterator(capture_cfg.sources);
@@ -1030,39 +2265,809 @@ capture_close()
                 pthread_join(capinfo->capture_t, NULL);
             }
         }
+#ifdef USE_TPACKET
+        // Release AF_PACKET ring
+        capture_tpacket_close(capinfo);
+#endif
+#ifdef HAVE_MMAP
+        // Release mapped input file
+        capture_mmap_close(capinfo);
+#endif
+#ifdef USE_EEP
+        // Release EEP listener socket
+        capture_eep_close(capinfo);
+#endif
+#ifdef HAVE_SHM_OPEN
+        // Release attached daemon ring
+        capture_shm_close(capinfo);
+#endif
+        // Release benchmark preloaded packets
+        if (capinfo->bench) {
+            sng_free(capinfo->bench->data);
+            sng_free(capinfo->bench->headers);
+            sng_free(capinfo->bench->offsets);
+            sng_free(capinfo->bench);
+            capinfo->bench = NULL;
+        }
+    }
+
+    // Stop parser thread
+    if (capture_cfg.parsing) {
+        capture_cfg.parsing = false;
+        pthread_join(capture_cfg.parser_t, NULL);
+    }
+
+    // Stop SIP parsing workers
+    for (i = 0; i < capture_cfg.worker_count; i++) {
+        pthread_join(capture_cfg.workers[i].thread, NULL);
+        while ((pkt = queue_pop(capture_cfg.workers[i].queue)))
+            packet_destroy(pkt);
+        queue_destroy(capture_cfg.workers[i].queue);
+    }
+    sng_free(capture_cfg.workers);
+    capture_cfg.workers = NULL;
+    capture_cfg.worker_count = 0;
+
+    // Stop TLS decryption workers
+    for (i = 0; i < capture_cfg.tls_worker_count; i++) {
+        tls_worker = &capture_cfg.tls_workers[i];
+        pthread_join(tls_worker->thread, NULL);
+        while ((tls_segment = queue_pop(tls_worker->queue))) {
+            packet_destroy(tls_segment->pkt);
+            sng_free(tls_segment);
+        }
+        while ((pkt = queue_pop(tls_worker->output)))
+            packet_destroy(pkt);
+        queue_destroy(tls_worker->queue);
+        queue_destroy(tls_worker->output);
+        pthread_mutex_destroy(&tls_worker->lock);
+    }
+    sng_free(capture_cfg.tls_workers);
+    capture_cfg.tls_workers = NULL;
+    capture_cfg.tls_worker_count = 0;
+
+    // Write pending packets and close dump file
+    capture_dump_stop();
+
+    // Remove packets pending to be parsed
+    it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        // Remove datagrams pending IP and TCP reassembly
+        capture_ip_reasm_destroy(capinfo->ip_reasm);
+        capinfo->ip_reasm = NULL;
+        capture_tcp_reasm_destroy(capinfo->tcp_reasm);
+        capinfo->tcp_reasm = NULL;
+        if (!capinfo->queue)
+            continue;
+        while ((pkt = queue_pop(capinfo->queue)))
+            packet_destroy(pkt);
+    }
+
+}
+
+void
+capture_queue_packet(capture_info_t *capinfo, packet_t *pkt)
+{
+    while (!queue_push(capinfo->queue, pkt)) {
+        // Online captures must not wait for the parser
+        if (!capinfo->infile) {
+            capinfo->queue_drops++;
+            packet_destroy(pkt);
+            return;
+        }
+        // Wait until parser has room for more packets
+        usleep(CAPTURE_QUEUE_WAIT);
+    }
+}
+
+/**
+ * @brief Send, dump and store an already parsed packet
+ */
+static void
+capture_output_packet(packet_t *pkt)
+{
+    uint64_t start;
+
+    pthread_mutex_lock(&capture_cfg.output_lock);
+#ifdef USE_EEP
+    // Send this packet through eep
+    start = metrics_timing_start();
+    capture_eep_send(pkt);
+    metrics_timing_end(METRICS_STAGE_EEP_SEND, start);
+#endif
+    // Store this packets in output file
+    start = metrics_timing_start();
+    capture_dump_packet(pkt);
+    metrics_timing_end(METRICS_STAGE_DUMP, start);
+#ifdef HAVE_MMAP
+    // Remember stored frames position for next sessions
+    capture_mmap_index_packet(pkt);
+#endif
+    pthread_mutex_unlock(&capture_cfg.output_lock);
+
+    // If storage is disabled, delete frames payload
+    if (capture_cfg.storage == 0) {
+        packet_free_frames(pkt);
+    }
+}
+
+void
+capture_store_packet(packet_t *pkt)
+{
+    int ret;
+
+    // Check if we can handle this packet
+    if ((ret = capture_packet_parse(pkt)) == 0) {
+        capture_output_packet(pkt);
+        return;
+    }
+
+    // RTP packets with header stored are still sent and dumped
+    if (ret == 2) {
+        capture_output_packet(pkt);
+    }
+
+    // Not an interesting packet ...
+    packet_destroy(pkt);
+}
+
+/**
+ * @brief Check if all SIP parsing workers have empty queues
+ */
+static bool
+capture_workers_idle()
+{
+    int i;
+
+    for (i = 0; i < capture_cfg.worker_count; i++) {
+        if (__atomic_load_n(&capture_cfg.workers[i].parsed, __ATOMIC_ACQUIRE)
+            != capture_cfg.workers[i].queued)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Capture lock held by the parser thread for a batch of packets
+ */
+typedef struct capture_batch
+{
+    //! Capture is locked by this batch
+    bool locked;
+    //! Time when capture was locked
+    uint64_t start;
+} capture_batch_t;
+
+/**
+ * @brief Lock capture once for a batch of parsed packets
+ */
+static void
+capture_batch_lock(capture_batch_t *batch)
+{
+    if (batch->locked)
+        return;
+    capture_lock();
+    batch->locked = true;
+    batch->start = metrics_timing_start();
+}
+
+/**
+ * @brief Unlock capture after a batch of parsed packets
+ */
+static void
+capture_batch_unlock(capture_batch_t *batch)
+{
+    if (!batch->locked)
+        return;
+    metrics_timing_end(METRICS_STAGE_BATCH, batch->start);
+    capture_unlock();
+    batch->locked = false;
+}
+
+/**
+ * @brief Parse a packet or hand it to its call store shard worker
+ *
+ * Capture is kept locked between consecutive packets parsed by this
+ * thread, so it must be unlocked with capture_batch_unlock after the
+ * batch.
+ */
+static void
+capture_dispatch_packet(capture_info_t *capinfo, packet_t *pkt, capture_batch_t *batch)
+{
+    capture_worker_t *worker;
+    int shard;
+
+    // SIP packets are parsed by the worker of their Call-ID shard
+    if ((shard = sip_packet_shard(pkt)) >= 0) {
+        // Workers can not parse while capture is locked
+        capture_batch_unlock(batch);
+        worker = &capture_cfg.workers[shard];
+        while (!queue_push(worker->queue, pkt))
+            usleep(CAPTURE_QUEUE_WAIT);
+        worker->queued++;
+        return;
+    }
+
+    // Files are parsed in order: wait for SIP packets that may
+    // contain the SDP describing this RTP stream. No SIP packet has
+    // been handed to workers since capture was locked.
+    if (capinfo && capinfo->infile && !batch->locked) {
+        while (!capture_workers_idle())
+            sched_yield();
+    }
+
+    // Other packets can belong to any call
+    capture_batch_lock(batch);
+    capture_store_packet(pkt);
+}
+
+/**
+ * @brief Update load shedding level from online parser queues usage
+ *
+ * Offline sources are never shed: their capture threads wait for free
+ * space in the parser queue instead of dropping packets.
+ */
+static void
+capture_overload_update()
+{
+    capture_info_t *capinfo;
+    size_t usage = 0, count;
+
+    if (capture_cfg.overload_sample <= 1 || !capture_cfg.queue_size)
+        return;
+
+    // Get the most used online parser queue
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->queue && !capinfo->infile) {
+            count = queue_count(capinfo->queue) * 100 / capture_cfg.queue_size;
+            if (count > usage)
+                usage = count;
+        }
+    }
+
+    if (usage >= CAPTURE_OVERLOAD_HIGH) {
+        if (capture_cfg.overload == CAPTURE_OVERLOAD_NONE) {
+            capture_cfg.overload = CAPTURE_OVERLOAD_RTP;
+            capture_cfg.overload_start = time(NULL);
+        } else if (time(NULL) - capture_cfg.overload_start >= CAPTURE_OVERLOAD_SUSTAIN) {
+            capture_cfg.overload = CAPTURE_OVERLOAD_FILTER;
+        }
+    } else if (usage < CAPTURE_OVERLOAD_LOW) {
+        capture_cfg.overload = CAPTURE_OVERLOAD_NONE;
+    }
+}
+
+/**
+ * @brief Parse queued packets from offline sources in timestamp order
+ *
+ * Packets are only parsed while all unfinished offline sources have queued
+ * packets, so the oldest one is always known.
+ *
+ * @return number of parsed packets
+ */
+static int
+capture_parser_merge()
+{
+    capture_info_t *capinfo, *oldest;
+    capture_batch_t batch = { 0 };
+    packet_t *pkt, *first;
+    int parsed;
+
+    // Avoid parsing while screen in being redrawn
+    if (capture_cfg.worker_count <= 1)
+        capture_batch_lock(&batch);
+
+    for (parsed = 0; parsed < capture_cfg.batch; parsed++) {
+        oldest = NULL;
+        first = NULL;
+
+        vector_iter_t it = vector_iterator(capture_cfg.sources);
+        while ((capinfo = vector_iterator_next(&it))) {
+            if (!capinfo->infile || !capinfo->queue)
+                continue;
+
+            if (!(pkt = queue_peek(capinfo->queue))) {
+                // Wait for more packets from this source
+                if (!queue_finished(capinfo->queue))
+                    break;
+                continue;
+            }
+
+            if (!first || packet_time_ns(pkt) < packet_time_ns(first)) {
+                oldest = capinfo;
+                first = pkt;
+            }
+        }
+
+        // Some source is still reading or all packets have been parsed
+        if (capinfo || !oldest)
+            break;
+
+        queue_pop(oldest->queue);
+        if (capture_cfg.worker_count > 1) {
+            capture_dispatch_packet(oldest, first, &batch);
+        } else {
+            capture_store_packet(first);
+        }
     }
 
+    // Allow Interface refresh and user input actions
+    capture_batch_unlock(&batch);
+
+    return parsed;
+}
+
+/**
+ * @brief Check if packets of an online source are merged by timestamp
+ *
+ * HEP packets are timestamped by remote agents clocks, so they are
+ * always parsed in arrival order.
+ */
+static bool
+capture_source_merged(capture_info_t *capinfo)
+{
+    if (capinfo->infile || !capinfo->queue)
+        return false;
+#ifdef USE_EEP
+    if (capinfo->eep)
+        return false;
+#endif
+    return capture_cfg.reorder_window > 0;
+}
+
+/**
+ * @brief Parse queued packets from online sources in timestamp order
+ *
+ * The oldest queued packet is parsed when all online sources have queued
+ * packets or when it has waited the reorder window, so a source without
+ * traffic only delays the others for that window.
+ *
+ * @return number of parsed packets
+ */
+static int
+capture_parser_online_merge()
+{
+    capture_info_t *capinfo, *oldest;
+    capture_batch_t batch = { 0 };
+    packet_t *pkt, *first;
+    struct timespec now;
+    uint64_t now_ns;
+    bool waiting;
+    int parsed;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    now_ns = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+
+    for (parsed = 0; parsed < capture_cfg.batch; parsed++) {
+        oldest = NULL;
+        first = NULL;
+        waiting = false;
+
+        vector_iter_t it = vector_iterator(capture_cfg.sources);
+        while ((capinfo = vector_iterator_next(&it))) {
+            if (!capture_source_merged(capinfo))
+                continue;
+
+            if (!(pkt = queue_peek(capinfo->queue))) {
+                // This source may still capture older packets
+                if (!queue_finished(capinfo->queue))
+                    waiting = true;
+                continue;
+            }
+
+            if (!first || packet_time_ns(pkt) < packet_time_ns(first)) {
+                oldest = capinfo;
+                first = pkt;
+            }
+        }
+
+        // Nothing to parse or oldest packet is still inside reorder window
+        if (!oldest)
+            break;
+        if (waiting && packet_time_ns(first) + capture_cfg.reorder_window > now_ns)
+            break;
+
+        queue_pop(oldest->queue);
+        if (capture_cfg.worker_count > 1) {
+            capture_dispatch_packet(oldest, first, &batch);
+        } else {
+            // Avoid parsing while screen in being redrawn
+            capture_batch_lock(&batch);
+            capture_store_packet(first);
+        }
+    }
+
+    // Allow Interface refresh and user input actions
+    capture_batch_unlock(&batch);
+
+    return parsed;
+}
+
+/**
+ * @brief Parse queued packets from an online queue in arrival order
+ *
+ * @param capinfo Source of the queued packets or NULL for TLS workers output
+ * @param queue Online source or TLS worker output queue
+ * @return number of parsed packets
+ */
+static int
+capture_parser_online(capture_info_t *capinfo, queue_t *queue)
+{
+    capture_batch_t batch = { 0 };
+    packet_t *pkt;
+    int parsed = 0;
+
+    if (capture_cfg.worker_count > 1) {
+        // Distribute packets between SIP parsing workers
+        for (parsed = 0; parsed < capture_cfg.batch; parsed++) {
+            if (!(pkt = queue_pop(queue)))
+                break;
+            capture_dispatch_packet(capinfo, pkt, &batch);
+        }
+    } else if (queue_count(queue)) {
+        // Avoid parsing while screen in being redrawn
+        capture_batch_lock(&batch);
+        for (parsed = 0; parsed < capture_cfg.batch; parsed++) {
+            if (!(pkt = queue_pop(queue)))
+                break;
+            capture_store_packet(pkt);
+        }
+    }
+
+    // Allow Interface refresh and user input actions
+    capture_batch_unlock(&batch);
+
+    return parsed;
+}
+
+void *
+capture_parser_thread(void *none)
+{
+    capture_info_t *capinfo;
+    int i, total;
+
+    while (capture_cfg.parsing) {
+        total = 0;
+
+        vector_iter_t it = vector_iterator(capture_cfg.sources);
+        while ((capinfo = vector_iterator_next(&it))) {
+            // Source packets are not parsed by this thread
+            if (!capinfo->queue)
+                continue;
+
+            // Online sources packets are parsed in arrival order
+            if (!capinfo->infile && !capture_source_merged(capinfo))
+                total += capture_parser_online(capinfo, capinfo->queue);
+
+            // All packets from this source has been parsed
+            if (capinfo->running && queue_finished(capinfo->queue) && capture_workers_idle()) {
+                // Benchmark ends when all replayed packets have been parsed
+                if (capinfo->bench)
+                    clock_gettime(CLOCK_MONOTONIC, &capinfo->bench->end);
+                capinfo->running = false;
+            }
+        }
+
+        // Parse decrypted packets from TLS workers
+        for (i = 0; i < capture_cfg.tls_worker_count; i++)
+            total += capture_parser_online(NULL, capture_cfg.tls_workers[i].output);
+
+        // Parse packets from online and offline sources in timestamp order
+        total += capture_parser_online_merge();
+        total += capture_parser_merge();
+
+        // Add new media ports to capture filter
+        capture_filter_update();
+
+        // Compress calls that are no longer receiving packets
+        capture_storage_update();
+
+        // Remove dialogs idle for longer than their timeout
+        capture_expire_update();
+
+        // Save dialogs matching configured triggers
+        trigger_update();
+
+        // Start or stop shedding load depending on queues usage
+        capture_overload_update();
+
+        // Nothing to parse, wait for more packets
+        if (total == 0)
+            usleep(CAPTURE_QUEUE_WAIT);
+    }
+
+    return NULL;
+}
+
+void *
+capture_worker_thread(void *info)
+{
+    capture_worker_t *worker = (capture_worker_t *) info;
+    packet_t *pkt;
+    uint64_t start;
+    int idle = 0, parsed;
+
+    while (capture_cfg.parsing) {
+        if (!(pkt = queue_pop(worker->queue))) {
+            // Parser thread may be waiting for this worker, dont sleep yet
+            if (idle++ < CAPTURE_WORKER_SPIN) {
+                sched_yield();
+            } else {
+                usleep(CAPTURE_QUEUE_WAIT);
+            }
+            continue;
+        }
+        idle = 0;
+
+        // Only calls from this worker shard are modified
+        // Shard is locked once for all queued packets of the batch
+        sip_calls_lock_shard(worker->id);
+        start = metrics_timing_start();
+        parsed = 0;
+        do {
+            if (capture_sip_check(pkt)) {
+                capture_output_packet(pkt);
+            } else {
+                packet_destroy(pkt);
+            }
+        } while (++parsed < capture_cfg.batch && (pkt = queue_pop(worker->queue)));
+        metrics_timing_end(METRICS_STAGE_BATCH, start);
+        sip_calls_unlock_shard(worker->id);
+
+        __atomic_add_fetch(&worker->parsed, parsed, __ATOMIC_RELEASE);
+    }
+
+    return NULL;
+}
+
+void *
+capture_tls_worker_thread(void *info)
+{
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    capture_tls_worker_t *worker = (capture_tls_worker_t *) info;
+    capture_tls_segment_t *segment;
+    packet_t *pkt, *next;
+    uint64_t start;
+    int idle = 0;
+
+    while (capture_cfg.parsing) {
+        if (!(segment = queue_pop(worker->queue))) {
+            if (idle++ < CAPTURE_WORKER_SPIN) {
+                sched_yield();
+            } else {
+                usleep(CAPTURE_QUEUE_WAIT);
+            }
+            continue;
+        }
+        idle = 0;
+
+        // Only connections from this worker partition are modified
+        pkt = segment->pkt;
+        start = metrics_timing_start();
+        tls_process_segment(pkt, &segment->tcp);
+        metrics_timing_end(METRICS_STAGE_TLS, start);
+        sng_free(segment);
+
+        // Check if packet is WS or WSS, each WS message is parsed as a packet
+        do {
+            capture_ws_check_packet(pkt, &next);
+
+            // Wait for the parser thread to make room for decrypted packets
+            while (!queue_push(worker->output, pkt)) {
+                if (!capture_cfg.parsing) {
+                    packet_destroy(pkt);
+                    break;
+                }
+                usleep(CAPTURE_QUEUE_WAIT);
+            }
+        } while ((pkt = next));
+    }
+#endif
+
+    return NULL;
+}
+
+void
+capture_queue_stats(uint32_t *depth, uint64_t *drops)
+{
+    capture_info_t *capinfo;
+
+    *depth = 0;
+    *drops = 0;
+
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->queue) {
+            *depth += queue_count(capinfo->queue);
+            *drops += capinfo->queue_drops;
+        }
+    }
+}
+
+const char *
+capture_source_stats(int index, capture_stats_t *stats)
+{
+    capture_info_t *capinfo;
+
+    memset(stats, 0, sizeof(capture_stats_t));
+
+    if (!(capinfo = vector_item(capture_cfg.sources, index)))
+        return NULL;
+
+    stats->received = capinfo->received;
+    stats->queue_drops = capinfo->queue_drops;
+    stats->rejected = __atomic_load_n(&capinfo->rejected, __ATOMIC_RELAXED);
+    stats->skipped = capinfo->skipped;
+
+    if (capinfo->ip_reasm)
+        stats->reasm_drops += capinfo->ip_reasm->expired + capinfo->ip_reasm->evicted;
+    if (capinfo->tcp_reasm)
+        stats->reasm_drops += capinfo->tcp_reasm->expired + capinfo->tcp_reasm->evicted;
+
+    // Files have no kernel counters
+    if (capinfo->infile)
+        return capinfo->infile;
+
+#ifdef USE_TPACKET
+    if (capinfo->tpacket) {
+        stats->kernel_drops = capture_tpacket_drops(capinfo);
+        return capinfo->device;
+    }
+#endif
+
+#ifdef USE_EEP
+    if (capinfo->eep) {
+        stats->kernel_drops = capture_eep_drops(capinfo);
+        return capinfo->device;
+    }
+#endif
+
+#ifdef HAVE_SHM_OPEN
+    // Frames overwritten by the daemon before being read
+    if (capinfo->shm) {
+        stats->kernel_drops = capture_shm_drops(capinfo);
+        return capinfo->device;
+    }
+#endif
+
+    stats->kernel_drops = __atomic_load_n(&capinfo->kernel_drops, __ATOMIC_RELAXED);
+    stats->if_drops = __atomic_load_n(&capinfo->if_drops, __ATOMIC_RELAXED);
+
+    return capinfo->device;
 }
 
 int
 capture_launch_thread(capture_info_t *capinfo)
 {
-    //! capture thread attributes
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
+    //! thread names
+    char name[THREAD_NAME_MAXLEN];
+    capture_worker_t *worker;
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    capture_tls_worker_t *tls_worker;
+    int count;
+#endif
+    int i;
+
+    // Start parser thread
+    capture_cfg.parsing = true;
+    if (thread_create(&capture_cfg.parser_t, THREAD_PARSER, "sng-parser", capture_parser_thread, NULL)) {
+        capture_cfg.parsing = false;
+        return 1;
+    }
+
+    // Start one SIP parsing worker per call store shard
+    if (sip_calls_shard_count() > 1) {
+        capture_cfg.workers = sng_malloc(sizeof(capture_worker_t) * sip_calls_shard_count());
+        for (i = 0; i < sip_calls_shard_count(); i++) {
+            worker = &capture_cfg.workers[i];
+            worker->id = i;
+            worker->queue = queue_create(capture_cfg.queue_size);
+            // Thread names are truncated by the system, keep indexes short
+            snprintf(name, sizeof(name), "sng-worker/%u", (unsigned) i % 10000);
+            if (thread_create(&worker->thread, THREAD_WORKER, name, capture_worker_thread, worker)) {
+                queue_destroy(worker->queue);
+                break;
+            }
+            capture_cfg.worker_count++;
+        }
+    }
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // Start one TLS decryption worker per connections table partition
+    count = setting_get_intvalue(SETTING_CAPTURE_TLS_WORKERS);
+    if (count > CAPTURE_TLS_WORKERS_MAX)
+        count = CAPTURE_TLS_WORKERS_MAX;
+    if (capture_cfg.keyfile && count > 0 && tls_set_partitions(count) == 0) {
+        capture_cfg.tls_workers = sng_malloc(sizeof(capture_tls_worker_t) * count);
+        for (i = 0; i < count; i++) {
+            tls_worker = &capture_cfg.tls_workers[i];
+            tls_worker->id = i;
+            tls_worker->queue = queue_create(capture_cfg.queue_size);
+            tls_worker->output = queue_create(capture_cfg.queue_size);
+            pthread_mutex_init(&tls_worker->lock, NULL);
+            snprintf(name, sizeof(name), "sng-tls/%u", (unsigned) i % 10000);
+            if (thread_create(&tls_worker->thread, THREAD_WORKER, name, capture_tls_worker_thread, tls_worker)) {
+                queue_destroy(tls_worker->queue);
+                queue_destroy(tls_worker->output);
+                pthread_mutex_destroy(&tls_worker->lock);
+                break;
+            }
+            capture_cfg.tls_worker_count++;
+        }
+    }
+#endif
 
     // Start all captures threads
+    i = 0;
     vector_iter_t it = vector_iterator(capture_cfg.sources);
     while ((capinfo = vector_iterator_next(&it))) {
         // Mark capture as running
         capinfo->running = true;
-        if (pthread_create(&capinfo->capture_t, &attr, (void *) capinfo->capture_fn, capinfo)) {
+        snprintf(name, sizeof(name), "sng-capture/%u", (unsigned) i++ % 1000);
+        if (thread_create(&capinfo->capture_t, THREAD_CAPTURE, name, capinfo->capture_fn, capinfo)) {
             return 1;
         }
     }
 
-    pthread_attr_destroy(&attr);
     return 0;
 }
 
+/**
+ * @brief Publish libpcap drop counters of an online source
+ *
+ * Counters are requested from the capture thread, pcap handles are not
+ * safe to be used from other threads while capturing.
+ */
+static void
+capture_pcap_stats(capture_info_t *capinfo)
+{
+    struct pcap_stat ps;
+
+    if (pcap_stats(capinfo->handle, &ps) != 0)
+        return;
+
+    __atomic_store_n(&capinfo->kernel_drops, ps.ps_drop, __ATOMIC_RELAXED);
+    __atomic_store_n(&capinfo->if_drops, ps.ps_ifdrop, __ATOMIC_RELAXED);
+}
+
 void *
 capture_thread(void *info)
 {
     capture_info_t *capinfo = (capture_info_t *) info;
-
+    unsigned dispatches = 0;
+    int count;
+
+#ifdef HAVE_MMAP
+    // Read uncompressed files directly from memory
+    if (setting_enabled(SETTING_CAPTURE_OFFLINE_MMAP) && capture_mmap_open(capinfo) == 0) {
+        capture_mmap_loop(capinfo);
+    } else
+#endif
     // Parse available packets
-    pcap_loop(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
-    capinfo->running = false;
+    if (capinfo->infile_end) {
+        // Parse packets until the end of this file chunk
+        struct pcap_pkthdr *header;
+        const u_char *data;
+        while (ftell(pcap_file(capinfo->handle)) < capinfo->infile_end
+                && pcap_next_ex(capinfo->handle, &header, &data) == 1) {
+            parse_packet((u_char *) capinfo, header, data);
+        }
+    } else if (capinfo->infile) {
+        pcap_loop(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
+    } else {
+        // Read packets until timeout so media ports filter can be updated
+        do {
+            capture_filter_install(capinfo);
+            count = pcap_dispatch(capinfo->handle, -1, parse_packet, (u_char *) capinfo);
+            // Update drop counters on timeouts and periodically under load
+            if (count == 0 || ++dispatches % CAPTURE_STATS_DISPATCHES == 0)
+                capture_pcap_stats(capinfo);
+        } while (count >= 0);
+    }
+
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
 
     return NULL;
 }
@@ -1103,6 +3108,21 @@ capture_set_bpf_filter(const char *filter)
         if (pcap_compile(capinfo->handle, &capture_cfg.fp, filter, 0, capinfo->mask) == -1)
             return 1;
 
+#ifdef USE_TPACKET
+        // Attach filter to AF_PACKET socket
+        if (capinfo->tpacket) {
+            if (capture_tpacket_set_filter(capinfo, &capture_cfg.fp) != 0)
+                return 1;
+            continue;
+        }
+#endif
+
+#ifdef HAVE_SHM_OPEN
+        // Filter is applied to each frame read from the ring
+        if (capinfo->shm)
+            continue;
+#endif
+
         // Set capture filter
         if (pcap_setfilter(capinfo->handle, &capture_cfg.fp) == -1)
             return 1;
@@ -1115,12 +3135,153 @@ capture_set_bpf_filter(const char *filter)
     return 0;
 }
 
+void
+capture_filter_add_port(uint16_t port, time_t ts)
+{
+    if (!capture_cfg.filter_ports || capture_cfg.filter_ports[port] == ts)
+        return;
+
+    pthread_mutex_lock(&capture_cfg.filter_lock);
+    if (!capture_cfg.filter_ports[port])
+        capture_cfg.filter_changed = true;
+    if (ts > capture_cfg.filter_ports[port])
+        capture_cfg.filter_ports[port] = ts;
+    pthread_mutex_unlock(&capture_cfg.filter_lock);
+}
+
+/**
+ * @brief Build capture filter expression with current media ports
+ *
+ * Consecutive ports are added as ranges. If there are too many ranges
+ * the nearest ones are merged, so filter can still be compiled.
+ */
+static void
+capture_filter_build(char *filter, size_t len, time_t now)
+{
+    uint16_t first[CAPTURE_FILTER_MAX_RANGES], last[CAPTURE_FILTER_MAX_RANGES];
+    uint32_t port, gap = 1;
+    int count, i;
+    size_t pos;
+
+    do {
+        count = 0;
+        for (port = 1; port <= UINT16_MAX; port++) {
+            if (!capture_cfg.filter_ports[port])
+                continue;
+
+            // Remove ports without SDP or RTP for a while
+            if (capture_cfg.filter_ports[port] + CAPTURE_FILTER_PORT_TIMEOUT < now) {
+                capture_cfg.filter_ports[port] = 0;
+                continue;
+            }
+
+            if (count && port - last[count - 1] <= gap) {
+                last[count - 1] = port;
+            } else if (count < CAPTURE_FILTER_MAX_RANGES) {
+                first[count] = last[count] = port;
+                count++;
+            } else {
+                // Too many ranges, merge ports with bigger gaps
+                break;
+            }
+        }
+        gap *= 2;
+    } while (port <= UINT16_MAX);
+
+    pos = snprintf(filter, len, "(%s)", capture_cfg.filter);
+    for (i = 0; i < count && pos < len; i++) {
+        if (first[i] == last[i]) {
+            pos += snprintf(filter + pos, len - pos, " or udp port %d", first[i]);
+        } else {
+            pos += snprintf(filter + pos, len - pos, " or udp portrange %d-%d", first[i], last[i]);
+        }
+    }
+}
+
+void
+capture_filter_update()
+{
+    time_t now = time(NULL);
+
+    // Media ports are only added to user filter
+    if (!capture_cfg.filter_ports || !capture_cfg.filter)
+        return;
+
+    // Dont update the filter more than once per second
+    if (capture_cfg.filter_time == now)
+        return;
+
+    pthread_mutex_lock(&capture_cfg.filter_lock);
+    // Expire ports once in a while even if there are no new ports
+    if (!capture_cfg.filter_changed && capture_cfg.filter_time + CAPTURE_FILTER_PORT_TIMEOUT > now) {
+        pthread_mutex_unlock(&capture_cfg.filter_lock);
+        return;
+    }
+    capture_filter_build(capture_cfg.filter_pending, sizeof(capture_cfg.filter_pending), now);
+    capture_cfg.filter_changed = false;
+    capture_cfg.filter_time = now;
+    // Capture threads will install the new filter before their next read
+    __atomic_add_fetch(&capture_cfg.filter_version, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&capture_cfg.filter_lock);
+}
+
+void
+capture_filter_install(capture_info_t *capinfo)
+{
+    char filter[CAPTURE_FILTER_LEN];
+    struct bpf_program fp;
+    uint32_t version;
+
+    // No new filter since last install
+    version = __atomic_load_n(&capture_cfg.filter_version, __ATOMIC_ACQUIRE);
+    if (version == capinfo->filter_version)
+        return;
+
+    pthread_mutex_lock(&capture_cfg.filter_lock);
+    capinfo->filter_version = capture_cfg.filter_version;
+    snprintf(filter, sizeof(filter), "%s", capture_cfg.filter_pending);
+    pthread_mutex_unlock(&capture_cfg.filter_lock);
+
+    if (pcap_compile(capinfo->handle, &fp, filter, 1, capinfo->mask) == -1)
+        return;
+
+#ifdef USE_TPACKET
+    if (capinfo->tpacket) {
+        capture_tpacket_set_filter(capinfo, &fp);
+    } else
+#endif
+    pcap_setfilter(capinfo->handle, &fp);
+
+    pcap_freecode(&fp);
+}
+
+bool
+capture_packet_filter(const struct pcap_pkthdr *header, const u_char *packet)
+{
+    if (!capture_cfg.filter)
+        return true;
+    return pcap_offline_filter(&capture_cfg.fp, header, packet) != 0;
+}
+
 const char *
 capture_get_bpf_filter()
 {
     return capture_cfg.filter;
 }
 
+uint64_t
+capture_options_hash()
+{
+    char options[4096];
+    const char *filter = capture_get_bpf_filter();
+    const char *match = sip_get_match_expression();
+
+    snprintf(options, sizeof(options), "%s|%s|%d|%s|%s",
+             filter ? filter : "", match ? match : "", capture_cfg.rtp_capture,
+             setting_get_value(SETTING_SIP_CALLS), setting_get_value(SETTING_SIP_NOINCOMPLETE));
+    return hash_mem64(options, strlen(options));
+}
+
 
 void
 capture_set_paused(int pause)
@@ -1134,6 +3295,60 @@ capture_paused()
     return capture_cfg.paused;
 }
 
+enum capture_overload
+capture_overload_level()
+{
+    return capture_cfg.overload;
+}
+
+int
+capture_overload_sample()
+{
+    return capture_cfg.overload_sample;
+}
+
+void
+capture_storage_update()
+{
+    time_t now = time(NULL);
+
+    // Only compressed storage requires periodic updates
+    if (capture_cfg.storage != CAPTURE_STORAGE_COMPRESSED)
+        return;
+
+    if (capture_cfg.storage_time + STORAGE_UPDATE_INTERVAL > now)
+        return;
+    capture_cfg.storage_time = now;
+
+    // Stored calls can not be read while their frames are compressed
+    capture_lock();
+    storage_update();
+    capture_unlock();
+}
+
+void
+capture_expire_update()
+{
+    time_t now = time(NULL);
+
+    if (!sip_calls_expire_enabled())
+        return;
+
+    if (capture_cfg.expire_time >= now)
+        return;
+    capture_cfg.expire_time = now;
+
+    capture_lock();
+    sip_calls_expire(now);
+    capture_unlock();
+}
+
+enum capture_storage
+capture_storage()
+{
+    return capture_cfg.storage;
+}
+
 const char *
 capture_status_desc()
 {
@@ -1187,12 +3402,37 @@ capture_status_desc()
     }
 }
 
+/**
+ * @brief Check if all sources are chunks of the same input file
+ *
+ * @return true if there is only one input, even if split in several sources
+ */
+static bool
+capture_single_input()
+{
+    capture_info_t *capinfo, *first = vector_first(capture_cfg.sources);
+
+    if (vector_count(capture_cfg.sources) == 1)
+        return true;
+
+    if (!first || !first->infile)
+        return false;
+
+    vector_iter_t it = vector_iterator(capture_cfg.sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (!capinfo->infile || strcmp(capinfo->infile, first->infile) != 0)
+            return false;
+    }
+
+    return true;
+}
+
 const char*
 capture_input_file()
 {
     capture_info_t *capinfo;
 
-    if (vector_count(capture_cfg.sources) == 1) {
+    if (capture_single_input()) {
         capinfo = vector_first(capture_cfg.sources);
         if (capinfo->infile) {
             return sng_basename(capinfo->infile);
@@ -1239,6 +3479,8 @@ capture_tls_server()
 void
 capture_add_source(struct capture_info *capinfo)
 {
+    // Create queue for packets pending to be parsed
+    capinfo->queue = queue_create(capture_cfg.queue_size);
     vector_append(capture_cfg.sources, capinfo);
 }
 
@@ -1263,13 +3505,19 @@ capture_last_error()
 void
 capture_lock()
 {
+    uint64_t start = metrics_timing_start();
     // Avoid parsing more packet
     pthread_mutex_lock(&capture_cfg.lock);
+    // Avoid parsing from SIP workers
+    sip_calls_lock();
+    metrics_timing_end(METRICS_STAGE_LOCK_WAIT, start);
 }
 
 void
 capture_unlock()
 {
+    // Allow parsing more packets from SIP workers
+    sip_calls_unlock();
     // Allow parsing more packets
     pthread_mutex_unlock(&capture_cfg.lock);
 }
@@ -1279,18 +3527,18 @@ capture_unlock()
 void
 capture_packet_time_sorter(vector_t *vector, void *item)
 {
-    struct timeval curts, prevts;
+    uint64_t curts, prevts;
     int count = vector_count(vector);
     int i;
 
     // TODO Implement multiframe packets
-    curts = packet_time(item);
+    curts = packet_time_ns(item);
 
     for (i = count - 2 ; i >= 0; i--) {
         // Get previous packet
-        prevts = packet_time(vector_item(vector, i));
+        prevts = packet_time_ns(vector_item(vector, i));
         // Check if the item is already in a sorted position
-        if (timeval_is_older(curts, prevts)) {
+        if (curts >= prevts) {
             vector_insert(vector, item, i + 1);
             return;
         }
@@ -1300,39 +3548,309 @@ capture_packet_time_sorter(vector_t *vector, void *item)
     vector_insert(vector, item, 0);
 }
 
-void
-capture_set_dumper(pcap_dumper_t *dumper, ino_t dump_inode)
+/**
+ * @brief Build the name of next dump file
+ *
+ * Expand dump file name format using given time. When rotating, a sequence
+ * number is added before the file extension to avoid overwriting existing
+ * files (i.e. when the format has no time conversions).
+ */
+static void
+capture_dump_filename(char *filename, size_t len, time_t ts, bool rotate)
 {
-    capture_cfg.pd = dumper;
-    capture_cfg.dump_inode = dump_inode;
+    char name[PATH_MAX];
+    const char *ext;
+    struct stat sb;
+    struct tm tm;
+
+    localtime_r(&ts, &tm);
+    if (strftime(name, sizeof(name), capture_cfg.dumpfmt, &tm) == 0)
+        snprintf(name, sizeof(name), "%s", capture_cfg.dumpfmt);
+
+    snprintf(filename, len, "%s", name);
+    if (!rotate)
+        return;
+
+    if (!(ext = strchr(sng_basename(name), '.')))
+        ext = name + strlen(name);
+
+    while (stat(filename, &sb) == 0) {
+        snprintf(filename, len, "%.*s.%d%s", (int) (ext - name), name, ++capture_cfg.dump_seq, ext);
+    }
 }
 
-void
-capture_dump_packet(packet_t *packet)
+/**
+ * @brief Release a queued packet copy
+ */
+static void
+capture_dump_free(capture_dump_frame_t *dframe)
 {
-    if (sighup_received && capture_cfg.pd) {
-        // we got a SIGHUP: reopen the dump file because it could have been renamed
-        // we don't need to care about locking or other threads accessing in parallel
-        // because dump_open ensures count(capture_cfg.sources) == 1
+    capture_dump_frame_t *next;
+
+    for (; dframe; dframe = next) {
+        next = dframe->next;
+        free(dframe);
+    }
+}
+
+/**
+ * @brief Remember a rotated dump file so it can be removed later
+ */
+static void
+capture_dump_file_add(const char *name, uint64_t bytes, time_t end)
+{
+    capture_dump_file_t *file;
+
+    if (!(file = malloc(sizeof(capture_dump_file_t) + strlen(name) + 1)))
+        return;
+    file->bytes = bytes;
+    file->end = end;
+    file->next = NULL;
+    strcpy(file->name, name);
+
+    if (capture_cfg.dump_files_last) {
+        capture_cfg.dump_files_last->next = file;
+    } else {
+        capture_cfg.dump_files = file;
+    }
+    capture_cfg.dump_files_last = file;
+    capture_cfg.dump_files_bytes += bytes;
+}
+
+/**
+ * @brief Remove oldest rotated dump files exceeding configured limits
+ *
+ * @param ts Time of the packet that is going to be written
+ */
+static void
+capture_dump_file_prune(time_t ts)
+{
+    capture_dump_file_t *file;
+
+    while ((file = capture_cfg.dump_files)) {
+        if (!(capture_cfg.dump_keep_size
+              && capture_cfg.dump_files_bytes + capture_cfg.dump_bytes > capture_cfg.dump_keep_size)
+            && !(capture_cfg.dump_keep_time && file->end + capture_cfg.dump_keep_time < ts))
+            break;
 
+        unlink(file->name);
+        capture_cfg.dump_files_bytes -= file->bytes;
+        if (!(capture_cfg.dump_files = file->next))
+            capture_cfg.dump_files_last = NULL;
+        free(file);
+    }
+}
+
+/**
+ * @brief Open a new dump file if required before writing next packet
+ *
+ * @param ts Time of the packet that is going to be written
+ */
+static void
+capture_dump_rotate(time_t ts)
+{
+    struct stat sb;
+    bool reopen = false;
+
+    if (sighup_received) {
+        // we got a SIGHUP: reopen the dump file because it could have been renamed
         // check if the file has actually changed
         // only reopen if it has, otherwise we would overwrite the existing one
-        struct stat sb;
-        if (stat(capture_cfg.dumpfilename, &sb) == -1 ||
-            sb.st_ino != capture_cfg.dump_inode)
-        {
+        if (stat(capture_cfg.dumpfilename, &sb) == -1 || sb.st_ino != capture_cfg.dump_inode)
+            reopen = true;
+        sighup_received = 0;
+    }
+
+    if (!capture_cfg.dump_start)
+        capture_cfg.dump_start = ts;
+
+    // Check configured file rotation
+    if ((capture_cfg.dump_rotate_size && capture_cfg.dump_bytes >= capture_cfg.dump_rotate_size)
+        || (capture_cfg.dump_rotate_time && ts >= capture_cfg.dump_start + capture_cfg.dump_rotate_time)) {
+        if (capture_cfg.dump_keep_size || capture_cfg.dump_keep_time)
+            capture_dump_file_add(capture_cfg.dumpfilename, capture_cfg.dump_bytes, ts);
+        capture_dump_filename(capture_cfg.dumpfilename, sizeof(capture_cfg.dumpfilename), ts, true);
+        capture_cfg.dump_start = ts;
+        reopen = true;
+    }
+
+    if (reopen) {
+        if (capture_cfg.pd)
             pcap_dump_close(capture_cfg.pd);
-            capture_cfg.pd = dump_open(capture_cfg.dumpfilename, &capture_cfg.dump_inode);
+        // error reopening capture file: we can't capture anymore
+        capture_cfg.pd = dump_open(capture_cfg.dumpfilename, &capture_cfg.dump_inode);
+        capture_cfg.dump_bytes = 0;
+    }
+
+    capture_dump_file_prune(ts);
+}
+
+/**
+ * @brief Dump writer thread
+ *
+ * Write queued packets in dump file. Writes are buffered and only flushed
+ * when there are no more packets pending.
+ */
+static void *
+capture_dump_thread(void *data)
+{
+    capture_dump_frame_t *dframe, *frame;
+    bool pending = false;
+
+    while (!queue_finished(capture_cfg.dump_queue)) {
+        if (!(dframe = queue_pop(capture_cfg.dump_queue))) {
+            // Nothing more to write right now
+            if (pending && capture_cfg.pd)
+                pcap_dump_flush(capture_cfg.pd);
+            pending = false;
+            usleep(CAPTURE_QUEUE_WAIT);
+            continue;
         }
 
-        sighup_received = 0;
+        capture_dump_rotate(dframe->header.ts.tv_sec);
 
-        // error reopening capture file: we can't capture anymore
-        if (!capture_cfg.pd)
-            return;
+        if (capture_cfg.pd) {
+            for (frame = dframe; frame; frame = frame->next) {
+                pcap_dump((u_char *) capture_cfg.pd, &frame->header, frame->data);
+                // pcap record header and frame data
+                capture_cfg.dump_bytes += 16 + frame->header.caplen;
+            }
+            pending = true;
+        }
+
+        capture_dump_free(dframe);
+    }
+
+    if (capture_cfg.pd)
+        pcap_dump_flush(capture_cfg.pd);
+
+    return NULL;
+}
+
+int
+capture_dump_start(const char *dumpfile)
+{
+    capture_cfg.dumpfmt = dumpfile;
+    capture_cfg.dump_rotate_size = (uint64_t) setting_get_intvalue(SETTING_CAPTURE_OUTFILE_SIZE) * 1024 * 1024;
+    capture_cfg.dump_rotate_time = setting_get_intvalue(SETTING_CAPTURE_OUTFILE_TIME) * 60;
+    capture_cfg.dump_keep_size = (uint64_t) setting_get_intvalue(SETTING_CAPTURE_OUTFILE_KEEPSIZE) * 1024 * 1024;
+    capture_cfg.dump_keep_time = setting_get_intvalue(SETTING_CAPTURE_OUTFILE_KEEPTIME) * 60;
+
+    capture_dump_filename(capture_cfg.dumpfilename, sizeof(capture_cfg.dumpfilename), time(NULL), false);
+    if (!(capture_cfg.pd = dump_open(capture_cfg.dumpfilename, &capture_cfg.dump_inode)))
+        return 1;
+
+    if (!(capture_cfg.dump_queue = queue_create(CAPTURE_DUMP_QUEUE)))
+        return 1;
+
+    if (thread_create(&capture_cfg.dump_t, THREAD_IO, "sng-dump", capture_dump_thread, NULL) != 0) {
+        queue_destroy(capture_cfg.dump_queue);
+        capture_cfg.dump_queue = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+capture_daemon_start(const char *name)
+{
+#ifdef HAVE_SHM_OPEN
+    capture_info_t *capinfo = vector_first(capture_cfg.sources);
+
+    if (!capinfo)
+        return 1;
+
+    // Capture threads are not running yet
+    if (!(capture_cfg.shm = capture_shm_create(name, capinfo->link)))
+        return 1;
+    return 0;
+#else
+    fprintf(stderr, "sngrep is not compiled with shared memory support.\n");
+    return 1;
+#endif
+}
+
+void
+capture_dump_stop()
+{
+    capture_dump_frame_t *dframe;
+    capture_dump_file_t *file;
+
+    if (!capture_cfg.dump_queue)
+        return;
+
+    // No more packets will be queued
+    pthread_mutex_lock(&capture_cfg.dump_lock);
+    queue_close(capture_cfg.dump_queue);
+    pthread_mutex_unlock(&capture_cfg.dump_lock);
+
+    // Wait until all pending packets are written
+    pthread_join(capture_cfg.dump_t, NULL);
+    while ((dframe = queue_pop(capture_cfg.dump_queue)))
+        capture_dump_free(dframe);
+    queue_destroy(capture_cfg.dump_queue);
+    capture_cfg.dump_queue = NULL;
+
+    dump_close(capture_cfg.pd);
+    capture_cfg.pd = NULL;
+
+    // Rotated files are kept on exit
+    while ((file = capture_cfg.dump_files)) {
+        capture_cfg.dump_files = file->next;
+        free(file);
+    }
+    capture_cfg.dump_files_last = NULL;
+    capture_cfg.dump_files_bytes = 0;
+}
+
+void
+capture_dump_packet(packet_t *packet)
+{
+    capture_dump_frame_t *dframe, *first = NULL, *last = NULL;
+    frame_t *frame;
+
+    if (!capture_cfg.dump_queue || !packet)
+        return;
+
+    // Copy packet frames, packet may be released before they are written
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (!(dframe = malloc(sizeof(capture_dump_frame_t) + frame->header->caplen)))
+            break;
+        memcpy(&dframe->header, frame->header, sizeof(struct pcap_pkthdr));
+        memcpy(dframe->data, frame->data, frame->header->caplen);
+        dframe->next = NULL;
+        if (last) {
+            last->next = dframe;
+        } else {
+            first = dframe;
+        }
+        last = dframe;
+    }
+
+    if (!first)
+        return;
+
+    pthread_mutex_lock(&capture_cfg.dump_lock);
+    while (capture_cfg.dump_queue->closed || !queue_push(capture_cfg.dump_queue, first)) {
+        // Online captures must not wait for the writer
+        if (capture_cfg.dump_queue->closed || capture_is_online()) {
+            capture_cfg.dump_drops++;
+            capture_dump_free(first);
+            break;
+        }
+        // Wait until writer has room for more packets
+        usleep(CAPTURE_QUEUE_WAIT);
     }
+    pthread_mutex_unlock(&capture_cfg.dump_lock);
+}
 
-    dump_packet(capture_cfg.pd, packet);
+void
+capture_dump_stats(uint32_t *backlog, uint64_t *drops)
+{
+    *backlog = (capture_cfg.dump_queue) ? queue_count(capture_cfg.dump_queue) : 0;
+    *drops = capture_cfg.dump_drops;
 }
 
 int8_t
@@ -1398,8 +3916,7 @@ dump_open(const char *dumpfile, ino_t* dump_inode)
 {
     capture_info_t *capinfo;
 
-    if (vector_count(capture_cfg.sources) == 1) {
-        capture_cfg.dumpfilename = dumpfile;
+    if (capture_single_input()) {
         capinfo = vector_first(capture_cfg.sources);
 
         FILE *fp = fopen(dumpfile,"wb+");
@@ -1421,20 +3938,15 @@ dump_open(const char *dumpfile, ino_t* dump_inode)
         if (is_gz_filename(dumpfile))
         {
 #if defined(HAVE_FOPENCOOKIE) && defined(WITH_ZLIB)
-            // create a gzip file stream out of the already opened file
-            gzFile zf = gzdopen(fileno(fp), "w");
-            if (!zf)
-                return NULL;
-
-            static cookie_io_functions_t cookiefuncs = {
-                NULL, gzip_cookie_write, NULL, gzip_cookie_close
-            };
-
-            // reroute the file access functions
-            // use the gzip write+close functions when accessing the file
-            fp = fopencookie(zf, "w", cookiefuncs);
-            if (!fp)
+            // Compress file blocks in parallel, capture is not limited
+            // by the speed of a single compression thread
+            FILE *zfp = gzip_open(fp, Z_DEFAULT_COMPRESSION,
+                                  setting_get_intvalue(SETTING_CAPTURE_GZIP_THREADS));
+            if (!zfp) {
+                fclose(fp);
                 return NULL;
+            }
+            fp = zfp;
 #else
             // no support for gzip compressed pcap files compiled in -> abort
             fclose(fp);
@@ -1442,6 +3954,9 @@ dump_open(const char *dumpfile, ino_t* dump_inode)
 #endif
         }
 
+        // Write packets to disk in big chunks
+        setvbuf(fp, NULL, _IOFBF, CAPTURE_DUMP_BUFFER);
+
         return pcap_dump_fopen(capinfo->handle, fp);
     }
     return NULL;
@@ -38,6 +38,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
+#include <limits.h>
 #include "address.h"
 
 #ifndef __FAVOR_BSD
@@ -72,11 +73,55 @@
 #include <stdbool.h>
 #include "packet.h"
 #include "vector.h"
+#include "queue.h"
+#include "match.h"
 
 //! Max allowed packet assembled size
 #define MAX_CAPTURE_LEN 20480
 //! Max allowed packet length
 #define MAXIMUM_SNAPLEN 262144
+//! Max packets parsed in a row while holding capture lock
+#define CAPTURE_PARSE_BATCH_MAX 4096
+//! Microseconds to wait when parser queues are empty or full
+#define CAPTURE_QUEUE_WAIT 1000
+//! Times an idle SIP worker yields before sleeping
+#define CAPTURE_WORKER_SPIN 1000
+//! Max number of TLS decryption workers
+#define CAPTURE_TLS_WORKERS_MAX 64
+//! Size of each decompressed block of gzip input files
+#define CAPTURE_GZIP_BLOCK_SIZE (256 * 1024)
+//! Decompressed blocks of gzip input files read ahead of parsing
+#define CAPTURE_GZIP_BLOCKS 16
+//! Max packets pending to be written in dump file
+#define CAPTURE_DUMP_QUEUE 65536
+//! Size of dump file write buffer
+#define CAPTURE_DUMP_BUFFER (1024 * 1024)
+//! Seconds a media port stays in capture filter without SDP or RTP
+#define CAPTURE_FILTER_PORT_TIMEOUT 60
+//! Max port ranges added to capture filter
+#define CAPTURE_FILTER_MAX_RANGES 256
+//! Max length of capture filter with media ports
+#define CAPTURE_FILTER_LEN (CAPTURE_FILTER_MAX_RANGES * 32 + 1024)
+//! Online parser queue usage (percent) that starts load shedding
+#define CAPTURE_OVERLOAD_HIGH 50
+//! Online parser queue usage (percent) that stops load shedding
+#define CAPTURE_OVERLOAD_LOW 25
+//! Seconds of overload before pausing payload filter evaluation
+#define CAPTURE_OVERLOAD_SUSTAIN 5
+//! Libpcap dispatches between kernel drop counters updates
+#define CAPTURE_STATS_DISPATCHES 64
+//! Number of buckets of IP reassembly hash table (power of 2)
+#define CAPTURE_IP_REASM_BUCKETS 1024
+//! Number of buckets of TCP reassembly hash table (power of 2)
+#define CAPTURE_TCP_REASM_BUCKETS 4096
+//! Initial size of TCP flow assembly buffer
+#define CAPTURE_TCP_FLOW_SIZE 2048
+//! Minimum size of input file chunks loaded in parallel
+#define CAPTURE_OFFLINE_CHUNK_MIN (16 * 1024 * 1024)
+//! Bytes searched for a record boundary at input file chunk start
+#define CAPTURE_OFFLINE_SYNC_LEN (1024 * 1024)
+//! Consecutive valid records required to accept a record boundary
+#define CAPTURE_OFFLINE_SYNC_RECORDS 8
 
 //! Define VLAN 802.1Q Ethernet type
 #ifndef ETHERTYPE_8021Q
@@ -98,18 +143,71 @@ typedef struct nflog_tlv {
 #define WH_OPCODE   0x0F
 #define WH_MASK     0x80
 #define WH_LEN      0x7F
+#define WS_OPCODE_CONTINUATION 0x0
 #define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_CONTROL 0x8
 
 enum capture_storage {
     CAPTURE_STORAGE_NONE = 0,
     CAPTURE_STORAGE_MEMORY,
-    CAPTURE_STORAGE_DISK
+    CAPTURE_STORAGE_DISK,
+    CAPTURE_STORAGE_COMPRESSED,
+    CAPTURE_STORAGE_INDEX
+};
+
+/**
+ * @brief Load shedding levels applied when parser can not keep up
+ *
+ * SIP packets are never shed, each level adds more work that is skipped
+ * until parser queues are drained.
+ */
+enum capture_overload {
+    //! All packets are parsed and stored
+    CAPTURE_OVERLOAD_NONE = 0,
+    //! Only one of each N RTP packets of a stream is stored
+    CAPTURE_OVERLOAD_RTP,
+    //! RTP is sampled and payload display filter evaluation is paused
+    CAPTURE_OVERLOAD_FILTER
 };
 
 //! Shorter declaration of capture_config structure
 typedef struct capture_config capture_config_t;
 //; Shorter declaration of capture_info structure
 typedef struct capture_info capture_info_t;
+//! Shorter declaration of capture_worker structure
+typedef struct capture_worker capture_worker_t;
+//! Shorter declaration of capture_tls_worker structure
+typedef struct capture_tls_worker capture_tls_worker_t;
+//! Shorter declaration of capture_tls_segment structure
+typedef struct capture_tls_segment capture_tls_segment_t;
+//! Shorter declaration of capture_stats structure
+typedef struct capture_stats capture_stats_t;
+//! Shorter declaration of capture_ip_reasm structure
+typedef struct capture_ip_reasm capture_ip_reasm_t;
+//! Shorter declaration of capture_ip_frag structure
+typedef struct capture_ip_frag capture_ip_frag_t;
+//! Shorter declaration of capture_tcp_reasm structure
+typedef struct capture_tcp_reasm capture_tcp_reasm_t;
+//! Shorter declaration of capture_tcp_flow structure
+typedef struct capture_tcp_flow capture_tcp_flow_t;
+//! Shorter declaration of capture_tcp_segment structure
+typedef struct capture_tcp_segment capture_tcp_segment_t;
+//! Shorter declaration of capture_dump_frame structure
+typedef struct capture_dump_frame capture_dump_frame_t;
+//! Shorter declaration of capture_dump_file structure
+typedef struct capture_dump_file capture_dump_file_t;
+#ifdef USE_TPACKET
+//! Forward declaration of AF_PACKET ring information
+struct capture_tpacket;
+#endif
+#ifdef HAVE_MMAP
+//! Forward declaration of mapped file information
+struct capture_mmap;
+#endif
+#ifdef HAVE_SHM_OPEN
+//! Forward declaration of shared frames ring
+struct capture_shm;
+#endif
 
 /**
  * @brief Capture common configuration
@@ -123,12 +221,30 @@ struct capture_config {
     size_t pcap_buffer_size;
     //! Also capture RTP packets
     bool rtp_capture;
+    //! Parse UDP payloads as HEP3 encapsulated packets
+    bool eep;
+    //! Only store RTP headers of calls not locked nor matching rtp_match
+    bool rtp_headers;
+    //! Calls whose first message matches keep full RTP packets (or NULL)
+    match_set_t *rtp_match;
     //! Rotate capturad dialogs when limit have reached
     bool rotate;
     //! Capture sources are paused (all packets are skipped)
     int paused;
     //! Where should we store captured packets
     enum capture_storage storage;
+    //! Current load shedding level
+    enum capture_overload overload;
+    //! Store one of each N RTP packets while overloaded (0 to disable shedding)
+    int overload_sample;
+    //! Nanoseconds online packets wait for older packets from other sources
+    uint64_t reorder_window;
+    //! Packets parsed in a row while holding capture or shard lock
+    int batch;
+    //! Time when current overload started
+    time_t overload_start;
+    //! RTP packets not stored because of overload
+    uint64_t overload_shed;
     //! Key file for TLS decrypt
     const char *keyfile;
     //! TLS Server address
@@ -137,16 +253,337 @@ struct capture_config {
     const char *filter;
     //! The compiled filter expression
     struct bpf_program fp;
+    //! Last time each media port was seen in SDP or RTP (NULL if disabled)
+    time_t *filter_ports;
+    //! Media ports have been added or expired since last filter update
+    bool filter_changed;
+    //! Last time media ports filter was updated
+    time_t filter_time;
+    //! Media ports Lock. Avoid adding ports from several workers
+    pthread_mutex_t filter_lock;
+    //! Last built filter expression with media ports
+    char filter_pending[CAPTURE_FILTER_LEN];
+    //! Incremented each time a new filter expression is built
+    uint32_t filter_version;
+    //! Last time stored calls were compressed
+    time_t storage_time;
+    //! Last time idle calls expiration was checked
+    time_t expire_time;
     //! libpcap dump file handler
     pcap_dumper_t *pd;
+    //! libpcap dump file name format (strftime expanded)
+    const char *dumpfmt;
     //! libpcap dump file name
-    const char *dumpfilename;
+    char dumpfilename[PATH_MAX];
     //! inode of the dump file we have open
     ino_t dump_inode;
+    //! Packets pending to be written in dump file
+    queue_t *dump_queue;
+    //! Dump writer thread
+    pthread_t dump_t;
+    //! Dump Lock. Avoid queueing dumped packets from several threads
+    pthread_mutex_t dump_lock;
+    //! Packets discarded because dump queue was full
+    uint64_t dump_drops;
+    //! Bytes written in current dump file
+    uint64_t dump_bytes;
+    //! First packet time of current dump file
+    time_t dump_start;
+    //! Last sequence number added to dump file names
+    int dump_seq;
+    //! Rotate dump file after this amount of bytes (0 to disable)
+    uint64_t dump_rotate_size;
+    //! Rotate dump file after this amount of seconds (0 to disable)
+    time_t dump_rotate_time;
+    //! Remove oldest rotated files above this amount of bytes (0 to disable)
+    uint64_t dump_keep_size;
+    //! Remove rotated files older than this amount of seconds (0 to disable)
+    time_t dump_keep_time;
+    //! Rotated dump files, oldest first
+    capture_dump_file_t *dump_files, *dump_files_last;
+    //! Bytes written in rotated dump files
+    uint64_t dump_files_bytes;
     //! Capture sources
     vector_t *sources;
     //! Capture Lock. Avoid parsing and handling data at the same time
     pthread_mutex_t lock;
+    //! Max packets pending to be parsed per capture source
+    size_t queue_size;
+    //! Parser thread is running
+    bool parsing;
+    //! Parser thread for all capture sources
+    pthread_t parser_t;
+    //! SIP parsing workers (one per call store shard)
+    capture_worker_t *workers;
+    //! Number of SIP parsing workers
+    int worker_count;
+    //! TLS decryption workers (one per TLS connections partition)
+    capture_tls_worker_t *tls_workers;
+    //! Number of TLS decryption workers
+    int tls_worker_count;
+    //! Output Lock. Avoid dumping or sending packets from several workers
+    pthread_mutex_t output_lock;
+    //! Seconds to wait for missing IP fragments
+    int ip_reasm_timeout;
+    //! Max bytes of IP fragments pending reassembly per capture source
+    size_t ip_reasm_memory;
+    //! Seconds to wait for missing TCP segments
+    int tcp_reasm_timeout;
+    //! Max bytes of TCP payload pending reassembly per capture source
+    size_t tcp_reasm_memory;
+#ifdef HAVE_SHM_OPEN
+    //! Ring where captured frames are published instead of parsed (daemon mode)
+    struct capture_shm *shm;
+#endif
+};
+
+/**
+ * @brief IP datagram pending reassembly
+ *
+ * Datagrams are identified by source, destination, IP id and protocol
+ */
+struct capture_ip_frag
+{
+    //! Packet containing all received fragments
+    packet_t *pkt;
+    //! Hash of datagram identifiers
+    uint32_t hash;
+    //! Captured bytes of all received fragments
+    uint32_t bytes;
+    //! Capture time of the first fragment
+    struct timeval ts;
+    //! Next datagram in the same hash bucket
+    capture_ip_frag_t *next;
+    //! Previous datagram in reception order
+    capture_ip_frag_t *older;
+    //! Next datagram in reception order
+    capture_ip_frag_t *newer;
+};
+
+/**
+ * @brief TCP segment received before the previous ones
+ */
+struct capture_tcp_segment
+{
+    //! Sequence number of first payload byte
+    uint32_t seq;
+    //! Payload length
+    uint32_t len;
+    //! Next segment in sequence order
+    capture_tcp_segment_t *next;
+    //! Segment payload
+    u_char data[];
+};
+
+/**
+ * @brief Frame copy pending to be written in dump file
+ */
+struct capture_dump_frame
+{
+    //! Frame pcap header
+    struct pcap_pkthdr header;
+    //! Next frame of the same packet
+    capture_dump_frame_t *next;
+    //! Frame data
+    u_char data[];
+};
+
+/**
+ * @brief Rotated dump file that can be removed to make room for new ones
+ */
+struct capture_dump_file
+{
+    //! Bytes written in the file
+    uint64_t bytes;
+    //! Time of the first packet written in the next file
+    time_t end;
+    //! Next rotated file (newer)
+    capture_dump_file_t *next;
+    //! File name
+    char name[];
+};
+
+/**
+ * @brief TCP flow with payload pending reassembly
+ *
+ * Flows are identified by source and destination address and port. Payload
+ * of in order segments is stored in a single buffer that grows as needed,
+ * up to MAX_CAPTURE_LEN bytes.
+ */
+struct capture_tcp_flow
+{
+    //! Packet containing all received frames
+    packet_t *pkt;
+    //! Hash of flow identifiers
+    uint32_t hash;
+    //! Assembled payload (NUL terminated)
+    u_char *data;
+    //! Assembled payload length
+    uint32_t len;
+    //! Allocated size of assembled payload buffer
+    uint32_t size;
+    //! Sequence number of first assembled byte
+    uint32_t seq;
+    //! Segments after a sequence gap
+    capture_tcp_segment_t *segments;
+    //! Payload length of segments after a sequence gap
+    uint32_t segments_len;
+    //! Capture time of the last segment
+    struct timeval ts;
+    //! Next flow in the same hash bucket
+    capture_tcp_flow_t *next;
+    //! Previous flow in activity order
+    capture_tcp_flow_t *older;
+    //! Next flow in activity order
+    capture_tcp_flow_t *newer;
+};
+
+/**
+ * @brief TCP flows pending reassembly of a capture source
+ */
+struct capture_tcp_reasm
+{
+    //! Hash table buckets
+    capture_tcp_flow_t *buckets[CAPTURE_TCP_REASM_BUCKETS];
+    //! Least recently updated flow (next to expire)
+    capture_tcp_flow_t *oldest;
+    //! Most recently updated flow
+    capture_tcp_flow_t *newest;
+    //! Number of flows pending reassembly
+    uint32_t count;
+    //! Payload bytes of all pending flows
+    size_t bytes;
+    //! Incomplete flows discarded after timeout
+    uint64_t expired;
+    //! Incomplete flows discarded because of memory limits
+    uint64_t evicted;
+};
+
+/**
+ * @brief IP datagrams pending reassembly of a capture source
+ */
+struct capture_ip_reasm
+{
+    //! Hash table buckets
+    capture_ip_frag_t *buckets[CAPTURE_IP_REASM_BUCKETS];
+    //! First received datagram (next to expire)
+    capture_ip_frag_t *oldest;
+    //! Last received datagram
+    capture_ip_frag_t *newest;
+    //! Number of datagrams pending reassembly
+    uint32_t count;
+    //! Captured bytes of all pending fragments
+    size_t bytes;
+    //! Incomplete datagrams discarded after timeout
+    uint64_t expired;
+    //! Incomplete datagrams discarded because of memory limit
+    uint64_t evicted;
+};
+
+/**
+ * @brief SIP parsing worker
+ *
+ * When more than one worker is configured, the parser thread hands SIP
+ * packets to the worker of their call store shard, so messages of the same
+ * Call-ID are always parsed in order by the same thread.
+ */
+struct capture_worker
+{
+    //! Worker index (same as its call store shard)
+    int id;
+    //! Packets pending to be parsed by this worker
+    queue_t *queue;
+    //! Worker thread
+    pthread_t thread;
+    //! Packets added to worker queue
+    uint64_t queued;
+    //! Packets already parsed by this worker
+    uint64_t parsed;
+};
+
+/**
+ * @brief TCP segment pending TLS decryption
+ */
+struct capture_tls_segment
+{
+    //! Segment packet
+    packet_t *pkt;
+    //! Copy of the segment TCP header
+    struct tcphdr tcp;
+};
+
+/**
+ * @brief TLS decryption worker information
+ *
+ * When capture.tls.workers is configured, capture threads of online
+ * sources hand TCP segments to the worker of their TLS connections
+ * partition, so records of the same connection are always decrypted in
+ * order by the same thread. Decrypted packets are parsed by the parser
+ * thread as packets of any other source.
+ */
+struct capture_tls_worker
+{
+    //! Worker index (same as its TLS connections partition)
+    int id;
+    //! Segments pending to be decrypted (capture_tls_segment_t)
+    queue_t *queue;
+    //! Segments are queued from all capture threads
+    pthread_mutex_t lock;
+    //! Processed packets pending to be parsed
+    queue_t *output;
+    //! Worker thread
+    pthread_t thread;
+};
+
+/**
+ * @brief Packet counters of a capture source
+ *
+ * Drops are split by the stage that discarded the packets so it can be
+ * told apart when sngrep itself lost packets and when they were never
+ * received.
+ */
+struct capture_stats
+{
+    //! Packets read from the source
+    uint64_t received;
+    //! Packets dropped by the kernel because capture buffer was full
+    uint64_t kernel_drops;
+    //! Packets dropped by the network interface or its driver
+    uint64_t if_drops;
+    //! Packets discarded because parser queue was full
+    uint64_t queue_drops;
+    //! Incomplete IP datagrams and TCP flows discarded before reassembly
+    uint64_t reasm_drops;
+    //! Packets with payload that are neither SIP nor RTP
+    uint64_t rejected;
+    //! Packets skipped because capture limit was reached
+    uint64_t skipped;
+};
+
+//! Shorter declaration of capture_bench structure
+typedef struct capture_bench capture_bench_t;
+
+/**
+ * @brief Packets preloaded in memory for a benchmark replay
+ */
+struct capture_bench
+{
+    //! Preloaded frames data
+    u_char *data;
+    //! Preloaded frames headers
+    struct pcap_pkthdr *headers;
+    //! Offset of each frame in data buffer
+    size_t *offsets;
+    //! Number of preloaded frames
+    int count;
+    //! Total preloaded frames bytes
+    uint64_t bytes;
+    //! Replay speed relative to recorded timestamps (0 for max speed)
+    double speed;
+    //! Time when replay started
+    struct timespec start;
+    //! Time when all replayed packets were parsed
+    struct timespec end;
 };
 
 /**
@@ -166,22 +603,62 @@ struct capture_info
     int8_t link_hl;
     //! libpcap capture handler
     pcap_t *handle;
+    //! Version of the media ports filter installed in this source
+    uint32_t filter_version;
+    //! Frame headers read from this source have nanoseconds in tv_usec
+    bool nsec;
+    //! Time of the frame being parsed in nanoseconds (if nsec is set)
+    uint64_t ts;
     //! Netmask of our sniffing device
     bpf_u_int32 mask;
     //! The IP of our sniffing device
     bpf_u_int32 net;
     //! Input file in Offline capture
     const char *infile;
+    //! Input file offset where this source stops reading (0 for end of file)
+    off_t infile_end;
     //! Capture device in Online mode
     const char *device;
     //! Packets pending IP reassembly
-    vector_t *ip_reasm;
+    capture_ip_reasm_t *ip_reasm;
     //! Packets pending TCP reassembly
-    vector_t *tcp_reasm;
+    capture_tcp_reasm_t *tcp_reasm;
+    //! Packets pending to be parsed
+    queue_t *queue;
+    //! Packets discarded because parser queue was full
+    uint64_t queue_drops;
+    //! Packets read from this source
+    uint64_t received;
+    //! Packets with payload that are neither SIP nor RTP
+    uint64_t rejected;
+    //! Packets skipped because capture limit was reached
+    uint64_t skipped;
+    //! Libpcap kernel drops, updated by the capture thread
+    uint64_t kernel_drops;
+    //! Libpcap interface drops, updated by the capture thread
+    uint64_t if_drops;
     //! Capture thread function
     void *(*capture_fn)(void *data);
     //! Capture thread for online capturing
     pthread_t capture_t;
+#ifdef USE_TPACKET
+    //! AF_PACKET ring information (NULL for libpcap sources)
+    struct capture_tpacket *tpacket;
+#endif
+#ifdef HAVE_MMAP
+    //! Mapped input file (NULL if file is read using libpcap)
+    struct capture_mmap *mmap;
+#endif
+#ifdef USE_EEP
+    //! EEP listener socket information (NULL for other sources)
+    struct capture_eep_listener *eep;
+#endif
+#ifdef HAVE_SHM_OPEN
+    //! Attached daemon ring (NULL for other sources)
+    struct capture_shm *shm;
+#endif
+    //! Preloaded packets for benchmark replay (NULL for other sources)
+    capture_bench_t *bench;
 };
 
 /**
@@ -224,6 +701,53 @@ capture_online(const char *dev);
 int
 capture_offline(const char *infile);
 
+/**
+ * @brief Load a pcap file in memory to measure parsing throughput
+ *
+ * All file packets are read before capture starts, so replay is not
+ * limited by disk or decompression speed. Packets are replayed as fast
+ * as possible or following their recorded times.
+ *
+ * @param infile File to read packets from
+ * @param speed Replay speed relative to recorded times (0 for max speed)
+ * @return 0 if load has been successfull, 1 otherwise
+ */
+int
+capture_bench(const char *infile, double speed);
+
+/**
+ * @brief Get benchmark replay information
+ *
+ * @return benchmark information or NULL if no benchmark is running
+ */
+const capture_bench_t *
+capture_bench_info();
+
+/**
+ * @brief Replay preloaded packets of a benchmark source
+ *
+ * @param info Capture source information
+ */
+void *
+capture_bench_thread(void *info);
+
+/**
+ * @brief Split an offline capture source into several file chunks
+ *
+ * Uncompressed pcap files bigger than CAPTURE_OFFLINE_CHUNK_MIN are split
+ * in record aligned chunks, each one read and decoded by its own capture
+ * thread. Packets from all offline sources are parsed in timestamp order.
+ *
+ * @note IP fragments and TCP segments of a message split in two chunks
+ * can not be reassembled.
+ *
+ * @param capinfo Offline capture source of the whole file
+ * @param chunks Number of requested chunks
+ * @return number of created chunks
+ */
+int
+capture_offline_split(capture_info_t *capinfo, int chunks);
+
 /**
  * @brief Read the next package and parse SIP messages
  *
@@ -246,15 +770,18 @@ parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *pa
  * done to avoid reassembling too big packets, that aren't likely to be interesting
  * for sngrep.
  *
+ * Incomplete datagrams are discarded after capture.ipreasm.timeout seconds
+ * or when capture.ipreasm.memory limit is reached (oldest first).
+ *
  * TODO
  * Assembly only works when all of the IP fragments are received in the good order.
- * Properly check memory boundaries during packet reconstruction.
- * Implement a way to timeout pending IP fragments after some time.
  * TODO
  *
  * @param capinfo Packet capture session information
  * @para header Header received from libpcap callback
  * @para packet Packet contents received from libpcap callback
+ * @param data Buffer used to assemble fragments. On return, points to the
+ * packet data to be parsed (packet frame data or assembled buffer)
  * @param size Packet size (not including Layer and Network headers)
  * @param caplen Full packet size (current fragment -> whole assembled packet)
  * @return a Packet structure when packet is not fragmented or fully reassembled
@@ -262,13 +789,62 @@ parse_packet(u_char *capinfo, const struct pcap_pkthdr *header, const u_char *pa
  */
 packet_t *
 capture_packet_reasm_ip(capture_info_t *capinfo, const struct pcap_pkthdr *header,
-                        u_char *packet, uint32_t *size, uint32_t *caplen);
+                        const u_char *packet, u_char **data, uint32_t *size, uint32_t *caplen);
+
+/**
+ * @brief Create an empty IP reassembly table
+ */
+capture_ip_reasm_t *
+capture_ip_reasm_create();
+
+/**
+ * @brief Remove an IP reassembly table and all its pending datagrams
+ */
+void
+capture_ip_reasm_destroy(capture_ip_reasm_t *reasm);
+
+/**
+ * @brief Get IP reassembly status of all capture sources
+ *
+ * @param pending Datagrams waiting for more fragments
+ * @param expired Incomplete datagrams discarded after timeout
+ * @param evicted Incomplete datagrams discarded because of memory limit
+ */
+void
+capture_ip_reasm_stats(uint32_t *pending, uint64_t *expired, uint64_t *evicted);
+
+/**
+ * @brief Create an empty TCP reassembly table
+ */
+capture_tcp_reasm_t *
+capture_tcp_reasm_create();
+
+/**
+ * @brief Remove a TCP reassembly table and all its pending flows
+ */
+void
+capture_tcp_reasm_destroy(capture_tcp_reasm_t *reasm);
+
+/**
+ * @brief Get TCP reassembly status of all capture sources
+ *
+ * @param pending Flows waiting for more segments
+ * @param expired Incomplete flows discarded after timeout
+ * @param evicted Incomplete flows discarded because of memory limits
+ */
+void
+capture_tcp_reasm_stats(uint32_t *pending, uint64_t *expired, uint64_t *evicted);
 
 /**
  * @brief Reassembly capture TCP segments
  *
  * This function will try to assemble TCP segments of an existing packet.
  *
+ * Segments are ordered using their sequence number. Segments after a gap
+ * are kept until the missing ones arrive, retransmitted data is ignored.
+ * Flows are discarded after capture.tcpreasm.timeout seconds without new
+ * segments or when capture.tcpreasm.memory limit is reached (oldest first).
+ *
  * @note We assume packets higher than MAX_CAPTURE_LEN won't be SIP. This has been
  * done to avoid reassembling too big packets, that aren't likely to be interesting
  * for sngrep.
@@ -288,13 +864,18 @@ capture_packet_reasm_tcp(capture_info_t *capinfo, packet_t *packet, struct tcphd
  * @brief Check if given payload belongs to a Websocket connection
  *
  * Parse the given payload and determine if given payload could belong
- * to a Websocket packet. This function will change the payload pointer
- * apnd size content to point to the SIP payload data.
+ * to a Websocket packet. This function will change the packet payload
+ * to the unmasked data of the first message, joining its fragments.
  *
- * @return 0 if packet is websocket, 1 otherwise
+ * If the payload contains more messages after the first one, a new packet
+ * is created with the remaining payload, to be checked again.
+ *
+ * @param packet Packet to check
+ * @param next Filled with a packet containing the following messages or NULL
+ * @return 1 if packet is websocket, 0 otherwise
  */
 int
-capture_ws_check_packet(packet_t *packet);
+capture_ws_check_packet(packet_t *packet, packet_t **next);
 
 /**
  * @brief Check if the given packet structure is SIP/RTP/..
@@ -303,10 +884,89 @@ capture_ws_check_packet(packet_t *packet);
  *
  * @return 0 in case this packets has SIP/RTP data
  * @return 1 otherwise
+ * @return 2 if this packet is RTP but only its header has been stored
  */
 int
 capture_packet_parse(packet_t *pkt);
 
+/**
+ * @brief Add a packet to capture source parser queue
+ *
+ * Online sources never wait for the parser: if the queue is full the
+ * packet is discarded. Offline sources wait until there is room.
+ *
+ * @param capinfo Capture source information
+ * @param pkt Reassembled packet
+ */
+void
+capture_queue_packet(capture_info_t *capinfo, packet_t *pkt);
+
+/**
+ * @brief Parse, dump and store a queued packet
+ *
+ * Must be called with capture lock held.
+ *
+ * @param pkt Packet extracted from parser queue
+ */
+void
+capture_store_packet(packet_t *pkt);
+
+/**
+ * @brief Parser thread
+ *
+ * Extract packets from all capture sources queues and parse them. Sources
+ * are marked as not running once all their packets have been parsed.
+ *
+ * Packets from offline sources are merged in timestamp order.
+ */
+void *
+capture_parser_thread(void *none);
+
+/**
+ * @brief SIP parsing worker thread
+ *
+ * Parse SIP packets of one call store shard while holding only that
+ * shard lock.
+ *
+ * @param info Worker information
+ */
+void *
+capture_worker_thread(void *info);
+
+/**
+ * @brief TLS decryption worker thread
+ *
+ * Decrypt TCP segments of one TLS connections partition and queue the
+ * resulting packets for the parser thread.
+ *
+ * @param info TLS worker information
+ */
+void *
+capture_tls_worker_thread(void *info);
+
+/**
+ * @brief Get parser queues status of all capture sources
+ *
+ * @param depth Packets pending to be parsed
+ * @param drops Packets discarded because parser queue was full
+ */
+void
+capture_queue_stats(uint32_t *depth, uint64_t *drops);
+
+/**
+ * @brief Get packet counters of a capture source
+ *
+ * Kernel and interface drops are only available for online sources.
+ * Libpcap counters are requested by the capture thread, so this function
+ * never blocks on the capture handle.
+ *
+ * @param index Capture source index
+ * @param stats Counters of the source
+ * @return Source device or file name, NULL if the source does not exist
+ */
+const char *
+capture_source_stats(int index, capture_stats_t *stats);
+
 /**
  * @brief Create a capture thread for online mode
  *
@@ -319,7 +979,8 @@ capture_launch_thread();
  * @brief PCAP Capture Thread
  *
  * This function is used as worker thread for capturing filtered packets and
- * pass them to the UI layer.
+ * pass them to the UI layer. Uncompressed input files are read from mapped
+ * memory when possible.
  */
 void *
 capture_thread(void *none);
@@ -357,6 +1018,75 @@ capture_set_bpf_filter(const char *filter);
 const char *
 capture_get_bpf_filter();
 
+/**
+ * @brief Get a hash of capture options that select stored packets
+ *
+ * Used to check if a sidecar index was created with the same options.
+ */
+uint64_t
+capture_options_hash();
+
+/**
+ * @brief Add a media port to online sources capture filter
+ *
+ * When capture.rtp.filter is enabled, ports seen in SDP are added to the
+ * configured capture filter, so only SIP and known RTP streams are copied
+ * from the kernel. Ports expire when no SDP or RTP refers them for a while.
+ *
+ * @param port UDP port of the media stream
+ * @param ts Time when the port has been seen
+ */
+void
+capture_filter_add_port(uint16_t port, time_t ts);
+
+/**
+ * @brief Build online sources filter with current media ports
+ *
+ * Filter is only rebuilt when media ports have changed, at most once
+ * per second. Sources install it from their own capture thread, as
+ * libpcap handles can not be used from several threads.
+ */
+void
+capture_filter_update();
+
+/**
+ * @brief Install the last built media ports filter in a source
+ *
+ * This function must be invoked from the source capture thread, between
+ * packet reads.
+ *
+ * @param capinfo Online capture source
+ */
+void
+capture_filter_install(capture_info_t *capinfo);
+
+/**
+ * @brief Compress idle stored calls
+ *
+ * Only used with compressed storage, at most once per second.
+ */
+void
+capture_storage_update();
+
+/**
+ * @brief Remove stored dialogs idle for longer than their timeout
+ *
+ * Only used when any sip.expire setting is configured, at most once
+ * per second.
+ */
+void
+capture_expire_update();
+
+/**
+ * @brief Check if a frame matches the configured BPF filter
+ *
+ * Used by capture sources that read frames without libpcap
+ *
+ * @return true if there is no filter or the frame matches it
+ */
+bool
+capture_packet_filter(const struct pcap_pkthdr *header, const u_char *packet);
+
 /**
  * @brief Pause/Resume capture
  *
@@ -373,6 +1103,31 @@ capture_set_paused(int pause);
 bool
 capture_paused();
 
+/**
+ * @brief Get current load shedding level
+ *
+ * Level is updated by the parser thread based on online sources parser
+ * queues usage.
+ *
+ * @return current overload level
+ */
+enum capture_overload
+capture_overload_level();
+
+/**
+ * @brief Get RTP sampling rate used while overloaded
+ *
+ * @return N when one of each N RTP packets is stored
+ */
+int
+capture_overload_sample();
+
+/**
+ * @brief Get where captured packets frames are stored
+ */
+enum capture_storage
+capture_storage();
+
 /**
  * @brief Get capture status value
  */
@@ -470,17 +1225,56 @@ void
 capture_close();
 
 /**
- * @brief Set general capture dumper
+ * @brief Open general capture dump file and start its writer thread
+ *
+ * Dump file name can contain strftime formats. When rotation is enabled
+ * by size or time settings, a new file is opened using the time of the
+ * packet that triggered the rotation. Oldest rotated files are removed
+ * when they exceed the configured total size or age, keeping only the
+ * most recent captured packets on disk.
+ *
+ * @param dumpfile Dump file name format
+ * @return 0 on success, 1 if file can not be opened
+ */
+int
+capture_dump_start(const char *dumpfile);
+
+/**
+ * @brief Publish captured frames for attached clients instead of parsing them
+ *
+ * Must be invoked once all capture sources have been added.
+ *
+ * @param name Shared ring name (NULL for default)
+ * @return 0 on success, 1 if ring can not be created
+ */
+int
+capture_daemon_start(const char *name);
+
+/**
+ * @brief Write all pending packets and close general capture dump file
  */
 void
-capture_set_dumper(pcap_dumper_t *dumper, ino_t dump_inode);
+capture_dump_stop();
 
 /**
- * @brief Store a packet in dumper file
+ * @brief Queue a packet to be stored in general capture dump file
+ *
+ * Packet frames are copied, so packet can be released before they are
+ * written by the writer thread. When the writer can not keep up, online
+ * captures drop the packet while offline captures wait for it.
  */
 void
 capture_dump_packet(packet_t *packet);
 
+/**
+ * @brief Get general capture dump file writer counters
+ *
+ * @param backlog Packets pending to be written
+ * @param drops Packets discarded because writer queue was full
+ */
+void
+capture_dump_stats(uint32_t *backlog, uint64_t *drops);
+
 /**
  * @brief Get datalink header size
  *
@@ -44,21 +44,532 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <poll.h>
 #include <unistd.h>
 #include <pcap.h>
 #include "capture_eep.h"
+#include "capture_probe.h"
 #include "util.h"
 #include "setting.h"
+#include "thread.h"
 
 capture_eep_config_t eep_cfg = { 0 };
 
-void *
-accept_eep_client(void *info);
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+//! Shorter declaration of recvmmsg/sendmmsg message structure
+typedef struct mmsghdr capture_eep_msg_t;
+#else
+//! Datagram and its received length
+typedef struct
+{
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} capture_eep_msg_t;
+#endif
+
+static int
+capture_eep_listener_create(struct addrinfo *ai, bool reuse);
+
+static void *
+capture_eep_stream_thread(void *info);
+
+/**
+ * @brief Get the transport protocol configured in a setting
+ *
+ * @return IPPROTO_TCP or IPPROTO_UDP
+ */
+static int
+capture_eep_proto(int id)
+{
+    return setting_has_value(id, "tcp") ? IPPROTO_TCP : IPPROTO_UDP;
+}
+
+/**
+ * @brief Check compressed streams can be used
+ *
+ * Compression is only supported between sngrep instances using TCP.
+ *
+ * @return 0 if compression is disabled or supported, 1 otherwise
+ */
+static int
+capture_eep_check_compress(bool compress, int proto)
+{
+    if (!compress)
+        return 0;
+#ifdef WITH_ZLIB
+    return (proto == IPPROTO_TCP) ? 0 : 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Create client socket and connect it to the HEP server
+ *
+ * @return 0 on success, 1 otherwise (errno is set)
+ */
+static int
+capture_eep_connect()
+{
+    struct addrinfo *ai, hints[1] = { { 0 } };
+    struct timeval timeout = { CAPTURE_EEP_CONNECT_TIMEOUT, 0 };
+    int err;
+
+    hints->ai_flags = AI_NUMERICSERV;
+    hints->ai_family = AF_UNSPEC;
+    hints->ai_socktype = (eep_cfg.capt_proto == IPPROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+    hints->ai_protocol = eep_cfg.capt_proto;
+
+    if (getaddrinfo(eep_cfg.capt_host, eep_cfg.capt_port, hints, &ai)) {
+        errno = EHOSTUNREACH;
+        return 1;
+    }
+
+    eep_cfg.client_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (eep_cfg.client_sock < 0) {
+        freeaddrinfo(ai);
+        return 1;
+    }
+
+    // Do not wait forever for unreachable servers
+    setsockopt(eep_cfg.client_sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if (connect(eep_cfg.client_sock, ai->ai_addr, (socklen_t) (ai->ai_addrlen)) == -1) {
+        if (errno != EINPROGRESS) {
+            err = errno;
+            close(eep_cfg.client_sock);
+            eep_cfg.client_sock = -1;
+            freeaddrinfo(ai);
+            errno = err;
+            return 1;
+        }
+    }
+
+    freeaddrinfo(ai);
+    return 0;
+}
+
+/**
+ * @brief Connect to the HEP server after waiting the reconnection delay
+ *
+ * The delay is doubled after each failed attempt, up to a maximum, and
+ * reset once the connection is established.
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int
+capture_eep_reconnect()
+{
+    u_char hello[CAPTURE_PROBE_MAXLEN];
+    uint32_t len;
+    int i;
+
+    // Wait checking if sender thread must stop
+    for (i = 0; i < eep_cfg.backoff * 10 && eep_cfg.sending; i++)
+        usleep(100000);
+
+    if (!eep_cfg.sending)
+        return 1;
+
+    if (capture_eep_connect() != 0) {
+        eep_cfg.backoff = eep_cfg.backoff ? eep_cfg.backoff * 2 : 1;
+        if (eep_cfg.backoff > CAPTURE_EEP_BACKOFF_MAX)
+            eep_cfg.backoff = CAPTURE_EEP_BACKOFF_MAX;
+        return 1;
+    }
+
+    eep_cfg.backoff = 0;
+#ifdef WITH_ZLIB
+    // Each connection starts a new compressed stream
+    if (eep_cfg.capt_compress)
+        deflateReset(&eep_cfg.zsend);
+#endif
+
+    // Probes authenticate before sending any record
+    eep_cfg.requests_len = 0;
+    if (eep_cfg.capt_probe) {
+        len = capture_probe_hello(hello, eep_cfg.capt_password);
+        if (!len || capture_eep_send_direct(hello, len) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Close the stream connection, it will be established again
+ */
+static void
+capture_eep_disconnect()
+{
+    close(eep_cfg.client_sock);
+    eep_cfg.client_sock = -1;
+}
+
+/**
+ * @brief Write a batch of frames to the stream client socket
+ *
+ * All frames are written using as few calls as possible, continuing
+ * after partial writes.
+ *
+ * @return number of frames that could not be completely written
+ */
+static int
+capture_eep_send_stream(struct iovec *iov, int count)
+{
+    struct msghdr msg;
+    ssize_t len;
+
+    while (count > 0) {
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+
+        if ((len = sendmsg(eep_cfg.client_sock, &msg, MSG_NOSIGNAL)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return count;
+        }
+
+        // Skip completely written frames
+        while (count > 0 && (size_t) len >= iov->iov_len) {
+            len -= iov->iov_len;
+            iov++;
+            count--;
+        }
+
+        // Continue from the middle of a partially written frame
+        if (count > 0) {
+            iov->iov_base = (u_char *) iov->iov_base + len;
+            iov->iov_len -= len;
+        }
+    }
+
+    return 0;
+}
+
+#ifdef WITH_ZLIB
+/**
+ * @brief Compress a batch of frames and write it to the stream socket
+ *
+ * The compressed stream is flushed after each batch, so the server can
+ * parse all its frames without waiting for more data.
+ *
+ * @return number of frames that could not be written
+ */
+static int
+capture_eep_send_compressed(struct iovec *iov, int count)
+{
+    z_stream *zs = &eep_cfg.zsend;
+    struct iovec out;
+    size_t used;
+    u_char *zbuf;
+    int i, flush;
+
+    zs->next_out = eep_cfg.zbuf;
+    zs->avail_out = eep_cfg.zsize;
+
+    for (i = 0; i < count; i++) {
+        zs->next_in = iov[i].iov_base;
+        zs->avail_in = iov[i].iov_len;
+        flush = (i == count - 1) ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+        do {
+            // Grow compressed buffer until the whole batch fits
+            if (zs->avail_out == 0) {
+                used = zs->next_out - eep_cfg.zbuf;
+                if (!(zbuf = realloc(eep_cfg.zbuf, eep_cfg.zsize * 2)))
+                    return count;
+                eep_cfg.zbuf = zbuf;
+                eep_cfg.zsize *= 2;
+                zs->next_out = eep_cfg.zbuf + used;
+                zs->avail_out = eep_cfg.zsize - used;
+            }
+            if (deflate(zs, flush) == Z_STREAM_ERROR)
+                return count;
+        } while (zs->avail_in > 0 || zs->avail_out == 0);
+    }
+
+    out.iov_base = eep_cfg.zbuf;
+    out.iov_len = zs->next_out - eep_cfg.zbuf;
+    return capture_eep_send_stream(&out, 1) ? count : 0;
+}
+#endif
+
+/**
+ * @brief Write a batch of frames to the stream connection
+ *
+ * All frames are coalesced in the same stream write, compressed if
+ * configured. Connection is closed if frames can not be written.
+ *
+ * @return number of frames that could not be written
+ */
+static int
+capture_eep_write(struct iovec *iov, int count)
+{
+    int sent;
+
+#ifdef WITH_ZLIB
+    if (eep_cfg.capt_compress) {
+        sent = capture_eep_send_compressed(iov, count);
+    } else
+#endif
+    sent = capture_eep_send_stream(iov, count);
+
+    // Connection lost, reconnect before sending more frames
+    if (sent != 0)
+        capture_eep_disconnect();
+    return sent;
+}
+
+/**
+ * @brief Read requests sent by the collector to a probe
+ *
+ * Requests are never compressed. They are answered by the sender thread
+ * before sending more queued records.
+ */
+static void
+capture_eep_read_requests()
+{
+    hep_ctrl_t ctrl;
+    uint32_t pos = 0;
+    ssize_t len;
+
+    len = recv(eep_cfg.client_sock, eep_cfg.requests + eep_cfg.requests_len,
+               CAPTURE_EEP_REQUEST_BUFFER - eep_cfg.requests_len, MSG_DONTWAIT);
+    if (len == 0 || (len == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Collector closed the connection
+        capture_eep_disconnect();
+        return;
+    }
+    if (len > 0)
+        eep_cfg.requests_len += len;
+
+    while (eep_cfg.requests_len - pos >= sizeof(hep_ctrl_t)) {
+        memcpy(&ctrl, eep_cfg.requests + pos, sizeof(hep_ctrl_t));
+
+        // Stream is no longer synchronized with requests boundaries
+        if (memcmp(ctrl.id, CAPTURE_PROBE_ID, 4) != 0 || ntohs(ctrl.length) < sizeof(capture_probe_hdr_t)
+            || ntohs(ctrl.length) > CAPTURE_EEP_REQUEST_BUFFER) {
+            capture_eep_disconnect();
+            return;
+        }
+
+        // Wait for the rest of the request
+        if (eep_cfg.requests_len - pos < ntohs(ctrl.length))
+            break;
+
+        capture_probe_request(eep_cfg.requests + pos, ntohs(ctrl.length));
+        pos += ntohs(ctrl.length);
+
+        // Connection lost while sending the answer
+        if (eep_cfg.client_sock < 0)
+            return;
+    }
+
+    // Move the partial request to the start of the buffer
+    if (pos > 0) {
+        memmove(eep_cfg.requests, eep_cfg.requests + pos, eep_cfg.requests_len - pos);
+        eep_cfg.requests_len -= pos;
+    }
+}
+
+/**
+ * @brief Receive a batch of datagrams from a listener socket
+ *
+ * Wait until at least one datagram is received and return all datagrams
+ * already queued in the socket, up to count.
+ *
+ * @return number of received datagrams or -1 on error
+ */
+static int
+capture_eep_recv_batch(int sock, capture_eep_msg_t *msgs, int count)
+{
+#ifdef HAVE_RECVMMSG
+    return recvmmsg(sock, msgs, count, MSG_WAITFORONE, NULL);
+#else
+    ssize_t len;
+
+    if ((len = recvmsg(sock, &msgs[0].msg_hdr, 0)) == -1)
+        return -1;
+    msgs[0].msg_len = len;
+    return 1;
+#endif
+}
+
+/**
+ * @brief Send a batch of datagrams through the client socket
+ *
+ * @return number of sent datagrams or -1 on error
+ */
+static int
+capture_eep_send_batch(int sock, capture_eep_msg_t *msgs, int count)
+{
+#ifdef HAVE_SENDMMSG
+    return sendmmsg(sock, msgs, count, 0);
+#else
+    ssize_t len;
+
+    if ((len = sendmsg(sock, &msgs[0].msg_hdr, 0)) == -1)
+        return -1;
+    msgs[0].msg_len = len;
+    return 1;
+#endif
+}
+
+/**
+ * @brief Sender thread function
+ *
+ * Send encoded HEP frames in batches and return them to the free frames
+ * queue to be reused.
+ */
+static void *
+capture_eep_send_thread(void *info)
+{
+    capture_eep_frame_t *batch[CAPTURE_EEP_BATCH];
+    capture_eep_msg_t msgs[CAPTURE_EEP_BATCH];
+    struct iovec iovecs[CAPTURE_EEP_BATCH];
+    int i, count, done, sent;
+
+    while (eep_cfg.sending) {
+        // Stream connections are established by this thread
+        if (eep_cfg.client_sock < 0 && capture_eep_reconnect() != 0)
+            continue;
+
+        // Collector can request frames to probes at any time
+        if (eep_cfg.capt_probe) {
+            capture_eep_read_requests();
+            if (eep_cfg.client_sock < 0)
+                continue;
+        }
+
+        for (count = 0; count < CAPTURE_EEP_BATCH; count++) {
+            if (!(batch[count] = queue_pop(eep_cfg.send_queue)))
+                break;
+            iovecs[count].iov_base = batch[count]->data;
+            iovecs[count].iov_len = batch[count]->len;
+            memset(&msgs[count], 0, sizeof(capture_eep_msg_t));
+            msgs[count].msg_hdr.msg_iov = &iovecs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+        }
+
+        // Nothing to send, wait for more frames
+        if (count == 0) {
+            usleep(CAPTURE_QUEUE_WAIT);
+            continue;
+        }
+
+        if (eep_cfg.capt_proto == IPPROTO_TCP) {
+            sent = capture_eep_write(iovecs, count);
+            eep_cfg.sent += count - sent;
+            eep_cfg.send_errors += sent;
+        } else {
+            for (done = 0; done < count; done += sent) {
+                // Skip the datagram that could not be sent
+                if ((sent = capture_eep_send_batch(eep_cfg.client_sock, msgs + done, count - done)) <= 0) {
+                    eep_cfg.send_errors++;
+                    sent = 1;
+                    continue;
+                }
+                eep_cfg.sent += sent;
+            }
+        }
+
+        // Frames buffers can be reused
+        for (i = 0; i < count; i++)
+            queue_push(eep_cfg.send_free, batch[i]);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Get a free frame to encode a HEP packet
+ *
+ * Frames buffers are only grown, so they are reused without allocating
+ * memory once they have the size of common packets.
+ *
+ * @param len Encoded HEP packet length
+ * @return a frame or NULL if all frames are pending to be sent
+ */
+static capture_eep_frame_t *
+capture_eep_frame_get(uint32_t len)
+{
+    capture_eep_frame_t *frame;
+    u_char *data;
+
+    if (!(frame = queue_peek(eep_cfg.send_free))) {
+        eep_cfg.send_drops++;
+        return NULL;
+    }
+
+    if (frame->size < len) {
+        if (!(data = realloc(frame->data, len))) {
+            eep_cfg.send_drops++;
+            return NULL;
+        }
+        frame->data = data;
+        frame->size = len;
+    }
+
+    queue_pop(eep_cfg.send_free);
+    frame->len = len;
+    return frame;
+}
+
+/**
+ * @brief Create frames, queues and thread for sending HEP packets
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int
+capture_eep_send_start()
+{
+    int count = setting_get_intvalue(SETTING_EEP_SEND_QUEUE);
+    int i;
+
+    if (count <= 0)
+        count = CAPTURE_EEP_SEND_QUEUE;
+
+    if (!(eep_cfg.frames = sng_malloc(sizeof(capture_eep_frame_t) * count)))
+        return 1;
+    eep_cfg.frame_count = count;
+
+    // All frames are initially free
+    pthread_mutex_init(&eep_cfg.send_lock, NULL);
+    eep_cfg.send_free = queue_create(count);
+    eep_cfg.send_queue = queue_create(count);
+    if (!eep_cfg.send_free || !eep_cfg.send_queue)
+        return 1;
+    for (i = 0; i < count; i++)
+        queue_push(eep_cfg.send_free, &eep_cfg.frames[i]);
+
+#ifdef WITH_ZLIB
+    if (eep_cfg.capt_compress) {
+        if (deflateInit(&eep_cfg.zsend, Z_DEFAULT_COMPRESSION) != Z_OK)
+            return 1;
+        eep_cfg.zsize = CAPTURE_EEP_STREAM_BUFFER;
+        if (!(eep_cfg.zbuf = malloc(eep_cfg.zsize)))
+            return 1;
+    }
+#endif
+
+    eep_cfg.sending = true;
+    if (thread_create(&eep_cfg.send_thread, THREAD_IO, "sng-hep", capture_eep_send_thread, NULL)) {
+        eep_cfg.sending = false;
+        return 1;
+    }
+
+    return 0;
+}
 
 int
 capture_eep_init()
 {
     struct addrinfo *ai, hints[1] = { { 0 } };
+    int threads, i;
 
     // Setting for EEP client
     if (setting_enabled(SETTING_EEP_SEND)) {
@@ -68,29 +579,39 @@ capture_eep_init()
         eep_cfg.capt_port = setting_get_value(SETTING_EEP_SEND_PORT);
         eep_cfg.capt_password = setting_get_value(SETTING_EEP_SEND_PASS);
         eep_cfg.capt_id = setting_get_intvalue(SETTING_EEP_SEND_ID);;
+        eep_cfg.capt_proto = capture_eep_proto(SETTING_EEP_SEND_PROTO);
+        eep_cfg.capt_compress = setting_enabled(SETTING_EEP_SEND_COMPRESS);
+        eep_cfg.capt_probe = setting_enabled(SETTING_EEP_SEND_PROBE);
 
-        hints->ai_flags = AI_NUMERICSERV;
-        hints->ai_family = AF_UNSPEC;
-        hints->ai_socktype = SOCK_DGRAM;
-        hints->ai_protocol = IPPROTO_UDP;
+        // Stream framing relies on HEPv3 packet length
+        if (eep_cfg.capt_proto == IPPROTO_TCP && eep_cfg.capt_version != 3) {
+            fprintf(stderr, "EEP client: TCP transport requires HEP version 3\n");
+            return 1;
+        }
 
-        if (getaddrinfo(eep_cfg.capt_host, eep_cfg.capt_port, hints, &ai)) {
-            fprintf(stderr, "EEP client: failed getaddrinfo() for %s:%s\n",
-                    eep_cfg.capt_host, eep_cfg.capt_port);
+        // Records are sent and frames requested through the same connection
+        if (eep_cfg.capt_probe && eep_cfg.capt_proto != IPPROTO_TCP) {
+            fprintf(stderr, "EEP client: probe mode requires TCP transport\n");
             return 1;
         }
 
-        eep_cfg.client_sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-        if (eep_cfg.client_sock < 0) {
+        if (capture_eep_check_compress(eep_cfg.capt_compress, eep_cfg.capt_proto) != 0) {
+            fprintf(stderr, "EEP client: compression requires TCP transport and zlib support\n");
+            return 1;
+        }
+
+        if (eep_cfg.capt_proto == IPPROTO_TCP) {
+            // Stream connection is established by the sender thread
+            eep_cfg.client_sock = -1;
+        } else if (capture_eep_connect() != 0) {
             fprintf(stderr, "Sender socket creation failed: %s\n", strerror(errno));
             return 1;
         }
 
-        if (connect(eep_cfg.client_sock, ai->ai_addr, (socklen_t) (ai->ai_addrlen)) == -1) {
-            if (errno != EINPROGRESS) {
-                fprintf(stderr, "Sender socket creation failed: %s\n", strerror(errno));
-                return 1;
-            }
+        // Packets are encoded by capture and sent from a dedicated thread
+        if (capture_eep_send_start() != 0) {
+            fprintf(stderr, "Sender thread creation failed\n");
+            return 1;
         }
     }
 
@@ -100,11 +621,24 @@ capture_eep_init()
         eep_cfg.capt_srv_host = setting_get_value(SETTING_EEP_LISTEN_ADDR);
         eep_cfg.capt_srv_port = setting_get_value(SETTING_EEP_LISTEN_PORT);
         eep_cfg.capt_srv_password = setting_get_value(SETTING_EEP_LISTEN_PASS);
+        eep_cfg.capt_srv_proto = capture_eep_proto(SETTING_EEP_LISTEN_PROTO);
+        eep_cfg.capt_srv_compress = setting_enabled(SETTING_EEP_LISTEN_COMPRESS);
+
+        // Stream framing relies on HEPv3 packet length
+        if (eep_cfg.capt_srv_proto == IPPROTO_TCP && eep_cfg.capt_srv_version != 3) {
+            fprintf(stderr, "EEP server: TCP transport requires HEP version 3\n");
+            return 1;
+        }
+
+        if (capture_eep_check_compress(eep_cfg.capt_srv_compress, eep_cfg.capt_srv_proto) != 0) {
+            fprintf(stderr, "EEP server: compression requires TCP transport and zlib support\n");
+            return 1;
+        }
 
         hints->ai_flags = AI_NUMERICSERV;
         hints->ai_family = AF_UNSPEC;
-        hints->ai_socktype = SOCK_DGRAM;
-        hints->ai_protocol = IPPROTO_UDP;
+        hints->ai_socktype = (eep_cfg.capt_srv_proto == IPPROTO_TCP) ? SOCK_STREAM : SOCK_DGRAM;
+        hints->ai_protocol = eep_cfg.capt_srv_proto;
 
         if (getaddrinfo(eep_cfg.capt_srv_host, eep_cfg.capt_srv_port, hints, &ai)) {
             fprintf(stderr, "EEP server: failed getaddrinfo() for %s:%s\n",
@@ -112,93 +646,499 @@ capture_eep_init()
             return 1;
         }
 
-        // Create a socket for a new TCP IPv4 connection
-        eep_cfg.server_sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (eep_cfg.client_sock < 0) {
-            fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
-            return 1;
+        threads = setting_get_intvalue(SETTING_EEP_LISTEN_THREADS);
+#ifndef SO_REUSEPORT
+        // Without SO_REUSEPORT only one socket can be bound to the address
+        threads = 1;
+#endif
+        if (threads < 1)
+            threads = 1;
+
+        for (i = 0; i < threads; i++) {
+            if (capture_eep_listener_create(ai, threads > 1) != 0) {
+                freeaddrinfo(ai);
+                return 1;
+            }
         }
+        freeaddrinfo(ai);
+    }
+
+    // Settings for EEP server
+    return 0;
+}
+
+/**
+ * @brief Create a HEP listener socket and its capture source
+ *
+ * @param ai Listen address
+ * @param reuse Allow other listeners to bind the same address
+ * @return 0 on success, 1 otherwise
+ */
+static int
+capture_eep_listener_create(struct addrinfo *ai, bool reuse)
+{
+    capture_info_t *capinfo;
+    capture_eep_listener_t *listener;
+    int rcvbuf = setting_get_intvalue(SETTING_EEP_LISTEN_RCVBUF) * 1024;
+    int on = 1;
+
+    // Create a new structure to handle this capture source
+    if (!(capinfo = sng_malloc(sizeof(capture_info_t)))
+        || !(listener = sng_malloc(sizeof(capture_eep_listener_t)))) {
+        fprintf(stderr, "Can't allocate memory for capture data!\n");
+        return 1;
+    }
+    capinfo->eep = listener;
+
+    // Create a socket for receiving HEP packets
+    listener->sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (listener->sock < 0) {
+        fprintf(stderr, "Error creating server socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // Allow restarting while previous connections are closing
+    if (ai->ai_protocol == IPPROTO_TCP)
+        setsockopt(listener->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+#ifdef SO_REUSEPORT
+    // Kernel balances incoming datagrams or connections between all listeners
+    if (reuse && setsockopt(listener->sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        fprintf(stderr, "Error sharing server socket: %s\n", strerror(errno));
+        return 1;
+    }
+#endif
+
+    // Bursts from many agents must fit in the socket until they are read
+    if (rcvbuf > 0) {
+#ifdef SO_RCVBUFFORCE
+        if (setsockopt(listener->sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) == -1)
+#endif
+            setsockopt(listener->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
+#ifdef SO_RXQ_OVFL
+    // Get the number of datagrams dropped by the kernel with each datagram
+    if (ai->ai_protocol == IPPROTO_UDP)
+        setsockopt(listener->sock, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+#endif
+
+    // Bind that socket to the requested address and port
+    if (bind(listener->sock, ai->ai_addr, ai->ai_addrlen) == -1) {
+        fprintf(stderr, "Error binding address: %s\n", strerror(errno));
+        return 1;
+    }
 
-        // Bind that socket to the requested address and port
-        if (bind(eep_cfg.server_sock, ai->ai_addr, ai->ai_addrlen) == -1) {
-            fprintf(stderr, "Error binding address: %s\n", strerror(errno));
+    if (ai->ai_protocol == IPPROTO_TCP) {
+        // Wait for agents connections
+        if (listen(listener->sock, SOMAXCONN) == -1) {
+            fprintf(stderr, "Error listening address: %s\n", strerror(errno));
             return 1;
         }
 
-        capture_info_t *capinfo;
-
-        // Create a new structure to handle this capture source
-        if (!(capinfo = sng_malloc(sizeof(capture_info_t)))) {
+        if (!(listener->clients = sng_malloc(sizeof(capture_eep_client_t) * CAPTURE_EEP_CLIENTS))) {
             fprintf(stderr, "Can't allocate memory for capture data!\n");
             return 1;
         }
 
-        // Set capture thread function
-        capinfo->capture_fn = accept_eep_client;
-        capinfo->ispcap = false;
+        // Probes connected to this listener can be requested for frames
+        pthread_mutex_init(&listener->lock, NULL);
+        if (!eep_cfg.listeners)
+            eep_cfg.listeners = vector_create(1, 1);
+        vector_append(eep_cfg.listeners, listener);
+    }
 
-        // Open capture device
-        capinfo->handle = pcap_open_dead(DLT_EN10MB, MAXIMUM_SNAPLEN);
+    // Set capture thread function
+    capinfo->capture_fn = (ai->ai_protocol == IPPROTO_TCP) ? capture_eep_stream_thread : accept_eep_client;
+    capinfo->ispcap = false;
 
-        // Get datalink to parse packets correctly
-        capinfo->link = pcap_datalink(capinfo->handle);
+    // Name this source after the listen address
+    snprintf(listener->name, sizeof(listener->name), "%s:%s:%s",
+             (ai->ai_protocol == IPPROTO_TCP) ? "tcp" : "udp",
+             eep_cfg.capt_srv_host, eep_cfg.capt_srv_port);
+    capinfo->device = listener->name;
 
-        // Check linktypes sngrep knowns before start parsing packets
-        if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
-            fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
-            return 3;
-        }
+    // Open capture device
+    capinfo->handle = pcap_open_dead(DLT_EN10MB, MAXIMUM_SNAPLEN);
 
-        // Create Vectors for IP and TCP reassembly
-        capinfo->tcp_reasm = vector_create(0, 10);
-        capinfo->ip_reasm = vector_create(0, 10);
+    // Get datalink to parse packets correctly
+    capinfo->link = pcap_datalink(capinfo->handle);
 
-        // Add this capture information as packet source
-        capture_add_source(capinfo);
+    // Check linktypes sngrep knowns before start parsing packets
+    if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
+        fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
+        return 3;
     }
 
-    // Settings for EEP server
+    // Create Vectors for IP and TCP reassembly
+    capinfo->tcp_reasm = capture_tcp_reasm_create();
+    capinfo->ip_reasm = capture_ip_reasm_create();
+
+    // Add this capture information as packet source
+    capture_add_source(capinfo);
     return 0;
 }
 
-
 void *
 accept_eep_client(void *info)
 {
-    packet_t *pkt;
     capture_info_t *capinfo = (capture_info_t *) info;
+    capture_eep_listener_t *listener = capinfo->eep;
+    capture_eep_msg_t msgs[CAPTURE_EEP_BATCH];
+    struct iovec iovecs[CAPTURE_EEP_BATCH];
+    char control[CAPTURE_EEP_BATCH][CAPTURE_EEP_CONTROL_LEN];
+#ifdef SO_RXQ_OVFL
+    struct cmsghdr *cmsg;
+#endif
+    u_char *buffers;
+    packet_t *pkt;
+    int i, count;
 
-    // Begin accepting connections
-    while (eep_cfg.server_sock > 0) {
-        if ((pkt = capture_eep_receive())) {
-            // Avoid parsing from multiples sources.
-            // Avoid parsing while screen in being redrawn
-            capture_lock();
-            if (capture_packet_parse(pkt) != 0) {
-                packet_destroy(pkt);
+    // Datagrams are parsed directly from receive buffers
+    if (!(buffers = sng_malloc(CAPTURE_EEP_BATCH * MAX_CAPTURE_LEN))) {
+        capinfo->running = false;
+        queue_close(capinfo->queue);
+        return NULL;
+    }
+
+    for (i = 0; i < CAPTURE_EEP_BATCH; i++) {
+        iovecs[i].iov_base = buffers + i * MAX_CAPTURE_LEN;
+        iovecs[i].iov_len = MAX_CAPTURE_LEN;
+    }
+
+    // Begin receiving datagrams
+    while (capinfo->running) {
+        for (i = 0; i < CAPTURE_EEP_BATCH; i++) {
+            memset(&msgs[i], 0, sizeof(capture_eep_msg_t));
+            msgs[i].msg_hdr.msg_iov = &iovecs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = CAPTURE_EEP_CONTROL_LEN;
+        }
+
+        if ((count = capture_eep_recv_batch(listener->sock, msgs, CAPTURE_EEP_BATCH)) <= 0) {
+            if (count == 0 || errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < count; i++) {
+            capinfo->received++;
+
+#ifdef SO_RXQ_OVFL
+            // Kernel reports the total datagrams dropped by this socket
+            for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+                    memcpy(&listener->drops, CMSG_DATA(cmsg), sizeof(uint32_t));
             }
-            capture_unlock();
+#endif
+
+            if (!(pkt = capture_eep_receive(iovecs[i].iov_base, msgs[i].msg_len))) {
+                __atomic_add_fetch(&capinfo->rejected, 1, __ATOMIC_RELAXED);
+                continue;
+            }
+
+            // Let the parser thread handle this packet
+            pkt->source = capinfo;
+            capture_queue_packet(capinfo, pkt);
         }
     }
 
+    sng_free(buffers);
+
     // Mark capture as not longer running
     capinfo->running = false;
 
-    // Leave the thread gracefully
-    pthread_exit(NULL);
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
+    return NULL;
+}
+
+/**
+ * @brief Parse HEP packets received from a stream connection
+ *
+ * Each complete HEP packet in the client buffer, delimited by its length
+ * header, is queued to be parsed.
+ *
+ * @return 0 if connection must be kept open, 1 otherwise
+ */
+static int
+capture_eep_stream_parse(capture_info_t *capinfo, capture_eep_client_t *client)
+{
+    hep_ctrl_t ctrl;
+    packet_t *pkt;
+    uint32_t pos = 0;
+    bool probe;
+
+    // Parse all complete HEP packets
+    while (client->len - pos >= sizeof(hep_ctrl_t)) {
+        memcpy(&ctrl, client->buffer + pos, sizeof(hep_ctrl_t));
+
+        // Stream is no longer synchronized with packets boundaries
+        probe = !memcmp(ctrl.id, CAPTURE_PROBE_ID, 4);
+        if ((!probe && memcmp(ctrl.id, "\x48\x45\x50\x33", 4) != 0) || ntohs(ctrl.length) < sizeof(hep_ctrl_t))
+            return 1;
+
+        // Wait for the rest of the packet
+        if (client->len - pos < ntohs(ctrl.length))
+            break;
+
+        capinfo->received++;
+        if (probe) {
+            // Parsed records sent by a sngrep probe
+            if (capture_probe_receive(capinfo, client, client->buffer + pos, ntohs(ctrl.length)) != 0)
+                return 1;
+        } else if ((pkt = capture_eep_receive(client->buffer + pos, ntohs(ctrl.length)))) {
+            // Let the parser thread handle this packet
+            pkt->source = capinfo;
+            capture_queue_packet(capinfo, pkt);
+        } else {
+            __atomic_add_fetch(&capinfo->rejected, 1, __ATOMIC_RELAXED);
+        }
+        pos += ntohs(ctrl.length);
+    }
+
+    // Move the partial packet to the start of the buffer
+    if (pos > 0) {
+        memmove(client->buffer, client->buffer + pos, client->len - pos);
+        client->len -= pos;
+    }
+
+    return 0;
+}
+
+#ifdef WITH_ZLIB
+/**
+ * @brief Decompress data received from a compressed stream connection
+ *
+ * Decompressed data is parsed each time the client buffer is filled.
+ * A full buffer always contains a complete HEP packet, so parsing
+ * always makes room for more data.
+ *
+ * @return 0 if connection must be kept open, 1 otherwise
+ */
+static int
+capture_eep_stream_inflate(capture_info_t *capinfo, capture_eep_client_t *client)
+{
+    u_char data[CAPTURE_EEP_ZCHUNK];
+    z_stream *zs = client->zrecv;
+    ssize_t len;
+    int ret;
+
+    len = recv(client->sock, data, sizeof(data), 0);
+    if (len <= 0)
+        return (len == -1 && errno == EINTR) ? 0 : 1;
+
+    zs->next_in = data;
+    zs->avail_in = len;
+    do {
+        zs->next_out = client->buffer + client->len;
+        zs->avail_out = CAPTURE_EEP_STREAM_BUFFER - client->len;
+        ret = inflate(zs, Z_SYNC_FLUSH);
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return 1;
+        client->len = CAPTURE_EEP_STREAM_BUFFER - zs->avail_out;
+        if (capture_eep_stream_parse(capinfo, client) != 0)
+            return 1;
+    } while (zs->avail_in > 0 || zs->avail_out == 0);
+
     return 0;
 }
+#endif
+
+/**
+ * @brief Read HEP packets from a stream connection
+ *
+ * Received data is appended to the client buffer and parsed.
+ *
+ * @return 0 if connection must be kept open, 1 otherwise
+ */
+static int
+capture_eep_stream_read(capture_info_t *capinfo, capture_eep_client_t *client)
+{
+    ssize_t len;
+
+#ifdef WITH_ZLIB
+    if (client->zrecv)
+        return capture_eep_stream_inflate(capinfo, client);
+#endif
+
+    len = recv(client->sock, client->buffer + client->len, CAPTURE_EEP_STREAM_BUFFER - client->len, 0);
+    if (len <= 0)
+        return (len == -1 && errno == EINTR) ? 0 : 1;
+    client->len += len;
+
+    return capture_eep_stream_parse(capinfo, client);
+}
+
+/**
+ * @brief Close a stream connection of a listener
+ *
+ * The last connection takes the place of the closed one.
+ */
+static void
+capture_eep_stream_close(capture_eep_listener_t *listener, int index)
+{
+    close(listener->clients[index].sock);
+    sng_free(listener->clients[index].buffer);
+#ifdef WITH_ZLIB
+    if (listener->clients[index].zrecv) {
+        inflateEnd(listener->clients[index].zrecv);
+        sng_free(listener->clients[index].zrecv);
+    }
+#endif
+    listener->clients[index] = listener->clients[--listener->client_count];
+}
+
+/**
+ * @brief Capture thread function for EEP stream listener sources
+ *
+ * Accept agents connections and read HEP packets from all of them.
+ */
+static void *
+capture_eep_stream_thread(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_eep_listener_t *listener = capinfo->eep;
+    capture_eep_client_t *client;
+    struct pollfd pfds[CAPTURE_EEP_CLIENTS + 1];
+    int i, count, sock;
+
+    while (capinfo->running) {
+        pfds[0].fd = listener->sock;
+        pfds[0].events = POLLIN;
+        count = listener->client_count;
+        for (i = 0; i < count; i++) {
+            pfds[i + 1].fd = listener->clients[i].sock;
+            pfds[i + 1].events = POLLIN;
+        }
+
+        // Wait for new connections or data from connected agents
+        if (poll(pfds, count + 1, 1000) <= 0)
+            continue;
+
+        // Closed connections are replaced by the last one, iterate backwards
+        for (i = count - 1; i >= 0; i--) {
+            if (pfds[i + 1].revents && capture_eep_stream_read(capinfo, &listener->clients[i]) != 0) {
+                pthread_mutex_lock(&listener->lock);
+                capture_eep_stream_close(listener, i);
+                pthread_mutex_unlock(&listener->lock);
+            }
+        }
+
+        if (!(pfds[0].revents & POLLIN) || (sock = accept(listener->sock, NULL, NULL)) == -1)
+            continue;
+
+        // Reject connections over the limit
+        if (listener->client_count == CAPTURE_EEP_CLIENTS) {
+            close(sock);
+            continue;
+        }
+
+        client = &listener->clients[listener->client_count];
+        if (!(client->buffer = sng_malloc(CAPTURE_EEP_STREAM_BUFFER))) {
+            close(sock);
+            continue;
+        }
+        client->sock = sock;
+        client->len = 0;
+        client->probe = false;
+#ifdef WITH_ZLIB
+        // Each connection is an independent compressed stream
+        client->zrecv = NULL;
+        if (eep_cfg.capt_srv_compress) {
+            if (!(client->zrecv = sng_malloc(sizeof(z_stream))) || inflateInit(client->zrecv) != Z_OK) {
+                sng_free(client->zrecv);
+                sng_free(client->buffer);
+                close(sock);
+                continue;
+            }
+        }
+#endif
+        pthread_mutex_lock(&listener->lock);
+        listener->client_count++;
+        pthread_mutex_unlock(&listener->lock);
+    }
+
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
+    return NULL;
+}
+
+uint64_t
+capture_eep_drops(capture_info_t *capinfo)
+{
+    return capinfo->eep->drops;
+}
+
+void
+capture_eep_close(capture_info_t *capinfo)
+{
+    capture_eep_listener_t *listener = capinfo->eep;
+
+    if (!listener)
+        return;
+
+    if (listener->sock > 0)
+        close(listener->sock);
+
+    // Close connected agents
+    if (listener->clients) {
+        pthread_mutex_lock(&listener->lock);
+        vector_remove(eep_cfg.listeners, listener);
+        while (listener->client_count)
+            capture_eep_stream_close(listener, listener->client_count - 1);
+        pthread_mutex_unlock(&listener->lock);
+    }
+    sng_free(listener->clients);
+
+    sng_free(listener);
+    capinfo->eep = NULL;
+}
 
 void
 capture_eep_deinit()
 {
-    if (eep_cfg.client_sock)
+    int i;
+
+    // Stop sender thread
+    if (eep_cfg.sending) {
+        eep_cfg.sending = false;
+        pthread_join(eep_cfg.send_thread, NULL);
+    }
+
+    // Pending frames are discarded
+    for (i = 0; i < eep_cfg.frame_count; i++)
+        sng_free(eep_cfg.frames[i].data);
+    sng_free(eep_cfg.frames);
+    eep_cfg.frames = NULL;
+    eep_cfg.frame_count = 0;
+    if (eep_cfg.send_free)
+        queue_destroy(eep_cfg.send_free);
+    if (eep_cfg.send_queue)
+        queue_destroy(eep_cfg.send_queue);
+    eep_cfg.send_free = eep_cfg.send_queue = NULL;
+
+    if (eep_cfg.client_sock > 0) {
         close(eep_cfg.client_sock);
+        eep_cfg.client_sock = 0;
+    }
 
-    if (eep_cfg.server_sock) {
-        close(eep_cfg.server_sock);
-        eep_cfg.server_sock = -1;
+#ifdef WITH_ZLIB
+    if (eep_cfg.zbuf) {
+        deflateEnd(&eep_cfg.zsend);
+        free(eep_cfg.zbuf);
+        eep_cfg.zbuf = NULL;
     }
+#endif
+}
+
+void
+capture_eep_send_stats(uint64_t *sent, uint64_t *drops, uint64_t *errors)
+{
+    *sent = eep_cfg.sent;
+    *drops = eep_cfg.send_drops;
+    *errors = eep_cfg.send_errors;
 }
 
 const char *
@@ -213,6 +1153,67 @@ capture_eep_listen_port()
     return eep_cfg.capt_srv_port;
 }
 
+const char *
+capture_eep_listen_password()
+{
+    return eep_cfg.capt_srv_password;
+}
+
+bool
+capture_eep_send_probe()
+{
+    return eep_cfg.sending && eep_cfg.capt_probe;
+}
+
+int
+capture_eep_send_record(const u_char *data, uint32_t len)
+{
+    capture_eep_frame_t *frame;
+
+    pthread_mutex_lock(&eep_cfg.send_lock);
+    if ((frame = capture_eep_frame_get(len))) {
+        memcpy(frame->data, data, len);
+        // Let the sender thread send this frame
+        queue_push(eep_cfg.send_queue, frame);
+    }
+    pthread_mutex_unlock(&eep_cfg.send_lock);
+    return (frame) ? 0 : 1;
+}
+
+int
+capture_eep_send_direct(const u_char *data, uint32_t len)
+{
+    struct iovec iov;
+
+    if (eep_cfg.client_sock < 0)
+        return 1;
+
+    iov.iov_base = (void *) data;
+    iov.iov_len = len;
+    if (capture_eep_write(&iov, 1) != 0) {
+        eep_cfg.send_errors++;
+        return 1;
+    }
+    return 0;
+}
+
+void
+capture_eep_fetch(const u_char *data, uint32_t len)
+{
+    capture_eep_listener_t *listener;
+    int i;
+
+    vector_iter_t it = vector_iterator(eep_cfg.listeners);
+    while ((listener = vector_iterator_next(&it))) {
+        pthread_mutex_lock(&listener->lock);
+        for (i = 0; i < listener->client_count; i++) {
+            if (listener->clients[i].probe)
+                send(listener->clients[i].sock, data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+        pthread_mutex_unlock(&listener->lock);
+    }
+}
+
 int
 capture_eep_send(packet_t *pkt)
 {
@@ -220,8 +1221,12 @@ capture_eep_send(packet_t *pkt)
     if (pkt->type == PACKET_RTP)
         return 1;
 
-    // Check we have a connection established
-    if (!eep_cfg.client_sock)
+    // Probes send parsed records instead of packets
+    if (eep_cfg.capt_probe)
+        return 1;
+
+    // Check sender thread is running (stream connection may be down)
+    if (!eep_cfg.sending)
         return 1;
 
     switch (eep_cfg.capt_version) {
@@ -261,8 +1266,10 @@ capture_eep_build_frame_data(
         .ip_len = htons(sizeof(ip_hdr) + sizeof(struct udphdr) + payload_size),
         .ip_ttl = 128,
     };
-    inet_pton(AF_INET, src.ip, &ip_hdr.ip_src);
-    inet_pton(AF_INET, dst.ip, &ip_hdr.ip_dst);
+    if (src.family == AF_INET)
+        ip_hdr.ip_src = src.ip.v4;
+    if (dst.family == AF_INET)
+        ip_hdr.ip_dst = dst.ip.v4;
 
     // Build frame UDP header
     struct udphdr udp_hdr = {
@@ -295,6 +1302,7 @@ capture_eep_build_frame_data(
 int
 capture_eep_send_v2(packet_t *pkt)
 {
+    capture_eep_frame_t *eep_frame;
     void* buffer;
     uint32_t buflen = 0, tlen = 0;
     struct hep_hdr hdr;
@@ -324,8 +1332,8 @@ capture_eep_send_v2(packet_t *pkt)
 
     /* IPv4 */
     if (pkt->ip_version == 4) {
-        inet_pton(AF_INET, pkt->src.ip, &hep_ipheader.hp_src);
-        inet_pton(AF_INET, pkt->dst.ip, &hep_ipheader.hp_dst);
+        hep_ipheader.hp_src = pkt->src.ip.v4;
+        hep_ipheader.hp_dst = pkt->dst.ip.v4;
         tlen += sizeof(struct hep_iphdr);
         hdr.hp_l += sizeof(struct hep_iphdr);
     }
@@ -333,8 +1341,8 @@ capture_eep_send_v2(packet_t *pkt)
 #ifdef USE_IPV6
     /* IPv6 */
     else if(pkt->ip_version == 6) {
-        inet_pton(AF_INET6, pkt->src.ip, &hep_ip6header.hp6_src);
-        inet_pton(AF_INET6, pkt->dst.ip, &hep_ip6header.hp6_dst);
+        hep_ip6header.hp6_src = pkt->src.ip.v6;
+        hep_ip6header.hp6_dst = pkt->dst.ip.v6;
         tlen += sizeof(struct hep_ip6hdr);
         hdr.hp_l += sizeof(struct hep_ip6hdr);
     }
@@ -344,9 +1352,10 @@ capture_eep_send_v2(packet_t *pkt)
     tlen += len;
     hdr.hp_l = htons(tlen);
 
-    // Allocate memory for HEPv2 packet
-    if (!(buffer = sng_malloc(tlen)))
+    // Get a frame for HEPv2 packet
+    if (!(eep_frame = capture_eep_frame_get(tlen)))
         return 1;
+    buffer = eep_frame->data;
 
     // Copy basic headers
     buflen = 0;
@@ -373,20 +1382,16 @@ capture_eep_send_v2(packet_t *pkt)
     memcpy((void*) buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
-        return 1;
-    }
-
-    /* FREE */
-    sng_free(buffer);
-
-    return 1;
+    // Let the sender thread send this frame
+    queue_push(eep_cfg.send_queue, eep_frame);
+    return 0;
 }
 
 int
 capture_eep_send_v3(packet_t *pkt)
 {
-    struct hep_generic *hg = NULL;
+    struct hep_generic hep_generic, *hg = &hep_generic;
+    capture_eep_frame_t *eep_frame;
     void* buffer;
     uint32_t buflen = 0, iplen = 0, tlen = 0;
     hep_chunk_ip4_t src_ip4, dst_ip4;
@@ -399,7 +1404,7 @@ capture_eep_send_v3(packet_t *pkt)
     unsigned char *data = packet_payload(pkt);
     uint32_t len = packet_payloadlen(pkt);
 
-    hg = sng_malloc(sizeof(struct hep_generic));
+    memset(hg, 0, sizeof(struct hep_generic));
 
     /* header set "HEP3" */
     memcpy(hg->header.id, "\x48\x45\x50\x33", 4);
@@ -421,13 +1426,13 @@ capture_eep_send_v3(packet_t *pkt)
         /* SRC IP */
         src_ip4.chunk.vendor_id = htons(0x0000);
         src_ip4.chunk.type_id = htons(0x0003);
-        inet_pton(AF_INET, pkt->src.ip, &src_ip4.data);
+        src_ip4.data = pkt->src.ip.v4;
         src_ip4.chunk.length = htons(sizeof(src_ip4));
 
         /* DST IP */
         dst_ip4.chunk.vendor_id = htons(0x0000);
         dst_ip4.chunk.type_id = htons(0x0004);
-        inet_pton(AF_INET, pkt->dst.ip, &dst_ip4.data);
+        dst_ip4.data = pkt->dst.ip.v4;
         dst_ip4.chunk.length = htons(sizeof(dst_ip4));
 
         iplen = sizeof(dst_ip4) + sizeof(src_ip4);
@@ -439,13 +1444,13 @@ capture_eep_send_v3(packet_t *pkt)
         /* SRC IPv6 */
         src_ip6.chunk.vendor_id = htons(0x0000);
         src_ip6.chunk.type_id = htons(0x0005);
-        inet_pton(AF_INET6, pkt->src.ip, &src_ip6.data);
+        src_ip6.data = pkt->src.ip.v6;
         src_ip6.chunk.length = htons(sizeof(src_ip6));
 
         /* DST IPv6 */
         dst_ip6.chunk.vendor_id = htons(0x0000);
         dst_ip6.chunk.type_id = htons(0x0006);
-        inet_pton(AF_INET6, pkt->dst.ip, &dst_ip6.data);
+        dst_ip6.data = pkt->dst.ip.v6;
         dst_ip6.chunk.length = htons(sizeof(dst_ip6));
 
         iplen = sizeof(dst_ip6) + sizeof(src_ip6);
@@ -509,10 +1514,10 @@ capture_eep_send_v3(packet_t *pkt)
     /* total */
     hg->header.length = htons(tlen);
 
-    if (!(buffer = sng_malloc(tlen))) {
-        sng_free(hg);
+    // Get a frame for HEPv3 packet
+    if (!(eep_frame = capture_eep_frame_get(tlen)))
         return 1;
-    }
+    buffer = eep_frame->data;
     memcpy((void*) buffer, hg, sizeof(struct hep_generic));
     buflen = sizeof(struct hep_generic);
 
@@ -557,35 +1562,30 @@ capture_eep_send_v3(packet_t *pkt)
     memcpy((void*) buffer + buflen, data, len);
     buflen += len;
 
-    if (send(eep_cfg.client_sock, buffer, buflen, 0) == -1) {
-        return 1;
-    }
-
-    /* FREE */
-    sng_free(buffer);
-    sng_free(hg);
+    // Let the sender thread send this frame
+    queue_push(eep_cfg.send_queue, eep_frame);
     return 0;
 }
 
 packet_t *
-capture_eep_receive()
+capture_eep_receive(const u_char *pkt, uint32_t size)
 {
     switch (eep_cfg.capt_srv_version) {
         case 2:
-            return capture_eep_receive_v2();
+            return capture_eep_receive_v2(pkt, size);
         case 3:
-            return capture_eep_receive_v3(NULL, 0);
+            return capture_eep_receive_v3(pkt, size);
     }
     return NULL;
 }
 
 packet_t *
-capture_eep_receive_v2()
+capture_eep_receive_v2(const u_char *pkt, uint32_t size)
 {
     uint8_t family, proto;
     unsigned char *payload = 0;
     uint32_t pos;
-    char buffer[MAX_CAPTURE_LEN] ;
+    const u_char *buffer = pkt;
     //! Source Address
     address_t src;
     //! Destination address
@@ -593,10 +1593,7 @@ capture_eep_receive_v2()
     //! Packet header
     struct pcap_pkthdr header;
     //! New created packet pointer
-    packet_t *pkt;
-    //! EEP client data
-    struct sockaddr_storage eep_client;
-    socklen_t eep_client_len=sizeof(eep_client);
+    packet_t *pkt_new;
     struct hep_hdr hdr;
     struct hep_timehdr hep_time;
     struct hep_iphdr hep_ipheader;
@@ -607,11 +1604,8 @@ capture_eep_receive_v2()
     struct hep_ip6hdr hep_ip6header;
 #endif
 
-    // Initialize buffer
-    memset(buffer, 0, MAX_CAPTURE_LEN);
-
-    /* Receive EEP generic header */
-    if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, (struct sockaddr*)&eep_client, &eep_client_len) == -1)
+    // Check received data contains a HEPv2 header
+    if (size < sizeof(struct hep_hdr))
         return NULL;
 
     /* Copy initial bytes to HEPv2 header */
@@ -621,6 +1615,10 @@ capture_eep_receive_v2()
     if (hdr.hp_v != 2)
         return NULL;
 
+    // Check received data contains the whole packet
+    if (ntohs(hdr.hp_l) > size)
+        return NULL;
+
     /* IP proto */
     family = hdr.hp_f;
     /* Proto ID */
@@ -631,16 +1629,16 @@ capture_eep_receive_v2()
     /* IPv4 */
     if (family == AF_INET) {
         memcpy(&hep_ipheader, (void*) buffer + pos, sizeof(struct hep_iphdr));
-        inet_ntop(AF_INET, &hep_ipheader.hp_src, src.ip, sizeof(src.ip));
-        inet_ntop(AF_INET, &hep_ipheader.hp_dst, dst.ip, sizeof(dst.ip));
+        address_set_ip(&src, AF_INET, &hep_ipheader.hp_src);
+        address_set_ip(&dst, AF_INET, &hep_ipheader.hp_dst);
         pos += sizeof(struct hep_iphdr);
     }
 #ifdef USE_IPV6
     /* IPv6 */
     else if(family == AF_INET6) {
         memcpy(&hep_ip6header, (void*) buffer + pos, sizeof(struct hep_ip6hdr));
-        inet_ntop(AF_INET6, &hep_ip6header.hp6_src, src.ip, sizeof(src.ip));
-        inet_ntop(AF_INET6, &hep_ip6header.hp6_dst, dst.ip, sizeof(dst.ip));
+        address_set_ip(&src, AF_INET6, &hep_ip6header.hp6_src);
+        address_set_ip(&dst, AF_INET6, &hep_ip6header.hp6_dst);
         pos += sizeof(struct hep_ip6hdr);
     }
 #endif
@@ -649,6 +1647,10 @@ capture_eep_receive_v2()
     src.port = ntohs(hdr.hp_sport);
     dst.port = ntohs(hdr.hp_dport);
 
+    // Check headers fit in packet length
+    if (pos + sizeof(struct hep_timehdr) > ntohs(hdr.hp_l))
+        return NULL;
+
     /* TIMESTAMP*/
     memcpy(&hep_time, (void*) buffer + pos, sizeof(struct hep_timehdr));
     pos += sizeof(struct hep_timehdr);
@@ -669,21 +1671,18 @@ capture_eep_receive_v2()
     frame_pcap_header = capture_eep_build_frame_data(header, payload,header.caplen, src, dst, &frame_payload);
 
     // Create a new packet
-    pkt = packet_create((family == AF_INET) ? 4 : 6, proto, src, dst, 0);
-    packet_add_frame(pkt, &frame_pcap_header, frame_payload);
-    packet_set_transport_data(pkt, src.port, dst.port);
-    packet_set_type(pkt, PACKET_SIP_UDP);
-    packet_set_payload(pkt, payload, header.caplen);
+    pkt_new = packet_create((family == AF_INET) ? 4 : 6, proto, src, dst, 0);
+    packet_add_frame(pkt_new, &frame_pcap_header, frame_payload);
+    packet_set_transport_data(pkt_new, src.port, dst.port);
+    packet_set_type(pkt_new, PACKET_SIP_UDP);
+    packet_set_payload(pkt_new, payload, header.caplen);
 
     // We don't longer require frame payload anymore, because adding the frame to packet clones its memory
     sng_free(frame_payload);
 
-    // Store this packets in output file
-    capture_dump_packet(pkt);
-
     /* FREE */
     sng_free(payload);
-    return pkt;
+    return pkt_new;
 
 }
 
@@ -712,12 +1711,9 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     int password_len;
     unsigned char *payload = 0;
     uint32_t total_len, pos;
-    char buffer[MAX_CAPTURE_LEN] ;
+    const u_char *buffer = pkt;
     //! Source and Destination Address
     address_t src, dst;
-    //! EEP client data
-    struct sockaddr_storage eep_client;
-    socklen_t eep_client_len=sizeof(eep_client);
     //! Packet header
     struct pcap_pkthdr header;
     //! New created packet pointer
@@ -726,13 +1722,9 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     struct pcap_pkthdr frame_pcap_header;
     unsigned char *frame_payload;
 
-    if(!pkt) {
-        /* Receive EEP generic header */
-        if (recvfrom(eep_cfg.server_sock, buffer, MAX_CAPTURE_LEN, 0, (struct sockaddr*)&eep_client, &eep_client_len) == -1)
-            return NULL;
-    } else {
-        memcpy(&buffer, pkt, size);
-    }
+    // Check received data contains a HEP header
+    if (size < sizeof(hep_ctrl_t))
+        return NULL;
 
     // Initialize structs
     memset(&hg, 0, sizeof(hep_generic_t));
@@ -742,16 +1734,19 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     memset(&header, 0, sizeof(struct pcap_pkthdr));
 
     /* Copy initial bytes to EEP Generic header */
-    memcpy(&hg.header, buffer, sizeof(struct hep_generic));
+    memcpy(&hg.header, buffer, sizeof(hep_ctrl_t));
 
     /* header check */
     if (memcmp(hg.header.id, "\x48\x45\x50\x33", 4) != 0)
         return NULL;
 
+    // Check received data contains the whole packet
     total_len = ntohs(hg.header.length);
+    if (total_len > size)
+        return NULL;
     pos = sizeof(hep_ctrl_t);
 
-    while (pos < total_len) {
+    while (pos + sizeof(hep_chunk_t) <= total_len) {
 
         hep_chunk_t *chunk = (struct hep_chunk*) (buffer + pos);
         int chunk_vendor = ntohs(chunk->vendor_id);
@@ -759,7 +1754,8 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
         int chunk_len = ntohs(chunk->length);
 
         /* Bad length, drop packet */
-        if (chunk_len == 0) {
+        if (chunk_len < sizeof(hep_chunk_t) || pos + chunk_len > total_len) {
+            sng_free(payload);
             return NULL;
         }
 
@@ -771,6 +1767,7 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
 
         switch (chunk_type) {
             case CAPTURE_EEP_CHUNK_INVALID:
+                sng_free(payload);
                 return NULL;
             case CAPTURE_EEP_CHUNK_FAMILY:
                 memcpy(&hg.ip_family, (void*) buffer + pos, sizeof(hep_chunk_uint8_t));
@@ -780,20 +1777,20 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
                 break;
             case CAPTURE_EEP_CHUNK_SRC_IP4:
                 memcpy(&src_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
-                inet_ntop(AF_INET, &src_ip4.data, src.ip, sizeof(src.ip));
+                address_set_ip(&src, AF_INET, &src_ip4.data);
                 break;
             case CAPTURE_EEP_CHUNK_DST_IP4:
                 memcpy(&dst_ip4, (void*) buffer + pos, sizeof(struct hep_chunk_ip4));
-                inet_ntop(AF_INET, &dst_ip4.data, dst.ip, sizeof(src.ip));
+                address_set_ip(&dst, AF_INET, &dst_ip4.data);
                 break;
 #ifdef USE_IPV6
             case CAPTURE_EEP_CHUNK_SRC_IP6:
                 memcpy(&src_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
-                inet_ntop(AF_INET6, &src_ip6.data, src.ip, sizeof(src.ip));
+                address_set_ip(&src, AF_INET6, &src_ip6.data);
                 break;
             case CAPTURE_EEP_CHUNK_DST_IP6:
                 memcpy(&dst_ip6, (void*) buffer + pos, sizeof(struct hep_chunk_ip6));
-                inet_ntop(AF_INET6, &dst_ip6.data, dst.ip, sizeof(dst.ip));
+                address_set_ip(&dst, AF_INET6, &dst_ip6.data);
                 break;
 #endif
             case CAPTURE_EEP_CHUNK_SRC_PORT:
@@ -823,11 +1820,14 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
             case CAPTURE_EEP_CHUNK_AUTH_KEY:
                 memcpy(&authkey_chunk, (void*) buffer + pos, sizeof(authkey_chunk));
                 password_len = ntohs(authkey_chunk.length) - sizeof(authkey_chunk);
+                if (password_len >= (int) sizeof(password))
+                    password_len = sizeof(password) - 1;
                 memcpy(password, (void*) buffer + pos + sizeof(hep_chunk_t), password_len);
                 break;
             case CAPTURE_EEP_CHUNK_PAYLOAD:
                 memcpy(&payload_chunk, (void*) buffer + pos, sizeof(payload_chunk));
                 header.caplen = header.len = chunk_len - sizeof(hep_chunk_t);
+                sng_free(payload);
                 payload = sng_malloc(header.caplen);
                 memcpy(payload, (void*) buffer + pos + sizeof(hep_chunk_t), header.caplen);
                 break;
@@ -843,12 +1843,12 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
 
     // Validate password
     if (eep_cfg.capt_srv_password != NULL) {
-        // No password in packet
-        if (strlen(password) == 0)
-            return NULL;
-        // Check password matches configured
-        if (strncmp(password, eep_cfg.capt_srv_password, strlen(eep_cfg.capt_srv_password)) != 0)
+        // No password in packet or not matching configured one
+        if (strlen(password) == 0
+            || strncmp(password, eep_cfg.capt_srv_password, strlen(eep_cfg.capt_srv_password)) != 0) {
+            sng_free(payload);
             return NULL;
+        }
     }
 
     // Build a custom frame pcap header
@@ -863,9 +1863,6 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size)
     // We don't longer require frame payload anymore, because adding the frame to packet clones its memory
     sng_free(frame_payload);
 
-    // Store this packets in output file
-    capture_dump_packet(pkt_new);
-
     /* FREE */
     sng_free(payload);
     return pkt_new;
@@ -875,14 +1872,19 @@ int
 capture_eep_set_server_url(const char *url)
 {
     char urlstr[256];
-    char address[ADDRESSLEN + 1], port[6];
+    char proto[4], address[ADDRESSLEN + 1], port[6];
 
+    memset(proto, 0, sizeof(proto));
     memset(address, 0, sizeof(address));
     memset(port, 0, sizeof(port));
 
     strncpy(urlstr, url, sizeof(urlstr));
-    if (sscanf(urlstr, "%*[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5s", address, port) == 2) {
+    if (sscanf(urlstr, "%3[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5s", proto, address, port) == 3) {
+        // Only UDP and TCP transports are supported
+        if (strcmp(proto, "udp") != 0 && strcmp(proto, "tcp") != 0)
+            return 1;
         setting_set_value(SETTING_EEP_LISTEN, SETTING_ON);
+        setting_set_value(SETTING_EEP_LISTEN_PROTO, proto);
         setting_set_value(SETTING_EEP_LISTEN_ADDR, address);
         setting_set_value(SETTING_EEP_LISTEN_PORT, port);
         return 0;
@@ -894,14 +1896,19 @@ int
 capture_eep_set_client_url(const char *url)
 {
     char urlstr[256];
-    char address[ADDRESSLEN + 1], port[6];
+    char proto[4], address[ADDRESSLEN + 1], port[6];
 
+    memset(proto, 0, sizeof(proto));
     memset(address, 0, sizeof(address));
     memset(port, 0, sizeof(port));
 
     strncpy(urlstr, url, sizeof(urlstr));
-    if (sscanf(urlstr, "%*[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5s", address, port) == 2) {
+    if (sscanf(urlstr, "%3[^:]:%" STRINGIFY(ADDRESSLEN) "[^:]:%5s", proto, address, port) == 3) {
+        // Only UDP and TCP transports are supported
+        if (strcmp(proto, "udp") != 0 && strcmp(proto, "tcp") != 0)
+            return 1;
         setting_set_value(SETTING_EEP_SEND, SETTING_ON);
+        setting_set_value(SETTING_EEP_SEND_PROTO, proto);
         setting_set_value(SETTING_EEP_SEND_ADDR, address);
         setting_set_value(SETTING_EEP_SEND_PORT, port);
         return 0;
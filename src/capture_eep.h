@@ -42,8 +42,31 @@
 #ifndef __SNGREP_CAPTURE_EEP_H
 #define __SNGREP_CAPTURE_EEP_H
 #include <pthread.h>
+#include <sys/socket.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
 #include "capture.h"
 
+//! Max datagrams read from a listener socket in a single call
+#define CAPTURE_EEP_BATCH 32
+//! Ancillary data space of each received datagram (kernel drops counter)
+#define CAPTURE_EEP_CONTROL_LEN CMSG_SPACE(sizeof(uint32_t))
+//! Default number of HEP frames pending to be sent
+#define CAPTURE_EEP_SEND_QUEUE 4096
+//! Max agents connected to each stream listener
+#define CAPTURE_EEP_CLIENTS 256
+//! Receive buffer of each stream connection (max HEPv3 packet length)
+#define CAPTURE_EEP_STREAM_BUFFER 65536
+//! Compressed data read from a stream connection in each call
+#define CAPTURE_EEP_ZCHUNK 16384
+//! Seconds to wait for stream connection to HEP server
+#define CAPTURE_EEP_CONNECT_TIMEOUT 5
+//! Max seconds between stream reconnection attempts
+#define CAPTURE_EEP_BACKOFF_MAX 30
+//! Receive buffer for collector requests in probe mode
+#define CAPTURE_EEP_REQUEST_BUFFER 4096
+
 //! HEP chunk types
 enum
 {
@@ -69,6 +92,27 @@ enum
 
 //! Shorter declaration of capture_eep_config structure
 typedef struct capture_eep_config  capture_eep_config_t;
+//! Shorter declaration of capture_eep_listener structure
+typedef struct capture_eep_listener capture_eep_listener_t;
+//! Shorter declaration of capture_eep_frame structure
+typedef struct capture_eep_frame capture_eep_frame_t;
+//! Shorter declaration of capture_eep_client structure
+typedef struct capture_eep_client capture_eep_client_t;
+
+/**
+ * @brief Encoded HEP packet pending to be sent
+ *
+ * Frames are preallocated and their buffers reused between packets.
+ */
+struct capture_eep_frame
+{
+    //! Encoded HEP packet
+    u_char *data;
+    //! Encoded HEP packet length
+    uint32_t len;
+    //! Allocated size of data buffer
+    uint32_t size;
+};
 
 /**
  * @brief EEP  Client/Server configuration
@@ -77,8 +121,6 @@ struct capture_eep_config
 {
     //! Client socket for sending EEP data
     int client_sock;
-    //! Server socket for receiving EEP data
-    int server_sock;
     //! Capture agent id
     int capt_id;
     //! Hep Version for sending data (2 or 3)
@@ -89,6 +131,14 @@ struct capture_eep_config
     const char *capt_port;
     //! Password for authenticate as client
     const char *capt_password;
+    //! Transport protocol to send EEP data (IPPROTO_UDP or IPPROTO_TCP)
+    int capt_proto;
+    //! Compress stream sent to EEP server
+    bool capt_compress;
+    //! Send parsed records instead of packets (probe mode)
+    bool capt_probe;
+    //! Seconds to wait before next stream connection attempt
+    int backoff;
     // HEp version for receiving data (2 or 3)
     int capt_srv_version;
     //! IP address to received EEP data
@@ -97,8 +147,87 @@ struct capture_eep_config
     const char *capt_srv_port;
     //! Server password to authenticate incoming connections
     const char *capt_srv_password;
-    //! Server thread to parse incoming data
-    pthread_t server_thread;
+    //! Transport protocol to receive EEP data (IPPROTO_UDP or IPPROTO_TCP)
+    int capt_srv_proto;
+    //! Received streams are compressed
+    bool capt_srv_compress;
+    //! Stream listeners (capture_eep_listener_t)
+    vector_t *listeners;
+    //! Preallocated frames for encoding HEP packets
+    capture_eep_frame_t *frames;
+    //! Number of preallocated frames
+    int frame_count;
+    //! Frames ready to be used (filled by sender thread)
+    queue_t *send_free;
+    //! Encoded frames pending to be sent (filled by capture)
+    queue_t *send_queue;
+    //! Serialize frames queued by parsing threads in probe mode
+    pthread_mutex_t send_lock;
+    //! Received collector requests pending to be parsed (probe mode)
+    u_char requests[CAPTURE_EEP_REQUEST_BUFFER];
+    //! Received collector requests length
+    uint32_t requests_len;
+    //! Sender thread
+    pthread_t send_thread;
+    //! Flag to determine if sender thread is running
+    bool sending;
+    //! HEP packets sent
+    uint64_t sent;
+    //! HEP packets discarded because all frames were pending to be sent
+    uint64_t send_drops;
+    //! HEP packets that could not be sent
+    uint64_t send_errors;
+#ifdef WITH_ZLIB
+    //! Compression state of the stream connection
+    z_stream zsend;
+    //! Compressed batch of frames
+    u_char *zbuf;
+    //! Allocated size of compressed batch buffer
+    size_t zsize;
+#endif
+};
+
+/**
+ * @brief Agent connected to a stream listener
+ */
+struct capture_eep_client
+{
+    //! Connected socket
+    int sock;
+    //! Received data pending to be parsed
+    u_char *buffer;
+    //! Received data length
+    uint32_t len;
+    //! Connection authenticated as a sngrep probe
+    bool probe;
+#ifdef WITH_ZLIB
+    //! Decompression state (NULL if stream is not compressed)
+    z_stream *zrecv;
+#endif
+};
+
+/**
+ * @brief EEP listener socket of a capture source
+ *
+ * Each listener has its own socket and capture thread. When more than one
+ * listener is configured, all sockets are bound to the same address using
+ * SO_REUSEPORT and the kernel balances incoming datagrams or connections
+ * between them.
+ */
+struct capture_eep_listener
+{
+    //! UDP or TCP socket bound to listen address
+    int sock;
+    //! Connected agents (TCP only)
+    capture_eep_client_t *clients;
+    //! Number of connected agents
+    int client_count;
+    //! Protect connected agents from other threads sending requests
+    pthread_mutex_t lock;
+    //! Datagrams dropped by the kernel because socket buffer was full
+    uint64_t drops;
+    //! Capture source name
+    char name[ADDRESSLEN + 16];
 };
 
 /* HEPv3 types */
@@ -243,12 +372,38 @@ capture_eep_init();
 /**
  * @brief Unitialize EEP process
  *
- * Close used sockets for receive and send data and stop server
- * thread if server mode is enabled.
+ * Close used socket for sending data. Listener sockets are closed
+ * with their capture sources.
  */
 void
 capture_eep_deinit();
 
+/**
+ * @brief Capture thread function for EEP listener sources
+ *
+ * Receive datagrams in batches and queue the HEP encapsulated packets
+ * to be parsed. Invalid datagrams are counted as rejected.
+ */
+void *
+accept_eep_client(void *info);
+
+/**
+ * @brief Return datagrams dropped by the kernel in a listener socket
+ *
+ * @param capinfo EEP listener capture source
+ * @return dropped datagrams since the socket was opened
+ */
+uint64_t
+capture_eep_drops(capture_info_t *capinfo);
+
+/**
+ * @brief Close listener socket of a capture source
+ *
+ * @param capinfo Capture source, ignored if it is not an EEP listener
+ */
+void
+capture_eep_close(capture_info_t *capinfo);
+
 /**
  * @brief Return the remote port where HEP packets are sent
  *
@@ -265,6 +420,85 @@ capture_eep_send_port();
 const char *
 capture_eep_listen_port();
 
+/**
+ * @brief Return the password required to agents in HEP listen mode
+ *
+ * @return Configured password or NULL if agents are not authenticated
+ */
+const char *
+capture_eep_listen_password();
+
+/**
+ * @brief Check if parsed records are sent instead of packets
+ *
+ * @return true if HEP send mode is running in probe mode
+ */
+bool
+capture_eep_send_probe();
+
+/**
+ * @brief Queue an encoded record to be sent by the sender thread
+ *
+ * Unlike packets, records can be queued from any thread.
+ *
+ * @param data Encoded record
+ * @param len Encoded record length
+ * @return 0 if record has been queued, 1 otherwise
+ */
+int
+capture_eep_send_record(const u_char *data, uint32_t len);
+
+/**
+ * @brief Write encoded records to the stream connection
+ *
+ * Records are written without waiting in the sender queue. This can
+ * only be called from the sender thread.
+ *
+ * @param data Encoded records
+ * @param len Encoded records length
+ * @return 0 if records have been written, 1 otherwise
+ */
+int
+capture_eep_send_direct(const u_char *data, uint32_t len);
+
+/**
+ * @brief Send a request to all probes connected to stream listeners
+ *
+ * Requests are written without waiting, probes that can not receive
+ * them are skipped.
+ *
+ * @param data Encoded request
+ * @param len Encoded request length
+ */
+void
+capture_eep_fetch(const u_char *data, uint32_t len);
+
+/**
+ * @brief Get HEP sender counters
+ *
+ * @param sent HEP packets sent
+ * @param drops HEP packets discarded because sender queue was full
+ * @param errors HEP packets that could not be sent
+ */
+void
+capture_eep_send_stats(uint64_t *sent, uint64_t *drops, uint64_t *errors);
+
+/**
+ * @brief Build a fake Ethernet, IPv4 and UDP frame around a payload
+ *
+ * @param header Frame header with capture time
+ * @param payload Frame payload
+ * @param payload_size Frame payload length
+ * @param src Source address
+ * @param dst Destination address
+ * @param frame_payload Allocated frame data, must be freed by caller
+ * @return frame header
+ */
+struct pcap_pkthdr
+capture_eep_build_frame_data(const struct pcap_pkthdr header, const unsigned char *payload,
+                             const uint32_t payload_size, const address_t src,
+                             const address_t dst, unsigned char **frame_payload);
+
 /**
  * @brief Wrapper for sending packet in configured EEP version
  *
@@ -277,7 +511,9 @@ capture_eep_send(packet_t *pkt);
 /**
  * @brief Send a captured packet (EEP version 2)
  *
- * Send a packet encapsulated into EEP through the client socket.
+ * Encapsulate a packet into EEP and queue it to be sent through the
+ * client socket by the sender thread. The packet is discarded if the
+ * sender queue is full, so capture never waits for the remote server.
  * This function will only handle SIP packets if EEP client mode
  * has been enabled.
  *
@@ -290,7 +526,9 @@ capture_eep_send_v2(packet_t *pkt);
 /**
  * @brief Send a captured packet (EEP version 3)
  *
- * Send a packet encapsulated into EEP through the client socket.
+ * Encapsulate a packet into EEP and queue it to be sent through the
+ * client socket by the sender thread. The packet is discarded if the
+ * sender queue is full, so capture never waits for the remote server.
  * This function will only handle SIP packets if EEP client mode
  * has been enabled.
  *
@@ -303,32 +541,34 @@ capture_eep_send_v3(packet_t *pkt);
 /**
  * @brief Wrapper for receiving packet in configured EEP version
  *
+ * @param pkt received datagram data
+ * @param size size of received datagram data
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive();
+capture_eep_receive(const u_char *pkt, uint32_t size);
 
 
 /**
  * @brief Received a captured packet (EEP version 2)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
- * structure.
+ * This function will parse EEP data received through the EEP server
+ * and create a new packet structure.
  *
+ * @param pkt received datagram data
+ * @param size size of received datagram data
  * @return NULL on any error, packet structure otherwise
  */
 packet_t *
-capture_eep_receive_v2();
+capture_eep_receive_v2(const u_char *pkt, uint32_t size);
 
 /**
  * @brief Received a captured packet (EEP version 3)
  *
- * Wait for a packet to be received through the EEP server. This
- * function will parse received EEP data and create a new packet
- * structure.
+ * This function will parse EEP data received through the EEP server
+ * or found in captured packets and create a new packet structure.
  *
- * @param pkt packet structure data, NULL if socket should be used
+ * @param pkt packet structure data
  * @param size size of packet structure data
  * @return NULL on any error, packet structure otherwise
  */
@@ -342,7 +582,7 @@ capture_eep_receive_v3(const u_char *pkt, uint32_t size);
  *  - proto:address:port
  * For example:
  *  - udp:10.10.0.100:9060
- *  - udp:0.0.0.0:9960
+ *  - tcp:0.0.0.0:9960
  *
  * @param url URL to be parsed
  * @return 0 if url has been parsed, 1 otherwise
@@ -357,7 +597,7 @@ capture_eep_set_server_url(const char *url);
  *  - proto:address:port
  * For example:
  *  - udp:10.10.0.100:9060
- *  - udp:0.0.0.0:9960
+ *  - tcp:10.10.0.100:9060
  *
  * @param url URL to be parsed
  * @return 0 if url has been parsed, 1 otherwise
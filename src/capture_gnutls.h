@@ -52,6 +52,15 @@
 #include <gcrypt.h>
 #include "capture.h"
 
+//! Number of buckets of TLS connections table
+#define TLS_CONNECTION_BUCKETS 4096
+//! Number of entries of resumable TLS sessions cache
+#define TLS_SESSION_CACHE 4096
+//! Max TLS session ID length
+#define TLS_SESSION_ID_MAXLEN 32
+//! SessionTicket extension type as defined in RFC5077
+#define TLS_EXT_SESSION_TICKET 35
+
 //! Cast two bytes into decimal (Big Endian)
 #define UINT16_INT(i) ((i.x[0] << 8) | i.x[1])
 //! Cast three bytes into decimal (Big Endian)
@@ -123,6 +132,7 @@ enum HandshakeType {
     server_hello_done   = GNUTLS_HANDSHAKE_SERVER_HELLO_DONE,
     certificate_verify  = GNUTLS_HANDSHAKE_CERTIFICATE_VERIFY,
     client_key_exchange = GNUTLS_HANDSHAKE_CLIENT_KEY_EXCHANGE,
+    new_session_ticket  = GNUTLS_HANDSHAKE_NEW_SESSION_TICKET,
     finished            = GNUTLS_HANDSHAKE_FINISHED
 };
 
@@ -246,6 +256,12 @@ struct SSLConnection {
     struct CipherData cipher_data;
     struct PreMasterSecret pre_master_secret;
     struct MasterSecret master_secret;
+    //! Session ID offered by client, or assigned by server in full handshakes
+    uint8_t session_id[TLS_SESSION_ID_MAXLEN];
+    //! Session ID length
+    uint8_t session_id_len;
+    //! Session ticket offered by client (cache key, 0 if none)
+    uint64_t ticket;
 
     struct tls_data {
         uint8_t *client_write_MAC_key;
@@ -259,7 +275,16 @@ struct SSLConnection {
     gcry_cipher_hd_t client_cipher_ctx;
     gcry_cipher_hd_t server_cipher_ctx;
 
+    //! Hash of client and server addresses
+    uint32_t hash;
+    //! Capture time of last connection packet
+    time_t ts;
+    //! Next connection in the same table bucket
     struct SSLConnection *next;
+    //! Newer connection in activity order
+    struct SSLConnection *newer;
+    //! Older connection in activity order
+    struct SSLConnection *older;
 };
 
 /**
@@ -305,7 +330,8 @@ PRF(struct SSLConnection *conn, unsigned char *dest, int dlen, unsigned char *pr
  *
  * This will allocate enough memory to store all connection data
  * from a detected SSL connection. This will also add this structure to
- * the connections linked list.
+ * the connections table. Least recently active connection is removed
+ * when capture.tls.connections limit has been reached.
  *
  * @param caddr Client address
  * @param cport Client port
@@ -320,13 +346,58 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
  * @brief Destroys an existing SSLConnection
  *
  * This will free all allocated memory of SSLConnection also removing
- * the connection from connections list.
+ * the connection from connections table.
  *
  * @param conn Existing connection pointer
  */
 void
 tls_connection_destroy(struct SSLConnection *conn);
 
+/**
+ * @brief Split TLS connections table in partitions
+ *
+ * Connections of each partition are only modified by segments of that
+ * partition, so segments can be processed by one thread per partition
+ * without sharing connection state. This must be called before any
+ * segment is processed.
+ *
+ * @param count Number of partitions
+ * @return 0 if partitions have been created, 1 otherwise
+ */
+int
+tls_set_partitions(int count);
+
+/**
+ * @brief Get the TLS connections table partition of a TCP segment
+ *
+ * Both directions of a connection belong to the same partition.
+ *
+ * @param packet TCP packet
+ * @return partition index
+ */
+int
+tls_packet_partition(packet_t *packet);
+
+/**
+ * @brief Get TLS connections table status
+ *
+ * @param count Tracked connections
+ * @param expired Connections removed after capture.tls.timeout seconds idle
+ * @param evicted Connections removed because of capture.tls.connections limit
+ * @param failures Records that could not be decrypted
+ */
+void
+tls_connection_stats(uint32_t *count, uint64_t *expired, uint64_t *evicted, uint64_t *failures);
+
+/**
+ * @brief Get the number of handshakes resumed from cached sessions
+ *
+ * Master secrets of full handshakes are cached by session ID and session
+ * ticket, so resumed handshakes are decrypted without the private key.
+ */
+uint64_t
+tls_session_resumed();
+
 /**
  * @brief Check if given keyfile is valid
  *
@@ -0,0 +1,593 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_mmap.h
+ *
+ */
+#include "config.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "capture_mmap.h"
+#include "setting.h"
+#include "util.h"
+
+//! Classic pcap file header size
+#define PCAP_FILE_HDR_LEN   24
+//! Classic pcap record header size
+#define PCAP_REC_HDR_LEN    16
+
+/**
+ * @brief Read a 32 bits field from mapped file
+ */
+static uint32_t
+capture_mmap_u32(const u_char *data, bool swapped)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return (swapped) ? __builtin_bswap32(value) : value;
+}
+
+/**
+ * @brief Read a 16 bits field from mapped file
+ */
+static uint16_t
+capture_mmap_u16(const u_char *data, bool swapped)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return (swapped) ? __builtin_bswap16(value) : value;
+}
+
+/**
+ * @brief Map the sidecar index of an input file if it is still valid
+ *
+ * Index is only used if the file has not changed and it was created with
+ * the same capture options.
+ */
+static void
+capture_mmap_index_open(capture_mmap_t *mm, const char *infile, const struct stat *sb)
+{
+    char path[PATH_MAX];
+    capture_index_header_t *header;
+    struct stat isb;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s%s", infile, CAPTURE_INDEX_SUFFIX);
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return;
+
+    if (fstat(fd, &isb) != 0 || (size_t) isb.st_size < sizeof(capture_index_header_t)) {
+        close(fd);
+        return;
+    }
+
+    mm->index_size = isb.st_size;
+    mm->index_map = mmap(NULL, mm->index_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mm->index_map == MAP_FAILED) {
+        mm->index_map = NULL;
+        return;
+    }
+
+    header = (capture_index_header_t *) mm->index_map;
+    if (memcmp(header->magic, CAPTURE_INDEX_MAGIC, sizeof(header->magic)) != 0
+        || header->size != (uint64_t) sb->st_size
+        || header->mtime != (int64_t) sb->st_mtime
+        || header->options != capture_options_hash()
+        || header->count > (mm->index_size - sizeof(capture_index_header_t)) / sizeof(capture_index_record_t)) {
+        munmap(mm->index_map, mm->index_size);
+        mm->index_map = NULL;
+        return;
+    }
+
+    mm->index = (const capture_index_record_t *) (header + 1);
+    mm->index_count = header->count;
+}
+
+int
+capture_mmap_open(capture_info_t *capinfo)
+{
+    capture_mmap_t *mm;
+    FILE *fp;
+    struct stat sb;
+    uint32_t magic;
+    long start;
+
+    // Only files opened by libpcap can be mapped
+    if (!capinfo->handle || !(fp = pcap_file(capinfo->handle)))
+        return 1;
+
+    // Compressed files and pipes have no file descriptor to map
+    if (fstat(fileno(fp), &sb) != 0 || !S_ISREG(sb.st_mode))
+        return 1;
+
+    if (sb.st_size < PCAP_FILE_HDR_LEN || (uintmax_t) sb.st_size > SIZE_MAX)
+        return 1;
+
+    if ((start = ftell(fp)) < 0)
+        return 1;
+
+    if (!(mm = sng_malloc(sizeof(capture_mmap_t))))
+        return 1;
+
+    mm->size = sb.st_size;
+    mm->map = mmap(NULL, mm->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (mm->map == MAP_FAILED) {
+        sng_free(mm);
+        return 1;
+    }
+
+#ifdef HAVE_MADVISE
+    // File will be read once from start to end
+    madvise(mm->map, mm->size, MADV_SEQUENTIAL);
+#endif
+
+    memcpy(&magic, mm->map, sizeof(magic));
+    switch (magic) {
+        case 0xa1b2c3d4:
+            break;
+        case 0xd4c3b2a1:
+            mm->swapped = true;
+            break;
+        case 0xa1b23c4d:
+            mm->nsec = true;
+            break;
+        case 0x4d3cb2a1:
+            mm->nsec = true;
+            mm->swapped = true;
+            break;
+        case PCAPNG_BLOCK_SHB:
+            mm->pcapng = true;
+            break;
+        default:
+            munmap(mm->map, mm->size);
+            sng_free(mm);
+            return 1;
+    }
+
+    // pcapng interfaces must be read again from the first section
+    if (mm->pcapng) {
+        mm->pos = 0;
+    } else {
+        mm->pos = (start < PCAP_FILE_HDR_LEN) ? PCAP_FILE_HDR_LEN : (size_t) start;
+    }
+
+    // File chunks stop reading at next chunk first record
+    if (capinfo->infile_end && (size_t) capinfo->infile_end < mm->size) {
+        mm->end = capinfo->infile_end;
+    } else {
+        mm->end = mm->size;
+    }
+
+    // Only read stored frames if file was already indexed
+    if (setting_enabled(SETTING_CAPTURE_OFFLINE_INDEX) && capinfo->infile)
+        capture_mmap_index_open(mm, capinfo->infile, &sb);
+
+    capinfo->mmap = mm;
+    // Records are parsed with nanosecond timestamps
+    capinfo->nsec = true;
+    return 0;
+}
+
+/**
+ * @brief Parse all records of a mapped classic pcap file
+ */
+static void
+capture_mmap_loop_pcap(capture_info_t *capinfo)
+{
+    capture_mmap_t *mm = capinfo->mmap;
+    struct pcap_pkthdr header;
+    const u_char *rec;
+
+    while (mm->pos + PCAP_REC_HDR_LEN <= mm->end) {
+        rec = mm->map + mm->pos;
+        header.ts.tv_sec = capture_mmap_u32(rec, mm->swapped);
+        header.ts.tv_usec = capture_mmap_u32(rec + 4, mm->swapped);
+        header.caplen = capture_mmap_u32(rec + 8, mm->swapped);
+        header.len = capture_mmap_u32(rec + 12, mm->swapped);
+
+        // Truncated or corrupted file
+        if (header.caplen > MAXIMUM_SNAPLEN
+            || mm->pos + PCAP_REC_HDR_LEN + header.caplen > mm->size)
+            break;
+
+        if (!mm->nsec)
+            header.ts.tv_usec *= 1000;
+
+        mm->pos += PCAP_REC_HDR_LEN + header.caplen;
+
+        // libpcap filter is not applied to records read from memory
+        if (!capture_packet_filter(&header, rec + PCAP_REC_HDR_LEN))
+            continue;
+
+        // Parse packet directly from mapped memory
+        parse_packet((u_char *) capinfo, &header, rec + PCAP_REC_HDR_LEN);
+    }
+}
+
+/**
+ * @brief Store the timestamp resolution of a pcapng interface
+ */
+static void
+capture_mmap_add_iface(capture_info_t *capinfo, const u_char *block, uint32_t len)
+{
+    capture_mmap_t *mm = capinfo->mmap;
+    uint64_t units = 1000000;
+    uint32_t pos = 16;
+    uint16_t code, optlen;
+    u_char resol;
+
+    if (mm->ifaces == CAPTURE_MMAP_MAX_IFACES || len < 20)
+        return;
+
+    // Look for if_tsresol option
+    while (pos + 4 <= len - 4) {
+        code = capture_mmap_u16(block + pos, mm->swapped);
+        optlen = capture_mmap_u16(block + pos + 2, mm->swapped);
+        if (code == 0 || pos + 4 + optlen > len - 4)
+            break;
+        if (code == PCAPNG_OPT_TSRESOL && optlen == 1) {
+            resol = block[pos + 4];
+            if (resol & 0x80) {
+                units = ((resol & 0x7F) < 64) ? (uint64_t) 1 << (resol & 0x7F) : 0;
+            } else {
+                for (units = 1; resol > 0 && resol <= 19; resol--)
+                    units *= 10;
+            }
+        }
+        pos += 4 + ((optlen + 3) & ~3);
+    }
+
+    // libpcap handle can only parse packets with the first interface link type
+    if (capture_mmap_u16(block + 8, mm->swapped) != capinfo->link)
+        units = 0;
+
+    mm->units[mm->ifaces++] = units;
+}
+
+/**
+ * @brief Parse all records of a mapped pcapng file
+ */
+static void
+capture_mmap_loop_pcapng(capture_info_t *capinfo)
+{
+    capture_mmap_t *mm = capinfo->mmap;
+    struct pcap_pkthdr header;
+    const u_char *block, *data;
+    uint32_t type, len, iface, magic;
+    uint64_t ts, units;
+
+    while (mm->pos + 12 <= mm->end) {
+        block = mm->map + mm->pos;
+        type = capture_mmap_u32(block, false);
+
+        // Each section can have different byte order and interfaces
+        if (type == PCAPNG_BLOCK_SHB) {
+            magic = capture_mmap_u32(block + 8, false);
+            if (magic == PCAPNG_BYTE_ORDER) {
+                mm->swapped = false;
+            } else if (__builtin_bswap32(magic) == PCAPNG_BYTE_ORDER) {
+                mm->swapped = true;
+            } else {
+                break;
+            }
+            mm->ifaces = 0;
+        } else {
+            type = capture_mmap_u32(block, mm->swapped);
+        }
+
+        // Truncated or corrupted file
+        len = capture_mmap_u32(block + 4, mm->swapped);
+        if (len < 12 || len % 4 != 0 || mm->pos + len > mm->size)
+            break;
+        mm->pos += len;
+
+        switch (type) {
+            case PCAPNG_BLOCK_IDB:
+                capture_mmap_add_iface(capinfo, block, len);
+                continue;
+            case PCAPNG_BLOCK_EPB:
+            case PCAPNG_BLOCK_PB:
+                if (len < 32)
+                    continue;
+                if (type == PCAPNG_BLOCK_EPB) {
+                    iface = capture_mmap_u32(block + 8, mm->swapped);
+                } else {
+                    iface = capture_mmap_u16(block + 8, mm->swapped);
+                }
+                ts = ((uint64_t) capture_mmap_u32(block + 12, mm->swapped) << 32)
+                     | capture_mmap_u32(block + 16, mm->swapped);
+                header.caplen = capture_mmap_u32(block + 20, mm->swapped);
+                header.len = capture_mmap_u32(block + 24, mm->swapped);
+                data = block + 28;
+                if (header.caplen > len - 32)
+                    continue;
+                break;
+            case PCAPNG_BLOCK_SPB:
+                if (len < 16)
+                    continue;
+                iface = 0;
+                ts = 0;
+                header.len = capture_mmap_u32(block + 8, mm->swapped);
+                header.caplen = (header.len < len - 16) ? header.len : len - 16;
+                data = block + 12;
+                break;
+            default:
+                continue;
+        }
+
+        // Packets from unknown interfaces can not be parsed
+        if (iface >= mm->ifaces || !(units = mm->units[iface]))
+            continue;
+
+        header.ts.tv_sec = ts / units;
+        if (units <= 1000000000) {
+            header.ts.tv_usec = (ts % units) * 1000000000 / units;
+        } else {
+            header.ts.tv_usec = (ts % units) / (units / 1000000000);
+        }
+
+        // libpcap filter is not applied to records read from memory
+        if (!capture_packet_filter(&header, data))
+            continue;
+
+        // Parse packet directly from mapped memory
+        parse_packet((u_char *) capinfo, &header, data);
+    }
+}
+
+/**
+ * @brief Parse only the indexed records of a mapped file
+ */
+static void
+capture_mmap_loop_index(capture_info_t *capinfo)
+{
+    capture_mmap_t *mm = capinfo->mmap;
+    const capture_index_record_t *rec;
+    struct pcap_pkthdr header;
+    uint64_t first = 0, last = mm->index_count, mid;
+
+    // File chunks only parse records in their range
+    while (first < last) {
+        mid = first + (last - first) / 2;
+        if (mm->index[mid].offset < mm->pos) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+
+    for (rec = mm->index + first; rec < mm->index + mm->index_count; rec++) {
+        if (rec->offset >= mm->end || rec->offset + rec->caplen > mm->size)
+            break;
+
+        header.ts.tv_sec = rec->sec;
+        header.ts.tv_usec = rec->usec * 1000;
+        header.caplen = rec->caplen;
+        header.len = rec->len;
+
+        // Indexed records already passed the capture filter
+        parse_packet((u_char *) capinfo, &header, mm->map + rec->offset);
+    }
+
+    mm->pos = mm->end;
+}
+
+void
+capture_mmap_loop(capture_info_t *capinfo)
+{
+    if (capinfo->mmap->index) {
+        capture_mmap_loop_index(capinfo);
+    } else if (capinfo->mmap->pcapng) {
+        capture_mmap_loop_pcapng(capinfo);
+    } else {
+        capture_mmap_loop_pcap(capinfo);
+    }
+
+#ifdef HAVE_MADVISE
+    // Indexed frames will be read again in any order
+    if (capture_storage() == CAPTURE_STORAGE_INDEX)
+        madvise(capinfo->mmap->map, capinfo->mmap->size, MADV_RANDOM);
+#endif
+}
+
+void
+capture_mmap_index_packet(packet_t *packet)
+{
+    capture_info_t *capinfo = packet->source;
+    capture_mmap_t *mm;
+    capture_index_record_t *records;
+    frame_t *frame;
+    vector_iter_t it;
+
+    // Only frames of files being completely read are indexed
+    if (!capinfo || !(mm = capinfo->mmap) || mm->index
+        || !setting_enabled(SETTING_CAPTURE_OFFLINE_INDEX))
+        return;
+
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (!frame->offset)
+            continue;
+        if (mm->records_count == mm->records_size) {
+            if (!(records = realloc(mm->records, sizeof(capture_index_record_t) * (mm->records_size * 2 + 1024))))
+                return;
+            mm->records = records;
+            mm->records_size = mm->records_size * 2 + 1024;
+        }
+        mm->records[mm->records_count].offset = frame->offset;
+        mm->records[mm->records_count].sec = frame->header->ts.tv_sec;
+        mm->records[mm->records_count].usec = frame->header->ts.tv_usec;
+        mm->records[mm->records_count].caplen = frame->header->caplen;
+        mm->records[mm->records_count].len = frame->header->len;
+        mm->records_count++;
+    }
+}
+
+/**
+ * @brief Sorter of sidecar index records by position
+ */
+static int
+capture_mmap_record_cmp(const void *a, const void *b)
+{
+    uint64_t oa = ((const capture_index_record_t *) a)->offset;
+    uint64_t ob = ((const capture_index_record_t *) b)->offset;
+    return (oa > ob) - (oa < ob);
+}
+
+/**
+ * @brief Write the sidecar index of a completely read file
+ *
+ * Records of all sources reading chunks of the same file are merged.
+ */
+static void
+capture_mmap_index_write(vector_t *sources, const char *infile)
+{
+    char path[PATH_MAX], tmppath[PATH_MAX + sizeof(".tmp")];
+    capture_index_header_t header;
+    capture_index_record_t *records;
+    capture_info_t *capinfo;
+    struct stat sb;
+    uint64_t count = 0, i, j;
+    vector_iter_t it;
+    FILE *f;
+
+    if (stat(infile, &sb) != 0)
+        return;
+
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (capinfo->infile && !strcmp(capinfo->infile, infile))
+            count += capinfo->mmap->records_count;
+    }
+
+    if (!(records = malloc(sizeof(capture_index_record_t) * (count + 1))))
+        return;
+
+    count = 0;
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (!capinfo->infile || strcmp(capinfo->infile, infile))
+            continue;
+        memcpy(records + count, capinfo->mmap->records,
+               sizeof(capture_index_record_t) * capinfo->mmap->records_count);
+        count += capinfo->mmap->records_count;
+    }
+
+    // Frames are parsed in file order, once
+    qsort(records, count, sizeof(capture_index_record_t), capture_mmap_record_cmp);
+    for (i = 0, j = 0; i < count; i++) {
+        if (j && records[j - 1].offset == records[i].offset)
+            continue;
+        records[j++] = records[i];
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_INDEX_MAGIC, sizeof(header.magic));
+    header.size = sb.st_size;
+    header.mtime = sb.st_mtime;
+    header.options = capture_options_hash();
+    header.count = j;
+
+    // Write index atomically, a partial index would skip packets
+    // Skip the index if its path does not fit, a truncated path could
+    // overwrite an unrelated file
+    if (snprintf(path, sizeof(path), "%s%s", infile,
+                 CAPTURE_INDEX_SUFFIX) >= (int) sizeof(path)
+        || snprintf(tmppath, sizeof(tmppath), "%s.tmp",
+                    path) >= (int) sizeof(tmppath)) {
+        free(records);
+        return;
+    }
+
+    if ((f = fopen(tmppath, "wb"))) {
+        if (fwrite(&header, sizeof(header), 1, f) == 1
+            && fwrite(records, sizeof(capture_index_record_t), j, f) == j
+            && fclose(f) == 0) {
+            rename(tmppath, path);
+        } else {
+            unlink(tmppath);
+        }
+    }
+
+    free(records);
+}
+
+void
+capture_mmap_index_save(vector_t *sources)
+{
+    capture_info_t *capinfo, *other;
+    vector_iter_t it, oit;
+    bool complete;
+
+    if (!setting_enabled(SETTING_CAPTURE_OFFLINE_INDEX))
+        return;
+
+    it = vector_iterator(sources);
+    while ((capinfo = vector_iterator_next(&it))) {
+        if (!capinfo->infile || !capinfo->mmap || capinfo->mmap->index)
+            continue;
+
+        // All chunks of the file must have been read and parsed
+        complete = true;
+        oit = vector_iterator(sources);
+        while ((other = vector_iterator_next(&oit))) {
+            if (!other->infile || strcmp(other->infile, capinfo->infile))
+                continue;
+            // Only the first source of each file writes its index
+            if (other != capinfo && vector_index(sources, other) < vector_index(sources, capinfo))
+                complete = false;
+            if (!other->mmap || other->mmap->index || other->running
+                || other->mmap->pos < other->mmap->end)
+                complete = false;
+        }
+
+        if (complete)
+            capture_mmap_index_write(sources, capinfo->infile);
+    }
+}
+
+void
+capture_mmap_close(capture_info_t *capinfo)
+{
+    capture_mmap_t *mm = capinfo->mmap;
+
+    if (!mm)
+        return;
+
+    if (mm->index_map)
+        munmap(mm->index_map, mm->index_size);
+    free(mm->records);
+    munmap(mm->map, mm->size);
+    sng_free(mm);
+    capinfo->mmap = NULL;
+}
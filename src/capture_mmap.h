@@ -0,0 +1,192 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_mmap.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to read offline capture files from mapped memory
+ *
+ * Uncompressed pcap and pcapng files are mapped in memory and their
+ * records are handed to parse_packet directly, without going through
+ * libpcap stdio buffers. libpcap is still used to open and validate the
+ * file, so any file that can not be mapped is read using pcap_loop.
+ *
+ * When capture.offline.index setting is enabled, the position of every
+ * stored packet frame is saved in a sidecar index file once the file has
+ * been completely read. Opening the same file again with the same capture
+ * options only parses the indexed frames, skipping all other records.
+ *
+ */
+#ifndef __SNGREP_CAPTURE_MMAP_H
+#define __SNGREP_CAPTURE_MMAP_H
+
+#include "capture.h"
+
+//! Max pcapng interfaces per section
+#define CAPTURE_MMAP_MAX_IFACES 64
+//! pcapng Section Header Block
+#define PCAPNG_BLOCK_SHB    0x0A0D0D0A
+//! pcapng Interface Description Block
+#define PCAPNG_BLOCK_IDB    0x00000001
+//! pcapng (obsolete) Packet Block
+#define PCAPNG_BLOCK_PB     0x00000002
+//! pcapng Simple Packet Block
+#define PCAPNG_BLOCK_SPB    0x00000003
+//! pcapng Enhanced Packet Block
+#define PCAPNG_BLOCK_EPB    0x00000006
+//! pcapng byte order magic
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+//! pcapng if_tsresol option code
+#define PCAPNG_OPT_TSRESOL  9
+
+//! Sidecar index file name suffix
+#define CAPTURE_INDEX_SUFFIX ".sngidx"
+//! Sidecar index file format identifier
+#define CAPTURE_INDEX_MAGIC  "SNGIDX01"
+
+//! Shorter declaration of capture_mmap structure
+typedef struct capture_mmap capture_mmap_t;
+//! Shorter declaration of capture_index_header structure
+typedef struct capture_index_header capture_index_header_t;
+//! Shorter declaration of capture_index_record structure
+typedef struct capture_index_record capture_index_record_t;
+
+/**
+ * @brief Sidecar index file header
+ */
+struct capture_index_header
+{
+    //! Format identifier
+    char magic[8];
+    //! Indexed file size
+    uint64_t size;
+    //! Indexed file modification time
+    int64_t mtime;
+    //! Hash of capture options that select stored packets
+    uint64_t options;
+    //! Number of records following the header
+    uint64_t count;
+};
+
+/**
+ * @brief Sidecar index record of a stored frame
+ */
+struct capture_index_record
+{
+    //! Frame data position in the indexed file
+    uint64_t offset;
+    //! Frame capture time
+    int64_t sec, usec;
+    //! Frame captured and original length
+    uint32_t caplen, len;
+};
+
+/**
+ * @brief Mapped capture file information of an offline source
+ */
+struct capture_mmap
+{
+    //! Mapped file data
+    u_char *map;
+    //! Mapped file size
+    size_t size;
+    //! Next record position
+    size_t pos;
+    //! Stop reading at this position
+    size_t end;
+    //! File is in pcapng format
+    bool pcapng;
+    //! File byte order is not host byte order
+    bool swapped;
+    //! Classic pcap file with nanoseconds timestamps
+    bool nsec;
+    //! pcapng interfaces in current section
+    uint32_t ifaces;
+    //! pcapng interfaces timestamp units per second (0 for unknown link types)
+    uint64_t units[CAPTURE_MMAP_MAX_IFACES];
+    //! Mapped sidecar index file (NULL if all records are read)
+    u_char *index_map;
+    //! Mapped sidecar index file size
+    size_t index_size;
+    //! Indexed frames records, sorted by position
+    const capture_index_record_t *index;
+    //! Number of indexed frames records
+    uint64_t index_count;
+    //! Stored frames records pending to be saved in sidecar index
+    capture_index_record_t *records;
+    //! Number of stored frames records
+    uint64_t records_count;
+    //! Allocated stored frames records
+    uint64_t records_size;
+};
+
+/**
+ * @brief Map the input file of an offline source
+ *
+ * Reading starts at the current position of the libpcap handle, so file
+ * chunks created by capture_offline_split are read from their first record.
+ *
+ * @param capinfo Offline capture source
+ * @return 0 if the file has been mapped, 1 if it must be read using libpcap
+ */
+int
+capture_mmap_open(capture_info_t *capinfo);
+
+/**
+ * @brief Parse all records of a mapped file
+ *
+ * @param capinfo Offline capture source with mapped file
+ */
+void
+capture_mmap_loop(capture_info_t *capinfo);
+
+/**
+ * @brief Remember the position of a stored packet frames
+ *
+ * This function is invoked with capture output locked, for every packet
+ * that has been stored or sent.
+ *
+ * @param packet Stored packet
+ */
+void
+capture_mmap_index_packet(packet_t *packet);
+
+/**
+ * @brief Save sidecar index of all completely read offline files
+ *
+ * This must be invoked after capture threads have stopped and before
+ * mapped files are closed.
+ *
+ * @param sources Capture sources vector
+ */
+void
+capture_mmap_index_save(vector_t *sources);
+
+/**
+ * @brief Unmap the input file of an offline source
+ *
+ * @param capinfo Offline capture source
+ */
+void
+capture_mmap_close(capture_info_t *capinfo);
+
+#endif /* __SNGREP_CAPTURE_MMAP_H */
@@ -35,9 +35,57 @@
 #include "capture_openssl.h"
 #include "option.h"
 #include "util.h"
+#include "hash.h"
 #include "sip.h"
+#include "setting.h"
 
-struct SSLConnection *connections;
+/**
+ * @brief Tracked TLS connections of one table partition
+ */
+struct SSLConnectionTable
+{
+    //! Connections by client and server addresses
+    struct SSLConnection *buckets[TLS_CONNECTION_BUCKETS];
+    //! Least recently active connection
+    struct SSLConnection *oldest;
+    //! Most recently active connection
+    struct SSLConnection *newest;
+    //! Number of tracked connections
+    uint32_t count;
+    //! Connections removed after timeout
+    uint64_t expired;
+    //! Connections removed because of connections limit
+    uint64_t evicted;
+    //! Records that could not be decrypted
+    uint64_t failures;
+    //! Segments can be processed from several capture threads
+    pthread_mutex_t lock;
+};
+
+//! Single partition used when segments are processed by capture threads
+static struct SSLConnectionTable default_table = { .lock = PTHREAD_MUTEX_INITIALIZER };
+//! Connection table partitions
+static struct SSLConnectionTable *tables = &default_table;
+//! Number of connection table partitions
+static int table_count = 1;
+
+/**
+ * @brief Master secret of a resumable TLS session
+ */
+struct SSLSession
+{
+    //! Hash of session ID or session ticket (0 if unused)
+    uint64_t key;
+    //! Session master secret
+    struct MasterSecret master_secret;
+};
+
+//! Resumable sessions, shared by all partitions as resumed connections can use any port
+static struct SSLSession sessions[TLS_SESSION_CACHE];
+//! Lock for resumable sessions
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER;
+//! Handshakes resumed from cached sessions
+static uint64_t sessions_resumed;
 
 struct CipherData ciphers[] = {
 /*  { number, encoder,    ivlen, bits, digest, diglen, mode }, */
@@ -190,10 +238,67 @@ PRF(struct SSLConnection *conn,
     return dlen;
 }
 
+/**
+ * @brief Hash connection addresses
+ *
+ * Both directions of a connection get the same hash.
+ */
+static uint32_t
+tls_connection_hash(struct in_addr addr1, uint16_t port1, struct in_addr addr2, uint16_t port2)
+{
+    uint32_t hash = (addr1.s_addr ^ ((uint32_t) port1 << 16 | port1))
+                  + (addr2.s_addr ^ ((uint32_t) port2 << 16 | port2));
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    return hash ^ (hash >> 16);
+}
+
+/**
+ * @brief Get the table partition of a connection hash
+ *
+ * Partition uses the high bits of the hash, the low ones select the
+ * bucket inside the partition.
+ */
+static struct SSLConnectionTable *
+tls_connection_table(uint32_t hash)
+{
+    return &tables[(hash >> 16) % table_count];
+}
+
+int
+tls_set_partitions(int count)
+{
+    int i;
+
+    if (count <= 1 || table_count > 1)
+        return 0;
+
+    if (!(tables = sng_malloc(sizeof(struct SSLConnectionTable) * count))) {
+        tables = &default_table;
+        return 1;
+    }
+
+    for (i = 0; i < count; i++)
+        pthread_mutex_init(&tables[i].lock, NULL);
+    table_count = count;
+    return 0;
+}
+
+int
+tls_packet_partition(packet_t *packet)
+{
+    return (tls_connection_hash(packet->src.ip.v4, packet->src.port,
+                                packet->dst.ip.v4, packet->dst.port) >> 16) % table_count;
+}
+
 struct SSLConnection *
 tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr, uint16_t sport) {
     struct SSLConnection *conn = NULL;
-    conn = sng_malloc(sizeof(struct SSLConnection));
+    struct SSLConnectionTable *table;
+    struct SSLConnection **bucket;
+    int limit;
+    conn = sng_malloc_tag(MEMSTAT_TLS, sizeof(struct SSLConnection));
 
     memcpy(&conn->client_addr, &caddr, sizeof(struct in_addr));
     memcpy(&conn->server_addr, &saddr, sizeof(struct in_addr));
@@ -220,9 +325,31 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
     conn->client_cipher_ctx = EVP_CIPHER_CTX_new();
     conn->server_cipher_ctx = EVP_CIPHER_CTX_new();
 
-    // Add this connection to the list
-    conn->next = connections;
-    connections = conn;
+    // Remove least recently active connections over the limit
+    // Limit is split between all table partitions
+    conn->hash = tls_connection_hash(caddr, cport, saddr, sport);
+    table = tls_connection_table(conn->hash);
+    limit = setting_get_intvalue(SETTING_CAPTURE_TLS_CONNECTIONS);
+    if (limit > 0 && (limit /= table_count) == 0)
+        limit = 1;
+    while (limit > 0 && table->count >= (uint32_t) limit && table->oldest) {
+        tls_connection_destroy(table->oldest);
+        table->evicted++;
+    }
+
+    // Add this connection to the table
+    bucket = &table->buckets[conn->hash & (TLS_CONNECTION_BUCKETS - 1)];
+    conn->next = *bucket;
+    *bucket = conn;
+
+    // Add as most recently active connection
+    conn->older = table->newest;
+    if (table->newest)
+        table->newest->newer = conn;
+    table->newest = conn;
+    if (!table->oldest)
+        table->oldest = conn;
+    table->count++;
 
     return conn;
 }
@@ -230,26 +357,34 @@ tls_connection_create(struct in_addr caddr, uint16_t cport, struct in_addr saddr
 void
 tls_connection_destroy(struct SSLConnection *conn)
 {
-    struct SSLConnection *c;
+    struct SSLConnectionTable *table = tls_connection_table(conn->hash);
+    struct SSLConnection **c;
 
-    // Remove connection from connections list
-    if (conn == connections) {
-        connections = conn->next;
-    } else {
-        for (c = connections; c; c = c->next) {
-            if (c->next == conn) {
-                c->next = conn->next;
-                break;
-            }
+    // Remove connection from its table bucket
+    for (c = &table->buckets[conn->hash & (TLS_CONNECTION_BUCKETS - 1)]; *c; c = &(*c)->next) {
+        if (*c == conn) {
+            *c = conn->next;
+            break;
         }
     }
 
+    // Remove from activity order list
+    if (conn->older)
+        conn->older->newer = conn->newer;
+    else if (table->oldest == conn)
+        table->oldest = conn->newer;
+    if (conn->newer)
+        conn->newer->older = conn->older;
+    else if (table->newest == conn)
+        table->newest = conn->older;
+    table->count--;
+
     // Deallocate connection memory
     EVP_CIPHER_CTX_free(conn->client_cipher_ctx);
     EVP_CIPHER_CTX_free(conn->server_cipher_ctx);
     SSL_CTX_free(conn->ssl_ctx);
     SSL_free(conn->ssl);
-    sng_free(conn);
+    sng_free_tag(MEMSTAT_TLS, conn, sizeof(struct SSLConnection));
 }
 
 /**
@@ -310,8 +445,12 @@ tls_connection_dir(struct SSLConnection *conn, struct in_addr addr, uint16_t por
 struct SSLConnection*
 tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint16_t dport) {
     struct SSLConnection *conn;
+    uint32_t hash = tls_connection_hash(src, sport, dst, dport);
+    struct SSLConnectionTable *table = tls_connection_table(hash);
 
-    for (conn = connections; conn; conn = conn->next) {
+    for (conn = table->buckets[hash & (TLS_CONNECTION_BUCKETS - 1)]; conn; conn = conn->next) {
+        if (conn->hash != hash)
+            continue;
         if (tls_connection_dir(conn, src, sport) == 0 &&
                 tls_connection_dir(conn, dst, dport) == 1) {
             return conn;
@@ -324,9 +463,76 @@ tls_connection_find(struct in_addr src, uint16_t sport, struct in_addr dst, uint
     return NULL;
 }
 
+/**
+ * @brief Move a connection to the end of activity order list
+ */
+static void
+tls_connection_touch(struct SSLConnection *conn, time_t ts)
+{
+    struct SSLConnectionTable *table = tls_connection_table(conn->hash);
+
+    conn->ts = ts;
+
+    if (table->newest == conn)
+        return;
+
+    // Remove from current position
+    if (conn->older)
+        conn->older->newer = conn->newer;
+    else if (table->oldest == conn)
+        table->oldest = conn->newer;
+    if (conn->newer)
+        conn->newer->older = conn->older;
+
+    // Add as newest connection
+    conn->newer = NULL;
+    conn->older = table->newest;
+    if (table->newest)
+        table->newest->newer = conn;
+    table->newest = conn;
+    if (!table->oldest)
+        table->oldest = conn;
+}
+
+/**
+ * @brief Remove connections without packets for capture.tls.timeout seconds
+ */
+static void
+tls_connection_expire(struct SSLConnectionTable *table, time_t now)
+{
+    int timeout = setting_get_intvalue(SETTING_CAPTURE_TLS_TIMEOUT);
+
+    if (timeout <= 0)
+        return;
+
+    while (table->oldest && table->oldest->ts + timeout < now) {
+        tls_connection_destroy(table->oldest);
+        table->expired++;
+    }
+}
+
+void
+tls_connection_stats(uint32_t *count, uint64_t *expired, uint64_t *evicted, uint64_t *failures)
+{
+    int i;
+
+    *count = 0;
+    *expired = *evicted = *failures = 0;
+
+    for (i = 0; i < table_count; i++) {
+        pthread_mutex_lock(&tables[i].lock);
+        *count += tables[i].count;
+        *expired += tables[i].expired;
+        *evicted += tables[i].evicted;
+        *failures += tables[i].failures;
+        pthread_mutex_unlock(&tables[i].lock);
+    }
+}
+
 int
 tls_process_segment(packet_t *packet, struct tcphdr *tcp)
 {
+    struct SSLConnectionTable *table;
     struct SSLConnection *conn;
     const u_char *payload = packet_payload(packet);
     uint32_t size_payload = packet_payloadlen(packet);
@@ -338,14 +544,30 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
     uint16_t dport = packet->dst.port;
     address_t tlsserver = capture_tls_server();
 
-    // Convert addresses
-    inet_pton(AF_INET, packet->src.ip, &ip_src);
-    inet_pton(AF_INET, packet->dst.ip, &ip_dst);
+    // Get IPv4 addresses
+    ip_src = packet->src.ip.v4;
+    ip_dst = packet->dst.ip.v4;
+
+    // Only connections of this partition are modified
+    table = tls_connection_table(tls_connection_hash(ip_src, sport, ip_dst, dport));
+    pthread_mutex_lock(&table->lock);
+
+    // Remove idle connections before looking for this one
+    tls_connection_expire(table, packet_time(packet).tv_sec);
 
     // Try to find a session for this ip
     if ((conn = tls_connection_find(ip_src, sport, ip_dst, dport))) {
-        // Update last connection direction
+        // Closed connection, no more records are expected
+        if ((tcp->th_flags & (TH_FIN | TH_RST)) && !size_payload) {
+            tls_connection_destroy(conn);
+            pthread_mutex_unlock(&table->lock);
+            sng_free(out);
+            return 0;
+        }
+
+        // Update last connection direction and activity
         conn->direction = tls_connection_dir(conn, ip_src, sport);
+        tls_connection_touch(conn, packet_time(packet).tv_sec);
 
         // Check current connection state
         switch (conn->state) {
@@ -363,17 +585,24 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
             case TCP_STATE_ESTABLISHED:
                 // Check if we have a SSLv2 Handshake
                 if(tls_record_handshake_is_ssl2(conn, payload, size_payload)) {
-                    if (tls_process_record_ssl2(conn, payload, size_payload, &out, &outl) != 0)
+                    if (tls_process_record_ssl2(conn, payload, size_payload, &out, &outl) != 0) {
+                        table->failures++;
                         outl = 0;
+                    }
 
                 } else {
                     // Process data segment!
-                    if (tls_process_record(conn, payload, size_payload, &out, &outl) != 0)
+                    if (tls_process_record(conn, payload, size_payload, &out, &outl) != 0) {
+                        // Segments without payload are not records
+                        if (size_payload)
+                            table->failures++;
                         outl = 0;
+                    }
                 }
 
                 // This seems a SIP TLS packet ;-)
                 if ((int32_t) outl > 0) {
+                    pthread_mutex_unlock(&table->lock);
                     packet_set_payload(packet, out, outl);
                     packet_set_type(packet, PACKET_SIP_TLS);
                     return 0;
@@ -391,15 +620,18 @@ tls_process_segment(packet_t *packet, struct tcphdr *tcp)
             if (tlsserver.port) {
                 if (addressport_equals(tlsserver, packet->dst)) {
                     // New connection, store it status and leave
-                    tls_connection_create(ip_src, sport, ip_dst, dport);
+                    if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                        conn->ts = packet_time(packet).tv_sec;
                 }
             } else {
                 // New connection, store it status and leave
-                tls_connection_create(ip_src, sport, ip_dst, dport);
+                if ((conn = tls_connection_create(ip_src, sport, ip_dst, dport)))
+                    conn->ts = packet_time(packet).tv_sec;
             }
         }
     }
 
+    pthread_mutex_unlock(&table->lock);
     sng_free(out);
     return 0;
 }
@@ -543,6 +775,223 @@ tls_process_record(struct SSLConnection *conn, const uint8_t *payload,
     return 0;
 }
 
+/**
+ * @brief Get the sessions cache key of a session ID or session ticket
+ */
+static uint64_t
+tls_session_key(const uint8_t *data, int len)
+{
+    uint64_t key = hash_mem64(data, len);
+    // Zero is used for empty entries
+    return key ? key : 1;
+}
+
+/**
+ * @brief Cache connection master secret for resumed handshakes
+ *
+ * Sessions cache is direct mapped, newer sessions replace older ones.
+ */
+static void
+tls_session_store(uint64_t key, struct MasterSecret *master_secret)
+{
+    struct SSLSession *session = &sessions[key % TLS_SESSION_CACHE];
+
+    pthread_mutex_lock(&sessions_lock);
+    session->key = key;
+    memcpy(&session->master_secret, master_secret, sizeof(struct MasterSecret));
+    pthread_mutex_unlock(&sessions_lock);
+}
+
+/**
+ * @brief Get the cached master secret of a session
+ *
+ * @return 0 if session was found, 1 otherwise
+ */
+static int
+tls_session_find(uint64_t key, struct MasterSecret *master_secret)
+{
+    struct SSLSession *session = &sessions[key % TLS_SESSION_CACHE];
+    int ret = 1;
+
+    pthread_mutex_lock(&sessions_lock);
+    if (session->key == key) {
+        memcpy(master_secret, &session->master_secret, sizeof(struct MasterSecret));
+        sessions_resumed++;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&sessions_lock);
+    return ret;
+}
+
+uint64_t
+tls_session_resumed()
+{
+    uint64_t resumed;
+
+    pthread_mutex_lock(&sessions_lock);
+    resumed = sessions_resumed;
+    pthread_mutex_unlock(&sessions_lock);
+    return resumed;
+}
+
+/**
+ * @brief Store session ID and session ticket offered in a ClientHello
+ *
+ * @param conn Existing connection pointer
+ * @param body ClientHello handshake body
+ * @param len ClientHello length in bytes
+ */
+static void
+tls_client_hello_session(struct SSLConnection *conn, const opaque *body, int len)
+{
+    const opaque *end = body + len, *p = body + sizeof(struct ClientHello);
+    int type, elen;
+
+    conn->session_id_len = 0;
+    conn->ticket = 0;
+
+    // Session ID
+    if (p + 1 > end || p[0] > TLS_SESSION_ID_MAXLEN || p + 1 + p[0] > end)
+        return;
+    conn->session_id_len = p[0];
+    memcpy(conn->session_id, p + 1, p[0]);
+    p += 1 + p[0];
+
+    // Skip cipher suites, compression methods and extensions length
+    if (p + 2 > end)
+        return;
+    p += 2 + ((p[0] << 8) | p[1]);
+    if (p + 1 > end)
+        return;
+    p += 1 + p[0] + 2;
+
+    // Look for a non empty session ticket extension
+    while (p + 4 <= end) {
+        type = (p[0] << 8) | p[1];
+        elen = (p[2] << 8) | p[3];
+        p += 4;
+        if (p + elen > end)
+            return;
+        if (type == TLS_EXT_SESSION_TICKET && elen > 0)
+            conn->ticket = tls_session_key(p, elen);
+        p += elen;
+    }
+}
+
+/**
+ * @brief Check if server resumes a cached session in its ServerHello
+ *
+ * Servers resuming a session, by ID or ticket, echo the session ID
+ * offered by the client. Otherwise a full handshake follows and the
+ * session ID assigned by the server is stored to cache its master secret.
+ *
+ * @return 0 if master secret has been loaded from cache, 1 otherwise
+ */
+static int
+tls_server_hello_session(struct SSLConnection *conn, const opaque *session_id, int len)
+{
+    if (len > 0 && len == conn->session_id_len && !memcmp(session_id, conn->session_id, len)) {
+        if (tls_session_find(tls_session_key(session_id, len), &conn->master_secret) == 0)
+            return 0;
+        if (conn->ticket && tls_session_find(conn->ticket, &conn->master_secret) == 0)
+            return 0;
+    }
+
+    conn->session_id_len = (len <= TLS_SESSION_ID_MAXLEN) ? len : 0;
+    memcpy(conn->session_id, session_id, conn->session_id_len);
+    return 1;
+}
+
+/**
+ * @brief Derive connection keys from its master secret and hello randoms
+ *
+ * @param conn Existing connection pointer
+ * @return 0 on success, 1 if connection cipher mode is not supported
+ */
+static int
+tls_connection_load_keys(struct SSLConnection *conn)
+{
+    uint8_t *seed = sng_malloc(sizeof(struct Random) * 2);
+
+    memcpy(seed, &conn->server_random, sizeof(struct Random) * 2);
+    memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
+
+    int key_material_len = 0;
+    key_material_len += conn->cipher_data.diglen * 2;
+    key_material_len += conn->cipher_data.ivblock * 2;
+    key_material_len += conn->cipher_data.bits / 4;
+    uint8_t *key_material = sng_malloc(key_material_len);
+
+    // Generate MACs, Write Keys and IVs
+    PRF(conn,
+        (unsigned char *) key_material, key_material_len,
+        (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
+        (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
+
+    // Get write mac keys
+    if (conn->cipher_data.mode == MODE_GCM) {
+        // AEAD ciphers
+        conn->key_material.client_write_MAC_key = 0;
+        conn->key_material.server_write_MAC_key = 0;
+    } else {
+        // Copy prf output to ssl connection key material
+        int mk_len = conn->cipher_data.diglen;
+        conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
+        tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
+        memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
+        key_material += mk_len;
+        conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
+        tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
+        memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
+        key_material += mk_len;
+    }
+
+    // Get write keys
+    int wk_len = conn->cipher_data.bits / 8;
+    conn->key_material.client_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.client_write_key, key_material, wk_len);
+    tls_debug_print_hex("client_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    conn->key_material.server_write_key = sng_malloc(wk_len);
+    memcpy(conn->key_material.server_write_key, key_material, wk_len);
+    tls_debug_print_hex("server_write_key", key_material, wk_len);
+    key_material+=wk_len;
+
+    // Get IV blocks
+    conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
+    key_material+=conn->cipher_data.ivblock;
+    conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
+    memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
+    tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
+
+    // Done with the seed
+    sng_free(seed);
+
+    // Create Client decoder
+#if MODSSL_USE_OPENSSL_PRE_1_1_API
+    EVP_CIPHER_CTX_init(conn->client_cipher_ctx);
+#else
+    EVP_CIPHER_CTX_reset(conn->client_cipher_ctx);
+#endif
+    EVP_CipherInit(conn->client_cipher_ctx, conn->ciph,
+                   conn->key_material.client_write_key, conn->key_material.client_write_IV,
+                   0);
+
+#if MODSSL_USE_OPENSSL_PRE_1_1_API
+    EVP_CIPHER_CTX_init(conn->server_cipher_ctx);
+#else
+    EVP_CIPHER_CTX_reset(conn->server_cipher_ctx);
+#endif
+    EVP_CipherInit(conn->server_cipher_ctx, conn->ciph,
+                   conn->key_material.server_write_key, conn->key_material.server_write_IV,
+                   0);
+
+    return 0;
+}
+
 int
 tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment, const int len)
 {
@@ -583,6 +1032,9 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
                 // Store TLS version
                 conn->version = clienthello->client_version.minor;
+
+                // Store offered session to check if server resumes it
+                tls_client_hello_session(conn, body, UINT24_INT(handshake->length));
                 break;
             case server_hello:
                 // Store server random
@@ -597,6 +1049,13 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
                     tls_connection_destroy(conn);
                     return 1;
                 }
+                // Resumed sessions have no key exchange, keys are derived from cached secret
+                if (tls_server_hello_session(conn, body + sizeof(struct ServerHello),
+                                             serverhello->session_id_length) == 0
+                    && tls_connection_load_keys(conn) != 0) {
+                    tls_connection_destroy(conn);
+                    return 1;
+                }
                 break;
             case certificate:
             case certificate_request:
@@ -634,85 +1093,29 @@ tls_process_record_handshake(struct SSLConnection *conn, const opaque *fragment,
 
                 tls_debug_print_hex("master_secret", conn->master_secret.random, 48);
 
-                memcpy(seed, &conn->server_random, sizeof(struct Random) * 2);
-                memcpy(seed + sizeof(struct Random), &conn->client_random, sizeof(struct Random));
+                sng_free(seed);
 
-                int key_material_len = 0;
-                key_material_len += conn->cipher_data.diglen * 2;
-                key_material_len += conn->cipher_data.ivblock * 2;
-                key_material_len += conn->cipher_data.bits / 4;
-                uint8_t *key_material = sng_malloc(key_material_len);
+                // Resumed handshakes will reuse this master secret
+                if (conn->session_id_len)
+                    tls_session_store(tls_session_key(conn->session_id, conn->session_id_len),
+                                      &conn->master_secret);
 
                 // Generate MACs, Write Keys and IVs
-                PRF(conn,
-                    (unsigned char *) key_material, key_material_len,
-                    (unsigned char *) &conn->master_secret, sizeof(struct MasterSecret),
-                    (unsigned char *) "key expansion", seed, sizeof(struct Random) * 2);
-
-                // Get write mac keys
-                if (conn->cipher_data.mode == MODE_GCM) {
-                    // AEAD ciphers
-                    conn->key_material.client_write_MAC_key = 0;
-                    conn->key_material.server_write_MAC_key = 0;
-                } else {
-                    // Copy prf output to ssl connection key material
-                    int mk_len = conn->cipher_data.diglen;
-                    conn->key_material.client_write_MAC_key = sng_malloc(mk_len);
-                    tls_debug_print_hex("client_write_MAC_key", key_material, mk_len);
-                    memcpy(conn->key_material.client_write_MAC_key, key_material, mk_len);
-                    key_material += mk_len;
-                    conn->key_material.server_write_MAC_key = sng_malloc(mk_len);
-                    tls_debug_print_hex("server_write_MAC_key", key_material, mk_len);
-                    memcpy(conn->key_material.server_write_MAC_key, key_material, mk_len);
-                    key_material += mk_len;
+                if (tls_connection_load_keys(conn) != 0) {
+                    tls_connection_destroy(conn);
+                    return 1;
                 }
-
-                // Get write keys
-                int wk_len = conn->cipher_data.bits / 8;
-                conn->key_material.client_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.client_write_key, key_material, wk_len);
-                tls_debug_print_hex("client_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                conn->key_material.server_write_key = sng_malloc(wk_len);
-                memcpy(conn->key_material.server_write_key, key_material, wk_len);
-                tls_debug_print_hex("server_write_key", key_material, wk_len);
-                key_material+=wk_len;
-
-                // Get IV blocks
-                conn->key_material.client_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.client_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("client_write_IV", key_material,  conn->cipher_data.ivblock);
-                key_material+=conn->cipher_data.ivblock;
-                conn->key_material.server_write_IV = sng_malloc(conn->cipher_data.ivblock);
-                memcpy(conn->key_material.server_write_IV, key_material, conn->cipher_data.ivblock);
-                tls_debug_print_hex("server_write_IV", key_material,  conn->cipher_data.ivblock);
-
-                // Done with the seed
-                sng_free(seed);
-
-                // Create Client decoder
-#if MODSSL_USE_OPENSSL_PRE_1_1_API
-                EVP_CIPHER_CTX_init(conn->client_cipher_ctx);
-#else
-                EVP_CIPHER_CTX_reset(conn->client_cipher_ctx);
-#endif
-                EVP_CipherInit(conn->client_cipher_ctx, conn->ciph,
-                               conn->key_material.client_write_key, conn->key_material.client_write_IV,
-                               0);
-
-#if MODSSL_USE_OPENSSL_PRE_1_1_API
-                EVP_CIPHER_CTX_init(conn->server_cipher_ctx);
-#else
-                EVP_CIPHER_CTX_reset(conn->server_cipher_ctx);
-#endif
-                EVP_CipherInit(conn->server_cipher_ctx, conn->ciph,
-                               conn->key_material.server_write_key, conn->key_material.server_write_IV,
-                               0);
-
                 break;
 #ifndef OLD_OPENSSL_VERSION
             case new_session_ticket:
+                // Resumed handshakes with this ticket will reuse current master secret
+                if (conn->key_material.client_write_key && len >= (int) sizeof(struct Handshake) + 6) {
+                    int ticket_len = (body[4] << 8) | body[5];
+                    if (UINT24_INT(handshake->length) == 6 + ticket_len
+                        && len >= (int) sizeof(struct Handshake) + 6 + ticket_len)
+                        tls_session_store(tls_session_key(body + 6, ticket_len), &conn->master_secret);
+                }
+                break;
 #endif
             case finished:
                 break;
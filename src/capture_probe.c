@@ -0,0 +1,836 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_probe.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_probe.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include "capture_probe.h"
+#include "rtp.h"
+#include "storage.h"
+#include "util.h"
+
+//! Shorter declaration of capture_probe_buf structure
+typedef struct capture_probe_buf capture_probe_buf_t;
+
+/**
+ * @brief Record being encoded or decoded
+ *
+ * Out of bounds reads and writes are not done, but flag the record as
+ * invalid, so fields can be read or written without checking each one.
+ */
+struct capture_probe_buf
+{
+    //! Record data
+    u_char *data;
+    //! Encoded or decoded bytes
+    uint32_t len;
+    //! Record data size
+    uint32_t size;
+    //! Record does not fit in data or is malformed
+    bool error;
+};
+
+static void
+capture_probe_put(capture_probe_buf_t *buf, const void *data, uint32_t len)
+{
+    if (buf->error || buf->len + len > buf->size) {
+        buf->error = true;
+        return;
+    }
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+}
+
+static void
+capture_probe_put8(capture_probe_buf_t *buf, uint8_t value)
+{
+    capture_probe_put(buf, &value, sizeof(value));
+}
+
+static void
+capture_probe_put16(capture_probe_buf_t *buf, uint16_t value)
+{
+    value = htons(value);
+    capture_probe_put(buf, &value, sizeof(value));
+}
+
+static void
+capture_probe_put32(capture_probe_buf_t *buf, uint32_t value)
+{
+    value = htonl(value);
+    capture_probe_put(buf, &value, sizeof(value));
+}
+
+static void
+capture_probe_put64(capture_probe_buf_t *buf, uint64_t value)
+{
+    capture_probe_put32(buf, value >> 32);
+    capture_probe_put32(buf, value & 0xFFFFFFFF);
+}
+
+static void
+capture_probe_put_str(capture_probe_buf_t *buf, const char *str)
+{
+    uint16_t len = (str) ? strlen(str) : 0;
+
+    capture_probe_put16(buf, len);
+    if (len)
+        capture_probe_put(buf, str, len);
+}
+
+static void
+capture_probe_put_addr(capture_probe_buf_t *buf, address_t addr)
+{
+    capture_probe_put8(buf, addr.family);
+    capture_probe_put16(buf, addr.port);
+    capture_probe_put(buf, &addr.ip, (addr.family == AF_INET6) ? sizeof(struct in6_addr) : sizeof(struct in_addr));
+}
+
+static const u_char *
+capture_probe_get(capture_probe_buf_t *buf, uint32_t len)
+{
+    const u_char *data = buf->data + buf->len;
+
+    if (buf->error || buf->len + len > buf->size) {
+        buf->error = true;
+        return NULL;
+    }
+    buf->len += len;
+    return data;
+}
+
+static uint8_t
+capture_probe_get8(capture_probe_buf_t *buf)
+{
+    const u_char *data = capture_probe_get(buf, sizeof(uint8_t));
+    return (data) ? *data : 0;
+}
+
+static uint16_t
+capture_probe_get16(capture_probe_buf_t *buf)
+{
+    const u_char *data = capture_probe_get(buf, sizeof(uint16_t));
+    uint16_t value = 0;
+
+    if (data)
+        memcpy(&value, data, sizeof(value));
+    return ntohs(value);
+}
+
+static uint32_t
+capture_probe_get32(capture_probe_buf_t *buf)
+{
+    const u_char *data = capture_probe_get(buf, sizeof(uint32_t));
+    uint32_t value = 0;
+
+    if (data)
+        memcpy(&value, data, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t
+capture_probe_get64(capture_probe_buf_t *buf)
+{
+    uint64_t value = (uint64_t) capture_probe_get32(buf) << 32;
+    return value | capture_probe_get32(buf);
+}
+
+/**
+ * @brief Get a string field as a NUL terminated string
+ *
+ * @param str Destination buffer of maxlen bytes
+ */
+static void
+capture_probe_get_str(capture_probe_buf_t *buf, char *str, uint32_t maxlen)
+{
+    uint16_t len = capture_probe_get16(buf);
+    const u_char *data = capture_probe_get(buf, len);
+
+    str[0] = '\0';
+    if (!data || len >= maxlen) {
+        buf->error = true;
+        return;
+    }
+    memcpy(str, data, len);
+    str[len] = '\0';
+}
+
+static address_t
+capture_probe_get_addr(capture_probe_buf_t *buf)
+{
+    address_t addr;
+    const u_char *data;
+
+    memset(&addr, 0, sizeof(address_t));
+    addr.family = capture_probe_get8(buf);
+    addr.port = capture_probe_get16(buf);
+    if (addr.family == AF_INET6) {
+        if ((data = capture_probe_get(buf, sizeof(struct in6_addr))))
+            memcpy(&addr.ip.v6, data, sizeof(struct in6_addr));
+    } else {
+        if ((data = capture_probe_get(buf, sizeof(struct in_addr))))
+            memcpy(&addr.ip.v4, data, sizeof(struct in_addr));
+    }
+    return addr;
+}
+
+/**
+ * @brief Start encoding a record in the given buffer
+ */
+static void
+capture_probe_begin(capture_probe_buf_t *buf, u_char *data, enum capture_probe_type type)
+{
+    capture_probe_hdr_t hdr;
+
+    memset(&hdr, 0, sizeof(capture_probe_hdr_t));
+    memcpy(hdr.id, CAPTURE_PROBE_ID, sizeof(hdr.id));
+    hdr.type = type;
+
+    buf->data = data;
+    buf->len = 0;
+    buf->size = CAPTURE_PROBE_MAXLEN;
+    buf->error = false;
+    capture_probe_put(buf, &hdr, sizeof(capture_probe_hdr_t));
+}
+
+/**
+ * @brief Finish encoding a record, setting its length
+ *
+ * @return record length or 0 if it did not fit in the buffer
+ */
+static uint32_t
+capture_probe_end(capture_probe_buf_t *buf)
+{
+    capture_probe_hdr_t *hdr = (capture_probe_hdr_t *) buf->data;
+
+    if (buf->error)
+        return 0;
+    hdr->length = htons(buf->len);
+    return buf->len;
+}
+
+/**
+ * @brief Start decoding a received record
+ *
+ * @return record type or 0 if record is malformed
+ */
+static int
+capture_probe_open(capture_probe_buf_t *buf, const u_char *data, uint32_t len)
+{
+    capture_probe_hdr_t hdr;
+
+    if (len < sizeof(capture_probe_hdr_t))
+        return 0;
+    memcpy(&hdr, data, sizeof(capture_probe_hdr_t));
+    if (memcmp(hdr.id, CAPTURE_PROBE_ID, sizeof(hdr.id)) != 0 || ntohs(hdr.length) != len)
+        return 0;
+
+    buf->data = (u_char *) data;
+    buf->len = sizeof(capture_probe_hdr_t);
+    buf->size = len;
+    buf->error = false;
+    return hdr.type;
+}
+
+/**
+ * @brief Add a payload line to a message summary
+ *
+ * @param start Line start
+ * @param end Line end, without its line feed
+ */
+static void
+capture_probe_put_line(capture_probe_buf_t *buf, const char *start, const char *end)
+{
+    capture_probe_put(buf, start, end - start);
+    capture_probe_put(buf, "\n", 1);
+}
+
+/**
+ * @brief Check if a body line is required to parse message media
+ */
+static bool
+capture_probe_sdp_line(const char *line, const char *eol)
+{
+    if (eol - line < 2 || line[1] != '=')
+        return false;
+    if (line[0] == 'c' || line[0] == 'm')
+        return true;
+    return (eol - line > 9 && !strncmp(line, "a=rtpmap:", 9))
+           || (eol - line > 7 && !strncmp(line, "a=rtcp:", 7));
+}
+
+/**
+ * @brief Add the summary of a message payload
+ *
+ * Summary keeps the start line, the full line of each header located
+ * while scanning and the SDP lines that describe media, so the collector
+ * gets the same call and media information parsing it.
+ */
+static void
+capture_probe_put_summary(capture_probe_buf_t *buf, const u_char *payload, uint32_t len,
+                          const sip_scan_t *scan)
+{
+    const char *text = (const char *) payload, *end = text + len;
+    const char *line, *value, *eol;
+    char clen[32];
+    uint32_t body = 0;
+    int header, pass;
+
+    // Request or response line
+    capture_probe_put_line(buf, text, text + scan->start_len);
+
+    for (header = 0; header < SIP_SCAN_HEADER_COUNT; header++) {
+        // Content length is recalculated for the summary body
+        if (header == SIP_SCAN_CONTENT_LENGTH || !scan->headers[header].off)
+            continue;
+        value = text + scan->headers[header].off;
+        for (line = value; line > text && line[-1] != '\n'; line--);
+        capture_probe_put_line(buf, line, value + scan->headers[header].len);
+    }
+
+    // Body lines are measured first, then copied after Content-Length
+    for (pass = 0; pass < 2; pass++) {
+        if (pass == 1) {
+            snprintf(clen, sizeof(clen), "Content-Length: %u\r\n\r\n", body);
+            capture_probe_put(buf, clen, strlen(clen));
+        }
+        if (!scan->body)
+            continue;
+        for (line = text + scan->body; line < end && *line; line = eol + 1) {
+            for (eol = line; eol < end && *eol && *eol != '\n'; eol++);
+            value = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+            if (capture_probe_sdp_line(line, value)) {
+                if (pass == 0) {
+                    body += value - line + 2;
+                } else {
+                    capture_probe_put(buf, line, value - line);
+                    capture_probe_put(buf, "\r\n", 2);
+                }
+            }
+            if (eol == end || !*eol)
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Encode the counters of a stream
+ *
+ * @return record length or 0 on error
+ */
+static uint32_t
+capture_probe_stream(u_char *data, sip_call_t *call, rtp_stream_t *stream)
+{
+    capture_probe_buf_t buf;
+    rtp_stats_t *stats = &stream->rtpinfo.stats;
+
+    capture_probe_begin(&buf, data, CAPTURE_PROBE_STREAM);
+    capture_probe_put_str(&buf, call->callid);
+    capture_probe_put8(&buf, stream->type);
+    capture_probe_put_addr(&buf, stream->src);
+    capture_probe_put_addr(&buf, stream->dst);
+    capture_probe_put32(&buf, stream->pktcnt);
+    capture_probe_put64(&buf, stream->time);
+    capture_probe_put32(&buf, stream->lasttm);
+
+    if (stream->type == PACKET_RTP) {
+        capture_probe_put32(&buf, stream->rtpinfo.fmtcode);
+        capture_probe_put16(&buf, stats->base_seq);
+        capture_probe_put16(&buf, stats->max_seq);
+        capture_probe_put32(&buf, stats->cycles);
+        capture_probe_put32(&buf, stats->out_of_order);
+        capture_probe_put32(&buf, stats->clock);
+        capture_probe_put32(&buf, stats->transit);
+        capture_probe_put32(&buf, stats->jitter);
+        capture_probe_put32(&buf, stats->max_delta);
+        capture_probe_put64(&buf, stats->last_time);
+        capture_probe_put64(&buf, stats->bytes);
+    } else {
+        capture_probe_put32(&buf, stream->rtcpinfo.spc);
+        capture_probe_put8(&buf, stream->rtcpinfo.flost);
+        capture_probe_put8(&buf, stream->rtcpinfo.fdiscard);
+        capture_probe_put8(&buf, stream->rtcpinfo.mosl);
+        capture_probe_put8(&buf, stream->rtcpinfo.mosc);
+    }
+
+    return capture_probe_end(&buf);
+}
+
+/**
+ * @brief Encode captured frames and payload of a message
+ *
+ * @return record length or 0 if frames are not stored or do not fit
+ */
+static uint32_t
+capture_probe_frames(u_char *data, sip_call_t *call, sip_msg_t *msg)
+{
+    capture_probe_buf_t buf;
+    packet_t *packet = msg->packet, *clone;
+    frame_t *frame;
+    vector_iter_t it;
+
+    // Expand compressed frames if required
+    if (storage_packet_load(packet) != 0)
+        return 0;
+
+    // Frames data may have been released
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (!frame->data)
+            return 0;
+    }
+
+    // Frames of retransmissions sharing their payload are rebuilt
+    clone = packet_clone(packet);
+
+    capture_probe_begin(&buf, data, CAPTURE_PROBE_FRAMES);
+    capture_probe_put_str(&buf, call->callid);
+    capture_probe_put64(&buf, packet_time_ns(packet));
+    capture_probe_put_addr(&buf, packet->src);
+    capture_probe_put_addr(&buf, packet->dst);
+    capture_probe_put16(&buf, vector_count(clone->frames));
+    it = vector_iterator(clone->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        capture_probe_put32(&buf, frame->header->ts.tv_sec);
+        capture_probe_put32(&buf, frame->header->ts.tv_usec);
+        capture_probe_put32(&buf, frame->header->caplen);
+        capture_probe_put32(&buf, frame->header->len);
+        capture_probe_put(&buf, frame->data, frame->header->caplen);
+    }
+    capture_probe_put32(&buf, packet_payloadlen(packet));
+    capture_probe_put(&buf, packet_payload(packet), packet_payloadlen(packet));
+
+    packet_destroy(clone);
+    return capture_probe_end(&buf);
+}
+
+uint32_t
+capture_probe_hello(u_char *buffer, const char *password)
+{
+    capture_probe_buf_t buf;
+
+    capture_probe_begin(&buf, buffer, CAPTURE_PROBE_HELLO);
+    capture_probe_put8(&buf, CAPTURE_PROBE_VERSION);
+    capture_probe_put_str(&buf, password);
+    return capture_probe_end(&buf);
+}
+
+void
+capture_probe_msg(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan)
+{
+    u_char data[CAPTURE_PROBE_MAXLEN];
+    capture_probe_buf_t buf;
+    packet_t *packet = msg->packet;
+    uint32_t len;
+
+    if (!capture_eep_send_probe())
+        return;
+
+    capture_probe_begin(&buf, data, CAPTURE_PROBE_MSG);
+    capture_probe_put64(&buf, packet_time_ns(packet));
+    capture_probe_put8(&buf, packet->ip_version);
+    capture_probe_put8(&buf, packet->proto);
+    capture_probe_put8(&buf, packet->type);
+    capture_probe_put_addr(&buf, packet->src);
+    capture_probe_put_addr(&buf, packet->dst);
+    capture_probe_put_summary(&buf, payload, packet_payloadlen(packet), scan);
+
+    if ((len = capture_probe_end(&buf)))
+        capture_eep_send_record(data, len);
+}
+
+void
+capture_probe_call(sip_call_t *call)
+{
+    u_char data[CAPTURE_PROBE_MAXLEN];
+    rtp_stream_t *stream;
+    uint32_t len;
+
+    if (!capture_eep_send_probe())
+        return;
+
+    vector_iter_t it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        // Streams without packets have nothing to report
+        if (!stream_is_complete(stream) || !stream_get_count(stream))
+            continue;
+        if ((len = capture_probe_stream(data, call, stream)))
+            capture_eep_send_record(data, len);
+    }
+}
+
+/**
+ * @brief Append an encoded record to the answer of a request
+ *
+ * @return 0 on success, 1 if memory could not be allocated
+ */
+static int
+capture_probe_answer(u_char **answer, uint32_t *len, const u_char *data, uint32_t rlen)
+{
+    u_char *grown;
+
+    if (!rlen)
+        return 0;
+    if (!(grown = realloc(*answer, *len + rlen)))
+        return 1;
+    memcpy(grown + *len, data, rlen);
+    *answer = grown;
+    *len += rlen;
+    return 0;
+}
+
+void
+capture_probe_request(const u_char *data, uint32_t len)
+{
+    u_char record[CAPTURE_PROBE_MAXLEN];
+    char callid[SIP_CALLID_MAXLEN];
+    capture_probe_buf_t buf;
+    u_char *answer = NULL;
+    uint32_t alen = 0;
+    uint64_t since;
+    sip_call_t *call;
+    sip_msg_t *msg;
+    rtp_stream_t *stream;
+    vector_iter_t it;
+
+    // Collectors only request call frames
+    if (capture_probe_open(&buf, data, len) != CAPTURE_PROBE_FETCH)
+        return;
+    capture_probe_get_str(&buf, callid, sizeof(callid));
+    since = capture_probe_get64(&buf);
+    if (buf.error)
+        return;
+
+    // Records are encoded while call is locked, and sent after
+    capture_lock();
+    if ((call = sip_find_by_callid(callid))) {
+        it = vector_iterator(call->msgs);
+        while ((msg = vector_iterator_next(&it))) {
+            if (msg_get_time_ns(msg) < since)
+                continue;
+            if (capture_probe_answer(&answer, &alen, record, capture_probe_frames(record, call, msg)) != 0)
+                break;
+        }
+
+        it = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&it))) {
+            if (!stream_is_complete(stream) || !stream_get_count(stream))
+                continue;
+            if (capture_probe_answer(&answer, &alen, record, capture_probe_stream(record, call, stream)) != 0)
+                break;
+        }
+    }
+    capture_unlock();
+
+    if (alen)
+        capture_eep_send_direct(answer, alen);
+    free(answer);
+}
+
+/**
+ * @brief Create a stub packet from a message summary
+ *
+ * Summary payload is stored in a fake UDP frame, as HEP packets, until
+ * the captured frames are fetched.
+ */
+static packet_t *
+capture_probe_receive_msg(capture_probe_buf_t *buf)
+{
+    struct pcap_pkthdr header, frame_header;
+    address_t src, dst;
+    const u_char *payload;
+    u_char *frame_payload;
+    uint8_t ip_version, proto, type;
+    uint32_t payload_len;
+    uint64_t ts;
+    packet_t *packet;
+    frame_t *frame;
+
+    ts = capture_probe_get64(buf);
+    ip_version = capture_probe_get8(buf);
+    proto = capture_probe_get8(buf);
+    type = capture_probe_get8(buf);
+    src = capture_probe_get_addr(buf);
+    dst = capture_probe_get_addr(buf);
+
+    // Summary payload takes the rest of the record
+    payload_len = buf->size - buf->len;
+    if (buf->error || !payload_len || !(payload = capture_probe_get(buf, payload_len)))
+        return NULL;
+
+    memset(&header, 0, sizeof(struct pcap_pkthdr));
+    header.ts.tv_sec = ts / 1000000000;
+    header.ts.tv_usec = (ts % 1000000000) / 1000;
+    header.caplen = header.len = payload_len;
+    frame_header = capture_eep_build_frame_data(header, payload, payload_len, src, dst, &frame_payload);
+
+    packet = packet_create(ip_version, proto, src, dst, 0);
+    frame = packet_add_frame(packet, &frame_header, frame_payload);
+    sng_free(frame_payload);
+
+    // Payload points to the end of the fake frame
+    packet_set_type(packet, (type <= PACKET_SIP_WSS) ? type : PACKET_SIP_UDP);
+    packet_set_payload(packet, frame->data + frame->header->caplen - payload_len, payload_len);
+    packet_set_time(packet, ts);
+    packet->probe = true;
+    return packet;
+}
+
+int
+capture_probe_receive(capture_info_t *capinfo, capture_eep_client_t *client,
+                      const u_char *data, uint32_t len)
+{
+    char password[256];
+    const char *expected;
+    capture_probe_buf_t buf;
+    packet_t *packet;
+    address_t none;
+
+    switch (capture_probe_open(&buf, data, len)) {
+        case CAPTURE_PROBE_HELLO:
+            if (capture_probe_get8(&buf) != CAPTURE_PROBE_VERSION)
+                return 1;
+            capture_probe_get_str(&buf, password, sizeof(password));
+            if (buf.error)
+                return 1;
+            // Validate password
+            if ((expected = capture_eep_listen_password()) && strcmp(password, expected) != 0)
+                return 1;
+            client->probe = true;
+            return 0;
+        case CAPTURE_PROBE_MSG:
+            if (!client->probe)
+                return 1;
+            if (!(packet = capture_probe_receive_msg(&buf))) {
+                __atomic_add_fetch(&capinfo->rejected, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+            break;
+        case CAPTURE_PROBE_STREAM:
+        case CAPTURE_PROBE_FRAMES:
+            if (!client->probe)
+                return 1;
+            // Applied to stored calls by the parser thread
+            memset(&none, 0, sizeof(address_t));
+            packet = packet_create(4, 0, none, none, 0);
+            packet_set_type(packet, PACKET_PROBE);
+            packet_set_payload(packet, (u_char *) data, len);
+            break;
+        default:
+            // Records from newer probes are ignored
+            return (client->probe) ? 0 : 1;
+    }
+
+    // Let the parser thread handle this packet
+    packet->source = capinfo;
+    capture_queue_packet(capinfo, packet);
+    return 0;
+}
+
+/**
+ * @brief Update the counters of a stream with the ones sent by a probe
+ *
+ * Streams are created from SDP of stored summaries. Streams not found
+ * are created as the probe did, from the media of other stream.
+ */
+static void
+capture_probe_apply_stream(capture_probe_buf_t *buf)
+{
+    char callid[SIP_CALLID_MAXLEN];
+    rtp_stream_t *stream, counters;
+    rtp_stats_t *stats = &counters.rtpinfo.stats;
+    sip_call_t *call;
+
+    memset(&counters, 0, sizeof(rtp_stream_t));
+    capture_probe_get_str(buf, callid, sizeof(callid));
+    counters.type = capture_probe_get8(buf);
+    counters.src = capture_probe_get_addr(buf);
+    counters.dst = capture_probe_get_addr(buf);
+    counters.pktcnt = capture_probe_get32(buf);
+    counters.time = capture_probe_get64(buf);
+    counters.lasttm = capture_probe_get32(buf);
+    if (counters.type == PACKET_RTP) {
+        counters.rtpinfo.fmtcode = capture_probe_get32(buf);
+        stats->base_seq = capture_probe_get16(buf);
+        stats->max_seq = capture_probe_get16(buf);
+        stats->cycles = capture_probe_get32(buf);
+        stats->out_of_order = capture_probe_get32(buf);
+        stats->clock = capture_probe_get32(buf);
+        stats->transit = capture_probe_get32(buf);
+        stats->jitter = capture_probe_get32(buf);
+        stats->max_delta = capture_probe_get32(buf);
+        stats->last_time = capture_probe_get64(buf);
+        stats->bytes = capture_probe_get64(buf);
+    } else {
+        counters.rtcpinfo.spc = capture_probe_get32(buf);
+        counters.rtcpinfo.flost = capture_probe_get8(buf);
+        counters.rtcpinfo.fdiscard = capture_probe_get8(buf);
+        counters.rtcpinfo.mosl = capture_probe_get8(buf);
+        counters.rtcpinfo.mosc = capture_probe_get8(buf);
+    }
+    if (buf->error || !(call = sip_find_by_callid(callid)))
+        return;
+
+    if (!(stream = rtp_find_call_exact_stream(call, counters.src, counters.dst))) {
+        // Use a stream to this destination or from the opposite direction
+        if (!(stream = call_find_stream(call, counters.dst))
+            && !(stream = call_find_stream(call, counters.src)))
+            return;
+        if (!stream_is_complete(stream) && stream->type == counters.type
+            && addressport_equals(stream->dst, counters.dst)) {
+            stream_complete(stream, counters.src);
+        } else {
+            stream = stream_create(stream->media, counters.dst, counters.type);
+            stream_complete(stream, counters.src);
+            call_add_stream(call, stream);
+        }
+    }
+
+    stream->pktcnt = counters.pktcnt;
+    stream->time = counters.time;
+    stream->lasttm = counters.lasttm;
+    if (stream->type == PACKET_RTP) {
+        stream->rtpinfo = counters.rtpinfo;
+    } else {
+        stream->rtcpinfo = counters.rtcpinfo;
+    }
+
+    // Cached call attributes must be calculated again
+    call_updated(call);
+}
+
+/**
+ * @brief Replace the summary of a stored message with its captured frames
+ */
+static void
+capture_probe_apply_frames(capture_probe_buf_t *buf)
+{
+    char callid[SIP_CALLID_MAXLEN];
+    struct pcap_pkthdr header;
+    address_t src, dst;
+    const u_char *payload, *fdata;
+    uint32_t payload_len;
+    uint64_t ts;
+    int count, i;
+    sip_call_t *call;
+    sip_msg_t *msg;
+    packet_t *data;
+    frame_t *frame = NULL;
+    vector_iter_t it;
+
+    capture_probe_get_str(buf, callid, sizeof(callid));
+    ts = capture_probe_get64(buf);
+    src = capture_probe_get_addr(buf);
+    dst = capture_probe_get_addr(buf);
+    count = capture_probe_get16(buf);
+    if (buf->error || !(call = sip_find_by_callid(callid)))
+        return;
+
+    // Find the summary of this message
+    it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it))) {
+        if (msg->packet->probe && packet_time_ns(msg->packet) == ts
+            && addressport_equals(msg->packet->src, src) && addressport_equals(msg->packet->dst, dst))
+            break;
+    }
+    if (!msg)
+        return;
+
+    data = packet_create(msg->packet->ip_version, msg->packet->proto, src, dst, 0);
+    packet_set_type(data, msg->packet->type);
+    for (i = 0; i < count; i++) {
+        memset(&header, 0, sizeof(struct pcap_pkthdr));
+        header.ts.tv_sec = capture_probe_get32(buf);
+        header.ts.tv_usec = capture_probe_get32(buf);
+        header.caplen = capture_probe_get32(buf);
+        header.len = capture_probe_get32(buf);
+        if (!(fdata = capture_probe_get(buf, header.caplen)))
+            break;
+        frame = packet_add_frame(data, &header, fdata);
+    }
+    payload_len = capture_probe_get32(buf);
+    payload = capture_probe_get(buf, payload_len);
+    if (buf->error || !frame) {
+        packet_destroy(data);
+        return;
+    }
+
+    // Payload is usually the end of the last frame
+    if (frame->header->caplen >= payload_len
+        && !memcmp(frame->data + frame->header->caplen - payload_len, payload, payload_len)) {
+        packet_set_payload(data, frame->data + frame->header->caplen - payload_len, payload_len);
+    } else {
+        packet_set_payload(data, (u_char *) payload, payload_len);
+    }
+    packet_set_time(data, ts);
+
+    if (sip_msg_set_data(msg, data) != 0)
+        packet_destroy(data);
+}
+
+int
+capture_probe_apply(packet_t *packet)
+{
+    capture_probe_buf_t buf;
+
+    switch (capture_probe_open(&buf, packet_payload(packet), packet_payloadlen(packet))) {
+        case CAPTURE_PROBE_STREAM:
+            capture_probe_apply_stream(&buf);
+            break;
+        case CAPTURE_PROBE_FRAMES:
+            capture_probe_apply_frames(&buf);
+            break;
+    }
+    return 1;
+}
+
+void
+capture_probe_fetch(sip_call_t *call)
+{
+    u_char data[CAPTURE_PROBE_MAXLEN];
+    capture_probe_buf_t buf;
+    uint64_t since = UINT64_MAX;
+    sip_msg_t *msg;
+    uint32_t len;
+
+    // Only frames of messages stored as summaries are requested
+    if (capture_storage() != CAPTURE_STORAGE_NONE) {
+        vector_iter_t it = vector_iterator(call->msgs);
+        while ((msg = vector_iterator_next(&it))) {
+            if (msg->packet->probe && msg_get_time_ns(msg) < since)
+                since = msg_get_time_ns(msg);
+        }
+    }
+
+    capture_probe_begin(&buf, data, CAPTURE_PROBE_FETCH);
+    capture_probe_put_str(&buf, call->callid);
+    capture_probe_put64(&buf, since);
+    if ((len = capture_probe_end(&buf)))
+        capture_eep_fetch(data, len);
+}
@@ -0,0 +1,181 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_probe.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to exchange parsed records between sngrep instances
+ *
+ * In probe mode, sngrep parses its own captures and sends parsed records
+ * instead of raw packets through the HEP stream connection (eep.send.proto
+ * tcp), sharing its batching, compression and reconnection.
+ *
+ * Each message is sent as a summary: its addresses, timestamp and a SIP
+ * payload with only the start line, the headers sngrep parses and the SDP
+ * lines describing media. RTP streams are sent as counters when their
+ * call finishes. The collector stores summaries as any other message.
+ *
+ * Captured frames are kept by the probe and only sent when the collector
+ * requests them, after an operator opens the call. Received frames and
+ * payload replace the stored summary.
+ *
+ * Records share HEPv3 framing: a 4 bytes id ("SNGP" instead of "HEP3")
+ * followed by the record length, so both can be sent on the same stream.
+ *
+ */
+#ifndef __SNGREP_CAPTURE_PROBE_H
+#define __SNGREP_CAPTURE_PROBE_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "capture.h"
+#include "capture_eep.h"
+#include "sip.h"
+
+//! Record id, placed where HEPv3 packets have "HEP3"
+#define CAPTURE_PROBE_ID "SNGP"
+//! Probe protocol version sent in hello records
+#define CAPTURE_PROBE_VERSION 1
+//! Max record length (stream framing uses 16 bits lengths)
+#define CAPTURE_PROBE_MAXLEN 65535
+
+//! Record types
+enum capture_probe_type
+{
+    //! Probe authentication, first record of each connection
+    CAPTURE_PROBE_HELLO = 1,
+    //! Message summary
+    CAPTURE_PROBE_MSG,
+    //! RTP or RTCP stream counters
+    CAPTURE_PROBE_STREAM,
+    //! Collector request for call frames (collector to probe)
+    CAPTURE_PROBE_FETCH,
+    //! Captured frames and payload of a message
+    CAPTURE_PROBE_FRAMES,
+};
+
+//! Shorter declaration of capture_probe_hdr structure
+typedef struct capture_probe_hdr capture_probe_hdr_t;
+
+/**
+ * @brief Header of each record
+ *
+ * The first fields have the same layout than hep_ctrl_t. All record
+ * fields are encoded in network byte order.
+ */
+struct capture_probe_hdr
+{
+    //! Record id (CAPTURE_PROBE_ID)
+    char id[4];
+    //! Record length, including this header
+    uint16_t length;
+    //! Record type @see capture_probe_type
+    uint8_t type;
+    //! Reserved for future use
+    uint8_t flags;
+}__attribute__((packed));
+
+/**
+ * @brief Encode the hello record sent after each connection
+ *
+ * @param buffer Output buffer of CAPTURE_PROBE_MAXLEN bytes
+ * @param password Password to authenticate in the collector or NULL
+ * @return record length or 0 on error
+ */
+uint32_t
+capture_probe_hello(u_char *buffer, const char *password);
+
+/**
+ * @brief Send the summary of a parsed message
+ *
+ * Called by the thread storing the message while its call is locked.
+ *
+ * @param msg Stored message
+ * @param payload Message payload
+ * @param scan Headers positions in payload
+ */
+void
+capture_probe_msg(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan);
+
+/**
+ * @brief Send the counters of all streams of a call
+ *
+ * Called by the thread storing the call packets while it is locked.
+ *
+ * @param call Finished call
+ */
+void
+capture_probe_call(sip_call_t *call);
+
+/**
+ * @brief Answer a request record received from the collector
+ *
+ * Called from the HEP sender thread, records are written directly to the
+ * stream connection.
+ *
+ * @param data Request record
+ * @param len Request record length
+ */
+void
+capture_probe_request(const u_char *data, uint32_t len);
+
+/**
+ * @brief Handle a record received from a probe connection
+ *
+ * Connections must start with a valid hello record. Summaries are queued
+ * as SIP packets. Stream counters and frames are queued as probe packets,
+ * applied to their call by the parser thread.
+ *
+ * @param capinfo Listener capture source
+ * @param client Probe connection
+ * @param data Received record
+ * @param len Received record length
+ * @return 0 if connection must be kept open, 1 otherwise
+ */
+int
+capture_probe_receive(capture_info_t *capinfo, capture_eep_client_t *client,
+                      const u_char *data, uint32_t len);
+
+/**
+ * @brief Apply stream counters or frames of a probe packet to its call
+ *
+ * Called by the parser thread while capture is locked.
+ *
+ * @param packet Packet of type PACKET_PROBE
+ * @return 1, the packet is never stored
+ */
+int
+capture_probe_apply(packet_t *packet);
+
+/**
+ * @brief Request frames of messages received from probes
+ *
+ * All probes connected to the collector are requested for the frames of
+ * the call messages that only have a summary, and their stream counters.
+ *
+ * @param call Call opened by the operator
+ */
+void
+capture_probe_fetch(sip_call_t *call);
+
+#endif /* __SNGREP_CAPTURE_PROBE_H */
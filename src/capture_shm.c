@@ -0,0 +1,388 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_shm.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_shm.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "capture_shm.h"
+#include "setting.h"
+#include "util.h"
+
+//! Records are aligned to 8 bytes
+#define CAPTURE_SHM_ALIGN(len) (((len) + 7) & ~((uint64_t) 7))
+
+/**
+ * @brief Build the shared memory object name of a ring
+ */
+static void
+capture_shm_name(capture_shm_t *shm, const char *name)
+{
+    snprintf(shm->name, sizeof(shm->name), "%s%s", CAPTURE_SHM_PREFIX,
+             (name && strlen(name)) ? name : CAPTURE_SHM_DEFAULT);
+}
+
+/**
+ * @brief Create the shared memory object of a ring
+ *
+ * Objects left by a daemon that is no longer running are replaced.
+ *
+ * @return object file descriptor or -1 on failure
+ */
+static int
+capture_shm_open(capture_shm_t *shm)
+{
+    capture_shm_header_t hdr;
+    int fd;
+
+    if ((fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0 || errno != EEXIST)
+        return fd;
+
+    // Check if the daemon that created the object is still running
+    if ((fd = shm_open(shm->name, O_RDONLY, 0)) >= 0) {
+        if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == CAPTURE_SHM_MAGIC
+            && !hdr.closed && kill(hdr.pid, 0) == 0) {
+            close(fd);
+            errno = EEXIST;
+            return -1;
+        }
+        close(fd);
+    }
+
+    shm_unlink(shm->name);
+    return shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+}
+
+capture_shm_t *
+capture_shm_create(const char *name, int link)
+{
+    capture_shm_t *shm;
+    uint64_t size = (uint64_t) setting_get_intvalue(SETTING_CAPTURE_SHM_SIZE) * 1024 * 1024;
+    int fd;
+
+    if (size < CAPTURE_SHM_MINSIZE)
+        size = CAPTURE_SHM_MINSIZE;
+
+    if (!(shm = sng_malloc(sizeof(capture_shm_t))))
+        return NULL;
+    capture_shm_name(shm, name);
+    pthread_mutex_init(&shm->lock, NULL);
+
+    if ((fd = capture_shm_open(shm)) == -1) {
+        fprintf(stderr, "Couldn't create shared memory %s: %s\n", shm->name, strerror(errno));
+        sng_free(shm);
+        return NULL;
+    }
+
+    shm->maplen = CAPTURE_SHM_HDRLEN + size;
+    if (ftruncate(fd, shm->maplen) == -1
+        || (shm->map = mmap(NULL, shm->maplen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map shared memory %s: %s\n", shm->name, strerror(errno));
+        close(fd);
+        shm_unlink(shm->name);
+        sng_free(shm);
+        return NULL;
+    }
+    close(fd);
+
+    shm->owner = true;
+    shm->hdr = (capture_shm_header_t *) shm->map;
+    shm->ring = shm->map + CAPTURE_SHM_HDRLEN;
+    shm->hdr->size = size;
+    shm->hdr->link = link;
+    shm->hdr->pid = getpid();
+    // Clients only read the ring once its layout is complete
+    __atomic_store_n(&shm->hdr->magic, CAPTURE_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+void
+capture_shm_publish(capture_shm_t *shm, capture_info_t *capinfo,
+                    const struct pcap_pkthdr *header, const u_char *packet)
+{
+    capture_shm_header_t *hdr = shm->hdr;
+    capture_shm_record_t rec;
+    uint64_t head, off, room;
+
+    // Clients would not parse bigger frames
+    if (header->caplen > MAX_CAPTURE_LEN)
+        return;
+
+    rec.len = CAPTURE_SHM_ALIGN(sizeof(rec) + header->caplen);
+    rec.caplen = header->caplen;
+    rec.wirelen = header->len;
+    rec.link = capinfo->link;
+    rec.ts = (uint64_t) header->ts.tv_sec * 1000000000
+             + (capinfo->nsec ? header->ts.tv_usec : (uint64_t) header->ts.tv_usec * 1000);
+
+    pthread_mutex_lock(&shm->lock);
+    head = hdr->commit;
+    off = head % hdr->size;
+    room = hdr->size - off;
+
+    // Records never wrap, continue at the beginning of the ring
+    if (room < rec.len) {
+        __atomic_store_n(&hdr->reserve, head + room + rec.len, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (room >= sizeof(rec))
+            ((capture_shm_record_t *) (shm->ring + off))->len = 0;
+        head += room;
+        off = 0;
+    } else {
+        __atomic_store_n(&hdr->reserve, head + rec.len, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    rec.frame = hdr->frames;
+    memcpy(shm->ring + off, &rec, sizeof(rec));
+    memcpy(shm->ring + off + sizeof(rec), packet, header->caplen);
+    __atomic_store_n(&hdr->frames, rec.frame + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hdr->commit, head + rec.len, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&shm->lock);
+}
+
+void
+capture_shm_destroy(capture_shm_t *shm)
+{
+    if (!shm)
+        return;
+
+    __atomic_store_n(&shm->hdr->closed, 1, __ATOMIC_RELEASE);
+    shm_unlink(shm->name);
+    munmap(shm->map, shm->maplen);
+    pthread_mutex_destroy(&shm->lock);
+    sng_free(shm);
+}
+
+int
+capture_shm_attach(const char *name)
+{
+    capture_info_t *capinfo;
+    capture_shm_t *shm;
+    struct stat st;
+    int fd;
+
+    // Create a new structure to handle this capture source
+    if (!(capinfo = sng_malloc(sizeof(capture_info_t)))
+        || !(shm = sng_malloc(sizeof(capture_shm_t)))) {
+        fprintf(stderr, "Can't allocate memory for capture data!\n");
+        return 1;
+    }
+    capinfo->shm = shm;
+    capture_shm_name(shm, name);
+
+    if ((fd = shm_open(shm->name, O_RDONLY, 0)) == -1) {
+        fprintf(stderr, "Couldn't attach to capture daemon %s: %s\n", shm->name, strerror(errno));
+        capture_shm_close(capinfo);
+        return 1;
+    }
+
+    // Clients can only read the ring
+    if (fstat(fd, &st) == -1 || st.st_size < CAPTURE_SHM_HDRLEN + CAPTURE_SHM_MINSIZE
+        || (shm->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map capture daemon %s\n", shm->name);
+        shm->map = NULL;
+        close(fd);
+        capture_shm_close(capinfo);
+        return 1;
+    }
+    close(fd);
+    shm->maplen = st.st_size;
+    shm->hdr = (capture_shm_header_t *) shm->map;
+    shm->ring = shm->map + CAPTURE_SHM_HDRLEN;
+
+    if (__atomic_load_n(&shm->hdr->magic, __ATOMIC_ACQUIRE) != CAPTURE_SHM_MAGIC
+        || shm->hdr->size != shm->maplen - CAPTURE_SHM_HDRLEN) {
+        fprintf(stderr, "Invalid capture daemon shared memory %s\n", shm->name);
+        capture_shm_close(capinfo);
+        return 1;
+    }
+
+    // Start reading from newest frames
+    shm->pos = __atomic_load_n(&shm->hdr->commit, __ATOMIC_ACQUIRE);
+    shm->frame = __atomic_load_n(&shm->hdr->frames, __ATOMIC_RELAXED);
+
+    // Frames are read from memory, only used for compiling filters
+    capinfo->handle = pcap_open_dead(shm->hdr->link, MAXIMUM_SNAPLEN);
+    capinfo->link = shm->hdr->link;
+    if ((capinfo->link_hl = datalink_size(capinfo->link)) == -1) {
+        fprintf(stderr, "Unable to handle linktype %d\n", capinfo->link);
+        capture_shm_close(capinfo);
+        return 3;
+    }
+
+    // Set capture thread function
+    capinfo->capture_fn = capture_shm_thread;
+
+    // Source is named after its ring
+    capinfo->device = shm->name + 1;
+    capinfo->ispcap = false;
+    // Records keep nanosecond timestamps
+    capinfo->nsec = true;
+
+    // Create Vectors for IP and TCP reassembly
+    capinfo->tcp_reasm = capture_tcp_reasm_create();
+    capinfo->ip_reasm = capture_ip_reasm_create();
+
+    // Add this capture information as packet source
+    capture_add_source(capinfo);
+
+    return 0;
+}
+
+/**
+ * @brief Copy next pending frame of the ring
+ *
+ * Frames overwritten while they were being copied are discarded and
+ * reading continues from the newest frame.
+ *
+ * @return 1 if a frame has been copied, 0 if there are no pending frames
+ */
+static int
+capture_shm_read(capture_shm_t *shm, struct pcap_pkthdr *header, int *link)
+{
+    capture_shm_header_t *hdr = shm->hdr;
+    capture_shm_record_t rec;
+    uint64_t commit, reserve, off;
+
+    while ((commit = __atomic_load_n(&hdr->commit, __ATOMIC_ACQUIRE)) != shm->pos) {
+        // Daemon has overwritten all pending frames
+        if (commit - shm->pos > hdr->size) {
+            shm->pos = commit;
+            continue;
+        }
+
+        off = shm->pos % hdr->size;
+        if (hdr->size - off < sizeof(rec)) {
+            shm->pos += hdr->size - off;
+            continue;
+        }
+
+        memcpy(&rec, shm->ring + off, sizeof(rec));
+        if (rec.len >= sizeof(rec) && rec.len <= hdr->size - off && rec.caplen <= MAX_CAPTURE_LEN)
+            memcpy(shm->data, shm->ring + off + sizeof(rec), rec.caplen);
+
+        // Check that record was not overwritten while it was copied
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        reserve = __atomic_load_n(&hdr->reserve, __ATOMIC_RELAXED);
+        if (reserve - shm->pos > hdr->size) {
+            shm->pos = commit;
+            continue;
+        }
+
+        if (rec.len == 0) {
+            shm->pos += hdr->size - off;
+            continue;
+        }
+
+        // Not overwritten but not a valid record, start again from newest frame
+        if (rec.len < sizeof(rec) || rec.len > hdr->size - off || rec.caplen > MAX_CAPTURE_LEN) {
+            shm->pos = commit;
+            continue;
+        }
+        shm->pos += rec.len;
+
+        // Account frames overwritten before being read
+        if (rec.frame > shm->frame)
+            shm->drops += rec.frame - shm->frame;
+        shm->frame = rec.frame + 1;
+
+        header->ts.tv_sec = rec.ts / 1000000000;
+        header->ts.tv_usec = rec.ts % 1000000000;
+        header->caplen = rec.caplen;
+        header->len = rec.wirelen;
+        *link = rec.link;
+        return 1;
+    }
+
+    return 0;
+}
+
+void *
+capture_shm_thread(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_shm_t *shm = capinfo->shm;
+    struct pcap_pkthdr header;
+    int link;
+
+    while (capinfo->running) {
+        if (!capture_shm_read(shm, &header, &link)) {
+            // Daemon has stopped
+            if (__atomic_load_n(&shm->hdr->closed, __ATOMIC_ACQUIRE))
+                break;
+            usleep(CAPTURE_SHM_WAIT);
+            continue;
+        }
+
+        // Daemon sources may have different datalinks
+        if (link != capinfo->link) {
+            if (datalink_size(link) == -1)
+                continue;
+            capinfo->link = link;
+            capinfo->link_hl = datalink_size(link);
+        }
+
+        // libpcap filter is not applied to frames read from memory
+        if (!capture_packet_filter(&header, shm->data))
+            continue;
+
+        parse_packet((u_char *) capinfo, &header, shm->data);
+    }
+
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
+    return NULL;
+}
+
+uint64_t
+capture_shm_drops(capture_info_t *capinfo)
+{
+    return capinfo->shm->drops;
+}
+
+void
+capture_shm_close(capture_info_t *capinfo)
+{
+    capture_shm_t *shm = capinfo->shm;
+
+    if (!shm)
+        return;
+
+    if (shm->map)
+        munmap(shm->map, shm->maplen);
+
+    sng_free(shm);
+    capinfo->shm = NULL;
+}
@@ -0,0 +1,216 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_shm.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to share captured frames between sngrep processes
+ *
+ * A daemon process (--daemon) captures from its sources and publishes
+ * all frames in a shared memory ring without parsing them. Any number
+ * of processes can attach to the ring (--attach) as a capture source,
+ * mapping it read-only, so kernel capture and filtering is done once
+ * while each client keeps its own dialogs, filters and interface.
+ *
+ * Frames are stored as variable length records. The daemon reserves
+ * ring space before overwriting it and commits it after, so readers
+ * detect records overwritten while being copied like a seqlock. Slow
+ * readers lose the overwritten frames and continue with the newest
+ * ones, never blocking the daemon.
+ *
+ */
+#ifndef __SNGREP_CAPTURE_SHM_H
+#define __SNGREP_CAPTURE_SHM_H
+
+#include "config.h"
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include "capture.h"
+
+//! Shared ring layout identifier
+#define CAPTURE_SHM_MAGIC   0x53484d31
+//! Shared memory object name prefix
+#define CAPTURE_SHM_PREFIX  "/sngrep-"
+//! Shared memory object name used when none is given
+#define CAPTURE_SHM_DEFAULT "default"
+//! Ring header length, records start in the next page
+#define CAPTURE_SHM_HDRLEN  4096
+//! Min ring size in bytes
+#define CAPTURE_SHM_MINSIZE (1024 * 1024)
+//! Microseconds clients wait when no frames are pending
+#define CAPTURE_SHM_WAIT    1000
+
+//! Shorter declaration of capture_shm structure
+typedef struct capture_shm capture_shm_t;
+//! Shorter declaration of capture_shm_header structure
+typedef struct capture_shm_header capture_shm_header_t;
+//! Shorter declaration of capture_shm_record structure
+typedef struct capture_shm_record capture_shm_record_t;
+
+/**
+ * @brief Shared ring header, placed in the first page of the object
+ *
+ * Positions are byte offsets since the ring was created, so they never
+ * wrap and readers can compare them with their own position.
+ */
+struct capture_shm_header
+{
+    //! Ring layout identifier (CAPTURE_SHM_MAGIC)
+    uint32_t magic;
+    //! Daemon has stopped publishing frames
+    uint32_t closed;
+    //! Daemon process id
+    int32_t pid;
+    //! Ring size in bytes (not including this header)
+    uint64_t size;
+    //! Datalink of the first daemon capture source
+    int32_t link;
+    //! End position of the record being written
+    uint64_t reserve;
+    //! End position of the last written record
+    uint64_t commit;
+    //! Number of published frames
+    uint64_t frames;
+};
+
+/**
+ * @brief Record of a published frame, followed by frame data
+ *
+ * Records are 8 bytes aligned and never wrap. A record with zero length
+ * marks that the next record starts at the beginning of the ring.
+ */
+struct capture_shm_record
+{
+    //! Record length including this header (0 for wrap mark)
+    uint32_t len;
+    //! Captured frame length
+    uint32_t caplen;
+    //! Frame length on the wire
+    uint32_t wirelen;
+    //! Frame datalink
+    int32_t link;
+    //! Frame time in nanoseconds
+    uint64_t ts;
+    //! Frame sequence number
+    uint64_t frame;
+};
+
+/**
+ * @brief Mapped shared ring of a daemon or a client
+ */
+struct capture_shm
+{
+    //! Shared memory object name
+    char name[NAME_MAX];
+    //! Mapped object (header page followed by ring)
+    uint8_t *map;
+    //! Mapped object size
+    size_t maplen;
+    //! Ring header
+    capture_shm_header_t *hdr;
+    //! Ring records
+    uint8_t *ring;
+    //! This process created the object (and publishes frames)
+    bool owner;
+    //! Lock for publishing frames from several capture threads
+    pthread_mutex_t lock;
+    //! Next record position to be read (clients only)
+    uint64_t pos;
+    //! Next expected frame sequence (clients only)
+    uint64_t frame;
+    //! Frames overwritten before being read (clients only)
+    uint64_t drops;
+    //! Copy of the frame being read (clients only)
+    u_char data[MAX_CAPTURE_LEN];
+};
+
+/**
+ * @brief Create a shared ring and publish all captured frames in it
+ *
+ * Captured frames are no longer parsed by this process.
+ *
+ * @param name Ring name (NULL for default)
+ * @param link Datalink of the first capture source
+ * @return Created ring or NULL on failure
+ */
+capture_shm_t *
+capture_shm_create(const char *name, int link);
+
+/**
+ * @brief Copy a captured frame into the shared ring
+ *
+ * This function can be invoked from several capture threads.
+ *
+ * @param shm Ring created by this process
+ * @param capinfo Capture source of the frame
+ * @param header Frame header
+ * @param packet Frame data
+ */
+void
+capture_shm_publish(capture_shm_t *shm, capture_info_t *capinfo,
+                    const struct pcap_pkthdr *header, const u_char *packet);
+
+/**
+ * @brief Mark the ring as closed and remove it
+ *
+ * Attached clients keep their mapping until they stop.
+ */
+void
+capture_shm_destroy(capture_shm_t *shm);
+
+/**
+ * @brief Attach to a daemon shared ring as a capture source
+ *
+ * Only frames published after attaching are read.
+ *
+ * @param name Ring name (NULL for default)
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_shm_attach(const char *name);
+
+/**
+ * @brief Capture thread function for attached rings
+ *
+ * @param info Capture source information
+ */
+void *
+capture_shm_thread(void *info);
+
+/**
+ * @brief Get frames lost because the daemon overwrote them
+ *
+ * @param capinfo Capture source information
+ */
+uint64_t
+capture_shm_drops(capture_info_t *capinfo);
+
+/**
+ * @brief Unmap an attached ring
+ *
+ * @param capinfo Capture source information
+ */
+void
+capture_shm_close(capture_info_t *capinfo);
+
+#endif /* __SNGREP_CAPTURE_SHM_H */
@@ -0,0 +1,313 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tpacket.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in capture_tpacket.h
+ *
+ */
+#include "config.h"
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include "capture_tpacket.h"
+#include "setting.h"
+#include "util.h"
+
+//! Frame size used to compute ring frame count (not used by TPACKET_V3 blocks)
+#define TPACKET_FRAME_SIZE  2048
+//! Time in milliseconds before the kernel retires a non-full block
+#define TPACKET_BLOCK_TOV   60
+//! Next frame in a ring block
+#define TPACKET_NEXT_FRAME(f) ((struct tpacket3_hdr *) ((uint8_t *) (f) + (f)->tp_next_offset))
+
+static int
+capture_tpacket_open(capture_info_t *capinfo, const char *dev, int fanout_id)
+{
+    capture_tpacket_t *tp = capinfo->tpacket;
+    int version = TPACKET_V3;
+    struct sockaddr_ll ll;
+    struct packet_mreq mreq;
+    unsigned int i;
+
+    // Create a cooked socket, frames will start at network header
+    if ((tp->sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL))) == -1) {
+        fprintf(stderr, "Couldn't create packet socket: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (setsockopt(tp->sock, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1) {
+        fprintf(stderr, "Error setting TPACKET_V3 on %s: %s\n", dev, strerror(errno));
+        return 1;
+    }
+
+    // Configure ring memory
+    memset(&tp->req, 0, sizeof(tp->req));
+    tp->req.tp_block_size = setting_get_intvalue(SETTING_CAPTURE_TPACKET_BLOCKSIZE) * 1024;
+    tp->req.tp_block_nr = setting_get_intvalue(SETTING_CAPTURE_TPACKET_BLOCKS);
+    tp->req.tp_frame_size = TPACKET_FRAME_SIZE;
+    tp->req.tp_frame_nr = (tp->req.tp_block_size * tp->req.tp_block_nr) / tp->req.tp_frame_size;
+    tp->req.tp_retire_blk_tov = TPACKET_BLOCK_TOV;
+    tp->req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+    if (setsockopt(tp->sock, SOL_PACKET, PACKET_RX_RING, &tp->req, sizeof(tp->req)) == -1) {
+        fprintf(stderr, "Error setting capture ring on %s: %s\n", dev, strerror(errno));
+        return 1;
+    }
+
+    tp->map = mmap(NULL, tp->req.tp_block_size * tp->req.tp_block_nr,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, tp->sock, 0);
+    if (tp->map == MAP_FAILED) {
+        tp->map = NULL;
+        fprintf(stderr, "Error mapping capture ring on %s: %s\n", dev, strerror(errno));
+        return 1;
+    }
+
+    tp->blocks = sng_malloc(tp->req.tp_block_nr * sizeof(struct iovec));
+    for (i = 0; i < tp->req.tp_block_nr; i++) {
+        tp->blocks[i].iov_base = tp->map + (i * tp->req.tp_block_size);
+        tp->blocks[i].iov_len = tp->req.tp_block_size;
+    }
+
+    // Bind to requested device (all devices for "any")
+    memset(&ll, 0, sizeof(ll));
+    ll.sll_family = AF_PACKET;
+    ll.sll_protocol = htons(ETH_P_ALL);
+    ll.sll_ifindex = (strcmp(dev, "any") == 0) ? 0 : if_nametoindex(dev);
+    if (strcmp(dev, "any") != 0 && ll.sll_ifindex == 0) {
+        fprintf(stderr, "Couldn't open device %s: %s\n", dev, strerror(errno));
+        return 1;
+    }
+
+    if (bind(tp->sock, (struct sockaddr *) &ll, sizeof(ll)) == -1) {
+        fprintf(stderr, "Couldn't bind device %s: %s\n", dev, strerror(errno));
+        return 1;
+    }
+
+    // Enable promiscuous mode
+    if (ll.sll_ifindex) {
+        memset(&mreq, 0, sizeof(mreq));
+        mreq.mr_ifindex = ll.sll_ifindex;
+        mreq.mr_type = PACKET_MR_PROMISC;
+        if (setsockopt(tp->sock, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+            fprintf(stderr, "Error setting promiscuous mode on %s: %s\n", dev, strerror(errno));
+            return 1;
+        }
+    }
+
+    // Share device traffic between all capture threads
+    // Flows are hashed so all packets of a dialog reach the same thread,
+    // and IP fragments are reassembled by the kernel before hashing
+    if (fanout_id >= 0) {
+        int fanout = (fanout_id & 0xFFFF) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(tp->sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1) {
+            fprintf(stderr, "Error joining fanout group on %s: %s\n", dev, strerror(errno));
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int
+capture_tpacket_online(const char *dev)
+{
+    capture_info_t *capinfo;
+    //! Error string
+    char errbuf[PCAP_ERRBUF_SIZE];
+    int threads = setting_get_intvalue(SETTING_CAPTURE_TPACKET_THREADS);
+    int fanout_id = -1;
+    int i;
+
+    // All rings of this device will use the same fanout group
+    if (threads > 1) {
+        fanout_id = (getpid() + capture_sources_count()) & 0xFFFF;
+    } else {
+        threads = 1;
+    }
+
+    for (i = 0; i < threads; i++) {
+        // Create a new structure to handle this capture source
+        if (!(capinfo = sng_malloc(sizeof(capture_info_t)))) {
+            fprintf(stderr, "Can't allocate memory for capture data!\n");
+            return 1;
+        }
+
+        if (!(capinfo->tpacket = sng_malloc(sizeof(capture_tpacket_t)))) {
+            fprintf(stderr, "Can't allocate memory for capture data!\n");
+            return 1;
+        }
+
+        // Try to find capture device information
+        if (pcap_lookupnet(dev, &capinfo->net, &capinfo->mask, errbuf) == -1) {
+            capinfo->net = 0;
+            capinfo->mask = 0;
+        }
+
+        // Open and map the ring
+        if (capture_tpacket_open(capinfo, dev, fanout_id) != 0) {
+            capture_tpacket_close(capinfo);
+            return 2;
+        }
+
+        // Frames are read without link layer, only used for compiling filters
+        capinfo->handle = pcap_open_dead(DLT_RAW, MAXIMUM_SNAPLEN);
+
+        // Set capture thread function
+        capinfo->capture_fn = capture_tpacket_thread;
+
+        // Store capture device
+        capinfo->device = dev;
+        capinfo->ispcap = false;
+        // Ring frames have nanosecond timestamps
+        capinfo->nsec = true;
+
+        // Get datalink to parse packets correctly
+        capinfo->link = pcap_datalink(capinfo->handle);
+        capinfo->link_hl = datalink_size(capinfo->link);
+
+        // Create Vectors for IP and TCP reassembly
+        capinfo->tcp_reasm = capture_tcp_reasm_create();
+        capinfo->ip_reasm = capture_ip_reasm_create();
+
+        // Add this capture information as packet source
+        capture_add_source(capinfo);
+    }
+
+    return 0;
+}
+
+static void
+capture_tpacket_parse_block(capture_info_t *capinfo, struct tpacket_block_desc *block)
+{
+    struct tpacket3_hdr *frame;
+    struct sockaddr_ll *sll;
+    struct pcap_pkthdr header;
+    uint32_t i;
+
+    frame = (struct tpacket3_hdr *) ((uint8_t *) block + block->hdr.bh1.offset_to_first_pkt);
+    for (i = 0; i < block->hdr.bh1.num_pkts; i++, frame = TPACKET_NEXT_FRAME(frame)) {
+        // Loopback frames are received twice (outgoing and incoming)
+        sll = (struct sockaddr_ll *) ((uint8_t *) frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        if (sll->sll_pkttype == PACKET_OUTGOING && sll->sll_hatype == ARPHRD_LOOPBACK)
+            continue;
+
+        // Build a pcap header for this frame
+        header.ts.tv_sec = frame->tp_sec;
+        header.ts.tv_usec = frame->tp_nsec;
+        header.caplen = frame->tp_snaplen;
+        header.len = frame->tp_len;
+
+        // Parse frame directly from ring memory
+        parse_packet((u_char *) capinfo, &header, (uint8_t *) frame + frame->tp_net);
+    }
+}
+
+void *
+capture_tpacket_thread(void *info)
+{
+    capture_info_t *capinfo = (capture_info_t *) info;
+    capture_tpacket_t *tp = capinfo->tpacket;
+    struct tpacket_block_desc *block;
+    struct pollfd pfd;
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = tp->sock;
+    pfd.events = POLLIN | POLLERR;
+
+    while (capinfo->running) {
+        // Install media ports filter built by parser thread
+        capture_filter_install(capinfo);
+
+        block = (struct tpacket_block_desc *) tp->blocks[tp->current].iov_base;
+
+        // Wait until kernel releases this block
+        if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
+            poll(&pfd, 1, 1000);
+            continue;
+        }
+
+        capture_tpacket_parse_block(capinfo, block);
+
+        // Return the block to the kernel
+        __sync_synchronize();
+        block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+        tp->current = (tp->current + 1) % tp->req.tp_block_nr;
+    }
+
+    // No more packets will be queued from this source
+    queue_close(capinfo->queue);
+    return NULL;
+}
+
+int
+capture_tpacket_set_filter(capture_info_t *capinfo, struct bpf_program *fp)
+{
+    struct sock_fprog prog;
+
+    prog.len = fp->bf_len;
+    prog.filter = (struct sock_filter *) fp->bf_insns;
+
+    if (setsockopt(capinfo->tpacket->sock, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) == -1)
+        return 1;
+
+    return 0;
+}
+
+uint64_t
+capture_tpacket_drops(capture_info_t *capinfo)
+{
+    capture_tpacket_t *tp = capinfo->tpacket;
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+
+    if (getsockopt(tp->sock, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+        tp->drops += st.tp_drops;
+
+    return tp->drops;
+}
+
+void
+capture_tpacket_close(capture_info_t *capinfo)
+{
+    capture_tpacket_t *tp = capinfo->tpacket;
+
+    if (!tp)
+        return;
+
+    if (tp->map)
+        munmap(tp->map, tp->req.tp_block_size * tp->req.tp_block_nr);
+
+    if (tp->sock > 0)
+        close(tp->sock);
+
+    sng_free(tp->blocks);
+    sng_free(tp);
+    capinfo->tpacket = NULL;
+}
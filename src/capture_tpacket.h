@@ -0,0 +1,118 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file capture_tpacket.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to capture packets using Linux AF_PACKET rings
+ *
+ * This file contains declaration of structure and functions to capture
+ * packets from a TPACKET_V3 memory mapped ring. Each ring is a capture
+ * source that hands its frames to the common parse_packet function.
+ *
+ * Multiple rings can be opened for the same device, sharing the traffic
+ * using PACKET_FANOUT, so several capture threads can read from one NIC.
+ *
+ */
+#ifndef __SNGREP_CAPTURE_TPACKET_H
+#define __SNGREP_CAPTURE_TPACKET_H
+
+#include <sys/uio.h>
+#include <linux/if_packet.h>
+#include "capture.h"
+
+//! Shorter declaration of capture_tpacket structure
+typedef struct capture_tpacket capture_tpacket_t;
+
+/**
+ * @brief TPACKET_V3 ring information of a capture source
+ */
+struct capture_tpacket
+{
+    //! AF_PACKET socket
+    int sock;
+    //! Ring configuration
+    struct tpacket_req3 req;
+    //! Memory mapped ring
+    uint8_t *map;
+    //! Ring blocks
+    struct iovec *blocks;
+    //! Next block to be read
+    unsigned int current;
+    //! Frames dropped by the kernel since the ring was opened
+    uint64_t drops;
+};
+
+/**
+ * @brief Online capture using AF_PACKET rings
+ *
+ * Create one capture source per configured capture thread. When more than
+ * one thread is configured, all rings join the same fanout group.
+ *
+ * @param dev Device to start capture from
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tpacket_online(const char *dev);
+
+/**
+ * @brief Capture thread function for AF_PACKET sources
+ *
+ * Read ring blocks as soon as the kernel releases them and parse all
+ * frames in them.
+ *
+ * @param info Capture source information
+ */
+void *
+capture_tpacket_thread(void *info);
+
+/**
+ * @brief Attach a compiled BPF filter to the ring socket
+ *
+ * @param capinfo Capture source information
+ * @param fp Compiled filter program
+ * @return 0 on success, 1 otherwise
+ */
+int
+capture_tpacket_set_filter(capture_info_t *capinfo, struct bpf_program *fp);
+
+/**
+ * @brief Get frames dropped by the kernel because the ring was full
+ *
+ * Kernel resets its counters each time they are read, so they are
+ * accumulated in the ring information.
+ *
+ * @param capinfo Capture source information
+ * @return Dropped frames since the ring was opened
+ */
+uint64_t
+capture_tpacket_drops(capture_info_t *capinfo);
+
+/**
+ * @brief Release ring memory and close the socket
+ *
+ * @param capinfo Capture source information
+ */
+void
+capture_tpacket_close(capture_info_t *capinfo);
+
+#endif /* __SNGREP_CAPTURE_TPACKET_H */
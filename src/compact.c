@@ -0,0 +1,331 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file compact.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in compact.h
+ *
+ * Rows are looked up by method and addresses in a hash table whose
+ * keys are stored in the row dialogs, so the table only needs to be
+ * updated when rows are created or removed.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "compact.h"
+#include "sip.h"
+#include "hash.h"
+#include "setting.h"
+#include "util.h"
+
+/**
+ * @brief Dialog compaction status
+ */
+static struct
+{
+    //! Dialogs are being compacted
+    bool enabled;
+    //! Methods whose dialogs are compacted
+    bool methods[COMPACT_METHODS];
+    //! Compaction rows by method and addresses (sip_call_t *)
+    htable_t *rows;
+    //! Dialogs folded into rows
+    uint64_t folded;
+} compact;
+
+static uint32_t
+compact_key_hash(const void *key)
+{
+    const sip_compact_key_t *ckey = key;
+    return address_hash(ckey->src, false) * 31 + address_hash(ckey->dst, false) + ckey->method;
+}
+
+static bool
+compact_key_equal(const void *key1, const void *key2)
+{
+    const sip_compact_key_t *ckey1 = key1, *ckey2 = key2;
+    return ckey1->method == ckey2->method
+           && address_equals(ckey1->src, ckey2->src)
+           && address_equals(ckey1->dst, ckey2->dst);
+}
+
+/**
+ * @brief Get the compaction key of a dialog
+ *
+ * @return false if dialog does not start with a compacted method
+ */
+static bool
+compact_call_key(sip_call_t *call, sip_compact_key_t *key)
+{
+    sip_msg_t *first = vector_first(call->msgs);
+
+    if (!first || !msg_is_request(first) || first->reqresp >= COMPACT_METHODS
+        || !compact.methods[first->reqresp])
+        return false;
+
+    memset(key, 0, sizeof(sip_compact_key_t));
+    key->method = first->reqresp;
+    key->src = first->packet->src;
+    key->dst = first->packet->dst;
+    key->src.port = key->dst.port = 0;
+    return true;
+}
+
+/**
+ * @brief Account the last transaction of a dialog in a row
+ */
+static void
+compact_row_add(sip_compact_t *row, sip_call_t *call)
+{
+    vector_iter_t it = vector_iterator(call->msgs);
+    sip_msg_t *msg, *request = NULL, *response = NULL;
+    struct timeval last = { 0 }, start, end;
+    int64_t rtt;
+    int i;
+
+    while ((msg = vector_iterator_next(&it))) {
+        if (msg_is_request(msg)) {
+            // Retransmissions do not restart the transaction
+            if (!msg->retrans) {
+                request = msg;
+                response = NULL;
+            }
+        } else if (msg->reqresp >= 200 && !response) {
+            response = msg;
+        }
+        last = msg_get_time(msg);
+    }
+
+    row->count++;
+    if (timercmp(&last, &row->last, >))
+        row->last = last;
+
+    if (!response) {
+        row->unanswered++;
+        return;
+    }
+
+    // Response codes histogram, codes are added in arrival order
+    for (i = 0; i < COMPACT_CODES; i++) {
+        if (!row->codes[i].code)
+            row->codes[i].code = response->reqresp;
+        if (row->codes[i].code == response->reqresp) {
+            row->codes[i].count++;
+            break;
+        }
+    }
+    if (i == COMPACT_CODES)
+        row->codes_other++;
+
+    if (request) {
+        start = msg_get_time(request);
+        end = msg_get_time(response);
+        rtt = (end.tv_sec - start.tv_sec) * (int64_t) 1000000 + (end.tv_usec - start.tv_usec);
+        if (rtt >= 0) {
+            row->rtt_count++;
+            row->rtt_sum += rtt;
+            if ((uint64_t) rtt < row->rtt_min)
+                row->rtt_min = rtt;
+            if ((uint64_t) rtt > row->rtt_max)
+                row->rtt_max = rtt;
+        }
+    }
+}
+
+int
+compact_init(const char *methods)
+{
+    char list[MAX_SETTING_LEN];
+    char *method, *saveptr = NULL;
+    int id;
+
+    memset(compact.methods, 0, sizeof(compact.methods));
+
+    // Empty settings are not set, compaction is disabled
+    if (!methods || !*methods)
+        return 0;
+
+    snprintf(list, sizeof(list), "%s", methods);
+    for (method = strtok_r(list, ", ", &saveptr); method; method = strtok_r(NULL, ", ", &saveptr)) {
+        id = sip_method_from_str(method);
+        // INVITE dialogs are never compacted
+        if (id <= 0 || id >= COMPACT_METHODS || id == SIP_METHOD_INVITE)
+            return 1;
+        compact.methods[id] = true;
+        compact.enabled = true;
+    }
+
+    if (compact.enabled && !(compact.rows = htable_create_custom(0, compact_key_hash, compact_key_equal))) {
+        compact.enabled = false;
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+compact_deinit()
+{
+    compact.enabled = false;
+    htable_destroy(compact.rows);
+    compact.rows = NULL;
+}
+
+bool
+compact_enabled()
+{
+    return compact.enabled;
+}
+
+bool
+compact_call_finished(sip_call_t *call, sip_msg_t *msg)
+{
+    sip_compact_key_t key;
+
+    if (!compact.enabled || call->compact || call->compact_done)
+        return false;
+
+    // Authentication challenges are followed by a new request
+    if (msg_is_request(msg) || msg->reqresp < 200 || msg->reqresp == 401 || msg->reqresp == 407)
+        return false;
+
+    if (!compact_call_key(call, &key))
+        return false;
+
+    call->compact_done = true;
+    return true;
+}
+
+int
+compact_call_aggregate(sip_call_t *call)
+{
+    sip_compact_t *row;
+    sip_compact_key_t key;
+
+    if (!compact_call_key(call, &key) || htable_find(compact.rows, &key))
+        return 1;
+
+    if (!(row = arena_alloc_tag(&call->arena, MEMSTAT_CALLS, sizeof(sip_compact_t))))
+        return 1;
+    row->key = key;
+    row->rtt_min = UINT64_MAX;
+
+    if (htable_insert(compact.rows, &row->key, call) != 0)
+        return 1;
+
+    // Row dialog is accounted as its first transaction
+    call->compact = row;
+    compact_row_add(row, call);
+    call_updated(call);
+    return 0;
+}
+
+sip_call_t *
+compact_call_row(sip_call_t *call)
+{
+    sip_compact_key_t key;
+
+    if (!compact.enabled || call->compact || !compact_call_key(call, &key))
+        return NULL;
+    return htable_find(compact.rows, &key);
+}
+
+void
+compact_call_remove(sip_call_t *call)
+{
+    sip_call_t *row;
+
+    if (!compact.enabled)
+        return;
+
+    if (call->compact) {
+        // New dialogs will create another row
+        if (htable_find(compact.rows, &call->compact->key) == call)
+            htable_remove(compact.rows, &call->compact->key);
+        return;
+    }
+
+    // Dialogs removed before finishing are accounted as unanswered
+    if ((row = compact_call_row(call))) {
+        compact_row_add(row->compact, call);
+        call_updated(row);
+        compact.folded++;
+    }
+}
+
+void
+compact_clear()
+{
+    if (!compact.enabled)
+        return;
+
+    htable_destroy(compact.rows);
+    compact.rows = htable_create_custom(0, compact_key_hash, compact_key_equal);
+    if (!compact.rows)
+        compact.enabled = false;
+}
+
+uint64_t
+compact_folded()
+{
+    return compact.folded;
+}
+
+const char *
+compact_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
+{
+    sip_compact_t *row = call->compact;
+    int i, len = 0;
+
+    value[0] = '\0';
+    if (!row)
+        return NULL;
+
+    switch (id) {
+        case SIP_ATTR_COMPACTED:
+            sprintf(value, "%" PRIu64, row->count);
+            break;
+        case SIP_ATTR_LASTSEEN:
+            timeval_to_time(row->last, value);
+            break;
+        case SIP_ATTR_RTT:
+            if (row->rtt_count)
+                sprintf(value, "%.1f", row->rtt_sum / (double) row->rtt_count / 1000);
+            break;
+        case SIP_ATTR_CODES:
+            for (i = 0; i < COMPACT_CODES && row->codes[i].code && len < SIP_ATTR_MAXLEN - 48; i++)
+                len += sprintf(value + len, "%s%d:%" PRIu64, len ? " " : "", row->codes[i].code, row->codes[i].count);
+            if (row->codes_other)
+                len += sprintf(value + len, "%s+:%" PRIu64, len ? " " : "", row->codes_other);
+            if (row->unanswered)
+                sprintf(value + len, "%s-:%" PRIu64, len ? " " : "", row->unanswered);
+            break;
+        default:
+            return NULL;
+    }
+
+    return strlen(value) ? value : NULL;
+}
@@ -0,0 +1,179 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file compact.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to compact keepalive dialogs
+ *
+ * Dialogs starting with a configured method (sip.compact), usually
+ * OPTIONS pings and REGISTER refreshes, are folded once their
+ * transaction has finished. The first finished dialog of each method,
+ * source and destination address is kept as compaction row, and the
+ * following ones are accounted in it and removed from storage, so the
+ * call list only grows with different peers.
+ *
+ */
+#ifndef __SNGREP_COMPACT_H
+#define __SNGREP_COMPACT_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "address.h"
+#include "sip_attr.h"
+#include "sip_call.h"
+
+//! Max method id that can be compacted
+#define COMPACT_METHODS 32
+//! Number of different response codes accounted in each row
+#define COMPACT_CODES 8
+
+//! Shorter declaration of sip_compact structure
+typedef struct sip_compact sip_compact_t;
+//! Shorter declaration of sip_compact_key structure
+typedef struct sip_compact_key sip_compact_key_t;
+
+/**
+ * @brief Method and addresses of dialogs compacted in the same row
+ */
+struct sip_compact_key
+{
+    //! First request method
+    int method;
+    //! First request source address (without port)
+    address_t src;
+    //! First request destination address (without port)
+    address_t dst;
+};
+
+/**
+ * @brief Accounted transactions of a compaction row
+ *
+ * Row information is allocated in the memory of the dialog used as row.
+ */
+struct sip_compact
+{
+    //! Method and addresses of compacted dialogs
+    sip_compact_key_t key;
+    //! Accounted transactions (including row dialog)
+    uint64_t count;
+    //! Accounted transactions without final response
+    uint64_t unanswered;
+    //! Time of the last accounted message
+    struct timeval last;
+    //! Final response codes and their count, in arrival order
+    struct {
+        int code;
+        uint64_t count;
+    } codes[COMPACT_CODES];
+    //! Final responses with codes not fitting codes table
+    uint64_t codes_other;
+    //! Transactions with measured round trip time
+    uint64_t rtt_count;
+    //! Round trip times from request to final response (microseconds)
+    uint64_t rtt_sum, rtt_min, rtt_max;
+};
+
+/**
+ * @brief Start compacting dialogs of the given methods
+ *
+ * @param methods Comma separated list of method names (NULL or empty to disable)
+ * @return 0 on success, 1 if any method is not valid
+ */
+int
+compact_init(const char *methods);
+
+/**
+ * @brief Stop compacting dialogs
+ */
+void
+compact_deinit();
+
+/**
+ * @brief Check if dialogs are being compacted
+ */
+bool
+compact_enabled();
+
+/**
+ * @brief Check if a message finishes the transaction of a compacted dialog
+ *
+ * Authentication challenges do not finish the dialog, as they are
+ * followed by a new request with the same Call-ID.
+ *
+ * @return true if the dialog can be folded
+ */
+bool
+compact_call_finished(sip_call_t *call, sip_msg_t *msg);
+
+/**
+ * @brief Use a finished dialog as compaction row if there is none yet
+ *
+ * This must be invoked with capture and calls lock taken.
+ *
+ * @return 0 if the dialog is now a compaction row, 1 if it must be folded
+ */
+int
+compact_call_aggregate(sip_call_t *call);
+
+/**
+ * @brief Get the compaction row where a finished dialog will be folded
+ *
+ * @return row dialog or NULL if there is none
+ */
+sip_call_t *
+compact_call_row(sip_call_t *call);
+
+/**
+ * @brief Account a dialog that is being removed in its compaction row
+ *
+ * Rows being removed are no longer used for new dialogs. This function
+ * is invoked with capture locked, or calls lock taken while rotating.
+ */
+void
+compact_call_remove(sip_call_t *call);
+
+/**
+ * @brief Forget all compaction rows
+ *
+ * Used when all calls are removed at once.
+ */
+void
+compact_clear();
+
+/**
+ * @brief Get the number of dialogs folded into compaction rows
+ */
+uint64_t
+compact_folded();
+
+/**
+ * @brief Format a compaction attribute of a row
+ *
+ * @return value or NULL if the dialog is not a row
+ */
+const char *
+compact_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value);
+
+#endif /* __SNGREP_COMPACT_H */
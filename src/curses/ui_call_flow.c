@@ -81,15 +81,165 @@ ui_t ui_call_flow = {
     .help = call_flow_help
 };
 
+/**
+ * @brief Hash function for arrows index
+ *
+ * Arrows are indexed by the address of their message or stream
+ */
+static uint32_t
+call_flow_arrow_index_hash(const void *key)
+{
+    uint64_t ptr = (uintptr_t) key;
+    return (uint32_t) (((ptr >> 4) ^ (ptr >> 32)) * 2654435761u);
+}
+
+static bool
+call_flow_arrow_index_equal(const void *key1, const void *key2)
+{
+    return key1 == key2;
+}
+
+/**
+ * @brief Get the sum of all group calls messages
+ *
+ * Used to check if group has new messages without iterating them
+ */
+static int
+call_flow_group_msg_total(sip_call_group_t *group)
+{
+    sip_call_t *call;
+    int total = 0, i;
+
+    for (i = 0; i < vector_count(group->calls); i++) {
+        call = vector_item(group->calls, i);
+        total += call_msg_count(call);
+    }
+    return total;
+}
+
+/**
+ * @brief Add a new arrow to the panel
+ *
+ * Arrows are sorted by time when added, so first line of arrows after
+ * the new one must be calculated again.
+ */
+static void
+call_flow_arrow_add(ui_t *ui, call_flow_arrow_t *arrow)
+{
+    call_flow_info_t *info = call_flow_info(ui);
+    int pos;
+
+    vector_append(info->arrows, arrow);
+    htable_insert(info->arrows_index, arrow->item, arrow);
+
+    // Most arrows are added at the end of the list
+    if (vector_last(info->arrows) == arrow) {
+        pos = vector_count(info->arrows) - 1;
+    } else {
+        pos = vector_index(info->arrows, arrow);
+    }
+
+    if (pos < info->arrows_lines_valid)
+        info->arrows_lines_valid = pos;
+}
+
+//! Settings that modify arrows height or visibility
+static const int call_flow_lines_settings[] = {
+    SETTING_CF_ONLYMEDIA,
+    SETTING_CF_SDP_INFO,
+    SETTING_CF_MEDIA,
+};
+
+/**
+ * @brief Calculate all arrows lines again when their height changes
+ */
+static void
+call_flow_lines_setting_changed(int id, void *data)
+{
+    ((call_flow_info_t *) data)->arrows_lines_valid = 0;
+}
+
+/**
+ * @brief Calculate first line of arrows added since last update
+ *
+ * Lines are stored as prefix sums of displayed arrows height, so the
+ * lines between any two arrows can be get without iterating them.
+ */
+static void
+call_flow_arrow_lines_update(ui_t *ui)
+{
+    call_flow_info_t *info = call_flow_info(ui);
+    call_flow_arrow_t *arrow;
+    int count = vector_count(info->arrows);
+    int *lines, size, i;
+
+    // Active streams may be displayed or hidden on each update
+    if (setting_has_value(SETTING_CF_MEDIA, SETTING_ACTIVE))
+        info->arrows_lines_valid = 0;
+
+    // Make room for each arrow first line and total lines
+    if (info->arrows_lines_size < count + 1) {
+        size = (count + 1) * 2;
+        if (!(lines = realloc(info->arrows_lines, sizeof(int) * size)))
+            return;
+        info->arrows_lines = lines;
+        info->arrows_lines_size = size;
+    }
+
+    info->arrows_lines[0] = 0;
+    for (i = info->arrows_lines_valid; i < count; i++) {
+        arrow = vector_item(info->arrows, i);
+        info->arrows_lines[i + 1] = info->arrows_lines[i];
+        if (call_flow_arrow_filter(arrow))
+            info->arrows_lines[i + 1] += call_flow_arrow_height(ui, arrow);
+    }
+    info->arrows_lines_valid = count;
+}
+
+/**
+ * @brief Get the first line of an arrow in the whole flow
+ *
+ * @param index Arrow position (number of arrows for total lines)
+ */
+static int
+call_flow_arrow_line(call_flow_info_t *info, int index)
+{
+    if (index < 0 || index > info->arrows_lines_valid || index >= info->arrows_lines_size)
+        return 0;
+    return info->arrows_lines[index];
+}
+
+/**
+ * @brief Deallocate a flow column and its Call-IDs list
+ */
+static void
+call_flow_column_destroyer(void *item)
+{
+    call_flow_column_t *column = (call_flow_column_t *) item;
+
+    vector_destroy(column->callids);
+    sng_free_tag(MEMSTAT_UI, column, sizeof(call_flow_column_t));
+}
+
+/**
+ * @brief Deallocate a flow arrow
+ */
+static void
+call_flow_arrow_destroyer(void *item)
+{
+    sng_free_tag(MEMSTAT_UI, item, sizeof(call_flow_arrow_t));
+}
+
 void
 call_flow_create(ui_t *ui)
 {
+    int i;
+
     // Create a new panel to fill all the screen
     ui_panel_create(ui, LINES, COLS);
 
     // Initialize Call List specific data
-    call_flow_info_t *info = malloc(sizeof(call_flow_info_t));
-    memset(info, 0, sizeof(call_flow_info_t));
+    call_flow_info_t *info = sng_malloc_tag(MEMSTAT_UI, sizeof(call_flow_info_t));
 
     // Display timestamp next to each arrow
     info->arrowtime = true;
@@ -100,31 +250,43 @@ call_flow_create(ui_t *ui)
 
     // Create vectors for columns and flow arrows
     info->columns = vector_create(2, 1);
+    vector_set_destroyer(info->columns, call_flow_column_destroyer);
     info->arrows = vector_create(20, 5);
+    vector_set_destroyer(info->arrows, call_flow_arrow_destroyer);
     vector_set_sorter(info->arrows, call_flow_arrow_sorter);
+    info->arrows_index = htable_create_custom(0, call_flow_arrow_index_hash, call_flow_arrow_index_equal);
 
     // Store it into panel userptr
     set_panel_userptr(ui->panel, (void*) info);
+
+    // Arrows height depends on some settings
+    for (i = 0; i < (int) (sizeof(call_flow_lines_settings) / sizeof(int)); i++)
+        setting_observe(call_flow_lines_settings[i], call_flow_lines_setting_changed, info);
 }
 
 void
 call_flow_destroy(ui_t *ui)
 {
     call_flow_info_t *info;
+    int i;
 
     // Free the panel information
     if ((info = call_flow_info(ui))) {
+        for (i = 0; i < (int) (sizeof(call_flow_lines_settings) / sizeof(int)); i++)
+            setting_unobserve(call_flow_lines_settings[i], call_flow_lines_setting_changed, info);
         // Delete panel columns
-        vector_destroy_items(info->columns);
+        vector_destroy(info->columns);
         // Delete panel arrows
-        vector_destroy_items(info->arrows);
+        vector_destroy(info->arrows);
+        htable_destroy(info->arrows_index);
+        free(info->arrows_lines);
         // Delete panel windows
         delwin(info->flow_win);
         delwin(info->raw_win);
         // Delete displayed call group
         call_group_destroy(info->group);
         // Free panel info
-        free(info);
+        sng_free_tag(MEMSTAT_UI, info, sizeof(call_flow_info_t));
     }
     ui_panel_destroy(ui);
 }
@@ -208,16 +370,9 @@ call_flow_draw(ui_t *ui)
     call_flow_draw_preview(ui);
 
     // Draw the scrollbar
-    vector_iter_t it = vector_iterator(info->darrows);
-    call_flow_arrow_t *arrow = NULL;
-    info->scroll.max = info->scroll.pos = 0;
-    while ((arrow = vector_iterator_next(&it))) {
-        // Store current position arrow
-        if (vector_iterator_current(&it) == info->first_arrow) {
-            info->scroll.pos = info->scroll.max;
-        }
-        info->scroll.max += call_flow_arrow_height(ui, arrow);
-    }
+    call_flow_arrow_lines_update(ui);
+    info->scroll.max = call_flow_arrow_line(info, vector_count(info->arrows));
+    info->scroll.pos = call_flow_arrow_line(info, info->first_arrow);
     ui_scrollbar_draw(info->scroll);
 
     // Redraw flow win
@@ -268,10 +423,12 @@ call_flow_draw_columns(ui_t *ui)
         info->maxcallids = 2;
     }
 
-    // Load columns
-    while((msg = call_group_get_next_msg(info->group, msg))) {
-        call_flow_column_add(ui, msg->call->callid, msg->packet->src);
-        call_flow_column_add(ui, msg->call->callid, msg->packet->dst);
+    // Load columns (only if there are new messages)
+    if (info->msgcnt != call_flow_group_msg_total(info->group)) {
+        while((msg = call_group_get_next_msg(info->group, msg))) {
+            call_flow_column_add(ui, msg->call->callid, msg->packet->src);
+            call_flow_column_add(ui, msg->call->callid, msg->packet->dst);
+        }
     }
 
     // Add RTP columns FIXME Really
@@ -308,7 +465,7 @@ call_flow_draw_columns(ui_t *ui)
         if (setting_enabled(SETTING_CF_SPLITCALLID) || !column->addr.port) {
             snprintf(coltext, MAX_SETTING_LEN, "%s", column->alias);
         } else if (setting_enabled(SETTING_DISPLAY_ALIAS)) {
-            if (strlen(column->addr.ip) > 15) {
+            if (strlen(column->ip) > 15) {
                 snprintf(coltext, MAX_SETTING_LEN, "..%.*s:%u",
                          MAX_SETTING_LEN - 9, column->alias + strlen(column->alias) - 13, column->addr.port);
             } else {
@@ -316,12 +473,12 @@ call_flow_draw_columns(ui_t *ui)
                          MAX_SETTING_LEN - 7, column->alias, column->addr.port);
             }
         } else {
-            if (strlen(column->addr.ip) > 15) {
+            if (strlen(column->ip) > 15) {
                 snprintf(coltext, MAX_SETTING_LEN, "..%.*s:%u",
-                         MAX_SETTING_LEN - 9, column->addr.ip + strlen(column->addr.ip) - 13, column->addr.port);
+                         MAX_SETTING_LEN - 9, column->ip + strlen(column->ip) - 13, column->addr.port);
             } else {
                 snprintf(coltext, MAX_SETTING_LEN, "%.*s:%u",
-                         MAX_SETTING_LEN - 7, column->addr.ip, column->addr.port);
+                         MAX_SETTING_LEN - 7, column->ip, column->addr.port);
             }
         }
 
@@ -337,25 +494,33 @@ call_flow_draw_arrows(ui_t *ui)
 {
     call_flow_info_t *info;
     call_flow_arrow_t *arrow = NULL;
-    int cline = 0;
+    sip_call_t *call;
+    sip_msg_t *msg = NULL;
+    rtp_stream_t *stream;
+    vector_iter_t streams;
+    int cline = 0, msgcnt, i;
 
     // Get panel information
     info = call_flow_info(ui);
 
-    // Create pending SIP arrows
-    sip_msg_t *msg = NULL;
-    while ((msg = call_group_get_next_msg(info->group, msg))) {
-        if (!call_flow_arrow_find(ui, msg)) {
-            arrow = call_flow_arrow_create(ui, msg, CF_ARROW_SIP);
-            vector_append(info->arrows, arrow);
+    // Create pending SIP arrows (only if there are new messages)
+    if ((msgcnt = call_flow_group_msg_total(info->group)) != info->msgcnt) {
+        while ((msg = call_group_get_next_msg(info->group, msg))) {
+            if (!call_flow_arrow_find(ui, msg))
+                call_flow_arrow_add(ui, call_flow_arrow_create(ui, msg, CF_ARROW_SIP));
         }
+        info->msgcnt = msgcnt;
     }
-    // Create pending RTP arrows
-    rtp_stream_t *stream = NULL;
-    while ((stream = call_group_get_next_stream(info->group, stream))) {
-        if (!call_flow_arrow_find(ui, stream)) {
-            arrow = call_flow_arrow_create(ui, stream, CF_ARROW_RTP);
-            vector_append(info->arrows, arrow);
+
+    // Create pending RTP arrows, streams are displayed once they have packets
+    for (i = 0; i < vector_count(info->group->calls); i++) {
+        call = vector_item(info->group->calls, i);
+        streams = vector_iterator(call->streams);
+        while ((stream = vector_iterator_next(&streams))) {
+            if (stream->type != PACKET_RTP || !stream_get_count(stream))
+                continue;
+            if (!call_flow_arrow_find(ui, stream))
+                call_flow_arrow_add(ui, call_flow_arrow_create(ui, stream, CF_ARROW_RTP));
         }
     }
 
@@ -430,6 +595,7 @@ call_flow_draw_message(ui_t *ui, call_flow_arrow_t *arrow, int cline)
     char delta[15] = {};
     int flowh;
     char mediastr[40];
+    char mediaip[ADDRESSLEN];
     sip_msg_t *msg = arrow->item;
     vector_iter_t medias;
     int color = 0;
@@ -486,12 +652,12 @@ call_flow_draw_message(ui_t *ui, call_flow_arrow_t *arrow, int cline)
     if (msg_has_sdp(msg) && setting_has_value(SETTING_CF_SDP_INFO, "first")) {
         snprintf(method, METHOD_MAXLEN, "%.3s (%s:%u)",
 		 msg_method,
-		 media->address.ip,
+		 address_get_ip(media->address, mediaip),
 		 media->address.port);
     }
 
     if (msg_has_sdp(msg) && setting_has_value(SETTING_CF_SDP_INFO, "full")) {
-        snprintf(method, METHOD_MAXLEN, "%.3s (%s)", msg_method, media->address.ip);
+        snprintf(method, METHOD_MAXLEN, "%.3s (%s)", msg_method, address_get_ip(media->address, mediaip));
     }
 
     // Draw message type or status and line
@@ -642,16 +808,16 @@ call_flow_draw_message(ui_t *ui, call_flow_arrow_t *arrow, int cline)
         if (!setting_has_value(SETTING_CF_SDP_INFO, "compressed")) {
             if (info->selected == -1) {
                 if (setting_enabled(SETTING_CF_DELTA)) {
-                    struct timeval selts, curts;
-                    selts = msg_get_time(call_group_get_prev_msg(info->group, msg));
-                    curts = msg_get_time(msg);
-                    timeval_to_delta(selts, curts, delta);
+                    uint64_t selts, curts;
+                    selts = msg_get_time_ns(call_group_get_prev_msg(info->group, msg));
+                    curts = msg_get_time_ns(msg);
+                    timestamp_to_delta(selts, curts, delta);
                 }
             } else if (arrow == vector_item(info->darrows, info->cur_arrow)) {
-                struct timeval selts, curts;
-                selts = msg_get_time(call_flow_arrow_message(call_flow_arrow_selected(ui)));
-                curts = msg_get_time(msg);
-                timeval_to_delta(selts, curts, delta);
+                uint64_t selts, curts;
+                selts = msg_get_time_ns(call_flow_arrow_message(call_flow_arrow_selected(ui)));
+                curts = msg_get_time_ns(msg);
+                timestamp_to_delta(selts, curts, delta);
             }
 
             if (strlen(delta)) {
@@ -672,7 +838,7 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
 {
     call_flow_info_t *info;
     WINDOW *win;
-    char text[50], time[20];
+    char text[80], quality[50], time[20];
     int height;
     rtp_stream_t *stream = arrow->item;
     sip_msg_t *msg;
@@ -798,6 +964,11 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
         }
     }
 
+    // Add stream quality to arrow text if it fits
+    sprintf(quality, " lost %u jitter %.1fms", stream_get_lost(stream), stream_get_jitter(stream));
+    if (strlen(text) + strlen(quality) < (size_t) distance)
+        strcat(text, quality);
+
     // Highlight current message
     if (arrow == vector_item(info->darrows, info->cur_arrow)) {
         if (setting_has_value(SETTING_CF_HIGHTLIGHT, "reverse")) {
@@ -861,7 +1032,7 @@ call_flow_draw_rtp_stream(ui_t *ui, call_flow_arrow_t *arrow, int cline)
 
     // Print timestamp
     if (info->arrowtime) {
-        timeval_to_time(stream->time, time);
+        timeval_to_time(timestamp_to_timeval(stream->time), time);
         if (arrow == vector_item(info->darrows, info->cur_arrow)) {
             wattron(win, A_BOLD);
             mvwprintw(win, cline, 2, "%s", time);
@@ -884,8 +1055,7 @@ call_flow_arrow_create(ui_t *ui, void *item, int type)
         return arrow;
 
     // Create a new arrow of the given type
-    arrow = malloc(sizeof(call_flow_arrow_t));
-    memset(arrow, 0, sizeof(call_flow_arrow_t));
+    arrow = sng_malloc_tag(MEMSTAT_UI, sizeof(call_flow_arrow_t));
     arrow->type = type;
     arrow->item = item;
     return arrow;
@@ -922,8 +1092,6 @@ call_flow_arrow_t *
 call_flow_arrow_find(ui_t *ui, const void *data)
 {
     call_flow_info_t *info;
-    call_flow_arrow_t *arrow;
-    vector_iter_t arrows;
 
     if (!data)
         return NULL;
@@ -931,12 +1099,7 @@ call_flow_arrow_find(ui_t *ui, const void *data)
     if (!(info = call_flow_info(ui)))
         return NULL;
 
-    arrows = vector_iterator(info->arrows);
-    while ((arrow = vector_iterator_next(&arrows)))
-        if (arrow->item == data)
-            return arrow;
-
-    return arrow;
+    return htable_find(info->arrows_index, data);
 }
 
 sip_msg_t *
@@ -1152,7 +1315,7 @@ call_flow_handle_key(ui_t *ui, int key)
                 if (call_group_count(info->group) == 1) {
                     call = vector_first(info->group->calls);
                     if (call->xcallid != NULL && strlen(call->xcallid)) {
-                        if ((xcall = sip_find_by_callid(call->xcallid))) {
+                        if ((xcall = call->xparent)) {
                             call_group_del(info->group, call);
                             call_group_add(info->group, xcall);
                             call_group_add_calls(info->group, xcall->xcalls);
@@ -1351,6 +1514,10 @@ call_flow_set_group(sip_call_group_t *group)
 
     vector_clear(info->columns);
     vector_clear(info->arrows);
+    htable_destroy(info->arrows_index);
+    info->arrows_index = htable_create_custom(0, call_flow_arrow_index_hash, call_flow_arrow_index_equal);
+    info->arrows_lines_valid = 0;
+    info->msgcnt = 0;
 
     info->group = group;
     info->cur_arrow = info->selected = -1;
@@ -1383,15 +1550,15 @@ call_flow_column_add(ui_t *ui, const char *callid, address_t addr)
     }
 
     // Create a new column
-    column = malloc(sizeof(call_flow_column_t));
-    memset(column, 0, sizeof(call_flow_column_t));
+    column = sng_malloc_tag(MEMSTAT_UI, sizeof(call_flow_column_t));
     column->callids = vector_create(1, 1);
     vector_append(column->callids, (void*)callid);
     column->addr = addr;
+    address_get_ip(addr, column->ip);
     if (setting_enabled(SETTING_ALIAS_PORT)) {
-        strcpy(column->alias, get_alias_value_vs_port(addr.ip, addr.port));
+        strcpy(column->alias, get_alias_value_vs_port(column->ip, addr.port));
     } else {
-        strcpy(column->alias, get_alias_value(addr.ip));
+        strcpy(column->alias, get_alias_value(column->ip));
     }
     column->colpos = vector_count(info->columns);
     vector_append(info->columns, column);
@@ -1405,6 +1572,7 @@ call_flow_column_get(ui_t *ui, const char *callid, address_t addr)
     vector_iter_t columns;
     int match_port;
     const char *alias;
+    char ip[ADDRESSLEN];
 
     if (!(info = call_flow_info(ui)))
         return NULL;
@@ -1413,10 +1581,11 @@ call_flow_column_get(ui_t *ui, const char *callid, address_t addr)
     match_port = addr.port != 0;
 
     // Get alias value for given address
+    address_get_ip(addr, ip);
     if (setting_enabled(SETTING_ALIAS_PORT) && match_port) {
-        alias = get_alias_value_vs_port(addr.ip, addr.port);
+        alias = get_alias_value_vs_port(ip, addr.port);
     } else {
-        alias = get_alias_value(addr.ip);
+        alias = get_alias_value(ip);
     }
 
     columns = vector_iterator(info->columns);
@@ -1450,8 +1619,7 @@ call_flow_move(ui_t *ui, int arrowindex)
 {
     call_flow_info_t *info;
     call_flow_arrow_t *arrow;
-    int flowh;
-    int curh = 0;
+    int flowh, curend, low, high, mid;
 
     // Get panel info
     if (!(info = call_flow_info(ui)))
@@ -1497,24 +1665,20 @@ call_flow_move(ui_t *ui, int arrowindex)
     if (info->cur_arrow <= info->first_arrow) {
         info->first_arrow = info->cur_arrow;
     } else {
-        // Draw the scrollbar
-        vector_iterator_set_current(&it, info->first_arrow - 1);
-        while ((arrow = vector_iterator_next(&it))) {
-            // Increase current arrow height position
-            curh += call_flow_arrow_height(ui, arrow);
-            // If we have reached current arrow
-            if (vector_iterator_current(&it) == info->cur_arrow) {
-                if (curh > flowh) {
-                    // Go to the next first arrow and check if current arrow
-                    // is still out of bottom bounds
-                    info->first_arrow++;
-                    vector_iterator_set_current(&it, info->first_arrow - 1);
-                    curh = 0;
-                } else {
-                    break;
-                }
+        // Find the first arrow that keeps current arrow in bottom bounds
+        call_flow_arrow_lines_update(ui);
+        curend = call_flow_arrow_line(info, info->cur_arrow + 1);
+        low = info->first_arrow;
+        high = info->cur_arrow;
+        while (low < high) {
+            mid = (low + high) / 2;
+            if (curend - call_flow_arrow_line(info, mid) > flowh) {
+                low = mid + 1;
+            } else {
+                high = mid;
             }
         }
+        info->first_arrow = low;
     }
 }
 
@@ -1531,10 +1695,10 @@ call_flow_arrow_selected(ui_t *ui)
 
 }
 
-struct timeval
+uint64_t
 call_flow_arrow_time(call_flow_arrow_t *arrow)
 {
-    struct timeval ts = { 0 };
+    uint64_t ts = 0;
     sip_msg_t *msg;
     rtp_stream_t *stream;
 
@@ -1543,7 +1707,7 @@ call_flow_arrow_time(call_flow_arrow_t *arrow)
 
     if (arrow->type == CF_ARROW_SIP) {
         msg = (sip_msg_t *) arrow->item;
-        ts = packet_time(msg->packet);
+        ts = packet_time_ns(msg->packet);
     } else if (arrow->type == CF_ARROW_RTP) {
         stream = (rtp_stream_t *) arrow->item;
         ts = stream->time;
@@ -1555,7 +1719,7 @@ call_flow_arrow_time(call_flow_arrow_t *arrow)
 void
 call_flow_arrow_sorter(vector_t *vector, void *item)
 {
-    struct timeval curts, prevts;
+    uint64_t curts, prevts;
     int count = vector_count(vector);
     int i;
 
@@ -1569,7 +1733,7 @@ call_flow_arrow_sorter(vector_t *vector, void *item)
         // Get previous arrow
         prevts = call_flow_arrow_time(vector_item(vector, i));
         // Check if the item is already in a sorted position
-        if (timeval_is_older(curts, prevts)) {
+        if (curts >= prevts) {
             vector_insert(vector, item, i + 1);
             return;
         }
@@ -121,6 +121,8 @@ struct call_flow_arrow {
 struct call_flow_column {
     //! Address header for this column
     address_t addr;
+    //! Address IP text for this column
+    char ip[ADDRESSLEN];
     //! Alias for the given address
     char alias[MAX_SETTING_LEN];
     //! Call Ids
@@ -146,6 +148,16 @@ struct call_flow_info {
     vector_t *arrows;
     //! List of displayed arrows
     vector_t *darrows;
+    //! Arrows indexed by their item (message or stream)
+    htable_t *arrows_index;
+    //! First screen line of each arrow, followed by total arrows lines
+    int *arrows_lines;
+    //! Allocated size of arrows lines array
+    int arrows_lines_size;
+    //! Number of arrows with a valid first line
+    int arrows_lines_valid;
+    //! Group messages count when arrows were last created
+    int msgcnt;
     //! First displayed arrow in the list
     int first_arrow;
     //! Current arrow index where the cursor is
@@ -471,12 +483,12 @@ call_flow_arrow_selected(ui_t *ui);
  * in different locations.
  *
  * If pointer is invalid of arrow type doesn't match anything known, the
- * timestamp returned structure will be zero'd
+ * timestamp returned will be zero
  *
  * @param arrow Arrow structure pointer
- * @return timestamp for given arrow
+ * @return timestamp for given arrow in nanoseconds
  */
-struct timeval
+uint64_t
 call_flow_arrow_time(call_flow_arrow_t *arrow);
 
 /**
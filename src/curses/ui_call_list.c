@@ -37,6 +37,7 @@
 #include "capture.h"
 #ifdef USE_EEP
 #include "capture_eep.h"
+#include "capture_probe.h"
 #endif
 #include "ui_manager.h"
 #include "ui_call_list.h"
@@ -60,6 +61,21 @@ ui_t ui_call_list = {
     .help = call_list_help,
 };
 
+//! Settings that modify displayed columns text or colors
+static const int call_list_layout_settings[] = {
+    SETTING_DISPLAY_ALIAS,
+    SETTING_CL_COLORATTR,
+};
+
+/**
+ * @brief Render all displayed calls again when their columns change
+ */
+static void
+call_list_layout_setting_changed(int id, void *data)
+{
+    ((call_list_info_t *) data)->layout++;
+}
+
 void
 call_list_create(ui_t *ui)
 {
@@ -119,6 +135,11 @@ call_list_create(ui_t *ui)
     // Set autoscroll default status
     info->autoscroll = setting_enabled(SETTING_CL_AUTOSCROLL);
 
+    // Columns text and colors depend on some settings
+    info->layout = 1;
+    for (i = 0; i < (int) (sizeof(call_list_layout_settings) / sizeof(int)); i++)
+        setting_observe(call_list_layout_settings[i], call_list_layout_setting_changed, info);
+
     // Apply initial configured filters
     filter_method_from_setting(setting_get_value(SETTING_FILTER_METHODS));
     filter_payload_from_setting(setting_get_value(SETTING_FILTER_PAYLOAD));
@@ -128,9 +149,17 @@ void
 call_list_destroy(ui_t *ui)
 {
     call_list_info_t *info;
+    int i;
 
     // Free its status data
     if ((info = call_list_info(ui))) {
+        for (i = 0; i < (int) (sizeof(call_list_layout_settings) / sizeof(int)); i++)
+            setting_unobserve(call_list_layout_settings[i], call_list_layout_setting_changed, info);
+
+        // Deallocate list lines cache
+        sng_free_tag(MEMSTAT_UI, info->rows[0].text, CALL_LIST_CACHE_SIZE * info->rowlen);
+        sng_free_tag(MEMSTAT_UI, info->lines, info->linecnt * sizeof(call_list_line_t));
+
         // Deallocate forms data
         if (info->form) {
             unpost_form(info->form);
@@ -140,7 +169,6 @@ call_list_destroy(ui_t *ui)
 
         // Deallocate group data
         call_group_destroy(info->group);
-        vector_destroy(info->dcalls);
 
         // Deallocate panel windows
         delwin(info->list_win);
@@ -231,6 +259,18 @@ call_list_draw_header(ui_t *ui)
     }
 #endif
 
+    // Show load shedding level
+    switch (capture_overload_level()) {
+        case CAPTURE_OVERLOAD_RTP:
+            wprintw(ui->win, "[Overload: RTP 1/%d]", capture_overload_sample());
+            break;
+        case CAPTURE_OVERLOAD_FILTER:
+            wprintw(ui->win, "[Overload: RTP 1/%d, Filter paused]", capture_overload_sample());
+            break;
+        default:
+            break;
+    }
+
     wattroff(ui->win, COLOR_PAIR(CP_GREEN_ON_DEF));
     wattroff(ui->win, COLOR_PAIR(CP_RED_ON_DEF));
 
@@ -308,7 +348,10 @@ call_list_draw_header(ui_t *ui)
     // Print calls count (also filtered)
     sip_stats_t stats = sip_calls_stats();
     mvwprintw(ui->win, 1, 45, "%*s", 30, "");
-    if (stats.total != stats.displayed) {
+    if (stats.pending && stats.total) {
+        mvwprintw(ui->win, 1, 45, "%s: %d (filtering %d%%)", countlb, stats.total,
+                  (stats.total - stats.pending) * 100 / stats.total);
+    } else if (stats.total != stats.displayed) {
         mvwprintw(ui->win, 1, 45, "%s: %d (%d displayed)", countlb, stats.total, stats.displayed);
     } else {
         mvwprintw(ui->win, 1, 45, "%s: %d", countlb, stats.total);
@@ -337,17 +380,164 @@ call_list_draw_footer(ui_t *ui)
     ui_draw_bindings(ui, keybindings, 23);
 }
 
+/**
+ * @brief Allocate lines state and rows text for the list window size
+ *
+ * All displayed calls are rendered again when window size changes.
+ *
+ * @return 0 on success, 1 on allocation error
+ */
+static int
+call_list_lines_resize(call_list_info_t *info, int listh, int listw)
+{
+    call_list_line_t *lines;
+    char *text;
+    int i;
+
+    if (info->linecnt == listh && info->rowlen == listw + 1)
+        return 0;
+
+    lines = sng_malloc_tag(MEMSTAT_UI, listh * sizeof(call_list_line_t));
+    text = sng_malloc_tag(MEMSTAT_UI, CALL_LIST_CACHE_SIZE * (listw + 1));
+    if (!lines || !text) {
+        sng_free_tag(MEMSTAT_UI, lines, listh * sizeof(call_list_line_t));
+        sng_free_tag(MEMSTAT_UI, text, CALL_LIST_CACHE_SIZE * (listw + 1));
+        return 1;
+    }
+
+    sng_free_tag(MEMSTAT_UI, info->rows[0].text, CALL_LIST_CACHE_SIZE * info->rowlen);
+    sng_free_tag(MEMSTAT_UI, info->lines, info->linecnt * sizeof(call_list_line_t));
+
+    memset(info->rows, 0, sizeof(info->rows));
+    for (i = 0; i < CALL_LIST_CACHE_SIZE; i++)
+        info->rows[i].text = text + i * (listw + 1);
+    info->rowlen = listw + 1;
+    info->lines = lines;
+    info->linecnt = listh;
+    info->layout++;
+    return 0;
+}
+
+/**
+ * @brief Get the rendered columns of a call
+ *
+ * Column texts are only requested again if the call has been updated or
+ * the layout has changed since they were cached.
+ */
+static call_list_row_t *
+call_list_row(call_list_info_t *info, sip_call_t *call, int listw)
+{
+    call_list_row_t *row = &info->rows[CALL_SLOT(call, index) % CALL_LIST_CACHE_SIZE];
+    uint32_t version = call->version;
+    char coltext[SIP_ATTR_MAXLEN];
+    int i, colid, collen, colpos;
+
+    if (row->call == call && row->index == CALL_SLOT(call, index)
+        && row->version == version && row->layout == info->layout)
+        return row;
+
+    memset(row->text, 0, info->rowlen);
+    colpos = 6;
+    for (i = 0; i < info->columncnt; i++) {
+        // Get current column id
+        colid = info->columns[i].id;
+        // Get current column width
+        collen = info->columns[i].width;
+        // Check if next column fits on window width
+        if (colpos + collen >= listw)
+            break;
+
+        // Get call attribute for current column
+        memset(coltext, 0, sizeof(coltext));
+        if (call_get_attribute(call, colid, coltext)) {
+            snprintf(row->text + colpos, collen + 1, "%s", coltext);
+            row->colors[i] = sip_attr_get_color(colid, coltext);
+        } else {
+            row->colors[i] = -1;
+        }
+        colpos += collen + 1;
+    }
+
+    row->call = call;
+    row->index = CALL_SLOT(call, index);
+    row->version = version;
+    row->layout = info->layout;
+    return row;
+}
+
+/**
+ * @brief Draw a call in a line of the list window
+ */
+static void
+call_list_draw_row(call_list_info_t *info, int cline, call_list_row_t *row,
+                   bool selected, bool grouped)
+{
+    WINDOW *list_win = info->list_win;
+    int listw = getmaxx(list_win);
+    int i, collen;
+    int colpos;
+    int color;
+
+    // Show bold selected rows
+    if (grouped)
+        wattron(list_win, A_BOLD | COLOR_PAIR(CP_DEFAULT));
+
+    // Highlight active call
+    if (selected) {
+        wattron(list_win, COLOR_PAIR(CP_WHITE_ON_BLUE));
+        // Reverse colors on monochrome terminals
+        if (!has_colors())
+            wattron(list_win, A_REVERSE);
+    }
+    // Set current line background
+    mvwprintw(list_win, cline, 0, "%*s", listw, "");
+    // Set current line selection box
+    mvwprintw(list_win, cline, 2, grouped ? "[*]" : "[ ]");
+
+    // Print requested columns
+    colpos = 6;
+    for (i = 0; i < info->columncnt; i++) {
+        // Get current column width
+        collen = info->columns[i].width;
+        // Check if next column fits on window width
+        if (colpos + collen >= listw)
+            break;
+
+        // Skip columns without value
+        if ((color = row->colors[i]) < 0) {
+            colpos += collen + 1;
+            continue;
+        }
+
+        // Enable attribute color (if not current one)
+        if (selected)
+            color = 0;
+        if (color > 0)
+            wattron(list_win, color);
+
+        // Add the column text to the existing columns
+        mvwprintw(list_win, cline, colpos, "%s", row->text + colpos);
+        colpos += collen + 1;
+
+        // Disable attribute color
+        if (color > 0)
+            wattroff(list_win, color);
+    }
+
+    wattroff(list_win, COLOR_PAIR(CP_DEFAULT));
+    wattroff(list_win, COLOR_PAIR(CP_DEF_ON_BLUE));
+    wattroff(list_win, A_BOLD | A_REVERSE);
+}
+
 void
 call_list_draw_list(ui_t *ui)
 {
     WINDOW *list_win;
     int listh, listw, cline = 0;
     struct sip_call *call = NULL;
-    int i, collen;
-    char coltext[SIP_ATTR_MAXLEN];
-    int colid;
-    int colpos;
-    int color;
+    call_list_line_t *line;
+    call_list_row_t *row;
+    bool selected, grouped;
 
     // Get panel info
     call_list_info_t *info = call_list_info(ui);
@@ -360,9 +550,10 @@ call_list_draw_list(ui_t *ui)
     if (info->cur_call >= 0)
         call = vector_item(info->dcalls, info->cur_call);
 
+    // Check new calls against display filters
+    sip_calls_filter_update();
     // Get the list of calls that are goint to be displayed
-    vector_destroy(info->dcalls);
-    info->dcalls = vector_copy_if(sip_calls_vector(), filter_check_call);
+    info->dcalls = sip_calls_filtered_vector();
 
     // If no active call, use the fist one (if exists)
     if (info->cur_call == -1 && vector_count(info->dcalls)) {
@@ -381,8 +572,18 @@ call_list_draw_list(ui_t *ui)
         call_list_move(ui, vector_index(info->dcalls, call));
     }
 
-    // Clear call list before redrawing
-    werase(list_win);
+    // Lines without cache can only be fully drawn
+    if (call_list_lines_resize(info, listh, listw) != 0) {
+        werase(list_win);
+        info->layout++;
+        return;
+    }
+
+    // Scrollbar column is only restored by drawing the lines again
+    info->scroll.max = vector_count(info->dcalls);
+    if (info->scroll_drawn && info->scroll.max < listh)
+        info->layout++;
+    info->scroll_drawn = (info->scroll.max >= listh);
 
     // Set the iterator position to the first call
     vector_iter_t it = vector_iterator(info->dcalls);
@@ -398,67 +599,39 @@ call_list_draw_list(ui_t *ui)
         if (!call_msg_count(call))
             continue;
 
-        // Show bold selected rows
-        if (call_group_exists(info->group, call))
-            wattron(list_win, A_BOLD | COLOR_PAIR(CP_DEFAULT));
-
-        // Highlight active call
-        if (info->cur_call == vector_iterator_current(&it)) {
-            wattron(list_win, COLOR_PAIR(CP_WHITE_ON_BLUE));
-            // Reverse colors on monochrome terminals
-            if (!has_colors())
-                wattron(list_win, A_REVERSE);
-        }
-        // Set current line background
-        mvwprintw(list_win, cline, 0, "%*s", listw, "");
-        // Set current line selection box
-        mvwprintw(list_win, cline, 2, call_group_exists(info->group, call) ? "[*]" : "[ ]");
-
-        // Print requested columns
-        colpos = 6;
-        for (i = 0; i < info->columncnt; i++) {
-            // Get current column id
-            colid = info->columns[i].id;
-            // Get current column width
-            collen = info->columns[i].width;
-            // Check if next column fits on window width
-            if (colpos + collen >= listw)
-                break;
-
-            // Initialize column text
-            memset(coltext, 0, sizeof(coltext));
-
-            // Get call attribute for current column
-            if (!call_get_attribute(call, colid, coltext)) {
-                colpos += collen + 1;
-                continue;
-            }
+        grouped = call_group_exists(info->group, call);
+        selected = (info->cur_call == vector_iterator_current(&it));
 
-            // Enable attribute color (if not current one)
-            color = 0;
-            if (info->cur_call != vector_iterator_current(&it)) {
-                if ((color = sip_attr_get_color(colid, coltext)) > 0) {
-                    wattron(list_win, color);
-                }
-            }
+        // Only draw lines that have changed since last update
+        line = &info->lines[cline++];
+        if (line->call == call && line->index == CALL_SLOT(call, index)
+            && line->version == call->version && line->layout == info->layout
+            && line->selected == selected && line->grouped == grouped)
+            continue;
 
-            // Add the column text to the existing columns
-            mvwprintw(list_win, cline, colpos, "%.*s", collen, coltext);
-            colpos += collen + 1;
+        row = call_list_row(info, call, listw);
+        call_list_draw_row(info, cline - 1, row, selected, grouped);
 
-            // Disable attribute color
-            if (color > 0)
-                wattroff(list_win, color);
-        }
-        cline++;
+        line->call = call;
+        line->index = row->index;
+        line->version = row->version;
+        line->layout = row->layout;
+        line->selected = selected;
+        line->grouped = grouped;
+    }
 
-        wattroff(list_win, COLOR_PAIR(CP_DEFAULT));
-        wattroff(list_win, COLOR_PAIR(CP_DEF_ON_BLUE));
-        wattroff(list_win, A_BOLD | A_REVERSE);
+    // Clear lines no longer used
+    for (; cline < listh; cline++) {
+        line = &info->lines[cline];
+        if (!line->call && line->layout == info->layout)
+            continue;
+        memset(line, 0, sizeof(call_list_line_t));
+        line->layout = info->layout;
+        wmove(list_win, cline, 0);
+        wclrtoeol(list_win);
     }
 
     // Draw scrollbar to the right
-    info->scroll.max = vector_count(info->dcalls);
     ui_scrollbar_draw(info->scroll);
 
     // Refresh the list
@@ -565,6 +738,9 @@ call_list_handle_key(ui_t *ui, int key)
     int action = -1;
     sip_call_t *call, *xcall;
     sip_sort_t sort;
+#ifdef USE_EEP
+    vector_iter_t it;
+#endif
 
     // Sanity check, this should not happen
     if (!(info  = call_list_info(ui)))
@@ -632,7 +808,7 @@ call_list_handle_key(ui_t *ui, int key)
                 if (action == ACTION_SHOW_FLOW_EX) {
                     call = vector_item(info->dcalls, info->cur_call);
                     if (call->xcallid != NULL && strlen(call->xcallid)) {
-                        if ((xcall = sip_find_by_callid(call->xcallid))) {
+                        if ((xcall = call->xparent)) {
                             call_group_del(group, call);
                             call_group_add(group, xcall);
                             call_group_add_calls(group, xcall->xcalls);
@@ -644,6 +820,13 @@ call_list_handle_key(ui_t *ui, int key)
                     }
                 }
 
+#ifdef USE_EEP
+                // Request frames of dialogs received from remote probes
+                it = vector_iterator(group->calls);
+                while ((call = vector_iterator_next(&it)))
+                    capture_probe_fetch(call);
+#endif
+
                 if (action == ACTION_SHOW_RAW) {
                     // Create a Call Flow panel
                     ui_create_panel(PANEL_CALL_RAW);
@@ -663,6 +846,9 @@ call_list_handle_key(ui_t *ui, int key)
             case ACTION_SHOW_STATS:
                 ui_create_panel(PANEL_STATS);
                 break;
+            case ACTION_SHOW_TIMING:
+                ui_create_panel(PANEL_TIMING);
+                break;
             case ACTION_SAVE:
                 if (capture_sources_count() > 1) {
                     dialog_run("Saving is not possible when multiple input sources are specified.");
@@ -808,15 +994,6 @@ call_list_handle_form_key(ui_t *ui, int key)
         break;
     }
 
-    // Filter has changed, re-apply filter to displayed calls
-    if (action == ACTION_PRINTABLE || action == ACTION_BACKSPACE ||
-            action == ACTION_DELETE || action == ACTION_CLEAR) {
-        // Updated displayed results
-         call_list_clear(ui);
-         // Reset filters on each key stroke
-         filter_reset_calls();
-    }
-
     // Validate all input data
     form_driver(info->form, REQ_VALIDATION);
 
@@ -832,6 +1009,15 @@ call_list_handle_form_key(ui_t *ui, int key)
     filter_set(FILTER_CALL_LIST, strlen(dfilter) ? dfilter : NULL);
     free(dfilter);
 
+    // Filter has changed, re-apply filter to displayed calls
+    if (action == ACTION_PRINTABLE || action == ACTION_BACKSPACE ||
+            action == ACTION_DELETE || action == ACTION_CLEAR) {
+        // Updated displayed results
+         call_list_clear(ui);
+         // Reset filters on each key stroke
+         filter_reset_calls();
+    }
+
     // Return if this panel has handled or not the key
     return (action == ERR) ? KEY_NOT_HANDLED : KEY_HANDLED;
 }
@@ -987,6 +1173,9 @@ call_list_add_column(ui_t *ui, enum sip_attr_id id, const char* attr,
     info->columns[info->columncnt].title = title;
     info->columns[info->columncnt].width = width;
     info->columncnt++;
+
+    // Render displayed calls with the new column
+    info->layout++;
     return 0;
 }
 
@@ -1005,6 +1194,7 @@ call_list_clear(ui_t *ui)
 
     // Clear Displayed lines
     werase(info->list_win);
+    info->layout++;
 }
 
 void
@@ -50,6 +50,13 @@ enum call_list_field_list {
 typedef struct call_list_column call_list_column_t;
 //! Sorter declaration of call_list_info struct
 typedef struct call_list_info call_list_info_t;
+//! Sorter declaration of call_list_row struct
+typedef struct call_list_row call_list_row_t;
+//! Sorter declaration of call_list_line struct
+typedef struct call_list_line call_list_line_t;
+
+//! Number of calls with cached column texts
+#define CALL_LIST_CACHE_SIZE 256
 
 /**
  * @brief Call List column information
@@ -65,6 +72,45 @@ struct call_list_column {
     int width;
 };
 
+/**
+ * @brief Cached column texts of a call
+ *
+ * Rows are stored by call index, so the calls displayed while scrolling
+ * are not formatted again until they are updated or the layout changes.
+ */
+struct call_list_row {
+    //! Rendered call (NULL if not used)
+    sip_call_t *call;
+    //! Call index when rendered
+    int index;
+    //! Call version when rendered
+    uint32_t version;
+    //! Layout generation when rendered
+    uint32_t layout;
+    //! Color of each displayed column text
+    int colors[SIP_ATTR_COUNT];
+    //! Text of each displayed column, at its column offset
+    char *text;
+};
+
+/**
+ * @brief Last drawn state of a list window line
+ */
+struct call_list_line {
+    //! Displayed call (NULL for empty lines)
+    sip_call_t *call;
+    //! Call index when drawn
+    int index;
+    //! Call version when drawn
+    uint32_t version;
+    //! Layout generation when drawn
+    uint32_t layout;
+    //! Line is the selected call
+    bool selected;
+    //! Call was in the selected group
+    bool grouped;
+};
+
 /**
  * @brief Call List panel status information
  *
@@ -72,7 +118,7 @@ struct call_list_column {
  * panel pointer.
  */
 struct call_list_info {
-    //! Displayed calls vector
+    //! Displayed calls vector (owned by call storage)
     vector_t *dcalls;
     //! Selected call in the list
     int cur_call;
@@ -100,6 +146,18 @@ struct call_list_info {
     int autoscroll;
     //! List scrollbar
     scrollbar_t scroll;
+    //! Scrollbar was drawn in last list update
+    bool scroll_drawn;
+    //! Layout generation, changed when displayed columns must be rendered again
+    uint32_t layout;
+    //! Cached column texts of displayed calls
+    call_list_row_t rows[CALL_LIST_CACHE_SIZE];
+    //! Bytes allocated for each row text
+    int rowlen;
+    //! Last drawn state of each list window line
+    call_list_line_t *lines;
+    //! Number of lines in list window when lines were allocated
+    int linecnt;
 };
 
 /**
@@ -61,7 +61,7 @@ call_raw_create(ui_t *ui)
     // Store it into panel userptr
     set_panel_userptr(ui->panel, (void*) info);
 
-    // Create a initial pad of 1000 lines
+    // Create a initial pad of 500 lines
     info->pad = newpad(500, COLS);
     info->padline = 0;
     info->scroll = 0;
@@ -75,6 +75,7 @@ call_raw_destroy(ui_t *ui)
     if ((info = call_raw_info(ui))) {
         // Delete panel windows
         delwin(info->pad);
+        sng_free(info->msgs);
         sng_free(info);
     }
     ui_panel_destroy(ui);
@@ -97,38 +98,138 @@ call_raw_redraw(ui_t *ui)
 
 }
 
+/**
+ * @brief Get the first added message visible at the given line
+ *
+ * @return message position index or msgcnt if line is after all messages
+ */
+static int
+call_raw_find_line(call_raw_info_t *info, int line)
+{
+    int first = 0, last = info->msgcnt, mid;
+
+    while (first < last) {
+        mid = first + (last - first) / 2;
+        if (info->msgs[mid].line + info->msgs[mid].height <= line) {
+            first = mid + 1;
+        } else {
+            last = mid;
+        }
+    }
+
+    return first;
+}
+
 int
 call_raw_draw(ui_t *ui)
 {
     call_raw_info_t *info;
     sip_msg_t *msg = NULL;
+    WINDOW *pad;
+    int first, pos, height, width, lines, offset;
 
     // Get panel information
     if(!(info = call_raw_info(ui)))
         return -1;
 
     if (info->group) {
-        // Print the call group messages into the pad
+        // Add new messages of the call group
         while ((msg = call_group_get_next_msg(info->group, info->last)))
-            call_raw_print_msg(ui, msg);
-    } else {
-        call_raw_set_msg(info->msg);
+            call_raw_add_msg(ui, msg);
+    }
+
+    // Messages intersecting the visible window
+    first = call_raw_find_line(info, info->scroll);
+    offset = (first < info->msgcnt) ? info->scroll - info->msgs[first].line : 0;
+    lines = offset + ui->height;
+    for (pos = first; pos < info->msgcnt && info->msgs[pos].line < info->scroll + ui->height; pos++) {
+        if (info->msgs[pos].line + info->msgs[pos].height - info->msgs[first].line > lines)
+            lines = info->msgs[pos].line + info->msgs[pos].height - info->msgs[first].line;
+    }
+
+    // Check if we have enough space in our pad to print them
+    getmaxyx(info->pad, height, width);
+    if (lines > height) {
+        if (!(pad = newpad(lines, width)))
+            return -1;
+        delwin(info->pad);
+        info->pad = pad;
     }
 
+    // Only print visible messages
+    werase(info->pad);
+    for (pos = first; pos < info->msgcnt && info->msgs[pos].line < info->scroll + ui->height; pos++)
+        call_raw_print_msg(ui, info->msgs[pos].msg, info->msgs[pos].line - info->msgs[first].line);
+
     // Copy the visible part of the pad into the panel window
-    copywin(info->pad, ui->win, info->scroll, 0, 0, 0, ui->height - 1, ui->width - 1, 0);
+    copywin(info->pad, ui->win, offset, 0, 0, 0, ui->height - 1, ui->width - 1, 0);
     touchwin(ui->win);
     return 0;
 }
 
+/**
+ * @brief Get the number of lines used to print a message payload
+ *
+ * Lines are counted the same way draw_message_pos prints them.
+ */
+static int
+call_raw_msg_lines(sip_msg_t *msg, int width)
+{
+    const char *payload = msg_get_payload(msg);
+    int lines = 0, column = 0;
+
+    for (; *payload; payload++) {
+        if (*payload == '\r')
+            continue;
+
+        if (column > width - 1 || *payload == '\n') {
+            lines++;
+            column = 0;
+        }
+
+        if (*payload != '\n')
+            column++;
+    }
+
+    return lines;
+}
+
 int
-call_raw_print_msg(ui_t *ui, sip_msg_t *msg)
+call_raw_add_msg(ui_t *ui, sip_msg_t *msg)
+{
+    call_raw_info_t *info;
+    call_raw_msg_t *msgs;
+
+    // Get panel information
+    if (!(info = call_raw_info(ui)))
+        return -1;
+
+    if (info->msgcnt == info->msgsize) {
+        if (!(msgs = realloc(info->msgs, sizeof(call_raw_msg_t) * (info->msgsize * 2 + 64))))
+            return -1;
+        info->msgs = msgs;
+        info->msgsize = info->msgsize * 2 + 64;
+    }
+
+    // Header, payload and an extra line between messages
+    info->msgs[info->msgcnt].msg = msg;
+    info->msgs[info->msgcnt].line = info->padline;
+    info->msgs[info->msgcnt].height = call_raw_msg_lines(msg, getmaxx(info->pad)) + 2;
+    info->padline += info->msgs[info->msgcnt].height;
+    info->msgcnt++;
+
+    // Set this as the last added message
+    info->last = msg;
+
+    return 0;
+}
+
+int
+call_raw_print_msg(ui_t *ui, sip_msg_t *msg, int line)
 {
     call_raw_info_t *info;
-    int payload_lines, i, column, height, width;
     // Message ngrep style Header
     char header[256];
-    char payload[MAX_SIP_PAYLOAD];
     int color = 0;
 
     // Get panel information
@@ -138,36 +239,6 @@ call_raw_print_msg(ui_t *ui, sip_msg_t *msg)
     // Get the pad window
     WINDOW *pad = info->pad;
 
-    // Get current pad dimensions
-    getmaxyx(pad, height, width);
-
-    // Get message payload
-    strcpy(payload, msg_get_payload(msg));
-
-    // Check how many lines we well need to draw this message
-    payload_lines = 0;
-    column = 0;
-    for (i = 0; i < strlen(payload); i++) {
-        if (column == width || payload[i] == '\n') {
-            payload_lines++;
-            column = 0;
-            continue;
-        }
-        column++;
-    }
-
-    // Check if we have enough space in our huge pad to store this message
-    if (info->padline + payload_lines > height) {
-        // Create a new pad with more lines!
-        pad = newpad(height + 500, COLS);
-        // And copy all previous information
-        overwrite(info->pad, pad);
-        // Delete previous pad
-        delwin(info->pad);
-        // And store the new pad
-        info->pad = pad;
-    }
-
     // Color the message {
     if (setting_has_value(SETTING_COLORMODE, "request")) {
         // Determine arrow color
@@ -189,16 +260,11 @@ call_raw_print_msg(ui_t *ui, sip_msg_t *msg)
 
     // Print msg header
     wattron(pad, A_BOLD);
-    mvwprintw(pad, info->padline++, 0, "%s", sip_get_msg_header(msg, header));
+    mvwprintw(pad, line, 0, "%s", sip_get_msg_header(msg, header));
     wattroff(pad, A_BOLD);
 
     // Print msg payload
-    info->padline += draw_message_pos(pad, msg, info->padline);
-    // Extra line between messages
-    info->padline++;
-
-    // Set this as the last printed message
-    info->last = msg;
+    draw_message_pos(pad, msg, line + 1);
 
     return 0;
 }
@@ -253,17 +319,8 @@ call_raw_handle_key(ui_t *ui, int key)
             case ACTION_TOGGLE_SYNTAX:
             case ACTION_CYCLE_COLOR:
                 // Handle colors using default handler
+                // Visible messages are printed again on next draw
                 ui_default_handle_key(ui, key);
-                // Create a new pad (forces messages draw)
-                delwin(info->pad);
-                info->pad = newpad(500, COLS);
-                info->last = NULL;
-                // Force refresh panel
-                if (info->group) {
-                    call_raw_set_group(info->group);
-                } else {
-                    call_raw_set_msg(info->msg);
-                }
                 break;
             case ACTION_CLEAR_CALLS:
             case ACTION_CLEAR_CALLS_SOFT:
@@ -271,16 +328,6 @@ call_raw_handle_key(ui_t *ui, int key)
                 return KEY_PROPAGATED;
             case ACTION_SHOW_ALIAS:
                 setting_toggle(SETTING_DISPLAY_ALIAS);
-                // Create a new pad (forces messages draw)
-                delwin(info->pad);
-                info->pad = newpad(500, COLS);
-                info->last = NULL;
-                // Force refresh panel
-                if (info->group) {
-                    call_raw_set_group(info->group);
-                } else {
-                    call_raw_set_msg(info->msg);
-                }
                 break;
             default:
                 // Parse next action
@@ -321,9 +368,10 @@ call_raw_set_group(sip_call_group_t *group)
     info->group = group;
     info->msg = NULL;
 
-    // Initialize internal pad
+    // Group messages are added on next draw
+    info->last = NULL;
+    info->msgcnt = 0;
     info->padline = 0;
-    wclear(info->pad);
 
     return 0;
 }
@@ -347,12 +395,11 @@ call_raw_set_msg(sip_msg_t *msg)
     info->group = NULL;
     info->msg = msg;
 
-    // Initialize internal pad
+    // Only display this message
+    info->last = NULL;
+    info->msgcnt = 0;
     info->padline = 0;
-    wclear(info->pad);
-
-    // Print the message in the pad
-    call_raw_print_msg(ui, msg);
+    call_raw_add_msg(ui, msg);
 
     return 0;
 
@@ -37,6 +37,23 @@
 
 //! Sorter declaration of struct call_raw_info
 typedef struct call_raw_info call_raw_info_t;
+//! Sorter declaration of struct call_raw_msg
+typedef struct call_raw_msg call_raw_msg_t;
+
+/**
+ * @brief Position of a message in the panel
+ *
+ * Messages are only printed when they are in the visible part of the
+ * panel, but their size is calculated when they are added.
+ */
+struct call_raw_msg {
+    //! Displayed message
+    sip_msg_t *msg;
+    //! First line of the message (its header)
+    int line;
+    //! Number of lines including header and separator line
+    int height;
+};
 
 /**
  * @brief Call raw status information
@@ -49,11 +66,17 @@ struct call_raw_info {
     sip_call_group_t *group;
     //! Message to display on the panel (Single message raw display)
     sip_msg_t *msg;
-    //! Last printed message on panel (Call raw display)
+    //! Last added message on panel (Call raw display)
     sip_msg_t *last;
-    //! Window pad to copy on displayed screen
+    //! Added messages positions in display order
+    call_raw_msg_t *msgs;
+    //! Number of added messages
+    int msgcnt;
+    //! Allocated messages positions
+    int msgsize;
+    //! Window pad where visible messages are printed
     WINDOW *pad;
-    //! Already used lines of the window pad
+    //! Total lines of added messages
     int padline;
     //! Scroll position of the window pad
     int scroll;
@@ -115,17 +138,31 @@ call_raw_redraw(ui_t *ui);
 int
 call_raw_draw(ui_t *ui);
 
+/**
+ * @brief Add a message to call Raw
+ *
+ * Calculate the lines required to display the message after all
+ * previously added messages. Message is printed when it's visible.
+ *
+ * @param ui UI structure pointer
+ * @param msg New message to be displayed
+ * @return 0 on success, -1 otherwise
+ */
+int
+call_raw_add_msg(ui_t *ui, sip_msg_t *msg);
+
 /**
  * @brief Draw a message in call Raw
  *
- * Draw a new message in the Raw pad.
+ * Draw a message in the Raw pad starting at given line.
  *
- * @param panel Ncurses panel pointer
- * @param msg New message to be printed
+ * @param ui UI structure pointer
+ * @param msg Message to be printed
+ * @param line Pad line where message header is printed
  * @return 0 in call cases
  */
 int
-call_raw_print_msg(ui_t *ui, sip_msg_t *msg);
+call_raw_print_msg(ui_t *ui, sip_msg_t *msg, int line);
 
 /**
  * @brief Handle Call Raw key strokes
@@ -35,9 +35,13 @@
 #include <math.h>
 #include <stdlib.h>
 #include <locale.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 #include "setting.h"
 #include "ui_manager.h"
 #include "capture.h"
+#include "metrics.h"
 #include "ui_call_list.h"
 #include "ui_call_flow.h"
 #include "ui_call_raw.h"
@@ -63,7 +67,8 @@ static ui_t *panel_pool[] = {
     &ui_msg_diff,
     &ui_column_select,
     &ui_settings,
-    &ui_stats
+    &ui_stats,
+    &ui_timing
 };
 
 int
@@ -185,12 +190,63 @@ ui_find_by_type(enum panel_types type)
     return NULL;
 }
 
+/**
+ * @brief Get current monotonic time in milliseconds
+ */
+static long
+ui_time_msec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief Wait until a key is pressed or the panel must be refreshed
+ *
+ * Call changes are notified by call storage, so the interface only
+ * wakes up when there is something to draw. Changes received shortly
+ * after a refresh are merged into the next one.
+ *
+ * @param last time of last refresh in milliseconds
+ */
+static void
+ui_wait_for_event(long last)
+{
+    struct pollfd fds[2];
+    long elapsed;
+
+    fds[0].fd = STDIN_FILENO;
+    fds[0].events = POLLIN;
+    fds[1].fd = sip_calls_notify_fd();
+
+    while ((elapsed = ui_time_msec() - last) < REFRESH_IDLE_MSEC) {
+        // Ignore call changes until minimum refresh time has passed
+        fds[1].events = (elapsed < REFRESH_MIN_MSEC) ? 0 : POLLIN;
+        fds[0].revents = fds[1].revents = 0;
+
+        if (poll(fds, 2, (fds[1].events ? REFRESH_IDLE_MSEC : REFRESH_MIN_MSEC) - elapsed) < 0)
+            return;
+
+        // Key pressed, handle it first
+        if (fds[0].revents)
+            return;
+
+        // Calls have changed, consume notification before redraw
+        if (fds[1].revents) {
+            sip_calls_notify_clear();
+            return;
+        }
+    }
+}
+
 int
 ui_wait_for_input()
 {
     ui_t *ui;
     WINDOW *win;
     PANEL *panel;
+    long last;
 
     // While there are still panels
     while ((panel = panel_below(NULL))) {
@@ -198,12 +254,13 @@ ui_wait_for_input()
         if (was_sigterm_received())
             return 0;
 
+        // Print stages timing when requested with SIGUSR1
+        if (was_sigusr1_received())
+            metrics_timing_dump(stderr);
+
         // Get panel interface structure
         ui = ui_find_by_panel(panel);
 
-        // Set character input timeout 200 ms
-        halfdelay(REFRESHTHSECS);
-
         // Avoid parsing any packet while UI is being drawn
         capture_lock();
         // Query the interface if it needs to be redrawn
@@ -216,9 +273,10 @@ ui_wait_for_input()
         }
         capture_unlock();
 
-        // Update panel stack
+        // Update panel stack (terminal output is done without lock)
         update_panels();
         doupdate();
+        last = ui_time_msec();
 
         // Get topmost panel
         panel = panel_below(NULL);
@@ -227,6 +285,10 @@ ui_wait_for_input()
         win = panel_window(panel);
         keypad(win, TRUE);
 
+        // Wait for keys or call changes, input is read without blocking
+        ui_wait_for_event(last);
+        wtimeout(win, 0);
+
         // Get pressed key
         int c = wgetch(win);
 
@@ -352,7 +414,7 @@ draw_message(WINDOW *win, sip_msg_t *msg)
 int
 draw_message_pos(WINDOW *win, sip_msg_t *msg, int starting)
 {
-    int height, width, line, column, i;
+    int height, width, line, column, i, len;
     const char *cur_line, *payload, *method = NULL;
     int syntax = setting_enabled(SETTING_SYNTAX);
     const char *nonascii = setting_get_value(SETTING_CR_NON_ASCII);
@@ -376,7 +438,8 @@ draw_message_pos(WINDOW *win, sip_msg_t *msg, int starting)
     // Print msg payload
     line = starting;
     column = 0;
-    for (i = 0; i < strlen(payload); i++) {
+    len = strlen(payload);
+    for (i = 0; i < len; i++) {
         // If syntax highlighting is enabled
         if (syntax) {
             // First line highlight
@@ -43,8 +43,10 @@
 #include "keybinding.h"
 #include "setting.h"
 
-//! Refresh UI every 200 ms
-#define REFRESHTHSECS   2
+//! Refresh UI every second when there are no changes
+#define REFRESH_IDLE_MSEC   1000
+//! Merge call changes received in 100 ms into a single refresh
+#define REFRESH_MIN_MSEC    100
 //! Default dialog dimensions
 #define DIALOG_MAX_WIDTH 100
 #define DIALOG_MIN_WIDTH 40
@@ -61,6 +63,7 @@ extern ui_t ui_msg_diff;
 extern ui_t ui_column_select;
 extern ui_t ui_settings;
 extern ui_t ui_stats;
+extern ui_t ui_timing;
 
 /**
  * @brief Initialize ncurses mode
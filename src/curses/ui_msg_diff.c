@@ -30,6 +30,7 @@
 #include <string.h>
 #include "ui_msg_diff.h"
 #include "option.h"
+#include "hash.h"
 
 /***
  *
@@ -52,6 +53,21 @@
  *
  */
 
+//! Shorter declaration of msg_diff_line structure
+typedef struct msg_diff_line msg_diff_line_t;
+
+/**
+ * @brief Complete line of a compared payload
+ */
+struct msg_diff_line {
+    //! Line first character
+    const char *start;
+    //! Line length including its line feed
+    size_t len;
+    //! Line content hash
+    uint64_t hash;
+};
+
 /**
  * Ui Structure definition for Message Diff panel
  */
@@ -100,7 +116,11 @@ msg_diff_create(ui_t *ui)
 void
 msg_diff_destroy(ui_t *ui)
 {
-    sng_free(msg_diff_info(ui));
+    msg_diff_info_t *info = msg_diff_info(ui);
+
+    sng_free(info->one_highlight);
+    sng_free(info->two_highlight);
+    sng_free(info);
     ui_panel_destroy(ui);
 }
 
@@ -110,33 +130,77 @@ msg_diff_info(ui_t *ui)
     return (msg_diff_info_t*) panel_userptr(ui->panel);
 }
 
+static uint32_t
+msg_diff_line_hash(const void *key)
+{
+    return (uint32_t) ((const msg_diff_line_t *) key)->hash;
+}
+
+static bool
+msg_diff_line_equal(const void *key1, const void *key2)
+{
+    const msg_diff_line_t *one = key1, *two = key2;
+    return one->hash == two->hash && one->len == two->len
+           && !memcmp(one->start, two->start, one->len);
+}
+
+/**
+ * @brief Split a payload in complete lines
+ *
+ * Trailing text without line feed is not a complete line.
+ *
+ * @return allocated lines array (count is stored in lcount)
+ */
+static msg_diff_line_t *
+msg_diff_split_lines(const char *payload, int *lcount)
+{
+    msg_diff_line_t *lines;
+    const char *start, *end;
+    int count = 0;
+
+    for (start = payload; (start = strchr(start, '\n')); start++)
+        count++;
+
+    if (!(lines = sng_malloc(sizeof(msg_diff_line_t) * (count + 1))))
+        return NULL;
+
+    for (count = 0, start = payload; (end = strchr(start, '\n')); start = end + 1, count++) {
+        lines[count].start = start;
+        lines[count].len = end - start + 1;
+        lines[count].hash = hash_mem64(start, lines[count].len);
+    }
+
+    *lcount = count;
+    return lines;
+}
+
 int
 msg_diff_line_highlight(const char* payload1, const char* payload2, char *highlight)
 {
-    char search[MAX_SIP_PAYLOAD];
-    int len, i;
-
-    // Initialize search terms
-    memset(search, 0, sizeof(search));
-    len = 0;
-
-    for (i = 0; i < strlen(payload1); i++) {
-        // Store this char in the search term
-        search[len++] = payload1[i];
-        // If we have a full line in search array
-        if (payload1[i] == '\n') {
-            // Check if this line is in the other payload
-            if (strstr(payload2, search) == NULL) {
-                // Highlight this line as different from the other payload
-                memset(highlight + i - len + 1, '1', len);
-            }
-
-            // Reset search terms
-            memset(search, 0, sizeof(search));
-            len = 0;
-        }
+    msg_diff_line_t *lines1, *lines2;
+    htable_t *others;
+    int count1 = 0, count2 = 0, i;
+
+    lines1 = msg_diff_split_lines(payload1, &count1);
+    lines2 = msg_diff_split_lines(payload2, &count2);
+    others = htable_create_custom(count2, msg_diff_line_hash, msg_diff_line_equal);
+    if (!lines1 || !lines2 || !others)
+        goto done;
+
+    // Store all lines of the other payload
+    for (i = 0; i < count2; i++)
+        htable_insert(others, &lines2[i], &lines2[i]);
+
+    // Highlight lines not found in the other payload
+    for (i = 0; i < count1; i++) {
+        if (!htable_find(others, &lines1[i]))
+            memset(highlight + (lines1[i].start - payload1), '1', lines1[i].len);
     }
 
+done:
+    htable_destroy(others);
+    sng_free(lines1);
+    sng_free(lines2);
     return 0;
 }
 
@@ -156,16 +220,11 @@ msg_diff_draw(ui_t *ui)
 {
     // Get panel information
     msg_diff_info_t *info = msg_diff_info(ui);
-    char highlight[MAX_SIP_PAYLOAD];
 
     // Draw first message
-    memset(highlight, 0, sizeof(highlight));
-    msg_diff_line_highlight(msg_get_payload(info->one), msg_get_payload(info->two), highlight);
-    msg_diff_draw_message(info->one_win, info->one, highlight);
+    msg_diff_draw_message(info->one_win, info->one, info->one_highlight);
     // Draw second message
-    memset(highlight, 0, sizeof(highlight));
-    msg_diff_line_highlight(msg_get_payload(info->two), msg_get_payload(info->one), highlight);
-    msg_diff_draw_message(info->two_win, info->two, highlight);
+    msg_diff_draw_message(info->two_win, info->two, info->two_highlight);
 
     // Redraw footer
     msg_diff_draw_footer(ui);
@@ -176,7 +235,7 @@ msg_diff_draw(ui_t *ui)
 int
 msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight)
 {
-    int height, width, line, column, i;
+    int height, width, line, column, i, len;
     char header[MAX_SIP_PAYLOAD];
     const char * payload = msg_get_payload(msg);
 
@@ -193,7 +252,8 @@ msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight)
     // Print msg payload
     line = 2;
     column = 0;
-    for (i = 0; i < strlen(payload); i++) {
+    len = strlen(payload);
+    for (i = 0; i < len; i++) {
         if (payload[i] == '\r')
             continue;
 
@@ -206,7 +266,7 @@ msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight)
         if (line == height)
             break;
 
-        if (highlight[i] == '1') {
+        if (highlight && highlight[i] == '1') {
             wattron(win, COLOR_PAIR(CP_YELLOW_ON_DEF));
         } else {
             wattroff(win, COLOR_PAIR(CP_YELLOW_ON_DEF));
@@ -222,6 +282,23 @@ msg_diff_draw_message(WINDOW *win, sip_msg_t *msg, char *highlight)
     return 0;
 }
 
+/**
+ * @brief Get the highlighted characters of a message compared to another
+ *
+ * @return allocated highlight array with payload length
+ */
+static char *
+msg_diff_highlight(sip_msg_t *msg, sip_msg_t *other)
+{
+    const char *payload = msg_get_payload(msg);
+    char *highlight;
+
+    if ((highlight = sng_malloc(strlen(payload) + 1)))
+        msg_diff_line_highlight(payload, msg_get_payload(other), highlight);
+
+    return highlight;
+}
+
 int
 msg_diff_set_msgs(ui_t *ui, sip_msg_t *one, sip_msg_t *two)
 {
@@ -232,6 +309,12 @@ msg_diff_set_msgs(ui_t *ui, sip_msg_t *one, sip_msg_t *two)
     info->one = one;
     info->two = two;
 
+    // Different lines only change with the compared messages
+    sng_free(info->one_highlight);
+    sng_free(info->two_highlight);
+    info->one_highlight = msg_diff_highlight(one, two);
+    info->two_highlight = msg_diff_highlight(two, one);
+
     return 0;
 }
 
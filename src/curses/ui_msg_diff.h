@@ -49,6 +49,10 @@ struct msg_diff_info {
     WINDOW *one_win;
     //! Right displayed subwindow
     WINDOW *two_win;
+    //! Lines of first message not found in the second one
+    char *one_highlight;
+    //! Lines of second message not found in the first one
+    char *two_highlight;
 };
 
 /**
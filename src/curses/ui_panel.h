@@ -74,6 +74,8 @@ enum panel_types {
     PANEL_SETTINGS,
     //! Stats panel
     PANEL_STATS,
+    //! Stage timing panel
+    PANEL_TIMING,
     //! Panel Counter
     PANEL_COUNT,
 };
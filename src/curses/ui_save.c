@@ -33,10 +33,12 @@
 #include <errno.h>
 #include <form.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "ui_save.h"
 #include "setting.h"
 #include "capture.h"
 #include "filter.h"
+#include "storage.h"
 
 /**
  * Ui Structure definition for Save panel
@@ -405,21 +407,306 @@ save_set_msg(ui_t *ui, sip_msg_t *msg)
     field_opts_on(info->fields[FLD_SAVE_MESSAGE], O_VISIBLE);
 }
 
+/**
+ * @brief Check if a run must be saved before another one
+ */
+static bool
+save_run_before(save_run_t *one, save_run_t *two)
+{
+    return one->ts < two->ts;
+}
+
+/**
+ * @brief Get the next packet to be saved from a run
+ */
+static packet_t *
+save_run_packet(save_run_t *run)
+{
+    void *item = vector_item(run->items, run->pos);
+    return (run->msgs) ? ((sip_msg_t *) item)->packet : item;
+}
+
+/**
+ * @brief Move a run down in the heap until it is sorted
+ */
+static void
+save_heap_down(save_job_t *job, int pos)
+{
+    save_run_t *run = job->heap[pos];
+    int child;
+
+    while ((child = pos * 2 + 1) < job->heapcnt) {
+        if (child + 1 < job->heapcnt && save_run_before(job->heap[child + 1], job->heap[child]))
+            child++;
+        if (!save_run_before(job->heap[child], run))
+            break;
+        job->heap[pos] = job->heap[child];
+        pos = child;
+    }
+    job->heap[pos] = run;
+}
+
+/**
+ * @brief Add a call packets vector to the save job
+ */
+static void
+save_job_add_run(save_job_t *job, vector_t *items, bool msgs)
+{
+    save_run_t *run = &job->runs[job->heapcnt];
+
+    if (!vector_count(items))
+        return;
+
+    run->items = items;
+    run->msgs = msgs;
+    run->count = vector_count(items);
+    run->pos = 0;
+    run->ts = packet_time_ns(save_run_packet(run));
+    job->heap[job->heapcnt++] = run;
+    job->total += run->count;
+}
+
+/**
+ * @brief Destroy a finished save job
+ *
+ * This must be invoked with capture locked, so calls can be unlocked.
+ */
+static void
+save_job_destroy(save_job_t *job)
+{
+    int i;
+
+    // Restore calls locked flag
+    for (i = 0; i < job->callcnt; i++)
+        CALL_SLOT(job->calls[i], locked) = job->locked[i];
+
+    // Close saved file
+    if (job->pd)
+        dump_close(job->pd);
+    if (job->f)
+        fclose(job->f);
+
+    sng_free(job->calls);
+    sng_free(job->locked);
+    sng_free(job->runs);
+    sng_free(job->heap);
+    sng_free(job);
+}
+
+/**
+ * @brief Create a save job for the given calls
+ *
+ * This must be invoked with capture locked. Calls are locked until the
+ * job is destroyed.
+ */
+static save_job_t *
+save_job_create(vector_iter_t *calls, enum save_format format, pcap_dumper_t *pd, FILE *f)
+{
+    save_job_t *job;
+    sip_call_t *call;
+    int count = vector_iterator_count(calls), i;
+
+    if (!(job = sng_malloc(sizeof(save_job_t))))
+        return NULL;
+
+    job->format = format;
+    job->pd = pd;
+    job->f = f;
+    job->calls = sng_malloc(sizeof(sip_call_t *) * (count + 1));
+    job->locked = sng_malloc(sizeof(bool) * (count + 1));
+    job->runs = sng_malloc(sizeof(save_run_t) * (count * 2 + 1));
+    job->heap = sng_malloc(sizeof(save_run_t *) * (count * 2 + 1));
+    if (!job->calls || !job->locked || !job->runs || !job->heap) {
+        // Files are closed by the caller
+        job->pd = NULL;
+        job->f = NULL;
+        save_job_destroy(job);
+        return NULL;
+    }
+
+    vector_iterator_reset(calls);
+    while ((call = vector_iterator_next(calls)) && job->callcnt < count) {
+        // Avoid rotating saved calls
+        job->calls[job->callcnt] = call;
+        job->locked[job->callcnt++] = CALL_SLOT(call, locked);
+        CALL_SLOT(call, locked) = true;
+
+        // Only packets received until now will be saved
+        if (format != SAVE_TXT) {
+            save_job_add_run(job, call->msgs, true);
+            if (format == SAVE_PCAP_RTP)
+                save_job_add_run(job, call->rtp_packets, false);
+        }
+    }
+
+    // Text files are saved one dialog at a time
+    if (format == SAVE_TXT)
+        job->total = job->callcnt;
+
+    // Sort runs by their first packet time
+    for (i = job->heapcnt / 2 - 1; i >= 0; i--)
+        save_heap_down(job, i);
+
+    return job;
+}
+
+/**
+ * @brief Copy next packets to be saved in time order
+ *
+ * This must be invoked with capture locked. Runs are merged picking the
+ * run with the oldest next packet from the heap.
+ *
+ * @return number of items processed
+ */
+static int
+save_job_next_packets(save_job_t *job, packet_t **packets, int *count)
+{
+    save_run_t *run;
+    packet_t *packet;
+    int done = 0;
+
+    *count = 0;
+    while (*count < SAVE_CHUNK && job->heapcnt) {
+        run = job->heap[0];
+        packet = save_run_packet(run);
+        done++;
+
+        // Expand compressed frames if required
+        if (storage_packet_load(packet) == 0)
+            packets[(*count)++] = packet_clone(packet);
+
+        // Update run position in the heap
+        if (++run->pos < run->count) {
+            run->ts = packet_time_ns(save_run_packet(run));
+        } else {
+            job->heap[0] = job->heap[--job->heapcnt];
+        }
+        if (job->heapcnt)
+            save_heap_down(job, 0);
+    }
+
+    return done;
+}
+
+/**
+ * @brief Write next dialog of a text save job
+ *
+ * This must be invoked with capture locked.
+ *
+ * @return number of dialogs saved
+ */
+static int
+save_job_next_txt(save_job_t *job)
+{
+    sip_call_t *call;
+    sip_msg_t *msg;
+    rtp_stream_t *stream;
+    vector_iter_t it;
+
+    if (job->done >= job->callcnt)
+        return 0;
+
+    call = job->calls[job->done];
+
+    // Save SIP message content
+    it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it)))
+        save_msg_txt(job->f, msg);
+
+    // Save RTP streams quality
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it)))
+        save_stream_txt(job->f, stream);
+
+    return 1;
+}
+
+/**
+ * @brief Save job thread function
+ *
+ * Packets are copied with capture locked and written to the file
+ * with capture unlocked.
+ */
+static void *
+save_job_thread(void *arg)
+{
+    save_job_t *job = (save_job_t *) arg;
+    packet_t *packets[SAVE_CHUNK];
+    frame_t *frame;
+    vector_iter_t it;
+    int done, count, i;
+
+    while (!__atomic_load_n(&job->cancel, __ATOMIC_ACQUIRE)) {
+        count = 0;
+        capture_lock();
+        if (job->format == SAVE_TXT) {
+            done = save_job_next_txt(job);
+        } else {
+            done = save_job_next_packets(job, packets, &count);
+        }
+        capture_unlock();
+
+        // Write copied packets
+        for (i = 0; i < count; i++) {
+            it = vector_iterator(packets[i]->frames);
+            while ((frame = vector_iterator_next(&it)))
+                pcap_dump((u_char *) job->pd, frame->header, frame->data);
+            packet_destroy(packets[i]);
+        }
+
+        if (done == 0)
+            break;
+        __atomic_add_fetch(&job->done, done, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&job->finished, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/**
+ * @brief Display save job progress until it finishes
+ *
+ * The user can cancel the save pressing the previous screen key.
+ */
+static void
+save_job_wait(save_job_t *job)
+{
+    WINDOW *progress;
+    int key, action;
+
+    progress = dialog_progress_run("Saving dialogs... Press %s to cancel",
+                                   key_action_key_str(ACTION_PREV_SCREEN));
+    wtimeout(progress, 100);
+
+    while (!__atomic_load_n(&job->finished, __ATOMIC_ACQUIRE)) {
+        dialog_progress_set_value(progress, job->total ?
+                                  __atomic_load_n(&job->done, __ATOMIC_ACQUIRE) * 100 / job->total : 0);
+
+        if ((key = wgetch(progress)) == ERR)
+            continue;
+
+        action = -1;
+        while ((action = key_find_action(key, action)) != ERR) {
+            if (action == ACTION_PREV_SCREEN)
+                __atomic_store_n(&job->cancel, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    dialog_progress_destroy(progress);
+}
+
 int
 save_to_file(ui_t *ui)
 {
     char savepath[MAX_SETTING_LEN];
     char savefile[MAX_SETTING_LEN];
     char fullfile[MAX_SETTING_LEN*2];
-    sip_call_t *call = NULL;
-    sip_msg_t *msg = NULL;
     pcap_dumper_t *pd = NULL;
     FILE *f = NULL;
-    int cur = 0, total = 0;
-    WINDOW *progress;
-    vector_iter_t calls, msgs, rtps, packets;
-    packet_t *packet;
-    vector_t *sorted;
+    vector_iter_t calls;
+    save_job_t *job;
+    int callcnt;
+    bool cancel;
 
     // Get panel information
     save_info_t *info = save_info(ui);
@@ -478,12 +765,24 @@ save_to_file(ui_t *ui)
         }
     }
 
+    // Save a single message
+    if (info->savemode == SAVE_MESSAGE) {
+        if (info->saveformat == SAVE_TXT) {
+            // Save selected message to file
+            save_msg_txt(f, info->msg);
+            fclose(f);
+        } else {
+            // Save selected message packet to pcap
+            storage_packet_load(info->msg->packet);
+            dump_packet(pd, info->msg->packet);
+            dump_close(pd);
+        }
+        dialog_run("Successfully saved selected SIP message to %s", savefile);
+        return 0;
+    }
+
     // Get calls iterator
     switch (info->savemode) {
-        case SAVE_ALL:
-            // Get calls iterator
-            calls = sip_calls_iterator();
-            break;
         case SAVE_SELECTED:
             // Save selected packets to file
             calls = vector_iterator(info->group->calls);
@@ -494,84 +793,41 @@ save_to_file(ui_t *ui)
             vector_iterator_set_filter(&calls, filter_check_call);
             break;
         default:
+            // Get calls iterator
+            calls = sip_calls_iterator();
             break;
     }
 
-    if (info->savemode == SAVE_MESSAGE) {
-        if (info->saveformat == SAVE_TXT) {
-            // Save selected message to file
-            save_msg_txt(f, info->msg);
+    // Save calls in a background thread
+    if (!(job = save_job_create(&calls, info->saveformat, pd, f))
+        || pthread_create(&job->thread, NULL, save_job_thread, job) != 0) {
+        if (job) {
+            save_job_destroy(job);
+        } else if (pd) {
+            dump_close(pd);
         } else {
-            // Save selected message packet to pcap
-            dump_packet(pd, info->msg->packet);
+            fclose(f);
         }
-    } else if (info->saveformat == SAVE_TXT) {
-        // Save selected packets to file
-        while ((call = vector_iterator_next(&calls))) {
-            msgs = vector_iterator(call->msgs);
-            // Save SIP message content
-            while ((msg = vector_iterator_next(&msgs))) {
-                save_msg_txt(f, msg);
-            }
-        }
-    } else {
-        // Store all messages in a time sorted vector
-        sorted = vector_create(100, 50);
-        vector_set_sorter(sorted, capture_packet_time_sorter);
-
-        // Count packages for progress bar
-        while ((call = vector_iterator_next(&calls))) {
-            total += vector_count(call->msgs);
-            if (info->saveformat == SAVE_PCAP_RTP)
-                total += vector_count(call->rtp_packets);
-        }
-        vector_iterator_reset(&calls);
-
-        progress = dialog_progress_run("Saving packets...");
-        dialog_progress_set_value(progress, 0);
-
-        // Save selected packets to file
-        while ((call = vector_iterator_next(&calls))) {
-            msgs = vector_iterator(call->msgs);
-            // Save SIP message content
-            while ((msg = vector_iterator_next(&msgs))) {
-                // Update progress bar dialog
-                dialog_progress_set_value(progress, (++cur * 100) / total);
-                vector_append(sorted, msg->packet);
-            }
-
-            // Save RTP packets
-            if (info->saveformat == SAVE_PCAP_RTP) {
-                rtps = vector_iterator(call->rtp_packets);
-                while ((packet = vector_iterator_next(&rtps))) {
-                    // Update progress bar dialog
-                    dialog_progress_set_value(progress, (++cur * 100) / total);
-                    vector_append(sorted, packet);
-                }
-            }
-        }
-
-        // Save sorted packets
-        packets = vector_iterator(sorted);
-        while ((packet = vector_iterator_next(&packets))) {
-            dump_packet(pd, packet);
-        }
-
-        dialog_progress_destroy(progress);
+        dialog_run("Unable to start saving dialogs to %s", savefile);
+        return 1;
     }
 
-    // Close saved file
-    if (info->saveformat == SAVE_PCAP || info->saveformat == SAVE_PCAP_RTP) {
-        dump_close(pd);
-    } else {
-        fclose(f);
-    }
+    // Let capture continue while file is being written
+    capture_unlock();
+    save_job_wait(job);
+    capture_lock();
 
-    // Show success popup
-    if (info->savemode == SAVE_MESSAGE) {
-      dialog_run("Successfully saved selected SIP message to %s", savefile);
+    pthread_join(job->thread, NULL);
+    callcnt = job->callcnt;
+    cancel = job->cancel;
+    save_job_destroy(job);
+
+    // Show result popup
+    if (cancel) {
+        unlink(fullfile);
+        dialog_run("Saving to %s has been cancelled", savefile);
     } else {
-      dialog_run("Successfully saved %d dialogs to %s", vector_iterator_count(&calls), savefile);
+        dialog_run("Successfully saved %d dialogs to %s", callcnt, savefile);
     }
 
     return 0;
@@ -589,3 +845,22 @@ save_msg_txt(FILE *f, sip_msg_t *msg)
             msg_get_attribute(msg, SIP_ATTR_DST, dst),
             msg_get_payload(msg));
 }
+
+void
+save_stream_txt(FILE *f, rtp_stream_t *stream)
+{
+    char src[ADDRESSLEN], dst[ADDRESSLEN];
+
+    // Only RTP streams with received packets have quality metrics
+    if (stream->type != PACKET_RTP || !stream_get_count(stream))
+        return;
+
+    fprintf(f, "RTP %s:%u -> %s:%u %s packets %u lost %u out-of-order %u "
+            "jitter %.1fms max-delta %ums bitrate %ubps\n\n",
+            address_get_ip(stream->src, src), stream->src.port,
+            address_get_ip(stream->dst, dst), stream->dst.port,
+            stream_get_format(stream) ? stream_get_format(stream) : "unknown",
+            stream_get_count(stream), stream_get_lost(stream),
+            stream->rtpinfo.stats.out_of_order, stream_get_jitter(stream),
+            stream->rtpinfo.stats.max_delta, stream_get_bitrate(stream));
+}
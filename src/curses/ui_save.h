@@ -34,7 +34,9 @@
 #define __UI_SAVE_PCAP_H
 #include "config.h"
 #include <form.h>
+#include <pthread.h>
 #include "group.h"
+#include "capture.h"
 #include "ui_manager.h"
 
 /**
@@ -77,8 +79,72 @@ enum save_format {
     SAVE_TXT
 };
 
+//! Max packets copied on each save step while capture is locked
+#define SAVE_CHUNK 256
+
 //! Sorter declaration of struct save_info
 typedef struct save_info save_info_t;
+//! Sorter declaration of struct save_run
+typedef struct save_run save_run_t;
+//! Sorter declaration of struct save_job
+typedef struct save_job save_job_t;
+
+/**
+ * @brief Packets of a call to be saved
+ *
+ * Messages and RTP packets of a call are stored in arrival order, so
+ * all calls runs are merged to write the packets in time order.
+ */
+struct save_run {
+    //! Call messages or RTP packets vector
+    vector_t *items;
+    //! Items of this run are SIP messages
+    bool msgs;
+    //! Number of items when save started
+    int count;
+    //! Next item to be saved
+    int pos;
+    //! Time of next item to be saved (ns)
+    uint64_t ts;
+};
+
+/**
+ * @brief Background save of multiple dialogs
+ *
+ * Saved calls are locked so they are not rotated while saving. The
+ * saving thread only reads them with capture locked, copying a few
+ * packets each time, so capture continues while the file is written.
+ */
+struct save_job {
+    //! Thread writing the file
+    pthread_t thread;
+    //! Save format @see save_formats
+    enum save_format format;
+    //! Dump file for pcap formats
+    pcap_dumper_t *pd;
+    //! Text file for txt format
+    FILE *f;
+    //! Calls being saved
+    sip_call_t **calls;
+    //! Locked flag of each call before saving
+    bool *locked;
+    //! Number of calls being saved
+    int callcnt;
+    //! Runs of packets of all calls
+    save_run_t *runs;
+    //! Runs with pending packets, sorted by next packet time
+    save_run_t **heap;
+    //! Number of runs in the heap
+    int heapcnt;
+    //! Saved items (packets or calls for txt format)
+    int done;
+    //! Total items to be saved
+    int total;
+    //! Saving thread has finished
+    bool finished;
+    //! User requested to stop saving
+    bool cancel;
+};
 
 /**
  * @brief Save panel private information
@@ -217,4 +283,13 @@ save_to_file(ui_t *ui);
 void
 save_msg_txt(FILE *f, sip_msg_t *msg);
 
+/**
+ * @brief Save quality metrics of one RTP stream into open file
+ *
+ * @param f File opened with fopen
+ * @param stream a RTP stream
+ */
+void
+save_stream_txt(FILE *f, rtp_stream_t *stream);
+
 #endif
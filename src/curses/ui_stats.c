@@ -49,13 +49,21 @@
  * |  BYE:       10 (0.5%)                                   |
  * |  CANCEL:    0 (0.0%)                                    |
  * +---------------------------------------------------------+
+ * |  Received:      2450           Kernel drops: 0          |
+ * |  Queue drops:   0              Iface drops:  0          |
+ * |  Reasm drops:   0              Rejected:     12         |
+ * |  Limit skipped: 0              Output drops: 0          |
+ * +---------------------------------------------------------+
  * |               Press any key to continue                 |
  * +---------------------------------------------------------+
  *
  */
 #include "config.h"
+#include <inttypes.h>
 #include "vector.h"
 #include "sip.h"
+#include "capture.h"
+#include "memstat.h"
 #include "ui_manager.h"
 #include "ui_stats.h"
 
@@ -73,10 +81,13 @@ ui_t ui_stats = {
 void
 stats_create(ui_t *ui)
 {
-    vector_iter_t calls;
-    vector_iter_t msgs;
-    sip_call_t *call;
-    sip_msg_t *msg;
+    sip_counters_t counters;
+    capture_stats_t source, capture;
+    uint32_t backlog;
+    uint64_t output_drops;
+    uint64_t memory, memory_limit;
+    int64_t live, peak;
+    int i;
 
     // Counters!
     struct {
@@ -88,7 +99,7 @@ stats_create(ui_t *ui)
     memset(&stats, 0, sizeof(stats));
 
     // Calculate window dimensions
-    ui_panel_create(ui, 25, 60);
+    ui_panel_create(ui, 36, 60);
 
     // Set the window title and boxes
     mvwprintw(ui->win, 1, ui->width / 2 - 9, "Stats Information");
@@ -97,12 +108,57 @@ stats_create(ui_t *ui)
     mvwhline(ui->win, 10, 1, ACS_HLINE, ui->width - 1);
     mvwaddch(ui->win, 10, 0, ACS_LTEE);
     mvwaddch(ui->win, 10, ui->width - 1, ACS_RTEE);
+    mvwhline(ui->win, 22, 1, ACS_HLINE, ui->width - 1);
+    mvwaddch(ui->win, 22, 0, ACS_LTEE);
+    mvwaddch(ui->win, 22, ui->width - 1, ACS_RTEE);
+    mvwhline(ui->win, 28, 1, ACS_HLINE, ui->width - 1);
+    mvwaddch(ui->win, 28, 0, ACS_LTEE);
+    mvwaddch(ui->win, 28, ui->width - 1, ACS_RTEE);
     mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 9, "Press ESC to leave");
     wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
 
-    // Parse the data
-    calls = sip_calls_iterator();
-    stats.dtotal = vector_iterator_count(&calls);
+    // Sum packet counters of all capture sources
+    memset(&capture, 0, sizeof(capture));
+    for (i = 0; capture_source_stats(i, &source); i++) {
+        capture.received += source.received;
+        capture.kernel_drops += source.kernel_drops;
+        capture.if_drops += source.if_drops;
+        capture.queue_drops += source.queue_drops;
+        capture.reasm_drops += source.reasm_drops;
+        capture.rejected += source.rejected;
+        capture.skipped += source.skipped;
+    }
+    capture_dump_stats(&backlog, &output_drops);
+
+    // Capture counters are available even without dialogs
+    mvwprintw(ui->win, 23, 3,  "Received:      %" PRIu64, capture.received);
+    mvwprintw(ui->win, 24, 3,  "Queue drops:   %" PRIu64, capture.queue_drops);
+    mvwprintw(ui->win, 25, 3,  "Reasm drops:   %" PRIu64, capture.reasm_drops);
+    mvwprintw(ui->win, 26, 3,  "Limit skipped: %" PRIu64, capture.skipped);
+    mvwprintw(ui->win, 23, 33, "Kernel drops: %" PRIu64, capture.kernel_drops);
+    mvwprintw(ui->win, 24, 33, "Iface drops:  %" PRIu64, capture.if_drops);
+    mvwprintw(ui->win, 25, 33, "Rejected:     %" PRIu64, capture.rejected);
+    mvwprintw(ui->win, 26, 33, "Output drops: %" PRIu64, output_drops);
+
+    // Stored dialogs memory usage
+    memory = sip_calls_memory(&memory_limit);
+    mvwprintw(ui->win, 27, 3,  "Memory:        %" PRIu64 " KB", memory / 1024);
+    if (memory_limit) {
+        mvwprintw(ui->win, 27, 33, "Memory limit: %" PRIu64 " KB", memory_limit / 1024);
+    } else {
+        mvwprintw(ui->win, 27, 33, "Memory limit: none");
+    }
+
+    // Allocated memory per subsystem (live / high-water mark)
+    for (i = 0; i < MEMSTAT_COUNT; i++) {
+        memstat_get(i, &live, &peak);
+        mvwprintw(ui->win, 29 + i / 2, (i % 2) ? 33 : 3, "%-10s %6" PRId64 "/%" PRId64 " KB",
+                  memstat_name(i), live / 1024, peak / 1024);
+    }
+
+    // Stored dialogs and messages are counted as they are parsed
+    sip_calls_counters(&counters);
+    stats.dtotal = sip_calls_count();
 
     // Ignore this screen when no dialog exists
     if (!stats.dtotal) {
@@ -110,57 +166,38 @@ stats_create(ui_t *ui)
         return;
     }
 
-    while ((call = vector_iterator_next(&calls))) {
-        // If this dialog is a call
-        if (call->state) {
-            // Increase call counter
-            stats.dcalls++;
-            // Increase call status counter
-            switch (call->state) {
-                case SIP_CALLSTATE_CALLSETUP: stats.setup++; break;
-                case SIP_CALLSTATE_INCALL: stats.incall++; break;
-                case SIP_CALLSTATE_CANCELLED: stats.cancelled++; break;
-                case SIP_CALLSTATE_REJECTED: stats.rejected++; break;
-                case SIP_CALLSTATE_BUSY: stats.busy++; break;
-                case SIP_CALLSTATE_DIVERTED: stats.diverted++; break;
-                case SIP_CALLSTATE_COMPLETED: stats.completed++; break;
-            }
-        }
-        // For each message in call
-        msgs = vector_iterator(call->msgs);
-        while ((msg = vector_iterator_next(&msgs))) {
-            // Increase message counter
-            stats.mtotal++;
-            // Check message type
-            switch (msg->reqresp) {
-                case SIP_METHOD_REGISTER: stats.regist++; break;
-                case SIP_METHOD_INVITE: stats.invite++; break;
-                case SIP_METHOD_SUBSCRIBE: stats.subscribe++; break;
-                case SIP_METHOD_NOTIFY: stats.notify++; break;
-                case SIP_METHOD_OPTIONS: stats.options++; break;
-                case SIP_METHOD_PUBLISH: stats.publish++; break;
-                case SIP_METHOD_MESSAGE: stats.message++; break;
-                case SIP_METHOD_CANCEL: stats.cancel++; break;
-                case SIP_METHOD_BYE: stats.bye++; break;
-                case SIP_METHOD_ACK: stats.ack++; break;
-                // case SIP_METHOD_PRACK:
-                case SIP_METHOD_INFO: stats.info++; break;
-                // case SIP_METHOD_REFER:
-                case SIP_METHOD_UPDATE: stats.update++; break;
-                default:
-                    if (msg->reqresp >= 800) stats.r800++;
-                    else if (msg->reqresp >= 700) stats.r700++;
-                    else if (msg->reqresp >= 600) stats.r600++;
-                    else if (msg->reqresp >= 500) stats.r500++;
-                    else if (msg->reqresp >= 400) stats.r400++;
-                    else if (msg->reqresp >= 300) stats.r300++;
-                    else if (msg->reqresp >= 200) stats.r200++;
-                    else if (msg->reqresp >= 100) stats.r100++;
-            }
-        }
+    // Dialogs with a call state are calls
+    stats.dcalls = stats.dtotal - counters.states[0];
+    stats.setup = counters.states[SIP_CALLSTATE_CALLSETUP];
+    stats.incall = counters.states[SIP_CALLSTATE_INCALL];
+    stats.cancelled = counters.states[SIP_CALLSTATE_CANCELLED];
+    stats.rejected = counters.states[SIP_CALLSTATE_REJECTED];
+    stats.busy = counters.states[SIP_CALLSTATE_BUSY];
+    stats.diverted = counters.states[SIP_CALLSTATE_DIVERTED];
+    stats.completed = counters.states[SIP_CALLSTATE_COMPLETED];
 
-
-    }
+    // Requests are counted by method and responses by class
+    stats.mtotal = counters.msgs;
+    stats.regist = counters.reqresp[SIP_METHOD_REGISTER];
+    stats.invite = counters.reqresp[SIP_METHOD_INVITE];
+    stats.subscribe = counters.reqresp[SIP_METHOD_SUBSCRIBE];
+    stats.notify = counters.reqresp[SIP_METHOD_NOTIFY];
+    stats.options = counters.reqresp[SIP_METHOD_OPTIONS];
+    stats.publish = counters.reqresp[SIP_METHOD_PUBLISH];
+    stats.message = counters.reqresp[SIP_METHOD_MESSAGE];
+    stats.cancel = counters.reqresp[SIP_METHOD_CANCEL];
+    stats.bye = counters.reqresp[SIP_METHOD_BYE];
+    stats.ack = counters.reqresp[SIP_METHOD_ACK];
+    stats.info = counters.reqresp[SIP_METHOD_INFO];
+    stats.update = counters.reqresp[SIP_METHOD_UPDATE];
+    stats.r100 = counters.reqresp[101];
+    stats.r200 = counters.reqresp[102];
+    stats.r300 = counters.reqresp[103];
+    stats.r400 = counters.reqresp[104];
+    stats.r500 = counters.reqresp[105];
+    stats.r600 = counters.reqresp[106];
+    stats.r700 = counters.reqresp[107];
+    stats.r800 = counters.reqresp[108] + counters.reqresp[109];
 
     // Print parses data
     mvwprintw(ui->win, 3,  3,  "Dialogs: %d", stats.dtotal);
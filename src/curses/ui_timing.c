@@ -0,0 +1,158 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_timing.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in ui_timing.h
+ */
+/*
+ * +---------------------------------------------------------------------------+
+ * |                            Timing Information                             |
+ * +---------------------------------------------------------------------------+
+ * |  Stage              Count       Avg       p50       p90       p99      Max |
+ * |  ip_reasm          120000     180ns     256ns     256ns     512ns    2.0us |
+ * |  tcp_reasm           1500     1.2us     2.0us     4.1us     8.2us   16.4us |
+ * |  ...                                                                      |
+ * +---------------------------------------------------------------------------+
+ * |  Timing: enabled, measuring 1 of each 1 events                            |
+ * +---------------------------------------------------------------------------+
+ * |       Press Space to toggle timing, Ctrl-U to reset, ESC to leave         |
+ * +---------------------------------------------------------------------------+
+ *
+ */
+#include "config.h"
+#include <inttypes.h>
+#include "metrics.h"
+#include "ui_manager.h"
+#include "ui_timing.h"
+
+/**
+ * Ui Structure definition for Timing panel
+ */
+ui_t ui_timing = {
+    .type = PANEL_TIMING,
+    .panel = NULL,
+    .create = timing_create,
+    .destroy = ui_panel_destroy,
+    .draw = timing_draw,
+    .handle_key = timing_handle_key
+};
+
+/**
+ * @brief Format a time in nanoseconds with a readable unit
+ */
+static const char *
+timing_format(uint64_t nsec, char *out)
+{
+    if (nsec < 1000) {
+        sprintf(out, "%" PRIu64 "ns", nsec);
+    } else if (nsec < 1000000) {
+        sprintf(out, "%.1fus", nsec / 1000.0);
+    } else if (nsec < 1000000000) {
+        sprintf(out, "%.1fms", nsec / 1000000.0);
+    } else {
+        sprintf(out, "%.1fs", nsec / 1000000000.0);
+    }
+    return out;
+}
+
+void
+timing_create(ui_t *ui)
+{
+    // Calculate window dimensions
+    ui_panel_create(ui, METRICS_STAGE_COUNT + 10, 77);
+
+    // Set the window title and boxes
+    mvwprintw(ui->win, 1, ui->width / 2 - 9, "Timing Information");
+    wattron(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+    title_foot_box(ui->panel);
+    mvwhline(ui->win, METRICS_STAGE_COUNT + 4, 1, ACS_HLINE, ui->width - 1);
+    mvwaddch(ui->win, METRICS_STAGE_COUNT + 4, 0, ACS_LTEE);
+    mvwaddch(ui->win, METRICS_STAGE_COUNT + 4, ui->width - 1, ACS_RTEE);
+    mvwprintw(ui->win, ui->height - 2, ui->width / 2 - 32,
+              "Press Space to toggle timing, Ctrl-U to reset, ESC to leave");
+    wattroff(ui->win, COLOR_PAIR(CP_BLUE_ON_DEF));
+
+    wattron(ui->win, A_BOLD);
+    mvwprintw(ui->win, 3, 3, "%-14s %10s %9s %9s %9s %9s %9s",
+              "Stage", "Count", "Avg", "p50", "p90", "p99", "Max");
+    wattroff(ui->win, A_BOLD);
+}
+
+int
+timing_draw(ui_t *ui)
+{
+    metrics_timing_t timing;
+    char avg[16], p50[16], p90[16], p99[16], max[16];
+    int i;
+
+    for (i = 0; i < METRICS_STAGE_COUNT; i++) {
+        metrics_timing_get(i, &timing);
+        mvwprintw(ui->win, 4 + i, 3, "%-14s %10" PRIu64 " %9s %9s %9s %9s %9s",
+                  metrics_stage_name(i), timing.count,
+                  timing_format(timing.count ? timing.sum / timing.count : 0, avg),
+                  timing_format(timing.p50, p50), timing_format(timing.p90, p90),
+                  timing_format(timing.p99, p99), timing_format(timing.max, max));
+    }
+
+    wmove(ui->win, METRICS_STAGE_COUNT + 5, 3);
+    wclrtoeol(ui->win);
+    if (metrics_timing_enabled()) {
+        mvwprintw(ui->win, METRICS_STAGE_COUNT + 5, 3, "Timing: enabled, measuring 1 of each %d events",
+                  setting_get_intvalue(SETTING_CAPTURE_TIMING_SAMPLE));
+    } else {
+        mvwprintw(ui->win, METRICS_STAGE_COUNT + 5, 3, "Timing: disabled");
+    }
+    mvwaddch(ui->win, METRICS_STAGE_COUNT + 5, ui->width - 1, ACS_VLINE);
+
+    return 0;
+}
+
+int
+timing_handle_key(ui_t *ui, int key)
+{
+    int action = -1;
+
+    // Check actions for this key
+    while ((action = key_find_action(key, action)) != ERR) {
+        // Check if we handle this action
+        switch (action) {
+            case ACTION_SELECT:
+                metrics_timing_enable(!metrics_timing_enabled(),
+                                      setting_get_intvalue(SETTING_CAPTURE_TIMING_SAMPLE));
+                break;
+            case ACTION_CLEAR:
+                metrics_timing_reset();
+                break;
+            default:
+                // Parse next action
+                continue;
+        }
+
+        // This panel has handled the key successfully
+        break;
+    }
+
+    // Return if this panel has handled or not the key
+    return (action == ERR) ? KEY_NOT_HANDLED : KEY_HANDLED;
+}
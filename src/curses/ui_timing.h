@@ -0,0 +1,65 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file ui_timing.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage ui window for stage timing display
+ */
+#ifndef __SNGREP_UI_TIMING_H
+#define __SNGREP_UI_TIMING_H
+
+/**
+ * @brief Creates a new timing panel
+ *
+ * This function allocates all required memory for
+ * displaying the timing panel and draws its static
+ * information.
+ *
+ * @param ui UI structure pointer
+ */
+void
+timing_create(ui_t *ui);
+
+/**
+ * @brief Draw the measured timing of each stage
+ *
+ * @param ui UI structure pointer
+ * @return 0 if the panel has been drawn, -1 otherwise
+ */
+int
+timing_draw(ui_t *ui);
+
+/**
+ * @brief Manage pressed keys for timing panel
+ *
+ * Timing measurement can be enabled, disabled and reset
+ * from this panel.
+ *
+ * @param ui UI structure pointer
+ * @param key key code
+ * @return enum @key_handler_ret
+ */
+int
+timing_handle_key(ui_t *ui, int key);
+
+#endif /* __SNGREP_UI_TIMING_H */
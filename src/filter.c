@@ -28,16 +28,60 @@
  */
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "sip.h"
+#include "capture.h"
 #include "curses/ui_call_list.h"
 #include "filter.h"
 
 //! Storage of filter information
 filter_t filters[FILTER_COUNT] = { };
+//! Filters changed since last calls reset (one bit per type)
+static uint16_t filters_changed = 0;
+
+#ifdef WITH_PCRE2
+//! Match data of each thread
+static pthread_key_t filter_match_key;
+//! Match data key is created the first time is requested
+static pthread_once_t filter_match_once = PTHREAD_ONCE_INIT;
+
+static void
+filter_match_data_destroy(void *match_data)
+{
+    pcre2_match_data_free((pcre2_match_data *) match_data);
+}
+
+static void
+filter_match_key_create()
+{
+    pthread_key_create(&filter_match_key, filter_match_data_destroy);
+}
+
+pcre2_match_data *
+filter_match_data()
+{
+    pcre2_match_data *match_data;
+
+    pthread_once(&filter_match_once, filter_match_key_create);
+    if (!(match_data = pthread_getspecific(filter_match_key))) {
+        // Only whole match offsets are required
+        match_data = pcre2_match_data_create(1, NULL);
+        pthread_setspecific(filter_match_key, match_data);
+    }
+
+    return match_data;
+}
+
+#endif
 
 int
 filter_set(int type, const char *expr)
 {
+    // Same expression, calls don't need to be evaluated again
+    if (expr == filters[type].expr
+        || (expr && filters[type].expr && !strcmp(expr, filters[type].expr)))
+        return 0;
+
 #ifdef WITH_PCRE
     pcre *regex = NULL;
 
@@ -73,6 +117,9 @@ filter_set(int type, const char *expr)
         // Check if we have a valid expression
         if (!(regex = pcre2_compile((PCRE2_SPTR) expr, PCRE2_ZERO_TERMINATED, pcre_options, &re_err, &err_offset, NULL)))
             return 1;
+
+        // Use JIT compiled expression if available
+        pcre2_jit_compile(regex, PCRE2_JIT_COMPLETE);
     }
 
     // Remove previous value
@@ -104,6 +151,15 @@ filter_set(int type, const char *expr)
     memcpy(&filters[type].regex, &regex, sizeof(regex));
 #endif
 
+    // Calls must be evaluated again for this filter
+    filters_changed |= FILTER_BIT(type);
+
+    // Store the text required by the new expression
+    filters[type].literal_only = false;
+    filters[type].literal[0] = '\0';
+    if (expr)
+        filters[type].literal_only = expr_required_literal(expr, filters[type].literal);
+
     return 0;
 }
 
@@ -113,25 +169,50 @@ filter_get(int type)
     return filters[type].expr;
 }
 
+/**
+ * @brief Get enabled filters (one bit per type)
+ */
+static uint16_t
+filter_enabled_mask()
+{
+    uint16_t mask = 0;
+    int i;
+
+    for (i = 0; i < FILTER_COUNT; i++) {
+        if (filters[i].expr)
+            mask |= FILTER_BIT(i);
+    }
+    return mask;
+}
+
 int
 filter_check_call(void *item)
 {
-    int i;
+    int i, count;
     char data[MAX_SIP_PAYLOAD];
     sip_call_t *call = (sip_call_t*) item;
     sip_msg_t *msg;
-    vector_iter_t it;
+    uint16_t bit;
 
     // Dont filter calls without messages
     if (call_msg_count(call) == 0)
         return 0;
 
     // Filter for this call has already be processed
-    if (call->filtered != -1)
-        return (call->filtered == 0);
+    if (CALL_SLOT(call, filtered) != -1)
+        return (CALL_SLOT(call, filtered) == 0);
+
+    // Payload evaluation is paused while capture is overloaded. Calls are
+    // displayed until they are checked once parser has caught up
+    if (filters[FILTER_PAYLOAD].expr
+        && !(CALL_SLOT(call, filter_matched) & FILTER_BIT(FILTER_PAYLOAD))
+        && (!(CALL_SLOT(call, filter_checked) & FILTER_BIT(FILTER_PAYLOAD))
+            || call->filter_msgcnt < call_msg_count(call))
+        && capture_overload_level() == CAPTURE_OVERLOAD_FILTER)
+        return 1;
 
     // By default, call matches all filters
-    call->filtered = 0;
+    CALL_SLOT(call, filtered) = 0;
 
     // Check all filter types
     for (i=0; i < FILTER_COUNT; i++) {
@@ -139,91 +220,122 @@ filter_check_call(void *item)
         if (!filters[i].expr)
             continue;
 
-        // Initialize
-        memset(data, 0, sizeof(data));
-
-        // Get filtered field
-        switch(i) {
-            case FILTER_SIPFROM:
-                call_get_attribute(call, SIP_ATTR_SIPFROM, data);
-                break;
-            case FILTER_SIPTO:
-                call_get_attribute(call, SIP_ATTR_SIPTO, data);
-                break;
-            case FILTER_SOURCE:
-                call_get_attribute(call, SIP_ATTR_SRC, data);
-                break;
-            case FILTER_DESTINATION:
-                call_get_attribute(call, SIP_ATTR_DST, data);
-                break;
-            case FILTER_METHOD:
-                call_get_attribute(call, SIP_ATTR_METHOD, data);
-                break;
-            case FILTER_PAYLOAD:
-                break;
-            case FILTER_CALL_LIST:
-                // FIXME Maybe call should know hot to calculate this line
-                call_list_line_text(ui_find_by_type(PANEL_CALL_LIST), call, data);
-                break;
-            default:
-                // Unknown filter id
-                return 0;
-        }
+        bit = FILTER_BIT(i);
 
-        // For payload filtering, check all messages payload
+        // For payload filtering, check messages not checked yet
         if (i == FILTER_PAYLOAD) {
-            // Assume this call doesn't match the filter
-            call->filtered = 1;
-            // Create an iterator for the call messages
-            it = vector_iterator(call->msgs);
-            while ((msg = vector_iterator_next(&it))) {
-                // Copy message payload
-                strcpy(data, msg_get_payload(msg));
+            // Payload filter has changed since messages were checked
+            if (!(CALL_SLOT(call, filter_checked) & bit))
+                call->filter_msgcnt = 0;
+            count = call_msg_count(call);
+            while (!(CALL_SLOT(call, filter_matched) & bit) && call->filter_msgcnt < count) {
+                msg = vector_item(call->msgs, call->filter_msgcnt++);
                 // Check if this payload matches the filter
-                if (filter_check_expr(filters[i], data) == 0) {
-                    call->filtered = 0;
+                if (filter_check_expr(&filters[i], msg_get_payload(msg)) == 0)
+                    CALL_SLOT(call, filter_matched) |= bit;
+            }
+            CALL_SLOT(call, filter_checked) |= bit;
+        }
+
+        // Evaluate filters that have changed since last check
+        if (!(CALL_SLOT(call, filter_checked) & bit)) {
+            // Initialize
+            data[0] = '\0';
+
+            // Get filtered field
+            switch(i) {
+                case FILTER_SIPFROM:
+                    call_get_attribute(call, SIP_ATTR_SIPFROM, data);
+                    break;
+                case FILTER_SIPTO:
+                    call_get_attribute(call, SIP_ATTR_SIPTO, data);
+                    break;
+                case FILTER_SOURCE:
+                    call_get_attribute(call, SIP_ATTR_SRC, data);
+                    break;
+                case FILTER_DESTINATION:
+                    call_get_attribute(call, SIP_ATTR_DST, data);
                     break;
-                }
+                case FILTER_METHOD:
+                    call_get_attribute(call, SIP_ATTR_METHOD, data);
+                    break;
+                case FILTER_CALL_LIST:
+                    // FIXME Maybe call should know hot to calculate this line
+                    call_list_line_text(ui_find_by_type(PANEL_CALL_LIST), call, data);
+                    break;
+                default:
+                    // Unknown filter id
+                    return 0;
             }
-            if (call->filtered == 1)
-                break;
-        } else {
+
             // Check the filter against given data
-            if (filter_check_expr(filters[i], data) != 0) {
-                // The data didn't matched the filter
-                call->filtered = 1;
-                break;
-            }
+            CALL_SLOT(call, filter_checked) |= bit;
+            if (filter_check_expr(&filters[i], data) == 0)
+                CALL_SLOT(call, filter_matched) |= bit;
+        }
+
+        // The call didn't match this filter
+        if (!(CALL_SLOT(call, filter_matched) & bit)) {
+            CALL_SLOT(call, filtered) = 1;
+            break;
         }
     }
 
     // Return the final filter status
-    return (call->filtered == 0);
+    return (CALL_SLOT(call, filtered) == 0);
+}
+
+bool
+filter_check_call_msgs(sip_call_t *call)
+{
+    uint16_t failed;
+
+    // Call has not been evaluated yet or it matches all filters
+    if (CALL_SLOT(call, filtered) != 1 || !filters[FILTER_PAYLOAD].expr)
+        return false;
+
+    // Only calls that failed payload filter can match with new messages
+    failed = CALL_SLOT(call, filter_checked) & ~CALL_SLOT(call, filter_matched) & filter_enabled_mask();
+    if (failed != FILTER_BIT(FILTER_PAYLOAD))
+        return false;
+
+    CALL_SLOT(call, filtered) = -1;
+    return true;
 }
 
 int
-filter_check_expr(filter_t filter, const char *data)
+filter_check_expr(const filter_t *filter, const char *data)
 {
+    // Filters are always case insensitive
+    if (!expr_literal_found(data, filter->literal, true))
+        return 1;
+
+    // No need to run the expression for plain texts
+    if (filter->literal_only)
+        return 0;
+
 #ifdef WITH_PCRE
-        return pcre_exec(filter.regex, 0, data, strlen(data), 0, 0, 0, 0);
+        return pcre_exec(filter->regex, 0, data, strlen(data), 0, 0, 0, 0);
 #elif defined(WITH_PCRE2)
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(filter.regex, NULL);
-    int ret = pcre2_match(filter.regex, (PCRE2_SPTR) data, (PCRE2_SIZE) strlen(data), 0, 0, match_data, NULL);
-    pcre2_match_data_free(match_data);
+    int ret = pcre2_match(filter->regex, (PCRE2_SPTR) data, (PCRE2_SIZE) strlen(data), 0, 0, filter_match_data(), NULL);
     return (ret == PCRE2_ERROR_NOMATCH) ? 1 : 0;
 #else
         // Call doesn't match this filter
-        return regexec(&filter.regex, data, 0, NULL, 0);
+        return regexec(&filter->regex, data, 0, NULL, 0);
 #endif
 }
 
 void
 filter_reset_calls()
 {
-    sip_call_t *call;
-    vector_iter_t calls = sip_calls_iterator();
+    // No filter has changed since last reset
+    if (!filters_changed)
+        return;
+
+    // Force evaluation of changed filters, without loading each call
+    call_slots_filter_reset(filters_changed);
+    filters_changed = 0;
 
-    // Force filter evaluation
-    while ((call = vector_iterator_next(&calls)))
-        call->filtered = -1;
+    // Rebuild displayed calls list
+    sip_calls_filter_reset();
 }
@@ -75,6 +75,9 @@ enum filter_type {
     FILTER_COUNT,
 };
 
+//! Bit of a filter type in call filter flags
+#define FILTER_BIT(type) (1 << (type))
+
 /**
  * @brief Filter information
  */
@@ -91,6 +94,10 @@ struct filter {
     //! The filter compiled expression
     regex_t regex;
 #endif
+    //! Text required to match the filter expression
+    char literal[EXPR_LITERAL_MAXLEN];
+    //! Filter expression is just the required text
+    bool literal_only;
 };
 
 /**
@@ -119,19 +126,52 @@ filter_get(int type);
 /**
  * @brief Check if a call if filtered
  *
+ * Calls whose payload filter can not be evaluated while capture is
+ * overloaded are displayed, keeping their filter status unset so they
+ * can be evaluated later.
+ *
  * @param call Call to be checked
  * @return 1 if call is filtered
  */
 int
 filter_check_call(void *item);
 
+/**
+ * @brief Check if a call must be filtered again after new messages
+ *
+ * Calls that only failed payload filter can match it with their new
+ * messages. In that case, the call filter status is reset so only the
+ * new messages are checked in next evaluation.
+ *
+ * @param call Call that has received new messages
+ * @return true if call must be evaluated again
+ */
+bool
+filter_check_call_msgs(sip_call_t *call);
+
 /**
  * @brief Check if data matches the filter regexp
  *
+ * Data without the text required by the expression is discarded without
+ * running the regexp.
+ *
  * @return 0 if the given data matches the filter
  */
 int
-filter_check_expr(filter_t filter, const char *data);
+filter_check_expr(const filter_t *filter, const char *data);
+
+#ifdef WITH_PCRE2
+/**
+ * @brief Get match data for current thread
+ *
+ * Match data is created once per thread and can be used with any
+ * compiled expression, as only whole match offsets are stored.
+ *
+ * @return match data of current thread
+ */
+pcre2_match_data *
+filter_match_data();
+#endif
 
 /**
  * @brief Reset filtered flag in all calls
@@ -38,6 +38,8 @@ call_group_create()
         return NULL;
     }
     group->calls = vector_create(5, 2);
+    group->msgs = vector_create(0, 128);
+    vector_set_sorter(group->msgs, call_group_msg_sorter);
     return group;
 }
 
@@ -50,9 +52,117 @@ call_group_destroy(sip_call_group_t *group)
         call_group_del(group, call);
     }
     vector_destroy(group->calls);
+    vector_destroy(group->msgs);
+    free(group->merged);
     sng_free(group);
 }
 
+/**
+ * @brief Check if merged messages belong to current group calls
+ *
+ * Group calls can be changed directly in the calls vector, so compare
+ * them with the calls used to build the messages list.
+ */
+static bool
+call_group_msgs_valid(sip_call_group_t *group)
+{
+    sip_call_t *call;
+    int i;
+
+    if (group->merged_count != vector_count(group->calls))
+        return false;
+
+    for (i = 0; i < group->merged_count; i++) {
+        call = vector_item(group->calls, i);
+        if (group->merged[i].call != call || group->merged[i].msgcnt > call_msg_count(call))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Create group messages list from all calls messages
+ *
+ * Messages of each call are already stored in arrival order, so
+ * they are merged picking the oldest pending message of all calls.
+ */
+static void
+call_group_msgs_rebuild(sip_call_group_t *group)
+{
+    call_group_merged_t *merged;
+    sip_msg_t *msg, *older;
+    int count = vector_count(group->calls);
+    int i, pick;
+
+    vector_clear(group->msgs);
+    group->merged_count = 0;
+    group->msgs_pos = 0;
+
+    if (!(merged = realloc(group->merged, sizeof(call_group_merged_t) * (count ? count : 1))))
+        return;
+    group->merged = merged;
+
+    for (i = 0; i < count; i++) {
+        merged[i].call = vector_item(group->calls, i);
+        merged[i].msgcnt = 0;
+    }
+
+    // Merged messages are already sorted
+    vector_set_sorter(group->msgs, NULL);
+    while (1) {
+        older = NULL;
+        pick = -1;
+        for (i = 0; i < count; i++) {
+            msg = vector_item(merged[i].call->msgs, merged[i].msgcnt);
+            if (msg && (!older || msg_get_time_ns(msg) < msg_get_time_ns(older))) {
+                older = msg;
+                pick = i;
+            }
+        }
+        if (pick == -1)
+            break;
+        vector_append(group->msgs, older);
+        merged[pick].msgcnt++;
+    }
+    vector_set_sorter(group->msgs, call_group_msg_sorter);
+    group->merged_count = count;
+}
+
+/**
+ * @brief Add new calls messages to group messages list
+ */
+static void
+call_group_msgs_update(sip_call_group_t *group)
+{
+    sip_call_t *call;
+    int i, count;
+
+    if (!call_group_msgs_valid(group)) {
+        call_group_msgs_rebuild(group);
+        return;
+    }
+
+    for (i = 0; i < group->merged_count; i++) {
+        call = group->merged[i].call;
+        count = call_msg_count(call);
+        // New messages are usually newer than any other in the list
+        while (group->merged[i].msgcnt < count)
+            vector_append(group->msgs, vector_item(call->msgs, group->merged[i].msgcnt++));
+    }
+}
+
+/**
+ * @brief Get the position of a message in group messages list
+ */
+static int
+call_group_msg_index(sip_call_group_t *group, sip_msg_t *msg)
+{
+    // Messages are usually iterated in order, check last returned first
+    if (vector_item(group->msgs, group->msgs_pos) == msg)
+        return group->msgs_pos;
+    return vector_index(group->msgs, msg);
+}
+
 bool
 call_group_has_changed(sip_call_group_t *group)
 {
@@ -64,7 +174,7 @@ call_group_has_changed(sip_call_group_t *group)
     sip_call_t *call = NULL;
     while ((call = call_group_get_next(group, call))) {
         if (call_has_changed(call)) {
-            call->changed = false;
+            CALL_SLOT(call, changed) = false;
             changed = true;
 
             // If this group is based on a Call-Id, check there are no new call related
@@ -74,6 +184,10 @@ call_group_has_changed(sip_call_group_t *group)
         }
     }
 
+    // Merge new messages
+    if (changed && call_group_count(group) > 1)
+        call_group_msgs_update(group);
+
     // Return if any of the calls have changed
     return changed;
 }
@@ -91,6 +205,8 @@ call_group_clone(sip_call_group_t *original)
     }
 
     clone->calls = vector_clone(original->calls);
+    clone->msgs = vector_create(0, 128);
+    vector_set_sorter(clone->msgs, call_group_msg_sorter);
     return clone;
 }
 
@@ -100,7 +216,7 @@ call_group_add(sip_call_group_t *group, sip_call_t *call)
     if (!call) return;
 
     if (!call_group_exists(group, call)) {
-        call->locked = true;
+        CALL_SLOT(call, locked) = true;
         vector_append(group->calls, call);
     }
 }
@@ -113,7 +229,7 @@ call_group_add_calls(sip_call_group_t *group, vector_t *calls)
 
     // Get the call with the next chronological message
     while ((call = vector_iterator_next(&it))) {
-        call->locked = true;
+        CALL_SLOT(call, locked) = true;
         if (!call_group_exists(group, call)) {
             vector_append(group->calls, call);
         }
@@ -124,7 +240,7 @@ void
 call_group_del(sip_call_group_t *group, sip_call_t *call)
 {
     if (!call) return;
-    call->locked = false;
+    CALL_SLOT(call, locked) = false;
     vector_remove(group->calls, call);
 }
 
@@ -224,6 +340,7 @@ sip_msg_t *
 call_group_get_next_msg(sip_call_group_t *group, sip_msg_t *msg)
 {
     sip_msg_t *next;
+    int pos;
 
     if (call_group_count(group) == 1) {
         sip_call_t *call = vector_first(group->calls);
@@ -231,20 +348,10 @@ call_group_get_next_msg(sip_call_group_t *group, sip_msg_t *msg)
         vector_iterator_set_current(&it, vector_index(call->msgs, msg));
         next = vector_iterator_next(&it);
     } else {
-        vector_t *messages = vector_create(1,10);
-        vector_set_sorter(messages, call_group_msg_sorter);
-        vector_iter_t callsit = vector_iterator(group->calls);
-        sip_call_t *call;
-        while ((call = vector_iterator_next(&callsit))) {
-            vector_append_vector(messages, call->msgs);
-        }
-
-        if (msg == NULL) {
-            next = vector_first(messages);
-        } else {
-            next = vector_item(messages, vector_index(messages, msg) + 1);
-        }
-        vector_destroy(messages);
+        call_group_msgs_update(group);
+        pos = (msg == NULL) ? 0 : call_group_msg_index(group, msg) + 1;
+        if ((next = vector_item(group->msgs, pos)))
+            group->msgs_pos = pos;
     }
 
     next = sip_parse_msg(next);
@@ -259,6 +366,7 @@ sip_msg_t *
 call_group_get_prev_msg(sip_call_group_t *group, sip_msg_t *msg)
 {
     sip_msg_t *prev;
+    int pos;
 
     if (call_group_count(group) == 1) {
         sip_call_t *call = vector_first(group->calls);
@@ -266,22 +374,10 @@ call_group_get_prev_msg(sip_call_group_t *group, sip_msg_t *msg)
         vector_iterator_set_current(&it, vector_index(call->msgs, msg));
         prev = vector_iterator_prev(&it);
     } else {
-        vector_t *messages = vector_create(1, 10);
-        vector_set_sorter(messages, call_group_msg_sorter);
-
-
-        vector_iter_t callsit = vector_iterator(group->calls);
-        sip_call_t *call;
-        while ((call = vector_iterator_next(&callsit))) {
-            vector_append_vector(messages, call->msgs);
-        }
-
-        if (msg == NULL) {
-            prev = vector_last(messages);
-        } else {
-            prev = vector_item(messages, vector_index(messages, msg) - 1);
-        }
-        vector_destroy(messages);
+        call_group_msgs_update(group);
+        pos = (msg == NULL) ? vector_count(group->msgs) - 1 : call_group_msg_index(group, msg) - 1;
+        if ((prev = vector_item(group->msgs, pos)))
+            group->msgs_pos = pos;
     }
 
     prev = sip_parse_msg(prev);
@@ -323,18 +419,18 @@ call_group_get_next_stream(sip_call_group_t *group, rtp_stream_t *stream)
 void
 call_group_msg_sorter(vector_t *vector, void *item)
 {
-    struct timeval curts, prevts;
+    uint64_t curts, prevts;
     int count = vector_count(vector);
     int i;
 
     // Current and last packet times
-    curts = msg_get_time(item);
+    curts = msg_get_time_ns(item);
 
     for (i = count - 2 ; i >= 0; i--) {
         // Get previous packet
-        prevts = msg_get_time(vector_item(vector, i));
+        prevts = msg_get_time_ns(vector_item(vector, i));
         // Check if the item is already in a sorted position
-        if (timeval_is_older(curts, prevts)) {
+        if (curts >= prevts) {
             vector_insert(vector, item, i + 1);
             return;
         }
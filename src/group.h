@@ -39,6 +39,18 @@
 
 //! Shorter declaration of sip_call_group structure
 typedef struct sip_call_group sip_call_group_t;
+//! Shorter declaration of call_group_merged structure
+typedef struct call_group_merged call_group_merged_t;
+
+/**
+ * @brief Number of messages of a call in group messages list
+ */
+struct call_group_merged {
+    //! Call of the group
+    sip_call_t *call;
+    //! How many messages of this call have been merged
+    int msgcnt;
+};
 
 /**
  * @brief Contains a list of calls
@@ -56,6 +68,14 @@ struct sip_call_group {
     int color;
     //! Only consider SDP messages from Calls
     int sdp_only;
+    //! Messages of all calls sorted by time
+    vector_t *msgs;
+    //! Merged messages of each call, in the same order than calls array
+    call_group_merged_t *merged;
+    //! Number of calls in merged array
+    int merged_count;
+    //! Position in messages list of the last returned message
+    int msgs_pos;
 };
 
 /**
@@ -0,0 +1,372 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file gzip.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in gzip.h
+ *
+ * Blocks are reused in a ring. Only the thread writing to the stream
+ * fills blocks and writes compressed ones, pool threads only compress
+ * pending blocks, oldest first.
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "gzip.h"
+#include "thread.h"
+
+#ifdef HAVE_FOPENCOOKIE
+
+//! Shorter declaration of gzip block structure
+typedef struct gzip_block gzip_block_t;
+//! Shorter declaration of gzip writer structure
+typedef struct gzip_writer gzip_writer_t;
+
+/**
+ * @brief Gzip block states
+ */
+enum gzip_block_state {
+    //! Block is empty or being filled
+    GZIP_BLOCK_FREE = 0,
+    //! Block is waiting for a compression thread
+    GZIP_BLOCK_PENDING,
+    //! Block is being compressed
+    GZIP_BLOCK_COMPRESSING,
+    //! Block is compressed and waiting to be written
+    GZIP_BLOCK_DONE
+};
+
+/**
+ * @brief Uncompressed data and its compressed gzip member
+ */
+struct gzip_block {
+    //! Block state
+    enum gzip_block_state state;
+    //! Uncompressed data length
+    size_t len;
+    //! Compressed member length (0 if compression failed)
+    size_t zlen;
+    //! Compressed member buffer size
+    size_t zsize;
+    //! Compressed member
+    unsigned char *zdata;
+    //! Uncompressed data
+    char data[GZIP_BLOCK_SIZE];
+};
+
+/**
+ * @brief Gzip stream compressed by a thread pool
+ */
+struct gzip_writer {
+    //! Compressed output file
+    FILE *fp;
+    //! zlib compression level
+    int level;
+    //! Ring of blocks
+    gzip_block_t **blocks;
+    //! Number of blocks in the ring
+    int count;
+    //! Oldest block not written yet
+    int head;
+    //! Block being filled
+    int fill;
+    //! Compression threads
+    pthread_t threads[GZIP_THREADS_MAX];
+    //! Number of running compression threads
+    int nthreads;
+    //! Lock for blocks states
+    pthread_mutex_t lock;
+    //! Signaled when a block state changes
+    pthread_cond_t cond;
+    //! Compression threads must exit when no block is pending
+    bool closing;
+    //! Some block could not be compressed or written
+    bool error;
+};
+
+/**
+ * @brief Compress a block as a complete gzip member
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int
+gzip_block_compress(z_stream *z, gzip_block_t *block)
+{
+    unsigned char *zdata;
+    size_t bound;
+
+    if (deflateReset(z) != Z_OK)
+        return 1;
+
+    bound = deflateBound(z, block->len);
+    if (block->zsize < bound) {
+        if (!(zdata = realloc(block->zdata, bound)))
+            return 1;
+        block->zdata = zdata;
+        block->zsize = bound;
+    }
+
+    z->next_in = (Bytef *) block->data;
+    z->avail_in = block->len;
+    z->next_out = block->zdata;
+    z->avail_out = block->zsize;
+    if (deflate(z, Z_FINISH) != Z_STREAM_END)
+        return 1;
+
+    block->zlen = block->zsize - z->avail_out;
+    return 0;
+}
+
+/**
+ * @brief Compress pending blocks until the stream is closed
+ */
+static void *
+gzip_thread(void *data)
+{
+    gzip_writer_t *gz = (gzip_writer_t *) data;
+    gzip_block_t *block;
+    z_stream z;
+    bool init;
+    int i;
+
+    // Each thread reuses its own deflate state for all blocks
+    memset(&z, 0, sizeof(z));
+    init = deflateInit2(&z, gz->level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+
+    pthread_mutex_lock(&gz->lock);
+    while (true) {
+        // Compress oldest pending block first
+        for (block = NULL, i = 0; i < gz->count && !block; i++) {
+            block = gz->blocks[(gz->head + i) % gz->count];
+            if (block->state != GZIP_BLOCK_PENDING)
+                block = NULL;
+        }
+
+        if (!block) {
+            if (gz->closing)
+                break;
+            pthread_cond_wait(&gz->cond, &gz->lock);
+            continue;
+        }
+
+        block->state = GZIP_BLOCK_COMPRESSING;
+        pthread_mutex_unlock(&gz->lock);
+
+        if (!init || gzip_block_compress(&z, block) != 0)
+            block->zlen = 0;
+
+        pthread_mutex_lock(&gz->lock);
+        if (!block->zlen)
+            __atomic_store_n(&gz->error, true, __ATOMIC_RELAXED);
+        block->state = GZIP_BLOCK_DONE;
+        pthread_cond_broadcast(&gz->cond);
+    }
+    pthread_mutex_unlock(&gz->lock);
+
+    if (init)
+        deflateEnd(&z);
+    return NULL;
+}
+
+/**
+ * @brief Write compressed blocks in order
+ *
+ * This function must be invoked with writer locked.
+ *
+ * @param all Wait until all blocks are written, otherwise only wait
+ *        until the next block to be filled is free
+ */
+static void
+gzip_write_blocks(gzip_writer_t *gz, bool all)
+{
+    gzip_block_t *block;
+    bool written;
+
+    while (true) {
+        block = gz->blocks[gz->head];
+
+        if (block->state == GZIP_BLOCK_DONE) {
+            // Compression threads do not touch finished blocks
+            pthread_mutex_unlock(&gz->lock);
+            written = !block->zlen || fwrite(block->zdata, 1, block->zlen, gz->fp) == block->zlen;
+            pthread_mutex_lock(&gz->lock);
+            if (!written)
+                __atomic_store_n(&gz->error, true, __ATOMIC_RELAXED);
+            block->len = 0;
+            block->state = GZIP_BLOCK_FREE;
+            gz->head = (gz->head + 1) % gz->count;
+            continue;
+        }
+
+        // No more blocks pending to be written
+        if (block->state == GZIP_BLOCK_FREE)
+            break;
+        if (!all && gz->blocks[gz->fill]->state == GZIP_BLOCK_FREE)
+            break;
+
+        pthread_cond_wait(&gz->cond, &gz->lock);
+    }
+}
+
+/**
+ * @brief Queue the filled block for compression
+ */
+static void
+gzip_submit(gzip_writer_t *gz)
+{
+    pthread_mutex_lock(&gz->lock);
+    gz->blocks[gz->fill]->state = GZIP_BLOCK_PENDING;
+    gz->fill = (gz->fill + 1) % gz->count;
+    pthread_cond_broadcast(&gz->cond);
+    gzip_write_blocks(gz, false);
+    pthread_mutex_unlock(&gz->lock);
+}
+
+/**
+ * @brief Stop compression threads and release writer memory
+ */
+static void
+gzip_writer_destroy(gzip_writer_t *gz)
+{
+    int i;
+
+    pthread_mutex_lock(&gz->lock);
+    gz->closing = true;
+    pthread_cond_broadcast(&gz->cond);
+    pthread_mutex_unlock(&gz->lock);
+
+    for (i = 0; i < gz->nthreads; i++)
+        pthread_join(gz->threads[i], NULL);
+
+    for (i = 0; i < gz->count; i++) {
+        if (gz->blocks[i])
+            free(gz->blocks[i]->zdata);
+        free(gz->blocks[i]);
+    }
+    free(gz->blocks);
+    pthread_cond_destroy(&gz->cond);
+    pthread_mutex_destroy(&gz->lock);
+    free(gz);
+}
+
+static ssize_t
+gzip_cookie_write(void *cookie, const char *buf, size_t size)
+{
+    gzip_writer_t *gz = (gzip_writer_t *) cookie;
+    gzip_block_t *block;
+    size_t len, done = 0;
+
+    while (done < size) {
+        // Block being filled is only used by this thread
+        block = gz->blocks[gz->fill];
+        len = GZIP_BLOCK_SIZE - block->len;
+        if (len > size - done)
+            len = size - done;
+        memcpy(block->data + block->len, buf + done, len);
+        block->len += len;
+        done += len;
+
+        if (block->len == GZIP_BLOCK_SIZE)
+            gzip_submit(gz);
+    }
+
+    return __atomic_load_n(&gz->error, __ATOMIC_RELAXED) ? 0 : (ssize_t) size;
+}
+
+static int
+gzip_cookie_close(void *cookie)
+{
+    gzip_writer_t *gz = (gzip_writer_t *) cookie;
+    bool error;
+
+    // Compress remaining data and write all blocks
+    if (gz->blocks[gz->fill]->len)
+        gzip_submit(gz);
+    pthread_mutex_lock(&gz->lock);
+    gzip_write_blocks(gz, true);
+    pthread_mutex_unlock(&gz->lock);
+
+    error = __atomic_load_n(&gz->error, __ATOMIC_RELAXED);
+    if (fclose(gz->fp) != 0)
+        error = true;
+    gzip_writer_destroy(gz);
+    return error ? EOF : 0;
+}
+
+FILE *
+gzip_open(FILE *fp, int level, int threads)
+{
+    static cookie_io_functions_t funcs = {
+        NULL, gzip_cookie_write, NULL, gzip_cookie_close
+    };
+    gzip_writer_t *gz;
+    FILE *stream;
+    int i;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+    if (threads > GZIP_THREADS_MAX)
+        threads = GZIP_THREADS_MAX;
+
+    if (!(gz = calloc(1, sizeof(gzip_writer_t))))
+        return NULL;
+    gz->fp = fp;
+    gz->level = level;
+    pthread_mutex_init(&gz->lock, NULL);
+    pthread_cond_init(&gz->cond, NULL);
+
+    // Keep all threads busy while compressed blocks are written
+    gz->count = threads * 2;
+    if (!(gz->blocks = calloc(gz->count, sizeof(gzip_block_t *)))) {
+        gzip_writer_destroy(gz);
+        return NULL;
+    }
+    for (i = 0; i < gz->count; i++) {
+        if (!(gz->blocks[i] = calloc(1, sizeof(gzip_block_t)))) {
+            gzip_writer_destroy(gz);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < threads; i++) {
+        if (thread_create(&gz->threads[i], THREAD_IO, "sng-gzip-out", gzip_thread, gz) != 0)
+            break;
+        gz->nthreads++;
+    }
+
+    if (!gz->nthreads || !(stream = fopencookie(gz, "w", funcs))) {
+        gzip_writer_destroy(gz);
+        return NULL;
+    }
+
+    return stream;
+}
+
+#endif /* HAVE_FOPENCOOKIE */
@@ -0,0 +1,62 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file gzip.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to write gzip files compressed by a thread pool
+ *
+ * Written data is split in fixed size blocks and each block is
+ * compressed by a pool thread as an independent gzip member. Members
+ * are written in order, so the file is a standard multi-member gzip
+ * file that gzip and zlib read as a single stream.
+ *
+ * The thread writing to the stream only copies data and writes
+ * compressed blocks, so it is no longer limited by deflate speed.
+ *
+ */
+#ifndef __SNGREP_GZIP_H
+#define __SNGREP_GZIP_H
+
+#include "config.h"
+#include <stdio.h>
+
+//! Uncompressed bytes of each gzip member
+#define GZIP_BLOCK_SIZE (256 * 1024)
+//! Max number of compression threads of each file
+#define GZIP_THREADS_MAX 16
+
+/**
+ * @brief Open a gzip compressed stream on top of a file
+ *
+ * Closing the returned stream waits for all pending blocks, writes
+ * them and closes the underlying file.
+ *
+ * @param fp File opened for writing
+ * @param level zlib compression level
+ * @param threads Number of compression threads (0 for one per CPU)
+ * @return stream to write uncompressed data or NULL on error
+ */
+FILE *
+gzip_open(FILE *fp, int level, int threads);
+
+#endif /* __SNGREP_GZIP_H */
@@ -30,25 +30,151 @@
 #include <string.h>
 #include <stdlib.h>
 
+//! Slot hash values with special meaning
+#define HTABLE_EMPTY    0
+#define HTABLE_REMOVED  1
+
+/**
+ * @brief Get the hash value stored in the slots for a key
+ */
+static uint32_t
+htable_slot_hash(htable_t *table, const void *key)
+{
+    uint32_t hash = table->hash(key);
+    return (hash <= HTABLE_REMOVED) ? hash + 2 : hash;
+}
+
+/**
+ * @brief Find the slot of a key in a slots array
+ *
+ * @return slot storing the key or NULL if not found
+ */
+static hentry_t *
+htable_slot_find(htable_t *table, hentry_t *slots, size_t size, uint32_t hash, const void *key)
+{
+    size_t pos;
+
+    for (pos = hash & (size - 1); slots[pos].hash != HTABLE_EMPTY; pos = (pos + 1) & (size - 1)) {
+        if (slots[pos].hash == hash && table->equal(slots[pos].key, key))
+            return &slots[pos];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Store an entry in the first free slot of current slots array
+ */
+static void
+htable_slot_add(htable_t *table, uint32_t hash, const void *key, void *data)
+{
+    size_t pos;
+
+    for (pos = hash & (table->size - 1); table->slots[pos].hash > HTABLE_REMOVED;
+         pos = (pos + 1) & (table->size - 1));
+
+    if (table->slots[pos].hash == HTABLE_EMPTY)
+        table->used++;
+    table->slots[pos].hash = hash;
+    table->slots[pos].key = key;
+    table->slots[pos].data = data;
+    table->count++;
+}
+
+/**
+ * @brief Move some entries from previous slots array
+ *
+ * @param max Max number of slots checked
+ */
+static void
+htable_migrate(htable_t *table, size_t max)
+{
+    hentry_t *slot;
+
+    for (; table->old && max; max--) {
+        slot = &table->old[table->old_pos++];
+        if (slot->hash > HTABLE_REMOVED) {
+            htable_slot_add(table, slot->hash, slot->key, slot->data);
+        }
+
+        // All entries have been moved
+        if (table->old_pos == table->old_size) {
+            free(table->old);
+            table->old = NULL;
+            table->old_size = table->old_pos = 0;
+        }
+    }
+}
+
+/**
+ * @brief Allocate a new slots array for current number of entries
+ *
+ * Entries from the current slots array will be moved incrementally.
+ *
+ * @return 0 on success, -1 on error
+ */
+static int
+htable_resize(htable_t *table)
+{
+    hentry_t *slots;
+    size_t size = table->size;
+
+    // Previous resize must be finished before starting a new one
+    htable_migrate(table, table->old_size);
+
+    // Grow only if table is half full, otherwise just clean removed entries
+    if (table->count >= size / 2)
+        size *= 2;
+
+    if (!(slots = calloc(size, sizeof(hentry_t))))
+        return -1;
+
+    table->old = table->slots;
+    table->old_size = table->size;
+    table->old_pos = 0;
+    table->slots = slots;
+    table->size = size;
+    table->used = 0;
+
+    // Entries in previous slots are counted again as they are moved
+    table->count = 0;
+    return 0;
+}
+
+static bool
+htable_equal_str(const void *key1, const void *key2)
+{
+    return !strcmp(key1, key2);
+}
+
 htable_t *
 htable_create(size_t size)
+{
+    return htable_create_custom(size, htable_hash_str, htable_equal_str);
+}
+
+htable_t *
+htable_create_custom(size_t size, htable_hash_func hash, htable_equal_func equal)
 {
     htable_t *h;
+    size_t slots = HTABLE_MIN_SIZE;
 
     // Allocate memory for this table data
-    if (!(h = malloc(sizeof(htable_t))))
+    if (!(h = calloc(1, sizeof(htable_t))))
         return NULL;
 
-    h->size = size;
+    // Keep expected entries under 3/4 of slots
+    while (slots / 4 * 3 < size)
+        slots *= 2;
 
-    // Allocate memory for this table buckets
-    if (!(h->buckets = malloc(sizeof(hentry_t) * size))) {
+    // Allocate memory for this table slots
+    if (!(h->slots = calloc(slots, sizeof(hentry_t)))) {
         free(h);
         return NULL;
     }
 
-    // Initialize allocated memory
-    memset(h->buckets, 0, sizeof(hentry_t) * size);
+    h->size = slots;
+    h->hash = hash;
+    h->equal = equal;
 
     // Return allocated table
     return h;
@@ -57,87 +183,115 @@ htable_create(size_t size)
 void
 htable_destroy(htable_t *table)
 {
-    free(table->buckets);
+    if (!table)
+        return;
+
+    free(table->old);
+    free(table->slots);
     free(table);
 }
 
 int
-htable_insert(htable_t *table, const char *key, void *data)
+htable_insert(htable_t *table, const void *key, void *data)
 {
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
-
-    // Create a new entry for given key
-    hentry_t *entry;
-    if (!(entry = malloc(sizeof(hentry_t))))
-        return -1;
-
-    entry->key = key;
-    entry->data = data;
-    entry->next = 0;
+    uint32_t hash = htable_slot_hash(table, key);
 
-    // Check if the hash position is in use
-    hentry_t *exists = table->buckets[pos];
+    htable_migrate(table, HTABLE_MIGRATE);
 
-    if (!exists) {
-        table->buckets[pos] = entry;
-    } else {
-        while (exists->next) {
-            exists = exists->next;
-        }
-        exists->next = entry;
+    // Keep used slots under 3/4 of the table
+    if (table->used + 1 > table->size / 4 * 3) {
+        if (htable_resize(table) != 0)
+            return -1;
     }
+
+    htable_slot_add(table, hash, key, data);
     return 0;
 }
 
 void
-htable_remove(htable_t *table, const char *key)
-{
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
-
-    // Check if the hash position is in use
-    hentry_t *entry, *prev = NULL;
-    for (entry = table->buckets[pos]; entry; prev = entry, entry = entry->next) {
-        if (!strcmp(entry->key, key)) {
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                table->buckets[pos] = entry->next;
-            }
-            // Remove item memory
-            free(entry);
-            return;
-        }
+htable_remove(htable_t *table, const void *key)
+{
+    uint32_t hash = htable_slot_hash(table, key);
+    hentry_t *slot;
+
+    htable_migrate(table, HTABLE_MIGRATE);
+
+    if ((slot = htable_slot_find(table, table->slots, table->size, hash, key))) {
+        table->count--;
+    } else if (table->old) {
+        slot = htable_slot_find(table, table->old, table->old_size, hash, key);
+    }
+
+    // Keep probe sequences of other entries
+    if (slot) {
+        slot->hash = HTABLE_REMOVED;
+        slot->key = slot->data = NULL;
     }
 }
 
 void *
-htable_find(htable_t *table, const char *key)
+htable_find(htable_t *table, const void *key)
 {
-    // Get hash position for given entry
-    size_t pos = htable_hash(table, key);
+    uint32_t hash = htable_slot_hash(table, key);
+    hentry_t *slot;
 
-    // Check if the hash position is in use
-    hentry_t *entry;
-    for (entry = table->buckets[pos]; entry; entry = entry->next) {
-        if (!strcmp(entry->key, key)) {
-            //! Found
-            return entry->data;
-        }
-    }
+    if ((slot = htable_slot_find(table, table->slots, table->size, hash, key)))
+        return slot->data;
+
+    if (table->old && (slot = htable_slot_find(table, table->old, table->old_size, hash, key)))
+        return slot->data;
 
     // Not found
     return NULL;
 }
 
 size_t
-htable_hash(htable_t *table, const char *key)
+htable_count(htable_t *table)
+{
+    size_t count = table->count;
+    size_t pos;
+
+    // Add entries not moved yet from previous slots
+    for (pos = table->old_pos; table->old && pos < table->old_size; pos++) {
+        if (table->old[pos].hash > HTABLE_REMOVED)
+            count++;
+    }
+    return count;
+}
+
+uint32_t
+htable_hash(htable_t *table, const void *key)
+{
+    return table->hash(key);
+}
+
+uint32_t
+htable_hash_str(const void *key)
 {
     // dbj2 - http://www.cse.yorku.ca/~oz/hash.html
-    size_t hash = 5381;
-    while (*key++) {
-        hash = ((hash << 5) + hash) ^ *key;
+    const unsigned char *str = key;
+    uint32_t hash = 5381;
+
+    while (*str) {
+        hash = ((hash << 5) + hash) ^ *str++;
+    }
+
+    // Mix high bits into the low bits used to select slots
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    return hash ^ (hash >> 13);
+}
+
+uint64_t
+hash_mem64(const void *data, size_t len)
+{
+    // FNV-1a - http://www.isthe.com/chongo/tech/comp/fnv/
+    const unsigned char *c = data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    while (len--) {
+        hash ^= *c++;
+        hash *= 0x100000001b3ULL;
     }
-    return hash & (table->size - 1);
+    return hash;
 }
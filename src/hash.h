@@ -31,46 +31,141 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+//! Minimum number of slots of a hash table
+#define HTABLE_MIN_SIZE     16
+//! Entries moved from previous slots array on each table operation
+#define HTABLE_MIGRATE      8
 
 //! Shorter declaration of hash structures
 typedef struct htable htable_t;
 typedef struct hentry hentry_t;
 
+//! Calculate the hash value of a key
+typedef uint32_t (*htable_hash_func)(const void *key);
+//! Check if two keys are equal
+typedef bool (*htable_equal_func)(const void *key1, const void *key2);
+
 /**
  *  Structure to hold a Hash table entry
  */
 struct hentry {
+    //! Hash value of the key (0 for empty slots, 1 for removed entries)
+    uint32_t hash;
     //! Key of the hash entry
-    const char *key;
+    const void *key;
     //! Pointer to has entry data
     void *data;
-    //! Next entry sharing the same hash value
-    hentry_t *next;
 };
 
+/**
+ * @brief Open addressing hash table
+ *
+ * Entries are stored in a power of two slots array using linear probing.
+ * When the table grows, a new slots array is allocated and entries are
+ * moved from the previous one a few at a time on each operation, so no
+ * single insert has to rehash the whole table.
+ */
 struct htable {
-    //! Fixed hash table limit
+    //! Number of slots
     size_t size;
-    // Hash table entries
-    hentry_t **buckets;
+    //! Number of entries
+    size_t count;
+    //! Number of used slots (entries and removed entries)
+    size_t used;
+    //! Table slots
+    hentry_t *slots;
+    //! Previous slots still being moved (NULL if none)
+    hentry_t *old;
+    //! Number of previous slots
+    size_t old_size;
+    //! Next previous slot to be moved
+    size_t old_pos;
+    //! Key hash function
+    htable_hash_func hash;
+    //! Key compare function
+    htable_equal_func equal;
 };
 
+/**
+ * @brief Create a hash table with string keys
+ *
+ * @param size Expected number of entries
+ * @return allocated table or NULL on error
+ */
 htable_t *
 htable_create(size_t size);
 
+/**
+ * @brief Create a hash table with custom keys
+ *
+ * @param size Expected number of entries
+ * @param hash Key hash function
+ * @param equal Key compare function
+ * @return allocated table or NULL on error
+ */
+htable_t *
+htable_create_custom(size_t size, htable_hash_func hash, htable_equal_func equal);
+
+/**
+ * @brief Deallocate a hash table
+ *
+ * Keys and data of the entries are not deallocated.
+ */
 void
 htable_destroy(htable_t *table);
 
+/**
+ * @brief Add an entry to the table
+ *
+ * Key must be valid while the entry is in the table.
+ *
+ * @return 0 on success, -1 on error
+ */
 int
-htable_insert(htable_t *table, const char *key, void *data);
+htable_insert(htable_t *table, const void *key, void *data);
 
+/**
+ * @brief Remove the entry with the given key
+ */
 void
-htable_remove(htable_t *table, const char *key);
+htable_remove(htable_t *table, const void *key);
 
+/**
+ * @brief Get data of the entry with the given key
+ *
+ * @return entry data or NULL if not found
+ */
 void *
-htable_find(htable_t *table, const char *key);
+htable_find(htable_t *table, const void *key);
 
+/**
+ * @brief Get number of entries in the table
+ */
 size_t
-htable_hash(htable_t *table, const char *key);
+htable_count(htable_t *table);
+
+/**
+ * @brief Hash a key using the table hash function
+ */
+uint32_t
+htable_hash(htable_t *table, const void *key);
+
+/**
+ * @brief Hash a NUL terminated string
+ */
+uint32_t
+htable_hash_str(const void *key);
+
+/**
+ * @brief Hash a memory block into a 64 bits value
+ *
+ * Collisions are unlikely enough to skip comparing the blocks when
+ * hash values are different.
+ */
+uint64_t
+hash_mem64(const void *data, size_t len);
 
 #endif /* __SNGREP_HASH_H_ */
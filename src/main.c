@@ -30,13 +30,28 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
 #include <ctype.h>
 #include <getopt.h>
+#include <sys/resource.h>
 #include "option.h"
 #include "vector.h"
 #include "capture.h"
 #include "capture_eep.h"
-#include "curses/ui_save.h"
+#ifdef USE_TPACKET
+#include "capture_tpacket.h"
+#endif
+#ifdef HAVE_SHM_OPEN
+#include "capture_shm.h"
+#endif
+#include "output.h"
+#include "metrics.h"
+#include "trigger.h"
+#include "report.h"
+#include "compact.h"
+#include "sip_filter.h"
 #ifdef WITH_GNUTLS
 #include "capture_gnutls.h"
 #endif
@@ -53,14 +68,14 @@
 void
 usage()
 {
-    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-d dev] [-l limit] [-B buffer]"
+    printf("Usage: %s [-hVcivNqrD] [-IO pcap_dump] [-d dev] [-l limit] [-m memory] [-B buffer] [-T textfile] [-j jsonfile]"
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
            " [-k keyfile]"
 #endif
 #ifdef USE_EEP
            " [-LHE capture_url]"
 #endif
-           " [<match expression>] [<bpf filter>]\n\n"
+           " [-M match_file] [<match expression>] [<bpf filter>]\n\n"
            "    -h --help\t\t This usage\n"
            "    -V --version\t Version information\n"
            "    -d --device\t\t Use this capture device instead of default\n"
@@ -70,19 +85,28 @@ usage()
            "    -c --calls\t\t Only display dialogs starting with INVITE\n"
            "    -r --rtp\t\t Capture RTP packets payload\n"
            "    -l --limit\t\t Set capture limit to N dialogs\n"
+           "    -m --memory-limit\t Rotate dialogs when their memory exceeds N MB\n"
            "    -i --icase\t\t Make <match expression> case insensitive\n"
            "    -v --invert\t\t Invert <match expression>\n"
+           "    -M --match-file\t Only capture dialogs matching any pattern from file\n"
            "    -N --no-interface\t Don't display sngrep interface, just capture\n"
            "    -q --quiet\t\t Don't print captured dialogs in no interface mode\n"
            "    -D --dump-config\t Print active configuration settings and exit\n"
            "    -f --config\t\t Read configuration from file\n"
            "    -F --no-config\t Do not read configuration from default config file\n"
-           "    -T --text\t Save pcap to text file\n"
+           "    -T --text\t\t Write captured messages to text file as they arrive\n"
+           "    -j --json\t\t Write captured messages and finished calls to NDJSON file\n"
            "    -R --rotate\t\t Rotate calls when capture limit have been reached\n"
+           "    --bench[=speed]\t Replay -I files from memory and print throughput\n"
+           "    --sample N/M\t Only store N of each M dialogs, selected by Call-ID\n"
+           "    --stats[=json]\t Process -I files without storing frames and print a report\n"
+           "    --daemon[=name]\t Capture and share frames with attached processes\n"
+           "    --attach[=name]\t Read frames captured by a running daemon\n"
 #ifdef USE_EEP
-           "    -H --eep-send\t Homer sipcapture url (udp:X.X.X.X:XXXX)\n"
-           "    -L --eep-listen\t Listen for encapsulated packets (udp:X.X.X.X:XXXX)\n"
+           "    -H --eep-send\t Homer sipcapture url (udp|tcp:X.X.X.X:XXXX)\n"
+           "    -L --eep-listen\t Listen for encapsulated packets (udp|tcp:X.X.X.X:XXXX)\n"
            "    -E --eep-parse\t Enable EEP parsing in captured packets\n"
+           "    --probe\t\t Send parsed summaries to -H tcp url, frames on request\n"
 #endif
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
            "    -k --keyfile\t RSA private keyfile to decrypt captured packets\n"
@@ -116,11 +140,130 @@ version()
 #endif
 #ifdef USE_EEP
             " * Compiled with EEP/HEP support.\n"
+#endif
+#ifdef USE_TPACKET
+            " * Compiled with AF_PACKET TPACKET_V3 support.\n"
 #endif
            "\nWritten by Ivan Alonso [aka Kaian]\n",
            PACKAGE, VERSION);
 }
 
+/**
+ * @brief Print packet counters of all capture sources
+ *
+ * Used in no interface mode to check if any packet was lost
+ */
+void
+print_capture_stats()
+{
+    capture_stats_t stats;
+    const char *name;
+    int i;
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    uint32_t tls_count;
+    uint64_t tls_expired, tls_evicted, tls_failures;
+#endif
+#ifdef USE_EEP
+    uint64_t eep_sent, eep_drops, eep_errors;
+#endif
+
+    for (i = 0; (name = capture_source_stats(i, &stats)); i++) {
+        fprintf(stderr, "%s: received %" PRIu64 ", kernel drops %" PRIu64
+                ", iface drops %" PRIu64 ", queue drops %" PRIu64
+                ", reasm drops %" PRIu64 ", rejected %" PRIu64
+                ", limit skipped %" PRIu64 "\n", name ? name : "-",
+                stats.received, stats.kernel_drops, stats.if_drops,
+                stats.queue_drops, stats.reasm_drops, stats.rejected,
+                stats.skipped);
+    }
+    fprintf(stderr, "stored dialogs memory %" PRIu64 " KB\n", sip_calls_memory(NULL) / 1024);
+    if (compact_enabled())
+        fprintf(stderr, "compacted dialogs %" PRIu64 "\n", compact_folded());
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // TLS connections are only tracked with a keyfile
+    if (capture_keyfile()) {
+        tls_connection_stats(&tls_count, &tls_expired, &tls_evicted, &tls_failures);
+        fprintf(stderr, "tls connections %u, expired %" PRIu64 ", evicted %" PRIu64
+                ", decrypt failures %" PRIu64 ", resumed %" PRIu64 "\n",
+                tls_count, tls_expired, tls_evicted, tls_failures, tls_session_resumed());
+    }
+#endif
+
+#ifdef USE_EEP
+    // HEP packets are only sent in send mode
+    if (capture_eep_send_port()) {
+        capture_eep_send_stats(&eep_sent, &eep_drops, &eep_errors);
+        fprintf(stderr, "hep sent %" PRIu64 ", queue drops %" PRIu64 ", send errors %" PRIu64 "\n",
+                eep_sent, eep_drops, eep_errors);
+    }
+#endif
+}
+
+/**
+ * @brief Print hit counters of match file patterns
+ *
+ * Used in no interface mode to check which patterns have matched
+ */
+void
+print_match_stats()
+{
+    match_set_t *set;
+    const char *pattern;
+    uint64_t hits;
+    int i, matched = 0;
+
+    if (!(set = sip_get_match_set()))
+        return;
+
+    for (i = 0; (pattern = match_set_pattern(set, i, &hits)); i++) {
+        if (!hits)
+            continue;
+        fprintf(stderr, "%s: %" PRIu64 " dialogs\n", pattern, hits);
+        matched++;
+    }
+    fprintf(stderr, "Matched patterns: %d of %d\n", matched, match_set_count(set));
+}
+
+/**
+ * @brief Print throughput of a benchmark replay
+ *
+ * Used after a --bench capture to compare parsing performance
+ */
+void
+print_bench_stats()
+{
+    const capture_bench_t *bench;
+    struct timespec end;
+    struct rusage usage;
+    double secs;
+
+    if (!(bench = capture_bench_info()))
+        return;
+
+    // Replay may have been interrupted before all packets were parsed
+    end = bench->end;
+    if (!end.tv_sec)
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - bench->start.tv_sec) + (end.tv_nsec - bench->start.tv_nsec) / 1e9;
+    if (secs <= 0)
+        secs = 1e-9;
+
+    printf("Benchmark: %d packets, %.1f MB in %.3f s (%s%s)\n",
+           bench->count, bench->bytes / 1e6, secs,
+           bench->speed > 0 ? "replay at recorded speed" : "max speed",
+           bench->end.tv_sec ? "" : ", interrupted");
+    if (bench->speed > 0)
+        printf("Replay speed: %gx\n", bench->speed);
+    printf("Packets/s:  %.0f\n", bench->count / secs);
+    printf("Mbit/s:     %.1f\n", bench->bytes * 8 / secs / 1e6);
+    printf("Messages/s: %.0f\n", metrics_sip_msg_count() / secs);
+    printf("Calls/s:    %.0f\n", sip_calls_count_unrotated() / secs);
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("Peak RSS:   %ld KB (including preloaded file)\n", usage.ru_maxrss);
+    metrics_timing_dump(stdout);
+}
+
 /**
  * @brief Main function logic
  *
@@ -129,15 +272,24 @@ version()
 int
 main(int argc, char* argv[])
 {
-    int opt, idx, limit, only_calls, no_incomplete, pcap_buffer_size, i;
-    const char *device, *outfile, *text_outfile = NULL;
+    int opt, idx, limit, memory_limit, only_calls, no_incomplete, pcap_buffer_size, i;
+    const char *device, *outfile, *text_outfile = NULL, *json_outfile = NULL;
     char bpf[512];
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     const char *keyfile;
 #endif
-    const char *match_expr;
+    const char *match_expr, *match_file = NULL, *metrics_address, *trigger_dir;
+    const char *daemon_name = NULL;
+    int daemon_mode = 0;
+#ifdef HAVE_SHM_OPEN
+    const char *attach_name = NULL;
+    int attach = 0;
+#endif
     int match_insensitive = 0, match_invert = 0;
     int no_interface = 0, quiet = 0, rtp_capture = 0, rotate = 0, no_config = 0;
+    int stats_interval, report = 0;
+    double bench_speed = -1;
+    time_t stats_time;
     vector_t *infiles = vector_create(0, 1);
     vector_t *indevices = vector_create(0, 1);
     char *token;
@@ -156,25 +308,34 @@ main(int argc, char* argv[])
         { "calls", no_argument, 0, 'c' },
         { "rtp", no_argument, 0, 'r' },
         { "limit", required_argument, 0, 'l' },
+        { "memory-limit", required_argument, 0, 'm' },
         { "icase", no_argument, 0, 'i' },
         { "invert", no_argument, 0, 'v' },
+        { "match-file", required_argument, 0, 'M' },
         { "no-interface", no_argument, 0, 'N' },
         { "dump-config", no_argument, 0, 'D' },
         { "rotate", no_argument, 0, 'R' },
         { "config", required_argument, 0, 'f' },
         { "no-config", no_argument, 0, 'F' },
         { "text", required_argument, 0, 'T' },
+        { "json", required_argument, 0, 'j' },
 #ifdef USE_EEP
         { "eep-listen", required_argument, 0, 'L' },
         { "eep-send", required_argument, 0, 'H' },
         { "eep-parse", required_argument, 0, 'E' },
+        { "probe", no_argument, 0, 'P' },
 #endif
         { "quiet", no_argument, 0, 'q' },
+        { "bench", optional_argument, 0, 'b' },
+        { "sample", required_argument, 0, 'S' },
+        { "stats", optional_argument, 0, 'A' },
+        { "daemon", optional_argument, 0, 'n' },
+        { "attach", optional_argument, 0, 'a' },
     };
 
     // Parse command line arguments that have high priority
     opterr = 0;
-    char *options = "hVd:I:O:B:pqtW:k:crl:ivNqDL:H:ERf:F:T";
+    char *options = "hVd:I:O:B:pqtW:k:crl:m:ivM:NqDL:H:ERf:F:T:j:";
     while ((opt = getopt_long(argc, argv, options, long_options, &idx)) != -1) {
         switch (opt) {
             case 'h':
@@ -202,6 +363,7 @@ main(int argc, char* argv[])
     keyfile = setting_get_value(SETTING_CAPTURE_KEYFILE);
 #endif
     limit = setting_get_intvalue(SETTING_CAPTURE_LIMIT);
+    memory_limit = setting_get_intvalue(SETTING_CAPTURE_MEMORY);
     only_calls = setting_enabled(SETTING_SIP_CALLS);
     no_incomplete = setting_enabled(SETTING_SIP_NOINCOMPLETE);
     rtp_capture = setting_enabled(SETTING_CAPTURE_RTP);
@@ -234,6 +396,11 @@ main(int argc, char* argv[])
                 no_interface = 1;
                 setting_set_value(SETTING_CAPTURE_STORAGE, "none");
                 break;
+            case 'j':
+                json_outfile = optarg;
+                no_interface = 1;
+                setting_set_value(SETTING_CAPTURE_STORAGE, "none");
+                break;
             case 'B':
                 if(!(pcap_buffer_size = atoi(optarg))) {
                     fprintf(stderr, "Invalid buffer size.\n");
@@ -250,6 +417,12 @@ main(int argc, char* argv[])
                     return 0;
                 }
                 break;
+            case 'm':
+                if((memory_limit = atoi(optarg)) <= 0) {
+                    fprintf(stderr, "Invalid memory limit value.\n");
+                    return 0;
+                }
+                break;
             case 'k':
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
                 keyfile = optarg;
@@ -272,6 +445,9 @@ main(int argc, char* argv[])
             case 'v':
                 match_invert++;
                 break;
+            case 'M':
+                match_file = optarg;
+                break;
             case 'N':
                 no_interface = 1;
                 setting_set_value(SETTING_CAPTURE_STORAGE, "none");
@@ -288,6 +464,51 @@ main(int argc, char* argv[])
                 break;
             case 'F':  /* handled before with higher priority options */
                 break;
+            case 'b':
+                bench_speed = optarg ? atof(optarg) : 0;
+                if (bench_speed < 0) {
+                    fprintf(stderr, "Invalid benchmark speed.\n");
+                    return 1;
+                }
+                break;
+            case 'S':
+                setting_set_value(SETTING_CAPTURE_FILTER_SAMPLE, optarg);
+                break;
+            case 'A':
+                if (optarg && !strcasecmp(optarg, "json")) {
+                    report_enable(REPORT_JSON);
+                } else if (!optarg || !strcasecmp(optarg, "text")) {
+                    report_enable(REPORT_TEXT);
+                } else {
+                    fprintf(stderr, "Invalid report format %s.\n", optarg);
+                    return 1;
+                }
+                // Dialogs are accounted when rotated, frames are never stored
+                report = no_interface = quiet = rotate = rtp_capture = 1;
+                setting_set_value(SETTING_CAPTURE_STORAGE, "none");
+                setting_set_value(SETTING_CAPTURE_ROTATE, SETTING_ON);
+                setting_set_value(SETTING_CAPTURE_RTP, SETTING_ON);
+                break;
+            case 'n':
+#ifdef HAVE_SHM_OPEN
+                // Daemon does not parse captured frames
+                daemon_mode = no_interface = quiet = 1;
+                daemon_name = optarg;
+                setting_set_value(SETTING_CAPTURE_STORAGE, "none");
+                break;
+#else
+                fprintf(stderr, "sngrep is not compiled with shared memory support.");
+                exit(1);
+#endif
+            case 'a':
+#ifdef HAVE_SHM_OPEN
+                attach = 1;
+                attach_name = optarg;
+                break;
+#else
+                fprintf(stderr, "sngrep is not compiled with shared memory support.");
+                exit(1);
+#endif
             case 'R':
                 rotate = 1;
                 setting_set_value(SETTING_CAPTURE_ROTATE, SETTING_ON);
@@ -320,6 +541,14 @@ main(int argc, char* argv[])
 #else
                 fprintf(stderr, "sngrep is not compiled with HEP/EEP support.");
                 exit(1);
+#endif
+            case 'P':
+#ifdef USE_EEP
+                setting_set_value(SETTING_EEP_SEND_PROBE, SETTING_ON);
+                break;
+#else
+                fprintf(stderr, "sngrep is not compiled with HEP/EEP support.");
+                exit(1);
 #endif
             case '?':
                 if (strchr(options, optopt)) {
@@ -356,6 +585,14 @@ main(int argc, char* argv[])
 
     // Initialize SIP Messages Storage
     sip_init(limit, only_calls, no_incomplete);
+    // Discard dialogs not matching capture filters
+    if (sip_filter_init() != 0) {
+        fprintf(stderr, "Invalid capture.filter settings\n");
+        return 1;
+    }
+    // Rotate calls when their memory exceeds the limit
+    if (memory_limit > 0)
+        sip_set_memory_limit((uint64_t) memory_limit * 1024 * 1024);
 
     // Set capture options
     capture_init(limit, rtp_capture, rotate, pcap_buffer_size);
@@ -371,6 +608,12 @@ main(int argc, char* argv[])
     capture_eep_init();
 #endif
 
+#ifdef HAVE_SHM_OPEN
+    // Read frames from a running daemon
+    if (attach && capture_shm_attach(attach_name) != 0)
+        return 1;
+#endif
+
     // If no device or files has been specified in command line, use default
     if (capture_sources_count() == 0
         && vector_count(indevices) == 0
@@ -384,15 +627,39 @@ main(int argc, char* argv[])
         sng_free(token);
     }
 
+    // Benchmark replays input files from memory
+    if (bench_speed >= 0 && vector_count(infiles) == 0) {
+        fprintf(stderr, "Benchmark requires an input file (-I).\n");
+        return 1;
+    }
+
+    // Statistics report is built from input files only
+    if (report && vector_count(infiles) == 0) {
+        fprintf(stderr, "Statistics report requires an input file (-I).\n");
+        return 1;
+    }
+
     // If we have an input file, load it
     for (i = 0; i < vector_count(infiles); i++) {
         // Try to load file
-        if (capture_offline(vector_item(infiles, i)) != 0)
+        if (bench_speed >= 0) {
+            if (capture_bench(vector_item(infiles, i), bench_speed) != 0)
+                return 1;
+        } else if (capture_offline(vector_item(infiles, i)) != 0) {
             return 1;
+        }
     }
 
     // If we have an input device, load it
     for (i = 0; i < vector_count(indevices); i++) {
+#ifdef USE_TPACKET
+        // Capture from AF_PACKET rings if enabled
+        if (setting_enabled(SETTING_CAPTURE_TPACKET)) {
+            if (capture_tpacket_online(vector_item(indevices, i)) != 0)
+                return 1;
+            continue;
+        }
+#endif
         // Check if all capture data is valid
         if (capture_online(vector_item(indevices, i)) != 0)
             return 1;
@@ -401,11 +668,13 @@ main(int argc, char* argv[])
 
 
 
+    // Share frames of all sources instead of parsing them
+    if (daemon_mode && capture_daemon_start(daemon_name) != 0)
+        return 1;
+
     if (outfile)
     {
-        ino_t dump_inode;
-        pcap_dumper_t *dumper = dump_open(outfile, &dump_inode);
-        capture_set_dumper(dumper, dump_inode);
+        capture_dump_start(outfile);
     }
 
     // Remove Input files vector
@@ -447,6 +716,34 @@ main(int argc, char* argv[])
             }
     }
 
+    // Load match file patterns
+    if (match_file) {
+        if ((i = sip_set_match_file(match_file, match_insensitive, match_invert)) < 0) {
+            fprintf(stderr, "Unable to load match file %s\n", match_file);
+            return 1;
+        } else if (i > 0) {
+            fprintf(stderr, "Unable to parse pattern at %s:%d\n", match_file, i);
+            return 1;
+        }
+    }
+
+    // Open streaming output files
+    if (text_outfile && output_open(OUTPUT_TEXT, text_outfile) != 0) {
+        fprintf(stderr, "Couldn't open sip output file %s\n", text_outfile);
+        return 1;
+    }
+    if (json_outfile && output_open(OUTPUT_JSON, json_outfile) != 0) {
+        fprintf(stderr, "Couldn't open json output file %s\n", json_outfile);
+        return 1;
+    }
+    // Dialog count would be mixed with streamed output
+    if (output_is_stdout())
+        quiet = 1;
+
+    // Measure packet processing stages time if requested
+    metrics_timing_enable(setting_enabled(SETTING_CAPTURE_TIMING) || bench_speed >= 0,
+                          setting_get_intvalue(SETTING_CAPTURE_TIMING_SAMPLE));
+
     // Start a capture thread
     if (capture_launch_thread() != 0) {
         ncurses_deinit();
@@ -454,6 +751,20 @@ main(int argc, char* argv[])
         return 1;
     }
 
+    // Start metrics endpoint if configured
+    metrics_address = setting_get_value(SETTING_CAPTURE_METRICS);
+    if (metrics_address && strlen(metrics_address) && metrics_init(metrics_address) != 0) {
+        fprintf(stderr, "Unable to listen for metrics requests on %s\n", metrics_address);
+        return 1;
+    }
+
+    // Save dialogs matching configured triggers
+    trigger_dir = setting_get_value(SETTING_CAPTURE_TRIGGER_DIR);
+    if (trigger_dir && strlen(trigger_dir) && trigger_init(trigger_dir) != 0) {
+        fprintf(stderr, "Invalid capture.trigger.codes or capture.trigger.match settings\n");
+        return 1;
+    }
+
     if (!no_interface) {
         // Initialize interface
         ncurses_init();
@@ -463,52 +774,63 @@ main(int argc, char* argv[])
         ui_wait_for_input();
     } else {
         setbuf(stdout, NULL);
+        stats_interval = setting_get_intvalue(SETTING_CAPTURE_STATS_INTERVAL);
+        stats_time = time(NULL);
         while(capture_is_running() && !was_sigterm_received()) {
             if (!quiet)
                 printf("\rDialog count: %d", sip_calls_count_unrotated());
+            // Periodically print capture counters
+            if (stats_interval > 0 && time(NULL) - stats_time >= stats_interval) {
+                stats_time = time(NULL);
+                print_capture_stats();
+            }
+            // Print stages timing when requested with SIGUSR1
+            if (was_sigusr1_received())
+                metrics_timing_dump(stderr);
+            output_flush();
             usleep(500 * 1000);
         }
         if (!quiet)
             printf("\rDialog count: %d\n", sip_calls_count_unrotated());
+        if (stats_interval > 0)
+            print_capture_stats();
+        if (match_file)
+            print_match_stats();
     }
 
 
-    if (text_outfile)
-    {
-        vector_iter_t calls;
-        calls = sip_calls_iterator();
-
-        sip_call_t *call = NULL;
-        sip_msg_t *msg = NULL;
-        vector_iter_t msgs;
+    // Deinitialize interface
+    ncurses_deinit();
 
-        FILE *f = NULL;
+    // Print benchmark results once interface is closed
+    print_bench_stats();
 
-        if (!(f = fopen(text_outfile, "w"))) {
-            fprintf(stderr, "Couldn't open sip output file");
-            return 0;
-        }
+    // Stop metrics endpoint
+    metrics_deinit();
 
-        while ((call = vector_iterator_next(&calls))) {
-            msgs = vector_iterator(call->msgs);
-            // Save SIP message content
-            while ((msg = vector_iterator_next(&msgs))) {
-                save_msg_txt(f, msg);
-            }
-        }
-        fclose(f);
-    }
     // Capture deinit
     capture_deinit();
 
-    // Deinitialize interface
-    ncurses_deinit();
+    // Discard pending triggered dialogs
+    trigger_deinit();
+
+    // Close streaming output files
+    output_close();
+
+#ifdef USE_EEP
+    // Stop sending HEP packets
+    capture_eep_deinit();
+#endif
 
     // Deinitialize configuration options
     deinit_options();
 
     // Deallocate sip stored messages
     sip_deinit();
+    sip_filter_deinit();
+
+    // Print report once remaining dialogs have been accounted
+    report_print(stdout);
 
     // Leaving!
     return 0;
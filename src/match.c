@@ -0,0 +1,456 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file match.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in match.h
+ *
+ * The automaton works over byte classes instead of raw bytes: all bytes
+ * that are not part of any required text share the same class, so the
+ * transition table only has a column for each distinct pattern byte.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#ifdef WITH_PCRE
+#include <pcre.h>
+#elif defined(WITH_PCRE2)
+#include <pcre2.h>
+#else
+#include <regex.h>
+#endif
+#include "match.h"
+#include "util.h"
+
+//! Max length of a pattern line in patterns file
+#define MATCH_LINE_MAXLEN 1024
+
+//! Shorter declaration of match_pattern structure
+typedef struct match_pattern match_pattern_t;
+
+/**
+ * @brief Single pattern of the set
+ */
+struct match_pattern
+{
+    //! Pattern text
+    char *text;
+    //! Text required to match the pattern
+    char literal[EXPR_LITERAL_MAXLEN];
+    //! Pattern is just the required text
+    bool literal_only;
+#ifdef WITH_PCRE
+    //! Compiled pattern
+    pcre *regex;
+#elif defined(WITH_PCRE2)
+    //! Compiled pattern
+    pcre2_code *regex;
+#else
+    //! Compiled pattern
+    regex_t regex;
+#endif
+    //! Next pattern with the same automaton output state
+    int next;
+    //! Number of matched data
+    uint64_t hits;
+};
+
+/**
+ * @brief Set of patterns and the automaton of their required texts
+ */
+struct match_set
+{
+    //! Ignore case in all patterns
+    bool caseless;
+    //! Patterns of the set
+    match_pattern_t *patterns;
+    //! Number of patterns
+    int count;
+    //! Allocated patterns
+    int size;
+    //! Patterns that have no required text
+    int *always;
+    //! Number of patterns without required text
+    int always_count;
+    //! Byte class of each data byte
+    uint8_t classes[256];
+    //! Number of byte classes
+    int class_count;
+    //! Transition table (states x classes)
+    int32_t *delta;
+    //! First pattern whose required text ends in each state (-1 if none)
+    int32_t *output;
+    //! Next state in the failure chain with output (0 if none)
+    int32_t *dict;
+    //! Number of automaton states
+    int state_count;
+#ifdef WITH_PCRE2
+    //! Per thread match data
+    pthread_key_t match_key;
+#endif
+};
+
+#ifdef WITH_PCRE2
+/**
+ * @brief Free match data of a finished thread
+ */
+static void
+match_data_destroy(void *match_data)
+{
+    pcre2_match_data_free((pcre2_match_data *) match_data);
+}
+#endif
+
+match_set_t *
+match_set_create(bool caseless)
+{
+    match_set_t *set;
+
+    if (!(set = sng_malloc(sizeof(match_set_t))))
+        return NULL;
+
+    set->caseless = caseless;
+#ifdef WITH_PCRE2
+    if (pthread_key_create(&set->match_key, match_data_destroy) != 0) {
+        sng_free(set);
+        return NULL;
+    }
+#endif
+    return set;
+}
+
+void
+match_set_destroy(match_set_t *set)
+{
+    int i;
+
+    if (!set)
+        return;
+
+    for (i = 0; i < set->count; i++) {
+        free(set->patterns[i].text);
+        if (set->patterns[i].literal_only)
+            continue;
+#ifdef WITH_PCRE
+        pcre_free(set->patterns[i].regex);
+#elif defined(WITH_PCRE2)
+        pcre2_code_free(set->patterns[i].regex);
+#else
+        regfree(&set->patterns[i].regex);
+#endif
+    }
+
+#ifdef WITH_PCRE2
+    pthread_key_delete(set->match_key);
+#endif
+    free(set->patterns);
+    free(set->always);
+    free(set->delta);
+    free(set->output);
+    free(set->dict);
+    sng_free(set);
+}
+
+/**
+ * @brief Compile the regular expression of a pattern
+ *
+ * Expressions use the same flags of the match expression.
+ */
+static int
+match_pattern_compile(match_set_t *set, match_pattern_t *pattern)
+{
+#ifdef WITH_PCRE
+    const char *re_err = NULL;
+    int32_t err_offset;
+    int32_t pflags = PCRE_UNGREEDY | PCRE_DOTALL;
+
+    if (set->caseless)
+        pflags |= PCRE_CASELESS;
+
+    pattern->regex = pcre_compile(pattern->text, pflags, &re_err, &err_offset, 0);
+    return pattern->regex == NULL;
+#elif defined(WITH_PCRE2)
+    int re_err = 0;
+    PCRE2_SIZE err_offset = 0;
+    uint32_t pflags = PCRE2_UNGREEDY | PCRE2_DOTALL;
+
+    if (set->caseless)
+        pflags |= PCRE2_CASELESS;
+
+    pattern->regex = pcre2_compile((PCRE2_SPTR) pattern->text, PCRE2_ZERO_TERMINATED, pflags, &re_err, &err_offset, NULL);
+    if (pattern->regex == NULL)
+        return 1;
+
+    // Use JIT compiled expression if available
+    pcre2_jit_compile(pattern->regex, PCRE2_JIT_COMPLETE);
+    return 0;
+#else
+    int cflags = REG_EXTENDED | REG_NOSUB;
+
+    if (set->caseless)
+        cflags |= REG_ICASE;
+
+    return regcomp(&pattern->regex, pattern->text, cflags) != 0;
+#endif
+}
+
+/**
+ * @brief Run the regular expression of a pattern
+ */
+static bool
+match_pattern_exec(match_set_t *set, match_pattern_t *pattern, const char *data)
+{
+#ifdef WITH_PCRE
+    return pcre_exec(pattern->regex, 0, data, strlen(data), 0, 0, 0, 0) >= 0;
+#elif defined(WITH_PCRE2)
+    pcre2_match_data *match_data;
+
+    if (!(match_data = pthread_getspecific(set->match_key))) {
+        // Only whole match offsets are required
+        match_data = pcre2_match_data_create(1, NULL);
+        pthread_setspecific(set->match_key, match_data);
+    }
+
+    return pcre2_match(pattern->regex, (PCRE2_SPTR) data, (PCRE2_SIZE) strlen(data), 0, 0, match_data, NULL) >= 0;
+#else
+    return regexec(&pattern->regex, data, 0, NULL, 0) == 0;
+#endif
+}
+
+int
+match_set_add(match_set_t *set, const char *pattern)
+{
+    match_pattern_t *patterns, *new;
+
+    // Patterns can not be added after building the automaton
+    if (set->delta)
+        return 1;
+
+    if (set->count == set->size) {
+        if (!(patterns = realloc(set->patterns, sizeof(match_pattern_t) * (set->size ? set->size * 2 : 64))))
+            return 1;
+        set->patterns = patterns;
+        set->size = set->size ? set->size * 2 : 64;
+    }
+
+    new = &set->patterns[set->count];
+    memset(new, 0, sizeof(match_pattern_t));
+    if (!(new->text = strdup(pattern)))
+        return 1;
+
+    new->literal_only = expr_required_literal(pattern, new->literal);
+    if (!new->literal_only && match_pattern_compile(set, new) != 0) {
+        free(new->text);
+        return 1;
+    }
+
+    set->count++;
+    return 0;
+}
+
+int
+match_set_load(match_set_t *set, const char *file)
+{
+    FILE *fp;
+    char line[MATCH_LINE_MAXLEN];
+    int lineno = 0, len;
+
+    if (!(fp = fopen(file, "r")))
+        return -1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+
+        // Remove line ending characters
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        // Ignore comments and empty lines
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        if (match_set_add(set, line) != 0) {
+            fclose(fp);
+            return lineno;
+        }
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int
+match_set_compile(match_set_t *set)
+{
+    int32_t *queue, state, fail, next;
+    int i, c, head, tail, states;
+    const char *byte;
+
+    if (set->delta)
+        return 0;
+
+    // Assign a class to each byte of the required texts, class 0 is
+    // used for the bytes that can not be part of any text
+    memset(set->classes, 0, sizeof(set->classes));
+    set->class_count = 1;
+    states = 1;
+    for (i = 0; i < set->count; i++) {
+        for (byte = set->patterns[i].literal; *byte; byte++) {
+            c = (set->caseless) ? tolower((unsigned char) *byte) : (unsigned char) *byte;
+            if (!set->classes[c]) {
+                set->classes[c] = set->class_count++;
+                if (set->caseless)
+                    set->classes[toupper(c)] = set->classes[c];
+            }
+        }
+        states += strlen(set->patterns[i].literal);
+    }
+
+    if (!(set->delta = calloc((size_t) states * set->class_count, sizeof(int32_t)))
+        || !(set->output = malloc(sizeof(int32_t) * states))
+        || !(set->dict = calloc(states, sizeof(int32_t)))
+        || !(set->always = malloc(sizeof(int) * (set->count + 1)))
+        || !(queue = malloc(sizeof(int32_t) * states))) {
+        free(set->delta);
+        free(set->output);
+        free(set->dict);
+        free(set->always);
+        set->delta = set->output = set->dict = NULL;
+        set->always = NULL;
+        return 1;
+    }
+    memset(set->output, -1, sizeof(int32_t) * states);
+
+    // Add each required text to the trie, using 0 as missing transition
+    // as no state can go back to the root state
+    set->state_count = 1;
+    set->always_count = 0;
+    for (i = 0; i < set->count; i++) {
+        if (!set->patterns[i].literal[0]) {
+            set->always[set->always_count++] = i;
+            continue;
+        }
+        state = 0;
+        for (byte = set->patterns[i].literal; *byte; byte++) {
+            c = set->classes[(unsigned char) *byte];
+            if (!(next = set->delta[state * set->class_count + c]))
+                next = set->delta[state * set->class_count + c] = set->state_count++;
+            state = next;
+        }
+        set->patterns[i].next = set->output[state];
+        set->output[state] = i;
+    }
+
+    // Fill missing transitions in breadth-first order using failure links
+    head = tail = 0;
+    for (c = 0; c < set->class_count; c++) {
+        if ((next = set->delta[c]))
+            queue[tail++] = next;
+    }
+    // Failure state of each queued state is stored in dict until processed
+    while (head < tail) {
+        state = queue[head++];
+        fail = set->dict[state];
+        // Nearest state in the failure chain with output
+        set->dict[state] = (set->output[fail] >= 0) ? fail : set->dict[fail];
+        for (c = 0; c < set->class_count; c++) {
+            next = set->delta[state * set->class_count + c];
+            if (next) {
+                set->dict[next] = set->delta[fail * set->class_count + c];
+                queue[tail++] = next;
+            } else {
+                set->delta[state * set->class_count + c] = set->delta[fail * set->class_count + c];
+            }
+        }
+    }
+
+    free(queue);
+    return 0;
+}
+
+bool
+match_set_check(match_set_t *set, const char *data)
+{
+    uint64_t found[set->count / 64 + 1];
+    const int32_t *delta = set->delta;
+    int32_t state = 0, out;
+    bool matched = false;
+    const unsigned char *byte;
+    match_pattern_t *pattern;
+    int i, word, bit;
+
+    if (!set->delta)
+        return false;
+
+    memset(found, 0, sizeof(found));
+
+    // Mark all patterns whose required text is found in data
+    for (byte = (const unsigned char *) data; *byte; byte++) {
+        state = delta[state * set->class_count + set->classes[*byte]];
+        for (out = (set->output[state] >= 0) ? state : set->dict[state]; out; out = set->dict[out]) {
+            for (i = set->output[out]; i >= 0; i = set->patterns[i].next)
+                found[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+    }
+
+    // Patterns without required text are always candidates
+    for (i = 0; i < set->always_count; i++)
+        found[set->always[i] / 64] |= (uint64_t) 1 << (set->always[i] % 64);
+
+    // Check the expression of each candidate pattern
+    for (word = 0; word <= set->count / 64; word++) {
+        while (found[word]) {
+            bit = __builtin_ctzll(found[word]);
+            found[word] &= found[word] - 1;
+            pattern = &set->patterns[word * 64 + bit];
+            if (pattern->literal_only || match_pattern_exec(set, pattern, data)) {
+                __atomic_add_fetch(&pattern->hits, 1, __ATOMIC_RELAXED);
+                matched = true;
+            }
+        }
+    }
+
+    return matched;
+}
+
+int
+match_set_count(match_set_t *set)
+{
+    return set->count;
+}
+
+const char *
+match_set_pattern(match_set_t *set, int idx, uint64_t *hits)
+{
+    if (idx < 0 || idx >= set->count)
+        return NULL;
+
+    if (hits)
+        *hits = __atomic_load_n(&set->patterns[idx].hits, __ATOMIC_RELAXED);
+    return set->patterns[idx].text;
+}
@@ -0,0 +1,128 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file match.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to match payloads against a set of patterns
+ *
+ * The required text of all patterns is searched at once using an
+ * Aho-Corasick automaton, so each payload is read only once no matter
+ * how many patterns are loaded. Regular expressions are only executed
+ * when their required text has been found.
+ *
+ */
+#ifndef __SNGREP_MATCH_H
+#define __SNGREP_MATCH_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Shorter declaration of match_set structure
+typedef struct match_set match_set_t;
+
+/**
+ * @brief Create an empty pattern set
+ *
+ * @param caseless Ignore case when matching all patterns
+ * @return allocated pattern set or NULL on error
+ */
+match_set_t *
+match_set_create(bool caseless);
+
+/**
+ * @brief Deallocate a pattern set and all its patterns
+ */
+void
+match_set_destroy(match_set_t *set);
+
+/**
+ * @brief Add a new pattern to the set
+ *
+ * Patterns are regular expressions with the same syntax of the
+ * match expression. Patterns without special characters are
+ * matched without running the expression.
+ *
+ * @param set Pattern set
+ * @param pattern Pattern text
+ * @return 0 if pattern has been added, 1 otherwise
+ */
+int
+match_set_add(match_set_t *set, const char *pattern);
+
+/**
+ * @brief Add all patterns from a file, one per line
+ *
+ * Empty lines and lines starting with '#' are ignored.
+ *
+ * @param set Pattern set
+ * @param file Patterns file path
+ * @return 0 on success, -1 if file can not be read, line number
+ * of the first invalid pattern otherwise
+ */
+int
+match_set_load(match_set_t *set, const char *file);
+
+/**
+ * @brief Build the automaton for all added patterns
+ *
+ * This must be called after adding patterns and before checking
+ * any payload.
+ *
+ * @param set Pattern set
+ * @return 0 on success, 1 otherwise
+ */
+int
+match_set_compile(match_set_t *set);
+
+/**
+ * @brief Check if data matches any pattern of the set
+ *
+ * Hit counter of all matching patterns is incremented.
+ * This function can be called from multiple threads.
+ *
+ * @param set Compiled pattern set
+ * @param data NUL terminated data
+ * @return true if at least one pattern matches
+ */
+bool
+match_set_check(match_set_t *set, const char *data);
+
+/**
+ * @brief Get the number of patterns in the set
+ */
+int
+match_set_count(match_set_t *set);
+
+/**
+ * @brief Get pattern text and hit counter
+ *
+ * @param set Pattern set
+ * @param idx Pattern position in the set
+ * @param hits Number of checked data that matched this pattern
+ * @return Pattern text or NULL if idx is out of bounds
+ */
+const char *
+match_set_pattern(match_set_t *set, int idx, uint64_t *hits);
+
+#endif /* __SNGREP_MATCH_H */
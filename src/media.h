@@ -64,7 +64,8 @@ struct sdp_media {
 /**
  * @brief Allocate memory for a new media structure
  *
- * Create a structure for a new message sdp connection data.
+ * Create a structure for a new message sdp connection data. Media is
+ * allocated in the message call memory.
  *
  * @param msg SIP Message pointer owner of this media
  * @return new allocated structure
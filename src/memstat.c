@@ -0,0 +1,86 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file memstat.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in memstat.h
+ *
+ * Counters are updated from all capture threads, so they use relaxed
+ * atomics. High-water marks are only moved forward.
+ */
+#include "config.h"
+#include <stdbool.h>
+#include "memstat.h"
+
+//! Live and max accounted bytes of each tag
+static struct
+{
+    int64_t live[MEMSTAT_COUNT];
+    int64_t peak[MEMSTAT_COUNT];
+} memstat;
+
+//! Display name of each tag
+static const char *memstat_names[MEMSTAT_COUNT] = {
+    "packets",
+    "frames",
+    "payloads",
+    "messages",
+    "calls",
+    "streams",
+    "rtp",
+    "reassembly",
+    "tls",
+    "ui",
+};
+
+void
+memstat_add(enum memstat_tag tag, int64_t bytes)
+{
+    int64_t live, peak;
+
+    live = __atomic_add_fetch(&memstat.live[tag], bytes, __ATOMIC_RELAXED);
+    if (bytes <= 0)
+        return;
+
+    peak = __atomic_load_n(&memstat.peak[tag], __ATOMIC_RELAXED);
+    while (live > peak) {
+        if (__atomic_compare_exchange_n(&memstat.peak[tag], &peak, live, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            break;
+    }
+}
+
+void
+memstat_get(enum memstat_tag tag, int64_t *live, int64_t *peak)
+{
+    if (live)
+        *live = __atomic_load_n(&memstat.live[tag], __ATOMIC_RELAXED);
+    if (peak)
+        *peak = __atomic_load_n(&memstat.peak[tag], __ATOMIC_RELAXED);
+}
+
+const char *
+memstat_name(enum memstat_tag tag)
+{
+    return memstat_names[tag];
+}
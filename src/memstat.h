@@ -0,0 +1,91 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file memstat.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to account memory used by each subsystem
+ *
+ * Allocations of long lived structures are tagged with the subsystem
+ * that owns them, keeping live bytes and high-water mark of each tag.
+ * Tags do not overlap, memory of a structure is only accounted once.
+ */
+#ifndef __SNGREP_MEMSTAT_H
+#define __SNGREP_MEMSTAT_H
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * @brief Subsystems with accounted memory
+ */
+enum memstat_tag {
+    //! Packet structures
+    MEMSTAT_PACKETS = 0,
+    //! Captured frames of SIP packets
+    MEMSTAT_FRAMES,
+    //! Payload copies not stored in frames
+    MEMSTAT_PAYLOADS,
+    //! SIP messages and their SDP media
+    MEMSTAT_MSGS,
+    //! Call structures and unused call memory
+    MEMSTAT_CALLS,
+    //! RTP streams
+    MEMSTAT_STREAMS,
+    //! Captured frames and headers of RTP packets
+    MEMSTAT_RTP,
+    //! Data pending IP or TCP reassembly
+    MEMSTAT_REASM,
+    //! TLS connections
+    MEMSTAT_TLS,
+    //! Interface panels data
+    MEMSTAT_UI,
+    //! Number of tags
+    MEMSTAT_COUNT
+};
+
+/**
+ * @brief Account allocated or released memory of a subsystem
+ *
+ * @param tag Subsystem owning the memory
+ * @param bytes Allocated bytes, negative when memory is released
+ */
+void
+memstat_add(enum memstat_tag tag, int64_t bytes);
+
+/**
+ * @brief Get accounted memory of a subsystem
+ *
+ * @param tag Subsystem to check
+ * @param live Bytes currently allocated
+ * @param peak Max bytes allocated at the same time
+ */
+void
+memstat_get(enum memstat_tag tag, int64_t *live, int64_t *peak);
+
+/**
+ * @brief Get the display name of a subsystem
+ */
+const char *
+memstat_name(enum memstat_tag tag);
+
+#endif /* __SNGREP_MEMSTAT_H */
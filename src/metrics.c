@@ -0,0 +1,645 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file metrics.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in metrics.h
+ *
+ * SIP counters and stage timings are updated by capture threads with
+ * relaxed atomics. All other values are read from their modules when a
+ * request arrives, so nothing is accounted twice.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+#include "capture.h"
+#include "sip.h"
+#include "storage.h"
+#include "memstat.h"
+#include "trigger.h"
+#include "sip_filter.h"
+#include "thread.h"
+#ifdef USE_EEP
+#include "capture_eep.h"
+#endif
+#ifdef WITH_GNUTLS
+#include "capture_gnutls.h"
+#endif
+#ifdef WITH_OPENSSL
+#include "capture_openssl.h"
+#endif
+#include "util.h"
+
+//! Shorter declaration of metrics structure
+typedef struct metrics metrics_t;
+
+/**
+ * @brief Metrics listener status and SIP counters
+ */
+struct metrics {
+    //! Listening socket (-1 if metrics are disabled)
+    int sock;
+    //! Unix socket path to remove on exit
+    char path[108];
+    //! Metrics thread is running
+    bool running;
+    //! Metrics thread
+    pthread_t thread;
+    //! SIP messages by request method or response code (0 for unknown)
+    uint64_t sip_msgs[METRICS_SIP_MAXCODE];
+    //! Stage timing is being measured
+    bool timing;
+    //! Measure one of each timing_sample events
+    int timing_sample;
+    //! Stage timing histograms (bucket i counts times below 2^i ns)
+    uint64_t timing_buckets[METRICS_STAGE_COUNT][METRICS_TIMING_BUCKETS];
+    //! Stage total measured time in nanoseconds
+    uint64_t timing_sum[METRICS_STAGE_COUNT];
+};
+
+//! Metrics listener and counters
+static metrics_t metrics = { .sock = -1, .timing_sample = 1 };
+
+//! Events seen by this thread since its last measured one
+static __thread int metrics_timing_skipped;
+
+//! Stage names for display and exported metrics
+static const char *metrics_stage_names[METRICS_STAGE_COUNT] = {
+    "ip_reasm", "tcp_reasm", "tls", "sip_validate", "sip_check",
+    "rtp_check", "dump", "eep_send", "lock_wait", "batch"
+};
+
+/**
+ * @brief Create a listening socket for the given address
+ *
+ * @return socket descriptor or -1 on error
+ */
+static int
+metrics_listen(const char *address)
+{
+    struct sockaddr_un sun;
+    struct addrinfo hints, *ai;
+    char host[256], *port;
+    int sock, on = 1;
+
+    // Unix socket path
+    if (address[0] == '/') {
+        if (strlen(address) >= sizeof(sun.sun_path))
+            return -1;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, address);
+        unlink(address);
+        if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+            return -1;
+        if (bind(sock, (struct sockaddr *) &sun, sizeof(sun)) == -1
+            || listen(sock, METRICS_BACKLOG) == -1) {
+            close(sock);
+            return -1;
+        }
+        strcpy(metrics.path, address);
+        return sock;
+    }
+
+    // TCP host:port address
+    strncpy(host, address, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    if (!(port = strrchr(host, ':')))
+        return -1;
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(strlen(host) ? host : NULL, port, &hints, &ai) != 0)
+        return -1;
+
+    if ((sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1) {
+        freeaddrinfo(ai);
+        return -1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(sock, ai->ai_addr, ai->ai_addrlen) == -1
+        || listen(sock, METRICS_BACKLOG) == -1) {
+        freeaddrinfo(ai);
+        close(sock);
+        return -1;
+    }
+
+    freeaddrinfo(ai);
+    return sock;
+}
+
+/**
+ * @brief Write SIP messages counters
+ */
+static void
+metrics_write_sip(FILE *f)
+{
+    const char *method;
+    uint64_t count;
+    int i;
+
+    fputs("# HELP sngrep_sip_requests_total SIP requests parsed by method\n"
+          "# TYPE sngrep_sip_requests_total counter\n", f);
+    for (i = 0; i < 100; i++) {
+        if (!(count = __atomic_load_n(&metrics.sip_msgs[i], __ATOMIC_RELAXED)))
+            continue;
+        method = (i > 0) ? sip_method_str(i) : NULL;
+        fprintf(f, "sngrep_sip_requests_total{method=\"%s\"} %" PRIu64 "\n",
+                method ? method : "other", count);
+    }
+
+    fputs("# HELP sngrep_sip_responses_total SIP responses parsed by code\n"
+          "# TYPE sngrep_sip_responses_total counter\n", f);
+    for (i = 100; i < METRICS_SIP_MAXCODE; i++) {
+        if ((count = __atomic_load_n(&metrics.sip_msgs[i], __ATOMIC_RELAXED)))
+            fprintf(f, "sngrep_sip_responses_total{code=\"%d\"} %" PRIu64 "\n", i, count);
+    }
+
+    fputs("# HELP sngrep_filter_dropped_total Dialogs discarded by capture filters\n"
+          "# TYPE sngrep_filter_dropped_total counter\n", f);
+    for (i = 0; i < SIP_FILTER_COUNT; i++) {
+        fprintf(f, "sngrep_filter_dropped_total{filter=\"%s\"} %" PRIu64 "\n",
+                sip_filter_name(i), sip_filter_dropped(i));
+    }
+}
+
+/**
+ * @brief Write stage timing histograms
+ */
+static void
+metrics_write_timing(FILE *f)
+{
+    uint64_t total;
+    int i, j;
+
+    fputs("# HELP sngrep_stage_seconds Time spent by packet processing stages\n"
+          "# TYPE sngrep_stage_seconds histogram\n", f);
+    for (i = 0; i < METRICS_STAGE_COUNT; i++) {
+        total = 0;
+        for (j = 0; j < METRICS_TIMING_BUCKETS; j++) {
+            total += __atomic_load_n(&metrics.timing_buckets[i][j], __ATOMIC_RELAXED);
+            fprintf(f, "sngrep_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %" PRIu64 "\n",
+                    metrics_stage_names[i], (double) (1ULL << j) / 1000000000, total);
+        }
+        fprintf(f, "sngrep_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu64 "\n"
+                "sngrep_stage_seconds_sum{stage=\"%s\"} %g\n"
+                "sngrep_stage_seconds_count{stage=\"%s\"} %" PRIu64 "\n",
+                metrics_stage_names[i], total, metrics_stage_names[i],
+                (double) __atomic_load_n(&metrics.timing_sum[i], __ATOMIC_RELAXED) / 1000000000,
+                metrics_stage_names[i], total);
+    }
+}
+
+/**
+ * @brief Write tagged allocation counters
+ */
+static void
+metrics_write_alloc(FILE *f)
+{
+    int64_t live[MEMSTAT_COUNT], peak[MEMSTAT_COUNT];
+    int i;
+
+    for (i = 0; i < MEMSTAT_COUNT; i++)
+        memstat_get(i, &live[i], &peak[i]);
+
+    fputs("# HELP sngrep_alloc_bytes Allocated memory by subsystem\n"
+          "# TYPE sngrep_alloc_bytes gauge\n", f);
+    for (i = 0; i < MEMSTAT_COUNT; i++)
+        fprintf(f, "sngrep_alloc_bytes{subsystem=\"%s\"} %" PRId64 "\n",
+                memstat_name(i), live[i]);
+    fputs("# HELP sngrep_alloc_peak_bytes Allocated memory high-water mark by subsystem\n"
+          "# TYPE sngrep_alloc_peak_bytes gauge\n", f);
+    for (i = 0; i < MEMSTAT_COUNT; i++)
+        fprintf(f, "sngrep_alloc_peak_bytes{subsystem=\"%s\"} %" PRId64 "\n",
+                memstat_name(i), peak[i]);
+}
+
+/**
+ * @brief Write capture sources counters
+ */
+static void
+metrics_write_sources(FILE *f)
+{
+    capture_stats_t stats;
+    const char *name;
+    int i;
+
+    fputs("# HELP sngrep_packets_received_total Packets read from capture source\n"
+          "# TYPE sngrep_packets_received_total counter\n", f);
+    for (i = 0; (name = capture_source_stats(i, &stats)); i++) {
+        name = name ? name : "-";
+        fprintf(f, "sngrep_packets_received_total{source=\"%s\"} %" PRIu64 "\n",
+                name, stats.received);
+    }
+
+    fputs("# HELP sngrep_packets_dropped_total Packets lost by capture stage\n"
+          "# TYPE sngrep_packets_dropped_total counter\n", f);
+    for (i = 0; (name = capture_source_stats(i, &stats)); i++) {
+        name = name ? name : "-";
+        fprintf(f, "sngrep_packets_dropped_total{source=\"%s\",stage=\"kernel\"} %" PRIu64 "\n"
+                "sngrep_packets_dropped_total{source=\"%s\",stage=\"interface\"} %" PRIu64 "\n"
+                "sngrep_packets_dropped_total{source=\"%s\",stage=\"queue\"} %" PRIu64 "\n"
+                "sngrep_packets_dropped_total{source=\"%s\",stage=\"reassembly\"} %" PRIu64 "\n",
+                name, stats.kernel_drops, name, stats.if_drops,
+                name, stats.queue_drops, name, stats.reasm_drops);
+    }
+
+    fputs("# HELP sngrep_packets_rejected_total Packets that are neither SIP nor RTP\n"
+          "# TYPE sngrep_packets_rejected_total counter\n", f);
+    for (i = 0; (name = capture_source_stats(i, &stats)); i++) {
+        name = name ? name : "-";
+        fprintf(f, "sngrep_packets_rejected_total{source=\"%s\"} %" PRIu64 "\n",
+                name, stats.rejected);
+    }
+}
+
+/**
+ * @brief Write all metrics with capture locked
+ */
+static void
+metrics_write(FILE *f)
+{
+    uint32_t pending, depth;
+    uint64_t expired, evicted, drops, len, zlen, limit;
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    uint64_t failures;
+#endif
+#ifdef USE_EEP
+    uint64_t sent, errors;
+#endif
+
+    metrics_write_sources(f);
+    metrics_write_sip(f);
+    metrics_write_timing(f);
+
+    capture_queue_stats(&depth, &drops);
+    fprintf(f, "# HELP sngrep_parser_queue_depth Packets pending to be parsed\n"
+            "# TYPE sngrep_parser_queue_depth gauge\n"
+            "sngrep_parser_queue_depth %u\n", depth);
+
+    fprintf(f, "# HELP sngrep_calls Dialogs stored\n"
+            "# TYPE sngrep_calls gauge\n"
+            "sngrep_calls %d\n"
+            "# HELP sngrep_calls_active Calls in setup or in conversation\n"
+            "# TYPE sngrep_calls_active gauge\n"
+            "sngrep_calls_active %d\n"
+            "# HELP sngrep_calls_total Dialogs captured\n"
+            "# TYPE sngrep_calls_total counter\n"
+            "sngrep_calls_total %d\n"
+            "# HELP sngrep_calls_rotated_total Dialogs removed by rotation\n"
+            "# TYPE sngrep_calls_rotated_total counter\n"
+            "sngrep_calls_rotated_total %" PRIu64 "\n"
+            "# HELP sngrep_calls_expired_total Dialogs removed by idle timeout\n"
+            "# TYPE sngrep_calls_expired_total counter\n"
+            "sngrep_calls_expired_total %" PRIu64 "\n",
+            sip_calls_count(), vector_count(sip_active_calls_vector()),
+            sip_calls_count_unrotated(), sip_calls_rotated(), sip_calls_expired());
+
+    fprintf(f, "# HELP sngrep_trigger_saved_total Dialogs saved by a trigger\n"
+            "# TYPE sngrep_trigger_saved_total counter\n"
+            "sngrep_trigger_saved_total %" PRIu64 "\n", trigger_saved_count());
+
+    fputs("# HELP sngrep_reasm_pending Incomplete datagrams and flows waiting for data\n"
+          "# TYPE sngrep_reasm_pending gauge\n", f);
+    capture_ip_reasm_stats(&pending, &expired, &evicted);
+    fprintf(f, "sngrep_reasm_pending{protocol=\"ip\"} %u\n", pending);
+    capture_tcp_reasm_stats(&pending, &expired, &evicted);
+    fprintf(f, "sngrep_reasm_pending{protocol=\"tcp\"} %u\n", pending);
+
+    fputs("# HELP sngrep_memory_bytes Memory used by subsystem\n"
+          "# TYPE sngrep_memory_bytes gauge\n", f);
+    fprintf(f, "sngrep_memory_bytes{subsystem=\"calls\"} %" PRIu64 "\n", sip_calls_memory(&limit));
+    storage_stats(&len, &zlen);
+    fprintf(f, "sngrep_memory_bytes{subsystem=\"storage\"} %" PRIu64 "\n", zlen);
+    fprintf(f, "# HELP sngrep_memory_limit_bytes Max memory used by stored dialogs\n"
+            "# TYPE sngrep_memory_limit_bytes gauge\n"
+            "sngrep_memory_limit_bytes %" PRIu64 "\n", limit);
+    metrics_write_alloc(f);
+
+    capture_dump_stats(&pending, &drops);
+    fprintf(f, "# HELP sngrep_dump_backlog Packets pending to be written to output file\n"
+            "# TYPE sngrep_dump_backlog gauge\n"
+            "sngrep_dump_backlog %u\n"
+            "# HELP sngrep_dump_dropped_total Packets not written to output file\n"
+            "# TYPE sngrep_dump_dropped_total counter\n"
+            "sngrep_dump_dropped_total %" PRIu64 "\n", pending, drops);
+
+#if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
+    // TLS connections are only tracked with a keyfile
+    if (capture_keyfile()) {
+        tls_connection_stats(&pending, &expired, &evicted, &failures);
+        fprintf(f, "# HELP sngrep_tls_connections TLS connections being decrypted\n"
+                "# TYPE sngrep_tls_connections gauge\n"
+                "sngrep_tls_connections %u\n"
+                "# HELP sngrep_tls_decrypt_failures_total TLS records that could not be decrypted\n"
+                "# TYPE sngrep_tls_decrypt_failures_total counter\n"
+                "sngrep_tls_decrypt_failures_total %" PRIu64 "\n"
+                "# HELP sngrep_tls_resumed_total TLS handshakes resumed from cached sessions\n"
+                "# TYPE sngrep_tls_resumed_total counter\n"
+                "sngrep_tls_resumed_total %" PRIu64 "\n", pending, failures, tls_session_resumed());
+    }
+#endif
+
+#ifdef USE_EEP
+    // HEP packets are only sent in send mode
+    if (capture_eep_send_port()) {
+        capture_eep_send_stats(&sent, &drops, &errors);
+        fprintf(f, "# HELP sngrep_hep_sent_total HEP packets sent\n"
+                "# TYPE sngrep_hep_sent_total counter\n"
+                "sngrep_hep_sent_total %" PRIu64 "\n"
+                "# HELP sngrep_hep_dropped_total HEP packets not sent\n"
+                "# TYPE sngrep_hep_dropped_total counter\n"
+                "sngrep_hep_dropped_total{reason=\"queue\"} %" PRIu64 "\n"
+                "sngrep_hep_dropped_total{reason=\"error\"} %" PRIu64 "\n",
+                sent, drops, errors);
+    }
+#endif
+}
+
+/**
+ * @brief Request saving the dialog given in a trigger request
+ *
+ * Call-ID is read from the callid query parameter, URL encoded.
+ */
+static void
+metrics_trigger(const char *query)
+{
+    char callid[SIP_CALLID_MAXLEN];
+    char hex[3] = "";
+    int len = 0;
+
+    for (; *query && *query != ' ' && *query != '&' && len < SIP_CALLID_MAXLEN - 1; query++) {
+        if (*query == '%' && query[1] && query[2]) {
+            memcpy(hex, query + 1, 2);
+            callid[len++] = (char) strtol(hex, NULL, 16);
+            query += 2;
+        } else {
+            callid[len++] = *query;
+        }
+    }
+    callid[len] = '\0';
+
+    if (len)
+        trigger_callid(callid);
+}
+
+/**
+ * @brief Answer a single metrics request
+ */
+static void
+metrics_answer(int client)
+{
+    char request[METRICS_REQUEST_MAXLEN], header[128];
+    struct pollfd pfd = { .fd = client, .events = POLLIN };
+    char *body = NULL;
+    size_t len = 0;
+    ssize_t rlen;
+    FILE *f;
+
+    if (poll(&pfd, 1, METRICS_POLL_MSEC) <= 0
+        || (rlen = recv(client, request, sizeof(request) - 1, 0)) <= 0)
+        return;
+    request[rlen] = '\0';
+
+    // Dialogs can be saved on demand, any other path returns all metrics
+    if (!strncmp(request, "GET /trigger?callid=", 20)) {
+        metrics_trigger(request + 20);
+        sprintf(header, "HTTP/1.0 202 Accepted\r\nContent-Length: 0\r\n\r\n");
+        send(client, header, strlen(header), MSG_NOSIGNAL);
+        return;
+    }
+
+    if (!(f = open_memstream(&body, &len)))
+        return;
+
+    capture_lock();
+    metrics_write(f);
+    capture_unlock();
+    fclose(f);
+
+    sprintf(header, "HTTP/1.0 200 OK\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %zu\r\n\r\n", len);
+    if (send(client, header, strlen(header), MSG_NOSIGNAL) > 0)
+        send(client, body, len, MSG_NOSIGNAL);
+    free(body);
+}
+
+/**
+ * @brief Metrics thread function
+ */
+static void *
+metrics_thread(void *arg)
+{
+    struct pollfd pfd = { .fd = metrics.sock, .events = POLLIN };
+    int client;
+
+    while (__atomic_load_n(&metrics.running, __ATOMIC_ACQUIRE)) {
+        if (poll(&pfd, 1, METRICS_POLL_MSEC) <= 0)
+            continue;
+        if ((client = accept(metrics.sock, NULL, NULL)) == -1)
+            continue;
+        metrics_answer(client);
+        close(client);
+    }
+
+    return NULL;
+}
+
+int
+metrics_init(const char *address)
+{
+    if ((metrics.sock = metrics_listen(address)) == -1)
+        return 1;
+
+    metrics.running = true;
+    if (thread_create(&metrics.thread, THREAD_IO, "sng-metrics", metrics_thread, NULL) != 0) {
+        metrics.running = false;
+        metrics_deinit();
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+metrics_deinit()
+{
+    if (metrics.sock == -1)
+        return;
+
+    if (__atomic_exchange_n(&metrics.running, false, __ATOMIC_ACQ_REL))
+        pthread_join(metrics.thread, NULL);
+
+    close(metrics.sock);
+    metrics.sock = -1;
+    if (strlen(metrics.path))
+        unlink(metrics.path);
+}
+
+void
+metrics_sip_msg(int reqresp)
+{
+    if (reqresp < 0 || reqresp >= METRICS_SIP_MAXCODE)
+        reqresp = 0;
+    __atomic_add_fetch(&metrics.sip_msgs[reqresp], 1, __ATOMIC_RELAXED);
+}
+
+uint64_t
+metrics_sip_msg_count()
+{
+    uint64_t count = 0;
+    int i;
+
+    for (i = 0; i < METRICS_SIP_MAXCODE; i++)
+        count += __atomic_load_n(&metrics.sip_msgs[i], __ATOMIC_RELAXED);
+    return count;
+}
+
+void
+metrics_timing_enable(bool enable, int sample)
+{
+    metrics.timing_sample = (sample > 0) ? sample : 1;
+    __atomic_store_n(&metrics.timing, enable, __ATOMIC_RELEASE);
+}
+
+bool
+metrics_timing_enabled()
+{
+    return __atomic_load_n(&metrics.timing, __ATOMIC_RELAXED);
+}
+
+void
+metrics_timing_reset()
+{
+    int i, j;
+
+    for (i = 0; i < METRICS_STAGE_COUNT; i++) {
+        for (j = 0; j < METRICS_TIMING_BUCKETS; j++)
+            __atomic_store_n(&metrics.timing_buckets[i][j], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&metrics.timing_sum[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t
+metrics_timing_start()
+{
+    struct timespec now;
+
+    if (!__atomic_load_n(&metrics.timing, __ATOMIC_RELAXED))
+        return 0;
+
+    // Only measure one of each sample events of this thread
+    if (++metrics_timing_skipped < metrics.timing_sample)
+        return 0;
+    metrics_timing_skipped = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void
+metrics_timing_end(enum metrics_stage stage, uint64_t start)
+{
+    struct timespec now;
+    uint64_t nsec;
+    int bucket;
+
+    if (!start)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    nsec = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec - start;
+
+    // Times in [2^(i-1), 2^i) nanoseconds are stored in bucket i
+    bucket = 64 - __builtin_clzll(nsec | 1);
+    if (bucket >= METRICS_TIMING_BUCKETS)
+        bucket = METRICS_TIMING_BUCKETS - 1;
+
+    __atomic_add_fetch(&metrics.timing_buckets[stage][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metrics.timing_sum[stage], nsec, __ATOMIC_RELAXED);
+}
+
+void
+metrics_timing_get(enum metrics_stage stage, metrics_timing_t *timing)
+{
+    uint64_t buckets[METRICS_TIMING_BUCKETS], seen = 0;
+    int i;
+
+    memset(timing, 0, sizeof(metrics_timing_t));
+    for (i = 0; i < METRICS_TIMING_BUCKETS; i++) {
+        buckets[i] = __atomic_load_n(&metrics.timing_buckets[stage][i], __ATOMIC_RELAXED);
+        timing->count += buckets[i];
+    }
+    timing->sum = __atomic_load_n(&metrics.timing_sum[stage], __ATOMIC_RELAXED);
+
+    for (i = 0; i < METRICS_TIMING_BUCKETS && timing->count; i++) {
+        if (!buckets[i])
+            continue;
+        seen += buckets[i];
+        if (!timing->p50 && seen * 100 >= timing->count * 50)
+            timing->p50 = 1ULL << i;
+        if (!timing->p90 && seen * 100 >= timing->count * 90)
+            timing->p90 = 1ULL << i;
+        if (!timing->p99 && seen * 100 >= timing->count * 99)
+            timing->p99 = 1ULL << i;
+        timing->max = 1ULL << i;
+    }
+}
+
+const char *
+metrics_stage_name(enum metrics_stage stage)
+{
+    return metrics_stage_names[stage];
+}
+
+void
+metrics_timing_dump(FILE *f)
+{
+    metrics_timing_t timing;
+    int i;
+
+    fprintf(f, "%-14s %12s %10s %10s %10s %10s %10s\n",
+            "stage", "count", "avg(ns)", "p50(ns)", "p90(ns)", "p99(ns)", "max(ns)");
+    for (i = 0; i < METRICS_STAGE_COUNT; i++) {
+        metrics_timing_get(i, &timing);
+        fprintf(f, "%-14s %12" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+                " %10" PRIu64 " %10" PRIu64 "\n", metrics_stage_names[i], timing.count,
+                timing.count ? timing.sum / timing.count : 0,
+                timing.p50, timing.p90, timing.p99, timing.max);
+    }
+}
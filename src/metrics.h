@@ -0,0 +1,182 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file metrics.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to expose capture counters over HTTP
+ *
+ * When capture.metrics setting is configured, a thread listens on the
+ * given TCP address or Unix socket and answers every request with the
+ * current counters in Prometheus text format.
+ *
+ * Time spent by each packet processing stage can also be measured in
+ * log2 histograms. Measurement can be enabled at runtime and sampled.
+ *
+ */
+#ifndef __SNGREP_METRICS_H
+#define __SNGREP_METRICS_H
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Max pending connections to metrics socket
+#define METRICS_BACKLOG 8
+//! Max size of a metrics HTTP request
+#define METRICS_REQUEST_MAXLEN 2048
+//! Wait time between checks of metrics thread stop (ms)
+#define METRICS_POLL_MSEC 500
+//! Max SIP response code with its own counter
+#define METRICS_SIP_MAXCODE 700
+//! Number of timing histogram buckets (powers of two nanoseconds)
+#define METRICS_TIMING_BUCKETS 32
+
+/**
+ * @brief Packet processing stages with timing histograms
+ */
+enum metrics_stage {
+    METRICS_STAGE_IP_REASM = 0,
+    METRICS_STAGE_TCP_REASM,
+    METRICS_STAGE_TLS,
+    METRICS_STAGE_SIP_VALIDATE,
+    METRICS_STAGE_SIP_CHECK,
+    METRICS_STAGE_RTP_CHECK,
+    METRICS_STAGE_DUMP,
+    METRICS_STAGE_EEP_SEND,
+    METRICS_STAGE_LOCK_WAIT,
+    METRICS_STAGE_BATCH,
+    METRICS_STAGE_COUNT
+};
+
+//! Shorter declaration of metrics_timing structure
+typedef struct metrics_timing metrics_timing_t;
+
+/**
+ * @brief Summary of a stage timing histogram
+ *
+ * Percentiles are the upper bound of the bucket containing them, so
+ * they are at most twice the real value.
+ */
+struct metrics_timing {
+    //! Measured events
+    uint64_t count;
+    //! Total measured time in nanoseconds
+    uint64_t sum;
+    //! Percentiles 50, 90 and 99 in nanoseconds
+    uint64_t p50, p90, p99;
+    //! Max measured time bucket upper bound in nanoseconds
+    uint64_t max;
+};
+
+/**
+ * @brief Start listening for metrics requests
+ *
+ * Addresses starting with '/' are Unix socket paths, otherwise they
+ * must have the format host:port.
+ *
+ * @param address Listen address
+ * @return 0 if metrics thread has been started, 1 otherwise
+ */
+int
+metrics_init(const char *address);
+
+/**
+ * @brief Stop metrics thread and close its socket
+ */
+void
+metrics_deinit();
+
+/**
+ * @brief Account a parsed SIP message
+ *
+ * @param reqresp Request method or response code of the message
+ */
+void
+metrics_sip_msg(int reqresp);
+
+/**
+ * @brief Get the number of parsed SIP messages
+ */
+uint64_t
+metrics_sip_msg_count();
+
+/**
+ * @brief Enable or disable stage timing measurement
+ *
+ * @param enable Start measuring if true, stop otherwise
+ * @param sample Measure one of each sample events per thread
+ */
+void
+metrics_timing_enable(bool enable, int sample);
+
+/**
+ * @brief Check if stage timing is being measured
+ */
+bool
+metrics_timing_enabled();
+
+/**
+ * @brief Remove all measured timing data
+ */
+void
+metrics_timing_reset();
+
+/**
+ * @brief Start measuring an event of any stage
+ *
+ * This is cheap when timing is disabled or the event is not sampled.
+ *
+ * @return start timestamp or 0 if this event must not be measured
+ */
+uint64_t
+metrics_timing_start();
+
+/**
+ * @brief Account the time spent by an event of a stage
+ *
+ * @param stage Measured stage
+ * @param start Value returned by @metrics_timing_start
+ */
+void
+metrics_timing_end(enum metrics_stage stage, uint64_t start);
+
+/**
+ * @brief Get the measured timing summary of a stage
+ */
+void
+metrics_timing_get(enum metrics_stage stage, metrics_timing_t *timing);
+
+/**
+ * @brief Get the display name of a stage
+ */
+const char *
+metrics_stage_name(enum metrics_stage stage);
+
+/**
+ * @brief Print timing summary of all stages
+ */
+void
+metrics_timing_dump(FILE *f);
+
+#endif /* __SNGREP_METRICS_H */
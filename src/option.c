@@ -35,6 +35,7 @@
 #include "keybinding.h"
 #include "option.h"
 #include "setting.h"
+#include "hash.h"
 #include "util.h"
 
 /**
@@ -46,6 +47,11 @@
 option_opt_t options[1024];
 int optscnt = 0;
 
+//! Configured aliases indexed by address (option_alias_t *)
+static htable_t *aliases;
+//! List of configured aliases, last configured first
+static option_alias_t *aliases_list;
+
 int
 init_options(int no_config)
 {
@@ -97,12 +103,23 @@ init_options(int no_config)
 void
 deinit_options()
 {
+    option_alias_t *alias;
     int i;
     // Deallocate options memory
     for (i = 0; i < optscnt; i++) {
         sng_free(options[i].opt);
         sng_free(options[i].value);
     }
+    optscnt = 0;
+
+    // Deallocate aliases memory
+    while ((alias = aliases_list)) {
+        aliases_list = alias->next;
+        sng_free(alias->alias);
+        sng_free(alias);
+    }
+    htable_destroy(aliases);
+    aliases = NULL;
 }
 
 int
@@ -185,33 +202,116 @@ set_option_value(const char *opt, const char *value)
     }
 }
 
+static uint32_t
+option_alias_hash(const void *key)
+{
+    return address_hash(*(const address_t *) key, true);
+}
+
+static bool
+option_alias_equal(const void *key1, const void *key2)
+{
+    return addressport_equals(*(const address_t *) key1, *(const address_t *) key2);
+}
+
+/**
+ * @brief Parse an IP address with optional port
+ *
+ * @param str Address string (IP or IP:port)
+ * @param addr Parsed address
+ * @return 0 if address is valid, 1 otherwise
+ */
+static int
+option_alias_parse(const char *str, address_t *addr)
+{
+    char ip[ADDRESSLEN + 1];
+    const char *sep, *c;
+    size_t len;
+
+    memset(addr, 0, sizeof(address_t));
+
+    // Address without port
+    if (address_parse_ip(addr, str) == 0)
+        return 0;
+
+    // Address followed by :port
+    if (!(sep = strrchr(str, ':')) || !*(sep + 1) || (len = sep - str) > ADDRESSLEN)
+        return 1;
+    for (c = sep + 1; *c; c++) {
+        if (*c < '0' || *c > '9')
+            return 1;
+    }
+    memcpy(ip, str, len);
+    ip[len] = '\0';
+    if (address_parse_ip(addr, ip) != 0)
+        return 1;
+    addr->port = atoi(sep + 1);
+    return 0;
+}
+
+/**
+ * @brief Get the alias configured for a binary address
+ */
+static const char *
+option_alias_find(address_t addr)
+{
+    option_alias_t *alias;
+
+    if (!aliases || !(alias = htable_find(aliases, &addr)))
+        return NULL;
+    return alias->alias;
+}
+
 void
 set_alias_value(const char *address, const char *alias)
 {
-    options[optscnt].type = ALIAS;
-    options[optscnt].opt = strdup(address);
-    options[optscnt].value = strdup(alias);
-    optscnt++;
+    option_alias_t *entry;
+    address_t addr;
+
+    if (!address || !alias || option_alias_parse(address, &addr) != 0)
+        return;
+
+    if (!aliases && !(aliases = htable_create_custom(0, option_alias_hash, option_alias_equal)))
+        return;
+
+    // First configured alias of an address is used
+    if (htable_find(aliases, &addr))
+        return;
+
+    if (!(entry = sng_malloc(sizeof(option_alias_t))))
+        return;
+    entry->addr = addr;
+    entry->alias = strdup(alias);
+    if (htable_insert(aliases, &entry->addr, entry) != 0) {
+        sng_free(entry->alias);
+        sng_free(entry);
+        return;
+    }
+    entry->next = aliases_list;
+    aliases_list = entry;
 }
 
 const char *
 get_alias_value_vs_port(const char *address, uint16_t port)
 {
+    const char *alias;
+    address_t addr;
+
     if (!address)
         return NULL;
 
-    int i;
+    if (!aliases || option_alias_parse(address, &addr) != 0)
+        return address;
 
-    char *addr_port = sng_malloc(ADDRESSLEN + 10);
-    sprintf(addr_port, "%s:%d", address, port);
-    for (i = 0; i < optscnt; i++) {
-        if (options[i].type != ALIAS)
-            continue;
-        if (!strcmp(options[i].opt, addr_port) || !strcmp(options[i].opt, address)) {
-            sng_free(addr_port);
-            return options[i].value;
-        }
-    }
+    // Address and port alias
+    addr.port = port;
+    if ((alias = option_alias_find(addr)))
+        return alias;
+
+    // Address only alias
+    addr.port = 0;
+    if ((alias = option_alias_find(addr)))
+        return alias;
 
     return address;
 }
@@ -219,18 +319,14 @@ get_alias_value_vs_port(const char *address, uint16_t port)
 const char *
 get_alias_value(const char *address)
 {
-    int i;
+    const char *alias;
+    address_t addr;
 
     if (!address)
         return NULL;
 
-    for (i = 0; i < optscnt; i++) {
-        if (options[i].type != ALIAS)
-            continue;
-        if (!strcmp(options[i].opt, address))
-            return options[i].value;
-    }
+    if (aliases && option_alias_parse(address, &addr) == 0 && (alias = option_alias_find(addr)))
+        return alias;
 
     return address;
 }
-
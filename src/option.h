@@ -44,9 +44,12 @@
 #define __SNGREP_CONFIG_H
 
 #include <stdint.h>
+#include "address.h"
 
 //! Shorter declaration of config_option struct
 typedef struct config_option option_opt_t;
+//! Shorter declaration of option_alias struct
+typedef struct option_alias option_alias_t;
 
 //! Option types
 enum option_type {
@@ -69,6 +72,21 @@ struct config_option {
     char *value;
 };
 
+/**
+ * @brief Configured alias of an address
+ *
+ * Aliases are stored in a hash table using the binary address as key.
+ * Aliases configured without port are stored with port 0.
+ */
+struct option_alias {
+    //! Aliased address (and port)
+    address_t addr;
+    //! Alias text
+    char *alias;
+    //! Next configured alias
+    option_alias_t *next;
+};
+
 /**
  * @brief Initialize all program options
  *
@@ -144,6 +162,9 @@ set_option_value(const char *opt, const char *value);
 /**
  * @brief Sets an alias for a given address
  *
+ * Address can be an IP address or IP:port. If the address already has
+ * an alias, the first configured one is kept.
+ *
  * @param address IP Address
  * @param string representing the alias
  */
@@ -162,6 +183,9 @@ get_alias_value(const char *address);
 /**
  * @brief Get alias for a given address and port (string)
  *
+ * Aliases configured for address and port have priority over
+ * aliases configured only for the address.
+ *
  * @param address IP Address
  * @param port port
  * @return configured alias or address if alias not found
@@ -0,0 +1,343 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file output.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in output.h
+ *
+ * Capture threads of different shards can write at the same time, so
+ * each output file has its own lock. Events are written to stdio
+ * buffers and flushed periodically by the main thread.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "output.h"
+#include "rtp.h"
+#include "util.h"
+
+//! Shorter declaration of output structure
+typedef struct output output_t;
+
+/**
+ * @brief Opened output file for a single format
+ */
+struct output {
+    //! Output file (NULL if not opened)
+    FILE *f;
+    //! Output is writing to standard output
+    bool is_stdout;
+    //! Lock for writing complete events
+    pthread_mutex_t lock;
+};
+
+//! Opened outputs, one per format
+static output_t outputs[OUTPUT_COUNT] = {
+    { NULL, false, PTHREAD_MUTEX_INITIALIZER },
+    { NULL, false, PTHREAD_MUTEX_INITIALIZER },
+};
+
+int
+output_open(enum output_format format, const char *file)
+{
+    output_t *output = &outputs[format];
+
+    if (!strcmp(file, "-")) {
+        output->f = stdout;
+        output->is_stdout = true;
+    } else if (!(output->f = fopen(file, "w"))) {
+        return 1;
+    }
+
+    return 0;
+}
+
+bool
+output_is_stdout()
+{
+    int i;
+    for (i = 0; i < OUTPUT_COUNT; i++) {
+        if (outputs[i].f && outputs[i].is_stdout)
+            return true;
+    }
+    return false;
+}
+
+void
+output_close()
+{
+    output_t *output;
+    int i;
+
+    for (i = 0; i < OUTPUT_COUNT; i++) {
+        output = &outputs[i];
+        if (!output->f)
+            continue;
+        pthread_mutex_lock(&output->lock);
+        if (output->is_stdout) {
+            fflush(output->f);
+        } else {
+            fclose(output->f);
+        }
+        output->f = NULL;
+        pthread_mutex_unlock(&output->lock);
+    }
+}
+
+void
+output_flush()
+{
+    output_t *output;
+    int i;
+
+    for (i = 0; i < OUTPUT_COUNT; i++) {
+        output = &outputs[i];
+        pthread_mutex_lock(&output->lock);
+        if (output->f)
+            fflush(output->f);
+        pthread_mutex_unlock(&output->lock);
+    }
+}
+
+/**
+ * @brief Write a string value escaped as JSON string
+ */
+static void
+output_json_str(FILE *f, const char *str)
+{
+    const unsigned char *c;
+
+    if (!str) {
+        fputs("null", f);
+        return;
+    }
+
+    fputc('"', f);
+    for (c = (const unsigned char *) str; *c; c++) {
+        switch (*c) {
+            case '"':
+                fputs("\\\"", f);
+                break;
+            case '\\':
+                fputs("\\\\", f);
+                break;
+            case '\n':
+                fputs("\\n", f);
+                break;
+            case '\r':
+                fputs("\\r", f);
+                break;
+            case '\t':
+                fputs("\\t", f);
+                break;
+            default:
+                if (*c < 0x20) {
+                    fprintf(f, "\\u%04x", *c);
+                } else {
+                    fputc(*c, f);
+                }
+                break;
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * @brief Get milliseconds between two timestamps
+ */
+static long
+output_msec(struct timeval start, struct timeval end)
+{
+    return (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+}
+
+/**
+ * @brief Write message payload in the same format of saved text files
+ */
+static void
+output_msg_txt(FILE *f, sip_msg_t *msg)
+{
+    char date[20], time[20], src[80], dst[80];
+
+    fprintf(f, "%s %s %s -> %s\n%s\n\n",
+            msg_get_attribute(msg, SIP_ATTR_DATE, date),
+            msg_get_attribute(msg, SIP_ATTR_TIME, time),
+            msg_get_attribute(msg, SIP_ATTR_SRC, src),
+            msg_get_attribute(msg, SIP_ATTR_DST, dst),
+            msg_get_payload(msg));
+}
+
+/**
+ * @brief Write message summary as a JSON event line
+ */
+static void
+output_msg_json(FILE *f, sip_msg_t *msg)
+{
+    char src[80], dst[80];
+    struct timeval ts = msg_get_time(msg);
+
+    fprintf(f, "{\"event\":\"message\",\"ts\":%ld.%06ld,\"callid\":",
+            (long) ts.tv_sec, (long) ts.tv_usec);
+    output_json_str(f, msg->call->callid);
+    fprintf(f, ",\"index\":%d,\"src\":\"%s\",\"dst\":\"%s\"",
+            CALL_SLOT(msg->call, index),
+            msg_get_attribute(msg, SIP_ATTR_SRC, src),
+            msg_get_attribute(msg, SIP_ATTR_DST, dst));
+    if (msg_is_request(msg)) {
+        fputs(",\"method\":", f);
+        output_json_str(f, sip_get_msg_reqresp_str(msg));
+    } else {
+        fprintf(f, ",\"code\":%d,\"reason\":", msg->reqresp);
+        output_json_str(f, sip_get_msg_reqresp_str(msg));
+    }
+    fprintf(f, ",\"cseq\":%u,\"retrans\":%s}\n",
+            msg->cseq, msg->retrans ? "true" : "false");
+}
+
+void
+output_msg(sip_msg_t *msg)
+{
+    output_t *output;
+    int i;
+
+    for (i = 0; i < OUTPUT_COUNT; i++) {
+        output = &outputs[i];
+        if (!output->f)
+            continue;
+        pthread_mutex_lock(&output->lock);
+        if (i == OUTPUT_TEXT) {
+            output_msg_txt(output->f, msg);
+        } else {
+            output_msg_json(output->f, msg);
+        }
+        pthread_mutex_unlock(&output->lock);
+    }
+}
+
+/**
+ * @brief Write call streams quality in the same format of saved text files
+ */
+static void
+output_call_txt(FILE *f, sip_call_t *call)
+{
+    char src[ADDRESSLEN], dst[ADDRESSLEN];
+    rtp_stream_t *stream;
+    vector_iter_t it = vector_iterator(call->streams);
+
+    while ((stream = vector_iterator_next(&it))) {
+        // Only RTP streams with received packets have quality metrics
+        if (stream->type != PACKET_RTP || !stream_get_count(stream))
+            continue;
+
+        fprintf(f, "RTP %s:%u -> %s:%u %s packets %u lost %u out-of-order %u "
+                "jitter %.1fms max-delta %ums bitrate %ubps\n\n",
+                address_get_ip(stream->src, src), stream->src.port,
+                address_get_ip(stream->dst, dst), stream->dst.port,
+                stream_get_format(stream) ? stream_get_format(stream) : "unknown",
+                stream_get_count(stream), stream_get_lost(stream),
+                stream->rtpinfo.stats.out_of_order, stream_get_jitter(stream),
+                stream->rtpinfo.stats.max_delta, stream_get_bitrate(stream));
+    }
+}
+
+/**
+ * @brief Write call summary and streams quality as a JSON event line
+ */
+static void
+output_call_json(FILE *f, sip_call_t *call)
+{
+    char from[SIP_ATTR_MAXLEN + 1] = "", to[SIP_ATTR_MAXLEN + 1] = "";
+    char src[ADDRESSLEN], dst[ADDRESSLEN];
+    sip_msg_t *first = vector_first(call->msgs);
+    sip_msg_t *last = vector_last(call->msgs);
+    struct timeval start = msg_get_time(first);
+    rtp_stream_t *stream;
+    vector_iter_t it;
+    bool comma = false;
+
+    fprintf(f, "{\"event\":\"call\",\"ts\":%ld.%06ld,\"callid\":",
+            (long) start.tv_sec, (long) start.tv_usec);
+    output_json_str(f, call->callid);
+    fprintf(f, ",\"index\":%d,\"from\":", CALL_SLOT(call, index));
+    output_json_str(f, msg_get_attribute(first, SIP_ATTR_SIPFROMUSER, from));
+    fputs(",\"to\":", f);
+    output_json_str(f, msg_get_attribute(first, SIP_ATTR_SIPTOUSER, to));
+    fputs(",\"state\":", f);
+    output_json_str(f, call_state_to_str(CALL_SLOT(call, state)));
+    fputs(",\"reason\":", f);
+    output_json_str(f, call->reasontxt);
+    fprintf(f, ",\"msgcnt\":%d,\"total_ms\":%ld", call_msg_count(call),
+            output_msec(start, msg_get_time(last)));
+
+    // Conversation timings are only available for answered calls
+    if (call->cstart_msg) {
+        fprintf(f, ",\"setup_ms\":%ld",
+                output_msec(start, msg_get_time(call->cstart_msg)));
+        if (call->cend_msg)
+            fprintf(f, ",\"duration_ms\":%ld",
+                    output_msec(msg_get_time(call->cstart_msg), msg_get_time(call->cend_msg)));
+    }
+
+    fputs(",\"streams\":[", f);
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it))) {
+        // Only RTP streams with received packets have quality metrics
+        if (stream->type != PACKET_RTP || !stream_get_count(stream))
+            continue;
+
+        fprintf(f, "%s{\"src\":\"%s:%u\",\"dst\":\"%s:%u\",\"format\":",
+                comma ? "," : "",
+                address_get_ip(stream->src, src), stream->src.port,
+                address_get_ip(stream->dst, dst), stream->dst.port);
+        output_json_str(f, stream_get_format(stream));
+        fprintf(f, ",\"packets\":%u,\"lost\":%u,\"out_of_order\":%u,"
+                "\"jitter_ms\":%.1f,\"max_delta_ms\":%u,\"bitrate\":%u}",
+                stream_get_count(stream), stream_get_lost(stream),
+                stream->rtpinfo.stats.out_of_order, stream_get_jitter(stream),
+                stream->rtpinfo.stats.max_delta, stream_get_bitrate(stream));
+        comma = true;
+    }
+    fputs("]}\n", f);
+}
+
+void
+output_call(sip_call_t *call)
+{
+    output_t *output;
+    int i;
+
+    for (i = 0; i < OUTPUT_COUNT; i++) {
+        output = &outputs[i];
+        if (!output->f)
+            continue;
+        pthread_mutex_lock(&output->lock);
+        if (i == OUTPUT_TEXT) {
+            output_call_txt(output->f, call);
+        } else {
+            output_call_json(output->f, call);
+        }
+        pthread_mutex_unlock(&output->lock);
+    }
+}
@@ -0,0 +1,94 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file output.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to stream captured SIP messages to files
+ *
+ * Messages are written as soon as they are parsed, so captured data
+ * does not need to be stored until sngrep exits. Text output writes
+ * each message payload, while JSON output writes one event per line
+ * for each message and each finished call.
+ *
+ */
+#ifndef __SNGREP_OUTPUT_H
+#define __SNGREP_OUTPUT_H
+
+#include "config.h"
+#include "sip.h"
+
+/**
+ * @brief Available streaming output formats
+ */
+enum output_format {
+    OUTPUT_TEXT = 0,
+    OUTPUT_JSON,
+    OUTPUT_COUNT
+};
+
+/**
+ * @brief Open an output file for the given format
+ *
+ * @param format Output format
+ * @param file File path or "-" for standard output
+ * @return 0 if file has been opened, 1 otherwise
+ */
+int
+output_open(enum output_format format, const char *file);
+
+/**
+ * @brief Check if any output file is writing to standard output
+ */
+bool
+output_is_stdout();
+
+/**
+ * @brief Flush and close all opened output files
+ */
+void
+output_close();
+
+/**
+ * @brief Flush pending data of all opened output files
+ */
+void
+output_flush();
+
+/**
+ * @brief Write a new parsed message to all opened outputs
+ *
+ * This function is invoked by capture threads with message call locked.
+ */
+void
+output_msg(sip_msg_t *msg);
+
+/**
+ * @brief Write a finished call to all opened outputs
+ *
+ * This function is invoked by capture threads with the call locked
+ * once it reaches a final state.
+ */
+void
+output_call(sip_call_t *call);
+
+#endif /* __SNGREP_OUTPUT_H */
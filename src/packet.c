@@ -30,23 +30,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include "packet.h"
+#include "slab.h"
+#include "memstat.h"
+
+//! Size of a block stored in arena, keeping next block aligned
+#define PACKET_BLOCK_SIZE(len) (((len) + 7) & ~(size_t) 7)
+//! Payload offset of packets without payload
+#define PACKET_NO_PAYLOAD UINT32_MAX
+//! Slab memory used by a frame, its header and its data
+#define PACKET_FRAME_SIZE(frame) (sizeof(frame_t) + sizeof(struct pcap_pkthdr) \
+                                  + ((frame)->data ? (frame)->header->caplen + 1 : 0))
+
+/**
+ * @brief Account memory of the payload copy owned by the packet
+ *
+ * @param sign 1 when the payload is allocated, -1 when released
+ */
+static void
+packet_payload_account(packet_t *packet, int sign)
+{
+    if (packet->payload && !packet->payload_ref && !packet->arena)
+        memstat_add(MEMSTAT_PAYLOADS, sign * ((int64_t) packet->payload_len + 1));
+}
+
+/**
+ * @brief Release a frame allocated in slab memory
+ */
+static void
+packet_frame_free(frame_t *frame)
+{
+    memstat_add(MEMSTAT_FRAMES, -(int64_t) PACKET_FRAME_SIZE(frame));
+    slab_free(frame->data);
+    slab_free(frame);
+}
 
 packet_t *
 packet_create(uint8_t ip_ver, uint8_t proto, address_t src, address_t dst, uint32_t id)
 {
     // Create a new packet
     packet_t *packet;
-    packet = malloc(sizeof(packet_t));
-    memset(packet, 0, sizeof(packet_t));
+    packet = slab_zalloc(sizeof(packet_t));
     packet->ip_version = ip_ver;
     packet->proto = proto;
     packet->frames = vector_create(1, 1);
     packet->ip_id = id;
     packet->src = src;
     packet->dst = dst;
+    memstat_add(MEMSTAT_PACKETS, sizeof(packet_t));
     return packet;
 }
 
+/**
+ * @brief Add a frame rebuilt from its data before a shared payload
+ */
+static void
+packet_add_shared_frame(packet_t *pkt, frame_t *frame, packet_t *packet)
+{
+    uint32_t len = frame->header->caplen - packet->payload_len;
+    u_char *data;
+
+    if (!(data = malloc(frame->header->caplen)))
+        return;
+    memcpy(data, frame->data, len);
+    memcpy(data + len, packet->payload, packet->payload_len);
+    packet_add_frame(pkt, frame->header, data);
+    free(data);
+}
+
 packet_t*
 packet_clone(packet_t *packet)
 {
@@ -57,11 +107,18 @@ packet_clone(packet_t *packet)
     clone =    packet_create(packet->ip_version, packet->proto, packet->src, packet->dst, packet->ip_id);
     clone->tcp_seq = packet->tcp_seq;
     clone->type = packet->type;
+    clone->source = packet->source;
 
     // Append this frames to the original packet
     vector_iter_t frames = vector_iterator(packet->frames);
-    while ((frame = vector_iterator_next(&frames)))
-        packet_add_frame(clone, frame->header, frame->data);
+    while ((frame = vector_iterator_next(&frames))) {
+        if (packet->payload_owner && frame->data) {
+            packet_add_shared_frame(clone, frame, packet);
+        } else {
+            packet_add_frame(clone, frame->header, frame->data);
+        }
+    }
+    clone->ts = packet->ts;
 
     return clone;
 }
@@ -74,18 +131,27 @@ packet_destroy(packet_t *packet)
     // Check we have a valid packet pointer
     if (!packet) return;
 
+    memstat_add(MEMSTAT_PACKETS, -(int64_t) sizeof(packet_t));
+    slab_free(packet->scan);
+
+    // Frames and payload are released with their arena
+    if (packet->arena) {
+        vector_destroy(packet->frames);
+        slab_free(packet);
+        return;
+    }
+
     // Destroy frames
     vector_iter_t it = vector_iterator(packet->frames);
-    while ((frame = vector_iterator_next(&it))) {
-        free(frame->header);
-        free(frame->data);
-    }
+    while ((frame = vector_iterator_next(&it)))
+        packet_frame_free(frame);
 
     // TODO Free remaining packet data
-    vector_set_destroyer(packet->frames, vector_generic_destroyer);
     vector_destroy(packet->frames);
-    free(packet->payload);
-    free(packet);
+    packet_payload_account(packet, -1);
+    if (!packet->payload_ref)
+        free(packet->payload);
+    slab_free(packet);
 }
 
 void
@@ -94,14 +160,320 @@ packet_destroyer(void *packet)
     packet_destroy((packet_t*) packet);
 }
 
+int
+packet_set_arena(packet_t *packet, arena_t *arena)
+{
+    frame_t *frame, *copy;
+    frame_t *payload_frame = NULL;
+    char *block;
+    size_t size = 0;
+    int i;
+    // Stored RTP is accounted apart from SIP frames
+    enum memstat_tag tag = (packet->type == PACKET_RTP) ? MEMSTAT_RTP : MEMSTAT_FRAMES;
+
+    if (packet->arena)
+        return packet->arena != arena;
+
+    // Allocate all required memory at once
+    for (i = 0; i < vector_count(packet->frames); i++) {
+        frame = vector_item(packet->frames, i);
+        size += PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+        if (!frame->data)
+            continue;
+        size += PACKET_BLOCK_SIZE(frame->header->caplen + 1);
+        // Check if payload is stored in this frame data
+        if (packet->payload_ref && packet->payload >= frame->data
+                && packet->payload <= frame->data + frame->header->caplen)
+            payload_frame = frame;
+    }
+    if (packet->payload && !payload_frame)
+        size += PACKET_BLOCK_SIZE(packet->payload_len + 1);
+
+    if (!(block = arena_alloc_tag(arena, tag, size)))
+        return 1;
+
+    // Payload not stored in frames data gets its own copy
+    if (packet->payload && !payload_frame) {
+        memcpy(block, packet->payload, packet->payload_len + 1);
+        packet_payload_account(packet, -1);
+        if (!packet->payload_ref)
+            free(packet->payload);
+        packet->payload = (u_char *) block;
+        packet->payload_ref = true;
+        block += PACKET_BLOCK_SIZE(packet->payload_len + 1);
+    }
+
+    for (i = 0; i < vector_count(packet->frames); i++) {
+        frame = vector_item(packet->frames, i);
+        copy = (frame_t *) block;
+        copy->header = (struct pcap_pkthdr *) (block + sizeof(frame_t));
+        memcpy(copy->header, frame->header, sizeof(struct pcap_pkthdr));
+        copy->offset = frame->offset;
+        block += PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+        if (frame->data) {
+            copy->data = (u_char *) block;
+            memcpy(copy->data, frame->data, frame->header->caplen + 1);
+            block += PACKET_BLOCK_SIZE(frame->header->caplen + 1);
+            // Payload pointing to frame data must point to the copy
+            if (frame == payload_frame)
+                packet->payload = copy->data + (packet->payload - frame->data);
+        }
+        vector_set_item(packet->frames, i, copy);
+        packet_frame_free(frame);
+    }
+
+    packet->arena = arena;
+    return 0;
+}
+
+int
+packet_share_payload(packet_t *packet, packet_t *owner, arena_t *arena)
+{
+    frame_t *frame, *copy;
+    char *block;
+    uint32_t len;
+    vector_iter_t it;
+
+    if (packet->arena || !packet->payload || !owner->payload
+            || packet->payload_len != owner->payload_len)
+        return 1;
+
+    frame = vector_first(packet->frames);
+    if (frame && frame->data) {
+        // Payload must be the end of the only frame data
+        if (vector_count(packet->frames) != 1 || !packet->payload_ref
+                || packet->payload < frame->data
+                || packet->payload + packet->payload_len != frame->data + frame->header->caplen)
+            return 1;
+
+        // Only frame data before the payload is kept
+        len = packet->payload - frame->data;
+        block = arena_alloc_tag(arena, MEMSTAT_FRAMES, PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr))
+                                + PACKET_BLOCK_SIZE(len + 1));
+        if (!block)
+            return 1;
+        copy = (frame_t *) block;
+        copy->header = (struct pcap_pkthdr *) (block + sizeof(frame_t));
+        memcpy(copy->header, frame->header, sizeof(struct pcap_pkthdr));
+        copy->offset = frame->offset;
+        copy->data = (u_char *) block + PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+        memcpy(copy->data, frame->data, len);
+        copy->data[len] = '\0';
+        vector_set_item(packet->frames, 0, copy);
+        packet_frame_free(frame);
+        packet->arena = arena;
+    } else {
+        // Frames data has been released, only payload is stored
+        it = vector_iterator(packet->frames);
+        while ((frame = vector_iterator_next(&it))) {
+            if (frame->data)
+                return 1;
+        }
+        packet_payload_account(packet, -1);
+        if (!packet->payload_ref)
+            free(packet->payload);
+    }
+
+    packet->payload = owner->payload;
+    packet->payload_ref = true;
+    packet->payload_owner = (owner->payload_owner) ? owner->payload_owner : owner;
+    return 0;
+}
+
+uint32_t
+packet_data_copy(packet_t *packet, u_char *dst)
+{
+    frame_t *frame;
+    uint32_t len = 0;
+    bool in_frames = false;
+
+    // Packets without payload keep it unset
+    packet->data_payload = PACKET_NO_PAYLOAD;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        // Check if payload is stored in this frame data
+        if (packet->payload_ref && frame->data && packet->payload >= frame->data
+                && packet->payload <= frame->data + frame->header->caplen) {
+            packet->data_payload = len + (packet->payload - frame->data);
+            in_frames = true;
+        }
+        if (dst && frame->data)
+            memcpy(dst + len, frame->data, frame->header->caplen + 1);
+        len += frame->header->caplen + 1;
+    }
+
+    if (packet->payload && !in_frames) {
+        packet->data_payload = len;
+        if (dst)
+            memcpy(dst + len, packet->payload, packet->payload_len + 1);
+        len += packet->payload_len + 1;
+    }
+
+    return len;
+}
+
+int
+packet_drop_data(packet_t *packet, arena_t *arena)
+{
+    frame_t *frame, *copy;
+    char *block;
+    int i;
+    // Stored RTP is accounted apart from SIP frames
+    enum memstat_tag tag = (packet->type == PACKET_RTP) ? MEMSTAT_RTP : MEMSTAT_FRAMES;
+
+    if (packet->arena)
+        return 1;
+
+    // Only frames and their headers are kept
+    block = arena_alloc_tag(arena, tag, vector_count(packet->frames)
+                            * PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr)));
+    if (!block)
+        return 1;
+
+    for (i = 0; i < vector_count(packet->frames); i++) {
+        frame = vector_item(packet->frames, i);
+        copy = (frame_t *) block;
+        copy->header = (struct pcap_pkthdr *) (block + sizeof(frame_t));
+        memcpy(copy->header, frame->header, sizeof(struct pcap_pkthdr));
+        copy->data = NULL;
+        copy->offset = frame->offset;
+        block += PACKET_BLOCK_SIZE(sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+        vector_set_item(packet->frames, i, copy);
+        packet_frame_free(frame);
+    }
+
+    packet_payload_account(packet, -1);
+    if (!packet->payload_ref)
+        free(packet->payload);
+    packet->payload = NULL;
+    packet->payload_ref = true;
+    packet->arena = arena;
+    return 0;
+}
+
+void
+packet_set_data(packet_t *packet, u_char *data)
+{
+    frame_t *frame;
+    uint32_t len = 0;
+
+    vector_iter_t it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        frame->data = (data) ? data + len : NULL;
+        len += frame->header->caplen + 1;
+    }
+
+    if (data && packet->data_payload != PACKET_NO_PAYLOAD) {
+        packet->payload = data + packet->data_payload;
+    } else {
+        packet->payload = NULL;
+    }
+}
+
+int
+packet_replace_data(packet_t *packet, packet_t *data, arena_t *arena)
+{
+    vector_t *frames;
+    u_char *payload;
+    uint32_t payload_len;
+    bool payload_ref;
+
+    // Compressed frames are restored from their block
+    if (packet->block)
+        return 1;
+
+    if (packet->arena) {
+        // Previous frames memory is kept, retransmissions may share it
+        if (packet_set_arena(data, arena) != 0)
+            return 1;
+        vector_destroy(packet->frames);
+        packet->frames = data->frames;
+        packet->payload = data->payload;
+        packet->payload_len = data->payload_len;
+        packet->payload_ref = true;
+        packet->payload_owner = NULL;
+        data->frames = NULL;
+    } else {
+        // Swap frames and payload, previous ones are freed with data
+        packet_payload_account(packet, -1);
+        packet_payload_account(data, -1);
+        frames = packet->frames;
+        payload = packet->payload;
+        payload_len = packet->payload_len;
+        payload_ref = packet->payload_ref;
+        packet->frames = data->frames;
+        packet->payload = data->payload;
+        packet->payload_len = data->payload_len;
+        packet->payload_ref = data->payload_ref;
+        data->frames = frames;
+        data->payload = payload;
+        data->payload_len = payload_len;
+        data->payload_ref = payload_ref;
+        packet_payload_account(packet, 1);
+        packet_payload_account(data, 1);
+    }
+
+    packet_destroy(data);
+    packet->probe = false;
+    return 0;
+}
+
+int
+packet_index_data(packet_t *packet, arena_t *arena, u_char *map)
+{
+    u_char *payload = NULL;
+    frame_t *frame;
+    vector_iter_t it;
+
+    if (packet->arena)
+        return 1;
+
+    // Payload is parsed as a string, keep a terminated copy
+    if (packet->payload) {
+        if (!(payload = arena_alloc_tag(arena, MEMSTAT_PAYLOADS, packet->payload_len + 1)))
+            return 1;
+        memcpy(payload, packet->payload, packet->payload_len);
+        payload[packet->payload_len] = '\0';
+    }
+
+    if (packet_drop_data(packet, arena) != 0)
+        return 1;
+
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it)))
+        frame->data = map + frame->offset;
+    packet->payload = payload;
+    return 0;
+}
+
 void
 packet_free_frames(packet_t *pkt)
 {
     frame_t *frame;
     vector_iter_t it = vector_iterator(pkt->frames);
 
+    // Arena memory can not be freed, but is still valid for payload
+    if (pkt->arena) {
+        while ((frame = vector_iterator_next(&it)))
+            frame->data = NULL;
+        return;
+    }
+
+    // Payload is stored in frames data, keep a copy
+    if (pkt->payload_ref) {
+        u_char *payload = malloc(pkt->payload_len + 1);
+        memcpy(payload, pkt->payload, pkt->payload_len);
+        payload[pkt->payload_len] = '\0';
+        pkt->payload = payload;
+        pkt->payload_ref = false;
+        packet_payload_account(pkt, 1);
+    }
+
     while ((frame = vector_iterator_next(&it))) {
-        free(frame->data);
+        if (frame->data)
+            memstat_add(MEMSTAT_FRAMES, -(int64_t) frame->header->caplen - 1);
+        slab_free(frame->data);
         frame->data = NULL;
     }
 }
@@ -117,15 +489,31 @@ packet_set_transport_data(packet_t *pkt, uint16_t sport, uint16_t dport)
 frame_t *
 packet_add_frame(packet_t *pkt, const struct pcap_pkthdr *header, const u_char *packet)
 {
-    frame_t *frame = malloc(sizeof(frame_t));
-    frame->header = malloc(sizeof(struct pcap_pkthdr));
+    // Frame header is stored in the same block of the frame
+    frame_t *frame = slab_alloc(sizeof(frame_t) + sizeof(struct pcap_pkthdr));
+    frame->header = (struct pcap_pkthdr *) (frame + 1);
     memcpy(frame->header, header, sizeof(struct pcap_pkthdr));
-    frame->data = malloc(header->caplen);
+    frame->offset = 0;
+    frame->data = slab_alloc(header->caplen + 1);
     memcpy(frame->data, packet, header->caplen);
+    frame->data[header->caplen] = '\0';
+    // Packet time is its first frame time
+    if (!vector_count(pkt->frames))
+        pkt->ts = (uint64_t) header->ts.tv_sec * 1000000000 + (uint64_t) header->ts.tv_usec * 1000;
     vector_append(pkt->frames, frame);
+    memstat_add(MEMSTAT_FRAMES, PACKET_FRAME_SIZE(frame));
     return frame;
 }
 
+void
+packet_move_frames(packet_t *dst, packet_t *src)
+{
+    if (!vector_count(dst->frames))
+        dst->ts = src->ts;
+    vector_append_vector(dst->frames, src->frames);
+    vector_clear(src->frames);
+}
+
 void
 packet_set_type(packet_t *packet, enum packet_type type)
 {
@@ -135,19 +523,63 @@ packet_set_type(packet_t *packet, enum packet_type type)
 void
 packet_set_payload(packet_t *packet, u_char *payload, uint32_t payload_len)
 {
-    // Free previous payload
-    if (packet->payload)
-        free(packet->payload);
+    frame_t *frame;
+    // Previous payload (freed after setting the new one, as they can overlap)
+    u_char *prev = (packet->payload_ref || packet->arena) ? NULL : packet->payload;
+
+    packet_payload_account(packet, -1);
+    packet->payload = NULL;
     packet->payload_len = 0;
+    packet->payload_ref = false;
+    // Located headers belong to the previous payload
+    slab_free(packet->scan);
+    packet->scan = NULL;
 
     // Set new payload
     if (payload) {
-        packet->payload = malloc(payload_len + 1);
-        memset(packet->payload, 0, payload_len + 1);
-        memcpy(packet->payload, payload, payload_len);
-        packet->payload[payload_len] = '\0';
+        // Check if payload is already stored in one of the packet frames
+        vector_iter_t it = vector_iterator(packet->frames);
+        while ((frame = vector_iterator_next(&it))) {
+            if (frame->data && payload >= frame->data
+                    && payload + payload_len <= frame->data + frame->header->caplen
+                    && payload[payload_len] == '\0') {
+                packet->payload_ref = true;
+                break;
+            }
+        }
+
+        if (packet->payload_ref) {
+            packet->payload = payload;
+        } else if (packet->arena) {
+            packet->payload = arena_memdup(packet->arena, MEMSTAT_PAYLOADS, payload, payload_len);
+        } else {
+            packet->payload = malloc(payload_len + 1);
+            memcpy(packet->payload, payload, payload_len);
+            packet->payload[payload_len] = '\0';
+        }
         packet->payload_len = payload_len;
+        packet_payload_account(packet, 1);
+    }
+
+    free(prev);
+}
+
+void
+packet_attach_payload(packet_t *packet, u_char *payload, uint32_t payload_len, bool owned)
+{
+    packet_payload_account(packet, -1);
+    if (!packet->payload_ref && !packet->arena && packet->payload != payload)
+        free(packet->payload);
+    // Located headers belong to the previous payload
+    if (packet->payload != payload) {
+        slab_free(packet->scan);
+        packet->scan = NULL;
     }
+
+    packet->payload = payload;
+    packet->payload_len = payload_len;
+    packet->payload_ref = !owned;
+    packet_payload_account(packet, 1);
 }
 
 uint32_t
@@ -165,16 +597,23 @@ packet_payload(packet_t *packet)
 struct timeval
 packet_time(packet_t *packet)
 {
-    frame_t *first;
-    struct timeval ts = { 0 };
-
-    // Return first frame timestamp
-    if (packet && (first = vector_first(packet->frames))) {
-        ts.tv_sec = first->header->ts.tv_sec;
-        ts.tv_usec = first->header->ts.tv_usec;
-    }
+    uint64_t ns = packet_time_ns(packet);
+    struct timeval ts;
 
-    // Return packe timestamp
+    ts.tv_sec = ns / 1000000000;
+    ts.tv_usec = (ns % 1000000000) / 1000;
     return ts;
 }
 
+uint64_t
+packet_time_ns(packet_t *packet)
+{
+    return (packet) ? packet->ts : 0;
+}
+
+void
+packet_set_time(packet_t *packet, uint64_t ts)
+{
+    packet->ts = ts;
+}
+
@@ -37,10 +37,12 @@
 #define __SNGREP_CAPTURE_PACKET_H
 
 #include <time.h>
+#include <stdbool.h>
 #include <sys/types.h>
 #include <pcap.h>
 #include "address.h"
 #include "vector.h"
+#include "arena.h"
 
 //! Stored packet types
 enum packet_type {
@@ -51,6 +53,7 @@ enum packet_type {
     PACKET_SIP_WSS,
     PACKET_RTP,
     PACKET_RTCP,
+    PACKET_PROBE,
 };
 
 //! Shorter declaration of packet structure
@@ -92,8 +95,28 @@ struct packet {
     u_char *payload;
     //! Payload length
     uint32_t payload_len;
+    //! Payload points to memory not owned by the packet (usually frame data)
+    bool payload_ref;
     //! Packet frame list (frame_t)
     vector_t *frames;
+    //! First frame timestamp in nanoseconds
+    uint64_t ts;
+    //! Capture source this packet was read from (NULL if unknown)
+    struct capture_info *source;
+    //! Arena owning frames and payload memory (NULL if they are malloc'ed)
+    arena_t *arena;
+    //! Compressed block storing frames data and payload (NULL if not compressed)
+    struct storage_block *block;
+    //! Disk storage segment storing frames data and payload (NULL if not on disk)
+    struct storage_segment *segment;
+    //! Payload offset in packet data copy
+    uint32_t data_payload;
+    //! Packet owning the shared payload of this retransmission (NULL if not shared)
+    packet_t *payload_owner;
+    //! Packet only has a summary sent by a probe, frames are fetched on demand
+    bool probe;
+    //! SIP headers located while validating current payload (NULL if not scanned)
+    struct sip_scan *scan;
 };
 
 /**
@@ -105,8 +128,10 @@ struct packet {
 struct frame {
     //! PCAP Frame Header data
     struct pcap_pkthdr *header;
-    //! PCAP Frame content
+    //! PCAP Frame content (NUL terminated after caplen bytes unless indexed)
     u_char *data;
+    //! Frame content position in its mapped input file (0 if unknown)
+    size_t offset;
 };
 
 /**
@@ -117,6 +142,9 @@ packet_create(uint8_t ip_ver, uint8_t proto, address_t src, address_t dst, uint3
 
 /**
  * @brief Deep clone one packet
+ *
+ * Frames of packets sharing their payload are rebuilt with a full copy
+ * of their data, so clones can be written to pcap files.
  */
 packet_t*
 packet_clone(packet_t *packet);
@@ -133,6 +161,15 @@ packet_set_transport_data(packet_t *pkt, uint16_t sport, uint16_t dport);
 frame_t *
 packet_add_frame(packet_t *pkt, const struct pcap_pkthdr *header, const u_char *packet);
 
+/**
+ * @brief Move all frames from one packet to another
+ *
+ * Frames are appended to destination packet without copying their data.
+ * Source packet is left without frames.
+ */
+void
+packet_move_frames(packet_t *dst, packet_t *src);
+
 /**
  * @brief Deallocate a packet structure memory
  */
@@ -145,6 +182,96 @@ packet_destroy(packet_t *packet);
 void
 packet_destroyer(void *packet);
 
+/**
+ * @brief Move packet frames and payload memory into an arena
+ *
+ * Frames and payload are copied into the arena and their original memory
+ * is freed. They will be released when the arena is released, so packet
+ * must be destroyed before that.
+ *
+ * @return 0 if memory has been moved, 1 otherwise
+ */
+int
+packet_set_arena(packet_t *packet, arena_t *arena);
+
+/**
+ * @brief Share the payload of an equal packet
+ *
+ * Retransmissions only keep their frame headers and data before the
+ * payload, moved into an arena. Payload points to the owner copy, that
+ * must be kept until this packet is destroyed. Frames data is rebuilt
+ * when the packet is cloned.
+ *
+ * @param packet Packet not yet stored with a single frame or no frames data
+ * @param owner Stored packet with the same payload
+ * @param arena Arena owning frames memory
+ * @return 0 if payload is shared, 1 otherwise
+ */
+int
+packet_share_payload(packet_t *packet, packet_t *owner, arena_t *arena);
+
+/**
+ * @brief Copy frames data and payload to a buffer
+ *
+ * Each frame data is copied with its NUL terminator, followed by the
+ * payload if it is not stored in frames data.
+ *
+ * @param packet Packet with frames data
+ * @param dst Destination buffer or NULL to only get the required size
+ * @return number of bytes required for the copy
+ */
+uint32_t
+packet_data_copy(packet_t *packet, u_char *dst);
+
+/**
+ * @brief Move packet frames into an arena, releasing frames data and payload
+ *
+ * Frames data and payload will only be available again after setting a
+ * copy made with packet_data_copy using packet_set_data.
+ *
+ * @return 0 if packet data has been released, 1 otherwise
+ */
+int
+packet_drop_data(packet_t *packet, arena_t *arena);
+
+/**
+ * @brief Point frames data and payload to a copy of packet data
+ *
+ * @param packet Packet without frames data
+ * @param data Copy made with packet_data_copy or NULL to unset data
+ */
+void
+packet_set_data(packet_t *packet, u_char *data);
+
+/**
+ * @brief Replace packet frames and payload with the ones of other packet
+ *
+ * Used to store the frames of a packet that only had a summary. Frames
+ * moved into an arena are replaced by copies in the same arena, keeping
+ * previous memory until the arena is released. Data packet is destroyed.
+ *
+ * @param packet Stored packet not compressed
+ * @param data Packet with the new frames and payload
+ * @param arena Arena owning packet memory
+ * @return 0 if data has been replaced, 1 otherwise (data is not destroyed)
+ */
+int
+packet_replace_data(packet_t *packet, packet_t *data, arena_t *arena);
+
+/**
+ * @brief Point frames data to their position in a mapped input file
+ *
+ * Frames data copies are released and frames are moved into an arena.
+ * Payload must be NUL terminated, so it is copied into the arena.
+ *
+ * @param packet Packet whose frames have all a known offset
+ * @param arena Arena owning frames and payload memory
+ * @param map Mapped input file data
+ * @return 0 if frames data has been released, 1 otherwise
+ */
+int
+packet_index_data(packet_t *packet, arena_t *arena, u_char *map);
+
 /**
  * @brief Free packet frames data.
  *
@@ -161,10 +288,24 @@ packet_set_type(packet_t *packet, enum packet_type type);
 
 /**
  * @brief Set packet payload when it can not be get from packet
+ *
+ * If the given payload is contained in one of the packet frames and it is
+ * followed by a NUL byte, the packet will point to frame data instead of
+ * storing a copy of the payload.
  */
 void
 packet_set_payload(packet_t *packet, u_char *payload, uint32_t payload_len);
 
+/**
+ * @brief Use an existing buffer as packet payload without copying it
+ *
+ * Buffer must be NUL terminated after payload_len bytes. If owned is true
+ * the packet will free the buffer, otherwise the buffer must be valid while
+ * the packet payload is being used.
+ */
+void
+packet_attach_payload(packet_t *packet, u_char *payload, uint32_t payload_len, bool owned);
+
 /**
  * @brief Getter for capture payload size
  */
@@ -183,4 +324,22 @@ packet_payload(packet_t *packet);
 struct timeval
 packet_time(packet_t *packet);
 
+/**
+ * @brief Get the timestamp for a packet in nanoseconds
+ *
+ * Packets are sorted using this timestamp, so they keep the capture order
+ * of frames received in the same microsecond when the source provides
+ * nanosecond precision.
+ */
+uint64_t
+packet_time_ns(packet_t *packet);
+
+/**
+ * @brief Set the timestamp for a packet in nanoseconds
+ *
+ * By default, packet timestamp is taken from its first frame header.
+ */
+void
+packet_set_time(packet_t *packet, uint64_t ts);
+
 #endif /* __SNGREP_CAPTURE_PACKET_H */
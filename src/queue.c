@@ -0,0 +1,131 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file queue.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source code of functions defined in queue.h
+ *
+ */
+#include "queue.h"
+#include <string.h>
+#include <stdlib.h>
+
+queue_t *
+queue_create(uint32_t size)
+{
+    queue_t *queue;
+    uint32_t qsize = 2;
+
+    // Queue size must be a power of 2 to use masks
+    while (qsize < size)
+        qsize <<= 1;
+
+    // Allocate memory for this queue data
+    if (!(queue = malloc(sizeof(queue_t))))
+        return NULL;
+
+    memset(queue, 0, sizeof(queue_t));
+    queue->size = qsize;
+
+    // Allocate memory for queued items
+    if (!(queue->items = malloc(sizeof(void *) * qsize))) {
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void
+queue_destroy(queue_t *queue)
+{
+    if (!queue)
+        return;
+    free(queue->items);
+    free(queue);
+}
+
+bool
+queue_push(queue_t *queue, void *item)
+{
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    // Queue is full
+    if (tail - head == queue->size)
+        return false;
+
+    // Store the item before making it visible to the consumer
+    queue->items[tail & (queue->size - 1)] = item;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void *
+queue_pop(queue_t *queue)
+{
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    void *item;
+
+    // Queue is empty
+    if (head == tail)
+        return NULL;
+
+    // Get the item before releasing its position to the producer
+    item = queue->items[head & (queue->size - 1)];
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+void *
+queue_peek(queue_t *queue)
+{
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    // Queue is empty
+    if (head == tail)
+        return NULL;
+
+    return queue->items[head & (queue->size - 1)];
+}
+
+uint32_t
+queue_count(queue_t *queue)
+{
+    return __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)
+           - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+}
+
+void
+queue_close(queue_t *queue)
+{
+    __atomic_store_n(&queue->closed, true, __ATOMIC_RELEASE);
+}
+
+bool
+queue_finished(queue_t *queue)
+{
+    return __atomic_load_n(&queue->closed, __ATOMIC_ACQUIRE) && queue_count(queue) == 0;
+}
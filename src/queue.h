@@ -0,0 +1,117 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file queue.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to manage bounded single producer/consumer queues
+ *
+ * Queues are fixed size rings of pointers that can be filled from one
+ * thread and emptied from another one without locking.
+ */
+
+#ifndef __SNGREP_QUEUE_H_
+#define __SNGREP_QUEUE_H_
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//! Shorter declaration of queue structure
+typedef struct queue queue_t;
+
+/**
+ * @brief Structure to hold a bounded SPSC queue
+ */
+struct queue {
+    //! Queue size (power of 2)
+    uint32_t size;
+    //! Queue items
+    void **items;
+    //! Next position to be read (only written by consumer)
+    uint32_t head;
+    //! Next position to be written (only written by producer)
+    uint32_t tail;
+    //! Producer will no longer add items
+    bool closed;
+};
+
+/**
+ * @brief Create a new queue
+ *
+ * Requested size is rounded up to the next power of 2
+ *
+ * @param size Max number of queued items
+ * @return a new allocated queue or NULL
+ */
+queue_t *
+queue_create(uint32_t size);
+
+/**
+ * @brief Destroy the queue (not the queued items)
+ */
+void
+queue_destroy(queue_t *queue);
+
+/**
+ * @brief Add an item to the queue (producer side)
+ *
+ * @return true if the item has been queued, false if the queue is full
+ */
+bool
+queue_push(queue_t *queue, void *item);
+
+/**
+ * @brief Remove the oldest item from the queue (consumer side)
+ *
+ * @return the oldest queued item or NULL if the queue is empty
+ */
+void *
+queue_pop(queue_t *queue);
+
+/**
+ * @brief Get the oldest item without removing it (consumer side)
+ *
+ * @return the oldest queued item or NULL if the queue is empty
+ */
+void *
+queue_peek(queue_t *queue);
+
+/**
+ * @brief Number of items currently queued
+ */
+uint32_t
+queue_count(queue_t *queue);
+
+/**
+ * @brief Mark the queue as closed (producer side)
+ */
+void
+queue_close(queue_t *queue);
+
+/**
+ * @brief Check if queue is closed and all its items has been removed
+ */
+bool
+queue_finished(queue_t *queue);
+
+#endif /* __SNGREP_QUEUE_H_ */
@@ -0,0 +1,435 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file report.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in report.h
+ *
+ * Talkers are stored in an open addressing table. Once it is full,
+ * dialogs from new addresses are accounted as other talkers.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "report.h"
+#include "address.h"
+#include "hash.h"
+#include "rtp.h"
+#include "sip_msg.h"
+
+//! Shorter declaration of report_time structure
+typedef struct report_time report_time_t;
+//! Shorter declaration of report_talker structure
+typedef struct report_talker report_talker_t;
+
+/**
+ * @brief Accounted values of a dialog timing
+ */
+struct report_time {
+    //! Number of dialogs with this timing
+    uint64_t count;
+    //! Sum of all timings in milliseconds
+    uint64_t sum;
+    //! Min timing in milliseconds
+    uint64_t min;
+    //! Max timing in milliseconds
+    uint64_t max;
+};
+
+/**
+ * @brief Dialogs started from a single address
+ */
+struct report_talker {
+    //! Source address of first dialog message (empty if unused)
+    char ip[ADDRESSLEN];
+    //! Number of dialogs
+    uint64_t calls;
+    //! Number of messages of its dialogs
+    uint64_t msgs;
+};
+
+/**
+ * @brief Accounted dialogs statistics
+ */
+struct report {
+    //! Removed dialogs are being accounted
+    bool enabled;
+    //! Format of the printed report
+    enum report_format format;
+    //! Lock for accounted values
+    pthread_mutex_t lock;
+    //! Number of accounted dialogs
+    uint64_t calls;
+    //! Number of accounted messages
+    uint64_t msgs;
+    //! Dialogs by final state (0 for non INVITE dialogs)
+    uint64_t states[SIP_CALLSTATE_COMPLETED + 1];
+    //! Dialogs by final response code (0 without final response)
+    uint64_t codes[REPORT_MAXCODE];
+    //! Time from INVITE to first provisional ringing response
+    report_time_t pdd;
+    //! Time from INVITE to call answer
+    report_time_t setup;
+    //! Time from call answer to call hangup
+    report_time_t duration;
+    //! Number of RTP streams with received packets
+    uint64_t streams;
+    //! Number of RTP streams with lost packets
+    uint64_t streams_lossy;
+    //! Number of received RTP packets
+    uint64_t rtp_packets;
+    //! Number of lost RTP packets
+    uint64_t rtp_lost;
+    //! Sum of all RTP streams jitter
+    double jitter_sum;
+    //! Max RTP stream jitter
+    double jitter_max;
+    //! Dialogs by source address
+    report_talker_t talkers[REPORT_TALKERS];
+    //! Number of used talkers entries
+    int talkers_count;
+    //! Dialogs from addresses not fitting in talkers table
+    report_talker_t others;
+};
+
+//! Accounted statistics
+static struct report report = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void
+report_enable(enum report_format format)
+{
+    report.format = format;
+    report.enabled = true;
+}
+
+bool
+report_enabled()
+{
+    return report.enabled;
+}
+
+/**
+ * @brief Get milliseconds between two messages
+ */
+static uint64_t
+report_msec(sip_msg_t *from, sip_msg_t *to)
+{
+    uint64_t start = msg_get_time_ns(from), end = msg_get_time_ns(to);
+
+    return (end > start) ? (end - start) / 1000000 : 0;
+}
+
+/**
+ * @brief Account a dialog timing
+ */
+static void
+report_time_add(report_time_t *time, uint64_t msec)
+{
+    if (!time->count || msec < time->min)
+        time->min = msec;
+    if (msec > time->max)
+        time->max = msec;
+    time->sum += msec;
+    time->count++;
+}
+
+/**
+ * @brief Find or create the talkers entry of an address
+ *
+ * @return talker entry or others entry if table is full
+ */
+static report_talker_t *
+report_talker(const char *ip)
+{
+    uint64_t slot = hash_mem64(ip, strlen(ip)) % REPORT_TALKERS;
+    report_talker_t *talker;
+    int i;
+
+    for (i = 0; i < REPORT_TALKERS; i++) {
+        talker = &report.talkers[(slot + i) % REPORT_TALKERS];
+        if (!talker->ip[0]) {
+            // Keep a free entry so lookups always finish
+            if (report.talkers_count == REPORT_TALKERS - 1)
+                break;
+            strcpy(talker->ip, ip);
+            report.talkers_count++;
+            return talker;
+        }
+        if (!strcmp(talker->ip, ip))
+            return talker;
+    }
+
+    return &report.others;
+}
+
+/**
+ * @brief Account RTP streams quality of a dialog
+ */
+static void
+report_call_streams(sip_call_t *call)
+{
+    rtp_stream_t *stream;
+    vector_iter_t it = vector_iterator(call->streams);
+    double jitter;
+
+    while ((stream = vector_iterator_next(&it))) {
+        // Only RTP streams with received packets have quality metrics
+        if (stream->type != PACKET_RTP || !stream_get_count(stream))
+            continue;
+
+        jitter = stream_get_jitter(stream);
+        report.streams++;
+        report.rtp_packets += stream_get_count(stream);
+        report.rtp_lost += stream_get_lost(stream);
+        if (stream_get_lost(stream))
+            report.streams_lossy++;
+        report.jitter_sum += jitter;
+        if (jitter > report.jitter_max)
+            report.jitter_max = jitter;
+    }
+}
+
+void
+report_call(sip_call_t *call)
+{
+    sip_msg_t *first, *msg, *ringing = NULL, *final = NULL;
+    report_talker_t *talker;
+    char ip[ADDRESSLEN];
+    vector_iter_t it;
+    int msgs = 0;
+
+    if (!report.enabled || !(first = vector_first(call->msgs)))
+        return;
+
+    pthread_mutex_lock(&report.lock);
+
+    // Find the final response and first ringing of the initial transaction
+    it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it))) {
+        msgs++;
+        if (msg->retrans || msg_is_request(msg) || msg->cseq != first->cseq)
+            continue;
+        if (msg->reqresp >= 200) {
+            final = msg;
+        } else if (!ringing && msg->reqresp >= 180 && msg->reqresp < 190) {
+            ringing = msg;
+        }
+    }
+
+    report.calls++;
+    report.msgs += msgs;
+    if (CALL_SLOT(call, state) <= SIP_CALLSTATE_COMPLETED)
+        report.states[CALL_SLOT(call, state)]++;
+    report.codes[(final && final->reqresp < REPORT_MAXCODE) ? final->reqresp : 0]++;
+
+    // Conversation timings are only available for answered calls
+    if (CALL_SLOT(call, state) && ringing)
+        report_time_add(&report.pdd, report_msec(first, ringing));
+    if (call->cstart_msg) {
+        report_time_add(&report.setup, report_msec(first, call->cstart_msg));
+        if (call->cend_msg)
+            report_time_add(&report.duration, report_msec(call->cstart_msg, call->cend_msg));
+    }
+
+    report_call_streams(call);
+
+    talker = report_talker(address_get_ip(first->packet->src, ip));
+    talker->calls++;
+    talker->msgs += msgs;
+
+    pthread_mutex_unlock(&report.lock);
+}
+
+/**
+ * @brief Sort talkers by number of dialogs
+ *
+ * @return number of sorted talkers, at most REPORT_TALKERS_TOP
+ */
+static int
+report_talkers_top(report_talker_t **top)
+{
+    report_talker_t *talker;
+    int i, j, count = 0;
+
+    for (i = 0; i < REPORT_TALKERS; i++) {
+        talker = &report.talkers[i];
+        if (!talker->ip[0])
+            continue;
+        if (count == REPORT_TALKERS_TOP && top[count - 1]->calls >= talker->calls)
+            continue;
+        // Insert in place, dropping the last one if list is full
+        j = (count < REPORT_TALKERS_TOP) ? count++ : REPORT_TALKERS_TOP - 1;
+        for (; j > 0 && top[j - 1]->calls < talker->calls; j--)
+            top[j] = top[j - 1];
+        top[j] = talker;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Print a dialog timing in text format
+ */
+static void
+report_time_txt(FILE *f, const char *name, report_time_t *time)
+{
+    if (!time->count) {
+        fprintf(f, "%-10s -\n", name);
+        return;
+    }
+    fprintf(f, "%-10s count %" PRIu64 ", avg %" PRIu64 " ms, min %" PRIu64 " ms, max %" PRIu64 " ms\n",
+            name, time->count, time->sum / time->count, time->min, time->max);
+}
+
+/**
+ * @brief Print the report in text format
+ */
+static void
+report_print_txt(FILE *f)
+{
+    report_talker_t *top[REPORT_TALKERS_TOP];
+    int i, count;
+
+    fprintf(f, "Dialogs: %" PRIu64 " (%" PRIu64 " messages)\n", report.calls, report.msgs);
+
+    fprintf(f, "\nFinal state:\n");
+    for (i = 0; i <= SIP_CALLSTATE_COMPLETED; i++) {
+        if (report.states[i])
+            fprintf(f, "  %-12s %" PRIu64 "\n", i ? call_state_to_str(i) : "NON INVITE", report.states[i]);
+    }
+
+    fprintf(f, "\nFinal response:\n");
+    for (i = 0; i < REPORT_MAXCODE; i++) {
+        if (!report.codes[i])
+            continue;
+        if (i) {
+            fprintf(f, "  %-12d %" PRIu64 "\n", i, report.codes[i]);
+        } else {
+            fprintf(f, "  %-12s %" PRIu64 "\n", "none", report.codes[i]);
+        }
+    }
+
+    fprintf(f, "\nTimings:\n");
+    report_time_txt(f, "  PDD", &report.pdd);
+    report_time_txt(f, "  Setup", &report.setup);
+    report_time_txt(f, "  Duration", &report.duration);
+
+    fprintf(f, "\nRTP streams: %" PRIu64 ", with loss %" PRIu64 "\n", report.streams, report.streams_lossy);
+    if (report.streams) {
+        fprintf(f, "  packets %" PRIu64 ", lost %" PRIu64 " (%.2f%%)\n", report.rtp_packets, report.rtp_lost,
+                report.rtp_lost * 100.0 / (report.rtp_packets + report.rtp_lost));
+        fprintf(f, "  jitter avg %.1f ms, max %.1f ms\n", report.jitter_sum / report.streams,
+                report.jitter_max);
+    }
+
+    fprintf(f, "\nTop talkers:\n");
+    count = report_talkers_top(top);
+    for (i = 0; i < count; i++)
+        fprintf(f, "  %-40s %" PRIu64 " dialogs, %" PRIu64 " messages\n", top[i]->ip, top[i]->calls,
+                top[i]->msgs);
+    if (report.others.calls)
+        fprintf(f, "  %-40s %" PRIu64 " dialogs, %" PRIu64 " messages\n", "others", report.others.calls,
+                report.others.msgs);
+}
+
+/**
+ * @brief Print a dialog timing in JSON format
+ */
+static void
+report_time_json(FILE *f, const char *name, report_time_t *time)
+{
+    fprintf(f, ",\"%s\":{\"count\":%" PRIu64, name, time->count);
+    if (time->count)
+        fprintf(f, ",\"avg_ms\":%" PRIu64 ",\"min_ms\":%" PRIu64 ",\"max_ms\":%" PRIu64,
+                time->sum / time->count, time->min, time->max);
+    fputc('}', f);
+}
+
+/**
+ * @brief Print the report as a single JSON object
+ */
+static void
+report_print_json(FILE *f)
+{
+    report_talker_t *top[REPORT_TALKERS_TOP];
+    bool comma = false;
+    int i, count;
+
+    fprintf(f, "{\"dialogs\":%" PRIu64 ",\"messages\":%" PRIu64 ",\"states\":{", report.calls, report.msgs);
+    for (i = 0; i <= SIP_CALLSTATE_COMPLETED; i++) {
+        if (!report.states[i])
+            continue;
+        fprintf(f, "%s\"%s\":%" PRIu64, comma ? "," : "", i ? call_state_to_str(i) : "NON INVITE",
+                report.states[i]);
+        comma = true;
+    }
+
+    fputs("},\"codes\":{", f);
+    comma = false;
+    for (i = 0; i < REPORT_MAXCODE; i++) {
+        if (!report.codes[i])
+            continue;
+        if (i) {
+            fprintf(f, "%s\"%d\":%" PRIu64, comma ? "," : "", i, report.codes[i]);
+        } else {
+            fprintf(f, "%s\"none\":%" PRIu64, comma ? "," : "", report.codes[i]);
+        }
+        comma = true;
+    }
+    fputc('}', f);
+
+    report_time_json(f, "pdd", &report.pdd);
+    report_time_json(f, "setup", &report.setup);
+    report_time_json(f, "duration", &report.duration);
+
+    fprintf(f, ",\"rtp\":{\"streams\":%" PRIu64 ",\"streams_lossy\":%" PRIu64 ",\"packets\":%" PRIu64
+            ",\"lost\":%" PRIu64 ",\"jitter_avg_ms\":%.1f,\"jitter_max_ms\":%.1f}",
+            report.streams, report.streams_lossy, report.rtp_packets, report.rtp_lost,
+            report.streams ? report.jitter_sum / report.streams : 0, report.jitter_max);
+
+    fputs(",\"talkers\":[", f);
+    count = report_talkers_top(top);
+    for (i = 0; i < count; i++)
+        fprintf(f, "%s{\"src\":\"%s\",\"dialogs\":%" PRIu64 ",\"messages\":%" PRIu64 "}",
+                i ? "," : "", top[i]->ip, top[i]->calls, top[i]->msgs);
+    fprintf(f, "],\"other_talkers\":{\"dialogs\":%" PRIu64 ",\"messages\":%" PRIu64 "}}\n",
+            report.others.calls, report.others.msgs);
+}
+
+void
+report_print(FILE *f)
+{
+    if (!report.enabled)
+        return;
+
+    pthread_mutex_lock(&report.lock);
+    if (report.format == REPORT_JSON) {
+        report_print_json(f);
+    } else {
+        report_print_txt(f);
+    }
+    pthread_mutex_unlock(&report.lock);
+}
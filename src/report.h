@@ -0,0 +1,89 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file report.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to aggregate dialog statistics of a capture
+ *
+ * In statistics mode (--stats) no frames are stored and dialogs are
+ * rotated once the capture limit is reached. Each dialog is accounted
+ * when it is removed from storage, so a report of any capture size can
+ * be built with the memory of the stored dialogs and a fixed size
+ * table of talkers.
+ *
+ */
+#ifndef __SNGREP_REPORT_H
+#define __SNGREP_REPORT_H
+
+#include "config.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include "sip_call.h"
+
+//! Max final response code accounted in report
+#define REPORT_MAXCODE 700
+//! Max number of different talkers accounted in report
+#define REPORT_TALKERS 4096
+//! Number of talkers printed in report
+#define REPORT_TALKERS_TOP 10
+
+/**
+ * @brief Report output formats
+ */
+enum report_format {
+    REPORT_TEXT = 0,
+    REPORT_JSON,
+};
+
+/**
+ * @brief Start accounting removed dialogs
+ *
+ * @param format Format of the printed report
+ */
+void
+report_enable(enum report_format format);
+
+/**
+ * @brief Check if removed dialogs are being accounted
+ */
+bool
+report_enabled();
+
+/**
+ * @brief Account a dialog that is being removed from storage
+ *
+ * This function is invoked with capture locked, before the call
+ * messages and streams are destroyed.
+ */
+void
+report_call(sip_call_t *call);
+
+/**
+ * @brief Print the report of all accounted dialogs
+ *
+ * Remaining stored dialogs must have been removed before printing.
+ */
+void
+report_print(FILE *f);
+
+#endif /* __SNGREP_REPORT_H */
@@ -31,11 +31,26 @@
 
 #include "config.h"
 #include <stddef.h>
+#include <stdlib.h>
 #include <time.h>
+#include <string.h>
+#include <pthread.h>
 #include "rtp.h"
 #include "sip.h"
+#include "hash.h"
 #include "vector.h"
 
+/**
+ * @brief Streams of stored calls by destination address
+ */
+static struct
+{
+    //! First stream of each destination, newest first
+    htable_t *table;
+    //! Streams can be added from multiple SIP workers
+    pthread_mutex_t lock;
+} streams = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
 /**
  * @brief Known RTP encodings
  */
@@ -72,8 +87,8 @@ stream_create(sdp_media_t *media, address_t dst, int type)
 {
     rtp_stream_t *stream;
 
-    // Allocate memory for this stream structure
-    if (!(stream = sng_malloc(sizeof(rtp_stream_t))))
+    // Allocate memory for this stream structure in media call memory
+    if (!(stream = arena_alloc_tag(&media->msg->call->arena, MEMSTAT_STREAMS, sizeof(rtp_stream_t))))
         return NULL;
 
     // Initialize all fields
@@ -91,28 +106,250 @@ stream_complete(rtp_stream_t *stream, address_t src)
     return stream;
 }
 
+/**
+ * @brief Get clock rate of a stream format from its encoding name
+ *
+ * Encoding names have the form name/rate[/channels]. Unknown formats
+ * use the 8000 Hz rate of most audio codecs.
+ */
+static uint32_t
+stream_clock_rate(rtp_stream_t *stream)
+{
+    const char *name = NULL, *rate;
+    uint32_t clock;
+    int i;
+
+    for (i = 0; encodings[i].format; i++) {
+        if (encodings[i].id == stream->rtpinfo.fmtcode) {
+            name = encodings[i].name;
+            break;
+        }
+    }
+
+    if (!name && stream->media)
+        name = media_get_format(stream->media, stream->rtpinfo.fmtcode);
+
+    if (name && (rate = strchr(name, '/')) && (clock = strtoul(rate + 1, NULL, 10)))
+        return clock;
+
+    return 8000;
+}
+
 void
 stream_set_format(rtp_stream_t *stream, uint32_t format)
 {
     stream->rtpinfo.fmtcode = format;
+    if (stream->type == PACKET_RTP)
+        stream->rtpinfo.stats.clock = stream_clock_rate(stream);
+}
+
+/**
+ * @brief Update stream quality metrics with a new RTP packet
+ *
+ * This must be called before the packet is counted in the stream.
+ */
+static void
+stream_update_stats(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_stats_t *stats = &stream->rtpinfo.stats;
+    u_char *payload = packet_payload(packet);
+    uint32_t size = packet_payloadlen(packet);
+    uint64_t time = packet_time_ns(packet);
+    uint64_t elapsed = (time > stream->time) ? time - stream->time : 0;
+    uint16_t seq, udelta;
+    uint32_t rtpts, transit, delta;
+    int32_t d;
+
+    if (size < RTP_HDR_LENGTH)
+        return;
+
+    seq = (payload[2] << 8) | payload[3];
+    rtpts = ((uint32_t) payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+
+    if (!stats->clock)
+        stats->clock = stream_clock_rate(stream);
+
+    // Arrival time since first packet in RTP timestamp units
+    transit = (uint32_t) (elapsed / 1000000000 * stats->clock
+                          + elapsed % 1000000000 * stats->clock / 1000000000) - rtpts;
+
+    if (stream->pktcnt == 0) {
+        stats->base_seq = stats->max_seq = seq;
+    } else {
+        udelta = seq - stats->max_seq;
+        if (udelta != 0 && udelta < 0x8000) {
+            // In order packet, sequence may have wrapped around
+            if (seq < stats->max_seq)
+                stats->cycles += (UINT16_MAX + 1);
+            stats->max_seq = seq;
+        } else if (udelta != 0) {
+            stats->out_of_order++;
+        }
+
+        // J(i) = J(i-1) + (|D(i-1,i)| - J(i-1)) / 16
+        d = (int32_t) (transit - stats->transit);
+        if (d < 0)
+            d = -d;
+        stats->jitter += d - ((stats->jitter + 8) >> 4);
+
+        if (time > stats->last_time) {
+            delta = (time - stats->last_time) / 1000000;
+            if (delta > stats->max_delta)
+                stats->max_delta = delta;
+        }
+    }
+
+    stats->transit = transit;
+    stats->last_time = time;
+    stats->bytes += size - RTP_HDR_LENGTH;
 }
 
 void
 stream_add_packet(rtp_stream_t *stream, packet_t *packet)
 {
     if (stream->pktcnt == 0)
-        stream->time = packet_time(packet);
+        stream->time = packet_time_ns(packet);
+
+    if (stream->type == PACKET_RTP)
+        stream_update_stats(stream, packet);
 
     stream->lasttm = (int) time(NULL);
     stream->pktcnt++;
 }
 
+int
+stream_add_header(rtp_stream_t *stream, packet_t *packet)
+{
+    rtp_header_chunk_t *chunk = stream->headers_last;
+    rtp_header_t *header;
+    sip_call_t *call;
+    u_char *payload = packet_payload(packet);
+    uint32_t size = packet_payloadlen(packet);
+    struct timeval ts = packet_time(packet);
+    uint32_t chunk_size;
+
+    if (size < RTP_HDR_LENGTH || !(call = stream_get_call(stream)))
+        return 1;
+
+    // Allocate a new chunk when last one is full
+    if (!chunk || chunk->count == chunk->size) {
+        chunk_size = (chunk) ? chunk->size * 2 : STREAM_HEADER_CHUNK_MIN;
+        if (chunk_size > STREAM_HEADER_CHUNK_MAX)
+            chunk_size = STREAM_HEADER_CHUNK_MAX;
+        if (!(chunk = arena_alloc_tag(&call->arena, MEMSTAT_RTP,
+                                      sizeof(rtp_header_chunk_t) + chunk_size * sizeof(rtp_header_t))))
+            return 1;
+        chunk->size = chunk_size;
+        if (stream->headers_last) {
+            stream->headers_last->next = chunk;
+        } else {
+            stream->headers = chunk;
+        }
+        stream->headers_last = chunk;
+        call_update_memory(call);
+    }
+
+    header = &chunk->headers[chunk->count++];
+    header->sec = ts.tv_sec;
+    header->usec = ts.tv_usec;
+    header->mpt = payload[1];
+    header->seq = (payload[2] << 8) | payload[3];
+    header->ts = ((uint32_t) payload[4] << 24) | (payload[5] << 16) | (payload[6] << 8) | payload[7];
+    header->len = (size - RTP_HDR_LENGTH > UINT16_MAX) ? UINT16_MAX : size - RTP_HDR_LENGTH;
+    return 0;
+}
+
+int
+stream_get_summary(rtp_stream_t *stream, rtp_summary_t *summary)
+{
+    rtp_header_chunk_t *chunk;
+    rtp_header_t *header;
+    uint64_t time, first_time = 0, prev_time = 0;
+    uint32_t seq, first_seq = 0, max_seq = 0, cycles = 0;
+    uint16_t prev_seq = 0;
+    uint32_t i;
+
+    memset(summary, 0, sizeof(rtp_summary_t));
+
+    for (chunk = stream->headers; chunk; chunk = chunk->next) {
+        for (i = 0; i < chunk->count; i++) {
+            header = &chunk->headers[i];
+            time = (uint64_t) header->sec * 1000000 + header->usec;
+
+            if (summary->packets == 0) {
+                first_time = time;
+                first_seq = max_seq = header->seq;
+            } else {
+                // Sequence number has wrapped around
+                if (header->seq < prev_seq && prev_seq - header->seq > UINT16_MAX / 2)
+                    cycles += UINT16_MAX + 1;
+                seq = cycles + header->seq;
+                if (seq > max_seq)
+                    max_seq = seq;
+                if (time > prev_time && (time - prev_time) / 1000 > summary->max_gap)
+                    summary->max_gap = (time - prev_time) / 1000;
+            }
+
+            prev_seq = header->seq;
+            prev_time = time;
+            summary->packets++;
+        }
+    }
+
+    if (!summary->packets)
+        return 1;
+
+    summary->expected = max_seq - first_seq + 1;
+    summary->lost = (summary->expected > summary->packets) ? summary->expected - summary->packets : 0;
+    summary->duration = (prev_time > first_time) ? (prev_time - first_time) / 1000 : 0;
+    return 0;
+}
+
 uint32_t
 stream_get_count(rtp_stream_t *stream)
 {
     return stream->pktcnt;
 }
 
+uint32_t
+stream_get_lost(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->rtpinfo.stats;
+    uint32_t expected;
+
+    if (stream->type != PACKET_RTP || !stream->pktcnt)
+        return 0;
+
+    expected = stats->cycles + stats->max_seq - stats->base_seq + 1;
+    return (expected > stream->pktcnt) ? expected - stream->pktcnt : 0;
+}
+
+double
+stream_get_jitter(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->rtpinfo.stats;
+
+    if (stream->type != PACKET_RTP || !stats->clock)
+        return 0;
+
+    return (double) (stats->jitter >> 4) * 1000 / stats->clock;
+}
+
+uint32_t
+stream_get_bitrate(rtp_stream_t *stream)
+{
+    rtp_stats_t *stats = &stream->rtpinfo.stats;
+    uint64_t usecs;
+
+    if (stream->type != PACKET_RTP || stats->last_time <= stream->time)
+        return 0;
+
+    if (!(usecs = (stats->last_time - stream->time) / 1000))
+        return 0;
+
+    return stats->bytes * 8 * 1000000 / usecs;
+}
+
 struct sip_call *
 stream_get_call(rtp_stream_t *stream) {
     if (stream && stream->media && stream->media->msg)
@@ -328,54 +565,128 @@ rtp_check_packet(packet_t *packet)
     return stream;
 }
 
+static uint32_t
+stream_index_hash(const void *key)
+{
+    return address_hash(*(const address_t *) key, true);
+}
+
+static bool
+stream_index_equal(const void *key1, const void *key2)
+{
+    return addressport_equals(*(const address_t *) key1, *(const address_t *) key2);
+}
+
+/**
+ * @brief Get the newest indexed stream with the given destination
+ *
+ * Streams index lock must be held while walking the returned list.
+ */
+static rtp_stream_t *
+stream_index_find(address_t dst)
+{
+    if (!streams.table)
+        return NULL;
+    return htable_find(streams.table, &dst);
+}
+
+void
+stream_index_add(rtp_stream_t *stream)
+{
+    rtp_stream_t *next;
+
+    pthread_mutex_lock(&streams.lock);
+    if (!streams.table)
+        streams.table = htable_create_custom(0, stream_index_hash, stream_index_equal);
+
+    if (streams.table) {
+        // Newest stream is stored first, its address is the entry key
+        if ((next = htable_find(streams.table, &stream->dst)))
+            htable_remove(streams.table, &stream->dst);
+        if (htable_insert(streams.table, &stream->dst, stream) == 0) {
+            stream->index_next = next;
+        } else if (next) {
+            htable_insert(streams.table, &next->dst, next);
+        }
+    }
+    pthread_mutex_unlock(&streams.lock);
+}
+
+void
+stream_index_remove(rtp_stream_t *stream)
+{
+    rtp_stream_t **prev, *first;
+
+    pthread_mutex_lock(&streams.lock);
+    if ((first = stream_index_find(stream->dst))) {
+        if (first == stream) {
+            // Next stream becomes the first one, using its own address as key
+            htable_remove(streams.table, &stream->dst);
+            if (stream->index_next)
+                htable_insert(streams.table, &stream->index_next->dst, stream->index_next);
+        } else {
+            for (prev = &first->index_next; *prev && *prev != stream; prev = &(*prev)->index_next);
+            if (*prev)
+                *prev = stream->index_next;
+        }
+    }
+    stream->index_next = NULL;
+    pthread_mutex_unlock(&streams.lock);
+}
+
+void
+stream_index_clear()
+{
+    pthread_mutex_lock(&streams.lock);
+    htable_destroy(streams.table);
+    streams.table = NULL;
+    pthread_mutex_unlock(&streams.lock);
+}
+
+void
+rtp_deinit()
+{
+    pthread_mutex_lock(&streams.lock);
+    htable_destroy(streams.table);
+    streams.table = NULL;
+    pthread_mutex_unlock(&streams.lock);
+}
+
 rtp_stream_t *
 rtp_find_stream_format(address_t src, address_t dst, uint32_t format)
 {
     // Structure for RTP packet streams
     rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-    // Iterator for call streams
-    vector_iter_t streams;
     // Candiate stream
     rtp_stream_t *candidate = NULL;
 
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
-        streams = vector_iterator(call->streams);
-        vector_iterator_set_last(&streams);
-        while ((stream = vector_iterator_prev(&streams))) {
-            // Only look RTP packets
-            if (stream->type != PACKET_RTP)
-                continue;
-
-            // Stream complete, check source, dst
-            if (stream_is_complete(stream)) {
-                if (addressport_equals(stream->src, src) &&
-                    addressport_equals(stream->dst, dst)) {
-                    // Exact searched stream format
-                    if (stream->rtpinfo.fmtcode == format) {
-                        return stream;
-                    } else {
-                        // Matching addresses but different format
-                        candidate = stream;
-                    }
-                }
-            } else {
-                // Incomplete stream, if dst match is enough
-                if (addressport_equals(stream->dst, dst)) {
-                       return stream;
+    pthread_mutex_lock(&streams.lock);
+
+    // Check streams with this destination, newest first
+    for (stream = stream_index_find(dst); stream; stream = stream->index_next) {
+        // Only look RTP packets
+        if (stream->type != PACKET_RTP)
+            continue;
+
+        // Stream complete, check source
+        if (stream_is_complete(stream)) {
+            if (addressport_equals(stream->src, src)) {
+                // Exact searched stream format
+                if (stream->rtpinfo.fmtcode == format) {
+                    break;
+                } else {
+                    // Matching addresses but different format
+                    candidate = stream;
                 }
             }
+        } else {
+            // Incomplete stream, if dst match is enough
+            break;
         }
     }
 
-    return candidate;
+    pthread_mutex_unlock(&streams.lock);
+    return stream ? stream : candidate;
 }
 
 rtp_stream_t *
@@ -383,25 +694,20 @@ rtp_find_rtcp_stream(address_t src, address_t dst)
 {
     // Structure for RTP packet streams
     rtp_stream_t *stream;
-    // Check if this is a RTP packet from active calls
-    sip_call_t *call;
-    // Iterator for active calls
-    vector_iter_t calls;
-
-    // Get active calls (during conversation)
-    calls = sip_calls_iterator();
-    vector_iterator_set_current(&calls, vector_iterator_count(&calls));
-
-    while ((call = vector_iterator_prev(&calls))) {
-        // Check if this call has an RTP stream for current packet data
-        if ((stream = rtp_find_call_stream(call, src, dst))) {
-            if (stream->type != PACKET_RTCP)
-                continue;
-            return stream;
-        }
+
+    pthread_mutex_lock(&streams.lock);
+
+    // Check streams with this destination, newest first
+    for (stream = stream_index_find(dst); stream; stream = stream->index_next) {
+        if (stream->type != PACKET_RTCP)
+            continue;
+        // Stream without packets or with this exact source
+        if (!stream->pktcnt || addressport_equals(src, stream->src))
+            break;
     }
 
-    return NULL;
+    pthread_mutex_unlock(&streams.lock);
+    return stream;
 }
 
 
@@ -470,7 +776,7 @@ stream_is_older(rtp_stream_t *one, rtp_stream_t *two)
         return 0;
 
     // Otherwise
-    return timeval_is_older(one->time, two->time);
+    return one->time >= two->time;
 }
 
 int
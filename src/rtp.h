@@ -53,6 +53,10 @@
 // If stream does not receive a packet in this seconds, we consider it inactive
 #define STREAM_INACTIVE_SECS 3
 
+// Number of RTP headers stored in first and biggest chunks of a stream
+#define STREAM_HEADER_CHUNK_MIN 16
+#define STREAM_HEADER_CHUNK_MAX 512
+
 // RTCP header types
 //! http://www.iana.org/assignments/rtp-parameters/rtp-parameters.xhtml
 enum rtcp_header_types
@@ -91,6 +95,14 @@ enum rtcp_xr_block_types
 typedef struct rtp_encoding rtp_encoding_t;
 //! Shorter declaration of rtp_stream structure
 typedef struct rtp_stream rtp_stream_t;
+//! Shorter declaration of rtp_header structure
+typedef struct rtp_header rtp_header_t;
+//! Shorter declaration of rtp_header_chunk structure
+typedef struct rtp_header_chunk rtp_header_chunk_t;
+//! Shorter declaration of rtp_summary structure
+typedef struct rtp_summary rtp_summary_t;
+//! Shorter declaration of rtp_stats structure
+typedef struct rtp_stats rtp_stats_t;
 
 struct rtp_encoding {
     uint32_t id;
@@ -98,6 +110,85 @@ struct rtp_encoding {
     const char *format;
 };
 
+/**
+ * @brief RTP packet data kept when its payload is not stored
+ */
+struct rtp_header {
+    //! Capture time seconds
+    uint32_t sec;
+    //! Capture time microseconds
+    uint32_t usec;
+    //! RTP timestamp
+    uint32_t ts;
+    //! RTP sequence number
+    uint16_t seq;
+    //! RTP payload length
+    uint16_t len;
+    //! RTP marker (highest bit) and payload type
+    uint8_t mpt;
+};
+
+/**
+ * @brief Array of RTP headers
+ *
+ * Each chunk of a stream doubles the size of the previous one, up to
+ * STREAM_HEADER_CHUNK_MAX headers.
+ */
+struct rtp_header_chunk {
+    //! Next chunk in the stream
+    rtp_header_chunk_t *next;
+    //! Number of used headers in this chunk
+    uint32_t count;
+    //! Number of allocated headers in this chunk
+    uint32_t size;
+    //! Stored headers
+    rtp_header_t headers[];
+};
+
+/**
+ * @brief Stream statistics calculated from its stored headers
+ */
+struct rtp_summary {
+    //! Number of stored headers
+    uint32_t packets;
+    //! Number of packets expected from sequence numbers
+    uint32_t expected;
+    //! Number of packets never received
+    uint32_t lost;
+    //! Time between first and last packets (ms)
+    uint32_t duration;
+    //! Max time between two consecutive packets (ms)
+    uint32_t max_gap;
+};
+
+/**
+ * @brief Stream quality state updated with each received packet
+ *
+ * Sequence and jitter tracking follow RFC 3550 Appendix A.
+ */
+struct rtp_stats {
+    //! First received sequence number
+    uint16_t base_seq;
+    //! Highest received sequence number
+    uint16_t max_seq;
+    //! Sequence number wraparounds (shifted 16 bits)
+    uint32_t cycles;
+    //! Packets received after a higher sequence number
+    uint32_t out_of_order;
+    //! Clock rate of stream format (Hz)
+    uint32_t clock;
+    //! Relative transit time of last packet (clock units)
+    uint32_t transit;
+    //! Interarrival jitter (clock units, scaled by 16)
+    uint32_t jitter;
+    //! Max time between two consecutive packets (ms)
+    uint32_t max_delta;
+    //! Capture time of last packet (ns)
+    uint64_t last_time;
+    //! Received payload bytes
+    uint64_t bytes;
+};
+
 struct rtp_stream {
     //! Determine stream type
     uint32_t type;
@@ -109,8 +200,8 @@ struct rtp_stream {
     sdp_media_t *media;
     //! Packet count for this stream
     uint32_t pktcnt;
-    //! Time of first received packet of stream
-    struct timeval time;
+    //! Time of first received packet of stream (ns)
+    uint64_t time;
     //! Unix timestamp of last received packet
     int lasttm;
 
@@ -119,6 +210,8 @@ struct rtp_stream {
         struct {
             //! Format of first received packet of stre
             uint32_t fmtcode;
+            //! Quality metrics of received packets
+            rtp_stats_t stats;
         } rtpinfo;
         struct {
             //! Sender packet count
@@ -133,6 +226,12 @@ struct rtp_stream {
             uint8_t mosc;
         } rtcpinfo;
     };
+    //! Headers of packets whose payload is not stored
+    rtp_header_chunk_t *headers;
+    //! Last chunk of stored headers
+    rtp_header_chunk_t *headers_last;
+    //! Next older stream with the same destination in streams index
+    rtp_stream_t *index_next;
 };
 
 struct rtcp_hdr_generic
@@ -285,9 +384,53 @@ stream_set_format(rtp_stream_t *stream, uint32_t format);
 void
 stream_add_packet(rtp_stream_t *stream, packet_t *packet);
 
+/**
+ * @brief Store RTP header and time of a packet in the stream
+ *
+ * This is used instead of storing the whole packet when only RTP
+ * headers are retained. Packet memory is not referenced.
+ *
+ * @param stream RTP stream of the packet
+ * @param packet RTP packet
+ * @return 0 if header has been stored, 1 otherwise
+ */
+int
+stream_add_header(rtp_stream_t *stream, packet_t *packet);
+
+/**
+ * @brief Calculate stream statistics from its stored headers
+ *
+ * @param stream RTP stream
+ * @param summary Calculated statistics
+ * @return 0 if stream has stored headers, 1 otherwise
+ */
+int
+stream_get_summary(rtp_stream_t *stream, rtp_summary_t *summary);
+
 uint32_t
 stream_get_count(rtp_stream_t *stream);
 
+/**
+ * @brief Get number of packets never received by a RTP stream
+ *
+ * Expected packets are calculated from the highest sequence number
+ * received.
+ */
+uint32_t
+stream_get_lost(rtp_stream_t *stream);
+
+/**
+ * @brief Get RTP stream interarrival jitter in milliseconds
+ */
+double
+stream_get_jitter(rtp_stream_t *stream);
+
+/**
+ * @brief Get RTP stream average payload bitrate in bits per second
+ */
+uint32_t
+stream_get_bitrate(rtp_stream_t *stream);
+
 struct sip_call *
 stream_get_call(rtp_stream_t *stream);
 
@@ -300,6 +443,45 @@ rtp_get_standard_format(uint32_t code);
 rtp_stream_t *
 rtp_check_packet(packet_t *packet);
 
+/**
+ * @brief Add a call stream to the streams index
+ *
+ * Index is keyed by stream destination address and port, so packets can
+ * be matched with their stream without walking all calls. Stream
+ * destination must not change while the stream is indexed.
+ *
+ * @param stream Stream already added to its call
+ */
+void
+stream_index_add(rtp_stream_t *stream);
+
+/**
+ * @brief Remove a stream from the streams index
+ *
+ * Must be called before the stream call is destroyed.
+ *
+ * @param stream Indexed stream
+ */
+void
+stream_index_remove(rtp_stream_t *stream);
+
+/**
+ * @brief Remove all streams from the streams index
+ *
+ * Used when all calls are removed at once, so their streams don't need
+ * to be removed one by one.
+ */
+void
+stream_index_clear();
+
+/**
+ * @brief Release streams index memory
+ *
+ * This function must be called once all calls have been destroyed.
+ */
+void
+rtp_deinit();
+
 rtp_stream_t *
 rtp_find_stream_format(address_t src, address_t dst, uint32_t format);
 
@@ -25,6 +25,9 @@
  *
  * @brief Source code of functions defined in setting.h
  *
+ * Settings are indexed by id and their numeric and on/off values are
+ * parsed when set, so getters used in hot paths do not compare strings.
+ *
  */
 #include "config.h"
 #include <string.h>
@@ -44,22 +47,75 @@ setting_t settings[SETTING_COUNT] = {
     { SETTING_ALTKEY_HINT,        "hintkeyalt",         SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EXITPROMPT,         "exitprompt",         SETTING_FMT_ENUM,    SETTING_ON,  SETTING_ENUM_ONOFF },
     { SETTING_CAPTURE_LIMIT,      "capture.limit",      SETTING_FMT_NUMBER,  "20000",     NULL },
+    { SETTING_CAPTURE_MEMORY,     "capture.memory",     SETTING_FMT_NUMBER,  "0",         NULL },
     { SETTING_CAPTURE_DEVICE,     "capture.device",     SETTING_FMT_STRING,  "any",       NULL },
     { SETTING_CAPTURE_OUTFILE,    "capture.outfile",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_OUTFILE_SIZE, "capture.outfile.size", SETTING_FMT_NUMBER, "0",       NULL },
+    { SETTING_CAPTURE_OUTFILE_TIME, "capture.outfile.time", SETTING_FMT_NUMBER, "0",       NULL },
+    { SETTING_CAPTURE_OUTFILE_KEEPSIZE, "capture.outfile.keepsize", SETTING_FMT_NUMBER, "0", NULL },
+    { SETTING_CAPTURE_OUTFILE_KEEPTIME, "capture.outfile.keeptime", SETTING_FMT_NUMBER, "0", NULL },
     { SETTING_CAPTURE_BUFFER,     "capture.buffer",     SETTING_FMT_NUMBER,  "2",         NULL },
+    { SETTING_CAPTURE_QUEUE,      "capture.queue",      SETTING_FMT_NUMBER,  "32768",     NULL },
+    { SETTING_CAPTURE_WORKERS,    "capture.workers",    SETTING_FMT_NUMBER,  "1",         NULL },
+    { SETTING_CAPTURE_IPREASM_TIMEOUT, "capture.ipreasm.timeout", SETTING_FMT_NUMBER, "30", NULL },
+    { SETTING_CAPTURE_IPREASM_MEMORY, "capture.ipreasm.memory", SETTING_FMT_NUMBER, "4096", NULL },
+    { SETTING_CAPTURE_TCPREASM_TIMEOUT, "capture.tcpreasm.timeout", SETTING_FMT_NUMBER, "30", NULL },
+    { SETTING_CAPTURE_TCPREASM_MEMORY, "capture.tcpreasm.memory", SETTING_FMT_NUMBER, "65536", NULL },
+    { SETTING_CAPTURE_OFFLINE_THREADS, "capture.offline.threads", SETTING_FMT_NUMBER, "1", NULL },
+    { SETTING_CAPTURE_OFFLINE_MMAP, "capture.offline.mmap", SETTING_FMT_ENUM, SETTING_ON, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_OFFLINE_INDEX, "capture.offline.index", SETTING_FMT_ENUM, SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_CPUS_CAPTURE, "capture.cpus.capture", SETTING_FMT_STRING, "",        NULL },
+    { SETTING_CAPTURE_CPUS_PARSER, "capture.cpus.parser", SETTING_FMT_STRING, "",          NULL },
+    { SETTING_CAPTURE_CPUS_WORKER, "capture.cpus.workers", SETTING_FMT_STRING, "",         NULL },
+    { SETTING_CAPTURE_CPUS_IO,    "capture.cpus.io",    SETTING_FMT_STRING,  "",          NULL },
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     { SETTING_CAPTURE_KEYFILE,    "capture.keyfile",    SETTING_FMT_STRING,  "",          NULL },
     { SETTING_CAPTURE_TLSSERVER,  "capture.tlsserver",  SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_TLS_TIMEOUT, "capture.tls.timeout", SETTING_FMT_NUMBER, "3600",      NULL },
+    { SETTING_CAPTURE_TLS_CONNECTIONS, "capture.tls.connections", SETTING_FMT_NUMBER, "65536", NULL },
+    { SETTING_CAPTURE_TLS_WORKERS, "capture.tls.workers", SETTING_FMT_NUMBER, "0",          NULL },
 #endif
 #ifdef USE_EEP
     { SETTING_CAPTURE_EEP,        "capture.eep",        SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+#endif
+#ifdef USE_TPACKET
+    { SETTING_CAPTURE_TPACKET,    "capture.tpacket",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_TPACKET_BLOCKSIZE, "capture.tpacket.blocksize", SETTING_FMT_NUMBER, "1024", NULL },
+    { SETTING_CAPTURE_TPACKET_BLOCKS, "capture.tpacket.blocks", SETTING_FMT_NUMBER, "32", NULL },
+    { SETTING_CAPTURE_TPACKET_THREADS, "capture.tpacket.threads", SETTING_FMT_NUMBER, "1", NULL },
 #endif
     { SETTING_CAPTURE_RTP,        "capture.rtp",        SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_RTP_FILTER, "capture.rtp.filter", SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_RTP_STORE,  "capture.rtp.store",  SETTING_FMT_ENUM,    "full",      SETTING_ENUM_RTP_STORE },
+    { SETTING_CAPTURE_RTP_STORE_MATCH, "capture.rtp.store.match", SETTING_FMT_STRING, "", NULL },
     { SETTING_CAPTURE_STORAGE,    "capture.storage",    SETTING_FMT_ENUM,    "memory",    SETTING_ENUM_STORAGE },
+    { SETTING_CAPTURE_STORAGE_DIR, "capture.storage.dir", SETTING_FMT_STRING, "/var/tmp",  NULL },
     { SETTING_CAPTURE_ROTATE,     "capture.rotate",     SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_STATS_INTERVAL, "capture.stats.interval", SETTING_FMT_NUMBER, "0", NULL },
+    { SETTING_CAPTURE_METRICS,    "capture.metrics",    SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_TRIGGER_DIR, "capture.trigger.dir", SETTING_FMT_STRING, "",          NULL },
+    { SETTING_CAPTURE_TRIGGER_CODES, "capture.trigger.codes", SETTING_FMT_STRING, "",      NULL },
+    { SETTING_CAPTURE_TRIGGER_MATCH, "capture.trigger.match", SETTING_FMT_STRING, "",      NULL },
+    { SETTING_CAPTURE_TIMING,     "capture.timing",     SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_CAPTURE_TIMING_SAMPLE, "capture.timing.sample", SETTING_FMT_NUMBER, "1",  NULL },
+    { SETTING_CAPTURE_OVERLOAD_SAMPLE, "capture.overload.sample", SETTING_FMT_NUMBER, "10", NULL },
+    { SETTING_CAPTURE_REORDER_WINDOW, "capture.reorder.window", SETTING_FMT_NUMBER, "50", NULL },
+    { SETTING_CAPTURE_BATCH, "capture.batch", SETTING_FMT_NUMBER, "256",              NULL },
+    { SETTING_CAPTURE_GZIP_THREADS, "capture.gzip.threads", SETTING_FMT_NUMBER, "0",   NULL },
+    { SETTING_CAPTURE_SHM_SIZE,   "capture.shm.size",   SETTING_FMT_NUMBER,  "64",        NULL },
+    { SETTING_CAPTURE_FILTER_METHODS, "capture.filter.methods", SETTING_FMT_STRING, "", NULL },
+    { SETTING_CAPTURE_FILTER_CODES, "capture.filter.codes", SETTING_FMT_STRING, "",    NULL },
+    { SETTING_CAPTURE_FILTER_ADDRESS, "capture.filter.address", SETTING_FMT_STRING, "", NULL },
+    { SETTING_CAPTURE_FILTER_FROM, "capture.filter.from", SETTING_FMT_STRING, "",      NULL },
+    { SETTING_CAPTURE_FILTER_TO,  "capture.filter.to",  SETTING_FMT_STRING,  "",          NULL },
+    { SETTING_CAPTURE_FILTER_SAMPLE, "capture.filter.sample", SETTING_FMT_STRING, "",   NULL },
     { SETTING_SIP_NOINCOMPLETE,   "sip.noincomplete",   SETTING_FMT_ENUM,    SETTING_ON,  SETTING_ENUM_ONOFF },
     { SETTING_SIP_HEADER_X_CID,   "sip.xcid",           SETTING_FMT_STRING,  "X-Call-ID|X-CID", NULL },
     { SETTING_SIP_CALLS,          "sip.calls",          SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_SIP_EXPIRE_COMPLETED, "sip.expire.completed", SETTING_FMT_NUMBER, "0",       NULL },
+    { SETTING_SIP_EXPIRE_NONINVITE, "sip.expire.noninvite", SETTING_FMT_NUMBER, "0",       NULL },
+    { SETTING_SIP_EXPIRE_SETUP,   "sip.expire.setup",   SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_SIP_COMPACT,        "sip.compact",        SETTING_FMT_STRING,  "",          NULL },
     { SETTING_SAVEPATH,           "savepath",           SETTING_FMT_STRING,  "",          NULL },
     { SETTING_DISPLAY_ALIAS,      "displayalias",       SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_ALIAS_PORT,         "aliasport",          SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
@@ -86,34 +142,92 @@ setting_t settings[SETTING_COUNT] = {
 #ifdef USE_EEP
     { SETTING_EEP_SEND,           "eep.send",           SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_SEND_VER,       "eep.send.version",   SETTING_FMT_ENUM,    "3",         SETTING_ENUM_HEPVERSION },
+    { SETTING_EEP_SEND_PROTO,     "eep.send.proto",     SETTING_FMT_ENUM,    "udp",       SETTING_ENUM_HEPPROTO },
     { SETTING_EEP_SEND_ADDR,      "eep.send.address",   SETTING_FMT_STRING,  "127.0.0.1",  NULL },
     { SETTING_EEP_SEND_PORT,      "eep.send.port",      SETTING_FMT_NUMBER,  "9060",      NULL },
     { SETTING_EEP_SEND_PASS,      "eep.send.pass",      SETTING_FMT_STRING,  "",          NULL },
     { SETTING_EEP_SEND_ID,        "eep.send.id",        SETTING_FMT_NUMBER,  "2002",      NULL },
+    { SETTING_EEP_SEND_QUEUE,     "eep.send.queue",     SETTING_FMT_NUMBER,  "4096",      NULL },
+    { SETTING_EEP_SEND_COMPRESS,  "eep.send.compress",  SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_EEP_SEND_PROBE,     "eep.send.probe",     SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_LISTEN,         "eep.listen",         SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
     { SETTING_EEP_LISTEN_VER,     "eep.listen.version", SETTING_FMT_ENUM,    "3",         SETTING_ENUM_HEPVERSION },
+    { SETTING_EEP_LISTEN_PROTO,   "eep.listen.proto",   SETTING_FMT_ENUM,    "udp",       SETTING_ENUM_HEPPROTO },
     { SETTING_EEP_LISTEN_ADDR,    "eep.listen.address", SETTING_FMT_STRING,  "0.0.0.0",   NULL },
     { SETTING_EEP_LISTEN_PORT,    "eep.listen.port",    SETTING_FMT_NUMBER,  "9060",      NULL },
     { SETTING_EEP_LISTEN_PASS,    "eep.listen.pass",    SETTING_FMT_STRING,  "",          NULL },
     { SETTING_EEP_LISTEN_UUID,    "eep.listen.uuid",    SETTING_FMT_ENUM,    SETTING_OFF, SETTING_ENUM_ONOFF },
+    { SETTING_EEP_LISTEN_THREADS, "eep.listen.threads", SETTING_FMT_NUMBER,  "1",         NULL },
+    { SETTING_EEP_LISTEN_RCVBUF,  "eep.listen.rcvbuf",  SETTING_FMT_NUMBER,  "0",         NULL },
+    { SETTING_EEP_LISTEN_COMPRESS, "eep.listen.compress", SETTING_FMT_ENUM,  SETTING_OFF, SETTING_ENUM_ONOFF },
 #endif
 };
 
-setting_t *
-setting_by_id(int id)
+//! Shorter declaration of setting_observer struct
+typedef struct setting_observer setting_observer_t;
+
+/**
+ * @brief Function registered to be notified of setting changes
+ */
+struct setting_observer {
+    //! Observed setting id
+    int id;
+    //! Function invoked on changes
+    setting_observer_func func;
+    //! User data passed to the function
+    void *data;
+};
+
+//! Settings indexed by their id
+static setting_t *settings_index[SETTING_COUNT];
+//! Default values of settings have been parsed
+static bool settings_parsed = false;
+//! Registered setting observers
+static setting_observer_t observers[MAX_SETTING_OBSERVERS];
+//! Number of registered setting observers
+static int observers_count = 0;
+
+/**
+ * @brief Store the typed values of a setting
+ */
+static void
+setting_parse(setting_t *sett)
+{
+    sett->intvalue = strlen(sett->value) ? atoi(sett->value) : -1;
+    sett->enabled = !strcmp(sett->value, SETTING_ON) || !strcmp(sett->value, SETTING_YES);
+    sett->disabled = !strcmp(sett->value, SETTING_OFF) || !strcmp(sett->value, SETTING_NO);
+}
+
+/**
+ * @brief Index settings by id and parse their default values
+ */
+static void
+settings_parse()
 {
     int i;
     for (i = 0; i < SETTING_COUNT; i++) {
-        if (id == settings[i].id)
-            return &settings[i];
+        settings_index[settings[i].id] = &settings[i];
+        setting_parse(&settings[i]);
     }
-    return NULL;
+    settings_parsed = true;
+}
+
+setting_t *
+setting_by_id(int id)
+{
+    if (id < 0 || id >= SETTING_COUNT)
+        return NULL;
+    if (!settings_parsed)
+        settings_parse();
+    return settings_index[id];
 }
 
 setting_t *
 setting_by_name(const char *name)
 {
     int i;
+    if (!settings_parsed)
+        settings_parse();
     for (i = 0; i < SETTING_COUNT; i++) {
         if (!strcmp(name, settings[i].name))
             return &settings[i];
@@ -160,14 +274,20 @@ int
 setting_get_intvalue(int id)
 {
     const setting_t *sett = setting_by_id(id);
-    return (sett && strlen(sett->value)) ? atoi(sett->value) : -1;
+    return (sett) ? sett->intvalue : -1;
 }
 
 void
 setting_set_value(int id, const char *value)
 {
     setting_t *sett = setting_by_id(id);
+    int i;
+
     if (sett) {
+        // Nothing to do if value has not changed
+        if (!strcmp(sett->value, value ? value : ""))
+            return;
+
         memset(sett->value, 0, sizeof(sett->value));
         if (value) {
             if (strlen(value) < MAX_SETTING_LEN) {
@@ -177,6 +297,13 @@ setting_set_value(int id, const char *value)
                 exit(1);
             }
         }
+        setting_parse(sett);
+
+        // Notify the change to observers of this setting
+        for (i = 0; i < observers_count; i++) {
+            if (observers[i].id == id)
+                observers[i].func(id, observers[i].data);
+        }
     }
 }
 
@@ -191,15 +318,15 @@ setting_set_intvalue(int id, int value)
 int
 setting_enabled(int id)
 {
-    return setting_has_value(id, "on") ||
-           setting_has_value(id, "yes");
+    const setting_t *sett = setting_by_id(id);
+    return (sett) ? sett->enabled : 0;
 }
 
 int
 setting_disabled(int id)
 {
-    return setting_has_value(id, "off") ||
-           setting_has_value(id, "no");
+    const setting_t *sett = setting_by_id(id);
+    return (sett) ? sett->disabled : 0;
 }
 
 int
@@ -261,6 +388,35 @@ setting_enum_next(int id, const char *value)
     return NULL;
 }
 
+int
+setting_observe(int id, setting_observer_func func, void *data)
+{
+    if (!setting_by_id(id) || observers_count == MAX_SETTING_OBSERVERS)
+        return 1;
+
+    observers[observers_count].id = id;
+    observers[observers_count].func = func;
+    observers[observers_count].data = data;
+    observers_count++;
+
+    // Notify current value
+    func(id, data);
+    return 0;
+}
+
+void
+setting_unobserve(int id, setting_observer_func func, void *data)
+{
+    int i;
+
+    for (i = 0; i < observers_count; i++) {
+        if (observers[i].id == id && observers[i].func == func && observers[i].data == data) {
+            observers[i] = observers[--observers_count];
+            return;
+        }
+    }
+}
+
 void
 settings_dump()
 {
@@ -42,15 +42,23 @@
 #ifndef __SNGREP_SETTING_H
 #define __SNGREP_SETTING_H
 
+#include <stdbool.h>
+
 //! Max setting value
 #define MAX_SETTING_LEN   1024
 
+//! Max number of registered setting observers
+#define MAX_SETTING_OBSERVERS 32
+
 //! Max extra length needed for "/.sngreprc.old"
 #define RCFILE_EXTRA_LEN   16
 
 //! Shorter declarartion of setting_option struct
 typedef struct setting_option setting_t;
 
+//! Function invoked when an observed setting changes its value
+typedef void (*setting_observer_func)(int id, void *data);
+
 //! Generic setting formats
 #define SETTING_ENUM_ONOFF       (const char *[]){ "on", "off", NULL }
 #define SETTING_ENUM_YESNO       (const char *[]){ "yes", "no", NULL }
@@ -58,9 +66,15 @@ typedef struct setting_option setting_t;
 #define SETTING_ENUM_COLORMODE   (const char *[]){ "request", "cseq", "callid", NULL }
 #define SETTING_ENUM_HIGHLIGHT   (const char *[]){ "bold", "reverse", "reversebold", NULL }
 #define SETTING_ENUM_SDP_INFO    (const char *[]){ "off", "first", "full", "compressed", NULL}
-#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", NULL }
+#ifdef WITH_ZLIB
+#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", "compressed", "disk", "index", NULL }
+#else
+#define SETTING_ENUM_STORAGE     (const char *[]){ "none", "memory", "disk", "index", NULL }
+#endif
 #define SETTING_ENUM_HEPVERSION  (const char *[]){ "2", "3", NULL }
+#define SETTING_ENUM_HEPPROTO    (const char *[]){ "udp", "tcp", NULL }
 #define SETTING_ENUM_MEDIA       (const char *[]){ "off", "on", "active", NULL }
+#define SETTING_ENUM_RTP_STORE   (const char *[]){ "full", "headers", NULL }
 
 //! Other useful defines
 #define SETTING_ON  "on"
@@ -80,22 +94,75 @@ enum setting_id {
     SETTING_ALTKEY_HINT,
     SETTING_EXITPROMPT,
     SETTING_CAPTURE_LIMIT,
+    SETTING_CAPTURE_MEMORY,
     SETTING_CAPTURE_DEVICE,
     SETTING_CAPTURE_OUTFILE,
+    SETTING_CAPTURE_OUTFILE_SIZE,
+    SETTING_CAPTURE_OUTFILE_TIME,
+    SETTING_CAPTURE_OUTFILE_KEEPSIZE,
+    SETTING_CAPTURE_OUTFILE_KEEPTIME,
     SETTING_CAPTURE_BUFFER,
+    SETTING_CAPTURE_QUEUE,
+    SETTING_CAPTURE_WORKERS,
+    SETTING_CAPTURE_IPREASM_TIMEOUT,
+    SETTING_CAPTURE_IPREASM_MEMORY,
+    SETTING_CAPTURE_TCPREASM_TIMEOUT,
+    SETTING_CAPTURE_TCPREASM_MEMORY,
+    SETTING_CAPTURE_OFFLINE_THREADS,
+    SETTING_CAPTURE_OFFLINE_MMAP,
+    SETTING_CAPTURE_OFFLINE_INDEX,
+    SETTING_CAPTURE_CPUS_CAPTURE,
+    SETTING_CAPTURE_CPUS_PARSER,
+    SETTING_CAPTURE_CPUS_WORKER,
+    SETTING_CAPTURE_CPUS_IO,
 #if defined(WITH_GNUTLS) || defined(WITH_OPENSSL)
     SETTING_CAPTURE_KEYFILE,
     SETTING_CAPTURE_TLSSERVER,
+    SETTING_CAPTURE_TLS_TIMEOUT,
+    SETTING_CAPTURE_TLS_CONNECTIONS,
+    SETTING_CAPTURE_TLS_WORKERS,
 #endif
 #ifdef USE_EEP
     SETTING_CAPTURE_EEP,
+#endif
+#ifdef USE_TPACKET
+    SETTING_CAPTURE_TPACKET,
+    SETTING_CAPTURE_TPACKET_BLOCKSIZE,
+    SETTING_CAPTURE_TPACKET_BLOCKS,
+    SETTING_CAPTURE_TPACKET_THREADS,
 #endif
     SETTING_CAPTURE_RTP,
+    SETTING_CAPTURE_RTP_FILTER,
+    SETTING_CAPTURE_RTP_STORE,
+    SETTING_CAPTURE_RTP_STORE_MATCH,
     SETTING_CAPTURE_STORAGE,
+    SETTING_CAPTURE_STORAGE_DIR,
     SETTING_CAPTURE_ROTATE,
+    SETTING_CAPTURE_STATS_INTERVAL,
+    SETTING_CAPTURE_METRICS,
+    SETTING_CAPTURE_TRIGGER_DIR,
+    SETTING_CAPTURE_TRIGGER_CODES,
+    SETTING_CAPTURE_TRIGGER_MATCH,
+    SETTING_CAPTURE_TIMING,
+    SETTING_CAPTURE_TIMING_SAMPLE,
+    SETTING_CAPTURE_OVERLOAD_SAMPLE,
+    SETTING_CAPTURE_REORDER_WINDOW,
+    SETTING_CAPTURE_BATCH,
+    SETTING_CAPTURE_GZIP_THREADS,
+    SETTING_CAPTURE_SHM_SIZE,
+    SETTING_CAPTURE_FILTER_METHODS,
+    SETTING_CAPTURE_FILTER_CODES,
+    SETTING_CAPTURE_FILTER_ADDRESS,
+    SETTING_CAPTURE_FILTER_FROM,
+    SETTING_CAPTURE_FILTER_TO,
+    SETTING_CAPTURE_FILTER_SAMPLE,
     SETTING_SIP_NOINCOMPLETE,
     SETTING_SIP_HEADER_X_CID,
     SETTING_SIP_CALLS,
+    SETTING_SIP_EXPIRE_COMPLETED,
+    SETTING_SIP_EXPIRE_NONINVITE,
+    SETTING_SIP_EXPIRE_SETUP,
+    SETTING_SIP_COMPACT,
     SETTING_SAVEPATH,
     SETTING_DISPLAY_ALIAS,
     SETTING_ALIAS_PORT,
@@ -122,16 +189,24 @@ enum setting_id {
 #ifdef USE_EEP
     SETTING_EEP_SEND,
     SETTING_EEP_SEND_VER,
+    SETTING_EEP_SEND_PROTO,
     SETTING_EEP_SEND_ADDR,
     SETTING_EEP_SEND_PORT,
     SETTING_EEP_SEND_PASS,
     SETTING_EEP_SEND_ID,
+    SETTING_EEP_SEND_QUEUE,
+    SETTING_EEP_SEND_COMPRESS,
+    SETTING_EEP_SEND_PROBE,
     SETTING_EEP_LISTEN,
     SETTING_EEP_LISTEN_VER,
+    SETTING_EEP_LISTEN_PROTO,
     SETTING_EEP_LISTEN_ADDR,
     SETTING_EEP_LISTEN_PORT,
     SETTING_EEP_LISTEN_PASS,
     SETTING_EEP_LISTEN_UUID,
+    SETTING_EEP_LISTEN_THREADS,
+    SETTING_EEP_LISTEN_RCVBUF,
+    SETTING_EEP_LISTEN_COMPRESS,
 #endif
     SETTING_COUNT
 };
@@ -157,6 +232,12 @@ struct setting_option {
     char value[MAX_SETTING_LEN];
     //! Compa separated valid values
     const char **valuelist;
+    //! Value parsed as number (-1 if empty)
+    int intvalue;
+    //! Value is on or yes
+    bool enabled;
+    //! Value is off or no
+    bool disabled;
 };
 
 setting_t *
@@ -216,6 +297,30 @@ setting_toggle(int id);
 const char *
 setting_enum_next(int id, const char *value);
 
+/**
+ * @brief Register a function to be invoked when a setting changes
+ *
+ * The function is also invoked once when registered, so modules can
+ * initialize local copies of the setting value from it.
+ *
+ * @param id Setting id from settings enum
+ * @param func Function invoked with the setting id and given data
+ * @param data User data passed to the function
+ * @return 0 if observer has been registered, 1 otherwise
+ */
+int
+setting_observe(int id, setting_observer_func func, void *data);
+
+/**
+ * @brief Remove a registered setting observer
+ *
+ * @param id Setting id from settings enum
+ * @param func Registered observer function
+ * @param data Registered user data
+ */
+void
+setting_unobserve(int id, setting_observer_func func, void *data);
+
 /**
  * @brief Dump configuration settings
  *
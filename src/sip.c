@@ -32,10 +32,27 @@
 #include <time.h>
 #include <pthread.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
 #include "sip.h"
 #include "option.h"
+#include "storage.h"
 #include "setting.h"
 #include "filter.h"
+#include "output.h"
+#include "metrics.h"
+#include "trigger.h"
+#include "sip_filter.h"
+#include "strpool.h"
+#include "report.h"
+#include "compact.h"
+#include "thread.h"
+#include "slab.h"
+#ifdef USE_EEP
+#include "capture_probe.h"
+#endif
 
 /**
  * @brief Linked list of parsed calls
@@ -46,6 +63,45 @@
 sip_call_list_t calls =
 { 0 };
 
+//! Shorter declaration of sip_calls_generation structure
+typedef struct sip_calls_generation sip_calls_generation_t;
+
+/**
+ * @brief Calls removed from storage pending to be released
+ */
+struct sip_calls_generation
+{
+    //! Removed calls, already unlinked from shared indexes
+    vector_t *list;
+    //! X-Call-Id waiting lists of removed calls (or NULL)
+    htable_t *xcalls_pending;
+    //! Next generation pending to be released
+    sip_calls_generation_t *next;
+};
+
+/**
+ * @brief Thread releasing removed calls memory
+ *
+ * Clearing the call list only swaps in an empty call store, so capture
+ * and interface are not blocked while millions of messages, packets and
+ * frames are released.
+ */
+static struct
+{
+    //! Reaper thread
+    pthread_t thread;
+    //! Reaper thread has been started
+    bool running;
+    //! Reaper thread must exit once pending generations are released
+    bool stop;
+    //! Generations pending to be released
+    sip_calls_generation_t *pending;
+    //! Lock for pending generations
+    pthread_mutex_t lock;
+    //! Wakes up reaper thread when generations are queued
+    pthread_cond_t cond;
+} reaper = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
 /* @brief list of methods and responses */
 sip_code_t sip_codes[] = {
     { SIP_METHOD_REGISTER,  "REGISTER" },
@@ -137,12 +193,190 @@ sip_code_t sip_codes[] = {
     { -1 , NULL },
 };
 
+/**
+ * @brief Get the expected number of Call-Ids of each shard
+ *
+ * Call-Ids hash tables grow when required, big capture limits are not
+ * allocated in advance.
+ */
+static size_t
+sip_calls_shard_size()
+{
+    size_t size = calls.limit / calls.shard_count + 1;
+    return (size > SIP_CALLIDS_PREALLOC) ? SIP_CALLIDS_PREALLOC : size;
+}
+
+/**
+ * @brief Mark call list as changed and wake up the interface
+ *
+ * Only the first change after the interface consumed the previous
+ * notification writes to the pipe, so busy captures don't flood it.
+ */
+static void
+sip_calls_set_changed()
+{
+    calls.changed = true;
+
+    if (calls.notify[1] < 0)
+        return;
+
+    if (!__atomic_exchange_n(&calls.notified, true, __ATOMIC_ACQ_REL)) {
+        if (write(calls.notify[1], "", 1) < 0) {
+            // Pipe is full, interface has wake ups pending anyway
+        }
+    }
+}
+
+/**
+ * @brief Account a stored message in call list counters
+ *
+ * @param sign 1 when the message is stored, -1 when removed
+ */
+static void
+sip_calls_count_msg(sip_msg_t *msg, int sign)
+{
+    int reqresp = (msg->reqresp < 100) ? msg->reqresp : 100 + msg->reqresp / 100;
+
+    __atomic_add_fetch(&calls.counters.msgs, sign, __ATOMIC_RELAXED);
+    if (reqresp >= 0 && reqresp < SIP_COUNTERS_REQRESP)
+        __atomic_add_fetch(&calls.counters.reqresp[reqresp], sign, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Account a call state in call list counters
+ */
+static void
+sip_calls_count_state(int state, int sign)
+{
+    __atomic_add_fetch(&calls.counters.states[state], sign, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Remove a call and its messages from call list counters
+ */
+static void
+sip_calls_count_remove(sip_call_t *call)
+{
+    vector_iter_t it = vector_iterator(call->msgs);
+    sip_msg_t *msg;
+
+    sip_calls_count_state(CALL_SLOT(call, state), -1);
+    while ((msg = vector_iterator_next(&it)))
+        sip_calls_count_msg(msg, -1);
+}
+
+/**
+ * @brief Add a call at the end of the arrival order list
+ */
+static void
+sip_calls_arrival_append(sip_call_t *call)
+{
+    call->arrival_prev = calls.last;
+    call->arrival_next = NULL;
+    if (calls.last) {
+        calls.last->arrival_next = call;
+    } else {
+        calls.first = call;
+    }
+    calls.last = call;
+}
+
+/**
+ * @brief Remove a call from the arrival order list or the locked calls
+ */
+static void
+sip_calls_arrival_remove(sip_call_t *call)
+{
+    if (call->arrival_prev) {
+        call->arrival_prev->arrival_next = call->arrival_next;
+    } else if (calls.first == call) {
+        calls.first = call->arrival_next;
+    } else {
+        // Call is not in the list, it must have been locked
+        vector_remove(calls.locked, call);
+        return;
+    }
+
+    if (call->arrival_next) {
+        call->arrival_next->arrival_prev = call->arrival_prev;
+    } else {
+        calls.last = call->arrival_prev;
+    }
+
+    call->arrival_prev = call->arrival_next = NULL;
+}
+
+/**
+ * @brief Add a call to the expiration wheel slot of the given time
+ */
+static void
+sip_calls_expire_add(sip_call_t *call, time_t when)
+{
+    sip_call_t **slot = &calls.expire_wheel[when % SIP_EXPIRE_SLOTS];
+
+    call->expire_time = when;
+    call->expire_prev = NULL;
+    call->expire_next = *slot;
+    if (*slot)
+        (*slot)->expire_prev = call;
+    *slot = call;
+}
+
+/**
+ * @brief Remove a call from the expiration wheel
+ */
+static void
+sip_calls_expire_remove(sip_call_t *call)
+{
+    if (!call->expire_time)
+        return;
+
+    if (call->expire_prev) {
+        call->expire_prev->expire_next = call->expire_next;
+    } else {
+        calls.expire_wheel[call->expire_time % SIP_EXPIRE_SLOTS] = call->expire_next;
+    }
+    if (call->expire_next)
+        call->expire_next->expire_prev = call->expire_prev;
+
+    call->expire_prev = call->expire_next = NULL;
+    call->expire_time = 0;
+}
+
+/**
+ * @brief Get the time when a call expires if no more messages are received
+ *
+ * @return expiration time or 0 if call does not expire in its current state
+ */
+static time_t
+sip_call_expire_deadline(sip_call_t *call)
+{
+    int timeout;
+
+    // Finished keepalive transactions are compacted as soon as possible
+    if (call->compact_done && !call->compact)
+        return call->last_time;
+
+    if (!call_is_invite(call)) {
+        timeout = calls.expire_noninvite;
+    } else if (CALL_SLOT(call, state) > SIP_CALLSTATE_INCALL) {
+        timeout = calls.expire_completed;
+    } else if (CALL_SLOT(call, state) != SIP_CALLSTATE_INCALL) {
+        timeout = calls.expire_setup;
+    } else {
+        // Conversations can last any time without SIP messages
+        timeout = 0;
+    }
+
+    return (timeout > 0) ? call->last_time + timeout : 0;
+}
+
 void
 sip_init(int limit, int only_calls, int no_incomplete)
 {
-    int match_flags, reg_rule_len, reg_rule_err;
-    char reg_rule[SIP_ATTR_MAXLEN];
     const char *setting = NULL;
+    pthread_mutexattr_t attr;
+    int i;
 
     // Store capture limit
     calls.limit = limit;
@@ -150,15 +384,51 @@ sip_init(int limit, int only_calls, int no_incomplete)
     calls.ignore_incomplete = no_incomplete;
     calls.last_index = 0;
     calls.call_count_unrotated = 0;
+    calls.expire_completed = setting_get_intvalue(SETTING_SIP_EXPIRE_COMPLETED);
+    calls.expire_noninvite = setting_get_intvalue(SETTING_SIP_EXPIRE_NONINVITE);
+    calls.expire_setup = setting_get_intvalue(SETTING_SIP_EXPIRE_SETUP);
 
     // Create a vector to store calls
     calls.list = vector_create(200, 50);
     vector_set_destroyer(calls.list, call_destroyer);
     vector_set_sorter(calls.list, sip_list_sorter);
     calls.active = vector_create(10, 10);
-
-    // Create hash table for callid search
-    calls.callids = htable_create(calls.limit);
+    calls.locked = vector_create(0, 4);
+    calls.filtered = vector_create(200, 50);
+    vector_set_sorter(calls.filtered, sip_list_sorter);
+    calls.unfiltered = vector_create(0, 50);
+    calls.filter_pending = vector_create(0, 50);
+    calls.first = calls.last = NULL;
+
+    // Create call store shards, each one with its own callid hash table
+    calls.shard_count = setting_get_intvalue(SETTING_CAPTURE_WORKERS);
+    if (calls.shard_count < 1)
+        calls.shard_count = 1;
+    if (calls.shard_count > MAX_SIP_SHARDS)
+        calls.shard_count = MAX_SIP_SHARDS;
+
+    // Shard locks can be taken again while rotating calls from the same shard
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    for (i = 0; i < calls.shard_count; i++) {
+        calls.shards[i].callids = htable_create(sip_calls_shard_size());
+        pthread_mutex_init(&calls.shards[i].lock, &attr);
+        pthread_mutex_init(&calls.shards[i].callids_lock, NULL);
+    }
+    pthread_mutexattr_destroy(&attr);
+    pthread_mutex_init(&calls.lock, NULL);
+    calls.xcalls_pending = htable_create(64);
+
+    // Create call changes notification pipe. Writes must never block workers
+    if (pipe(calls.notify) == 0) {
+        for (i = 0; i < 2; i++) {
+            fcntl(calls.notify[i], F_SETFL, fcntl(calls.notify[i], F_GETFL) | O_NONBLOCK);
+            fcntl(calls.notify[i], F_SETFD, FD_CLOEXEC);
+        }
+    } else {
+        calls.notify[0] = calls.notify[1] = -1;
+    }
+    calls.notified = false;
 
     // Set default sorting field
     if (sip_attr_from_name(setting_get_value(SETTING_CL_SORTFIELD)) >= 0) {
@@ -170,101 +440,131 @@ sip_init(int limit, int only_calls, int no_incomplete)
         calls.sort.asc = true;
     }
 
-    // Initialize payload parsing regexp
-    match_flags = REG_EXTENDED | REG_ICASE | REG_NEWLINE;
-    regcomp(&calls.reg_method, "^([a-zA-Z]+) [a-zA-Z]+:.* SIP/2.0[ ]*\r", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_callid, "^(Call-ID|i):[ ]*([^ ]+)[ ]*\r$", match_flags);
+    // Initialize keepalive dialogs compaction
+    if (compact_init(setting_get_value(SETTING_SIP_COMPACT)) != 0) {
+        fprintf(stderr, "%s setting is not valid, dialogs will not be compacted\n",
+            setting_name(SETTING_SIP_COMPACT));
+        compact_deinit();
+    }
+
+    // Initialize payload header names
     setting = setting_get_value(SETTING_SIP_HEADER_X_CID);
-    reg_rule_len = strlen(setting) + 22;
-    if (reg_rule_len >= SIP_ATTR_MAXLEN) {
-        setting = "X-Call-ID|X-CID";
-        reg_rule_len = strlen(setting) + 22;
-        fprintf(stderr, "%s setting too long, using default.\n",
+    if (sip_scan_set_xcallid(setting) != 0) {
+        fprintf(stderr, "%s setting is not valid, using default value instead\n",
             setting_name(SETTING_SIP_HEADER_X_CID));
+        sip_scan_set_xcallid("X-Call-ID|X-CID");
     }
-    snprintf(reg_rule, reg_rule_len, "^(%s):[ ]*([^ ]+)[ ]*\r$", setting);
-    reg_rule_err = regcomp(&calls.reg_xcallid, reg_rule, match_flags);
-    if(reg_rule_err != 0) {
-        regerror(reg_rule_err, &calls.reg_xcallid, reg_rule, SIP_ATTR_MAXLEN);
-        regfree(&calls.reg_xcallid);
-        fprintf(stderr, "%s setting produces regex compilation error: %s"
-            "using default value instead\n",
-            setting_name(SETTING_SIP_HEADER_X_CID), reg_rule);
-        regcomp(&calls.reg_xcallid,
-            "^(X-Call-ID|X-CID):[ ]*([^ ]+)[ ]*\r$", match_flags);
-    }
-    regcomp(&calls.reg_response, "^SIP/2.0[ ]*(([0-9]{3}) [^\r]*)[ ]*\r", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_cseq, "^CSeq:[ ]*([0-9]{1,10}) .+\r$", match_flags);
-    regcomp(&calls.reg_from, "^(From|f):[ ]*[^:]*:(([^@>]+)@?[^\r>;]+)", match_flags);
-    regcomp(&calls.reg_to, "^(To|t):[ ]*[^:]*:(([^@>]+)@?[^\r>;]+)", match_flags);
-    regcomp(&calls.reg_valid, "^([A-Z]+ [a-zA-Z]+:|SIP/2.0 [0-9]{3})", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_cl, "^(Content-Length|l):[ ]*([0-9]+)[ ]*\r$", match_flags);
-    regcomp(&calls.reg_body, "\r\n\r\n(.*)", match_flags & ~REG_NEWLINE);
-    regcomp(&calls.reg_reason, "Reason:[ ]*[^\r]*;text=\"([^\r]+)\"", match_flags);
-    regcomp(&calls.reg_warning, "Warning:[ ]*([0-9]*)", match_flags);
+}
+
+/**
+ * @brief Hash a Call-ID value
+ *
+ * Value ends with the first blank or line end character
+ */
+static unsigned int
+sip_callid_hash(const char *callid)
+{
+    unsigned int hash = 5381;
 
+    while (*callid && *callid != ' ' && *callid != '\r' && *callid != '\n')
+        hash = ((hash << 5) + hash) + (unsigned char) *callid++;
+
+    return hash;
 }
 
-void
-sip_deinit()
+/**
+ * @brief Add a call to its shard Call-Ids hash table
+ */
+static void
+sip_calls_shard_insert(sip_call_t *call)
 {
-    // Remove all calls
-    sip_calls_clear();
-    // Remove Call-id hash table
-    htable_destroy(calls.callids);
-    // Remove calls vector
-    vector_destroy(calls.list);
-    vector_destroy(calls.active);
-    // Deallocate regular expressions
-    regfree(&calls.reg_method);
-    regfree(&calls.reg_callid);
-    regfree(&calls.reg_xcallid);
-    regfree(&calls.reg_response);
-    regfree(&calls.reg_cseq);
-    regfree(&calls.reg_from);
-    regfree(&calls.reg_to);
-    regfree(&calls.reg_valid);
-    regfree(&calls.reg_cl);
-    regfree(&calls.reg_body);
-    regfree(&calls.reg_reason);
-    regfree(&calls.reg_warning);
+    sip_call_shard_t *shard = &calls.shards[sip_callid_shard(call->callid)];
+
+    pthread_mutex_lock(&shard->callids_lock);
+    htable_insert(shard->callids, call->callid, call);
+    pthread_mutex_unlock(&shard->callids_lock);
+}
+
+/**
+ * @brief Remove a call from its shard Call-Ids hash table
+ */
+static void
+sip_calls_shard_remove(sip_call_t *call)
+{
+    sip_call_shard_t *shard = &calls.shards[sip_callid_shard(call->callid)];
+
+    pthread_mutex_lock(&shard->callids_lock);
+    // Compaction rows Call-ID may be used by a newer dialog
+    if (htable_find(shard->callids, call->callid) == call)
+        htable_remove(shard->callids, call->callid);
+    pthread_mutex_unlock(&shard->callids_lock);
 }
 
+/**
+ * @brief Create again all shards Call-Ids hash tables
+ */
+static void
+sip_calls_shard_reset()
+{
+    int i;
+
+    for (i = 0; i < calls.shard_count; i++) {
+        pthread_mutex_lock(&calls.shards[i].callids_lock);
+        htable_destroy(calls.shards[i].callids);
+        calls.shards[i].callids = htable_create(sip_calls_shard_size());
+        pthread_mutex_unlock(&calls.shards[i].callids_lock);
+    }
+}
 
 char *
-sip_get_callid(const char* payload, char *callid)
+sip_get_callid(const char* payload, const sip_scan_t *scan, char *callid)
 {
-    regmatch_t pmatch[3];
+    const char *value;
+    int len;
 
     // Try to get Call-ID from payload
-    if (regexec(&calls.reg_callid, payload, 3, pmatch, 0) == 0) {
+    if ((value = sip_scan_token(payload, scan, SIP_SCAN_CALLID, &len))) {
         // Copy the matching part of payload
-        strncpy(callid, payload + pmatch[2].rm_so, (int) pmatch[2].rm_eo - pmatch[2].rm_so);
+        sprintf(callid, "%.*s", (len < SIP_CALLID_MAXLEN) ? len : SIP_CALLID_MAXLEN - 1, value);
     }
 
     return callid;
 }
 
 char *
-sip_get_xcallid(const char *payload, char *xcallid)
+sip_get_xcallid(const char *payload, const sip_scan_t *scan, char *xcallid)
 {
-    regmatch_t pmatch[3];
+    const char *value;
+    int len;
 
     // Try to get X-Call-ID from payload
-    if (regexec(&calls.reg_xcallid, (const char *)payload, 3, pmatch, 0) == 0) {
-        strncpy(xcallid, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
+    if ((value = sip_scan_token(payload, scan, SIP_SCAN_XCALLID, &len))) {
+        sprintf(xcallid, "%.*s", (len < SIP_CALLID_MAXLEN) ? len : SIP_CALLID_MAXLEN - 1, value);
     }
 
     return xcallid;
 }
 
+/**
+ * @brief Keep the headers located in a validated payload
+ *
+ * Parser uses them instead of scanning the same payload again.
+ */
+static void
+sip_packet_keep_scan(packet_t *packet, const sip_scan_t *scan)
+{
+    if (!packet->scan && !(packet->scan = slab_alloc(sizeof(sip_scan_t))))
+        return;
+    *packet->scan = *scan;
+}
+
 int
 sip_validate_packet(packet_t *packet)
 {
     uint32_t plen = packet_payloadlen(packet);
-    u_char payload[MAX_SIP_PAYLOAD];
-    regmatch_t pmatch[4];
-    char cl_header[10];
+    // Packet payload is always NUL terminated
+    u_char *payload = packet_payload(packet);
+    sip_scan_t scan;
     int content_len;
     int bodylen;
 
@@ -272,36 +572,29 @@ sip_validate_packet(packet_t *packet)
     if (plen == 0 || plen > MAX_SIP_PAYLOAD)
         return VALIDATE_NOT_SIP;
 
-    // Get payload from packet(s)
-    memset(payload, 0, MAX_SIP_PAYLOAD);
-    memcpy(payload, packet_payload(packet), plen);
-
-    // Initialize variables
-    memset(cl_header, 0, sizeof(cl_header));
-
     // Check if the first line follows SIP request or response format
-    if (regexec(&calls.reg_valid, (const char *) payload, 2, pmatch, 0) != 0) {
+    if (!sip_scan_is_sip((const char *) payload)) {
         // Not a SIP message AT ALL
         return VALIDATE_NOT_SIP;
     }
 
+    // Locate headers and body
+    sip_scan_payload((const char *) payload, &scan);
+
     // Check if we have Content Length header
-    if (regexec(&calls.reg_cl, (const char *) payload, 4, pmatch, 0) != 0) {
+    if ((content_len = sip_scan_content_length((const char *) payload, &scan)) < 0) {
         // Not a SIP message or not complete
         return VALIDATE_PARTIAL_SIP;
     }
 
-    strncpy(cl_header, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
-    content_len = atoi(cl_header);
-
     // Check if we have Body separator field
-    if (regexec(&calls.reg_body, (const char *) payload, 2, pmatch, 0) != 0) {
+    if (!scan.body) {
         // Not a SIP message or not complete
         return VALIDATE_PARTIAL_SIP;
     }
 
     // Get the SIP message body length
-    bodylen = (int) pmatch[1].rm_eo - pmatch[1].rm_so;
+    bodylen = strlen((const char *) payload + scan.body);
 
     // The SDP body of the SIP message ends in another packet
     if (content_len > bodylen) {
@@ -310,147 +603,312 @@ sip_validate_packet(packet_t *packet)
 
     if (content_len < bodylen) {
         // Check body ends with '\r\n'
-        if (payload[pmatch[1].rm_so + content_len - 1] != '\n')
+        if (payload[scan.body + content_len - 1] != '\n')
             return VALIDATE_NOT_SIP;
-        if (payload[pmatch[1].rm_so + content_len - 2] != '\r')
+        if (payload[scan.body + content_len - 2] != '\r')
             return VALIDATE_NOT_SIP;
         // We got more than one SIP message in the same packet
-        packet_set_payload(packet, payload, pmatch[1].rm_so + content_len);
+        packet_set_payload(packet, payload, scan.body + content_len);
+        // Headers of the first message are located before its body
+        sip_packet_keep_scan(packet, &scan);
         return VALIDATE_MULTIPLE_SIP;
     }
 
     // We got all the SDP body of the SIP message
+    sip_packet_keep_scan(packet, &scan);
     return VALIDATE_COMPLETE_SIP;
 }
 
+/**
+ * @brief Wait for the X-Call-Id parent of a call
+ *
+ * X-Call-Id strings are shared, so the key of the waiting calls entry is
+ * valid while any of them is stored.
+ */
+static void
+sip_calls_xcall_wait(sip_call_t *call)
+{
+    vector_t *waiting;
+
+    if (!(waiting = htable_find(calls.xcalls_pending, call->xcallid))) {
+        if (!(waiting = vector_create(1, 4)))
+            return;
+        htable_insert(calls.xcalls_pending, call->xcallid, waiting);
+    }
+    vector_append(waiting, call);
+}
+
+/**
+ * @brief Relate a new call with its X-Call-Id parent and children
+ *
+ * Children captured before their parent are linked when the parent
+ * arrives, so related calls do not depend on capture order.
+ * This must be invoked with calls lock taken.
+ */
+static void
+sip_calls_xcall_link(sip_call_t *call)
+{
+    sip_call_t *xcall;
+    vector_t *waiting;
+    vector_iter_t it;
+
+    if (strlen(call->xcallid)) {
+        if ((xcall = sip_find_by_callid(call->xcallid)) && xcall != call) {
+            call_add_xcall(xcall, call);
+        } else if (!xcall) {
+            sip_calls_xcall_wait(call);
+        }
+    }
+
+    // Calls that arrived before this one
+    if ((waiting = htable_find(calls.xcalls_pending, call->callid))) {
+        htable_remove(calls.xcalls_pending, call->callid);
+        it = vector_iterator(waiting);
+        while ((xcall = vector_iterator_next(&it)))
+            call_add_xcall(call, xcall);
+        vector_destroy(waiting);
+    }
+}
+
+void
+sip_calls_xcall_remove(sip_call_t *call)
+{
+    sip_call_t *xcall;
+    vector_t *waiting;
+    vector_iter_t it;
+
+    if (call->xparent) {
+        vector_remove(call->xparent->xcalls, call);
+    } else if (strlen(call->xcallid)
+               && (waiting = htable_find(calls.xcalls_pending, call->xcallid))) {
+        vector_remove(waiting, call);
+        if (!vector_count(waiting)) {
+            htable_remove(calls.xcalls_pending, call->xcallid);
+            vector_destroy(waiting);
+        }
+    }
+
+    // Children wait again for a call with this Call-Id
+    it = vector_iterator(call->xcalls);
+    while ((xcall = vector_iterator_next(&it))) {
+        xcall->xparent = NULL;
+        sip_calls_xcall_wait(xcall);
+    }
+    vector_clear(call->xcalls);
+}
+
 sip_msg_t *
 sip_check_packet(packet_t *packet)
 {
-    sip_msg_t *msg;
+    sip_msg_t *msg, parsed;
     sip_call_t *call;
-    char callid[1024], xcallid[1024];
-    u_char payload[MAX_SIP_PAYLOAD];
+    char callid[SIP_CALLID_MAXLEN], xcallid[SIP_CALLID_MAXLEN];
+    // Packet payload is always NUL terminated
+    u_char *payload = packet_payload(packet);
+    sip_scan_t scan;
     bool newcall = false;
+    int state = 0;
 
     // Max SIP payload allowed
-    if (packet->payload_len > MAX_SIP_PAYLOAD)
+    if (!payload || packet->payload_len > MAX_SIP_PAYLOAD)
         return NULL;
 
     // Initialize local variables
     memset(callid, 0, sizeof(callid));
     memset(xcallid, 0, sizeof(xcallid));
-
-    // Get payload from packet(s)
-    memset(payload, 0, MAX_SIP_PAYLOAD);
-    memcpy(payload, packet_payload(packet), packet_payloadlen(packet));
+    memset(&parsed, 0, sizeof(parsed));
+
+    // Locate message headers once for all the following checks, TCP
+    // payloads have already been scanned while being validated
+    if (packet->scan) {
+        scan = *packet->scan;
+        slab_free(packet->scan);
+        packet->scan = NULL;
+    } else {
+        sip_scan_payload((const char *) payload, &scan);
+    }
 
     // Get the Call-ID of this message
-    if (!sip_get_callid((const char*) payload, callid))
-        return NULL;
-
-    // Create a new message from this data
-    if (!(msg = msg_create((const char*) payload)))
+    if (!sip_get_callid((const char*) payload, &scan, callid))
         return NULL;
 
     // Get Method and request for the following checks
     // There is no need to parse all payload at this point
     // If no response or request code is found, this is not a SIP message
-    if (!sip_get_msg_reqresp(msg, payload)) {
-        // Deallocate message memory
-        msg_destroy(msg);
+    // Message is only allocated in call memory once the call is known
+    if (!sip_get_msg_reqresp(&parsed, payload, &scan))
         return NULL;
-    }
 
     // Find the call for this msg
+    // Calls of this shard can only be created by the thread holding its lock
     if (!(call = sip_find_by_callid(callid))) {
 
+        // Discard dialogs not matching capture filters before storing them
+        if (!sip_filter_check(&parsed, packet, callid, (const char *) payload, &scan))
+            goto skip_message;
+
         // Check if payload matches expression
         if (!sip_check_match_expression((const char*) payload))
             goto skip_message;
 
         // User requested only INVITE starting dialogs
-        if (calls.only_calls && msg->reqresp != SIP_METHOD_INVITE)
+        if (calls.only_calls && parsed.reqresp != SIP_METHOD_INVITE)
             goto skip_message;
 
         // Only create a new call if the first msg
         // is a request message in the following gorup
-        if (calls.ignore_incomplete && msg->reqresp > SIP_METHOD_MESSAGE)
+        if (calls.ignore_incomplete && parsed.reqresp > SIP_METHOD_MESSAGE)
             goto skip_message;
 
         // Get the Call-ID of this message
-        sip_get_xcallid((const char*) payload, xcallid);
-
-        // Rotate call list if limit has been reached
-        if (calls.limit == sip_calls_count())
-            sip_calls_rotate();
+        sip_get_xcallid((const char*) payload, &scan, xcallid);
 
         // Create the call if not found
         if (!(call = call_create(callid, xcallid)))
             goto skip_message;
 
         // Add this Call-Id to hash table
-        htable_insert(calls.callids, call->callid, call);
+        sip_calls_shard_insert(call);
+
+        pthread_mutex_lock(&calls.lock);
+        // Rotate call list until there is room for this call. Busy calls
+        // are skipped, so the list can temporarily exceed the limit
+        while (calls.limit > 0 && sip_calls_count() >= calls.limit) {
+            if (sip_calls_rotate() != 0)
+                break;
+        }
+        // Rotate oldest calls until stored calls fit in memory limit
+        while (calls.memory_limit && sip_calls_memory(NULL) > calls.memory_limit) {
+            if (sip_calls_rotate() != 0)
+                break;
+        }
 
         // Set call index
-        call->index = ++calls.last_index;
+        CALL_SLOT(call, index) = ++calls.last_index;
+        pthread_mutex_unlock(&calls.lock);
 
         // Mark this as a new call
         newcall = true;
     }
 
     // At this point we know we're handling an interesting SIP Packet
+    if (!(msg = msg_create(&call->arena)))
+        goto skip_message;
+    *msg = parsed;
     msg->packet = packet;
 
+    // Store message headers positions
+    sip_parse_msg_payload(msg, payload, &scan);
+    // Used to find retransmissions of this message
+    msg->hash = hash_mem64(payload, packet_payloadlen(packet));
+
     // Always parse first call message
     if (call_msg_count(call) == 0) {
-        // Parse SIP payload
-        sip_parse_msg_payload(msg, payload);
-        // If this call has X-Call-Id, append it to the parent call
-        if (strlen(call->xcallid)) {
-            call_add_xcall(sip_find_by_callid(call->xcallid), call);
-        }
+        // Relate this call with its X-Call-Id parent and children
+        // Related calls can be stored in other shards
+        pthread_mutex_lock(&calls.lock);
+        sip_calls_xcall_link(call);
+        pthread_mutex_unlock(&calls.lock);
     }
 
+    // Expiration timeouts start from the last message
+    if (sip_calls_expire_enabled())
+        call->last_time = time(NULL);
+
     // Add the message to the call
     call_add_message(call, msg);
-
-    // check if message is a retransmission
-    call_msg_retrans_check(msg);
+    sip_calls_count_msg(msg, 1);
+    // Payload may have been moved to call memory
+    payload = packet_payload(packet);
 
     if (call_is_invite(call)) {
         // Parse media data
-        sip_parse_msg_media(msg, payload);
+        sip_parse_msg_media(msg, payload, &scan);
         // Update Call State
+        state = CALL_SLOT(call, state);
         call_update_state(call, msg);
+        // New calls are counted when they are listed
+        if (!newcall && CALL_SLOT(call, state) != state) {
+            sip_calls_count_state(state, -1);
+            sip_calls_count_state(CALL_SLOT(call, state), 1);
+        }
         // Parse extra fields
-        sip_parse_extra_headers(msg, payload);
+        sip_parse_extra_headers(msg, payload, &scan);
+        pthread_mutex_lock(&calls.lock);
         // Check if this call should be in active call list
         if (call_is_active(call)) {
-            if (sip_call_is_active(call)) {
+            if (!sip_call_is_active(call)) {
                 vector_append(calls.active, call);
+                call->listed_active = true;
             }
         } else {
             if (sip_call_is_active(call)) {
                 vector_remove(calls.active, call);
+                call->listed_active = false;
             }
         }
+        pthread_mutex_unlock(&calls.lock);
     }
 
+    // Cached call attributes must be calculated again
+    call_updated(call);
+
     if (newcall) {
+        pthread_mutex_lock(&calls.lock);
         // Append this call to the call list
         vector_append(calls.list, call);
+        sip_calls_count_state(CALL_SLOT(call, state), 1);
+        sip_calls_arrival_append(call);
+        // Expiration is checked again after a wheel turn at most
+        if (sip_calls_expire_enabled())
+            sip_calls_expire_add(call, call->last_time + SIP_EXPIRE_SLOTS);
+        // Display filters will be checked by interface
+        vector_append(calls.unfiltered, call);
         ++calls.call_count_unrotated;
+        pthread_mutex_unlock(&calls.lock);
+    } else if (filter_check_call_msgs(call)) {
+        pthread_mutex_lock(&calls.lock);
+        // New messages may match display filters
+        vector_append(calls.unfiltered, call);
+        pthread_mutex_unlock(&calls.lock);
+    }
+
+    // Finished keepalive transactions are compacted on next expiration check
+    if (compact_call_finished(call, msg)) {
+        pthread_mutex_lock(&calls.lock);
+        sip_calls_expire_remove(call);
+        sip_calls_expire_add(call, call->last_time + 1);
+        pthread_mutex_unlock(&calls.lock);
+    }
+
+    // Account message in exposed metrics
+    metrics_sip_msg(msg->reqresp);
+
+    // Stream message and finished calls to output files
+    output_msg(msg);
+#ifdef USE_EEP
+    // Probes send a summary instead of the captured frames
+    capture_probe_msg(msg, payload, &scan);
+#endif
+    if (CALL_SLOT(call, state) != state && CALL_SLOT(call, state) > SIP_CALLSTATE_INCALL) {
+        output_call(call);
+#ifdef USE_EEP
+        capture_probe_call(call);
+#endif
     }
 
+    // Save this dialog apart if it matches configured triggers
+    trigger_check_msg(msg, (const char *) payload);
+
     // Mark the list as changed
-    calls.changed = true;
+    sip_calls_set_changed();
 
     // Return the loaded message
     return msg;
 
 skip_message:
-    // Deallocate message memory
-    msg_destroy(msg);
+    // Deallocate message parsed data
+    strpool_put(parsed.resp_str);
     return NULL;
 
 }
@@ -458,9 +916,27 @@ skip_message:
 bool
 sip_calls_has_changed()
 {
-    bool changed = calls.changed;
-    calls.changed = false;
-    return changed;
+    return __atomic_exchange_n(&calls.changed, false, __ATOMIC_ACQ_REL);
+}
+
+int
+sip_calls_notify_fd()
+{
+    return calls.notify[0];
+}
+
+void
+sip_calls_notify_clear()
+{
+    char buf[64];
+
+    if (calls.notify[0] < 0)
+        return;
+
+    // Drain the pipe before allowing new notifications
+    while (read(calls.notify[0], buf, sizeof(buf)) > 0)
+        ;
+    __atomic_store_n(&calls.notified, false, __ATOMIC_RELEASE);
 }
 
 int
@@ -475,6 +951,12 @@ sip_calls_count_unrotated()
     return calls.call_count_unrotated;
 }
 
+uint64_t
+sip_calls_rotated()
+{
+    return calls.rotated;
+}
+
 vector_iter_t
 sip_calls_iterator()
 {
@@ -490,7 +972,7 @@ sip_active_calls_iterator()
 bool
 sip_call_is_active(sip_call_t *call)
 {
-    return vector_index(calls.active, call) != -1;
+    return call->listed_active;
 }
 
 vector_t *
@@ -505,20 +987,122 @@ sip_active_calls_vector()
     return calls.active;
 }
 
+vector_t *
+sip_calls_filtered_vector()
+{
+    return calls.filtered;
+}
+
+/**
+ * @brief Check displayed calls whose payload filter was paused
+ *
+ * Up to SIP_FILTER_CHUNK calls are checked on each invocation. Calls
+ * that do not match display filters are removed from the filtered list.
+ */
+static void
+sip_calls_filter_pending()
+{
+    sip_call_t *call;
+    int i, count = vector_count(calls.filter_pending);
+
+    for (i = 0; i < count && i < SIP_FILTER_CHUNK; i++) {
+        call = vector_item(calls.filter_pending, i);
+        if (!filter_check_call(call)) {
+            vector_remove(calls.filtered, call);
+            call->listed_filtered = false;
+            call->listed_pending = false;
+        } else if (CALL_SLOT(call, filtered) == -1) {
+            // Capture is overloaded again, check it later
+            vector_append(calls.filter_pending, call);
+        } else {
+            call->listed_pending = false;
+        }
+    }
+
+    // Remove all checked calls at once
+    vector_remove_range(calls.filter_pending, 0, i);
+    sip_calls_set_changed();
+}
+
+int
+sip_calls_filter_update()
+{
+    sip_call_t *call;
+    int i, count = vector_count(calls.unfiltered);
+
+    if (vector_count(calls.filter_pending)
+        && capture_overload_level() != CAPTURE_OVERLOAD_FILTER)
+        sip_calls_filter_pending();
+
+    for (i = 0; i < count && i < SIP_FILTER_CHUNK; i++) {
+        call = vector_item(calls.unfiltered, i);
+        if (filter_check_call(call)) {
+            // Most calls are appended in order, no need to move others
+            vector_append(calls.filtered, call);
+            call->listed_filtered = true;
+            // Payload filter could not be evaluated, check it later
+            if (CALL_SLOT(call, filtered) == -1) {
+                vector_append(calls.filter_pending, call);
+                call->listed_pending = true;
+            }
+        }
+    }
+
+    // Remove all checked calls at once
+    vector_remove_range(calls.unfiltered, 0, i);
+
+    // Check remaining calls in next update
+    if (i == SIP_FILTER_CHUNK && i < count)
+        sip_calls_set_changed();
+
+    return vector_count(calls.unfiltered);
+}
+
+void
+sip_calls_filter_reset()
+{
+    sip_call_t *call;
+    vector_iter_t it = vector_iterator(calls.filtered);
+
+    // Only displayed calls are flagged as listed
+    while ((call = vector_iterator_next(&it))) {
+        call->listed_filtered = false;
+        call->listed_pending = false;
+    }
+
+    // All calls are pending evaluation, following call list order
+    vector_clear(calls.filtered);
+    vector_clear(calls.unfiltered);
+    vector_clear(calls.filter_pending);
+    vector_append_vector(calls.unfiltered, calls.list);
+    sip_calls_set_changed();
+}
+
 sip_stats_t
 sip_calls_stats()
 {
     sip_stats_t stats;
-    vector_iter_t it = vector_iterator(calls.list);
 
     // Total number of calls without filtering
-    stats.total = vector_iterator_count(&it);
+    stats.total = vector_count(calls.list);
     // Total number of calls after filtering
-    vector_iterator_set_filter(&it, filter_check_call);
-    stats.displayed = vector_iterator_count(&it);
+    stats.displayed = vector_count(calls.filtered);
+    // Total number of calls not filtered yet
+    stats.pending = vector_count(calls.unfiltered);
     return stats;
 }
 
+void
+sip_calls_counters(sip_counters_t *counters)
+{
+    int *src = (int *) &calls.counters, *dst = (int *) counters;
+    size_t i;
+
+    // Counters are updated by workers of all shards
+    for (i = 0; i < sizeof(sip_counters_t) / sizeof(int); i++)
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
 sip_call_t *
 sip_find_by_index(int index)
 {
@@ -528,54 +1112,131 @@ sip_find_by_index(int index)
 sip_call_t *
 sip_find_by_callid(const char *callid)
 {
-    return htable_find(calls.callids, callid);
+    sip_call_shard_t *shard = &calls.shards[sip_callid_shard(callid)];
+    sip_call_t *call;
+
+    pthread_mutex_lock(&shard->callids_lock);
+    call = htable_find(shard->callids, callid);
+    pthread_mutex_unlock(&shard->callids_lock);
+    return call;
 }
 
+
 int
-sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload)
+sip_callid_shard(const char *callid)
 {
-    regmatch_t pmatch[3];
-    char resp_str[SIP_ATTR_MAXLEN];
-    char reqresp[SIP_ATTR_MAXLEN];
-    char cseq[11];
-    const char *resp_def;
+    if (calls.shard_count <= 1)
+        return 0;
 
-    // Initialize variables
-    memset(pmatch, 0, sizeof(pmatch));
+    return sip_callid_hash(callid) % calls.shard_count;
+}
+
+int
+sip_packet_shard(packet_t *packet)
+{
+    const char *line = (const char *) packet_payload(packet);
+    const char *value;
+
+    // Media packets never start with a SIP request or response line
+    if (!line || !sip_scan_is_sip(line))
+        return -1;
+
+    while (*line) {
+        value = NULL;
+        if (!strncasecmp(line, "Call-ID:", 8)) {
+            value = line + 8;
+        } else if (!strncasecmp(line, "i:", 2)) {
+            value = line + 2;
+        }
+
+        if (value) {
+            while (*value == ' ')
+                value++;
+            return (calls.shard_count <= 1) ? 0 : sip_callid_hash(value) % calls.shard_count;
+        }
+
+        // Move to next payload line
+        if (!(line = strchr(line, '\n')))
+            break;
+        line++;
+    }
+
+    return -1;
+}
+
+int
+sip_calls_shard_count()
+{
+    return calls.shard_count;
+}
+
+void
+sip_calls_lock_shard(int shard)
+{
+    pthread_mutex_lock(&calls.shards[shard].lock);
+}
+
+void
+sip_calls_unlock_shard(int shard)
+{
+    pthread_mutex_unlock(&calls.shards[shard].lock);
+}
+
+void
+sip_calls_lock()
+{
+    int i;
+    for (i = 0; i < calls.shard_count; i++)
+        pthread_mutex_lock(&calls.shards[i].lock);
+}
+
+void
+sip_calls_unlock()
+{
+    int i;
+    for (i = calls.shard_count - 1; i >= 0; i--)
+        pthread_mutex_unlock(&calls.shards[i].lock);
+}
+
+
+int
+sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan)
+{
+    char resp_str[SIP_ATTR_MAXLEN];
+    char reqresp[SIP_ATTR_MAXLEN];
+    const char *resp_def, *value;
+    uint32_t cseq;
+    int len;
+
+    // Initialize variables
     memset(resp_str, 0, sizeof(resp_str));
     memset(reqresp, 0, sizeof(reqresp));
 
     // If not already parsed
     if (!msg->reqresp) {
 
-        // Method & CSeq
-        if (regexec(&calls.reg_method, (const char *)payload, 2, pmatch, 0) == 0) {
-            if ((int)(pmatch[1].rm_eo - pmatch[1].rm_so) >= SIP_ATTR_MAXLEN) {
+        // Method
+        if ((value = sip_scan_method((const char *) payload, scan, &len))) {
+            if (len >= SIP_ATTR_MAXLEN) {
                 strncpy(reqresp, "<malformed>", 12);
             } else {
-                sprintf(reqresp, "%.*s", (int) (pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
+                sprintf(reqresp, "%.*s", len, value);
             }
         }
 
         // CSeq
-        if (regexec(&calls.reg_cseq, (char*)payload, 2, pmatch, 0) == 0) {
-            sprintf(cseq, "%.*s", (int)(pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
-            msg->cseq = atoi(cseq);
+        if (sip_scan_cseq((const char *) payload, scan, &cseq)) {
+            msg->cseq = cseq;
         }
 
-
         // Response code
-        if (regexec(&calls.reg_response, (const char *)payload, 3, pmatch, 0) == 0) {
-            if ((int)(pmatch[1].rm_eo - pmatch[1].rm_so) >= SIP_ATTR_MAXLEN) {
-                strncpy(resp_str, "<malformed>", 12);
-            } else {
-                sprintf(resp_str, "%.*s", (int) (pmatch[1].rm_eo - pmatch[1].rm_so), payload + pmatch[1].rm_so);
-            }
-            if ((int)(pmatch[2].rm_eo - pmatch[2].rm_so) >= SIP_ATTR_MAXLEN) {
+        if ((value = sip_scan_response((const char *) payload, scan, &len))) {
+            if (len >= SIP_ATTR_MAXLEN) {
                 strncpy(resp_str, "<malformed>", 12);
             } else {
-                sprintf(reqresp, "%.*s", (int) (pmatch[2].rm_eo - pmatch[2].rm_so), payload + pmatch[2].rm_so);
+                sprintf(resp_str, "%.*s", len, value);
             }
+            sprintf(reqresp, "%.3s", value);
         }
 
         // Get Request/Response Code
@@ -585,7 +1246,7 @@ sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload)
         if (!msg_is_request(msg)) {
             resp_def = sip_method_str(msg->reqresp);
             if (!resp_def || strcmp(resp_def, resp_str)) {
-                msg->resp_str = strdup(resp_str);
+                msg->resp_str = strpool_get(resp_str, strlen(resp_str));
             }
         }
     }
@@ -607,63 +1268,175 @@ sip_get_msg_reqresp_str(sip_msg_t *msg)
 sip_msg_t *
 sip_parse_msg(sip_msg_t *msg)
 {
-    if (msg && !msg->cseq) {
-        sip_parse_msg_payload(msg, (u_char*) msg_get_payload(msg));
+    sip_scan_t scan;
+    const char *payload;
+
+    // Headers are indexed when messages are captured
+    if (msg && !msg->hdrs[SIP_SCAN_FROM].off && !msg->hdrs[SIP_SCAN_TO].off) {
+        payload = msg_get_payload(msg);
+        sip_scan_payload(payload, &scan);
+        sip_parse_msg_payload(msg, (const u_char *) payload, &scan);
     }
     return msg;
 }
 
-int
-sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload)
+/**
+ * @brief Store the position of a header value in message index
+ */
+static void
+sip_msg_set_header(sip_msg_t *msg, const u_char *payload, enum sip_scan_header header,
+                   const char *value, int len)
 {
-    regmatch_t pmatch[4];
+    if (!value)
+        return;
 
-    // From
-    if (regexec(&calls.reg_from, (const char *)payload, 4, pmatch, 0) == 0) {
-        msg->sip_from = sng_malloc((int)pmatch[2].rm_eo - pmatch[2].rm_so + 1);
-        strncpy(msg->sip_from, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
-    } else {
-        // Malformed From Header
-        msg->sip_from = sng_malloc(12);
-        strncpy(msg->sip_from, "<malformed>", 12);
+    msg->hdrs[header].off = (const u_char *) value - payload;
+    msg->hdrs[header].len = len;
+}
+
+int
+sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan)
+{
+    const char *value;
+    int header, len;
+
+    memset(msg->hdrs, 0, sizeof(msg->hdrs));
+
+    for (header = 0; header < SIP_SCAN_HEADER_COUNT; header++) {
+        switch (header) {
+            case SIP_SCAN_CALLID:
+            case SIP_SCAN_XCALLID:
+                value = sip_scan_token((const char *) payload, scan, header, &len);
+                break;
+            case SIP_SCAN_FROM:
+            case SIP_SCAN_TO:
+                value = sip_scan_uri((const char *) payload, scan, header, &len);
+                break;
+            case SIP_SCAN_REASON:
+                value = sip_scan_reason((const char *) payload, scan, &len);
+                break;
+            default:
+                value = sip_scan_value((const char *) payload, scan, header, &len);
+                break;
+        }
+        sip_msg_set_header(msg, payload, header, value, len);
     }
 
-    // To
-    if (regexec(&calls.reg_to, (const char *)payload, 4, pmatch, 0) == 0) {
-        msg->sip_to = sng_malloc((int)pmatch[2].rm_eo - pmatch[2].rm_so + 1);
-        strncpy(msg->sip_to, (const char *)payload +  pmatch[2].rm_so, (int)pmatch[2].rm_eo - pmatch[2].rm_so);
-    } else {
-        // Malformed To Header
-        msg->sip_to = sng_malloc(12);
-        strncpy(msg->sip_to, "<malformed>", 12);
+    return 0;
+}
+
+int
+sip_msg_set_data(sip_msg_t *msg, packet_t *data)
+{
+    sip_call_t *call = msg->call;
+    packet_t *packet = msg->packet;
+    uint32_t memory = 0;
+    sip_scan_t scan;
+    u_char *payload;
+
+    // Max SIP payload allowed
+    if (!packet_payload(data) || data->payload_len > MAX_SIP_PAYLOAD)
+        return 1;
+
+    // Frames not moved to call memory are accounted apart
+    if (!packet->arena)
+        memory = packet_data_copy(packet, NULL);
+    if (packet_replace_data(packet, data, &call->arena) != 0)
+        return 1;
+    if (!packet->arena) {
+        call->packets_memory -= memory;
+        call->packets_memory += packet_data_copy(packet, NULL);
     }
 
+    // Headers positions are stored as offsets of the new payload
+    payload = packet_payload(packet);
+    sip_scan_payload((const char *) payload, &scan);
+    sip_parse_msg_payload(msg, payload, &scan);
+    msg->hash = hash_mem64(payload, packet_payloadlen(packet));
+
+    call_update_memory(call);
+    call_updated(call);
+    CALL_SLOT(call, changed) = true;
+    sip_calls_set_changed();
     return 0;
 }
 
+/**
+ * @brief Get the next space separated token of a SDP line
+ *
+ * @param pos Current position in line, moved after the token
+ * @param eol Line end
+ * @param len Token length
+ * @return token start or NULL if line has no more tokens
+ */
+static const char *
+sip_sdp_token(const char **pos, const char *eol, int *len)
+{
+    const char *token = *pos;
+
+    while (token < eol && (*token == ' ' || *token == '\t'))
+        token++;
+    for (*pos = token; *pos < eol && **pos != ' ' && **pos != '\t'; (*pos)++);
+
+    *len = *pos - token;
+    return (*len) ? token : NULL;
+}
+
+/**
+ * @brief Parse a decimal number at the start of a SDP token
+ *
+ * @return number of parsed digits
+ */
+static int
+sip_sdp_number(const char *token, int len, uint32_t *value)
+{
+    int i;
+
+    for (*value = 0, i = 0; i < len && token[i] >= '0' && token[i] <= '9'; i++)
+        *value = *value * 10 + (token[i] - '0');
+    return i;
+}
+
+/**
+ * @brief Copy a SDP token into a NUL terminated buffer
+ *
+ * Tokens longer than maxlen are truncated.
+ */
+static void
+sip_sdp_copy(char *dst, const char *token, int len, int maxlen)
+{
+    if (len > maxlen)
+        len = maxlen;
+    memcpy(dst, token, len);
+    dst[len] = '\0';
+}
+
 void
-sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
+sip_parse_msg_media(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan)
 {
 
 #define ADD_STREAM(stream) \
     if (stream) { \
-        if (!rtp_find_call_stream(call, src, stream->dst)) { \
+        capture_filter_add_port(stream->dst.port, msg_get_time(msg).tv_sec); \
+        if (!call_find_stream(call, stream->dst)) { \
           call_add_stream(call, stream); \
       } else { \
-          sng_free(stream); \
           stream = NULL; \
       } \
     }
 
-    address_t dst, src = { };
+    address_t dst = { };
     rtp_stream_t *rtp_stream = NULL, *rtcp_stream = NULL, *msg_rtp_stream = NULL;
-    char media_type[MEDIATYPELEN + 1] = { };
-    char media_format[30] = { };
-    char address[ADDRESSLEN + 1] = { };
+    char media_type[MEDIATYPELEN + 1];
+    char media_format[30];
+    char address[ADDRESSLEN + 1];
     uint32_t media_fmt_pref;
     uint32_t media_fmt_code;
+    uint32_t port;
     sdp_media_t *media = NULL;
-    char *payload2, *tofree, *line;
+    const char *line, *eol, *end, *pos, *type, *token;
+    int typelen, len, digits;
+    char field;
     sip_call_t *call = msg_get_call(msg);
 
     // If message is retrans, there's no need to parse the payload again
@@ -673,13 +1446,27 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
         return;
     }
 
-    // Parse each line of payload looking for sdp information
-    tofree = payload2 = strdup((char*)payload);
-    while ((line = strsep(&payload2, "\r\n")) != NULL) {
-        // Check if we have a media string
-        if (!strncmp(line, "m=", 2)) {
-            if (sscanf(line, "m=%" STRINGIFY(MEDIATYPELEN) "s %hu RTP/%*s %u", media_type, &dst.port, &media_fmt_pref) == 3
-            ||  sscanf(line, "m=%" STRINGIFY(MEDIATYPELEN) "s %hu UDP/%*s %u", media_type, &dst.port, &media_fmt_pref) == 3) {
+    // SDP information is only in message body
+    if (!scan->body)
+        return;
+
+    // Parse each line of body in place looking for sdp information
+    end = (const char *) payload + packet_payloadlen(msg->packet);
+    for (line = (const char *) payload + scan->body; line < end && *line; line = eol) {
+        // Lines can end with CRLF or LF
+        for (eol = line; eol < end && *eol && *eol != '\r' && *eol != '\n'; eol++);
+        field = (eol - line >= 2 && line[1] == '=') ? line[0] : '\0';
+        pos = line + 2;
+
+        if (field == 'm') {
+            // Check if we have a media string: m=type port RTP/xxx format
+            if ((type = sip_sdp_token(&pos, eol, &typelen)) && typelen <= MEDIATYPELEN
+                && (token = sip_sdp_token(&pos, eol, &len)) && sip_sdp_number(token, len, &port) == len
+                && (token = sip_sdp_token(&pos, eol, &len)) && len > 4
+                && (!strncmp(token, "RTP/", 4) || !strncmp(token, "UDP/", 4))
+                && (token = sip_sdp_token(&pos, eol, &len)) && sip_sdp_number(token, len, &media_fmt_pref)) {
+                sip_sdp_copy(media_type, type, typelen, MEDIATYPELEN);
+                dst.port = port;
 
                 // Add streams from previous 'm=' line to the call
                 ADD_STREAM(msg_rtp_stream);
@@ -713,33 +1500,43 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
                     rtcp_stream->dst.port++;
                 }
             }
-        }
-
-        // Check if we have a connection string
-        if (!strncmp(line, "c=", 2)) {
-            if (sscanf(line, "c=IN IP%*c %" STRINGIFY(ADDRESSLEN) "s", address)) {
-                strncpy(dst.ip, address, ADDRESSLEN - 1);
+        } else if (field == 'c' && eol - pos > 6 && !strncmp(pos, "IN IP", 5)) {
+            // Check if we have a connection string: c=IN IPx address
+            pos += 6;
+            if ((token = sip_sdp_token(&pos, eol, &len))) {
+                sip_sdp_copy(address, token, len, ADDRESSLEN);
+                address_parse_ip(&dst, address);
                 if (media) {
                     media_set_address(media, dst);
-                    strcpy(rtp_stream->dst.ip, dst.ip);
-                    strcpy(rtcp_stream->dst.ip, dst.ip);
+                    rtp_stream->dst.family = rtcp_stream->dst.family = dst.family;
+                    rtp_stream->dst.ip = rtcp_stream->dst.ip = dst.ip;
                 }
             }
-        }
-
-        // Check if we have attribute format string
-        if (!strncmp(line, "a=rtpmap:", 9)) {
-            if (media && sscanf(line, "a=rtpmap:%u %29[^ ]", &media_fmt_code, media_format)) {
-                media_add_format(media, media_fmt_code, media_format);
+        } else if (field == 'a') {
+            if (eol - line > 9 && !strncmp(line, "a=rtpmap:", 9)) {
+                // Check if we have attribute format string: a=rtpmap:code format
+                pos = line + 9;
+                if (media && (token = sip_sdp_token(&pos, eol, &len))
+                    && (digits = sip_sdp_number(token, len, &media_fmt_code))) {
+                    pos = token + digits;
+                    if ((token = sip_sdp_token(&pos, eol, &len))) {
+                        sip_sdp_copy(media_format, token, len, sizeof(media_format) - 1);
+                    } else {
+                        media_format[0] = '\0';
+                    }
+                    media_add_format(media, media_fmt_code, media_format);
+                }
+            } else if (eol - line > 7 && !strncmp(line, "a=rtcp:", 7) && rtcp_stream) {
+                // Check if we have attribute format RTCP port
+                token = line + 7;
+                if (sip_sdp_number(token, eol - token, &port))
+                    rtcp_stream->dst.port = port;
             }
         }
 
-        // Check if we have attribute format RTCP port
-        if (!strncmp(line, "a=rtcp:", 7) && rtcp_stream) {
-            sscanf(line, "a=rtcp:%hu", &rtcp_stream->dst.port);
-        }
-
-
+        // Skip line feed characters
+        while (eol < end && (*eol == '\r' || *eol == '\n'))
+            eol++;
     }
 
     // Add streams from last 'm=' line to the call
@@ -747,78 +1544,474 @@ sip_parse_msg_media(sip_msg_t *msg, const u_char *payload)
     ADD_STREAM(rtp_stream);
     ADD_STREAM(rtcp_stream);
 
-    sng_free(tofree);
-
 #undef ADD_STREAM
 }
 
 void
-sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload)
+sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan)
 {
-    regmatch_t pmatch[4];
-    char warning[10];
+    const char *value;
+    int len, warning;
 
      // Reason text
-     if (regexec(&calls.reg_reason, (const char *)payload, 2, pmatch, 0) == 0) {
-         msg->call->reasontxt = sng_malloc((int)pmatch[1].rm_eo - pmatch[1].rm_so + 1);
-         strncpy(msg->call->reasontxt, (const char *)payload +  pmatch[1].rm_so, (int)pmatch[1].rm_eo - pmatch[1].rm_so);
+     if ((value = msg_get_header(msg, SIP_SCAN_REASON, &len))) {
+         strpool_put(msg->call->reasontxt);
+         msg->call->reasontxt = strpool_get(value, len);
      }
 
      // Warning code
-     if (regexec(&calls.reg_warning, (const char *)payload, 2, pmatch, 0) == 0) {
-         strncpy(warning, (const char *)payload +  pmatch[1].rm_so, (int)pmatch[1].rm_eo - pmatch[1].rm_so);
-         msg->call->warning = atoi(warning);
+     if (sip_scan_warning((const char *) payload, scan, &warning)) {
+         msg->call->warning = warning;
      }
 }
 
-void
-sip_calls_clear()
+/**
+ * @brief Release all calls of a removed generation
+ *
+ * Calls are no longer reachable from capture or interface, so this
+ * does not require capture lock.
+ */
+static void
+sip_calls_generation_free(sip_calls_generation_t *gen)
 {
-    // Create again the callid hash table
-    htable_destroy(calls.callids);
-    calls.callids = htable_create(calls.limit);
+    vector_iter_t it = vector_iterator(gen->list);
+    vector_t *waiting;
+    sip_call_t *call;
+
+    while ((call = vector_iterator_next(&it))) {
+        // Waiting lists are keyed by the X-Call-Id of their calls
+        if (gen->xcalls_pending && !call->xparent && strlen(call->xcallid)
+            && (waiting = htable_find(gen->xcalls_pending, call->xcallid))) {
+            htable_remove(gen->xcalls_pending, call->xcallid);
+            vector_destroy(waiting);
+        }
+        call_free(call);
+    }
+
+    vector_set_destroyer(gen->list, NULL);
+    vector_destroy(gen->list);
+    htable_destroy(gen->xcalls_pending);
+    sng_free(gen);
+}
+
+/**
+ * @brief Reaper thread function, releases queued generations
+ */
+static void *
+sip_calls_reaper(void *arg)
+{
+    sip_calls_generation_t *gen;
+#ifdef SCHED_IDLE
+    struct sched_param param = { 0 };
+
+    // Only use CPU time no other thread wants
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+    pthread_mutex_lock(&reaper.lock);
+    while (true) {
+        while (!reaper.pending && !reaper.stop)
+            pthread_cond_wait(&reaper.cond, &reaper.lock);
+        // Pending generations are released before exiting
+        if (!(gen = reaper.pending))
+            break;
+        reaper.pending = gen->next;
+        pthread_mutex_unlock(&reaper.lock);
+        sip_calls_generation_free(gen);
+        pthread_mutex_lock(&reaper.lock);
+    }
+    pthread_mutex_unlock(&reaper.lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Queue a removed generation to be released by reaper thread
+ *
+ * Reaper thread is started on first use. If it can not be started,
+ * generation is released by the caller.
+ */
+static void
+sip_calls_reap(sip_calls_generation_t *gen)
+{
+    pthread_mutex_lock(&reaper.lock);
+    if (!reaper.running && !reaper.stop)
+        reaper.running = (thread_create(&reaper.thread, THREAD_IO, "sng-reaper", sip_calls_reaper, NULL) == 0);
+
+    if (!reaper.running) {
+        pthread_mutex_unlock(&reaper.lock);
+        sip_calls_generation_free(gen);
+        return;
+    }
+
+    gen->next = reaper.pending;
+    reaper.pending = gen;
+    pthread_cond_signal(&reaper.cond);
+    pthread_mutex_unlock(&reaper.lock);
+}
+
+/**
+ * @brief Wait until all queued generations have been released
+ */
+static void
+sip_calls_reaper_stop()
+{
+    pthread_mutex_lock(&reaper.lock);
+    reaper.stop = true;
+    pthread_cond_signal(&reaper.cond);
+    pthread_mutex_unlock(&reaper.lock);
+
+    if (reaper.running)
+        pthread_join(reaper.thread, NULL);
+    reaper.running = false;
+}
+
+/**
+ * @brief Empty call store lists and indexes once calls have been taken
+ */
+static void
+sip_calls_reset()
+{
+    // Create again the callid hash tables
+    sip_calls_shard_reset();
 
     // Remove all items from vector
-    vector_clear(calls.list);
+    calls.first = calls.last = NULL;
+    memset(&calls.counters, 0, sizeof(calls.counters));
+    memset(calls.expire_wheel, 0, sizeof(calls.expire_wheel));
+    vector_clear(calls.locked);
     vector_clear(calls.active);
+    vector_clear(calls.filtered);
+    vector_clear(calls.unfiltered);
+    vector_clear(calls.filter_pending);
+}
+
+void
+sip_calls_clear()
+{
+    sip_calls_generation_t *gen;
+
+    // Removed calls must be accounted one by one in statistics report
+    if (report_enabled() || !(gen = sng_malloc(sizeof(sip_calls_generation_t)))) {
+        vector_clear(calls.list);
+        sip_calls_reset();
+        return;
+    }
+
+    // Take the whole call store, new calls are stored in a fresh one
+    gen->list = calls.list;
+    gen->xcalls_pending = calls.xcalls_pending;
+    calls.list = vector_create(200, 50);
+    vector_set_destroyer(calls.list, call_destroyer);
+    vector_set_sorter(calls.list, sip_list_sorter);
+    calls.xcalls_pending = htable_create(64);
+
+    // Shared indexes are emptied at once instead of call by call
+    stream_index_clear();
+    storage_clear();
+    compact_clear();
+    __atomic_store_n(&calls.memory, 0, __ATOMIC_RELAXED);
+    sip_calls_reset();
+
+    sip_calls_reap(gen);
 }
 
 void
 sip_calls_clear_soft()
 {
-        // Create again the callid hash table
-        htable_destroy(calls.callids);
-        calls.callids = htable_create(calls.limit);
+    vector_t *list = calls.list, *active = calls.active;
+    sip_calls_generation_t *gen;
+    sip_call_t *call;
+    vector_iter_t it;
 
-        // Repopulate list applying current filter
-        calls.list = vector_copy_if(sip_calls_vector(), filter_check_call);
-        calls.active = vector_copy_if(sip_active_calls_vector(), filter_check_call);
+    // Create again the callid hash tables
+    sip_calls_shard_reset();
 
-        // Repopulate callids based on filtered list
-        sip_call_t *call;
-        vector_iter_t it = vector_iterator(calls.list);
+    // Repopulate lists with calls matching current filter
+    calls.list = vector_create(vector_count(list), 50);
+    vector_set_destroyer(calls.list, call_destroyer);
+    vector_set_sorter(calls.list, sip_list_sorter);
+    calls.active = vector_create(10, 10);
+    calls.first = calls.last = NULL;
+    memset(calls.expire_wheel, 0, sizeof(calls.expire_wheel));
+    vector_clear(calls.locked);
+
+    // Removed calls are unlinked now and released by reaper thread
+    if ((gen = sng_malloc(sizeof(sip_calls_generation_t))))
+        gen->list = vector_create(0, 50);
 
-        while ((call = vector_iterator_next(&it)))
-        {
-                htable_insert(calls.callids, call->callid, call);
+    it = vector_iterator(list);
+    while ((call = vector_iterator_next(&it))) {
+        if (!CALL_SLOT(call, locked) && !filter_check_call(call)) {
+            sip_calls_count_remove(call);
+            if (gen) {
+                call_unlink(call);
+                vector_append(gen->list, call);
+            } else {
+                call_destroy(call);
+            }
+            continue;
         }
+        // Repopulate callids based on filtered list, rows have no Call-ID
+        if (!call->compact)
+            sip_calls_shard_insert(call);
+        vector_append_items(calls.list, (void **) &call, 1);
+        sip_calls_arrival_append(call);
+        if (call->expire_time)
+            sip_calls_expire_add(call, call->expire_time);
+        if (call->listed_active)
+            vector_append(calls.active, call);
+    }
+
+    // Removed calls have already been taken
+    vector_set_destroyer(list, NULL);
+    vector_destroy(list);
+    vector_destroy(active);
+
+    if (gen)
+        sip_calls_reap(gen);
+
+    // Rebuild filtered list with remaining calls
+    sip_calls_filter_reset();
 }
 
 void
+sip_deinit()
+{
+    int i;
+
+    // Wait until cleared calls have been released
+    sip_calls_reaper_stop();
+    // Remove all calls
+    vector_clear(calls.list);
+    sip_calls_reset();
+    // Remove Call-id hash tables
+    for (i = 0; i < calls.shard_count; i++) {
+        htable_destroy(calls.shards[i].callids);
+        pthread_mutex_destroy(&calls.shards[i].lock);
+        pthread_mutex_destroy(&calls.shards[i].callids_lock);
+    }
+    pthread_mutex_destroy(&calls.lock);
+    // All waiting calls have been destroyed
+    htable_destroy(calls.xcalls_pending);
+    calls.xcalls_pending = NULL;
+    // Remove notification pipe
+    if (calls.notify[0] >= 0) {
+        close(calls.notify[0]);
+        close(calls.notify[1]);
+    }
+    // Remove calls vector
+    vector_destroy(calls.list);
+    vector_destroy(calls.active);
+    vector_destroy(calls.locked);
+    vector_destroy(calls.filtered);
+    vector_destroy(calls.unfiltered);
+    vector_destroy(calls.filter_pending);
+    calls.first = calls.last = NULL;
+    // Remove streams index, all calls have been destroyed
+    rtp_deinit();
+    // Remove compaction rows, all calls have been destroyed
+    compact_deinit();
+    // Remove match file patterns
+    match_set_destroy(calls.match_set);
+    calls.match_set = NULL;
+    // Release disk storage of removed calls
+    storage_deinit();
+}
+
+/**
+ * @brief Remove a call from storage if it is not being modified
+ *
+ * @return 0 if the call has been removed, 1 otherwise
+ */
+static int
+sip_calls_remove_call(sip_call_t *call)
+{
+    pthread_mutex_t *lock;
+
+    // Skip calls being modified from other shards
+    lock = &calls.shards[sip_callid_shard(call->callid)].lock;
+    if (pthread_mutex_trylock(lock) != 0)
+        return 1;
+
+    // Remove from callids hash
+    sip_calls_shard_remove(call);
+    sip_calls_arrival_remove(call);
+    sip_calls_expire_remove(call);
+    // Remove call from active and call lists
+    if (call->listed_active)
+        vector_remove(calls.active, call);
+    if (call->listed_pending)
+        vector_remove(calls.filter_pending, call);
+    if (call->listed_filtered)
+        vector_remove(calls.filtered, call);
+    else if (vector_count(calls.unfiltered))
+        vector_remove(calls.unfiltered, call);
+    sip_calls_count_remove(call);
+    vector_remove(calls.list, call);
+    pthread_mutex_unlock(lock);
+    return 0;
+}
+
+/**
+ * @brief Remove a call from storage to make room for new ones
+ *
+ * @return 0 if the call has been removed, 1 otherwise
+ */
+static int
+sip_calls_rotate_call(sip_call_t *call)
+{
+    if (sip_calls_remove_call(call) != 0)
+        return 1;
+    calls.rotated++;
+    return 0;
+}
+
+int
 sip_calls_rotate()
 {
-    sip_call_t *call;
-    vector_iter_t it = vector_iterator(calls.list);
-    while ((call = vector_iterator_next(&it))) {
-        if (!call->locked) {
-            // Remove from callids hash
-            htable_remove(calls.callids, call->callid);
-            // Remove first call from active and call lists
-            vector_remove(calls.active, call);
-            vector_remove(calls.list, call);
-            return;
+    sip_call_t *call, *next;
+    int i;
+
+    // Locked calls are older than any call in arrival list
+    for (i = 0; i < vector_count(calls.locked); i++) {
+        call = vector_item(calls.locked, i);
+        if (!CALL_SLOT(call, locked) && sip_calls_rotate_call(call) == 0)
+            return 0;
+    }
+
+    for (call = calls.first; call; call = next) {
+        next = call->arrival_next;
+        if (CALL_SLOT(call, locked)) {
+            // Keep locked calls out of the way until they are unlocked
+            sip_calls_arrival_remove(call);
+            vector_append(calls.locked, call);
+            continue;
+        }
+        if (sip_calls_rotate_call(call) == 0)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Fold a finished keepalive dialog into its compaction row
+ *
+ * If there is no row for its method and addresses yet, the dialog is
+ * kept as row. Rows Call-ID is forgotten, so following transactions
+ * with the same Call-ID are stored in a new dialog and folded too.
+ * This must be invoked with capture and calls lock taken.
+ *
+ * @return 0 if the dialog has been folded or is now a row, 1 otherwise
+ */
+static int
+sip_calls_compact_call(sip_call_t *call, time_t now)
+{
+    sip_call_t *row;
+
+    if (compact_call_aggregate(call) == 0) {
+        sip_calls_shard_remove(call);
+        sip_calls_expire_add(call, now + SIP_EXPIRE_SLOTS);
+        sip_calls_set_changed();
+        return 0;
+    }
+
+    row = compact_call_row(call);
+    if (sip_calls_remove_call(call) != 0)
+        return 1;
+
+    // Rows in use are rotated after other dialogs and expire later
+    if (row) {
+        row->last_time = now;
+        if (!CALL_SLOT(row, locked)) {
+            sip_calls_arrival_remove(row);
+            sip_calls_arrival_append(row);
         }
     }
+    sip_calls_set_changed();
+    return 0;
+}
+
+uint64_t
+sip_calls_expired()
+{
+    return calls.expired;
+}
+
+bool
+sip_calls_expire_enabled()
+{
+    return calls.expire_completed > 0 || calls.expire_noninvite > 0 || calls.expire_setup > 0
+           || compact_enabled();
+}
+
+void
+sip_calls_expire(time_t now)
+{
+    sip_call_t *call, *next;
+    time_t deadline;
+    int slot;
+
+    if (!sip_calls_expire_enabled())
+        return;
+
+    pthread_mutex_lock(&calls.lock);
+
+    // Visit each elapsed second slot, a full turn visits all calls
+    if (!calls.expire_last || now - calls.expire_last > SIP_EXPIRE_SLOTS)
+        calls.expire_last = now - SIP_EXPIRE_SLOTS;
+
+    while (calls.expire_last < now) {
+        slot = ++calls.expire_last % SIP_EXPIRE_SLOTS;
+        call = calls.expire_wheel[slot];
+        calls.expire_wheel[slot] = NULL;
+
+        for (; call; call = next) {
+            next = call->expire_next;
+            call->expire_prev = call->expire_next = NULL;
+            call->expire_time = 0;
+
+            deadline = sip_call_expire_deadline(call);
+            if (deadline && deadline <= now && !CALL_SLOT(call, locked)) {
+                if (call->compact_done && !call->compact) {
+                    if (sip_calls_compact_call(call, now) == 0)
+                        continue;
+                } else if (sip_calls_remove_call(call) == 0) {
+                    calls.expired++;
+                    continue;
+                }
+                // Call is being modified, try again next second
+                sip_calls_expire_add(call, now + 1);
+            } else if (deadline > now) {
+                sip_calls_expire_add(call, deadline);
+            } else {
+                // State may change with new messages, check after a wheel turn
+                sip_calls_expire_add(call, now + SIP_EXPIRE_SLOTS);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&calls.lock);
+}
+
+void
+sip_set_memory_limit(uint64_t limit)
+{
+    calls.memory_limit = limit;
+}
+
+uint64_t
+sip_calls_memory(uint64_t *limit)
+{
+    if (limit)
+        *limit = calls.memory_limit;
+    return __atomic_load_n(&calls.memory, __ATOMIC_RELAXED);
+}
+
+void
+sip_calls_memory_update(int64_t delta)
+{
+    __atomic_add_fetch(&calls.memory, delta, __ATOMIC_RELAXED);
 }
 
 int
@@ -828,6 +2021,9 @@ sip_set_match_expression(const char *expr, int insensitive, int invert)
     calls.match_expr = expr;
     // Set invert flag
     calls.match_invert = invert;
+    calls.match_caseless = insensitive;
+    // Payloads without the expression required text can not match
+    calls.match_literal_only = expr_required_literal(expr, calls.match_literal);
 
 #ifdef WITH_PCRE
     const char *re_err = NULL;
@@ -843,14 +2039,19 @@ sip_set_match_expression(const char *expr, int insensitive, int invert)
 #elif defined(WITH_PCRE2)
     int re_err = 0;
     PCRE2_SIZE err_offset = 0;
-    uint32_t pflags = PCRE2_UNGREEDY | PCRE2_CASELESS;
+    uint32_t pflags = PCRE2_UNGREEDY | PCRE2_DOTALL;
 
     if (insensitive)
         pflags |= PCRE2_CASELESS;
 
     // Check if we have a valid expression
     calls.match_regex = pcre2_compile((PCRE2_SPTR) expr, PCRE2_ZERO_TERMINATED, pflags, &re_err, &err_offset, NULL);
-    return calls.match_regex == NULL;
+    if (calls.match_regex == NULL)
+        return 1;
+
+    // Use JIT compiled expression if available
+    pcre2_jit_compile(calls.match_regex, PCRE2_JIT_COMPLETE);
+    return 0;
 #else
     int cflags = REG_EXTENDED;
 
@@ -869,13 +2070,59 @@ sip_get_match_expression()
     return calls.match_expr;
 }
 
+int
+sip_set_match_file(const char *file, int insensitive, int invert)
+{
+    match_set_t *set;
+    int ret;
+
+    if (!(set = match_set_create(insensitive)))
+        return -1;
+
+    // Build the automaton once all patterns have been loaded
+    if ((ret = match_set_load(set, file)) == 0 && match_set_compile(set) != 0)
+        ret = -1;
+
+    if (ret != 0) {
+        match_set_destroy(set);
+        return ret;
+    }
+
+    match_set_destroy(calls.match_set);
+    calls.match_set = set;
+    calls.match_invert = invert;
+    return 0;
+}
+
+match_set_t *
+sip_get_match_set()
+{
+    return calls.match_set;
+}
+
 int
 sip_check_match_expression(const char *payload)
 {
     // Everything matches when there is no match
-    if (!calls.match_expr)
+    if (!calls.match_expr && !calls.match_set)
         return 1;
 
+    // Payload must match any of the match file patterns
+    if (calls.match_set && !match_set_check(calls.match_set, payload))
+        return 1 == calls.match_invert;
+
+    // Match file patterns are the only condition
+    if (!calls.match_expr)
+        return 0 == calls.match_invert;
+
+    // Payload does not contain the text required by the expression
+    if (!expr_literal_found(payload, calls.match_literal, calls.match_caseless))
+        return 1 == calls.match_invert;
+
+    // No need to run the expression for plain texts
+    if (calls.match_literal_only)
+        return 0 == calls.match_invert;
+
 #ifdef WITH_PCRE
     switch (pcre_exec(calls.match_regex, 0, payload, strlen(payload), 0, 0, 0, 0)) {
         case PCRE_ERROR_NOMATCH:
@@ -884,9 +2131,7 @@ sip_check_match_expression(const char *payload)
 
     return 0 == calls.match_invert;
 #elif defined(WITH_PCRE2)
-    pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(calls.match_regex, NULL);
-    int ret = pcre2_match(calls.match_regex, (PCRE2_SPTR) payload, (PCRE2_SIZE) strlen(payload), 0, 0, match_data, NULL);
-    pcre2_match_data_free(match_data);
+    int ret = pcre2_match(calls.match_regex, (PCRE2_SPTR) payload, (PCRE2_SIZE) strlen(payload), 0, 0, filter_match_data(), NULL);
 
     if (ret == PCRE2_ERROR_NOMATCH) {
         return 1 == calls.match_invert;
@@ -977,44 +2222,60 @@ sip_sort_options()
     return calls.sort;
 }
 
-void
-sip_sort_list()
+/**
+ * @brief Compare two calls using current sort options
+ *
+ * @return positive if one must be displayed after two, negative if
+ * before, 0 if they have the same value
+ */
+static int
+sip_list_compare(sip_call_t *one, sip_call_t *two)
 {
-    // Cloning the vector automatically sorts it
-    vector_t *clone = vector_clone(calls.list);
+    int cmp = call_attr_compare(one, two, calls.sort.by);
+    return (calls.sort.asc) ? cmp : -cmp;
+}
 
-    // FIXME FIXME FIXME
-    // There should be a way to destroy the vector without calling the
-    // vector destroyer for each item...
-    vector_set_destroyer(calls.list, NULL);
-    vector_destroy(calls.list);
+/**
+ * @brief qsort wrapper of sip_list_compare
+ */
+static int
+sip_list_qsort_compare(const void *one, const void *two)
+{
+    return sip_list_compare(*(sip_call_t **) one, *(sip_call_t **) two);
+}
 
-    // The new sorted list
-    calls.list = clone;
+void
+sip_sort_list()
+{
+    // Sort all calls at once instead of inserting them one by one
+    vector_sort(calls.list, sip_list_qsort_compare);
+    vector_sort(calls.filtered, sip_list_qsort_compare);
 }
 
 void
 sip_list_sorter(vector_t *vector, void *item)
 {
-    sip_call_t *prev, *cur = (sip_call_t *)item;
+    sip_call_t *cur = (sip_call_t *)item;
     int count = vector_count(vector);
-    int i;
+    int low = 0, high = count - 1, mid;
 
     // First item is alway sorted
-    if (vector_count(vector) == 1)
+    if (count == 1)
         return;
 
-    for (i = count - 2 ; i >= 0; i--) {
-        // Get previous item
-        prev = vector_item(vector, i);
-        // Check if the item is already in a sorted position
-        int cmp = call_attr_compare(cur, prev, calls.sort.by);
-        if ((calls.sort.asc && cmp > 0) || (!calls.sort.asc && cmp < 0)) {
-            vector_insert(vector, item, i + 1);
-            return;
+    // Most calls are appended in order
+    if (sip_list_compare(cur, vector_item(vector, count - 2)) > 0)
+        return;
+
+    // Find the first call that is not sorted before the new one
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (sip_list_compare(cur, vector_item(vector, mid)) > 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
     }
 
-    // Put this item at the begining of the vector
-    vector_insert(vector, item, 0);
+    vector_insert(vector, item, low);
 }
@@ -34,6 +34,7 @@
 
 #include "config.h"
 #include <stdbool.h>
+#include <pthread.h>
 #include <regex.h>
 #ifdef WITH_PCRE
 #include <pcre.h>
@@ -41,10 +42,22 @@
 #include <pcre2.h>
 #endif
 #include "sip_call.h"
+#include "sip_scan.h"
+#include "match.h"
 #include "vector.h"
 #include "hash.h"
 
 #define MAX_SIP_PAYLOAD 10240
+//! Max number of call store shards
+#define MAX_SIP_SHARDS 64
+//! Max number of Call-Ids allocated in advance in each shard hash table
+#define SIP_CALLIDS_PREALLOC 65536
+//! Max number of calls checked against display filters on each update
+#define SIP_FILTER_CHUNK 5000
+//! Max Call-ID and X-Call-ID length (including NUL)
+#define SIP_CALLID_MAXLEN 1024
+//! Number of one second slots of calls expiration wheel
+#define SIP_EXPIRE_SLOTS 256
 
 //! Shorter declaration of sip_call_list structure
 typedef struct sip_call_list sip_call_list_t;
@@ -52,8 +65,12 @@ typedef struct sip_call_list sip_call_list_t;
 typedef struct sip_code sip_code_t;
 //! Shorter declaration of sip stats
 typedef struct sip_stats sip_stats_t;
+//! Shorter declaration of sip counters
+typedef struct sip_counters sip_counters_t;
 //! Shorter declaration of sip sort
 typedef struct sip_sort sip_sort_t;
+//! Shorter declaration of sip call shard
+typedef struct sip_call_shard sip_call_shard_t;
 
 //! SIP Methods
 enum sip_methods {
@@ -100,6 +117,27 @@ struct sip_stats
     int total;
     //! Total number of displayed dialogs after filtering
     int displayed;
+    //! Total number of dialogs pending filter evaluation
+    int pending;
+};
+
+//! Message counters of request methods and response classes
+#define SIP_COUNTERS_REQRESP 110
+
+/**
+ * @brief Counters of stored dialogs and messages
+ *
+ * Counters are updated as messages are stored and calls removed, so
+ * they can be read without scanning stored calls.
+ */
+struct sip_counters
+{
+    //! Stored dialogs by call state (0 for dialogs that are not calls)
+    int states[SIP_CALLSTATE_COMPLETED + 1];
+    //! Stored messages
+    int msgs;
+    //! Stored messages by request method, or response class (100 + code / 100)
+    int reqresp[SIP_COUNTERS_REQRESP];
 };
 
 /**
@@ -113,29 +151,88 @@ struct sip_sort
     bool asc;
 };
 
+/**
+ * @brief Call store partition
+ *
+ * Calls are distributed between shards based on their Call-ID hash, so the
+ * messages of different shards can be parsed in parallel. Each shard lock
+ * must be held while its calls are modified.
+ */
+struct sip_call_shard {
+    //! Call-Ids hash table of this shard
+    htable_t *callids;
+    //! Lock for Call-Ids hash table access (always taken last)
+    pthread_mutex_t callids_lock;
+    //! Lock for calls of this shard
+    pthread_mutex_t lock;
+};
+
 /**
  * @brief call structures head list
  *
  * This structure acts as header of calls list
+ *
+ * Call list and active list contain calls of all shards and are the
+ * read-only merged view used by the interface.
  */
 struct sip_call_list {
     //! List of all captured calls
     vector_t *list;
     //! List of active captured calls
     vector_t *active;
+    //! List of calls matching display filters, sorted as call list
+    vector_t *filtered;
+    //! List of calls pending display filter evaluation
+    vector_t *unfiltered;
+    //! Displayed calls whose payload filter was paused by capture overload
+    vector_t *filter_pending;
+    //! Calls in arrival order, next ones to be rotated first
+    sip_call_t *first, *last;
+    //! Locked calls removed from arrival order list
+    vector_t *locked;
     //! Changed flag. For interface optimal updates
     bool changed;
+    //! Pipe to wake up the interface when calls change
+    int notify[2];
+    //! A wake up byte has been written and not yet consumed
+    bool notified;
     //! Sort call list following this options
     sip_sort_t sort;
     //! Last created id
     int last_index;
-    //! Call-Ids hash table
-    htable_t *callids;
+    //! Call store shards
+    sip_call_shard_t shards[MAX_SIP_SHARDS];
+    //! Number of call store shards
+    int shard_count;
+    //! Lock for merged lists modifications from shards
+    pthread_mutex_t lock;
+    //! Calls waiting for their X-Call-Id parent, by X-Call-Id
+    htable_t *xcalls_pending;
 
     //! Full count of all captured calls, regardless of rotation
     int call_count_unrotated;
+    //! Counters of stored calls and messages
+    sip_counters_t counters;
+    //! Calls removed from the list by rotation
+    uint64_t rotated;
+    //! Calls removed from the list by expiration
+    uint64_t expired;
+    //! Seconds without messages before completed INVITE dialogs expire (0 never)
+    int expire_completed;
+    //! Seconds without messages before non INVITE dialogs expire (0 never)
+    int expire_noninvite;
+    //! Seconds without messages before INVITE dialogs in setup expire (0 never)
+    int expire_setup;
+    //! Calls pending expiration check, by check time second
+    sip_call_t *expire_wheel[SIP_EXPIRE_SLOTS];
+    //! Last checked expiration wheel second
+    time_t expire_last;
     // Max call limit
     int limit;
+    //! Max memory used by stored calls in bytes (0 for no limit)
+    uint64_t memory_limit;
+    //! Memory used by stored calls in bytes
+    uint64_t memory;
     //! Only store dialogs starting with INVITE
     int only_calls;
     //! Only store dialogs starting with some Methods
@@ -154,20 +251,15 @@ struct sip_call_list {
 #endif
     //! Invert match expression result
     int match_invert;
+    //! Match expression is case insensitive
+    bool match_caseless;
+    //! Text required to match the expression
+    char match_literal[EXPR_LITERAL_MAXLEN];
+    //! Match expression is just the required text
+    bool match_literal_only;
+    //! Patterns loaded from match file
+    match_set_t *match_set;
 
-    //! Regexp for payload matching
-    regex_t reg_method;
-    regex_t reg_callid;
-    regex_t reg_xcallid;
-    regex_t reg_response;
-    regex_t reg_cseq;
-    regex_t reg_from;
-    regex_t reg_to;
-    regex_t reg_valid;
-    regex_t reg_cl;
-    regex_t reg_body;
-    regex_t reg_reason;
-    regex_t reg_warning;
 };
 
 /**
@@ -192,11 +284,12 @@ sip_deinit();
  * Mainly used to check if a payload contains a callid.
  *
  * @param payload SIP message payload
+ * @param scan Payload headers positions
  * @param callid Character array to store callid
  * @return callid parsed from Call-ID header
  */
 char *
-sip_get_callid(const char* payload, char *callid);
+sip_get_callid(const char* payload, const sip_scan_t *scan, char *callid);
 
 /**
  * @brief Parses X-Call-ID header of a SIP message payload
@@ -204,11 +297,12 @@ sip_get_callid(const char* payload, char *callid);
  * Mainly used to check if a payload contains a xcallid.
  *
  * @param payload SIP message payload
- * @paramx callid Character array to store callid
- * @return xcallid parsed from Call-ID header
+ * @param scan Payload headers positions
+ * @param xcallid Character array to store xcallid
+ * @return xcallid parsed from X-Call-ID header
  */
 char *
-sip_get_xcallid(const char* payload, char *xcallid);
+sip_get_xcallid(const char* payload, const sip_scan_t *scan, char *xcallid);
 
 /**
  * @brief Validate the packet payload is a SIP message
@@ -221,6 +315,9 @@ sip_get_xcallid(const char* payload, char *xcallid);
  * This function will only be used for TCP captured packets, when the
  * Content-Length header field is a MUST.
  *
+ * Headers located in complete messages are kept in the packet, so
+ * sip_check_packet does not scan the payload again.
+ *
  * @param packet TCP assembled packet structure
  * @return -1 if the packet first line doesn't match a SIP message
  * @return 0 if the packet contains SIP but is not yet complete
@@ -253,6 +350,27 @@ sip_check_packet(packet_t *packet);
 bool
 sip_calls_has_changed();
 
+/**
+ * @brief Get the file descriptor signaled when calls change
+ *
+ * The interface can poll this descriptor alongside its input instead
+ * of checking the call list periodically. Multiple changes are merged
+ * into a single notification until @sip_calls_notify_clear is called.
+ *
+ * @return readable end of notification pipe or -1 if not available
+ */
+int
+sip_calls_notify_fd();
+
+/**
+ * @brief Consume pending call changes notifications
+ *
+ * This must be invoked before checking what has changed, so changes
+ * done after the check will signal the descriptor again.
+ */
+void
+sip_calls_notify_clear();
+
 /**
  * @brief Getter for calls linked list size
  *
@@ -269,6 +387,18 @@ sip_calls_count();
 int
 sip_calls_count_unrotated();
 
+/**
+ * @brief Return the number of calls removed by rotation
+ */
+uint64_t
+sip_calls_rotated();
+
+/**
+ * @brief Return the number of calls removed by expiration
+ */
+uint64_t
+sip_calls_expired();
+
 /**
  * @brief Return an iterator of call list
  */
@@ -306,6 +436,40 @@ sip_calls_vector();
 vector_t *
 sip_active_calls_vector();
 
+/**
+ * @brief Return the list of calls matching display filters
+ *
+ * This list is only updated by @sip_calls_filter_update, while calls
+ * are locked, so new calls are only checked once instead of filtering
+ * the whole call list on each refresh.
+ */
+vector_t *
+sip_calls_filtered_vector();
+
+/**
+ * @brief Check pending calls against display filters
+ *
+ * Up to SIP_FILTER_CHUNK calls are checked on each invocation. If
+ * more calls are pending, the list is flagged as changed so they are
+ * checked in the next interface refresh.
+ *
+ * Displayed calls whose payload filter evaluation was paused by capture
+ * overload are checked again once capture is no longer overloaded.
+ *
+ * @return number of calls still pending evaluation
+ */
+int
+sip_calls_filter_update();
+
+/**
+ * @brief Evaluate again display filters for all calls
+ *
+ * Empty the filtered calls list and set all calls as pending. This
+ * must be invoked after changing display filters.
+ */
+void
+sip_calls_filter_reset();
+
 /**
  * @brief Return stats from call list
  *
@@ -315,6 +479,14 @@ sip_active_calls_vector();
 sip_stats_t
 sip_calls_stats();
 
+/**
+ * @brief Get counters of stored calls and messages
+ *
+ * @param counters Copy of current counters
+ */
+void
+sip_calls_counters(sip_counters_t *counters);
+
 
 /**
  * @brief Find a call structure in calls linked list given a call index
@@ -334,6 +506,59 @@ sip_find_by_index(int index);
 sip_call_t *
 sip_find_by_callid(const char *callid);
 
+/**
+ * @brief Get the call store shard for a given Call-ID
+ *
+ * @param callid Call-ID Header value
+ * @return shard index
+ */
+int
+sip_callid_shard(const char *callid);
+
+/**
+ * @brief Get the call store shard for a packet payload
+ *
+ * This performs a quick search of Call-ID header without fully
+ * validating the payload.
+ *
+ * @param packet Packet with SIP payload
+ * @return shard index or -1 if payload has no SIP start line or Call-ID header
+ */
+int
+sip_packet_shard(packet_t *packet);
+
+/**
+ * @brief Get the number of call store shards
+ */
+int
+sip_calls_shard_count();
+
+/**
+ * @brief Lock the calls of one shard
+ */
+void
+sip_calls_lock_shard(int shard);
+
+/**
+ * @brief Unlock the calls of one shard
+ */
+void
+sip_calls_unlock_shard(int shard);
+
+/**
+ * @brief Lock the calls of all shards
+ *
+ * This must be done before accessing calls from the merged view
+ */
+void
+sip_calls_lock();
+
+/**
+ * @brief Unlock the calls of all shards
+ */
+void
+sip_calls_unlock();
+
 
 /**
  * @brief Parse extra fields only for dialogs strarting with invite
@@ -342,15 +567,17 @@ sip_find_by_callid(const char *callid);
  *
  * @param msg SIP message structure
  * @param payload SIP message payload
+ * @param scan Payload headers positions
  */
 void
-sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload);
+sip_parse_extra_headers(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan);
 
 /**
  * @brief Remove al calls
  *
- * This funtion will clear the call list invoking the destroy
- * function for each one.
+ * An empty call store replaces the current one, whose calls are
+ * released by a low priority thread, so clearing does not depend on
+ * the number of stored calls.
  */
 void
 sip_calls_clear();
@@ -359,30 +586,95 @@ sip_calls_clear();
  * @brief Remove al calls
  *
  * This funtion will clear the call list of calls other than ones
- * fitting the current filter
+ * fitting the current filter. Removed calls are released by a low
+ * priority thread.
  */
 void
 sip_calls_clear_soft();
 
+/**
+ * @brief Set max memory used by stored calls
+ *
+ * Oldest unlocked calls are removed when new calls are created and
+ * stored calls memory exceeds this limit.
+ *
+ * @param limit Max memory in bytes (0 for no limit)
+ */
+void
+sip_set_memory_limit(uint64_t limit);
+
+/**
+ * @brief Get memory used by stored calls
+ *
+ * @param limit Max memory in bytes (0 for no limit)
+ * @return memory used by all calls in bytes
+ */
+uint64_t
+sip_calls_memory(uint64_t *limit);
+
+/**
+ * @brief Account memory allocated or released by a call
+ *
+ * @param delta Bytes allocated (positive) or released (negative)
+ */
+void
+sip_calls_memory_update(int64_t delta);
+
+/**
+ * @brief Unlink a call from its related calls before destroying it
+ *
+ * Calls related with this call by X-Call-Id wait again for a new call
+ * with this Call-Id. This must be invoked with calls lock taken or all
+ * shards locked.
+ */
+void
+sip_calls_xcall_remove(sip_call_t *call);
+
 /**
  * @brief Remove first call in the call list
  *
  * This function removes the first call in the calls vector avoiding
- * reaching the capture limit.
+ * reaching the capture limit. Calls from shards being modified by other
+ * threads are skipped.
+ *
+ * @return 0 if a call has been removed, 1 otherwise
  */
-void
+int
 sip_calls_rotate();
 
+/**
+ * @brief Check if any dialog expiration timeout is configured
+ */
+bool
+sip_calls_expire_enabled();
+
+/**
+ * @brief Remove calls without messages for longer than their timeout
+ *
+ * Calls are stored in a timing wheel with one slot per second, so only
+ * the calls scheduled for the seconds elapsed since last check are
+ * visited. Calls not expired yet are scheduled again for the time they
+ * would expire. Locked calls never expire.
+ *
+ * Capture must be locked while calling this function.
+ *
+ * @param now Current time
+ */
+void
+sip_calls_expire(time_t now);
+
 /**
  * @brief Get message Request/Response code
  *
  * Parse Payload to get Message Request/Response code.
  *
  * @param msg SIP Message to be parsed
+ * @param payload SIP message payload
+ * @param scan Payload headers positions
  * @return numeric representation of Request/ResponseCode
  */
 int
-sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload);
+sip_get_msg_reqresp(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan);
 
 /**
  * @brief Get full Response code (including text)
@@ -412,21 +704,36 @@ sip_parse_msg(sip_msg_t *msg);
  *
  * @param msg SIP message structure
  * @param payload SIP message payload
+ * @param scan Payload headers positions
  * @return 0 in all cases
  */
 int
-sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload);
+sip_parse_msg_payload(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan);
+
+/**
+ * @brief Replace the frames of a stored message
+ *
+ * Used when the frames of a message received as a probe summary are
+ * fetched. Headers positions are parsed again from the new payload.
+ *
+ * @param msg Stored message with its call locked
+ * @param data Packet with the message frames, destroyed on success
+ * @return 0 if frames have been replaced, 1 otherwise
+ */
+int
+sip_msg_set_data(sip_msg_t *msg, packet_t *data);
 
 /**
  * @brief Parse SIP Message payload for SDP media streams
  *
- * Parse the payload content to get SDP information
+ * Parse the body lines in place to get SDP information
  *
  * @param msg SIP message structure
- * @return 0 in all cases
+ * @param payload SIP message payload
+ * @param scan Payload headers positions
  */
 void
-sip_parse_msg_media(sip_msg_t *msg, const u_char *payload);
+sip_parse_msg_media(sip_msg_t *msg, const u_char *payload, const sip_scan_t *scan);
 
 /**
  * @brief Set Capture Matching expression
@@ -447,6 +754,29 @@ sip_set_match_expression(const char *expr, int insensitive, int invert);
 const char *
 sip_get_match_expression();
 
+/**
+ * @brief Load a set of match patterns from a file
+ *
+ * New dialogs will be stored only if their first message matches any
+ * of the patterns. This can be combined with the match expression.
+ *
+ * @param file File with one pattern per line
+ * @param insensitive 1 for case insensitive matching
+ * @param invert 1 for reverse matching
+ * @return 0 on success, -1 if file can not be read, line number
+ * of the first invalid pattern otherwise
+ */
+int
+sip_set_match_file(const char *file, int insensitive, int invert);
+
+/**
+ * @brief Get the set of patterns loaded from match file
+ *
+ * @return pattern set or NULL if no match file has been loaded
+ */
+match_set_t *
+sip_get_match_set();
+
 /**
  * @brief Checks if a given payload matches expression
  *
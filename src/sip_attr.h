@@ -85,6 +85,14 @@ enum sip_attr_id {
     SIP_ATTR_REASON_TXT,
     //! Warning Header
     SIP_ATTR_WARNING,
+    //! Transactions accounted in a compaction row
+    SIP_ATTR_COMPACTED,
+    //! Time of the last transaction of a compaction row
+    SIP_ATTR_LASTSEEN,
+    //! Average round trip time of a compaction row
+    SIP_ATTR_RTT,
+    //! Final response codes of a compaction row
+    SIP_ATTR_CODES,
     //! SIP Attribute count
     SIP_ATTR_COUNT
 };
@@ -32,6 +32,66 @@
 #include "sip_call.h"
 #include "sip.h"
 #include "setting.h"
+#include "strpool.h"
+#include "capture.h"
+#include "storage.h"
+#include "report.h"
+#include "compact.h"
+
+//! Hot fields of all calls
+sip_call_slots_t call_slots = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Get a free slot for call hot fields
+ *
+ * Slots of released calls are reused first. Pages are allocated when all
+ * slots of previous pages have been used.
+ *
+ * @return 0 on success, 1 if there are no free slots
+ */
+static int
+call_slot_alloc(sip_call_t *call)
+{
+    sip_call_page_t *page;
+    int ret = 0;
+
+    pthread_mutex_lock(&call_slots.lock);
+    if (call_slots.free_count) {
+        call->slot = call_slots.free[--call_slots.free_count];
+    } else if (call_slots.count % SIP_CALL_SLOT_PAGE) {
+        call->slot = call_slots.count++;
+    } else if (call_slots.count / SIP_CALL_SLOT_PAGE < SIP_CALL_SLOT_PAGES
+               && (page = sng_malloc_tag(MEMSTAT_CALLS, sizeof(sip_call_page_t)))) {
+        call_slots.pages[call_slots.count / SIP_CALL_SLOT_PAGE] = page;
+        call->slot = call_slots.count++;
+    } else {
+        ret = 1;
+    }
+    pthread_mutex_unlock(&call_slots.lock);
+    return ret;
+}
+
+/**
+ * @brief Make the slot of a released call available for new calls
+ */
+static void
+call_slot_release(sip_call_t *call)
+{
+    uint32_t *free_slots, size;
+
+    pthread_mutex_lock(&call_slots.lock);
+    if (call_slots.free_count == call_slots.free_size) {
+        size = (call_slots.free_size) ? call_slots.free_size * 2 : SIP_CALL_SLOT_PAGE;
+        if ((free_slots = realloc(call_slots.free, size * sizeof(uint32_t)))) {
+            call_slots.free = free_slots;
+            call_slots.free_size = size;
+        }
+    }
+    // Slot is not reused if there is no memory to remember it
+    if (call_slots.free_count < call_slots.free_size)
+        call_slots.free[call_slots.free_count++] = call->slot;
+    pthread_mutex_unlock(&call_slots.lock);
+}
 
 sip_call_t *
 call_create(char *callid, char *xcallid)
@@ -39,9 +99,24 @@ call_create(char *callid, char *xcallid)
     sip_call_t *call;
 
     // Initialize a new call structure
-    if (!(call = sng_malloc(sizeof(sip_call_t))))
+    if (!(call = sng_malloc_tag(MEMSTAT_CALLS, sizeof(sip_call_t))))
         return NULL;
 
+    // Hot fields are stored apart, in the call slot
+    if (call_slot_alloc(call) != 0) {
+        sng_free_tag(MEMSTAT_CALLS, call, sizeof(sip_call_t));
+        return NULL;
+    }
+    CALL_SLOT(call, index) = 0;
+    CALL_SLOT(call, state) = 0;
+    CALL_SLOT(call, filter_checked) = 0;
+    CALL_SLOT(call, filter_matched) = 0;
+    CALL_SLOT(call, changed) = false;
+    CALL_SLOT(call, locked) = false;
+
+    // All call related data will be allocated here
+    arena_init(&call->arena);
+
     // Create a vector to store call messages
     call->msgs = vector_create(2, 2);
     vector_set_destroyer(call->msgs, msg_destroyer);
@@ -52,19 +127,19 @@ call_create(char *callid, char *xcallid)
         vector_set_destroyer(call->rtp_packets, packet_destroyer);
     }
 
-    // Create an empty vector to strore stream data
+    // Create an empty vector to strore stream data (allocated in call arena)
     call->streams = vector_create(0, 2);
-    vector_set_destroyer(call->streams, vector_generic_destroyer);
 
     // Create an empty vector to store x-calls
     call->xcalls = vector_create(0, 1);
 
     // Initialize call filter status
-    call->filtered = -1;
+    CALL_SLOT(call, filtered) = -1;
+    call->rtp_store = -1;
 
     // Set message callid
-    call->callid = strdup(callid);
-    call->xcallid = strdup(xcallid);
+    call->callid = arena_strdup(&call->arena, callid);
+    call->xcallid = strpool_get(xcallid, strlen(xcallid));
 
     return call;
 }
@@ -72,19 +147,54 @@ call_create(char *callid, char *xcallid)
 void
 call_destroy(sip_call_t *call)
 {
+    call_unlink(call);
+    call_free(call);
+}
+
+void
+call_unlink(sip_call_t *call)
+{
+    rtp_stream_t *stream;
+    vector_iter_t it;
+
+    // Account removed dialog in statistics report
+    report_call(call);
+    // Account removed dialog in its compaction row
+    compact_call_remove(call);
+    // Unlink from related calls
+    sip_calls_xcall_remove(call);
+    // Streams are allocated in call memory
+    it = vector_iterator(call->streams);
+    while ((stream = vector_iterator_next(&it)))
+        stream_index_remove(stream);
+    // Release expanded compressed frames
+    storage_call_remove(call);
+    // Call memory is no longer accounted
+    sip_calls_memory_update(-(int64_t) call->memory);
+}
+
+void
+call_free(sip_call_t *call)
+{
+    // Release disk storage of call packets
+    storage_call_release(call);
     // Remove all call messages
     vector_destroy(call->msgs);
     // Remove all call streams
     vector_destroy(call->streams);
+    htable_destroy(call->streams_dst);
     // Remove all call rtp packets
     vector_destroy(call->rtp_packets);
     // Remove all xcalls
     vector_destroy(call->xcalls);
+    // Remove retransmissions index
+    htable_destroy(call->retrans);
     // Deallocate call memory
-    sng_free(call->callid);
-    sng_free(call->xcallid);
-    sng_free(call->reasontxt);
-    sng_free(call);
+    strpool_put(call->xcallid);
+    strpool_put(call->reasontxt);
+    arena_release(&call->arena);
+    call_slot_release(call);
+    sng_free_tag(MEMSTAT_CALLS, call, sizeof(sip_call_t));
 }
 
 void
@@ -93,10 +203,85 @@ call_destroyer(void *call)
     call_destroy((sip_call_t*)call);
 }
 
+void
+call_slots_filter_reset(uint16_t filters)
+{
+    sip_call_page_t *page;
+    uint32_t count, i, len;
+    int p;
+
+    pthread_mutex_lock(&call_slots.lock);
+    count = call_slots.count;
+    pthread_mutex_unlock(&call_slots.lock);
+
+    // Free slots are also reset, they are initialized when reused
+    for (p = 0; (uint32_t) p * SIP_CALL_SLOT_PAGE < count; p++) {
+        page = call_slots.pages[p];
+        len = count - p * SIP_CALL_SLOT_PAGE;
+        if (len > SIP_CALL_SLOT_PAGE)
+            len = SIP_CALL_SLOT_PAGE;
+        for (i = 0; i < len; i++) {
+            page->filter_checked[i] &= ~filters;
+            page->filter_matched[i] &= ~filters;
+        }
+        memset(page->filtered, -1, len);
+    }
+}
+
 bool
 call_has_changed(sip_call_t *call)
 {
-    return call->changed;
+    return CALL_SLOT(call, changed);
+}
+
+/**
+ * @brief Keep packet frames while the call is stored
+ *
+ * Frames are moved to call memory, kept until the call is compressed when
+ * using compressed storage, or written to disk storage log.
+ *
+ * Retransmissions stored in memory share the payload of their original
+ * message packet, keeping only their own frame headers.
+ *
+ * @param orig Stored packet with the same payload or NULL
+ */
+static void
+call_store_packet(sip_call_t *call, packet_t *packet, packet_t *orig)
+{
+    switch (capture_storage()) {
+        case CAPTURE_STORAGE_NONE:
+            if (orig && packet_share_payload(packet, orig, &call->arena) == 0)
+                break;
+            // Only a copy of the payload will be kept
+            call->packets_memory += packet_payloadlen(packet) + 1;
+            break;
+        case CAPTURE_STORAGE_COMPRESSED:
+            storage_call_update(call, packet);
+            break;
+        case CAPTURE_STORAGE_INDEX:
+            // Frames not read from a mapped file are kept in call memory
+            if (storage_packet_index(call, packet) == 0)
+                break;
+            packet_set_arena(packet, &call->arena);
+            break;
+        case CAPTURE_STORAGE_DISK:
+            // Keep data in call memory if it can not be written
+            if (storage_packet_store(call, packet) == 0)
+                break;
+            packet_set_arena(packet, &call->arena);
+            break;
+        default:
+            if (orig && packet_share_payload(packet, orig, &call->arena) == 0)
+                break;
+            packet_set_arena(packet, &call->arena);
+            break;
+    }
+
+    // Frames data not moved to call memory
+    if (!packet->arena && capture_storage() != CAPTURE_STORAGE_NONE)
+        call->packets_memory += packet_data_copy(packet, NULL);
+    call->packets_memory += sizeof(packet_t);
+    call_update_memory(call);
 }
 
 void
@@ -104,10 +289,26 @@ call_add_message(sip_call_t *call, sip_msg_t *msg)
 {
     // Set the message owner
     msg->call = call;
+    // Check if message is a retransmission before storing its frames
+    call_msg_retrans_check(msg);
+    // Keep stored frames in call memory
+    call_store_packet(call, msg->packet, (msg->retrans) ? msg->retrans->packet : NULL);
     // Put this msg at the end of the msg list
     msg->index = vector_append(call->msgs, msg);
     // Flag this call as changed
-    call->changed = true;
+    CALL_SLOT(call, changed) = true;
+}
+
+static uint32_t
+call_stream_hash(const void *key)
+{
+    return address_hash(*(const address_t *) key, true);
+}
+
+static bool
+call_stream_equal(const void *key1, const void *key2)
+{
+    return addressport_equals(*(const address_t *) key1, *(const address_t *) key2);
 }
 
 void
@@ -115,17 +316,45 @@ call_add_stream(sip_call_t *call, rtp_stream_t *stream)
 {
     // Store stream
     vector_append(call->streams, stream);
+    // Newest stream is indexed by its destination
+    if (!call->streams_dst)
+        call->streams_dst = htable_create_custom(0, call_stream_hash, call_stream_equal);
+    if (call->streams_dst) {
+        htable_remove(call->streams_dst, &stream->dst);
+        htable_insert(call->streams_dst, &stream->dst, stream);
+    }
+    // Allow finding this stream from its packets
+    stream_index_add(stream);
     // Flag this call as changed
-    call->changed = true;
+    CALL_SLOT(call, changed) = true;
 }
 
 void
 call_add_rtp_packet(sip_call_t *call, packet_t *packet)
 {
+    // Keep stored frames in call memory
+    call_store_packet(call, packet, NULL);
     // Store packet
     vector_append(call->rtp_packets, packet);
     // Flag this call as changed
-    call->changed = true;
+    CALL_SLOT(call, changed) = true;
+}
+
+void
+call_update_memory(sip_call_t *call)
+{
+    size_t memory = sizeof(sip_call_t) + call->arena.size + call->packets_memory;
+
+    sip_calls_memory_update((int64_t) memory - (int64_t) call->memory);
+    call->memory = memory;
+}
+
+rtp_stream_t *
+call_find_stream(sip_call_t *call, address_t dst)
+{
+    if (!call->streams_dst)
+        return NULL;
+    return htable_find(call->streams_dst, &dst);
 }
 
 int
@@ -137,7 +366,7 @@ call_msg_count(sip_call_t *call)
 int
 call_is_active(sip_call_t *call)
 {
-    return (call->state == SIP_CALLSTATE_CALLSETUP || call->state == SIP_CALLSTATE_INCALL);
+    return (CALL_SLOT(call, state) == SIP_CALLSTATE_CALLSETUP || CALL_SLOT(call, state) == SIP_CALLSTATE_INCALL);
 }
 
 int
@@ -150,25 +379,44 @@ call_is_invite(sip_call_t *call)
     return 0;
 }
 
+static uint32_t
+call_retrans_hash(const void *key)
+{
+    const sip_msg_t *msg = key;
+    return (uint32_t) (msg->hash ^ (msg->hash >> 32))
+           ^ address_hash(msg->packet->src, true)
+           ^ (address_hash(msg->packet->dst, true) * 31);
+}
+
+static bool
+call_retrans_equal(const void *key1, const void *key2)
+{
+    const sip_msg_t *msg1 = key1, *msg2 = key2;
+    return msg1->hash == msg2->hash
+           && msg1->packet->payload_len == msg2->packet->payload_len
+           && addressport_equals(msg1->packet->src, msg2->packet->src)
+           && addressport_equals(msg1->packet->dst, msg2->packet->dst);
+}
+
 void
 call_msg_retrans_check(sip_msg_t *msg)
 {
-    sip_msg_t *prev = NULL;
-    vector_iter_t it;
+    sip_call_t *call = msg->call;
+    sip_msg_t *prev;
 
-    // Get previous message in call with same origin and destination
-    it = vector_iterator(msg->call->msgs);
-    vector_iterator_set_current(&it, vector_index(msg->call->msgs, msg));
-    while ((prev = vector_iterator_prev(&it))) {
-        if (addressport_equals(prev->packet->src, msg->packet->src) &&
-                addressport_equals(prev->packet->dst, msg->packet->dst))
-            break;
-    }
+    if (!call->retrans && !(call->retrans = htable_create_custom(0, call_retrans_hash, call_retrans_equal)))
+        return;
 
-    // Store the flag that determines if message is retrans
-    if (prev && !strcasecmp(msg_get_payload(msg), msg_get_payload(prev))) {
-        msg->retrans = prev;
+    // Get last message in call with same origin, destination and payload hash
+    if ((prev = htable_find(call->retrans, msg))) {
+        // Only compare payloads when hashes match
+        if (!memcmp(msg_get_payload(msg), msg_get_payload(prev), packet_payloadlen(msg->packet)))
+            msg->retrans = prev;
+        htable_remove(call->retrans, prev);
     }
+
+    // This is now the last message with this key
+    htable_insert(call->retrans, msg, msg);
 }
 
 sip_msg_t *
@@ -205,41 +453,41 @@ call_update_state(sip_call_t *call, sip_msg_t *msg)
     reqresp = msg->reqresp;
 
     // If this message is actually a call, get its current state
-    if (call->state) {
-        if (call->state == SIP_CALLSTATE_CALLSETUP) {
+    if (CALL_SLOT(call, state)) {
+        if (CALL_SLOT(call, state) == SIP_CALLSTATE_CALLSETUP) {
             if (reqresp == SIP_METHOD_ACK && call->invitecseq == msg->cseq) {
                 // Alice and Bob are talking
-                call->state = SIP_CALLSTATE_INCALL;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_INCALL;
                 call->cstart_msg = msg;
             } else if (reqresp == SIP_METHOD_CANCEL) {
                 // Alice is not in the mood
-                call->state = SIP_CALLSTATE_CANCELLED;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_CANCELLED;
             } else if ((reqresp == 480) || (reqresp == 486) || (reqresp == 600 )) {
                 // Bob is busy
-                call->state = SIP_CALLSTATE_BUSY;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_BUSY;
             } else if (reqresp > 400 && call->invitecseq == msg->cseq) {
                 // Bob is not in the mood
-                call->state = SIP_CALLSTATE_REJECTED;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_REJECTED;
             } else if (reqresp == 181 || reqresp == 302 || reqresp == 301) {
                 // Bob has diversion
-                call->state = SIP_CALLSTATE_DIVERTED;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_DIVERTED;
             }
-        } else if (call->state == SIP_CALLSTATE_INCALL) {
+        } else if (CALL_SLOT(call, state) == SIP_CALLSTATE_INCALL) {
             if (reqresp == SIP_METHOD_BYE) {
                 // Thanks for all the fish!
-                call->state = SIP_CALLSTATE_COMPLETED;
+                CALL_SLOT(call, state) = SIP_CALLSTATE_COMPLETED;
                 call->cend_msg = msg;
             }
-        } else if (reqresp == SIP_METHOD_INVITE && call->state !=  SIP_CALLSTATE_INCALL) {
+        } else if (reqresp == SIP_METHOD_INVITE && CALL_SLOT(call, state) !=  SIP_CALLSTATE_INCALL) {
             // Call is being setup (after proper authentication)
             call->invitecseq = msg->cseq;
-            call->state = SIP_CALLSTATE_CALLSETUP;
+            CALL_SLOT(call, state) = SIP_CALLSTATE_CALLSETUP;
         }
     } else {
         // This is actually a call
         if (reqresp == SIP_METHOD_INVITE) {
             call->invitecseq = msg->cseq;
-            call->state = SIP_CALLSTATE_CALLSETUP;
+            CALL_SLOT(call, state) = SIP_CALLSTATE_CALLSETUP;
         }
     }
 }
@@ -254,7 +502,7 @@ call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
 
     switch (id) {
         case SIP_ATTR_CALLINDEX:
-            sprintf(value, "%d", call->index);
+            sprintf(value, "%d", CALL_SLOT(call, index));
             break;
         case SIP_ATTR_CALLID:
             sprintf(value, "%s", call->callid);
@@ -266,7 +514,7 @@ call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
             sprintf(value, "%d", vector_count(call->msgs));
             break;
         case SIP_ATTR_CALLSTATE:
-            sprintf(value, "%s", call_state_to_str(call->state));
+            sprintf(value, "%s", call_state_to_str(CALL_SLOT(call, state)));
             break;
         case SIP_ATTR_TRANSPORT:
             first = vector_first(call->msgs);
@@ -288,6 +536,11 @@ call_get_attribute(sip_call_t *call, enum sip_attr_id id, char *value)
             if (call->warning)
                 sprintf(value, "%d", call->warning);
             break;
+        case SIP_ATTR_COMPACTED:
+        case SIP_ATTR_LASTSEEN:
+        case SIP_ATTR_RTT:
+        case SIP_ATTR_CODES:
+            return compact_get_attribute(call, id, value);
         default:
             return msg_get_attribute(vector_first(call->msgs), id, value);
             break;
@@ -318,51 +571,170 @@ call_state_to_str(int state)
     return "";
 }
 
-int
-call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id)
+void
+call_updated(sip_call_t *call)
 {
-    char onevalue[256], twovalue[256];
-    int oneintvalue, twointvalue;
-    int comparetype; /* TODO 0 = string compare, 1 = int comprare */
+    call->version++;
+}
 
+/**
+ * @brief Check if an attribute is compared by its numeric value
+ */
+static bool
+call_attr_is_numeric(enum sip_attr_id id)
+{
     switch (id) {
         case SIP_ATTR_CALLINDEX:
-            oneintvalue = one->index;
-            twointvalue = two->index;
-            comparetype = 1;
-            break;
         case SIP_ATTR_MSGCNT:
-            oneintvalue = call_msg_count(one);
-            twointvalue = call_msg_count(two);
-            comparetype = 1;
-            break;
+        case SIP_ATTR_CONVDUR:
+        case SIP_ATTR_TOTALDUR:
+        case SIP_ATTR_WARNING:
+        case SIP_ATTR_DATE:
+        case SIP_ATTR_TIME:
+        case SIP_ATTR_COMPACTED:
+        case SIP_ATTR_LASTSEEN:
+        case SIP_ATTR_RTT:
+            return true;
         default:
-            // Get attribute values
-            memset(onevalue, 0, sizeof(onevalue));
-            memset(twovalue, 0, sizeof(twovalue));
-            call_get_attribute(one, id, onevalue);
-            call_get_attribute(two, id, twovalue);
-            comparetype = 0;
-            break;
+            return false;
     }
+}
+
+/**
+ * @brief Calculate the numeric value of an attribute
+ *
+ * Dates and times are compared in local time like their text values.
+ *
+ * @return false if attribute has no value
+ */
+static bool
+call_attr_numeric_value(sip_call_t *call, enum sip_attr_id id, int64_t *value)
+{
+    sip_msg_t *first = vector_first(call->msgs), *last = vector_last(call->msgs);
+    struct timeval start, end;
+    struct tm tm;
+    time_t t;
 
-    switch (comparetype) {
-        case 0:
-            if (strlen(twovalue) == 0 && strlen(onevalue) == 0)
-                return 0;
-            if (strlen(twovalue) == 0)
-                return 1;
-            if (strlen(onevalue) == 0)
-                return -1;
-            return strcmp(onevalue, twovalue);
-        case 1:
-            if (oneintvalue == twointvalue) return 0;
-            if (oneintvalue > twointvalue) return 1;
-            if (oneintvalue < twointvalue) return -1;
-            /* no break */
+    switch (id) {
+        case SIP_ATTR_CALLINDEX:
+            *value = CALL_SLOT(call, index);
+            return true;
+        case SIP_ATTR_MSGCNT:
+            *value = call_msg_count(call);
+            return true;
+        case SIP_ATTR_CONVDUR:
+        case SIP_ATTR_TOTALDUR:
+            if (id == SIP_ATTR_CONVDUR) {
+                start = msg_get_time(call->cstart_msg);
+                end = msg_get_time(call->cend_msg);
+            } else {
+                start = msg_get_time(first);
+                end = msg_get_time(last);
+            }
+            if (!start.tv_sec || !end.tv_sec)
+                return false;
+            *value = end.tv_sec - start.tv_sec;
+            return true;
+        case SIP_ATTR_WARNING:
+            *value = call->warning;
+            return call->warning != 0;
+        case SIP_ATTR_DATE:
+        case SIP_ATTR_TIME:
+            if (!first)
+                return false;
+            start = msg_get_time(first);
+            t = start.tv_sec;
+            localtime_r(&t, &tm);
+            if (id == SIP_ATTR_DATE) {
+                *value = (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+            } else {
+                *value = ((tm.tm_hour * 60 + tm.tm_min) * 60 + tm.tm_sec) * (int64_t) 1000000 + start.tv_usec;
+            }
+            return true;
+        case SIP_ATTR_COMPACTED:
+            if (!call->compact)
+                return false;
+            *value = call->compact->count;
+            return true;
+        case SIP_ATTR_LASTSEEN:
+            if (!call->compact)
+                return false;
+            *value = call->compact->last.tv_sec * (int64_t) 1000000 + call->compact->last.tv_usec;
+            return true;
+        case SIP_ATTR_RTT:
+            if (!call->compact || !call->compact->rtt_count)
+                return false;
+            *value = call->compact->rtt_sum / call->compact->rtt_count;
+            return true;
         default:
-            return 0;
+            return false;
+    }
+}
+
+/**
+ * @brief Get the cached sort key of a call, calculating it if required
+ */
+static sip_call_sort_key_t *
+call_sort_key(sip_call_t *call, enum sip_attr_id id)
+{
+    sip_call_sort_key_t *key = &call->sort_key;
+    uint32_t version = call->version;
+    char value[SIP_ATTR_MAXLEN + 1];
+
+    if (key->valid && key->attr == id && key->version == version)
+        return key;
+
+    if (call_attr_is_numeric(id)) {
+        key->empty = !call_attr_numeric_value(call, id, &key->num);
+    } else {
+        value[0] = '\0';
+        call_get_attribute(call, id, value);
+        key->empty = !strlen(value);
+        key->truncated = strlen(value) >= sizeof(key->text);
+        strncpy(key->text, value, sizeof(key->text));
+    }
+
+    key->attr = id;
+    key->version = version;
+    key->valid = true;
+    return key;
+}
+
+int
+call_attr_compare(sip_call_t *one, sip_call_t *two, enum sip_attr_id id)
+{
+    char onevalue[SIP_ATTR_MAXLEN + 1], twovalue[SIP_ATTR_MAXLEN + 1];
+    sip_call_sort_key_t *onekey, *twokey;
+    int cmp;
+
+    // Shared strings with the same content have the same address
+    if ((id == SIP_ATTR_XCALLID && one->xcallid == two->xcallid)
+        || (id == SIP_ATTR_REASON_TXT && one->reasontxt == two->reasontxt))
+        return 0;
+
+    onekey = call_sort_key(one, id);
+    twokey = call_sort_key(two, id);
+
+    // Calls without value are displayed first
+    if (onekey->empty || twokey->empty)
+        return twokey->empty - onekey->empty;
+
+    if (call_attr_is_numeric(id)) {
+        if (onekey->num == twokey->num) return 0;
+        return (onekey->num > twokey->num) ? 1 : -1;
     }
+
+    // Most text values are different in their first bytes
+    cmp = strncmp(onekey->text, twokey->text, sizeof(onekey->text));
+    if (cmp != 0 || (!onekey->truncated && !twokey->truncated))
+        return cmp;
+
+    // Compare complete values
+    memset(onevalue, 0, sizeof(onevalue));
+    memset(twovalue, 0, sizeof(twovalue));
+    call_get_attribute(one, id, onevalue);
+    call_get_attribute(two, id, twovalue);
+    return strcmp(onevalue, twovalue);
 }
 
 void
@@ -372,7 +744,8 @@ call_add_xcall(sip_call_t *call, sip_call_t *xcall)
         return;
 
     // Mark this call as changed
-    call->changed = true;
+    CALL_SLOT(call, changed) = true;
     // Add the xcall to the list
     vector_append(call->xcalls, xcall);
+    xcall->xparent = call;
 }
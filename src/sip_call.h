@@ -32,13 +32,33 @@
 #include "config.h"
 #include <stdarg.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include "vector.h"
+#include "hash.h"
+#include "arena.h"
 #include "rtp.h"
 #include "sip_msg.h"
 #include "sip_attr.h"
 
 //! Shorter declaration of sip_call structure
 typedef struct sip_call sip_call_t;
+//! Shorter declaration of sip_call_sort_key structure
+typedef struct sip_call_sort_key sip_call_sort_key_t;
+//! Shorter declaration of sip_call_page structure
+typedef struct sip_call_page sip_call_page_t;
+//! Shorter declaration of sip_call_slots structure
+typedef struct sip_call_slots sip_call_slots_t;
+
+//! Bytes of text attributes stored in call sort key
+#define SIP_CALL_SORT_PREFIX 32
+//! Call slots in each page of hot fields
+#define SIP_CALL_SLOT_PAGE 4096
+//! Max pages of hot fields
+#define SIP_CALL_SLOT_PAGES 4096
+
+//! Hot field of a call, stored in its slot page
+#define CALL_SLOT(call, field) \
+    (call_slots.pages[(call)->slot / SIP_CALL_SLOT_PAGE]->field[(call)->slot % SIP_CALL_SLOT_PAGE])
 
 //! SIP Call State
 enum call_state
@@ -52,6 +72,79 @@ enum call_state
     SIP_CALLSTATE_COMPLETED
 };
 
+/**
+ * @brief Cached value of the attribute used to sort calls
+ *
+ * Numeric and time attributes are compared as integers and text
+ * attributes by their first bytes, so sorting a new call does not
+ * format the attributes of every compared call.
+ */
+struct sip_call_sort_key {
+    //! Key has been calculated
+    bool valid;
+    //! Attribute of the cached value
+    enum sip_attr_id attr;
+    //! Call version when the value was cached
+    uint32_t version;
+    //! Attribute has no value
+    bool empty;
+    //! Numeric attribute value
+    int64_t num;
+    //! Text attribute value is longer than stored prefix
+    bool truncated;
+    //! Text attribute value prefix
+    char text[SIP_CALL_SORT_PREFIX];
+};
+
+/**
+ * @brief Hot fields of consecutive call slots
+ *
+ * Fields checked while scanning all stored calls are kept out of the
+ * call structure, one array per field, so those scans stream through
+ * contiguous memory instead of loading each call. Fields are accessed
+ * with CALL_SLOT and are protected by the same locks as their call.
+ */
+struct sip_call_page {
+    //! Call index in the call list
+    int index[SIP_CALL_SLOT_PAGE];
+    //! Display filters already evaluated for this call (one bit per type)
+    uint16_t filter_checked[SIP_CALL_SLOT_PAGE];
+    //! Display filters matched by this call (one bit per type)
+    uint16_t filter_matched[SIP_CALL_SLOT_PAGE];
+    //! Call State. For dialogs starting with an INVITE method
+    uint8_t state[SIP_CALL_SLOT_PAGE];
+    //! Flag this call as filtered so won't be displayed
+    signed char filtered[SIP_CALL_SLOT_PAGE];
+    //! Changed flag. For interface optimal updates
+    bool changed[SIP_CALL_SLOT_PAGE];
+    //! Locked flag. Calls locked are never deleted
+    bool locked[SIP_CALL_SLOT_PAGE];
+};
+
+/**
+ * @brief Pages storing hot fields of all calls
+ *
+ * Pages are never moved or released, so fields can be accessed without
+ * taking the slots lock. Slots of released calls are reused.
+ */
+struct sip_call_slots {
+    //! Allocated pages
+    sip_call_page_t *pages[SIP_CALL_SLOT_PAGES];
+    //! Slots used at least once, free slots are below this count
+    uint32_t count;
+    //! Released slots pending to be reused
+    uint32_t *free;
+    //! Number of released slots
+    uint32_t free_count;
+    //! Size of released slots array
+    uint32_t free_size;
+    //! Lock for slots allocation
+    pthread_mutex_t lock;
+};
+
+//! Hot fields of all calls
+extern sip_call_slots_t call_slots;
+
 /**
  * @brief Contains all information of a call and its messages
  *
@@ -60,26 +153,36 @@ enum call_state
  * data from its messages to speed up searches.
  */
 struct sip_call {
-    // Call index in the call list
-    int index;
+    //! Slot of call hot fields (index, state, filters, changed and locked)
+    uint32_t slot;
     // Call identifier
     char *callid;
-    //! Related Call identifier
-    char *xcallid;
-    //! Flag this call as filtered so won't be displayed
-    signed char filtered;
-    //! Call State. For dialogs starting with an INVITE method
-    int state;
-    //! Changed flag. For interface optimal updates
-    bool changed;
-    //! Locked flag. Calls locked are never deleted
-    bool locked;
-    //! Last reason text value for this call
-    char *reasontxt;
+    //! Related Call identifier (shared string)
+    const char *xcallid;
+    //! Messages already checked against payload filter
+    int filter_msgcnt;
+    //! Flag this call as storing full RTP packets (-1 if not checked yet)
+    signed char rtp_store;
+    //! Incremented each time a message has updated the call
+    uint32_t version;
+    //! Cached value of the sort attribute
+    sip_call_sort_key_t sort_key;
+    //! Call has matched a trigger and has been queued to be saved
+    bool triggered;
+    //! Call is stored in active calls list
+    bool listed_active;
+    //! Call is stored in filtered calls list
+    bool listed_filtered;
+    //! Call is stored in displayed calls pending payload filter list
+    bool listed_pending;
+    //! Last reason text value for this call (shared string)
+    const char *reasontxt;
     //! Last warning text value for this call
     int warning;
     //! List of calls with with this call as X-Call-Id
     vector_t *xcalls;
+    //! Call with this call X-Call-Id as Call-Id (NULL if not stored)
+    sip_call_t *xparent;
     //! Cseq from invite startint the call
     uint32_t invitecseq;
     //! List of messages of this call (sip_msg_t*)
@@ -88,8 +191,36 @@ struct sip_call {
     sip_msg_t *cstart_msg, *cend_msg;
     //! RTP streams for this call (rtp_stream_t *)
     vector_t *streams;
+    //! Newest stream of each destination address (rtp_stream_t *)
+    htable_t *streams_dst;
     //! RTP packets for this call (capture_packet_t *)
     vector_t *rtp_packets;
+    //! Last message of each addresses and payload hash (sip_msg_t *)
+    htable_t *retrans;
+    //! Memory of all call messages, packets, media and streams
+    arena_t arena;
+    //! Memory used by packets structures and data out of call arena
+    size_t packets_memory;
+    //! Memory accounted for this call
+    size_t memory;
+    //! Calls with uncompressed packets, ordered by last update
+    sip_call_t *stored_prev, *stored_next;
+    //! Calls in arrival order, oldest first
+    sip_call_t *arrival_prev, *arrival_next;
+    //! Time of the last message (wall clock, only set with expiration enabled)
+    time_t last_time;
+    //! Time of the next expiration check (0 if not in expiration wheel)
+    time_t expire_time;
+    //! Calls in the same expiration wheel slot
+    sip_call_t *expire_prev, *expire_next;
+    //! Time of the last uncompressed packet
+    struct timeval stored_time;
+    //! Blocks with compressed frames of this call
+    struct storage_block *blocks;
+    //! Keepalive transaction has finished and can be compacted
+    bool compact_done;
+    //! Accounted transactions, if this call is used as compaction row
+    struct sip_compact *compact;
 };
 
 /**
@@ -117,6 +248,29 @@ call_create(char *callid, char *xcallid);
 void
 call_destroy(sip_call_t *call);
 
+/**
+ * @brief Remove a call from all shared indexes
+ *
+ * Call is no longer reachable from other calls, streams or storage,
+ * but its memory is still allocated. This must be invoked with
+ * capture locked.
+ *
+ * @param call Call to be unlinked
+ */
+void
+call_unlink(sip_call_t *call);
+
+/**
+ * @brief Release memory of an unlinked call
+ *
+ * Only call own memory is accessed, so unlinked calls can be released
+ * from any thread without capture lock.
+ *
+ * @param call Call to be released
+ */
+void
+call_free(sip_call_t *call);
+
 
 /**
  * @brief Wrapper around Message destroyer to clear call vectors
@@ -124,6 +278,17 @@ call_destroy(sip_call_t *call);
 void
 call_destroyer(void *call);
 
+/**
+ * @brief Force evaluation of changed display filters for all calls
+ *
+ * Scans the filter fields of all call slots, so it must be invoked with
+ * capture locked.
+ *
+ * @param filters Changed filters (one bit per type)
+ */
+void
+call_slots_filter_reset(uint16_t filters);
+
 /**
  * @brief Return if the call has changed
  *
@@ -141,6 +306,7 @@ call_has_changed(sip_call_t *call);
  *
  * Creates a relation between this call and the message, appending it
  * to the end of the message list and setting the message owner.
+ * Retransmissions are detected before the message frames are stored.
  *
  * @param call pointer to the call owner of the message
  * @param msg SIP message structure
@@ -159,6 +325,16 @@ call_add_message(sip_call_t *call, sip_msg_t *msg);
 void
 call_add_stream(sip_call_t *call, rtp_stream_t *stream);
 
+/**
+ * @brief Find the newest call stream with the given destination
+ *
+ * @param call SIP call structure
+ * @param dst Stream destination address and port
+ * @return stream or NULL if call has no stream with that destination
+ */
+rtp_stream_t *
+call_find_stream(sip_call_t *call, address_t dst);
+
 /**
  * @brief Append a new RTP packet to the call
  *
@@ -168,6 +344,16 @@ call_add_stream(sip_call_t *call, rtp_stream_t *stream);
 void
 call_add_rtp_packet(sip_call_t *call, packet_t *packet);
 
+/**
+ * @brief Recalculate memory used by the call
+ *
+ * Difference with previous value is accounted in stored calls memory.
+ *
+ * @param call Call to update
+ */
+void
+call_update_memory(sip_call_t *call);
+
 /**
  * @brief Getter for call messages linked list size
  *
@@ -201,8 +387,9 @@ call_is_invite(sip_call_t *call);
 /**
  * @brief Check if a message is a retransmission
  *
- * This function will compare its payload with the previous message
- * in the dialog, to check if it has the same content.
+ * This function will look for the last message in the dialog with the
+ * same addresses and payload hash, comparing both payloads only when
+ * one is found.
  *
  * @param msg SIP message that will be checked
  */
@@ -248,9 +435,20 @@ call_get_attribute(struct sip_call *call, enum sip_attr_id id, char *value);
 const char *
 call_state_to_str(int state);
 
+/**
+ * @brief Notify the call has been updated by a new message
+ *
+ * This must be invoked after all call attributes have been updated, so
+ * cached values calculated meanwhile are not used.
+ */
+void
+call_updated(sip_call_t *call);
+
 /**
  * @brief Compare two calls based on a given attribute
  *
+ * Attribute values are cached in each call until it is updated.
+ *
  * @return 0 if call attributes are equal
  * @return 1 if first call is greater
  * @return -1 if first call is lesser
@@ -0,0 +1,384 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_filter.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_filter.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "sip_filter.h"
+#include "sip.h"
+#include "address.h"
+#include "hash.h"
+#include "setting.h"
+#include "util.h"
+#include "vector.h"
+
+//! Max SIP response code that can be filtered
+#define SIP_FILTER_MAXCODE 700
+
+//! Shorter declaration of sip_filter structure
+typedef struct sip_filter sip_filter_t;
+
+/**
+ * @brief Capture filters configuration and counters
+ */
+struct sip_filter {
+    //! Filter has at least one entry
+    bool enabled[SIP_FILTER_COUNT];
+    //! Accepted request methods and response codes
+    bool reqresp[SIP_FILTER_MAXCODE];
+    //! Accepted addresses (port 0 matches any port)
+    vector_t *addresses;
+    //! Accepted From users
+    vector_t *from;
+    //! Accepted To users
+    vector_t *to;
+    //! Sampled dialogs out of each sample_total dialogs
+    uint32_t sample;
+    //! Sample size
+    uint32_t sample_total;
+    //! Dialogs discarded by each filter
+    uint64_t dropped[SIP_FILTER_COUNT];
+};
+
+//! Capture filters status
+static sip_filter_t filter;
+
+//! Capture filters names
+static const char *filter_names[SIP_FILTER_COUNT] = {
+    "method",
+    "code",
+    "address",
+    "from",
+    "to",
+    "sample",
+};
+
+/**
+ * @brief Parse a list of request methods
+ *
+ * @return 0 on success, 1 if any method is unknown
+ */
+static int
+sip_filter_parse_methods(const char *value)
+{
+    char methods[MAX_SETTING_LEN];
+    char *method, *saveptr = NULL;
+    int id;
+
+    snprintf(methods, sizeof(methods), "%s", value);
+    for (method = strtok_r(methods, ", ", &saveptr); method; method = strtok_r(NULL, ", ", &saveptr)) {
+        if ((id = sip_method_from_str(method)) <= 0 || id >= 100)
+            return 1;
+        filter.reqresp[id] = true;
+        filter.enabled[SIP_FILTER_METHOD] = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parse a list of response codes
+ *
+ * Each code can be an exact number (404) or a class (4xx).
+ *
+ * @return 0 on success, 1 if any code is invalid
+ */
+static int
+sip_filter_parse_codes(const char *value)
+{
+    char codes[MAX_SETTING_LEN];
+    char *code, *saveptr = NULL;
+    int i, num;
+
+    snprintf(codes, sizeof(codes), "%s", value);
+    for (code = strtok_r(codes, ", ", &saveptr); code; code = strtok_r(NULL, ", ", &saveptr)) {
+        if (strlen(code) == 3 && isdigit(code[0]) && !strcasecmp(code + 1, "xx")) {
+            num = (code[0] - '0') * 100;
+            if (num < 100 || num + 100 > SIP_FILTER_MAXCODE)
+                return 1;
+            for (i = num; i < num + 100; i++)
+                filter.reqresp[i] = true;
+        } else {
+            num = atoi(code);
+            if (num < 100 || num >= SIP_FILTER_MAXCODE)
+                return 1;
+            filter.reqresp[num] = true;
+        }
+        filter.enabled[SIP_FILTER_CODE] = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parse a list of IP addresses with optional IPv4 port
+ *
+ * @return 0 on success, 1 if any address is invalid
+ */
+static int
+sip_filter_parse_addresses(const char *value)
+{
+    char addresses[MAX_SETTING_LEN];
+    char *addr, *saveptr = NULL;
+    address_t *entry;
+
+    snprintf(addresses, sizeof(addresses), "%s", value);
+    for (addr = strtok_r(addresses, ", ", &saveptr); addr; addr = strtok_r(NULL, ", ", &saveptr)) {
+        if (!(entry = sng_malloc(sizeof(address_t))))
+            return 1;
+        vector_append(filter.addresses, entry);
+
+        // IPv6 addresses also contain colons, try plain IP first
+        if (address_parse_ip(entry, addr) == 0)
+            continue;
+        *entry = address_from_str(addr);
+        if (!entry->family || !entry->port)
+            return 1;
+    }
+
+    if (vector_count(filter.addresses))
+        filter.enabled[SIP_FILTER_ADDRESS] = true;
+    return 0;
+}
+
+/**
+ * @brief Parse a list of URI users
+ */
+static int
+sip_filter_parse_users(const char *value, vector_t *users, enum sip_filter_type type)
+{
+    char list[MAX_SETTING_LEN];
+    char *user, *entry, *saveptr = NULL;
+
+    snprintf(list, sizeof(list), "%s", value);
+    for (user = strtok_r(list, ", ", &saveptr); user; user = strtok_r(NULL, ", ", &saveptr)) {
+        if (!(entry = sng_malloc(strlen(user) + 1)))
+            return 1;
+        strcpy(entry, user);
+        vector_append(users, entry);
+        filter.enabled[type] = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parse a sample in N/M format
+ *
+ * @return 0 on success, 1 if sample is invalid
+ */
+static int
+sip_filter_parse_sample(const char *value)
+{
+    unsigned int sample, total;
+    char end;
+
+    if (!strlen(value))
+        return 0;
+
+    if (sscanf(value, "%u/%u%c", &sample, &total, &end) != 2 || !sample || sample > total)
+        return 1;
+
+    // Keeping all dialogs is not sampling
+    if (sample < total) {
+        filter.sample = sample;
+        filter.sample_total = total;
+        filter.enabled[SIP_FILTER_SAMPLE] = true;
+    }
+    return 0;
+}
+
+int
+sip_filter_init()
+{
+    const char *value;
+
+    memset(&filter, 0, sizeof(filter));
+    filter.addresses = vector_create(0, 4);
+    vector_set_destroyer(filter.addresses, vector_generic_destroyer);
+    filter.from = vector_create(0, 4);
+    vector_set_destroyer(filter.from, vector_generic_destroyer);
+    filter.to = vector_create(0, 4);
+    vector_set_destroyer(filter.to, vector_generic_destroyer);
+
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_METHODS))
+        && sip_filter_parse_methods(value) != 0)
+        return 1;
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_CODES))
+        && sip_filter_parse_codes(value) != 0)
+        return 1;
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_ADDRESS))
+        && sip_filter_parse_addresses(value) != 0)
+        return 1;
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_FROM))
+        && sip_filter_parse_users(value, filter.from, SIP_FILTER_FROM) != 0)
+        return 1;
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_TO))
+        && sip_filter_parse_users(value, filter.to, SIP_FILTER_TO) != 0)
+        return 1;
+    if ((value = setting_get_value(SETTING_CAPTURE_FILTER_SAMPLE))
+        && sip_filter_parse_sample(value) != 0)
+        return 1;
+
+    return 0;
+}
+
+void
+sip_filter_deinit()
+{
+    vector_destroy(filter.addresses);
+    vector_destroy(filter.from);
+    vector_destroy(filter.to);
+    memset(filter.enabled, 0, sizeof(filter.enabled));
+    filter.addresses = filter.from = filter.to = NULL;
+}
+
+/**
+ * @brief Check if packet source or destination is an accepted address
+ */
+static bool
+sip_filter_check_address(const packet_t *packet)
+{
+    vector_iter_t it = vector_iterator(filter.addresses);
+    address_t *addr;
+
+    while ((addr = vector_iterator_next(&it))) {
+        if (addr->port) {
+            if (addressport_equals(*addr, packet->src) || addressport_equals(*addr, packet->dst))
+                return true;
+        } else {
+            if (address_equals(*addr, packet->src) || address_equals(*addr, packet->dst))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check if the user of a From or To header is an accepted user
+ */
+static bool
+sip_filter_check_user(vector_t *users, const char *payload, const sip_scan_t *scan,
+                      enum sip_scan_header header)
+{
+    vector_iter_t it = vector_iterator(users);
+    const char *uri, *at, *user;
+    int len;
+
+    // URI without user part can not match
+    if (!(uri = sip_scan_uri(payload, scan, header, &len)))
+        return false;
+    if (!(at = memchr(uri, '@', len)))
+        return false;
+    len = at - uri;
+
+    while ((user = vector_iterator_next(&it))) {
+        if ((int) strlen(user) == len && !strncmp(user, uri, len))
+            return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check if a dialog is in the sample
+ *
+ * Hash does not depend on the process, so all instances capturing the
+ * same traffic sample the same dialogs.
+ */
+static bool
+sip_filter_check_sample(const char *callid, const char *payload, const sip_scan_t *scan)
+{
+    const char *id;
+    int len;
+
+    // Related legs share the sample of their X-Call-Id
+    if (!(id = sip_scan_token(payload, scan, SIP_SCAN_XCALLID, &len))) {
+        id = callid;
+        len = strlen(callid);
+    }
+
+    return hash_mem64(id, len) % filter.sample_total < filter.sample;
+}
+
+/**
+ * @brief Count a dialog discarded by a filter
+ */
+static bool
+sip_filter_drop(enum sip_filter_type type)
+{
+    __atomic_add_fetch(&filter.dropped[type], 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+bool
+sip_filter_check(const sip_msg_t *msg, const packet_t *packet, const char *callid,
+                 const char *payload, const sip_scan_t *scan)
+{
+    // Unsampled dialogs are discarded first, sampling is the cheapest check
+    if (filter.enabled[SIP_FILTER_SAMPLE] && !sip_filter_check_sample(callid, payload, scan))
+        return sip_filter_drop(SIP_FILTER_SAMPLE);
+
+    // Requests are checked against methods and responses against codes
+    if (msg->reqresp < 100) {
+        if (filter.enabled[SIP_FILTER_METHOD] && !filter.reqresp[msg->reqresp])
+            return sip_filter_drop(SIP_FILTER_METHOD);
+    } else {
+        if (filter.enabled[SIP_FILTER_CODE]
+            && (msg->reqresp >= SIP_FILTER_MAXCODE || !filter.reqresp[msg->reqresp]))
+            return sip_filter_drop(SIP_FILTER_CODE);
+    }
+
+    if (filter.enabled[SIP_FILTER_ADDRESS] && !sip_filter_check_address(packet))
+        return sip_filter_drop(SIP_FILTER_ADDRESS);
+
+    if (filter.enabled[SIP_FILTER_FROM]
+        && !sip_filter_check_user(filter.from, payload, scan, SIP_SCAN_FROM))
+        return sip_filter_drop(SIP_FILTER_FROM);
+
+    if (filter.enabled[SIP_FILTER_TO]
+        && !sip_filter_check_user(filter.to, payload, scan, SIP_SCAN_TO))
+        return sip_filter_drop(SIP_FILTER_TO);
+
+    return true;
+}
+
+const char *
+sip_filter_name(enum sip_filter_type type)
+{
+    return filter_names[type];
+}
+
+uint64_t
+sip_filter_dropped(enum sip_filter_type type)
+{
+    return __atomic_load_n(&filter.dropped[type], __ATOMIC_RELAXED);
+}
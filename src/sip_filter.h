@@ -0,0 +1,114 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_filter.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to discard dialogs before they are stored
+ *
+ * Display filters only hide stored calls. Capture filters are checked
+ * against the first message of each new dialog, before the call is
+ * created, so dialogs that are not matching them never use call memory.
+ * Messages of already stored dialogs are never filtered.
+ *
+ * Each setting is a comma separated list and empty lists match any
+ * dialog. A dialog is stored if it matches all configured lists.
+ *
+ * Sampling keeps a fixed share of dialogs selected by a hash of their
+ * Call-ID, or their X-Call-Id so related legs are kept together. The
+ * same dialogs are sampled by every sngrep instance, and RTP of dialogs
+ * not stored is discarded as no stream expects it.
+ *
+ */
+#ifndef __SNGREP_SIP_FILTER_H
+#define __SNGREP_SIP_FILTER_H
+
+#include "config.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "packet.h"
+#include "sip_msg.h"
+#include "sip_scan.h"
+
+/**
+ * @brief Capture filter lists
+ */
+enum sip_filter_type {
+    //! First request method
+    SIP_FILTER_METHOD = 0,
+    //! First response code (dialogs captured without their request)
+    SIP_FILTER_CODE,
+    //! Source or destination address
+    SIP_FILTER_ADDRESS,
+    //! From header user
+    SIP_FILTER_FROM,
+    //! To header user
+    SIP_FILTER_TO,
+    //! Call-ID hash sample
+    SIP_FILTER_SAMPLE,
+    SIP_FILTER_COUNT
+};
+
+/**
+ * @brief Load capture filters from settings
+ *
+ * @return 0 on success, 1 if any filter setting is invalid
+ */
+int
+sip_filter_init();
+
+/**
+ * @brief Release capture filters data
+ */
+void
+sip_filter_deinit();
+
+/**
+ * @brief Check if the first message of a new dialog must be stored
+ *
+ * This function is invoked by capture threads and only reads headers
+ * positions already scanned, the message is not allocated yet.
+ *
+ * @param msg Message with its request method or response code
+ * @param packet Message packet
+ * @param callid Message Call-ID
+ * @param payload NUL terminated message payload
+ * @param scan Payload headers positions
+ * @return true if dialog matches all filters, false otherwise
+ */
+bool
+sip_filter_check(const sip_msg_t *msg, const packet_t *packet, const char *callid,
+                 const char *payload, const sip_scan_t *scan);
+
+/**
+ * @brief Get the name of a capture filter
+ */
+const char *
+sip_filter_name(enum sip_filter_type type);
+
+/**
+ * @brief Get the number of dialogs discarded by a capture filter
+ */
+uint64_t
+sip_filter_dropped(enum sip_filter_type type);
+
+#endif /* __SNGREP_SIP_FILTER_H */
@@ -31,14 +31,13 @@
 #include "sip_msg.h"
 #include "media.h"
 #include "sip.h"
+#include "strpool.h"
+#include "storage.h"
 
 sip_msg_t *
-msg_create()
+msg_create(arena_t *arena)
 {
-    sip_msg_t *msg;
-    if (!(msg = sng_malloc(sizeof(sip_msg_t))))
-        return NULL;
-    return msg;
+    return arena_alloc_tag(arena, MEMSTAT_MSGS, sizeof(sip_msg_t));
 }
 
 void
@@ -50,11 +49,8 @@ msg_destroy(sip_msg_t *msg)
 
     // Free message packets
     packet_destroy(msg->packet);
-    // Free all memory
-    sng_free(msg->resp_str);
-    sng_free(msg->sip_from);
-    sng_free(msg->sip_to);
-    sng_free(msg);
+    // Message memory is released with its call arena
+    strpool_put(msg->resp_str);
 }
 
 void
@@ -100,60 +96,76 @@ msg_add_media(sip_msg_t *msg, sdp_media_t *media)
 const char *
 msg_get_payload(sip_msg_t *msg)
 {
+    // Expand compressed frames if required
+    storage_packet_load(msg->packet);
     return (const char *) packet_payload(msg->packet);
 }
 
+const char *
+msg_get_header(sip_msg_t *msg, enum sip_scan_header header, int *len)
+{
+    if (!msg->hdrs[header].off)
+        return NULL;
+
+    *len = msg->hdrs[header].len;
+    return msg_get_payload(msg) + msg->hdrs[header].off;
+}
+
 struct timeval
 msg_get_time(sip_msg_t *msg) {
     struct timeval t = { };
-    frame_t *frame;
 
-    if (msg && (frame = vector_first(msg->packet->frames))) {
-        t.tv_sec = frame->header->ts.tv_sec;
-        t.tv_usec = frame->header->ts.tv_usec;
-    }
+    if (msg)
+        t = packet_time(msg->packet);
     return t;
 }
 
+uint64_t
+msg_get_time_ns(sip_msg_t *msg)
+{
+    return (msg) ? packet_time_ns(msg->packet) : 0;
+}
+
 const char *
 msg_get_attribute(sip_msg_t *msg, int id, char *value)
 {
-    char *ar;
+    const char *header, *ar;
+    char ip[ADDRESSLEN];
+    int len;
 
     switch (id) {
         case SIP_ATTR_SRC:
             if (msg->packet->ip_version == 6) {
-                sprintf(value, "[%s]:%u", msg->packet->src.ip, msg->packet->src.port);
+                sprintf(value, "[%s]:%u", address_get_ip(msg->packet->src, ip), msg->packet->src.port);
             } else {
-                sprintf(value, "%s:%u", msg->packet->src.ip, msg->packet->src.port);
+                sprintf(value, "%s:%u", address_get_ip(msg->packet->src, ip), msg->packet->src.port);
             }
             break;
         case SIP_ATTR_DST:
             if (msg->packet->ip_version == 6) {
-                sprintf(value, "[%s]:%u", msg->packet->dst.ip, msg->packet->dst.port);
+                sprintf(value, "[%s]:%u", address_get_ip(msg->packet->dst, ip), msg->packet->dst.port);
             } else {
-                sprintf(value, "%s:%u", msg->packet->dst.ip, msg->packet->dst.port);
+                sprintf(value, "%s:%u", address_get_ip(msg->packet->dst, ip), msg->packet->dst.port);
             }
             break;
         case SIP_ATTR_METHOD:
             sprintf(value, "%.*s", SIP_ATTR_MAXLEN, sip_get_msg_reqresp_str(msg));
             break;
         case SIP_ATTR_SIPFROM:
-            sprintf(value, "%.*s", SIP_ATTR_MAXLEN, msg->sip_from);
-            break;
         case SIP_ATTR_SIPTO:
-            sprintf(value, "%.*s", SIP_ATTR_MAXLEN, msg->sip_to);
-            break;
-        case SIP_ATTR_SIPFROMUSER:
-            if (msg->sip_from && (ar = strchr(msg->sip_from, '@'))) {
-                strncpy(value, msg->sip_from, ar - msg->sip_from);
-                value[ar - msg->sip_from] = '\0';
+            if ((header = msg_get_header(msg, (id == SIP_ATTR_SIPFROM) ? SIP_SCAN_FROM : SIP_SCAN_TO, &len))) {
+                sprintf(value, "%.*s", (len < SIP_ATTR_MAXLEN) ? len : SIP_ATTR_MAXLEN, header);
+            } else {
+                // Malformed From or To header
+                strcpy(value, "<malformed>");
             }
             break;
+        case SIP_ATTR_SIPFROMUSER:
         case SIP_ATTR_SIPTOUSER:
-            if (msg->sip_to && (ar = strchr(msg->sip_to, '@'))) {
-                strncpy(value, msg->sip_to, ar - msg->sip_to);
-                value[ar - msg->sip_to] = '\0';
+            header = msg_get_header(msg, (id == SIP_ATTR_SIPFROMUSER) ? SIP_SCAN_FROM : SIP_SCAN_TO, &len);
+            if (header && (ar = memchr(header, '@', len))) {
+                len = ar - header;
+                sprintf(value, "%.*s", (len < SIP_ATTR_MAXLEN) ? len : SIP_ATTR_MAXLEN, header);
             }
             break;
         case SIP_ATTR_DATE:
@@ -183,5 +195,5 @@ msg_is_older(sip_msg_t *one, sip_msg_t *two)
         return 0;
 
     // Otherwise
-    return timeval_is_older(msg_get_time(one), msg_get_time(two));
+    return msg_get_time_ns(one) >= msg_get_time_ns(two);
 }
@@ -32,12 +32,29 @@
 #include "config.h"
 #include <stdarg.h>
 #include "vector.h"
+#include "arena.h"
 #include "media.h"
 #include "sip_attr.h"
+#include "sip_scan.h"
 #include "util.h"
 
 //! Shorter declaration of sip_msg structure
 typedef struct sip_msg sip_msg_t;
+//! Shorter declaration of sip_msg_hdr structure
+typedef struct sip_msg_hdr sip_msg_hdr_t;
+
+/**
+ * @brief Position of a parsed header value in message payload
+ *
+ * SIP payloads are never bigger than MAX_SIP_PAYLOAD, so 16 bits are
+ * enough to store any position.
+ */
+struct sip_msg_hdr {
+    //! Value offset from payload start (0 if not present or malformed)
+    uint16_t off;
+    //! Value length
+    uint16_t len;
+};
 
 /**
  * @brief Information of a single message withing a dialog.
@@ -52,14 +69,12 @@ struct sip_call;
 struct sip_msg {
     //! Request Method or Response Code @see sip_methods
     int reqresp;
-    //!  Response text if it doesn't matches an standard
-    char *resp_str;
+    //!  Response text if it doesn't matches an standard (shared string)
+    const char *resp_str;
     //! Message Cseq
     uint32_t cseq;
-    //! SIP From Header
-    char *sip_from;
-    //! SIP To Header
-    char *sip_to;
+    //! Parsed header values in payload @see sip_scan_header
+    sip_msg_hdr_t hdrs[SIP_SCAN_HEADER_COUNT];
     //! SDP payload information (sdp_media_t *)
     vector_t *medias;
     //! Captured packet for this message
@@ -70,6 +85,8 @@ struct sip_msg {
     struct sip_call *call;
     //! Message is a retransmission from other message
     sip_msg_t *retrans;
+    //! Payload hash to find retransmissions
+    uint64_t hash;
 };
 
 
@@ -80,11 +97,11 @@ struct sip_msg {
  * will only store the given information, but wont parse it until
  * needed.
  *
- * @param payload Raw payload content
+ * @param arena Call arena where message will be allocated
  * @return a new allocated message
  */
 sip_msg_t *
-msg_create();
+msg_create(arena_t *arena);
 
 /**
  * @brief Destroy a SIP message and free its memory
@@ -164,6 +181,21 @@ msg_add_media(sip_msg_t *msg, sdp_media_t *media);
 const char *
 msg_get_payload(sip_msg_t *msg);
 
+/**
+ * @brief Get a parsed header value from message payload
+ *
+ * Values are not NUL terminated, they are just a slice of the message
+ * payload: From and To contain the URI without scheme, Reason the text
+ * parameter and the rest of headers the value without spaces.
+ *
+ * @param msg SIP message
+ * @param header Header to get
+ * @param len Value length
+ * @return Value start or NULL if header is not present or malformed
+ */
+const char *
+msg_get_header(sip_msg_t *msg, enum sip_scan_header header, int *len);
+
 /**
  * @brief Get Time of message from packet header
  *
@@ -173,6 +205,15 @@ msg_get_payload(sip_msg_t *msg);
 struct timeval
 msg_get_time(sip_msg_t *msg);
 
+/**
+ * @brief Get Time of message in nanoseconds
+ *
+ * @param msg SIP message
+ * @return message first packet time in nanoseconds
+ */
+uint64_t
+msg_get_time_ns(sip_msg_t *msg);
+
 /**
  * @brief Return a message attribute value
  *
@@ -0,0 +1,665 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_scan.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in sip_scan.h
+ *
+ */
+#include "config.h"
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <stdint.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+#include "sip_scan.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+//! Payload is read in aligned blocks that never cross a page boundary
+#define SIP_SCAN_SIMD 1
+//! Bytes checked in each block
+#define SIP_SCAN_BLOCK 32
+//! Mask bits used for each block byte
+#define SIP_SCAN_MASK_BITS 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SIP_SCAN_SIMD 1
+#define SIP_SCAN_BLOCK 16
+#define SIP_SCAN_MASK_BITS 4
+#endif
+
+//! Configured X-Call-ID header names
+static char sip_scan_xcallid[SIP_SCAN_MAX_XCALLID][SIP_SCAN_XCALLID_LEN] = {
+    "X-Call-ID", "X-CID"
+};
+//! Configured X-Call-ID header names length
+static uint32_t sip_scan_xcallid_len[SIP_SCAN_MAX_XCALLID] = { 9, 5 };
+//! Configured X-Call-ID header names count
+static int sip_scan_xcallid_count = 2;
+
+static inline bool
+sip_scan_alpha(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static inline bool
+sip_scan_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int
+sip_scan_set_xcallid(const char *names)
+{
+    char xcallid[SIP_SCAN_MAX_XCALLID][SIP_SCAN_XCALLID_LEN];
+    uint32_t xcallid_len[SIP_SCAN_MAX_XCALLID];
+    const char *name, *end;
+    size_t len;
+    int count = 0;
+
+    memset(xcallid, 0, sizeof(xcallid));
+
+    for (name = names; *name && count < SIP_SCAN_MAX_XCALLID; name = end) {
+        if (!(end = strchr(name, '|')))
+            end = name + strlen(name);
+        len = end - name;
+        if (len == 0 || len >= SIP_SCAN_XCALLID_LEN)
+            return 1;
+        memcpy(xcallid[count], name, len);
+        xcallid_len[count++] = len;
+        if (*end == '|')
+            end++;
+    }
+
+    if (!count || *name)
+        return 1;
+
+    // Only replace current names if all new ones are valid
+    memcpy(sip_scan_xcallid, xcallid, sizeof(xcallid));
+    memcpy(sip_scan_xcallid_len, xcallid_len, sizeof(uint32_t) * count);
+    sip_scan_xcallid_count = count;
+    return 0;
+}
+
+/**
+ * @brief Check the version in a SIP start line
+ *
+ * Version dot is not checked, to accept the same start lines that have
+ * always been accepted.
+ */
+static inline bool
+sip_scan_version(const char *c)
+{
+    return !strncasecmp(c, "SIP/2", 5) && c[5] && c[5] != '\n' && c[6] == '0';
+}
+
+#ifdef SIP_SCAN_SIMD
+/**
+ * @brief Get line feed, NUL and colon positions of an aligned block
+ *
+ * Each byte of the block is represented by SIP_SCAN_MASK_BITS bits of
+ * the returned masks.
+ */
+__attribute__((no_sanitize_address))
+static inline void
+sip_scan_block(const char *block, uint64_t *eol, uint64_t *colon)
+{
+#if defined(__AVX2__)
+    __m256i chunk = _mm256_load_si256((const __m256i *) block);
+    __m256i lf = _mm256_set1_epi8('\n'), sep = _mm256_set1_epi8(':'), nul = _mm256_setzero_si256();
+
+    *eol = (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, lf),
+                                                           _mm256_cmpeq_epi8(chunk, nul)));
+    *colon = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, sep));
+#elif defined(__SSE2__)
+    __m128i lo = _mm_load_si128((const __m128i *) block);
+    __m128i hi = _mm_load_si128((const __m128i *) (block + 16));
+    __m128i lf = _mm_set1_epi8('\n'), sep = _mm_set1_epi8(':'), nul = _mm_setzero_si128();
+
+    *eol = (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(lo, lf), _mm_cmpeq_epi8(lo, nul)))
+           | (uint32_t) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(hi, lf), _mm_cmpeq_epi8(hi, nul))) << 16;
+    *colon = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, sep))
+             | (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, sep)) << 16;
+#else
+    uint8x16_t chunk = vld1q_u8((const uint8_t *) block);
+    uint8x16_t lf = vorrq_u8(vceqq_u8(chunk, vdupq_n_u8('\n')), vceqq_u8(chunk, vdupq_n_u8(0)));
+    uint8x16_t sep = vceqq_u8(chunk, vdupq_n_u8(':'));
+
+    *eol = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(lf), 4)), 0);
+    *colon = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(sep), 4)), 0);
+#endif
+}
+#endif
+
+/**
+ * @brief Get the header stored from a payload line
+ *
+ * Header names (and their compact forms) are only compared when their
+ * length matches the name of the line.
+ *
+ * @param line Line start
+ * @param name Header name length (up to the line first colon)
+ * @return stored header or -1 if header is not located by the scanner
+ */
+static int
+sip_scan_line_header(const char *line, uint32_t name)
+{
+    int x;
+
+    switch (name) {
+        case 1:
+            switch (line[0] | 0x20) {
+                case 'i':
+                    return SIP_SCAN_CALLID;
+                case 'f':
+                    return SIP_SCAN_FROM;
+                case 't':
+                    return SIP_SCAN_TO;
+                case 'l':
+                    return SIP_SCAN_CONTENT_LENGTH;
+            }
+            break;
+        case 2:
+            if (!strncasecmp(line, "To", 2))
+                return SIP_SCAN_TO;
+            break;
+        case 4:
+            if (!strncasecmp(line, "From", 4))
+                return SIP_SCAN_FROM;
+            if (!strncasecmp(line, "CSeq", 4))
+                return SIP_SCAN_CSEQ;
+            break;
+        case 6:
+            if (!strncasecmp(line, "Reason", 6))
+                return SIP_SCAN_REASON;
+            break;
+        case 7:
+            if (!strncasecmp(line, "Call-ID", 7))
+                return SIP_SCAN_CALLID;
+            if (!strncasecmp(line, "Warning", 7))
+                return SIP_SCAN_WARNING;
+            break;
+        case 14:
+            if (!strncasecmp(line, "Content-Length", 14))
+                return SIP_SCAN_CONTENT_LENGTH;
+            break;
+    }
+
+    for (x = 0; x < sip_scan_xcallid_count; x++) {
+        if (name == sip_scan_xcallid_len[x] && !strncasecmp(line, sip_scan_xcallid[x], name))
+            return SIP_SCAN_XCALLID;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Store the header of a payload line
+ *
+ * @param payload Message payload
+ * @param line Line start
+ * @param end Line feed or NUL terminator position
+ * @param colon First colon of the line (NULL if none)
+ * @param scan Headers positions to fill
+ * @param header Stop on first occurrence of this header (-1 to store all headers)
+ * @return true if scanning must stop after this line
+ */
+static inline bool
+sip_scan_line(const char *payload, const char *line, const char *end, const char *colon,
+              sip_scan_t *scan, int header)
+{
+    uint32_t len = end - line, name;
+    int found;
+
+    // Start line
+    if (line == payload) {
+        scan->start_len = len;
+        return false;
+    }
+
+    // Empty line after headers (first CRLFCRLF in payload)
+    if (len == 1 && line[0] == '\r' && line - payload >= 2 && line[-2] == '\r') {
+        if (*end)
+            scan->body = end + 1 - payload;
+        return true;
+    }
+
+    if (!colon || colon == line)
+        return false;
+
+    name = colon - line;
+    if ((found = sip_scan_line_header(line, name)) < 0)
+        return false;
+
+    if (header == -1 && !scan->headers[found].off) {
+        scan->headers[found].off = line + name + 1 - payload;
+        scan->headers[found].len = len - name - 1;
+    } else if (found == header) {
+        scan->headers[found].off = line + name + 1 - payload;
+        scan->headers[found].len = len - name - 1;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Walk payload lines looking for headers
+ *
+ * Line feeds and colons of each payload block are located at once, so
+ * every byte of the payload headers is only read one time.
+ *
+ * @param payload Message payload
+ * @param line First line to check
+ * @param scan Headers positions to fill
+ * @param header Stop on first occurrence of this header (-1 to walk all headers)
+ */
+#ifdef SIP_SCAN_SIMD
+__attribute__((no_sanitize_address))
+static void
+sip_scan_lines(const char *payload, const char *line, sip_scan_t *scan, int header)
+{
+    const char *block = (const char *) ((uintptr_t) line & ~(uintptr_t) (SIP_SCAN_BLOCK - 1));
+    const char *colon = NULL, *pos;
+    uint64_t eol, sep, events, bytemask = ((uint64_t) 1 << SIP_SCAN_MASK_BITS) - 1;
+    int bit;
+
+    for (;; block += SIP_SCAN_BLOCK) {
+        sip_scan_block(block, &eol, &sep);
+        events = eol | sep;
+
+        // First block may start before requested line
+        if (block < line)
+            events &= ~(uint64_t) 0 << ((line - block) * SIP_SCAN_MASK_BITS);
+
+        while (events) {
+            bit = __builtin_ctzll(events);
+            events &= ~(bytemask << bit);
+            pos = block + bit / SIP_SCAN_MASK_BITS;
+
+            if (!((eol >> bit) & 1)) {
+                // Only first colon of the line is required
+                if (!colon)
+                    colon = pos;
+                sep = events & eol;
+                events = (sep) ? events & ~(~eol & ((sep & -sep) - 1)) : eol & events;
+                continue;
+            }
+
+            if (sip_scan_line(payload, line, pos, colon, scan, header) || !*pos)
+                return;
+            line = pos + 1;
+            colon = NULL;
+        }
+    }
+}
+#else
+static void
+sip_scan_lines(const char *payload, const char *line, sip_scan_t *scan, int header)
+{
+    const char *colon = NULL, *pos;
+
+    for (pos = line;; pos++) {
+        if (*pos == ':' && !colon) {
+            colon = pos;
+        } else if (*pos == '\n' || !*pos) {
+            if (sip_scan_line(payload, line, pos, colon, scan, header) || !*pos)
+                return;
+            line = pos + 1;
+            colon = NULL;
+        }
+    }
+}
+#endif
+
+/**
+ * @brief Move to the next occurrence of a header
+ *
+ * Headers are stored the first time they are found, but malformed ones
+ * are skipped when getting their value.
+ *
+ * @return true if another occurrence has been found
+ */
+static bool
+sip_scan_next(const char *payload, sip_scan_t *scan, enum sip_scan_header header)
+{
+    const char *line = payload + scan->headers[header].off + scan->headers[header].len;
+
+    if (*line != '\n')
+        return false;
+
+    scan->headers[header].off = 0;
+    sip_scan_lines(payload, line + 1, scan, header);
+    return scan->headers[header].off != 0;
+}
+
+bool
+sip_scan_is_sip(const char *payload)
+{
+    const char *c = payload, *word;
+
+    // Response start line
+    if (sip_scan_version(payload) && payload[7] == ' ')
+        return sip_scan_digit(payload[8]) && sip_scan_digit(payload[9]) && sip_scan_digit(payload[10]);
+
+    // Request start line: Method and Request-URI scheme
+    while (sip_scan_alpha(*c))
+        c++;
+    if (c == payload || *c != ' ')
+        return false;
+    for (word = ++c; sip_scan_alpha(*c); c++);
+    return c != word && *c == ':';
+}
+
+void
+sip_scan_payload(const char *payload, sip_scan_t *scan)
+{
+    memset(scan, 0, sizeof(sip_scan_t));
+    sip_scan_lines(payload, payload, scan, -1);
+}
+
+const char *
+sip_scan_value(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len)
+{
+    const char *value, *end;
+
+    if (!scan->headers[header].off)
+        return NULL;
+
+    value = payload + scan->headers[header].off;
+    end = value + scan->headers[header].len;
+
+    while (value < end && *value == ' ')
+        value++;
+    while (end > value && (end[-1] == ' ' || end[-1] == '\r'))
+        end--;
+
+    *len = end - value;
+    return value;
+}
+
+/**
+ * @brief Get a single token header value
+ */
+static const char *
+sip_scan_token_value(const char *value, const char *end, int *len)
+{
+    const char *c;
+
+    // Value must be followed by the line CR
+    if (end == value || *--end != '\r')
+        return NULL;
+
+    while (value < end && *value == ' ')
+        value++;
+    while (end > value && end[-1] == ' ')
+        end--;
+    if (value == end)
+        return NULL;
+
+    for (c = value; c < end; c++) {
+        if (*c == ' ')
+            return NULL;
+    }
+
+    *len = end - value;
+    return value;
+}
+
+const char *
+sip_scan_token(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len)
+{
+    sip_scan_t next = *scan;
+    const char *value;
+
+    if (!next.headers[header].off)
+        return NULL;
+
+    do {
+        value = payload + next.headers[header].off;
+        if ((value = sip_scan_token_value(value, value + next.headers[header].len, len)))
+            return value;
+    } while (sip_scan_next(payload, &next, header));
+
+    return NULL;
+}
+
+const char *
+sip_scan_method(const char *payload, const sip_scan_t *scan, int *len)
+{
+    const char *c = payload, *end = payload + scan->start_len, *ver;
+
+    // Method name followed by Request-URI scheme
+    while (sip_scan_alpha(*c))
+        c++;
+    if (c == payload || *c != ' ')
+        return NULL;
+    *len = c - payload;
+    for (c++; sip_scan_alpha(*c); c++);
+    if (c == payload + *len + 1 || *c != ':')
+        return NULL;
+
+    // SIP version followed by the start line CR
+    for (; c + 8 < end; c++) {
+        if (*c != ' ' || !sip_scan_version(c + 1))
+            continue;
+        for (ver = c + 8; ver < end && *ver == ' '; ver++);
+        if (ver < end && *ver == '\r')
+            break;
+    }
+    if (c + 8 >= end)
+        return NULL;
+
+    return payload;
+}
+
+const char *
+sip_scan_response(const char *payload, const sip_scan_t *scan, int *len)
+{
+    const char *code = payload + 7, *end;
+
+    if (!sip_scan_version(payload))
+        return NULL;
+
+    while (*code == ' ')
+        code++;
+    if (!sip_scan_digit(code[0]) || !sip_scan_digit(code[1]) || !sip_scan_digit(code[2]) || code[3] != ' ')
+        return NULL;
+
+    // Response text ends before first CR
+    if (!(end = strchr(code, '\r')))
+        return NULL;
+
+    *len = end - code;
+    return code;
+}
+
+bool
+sip_scan_cseq(const char *payload, const sip_scan_t *scan, uint32_t *cseq)
+{
+    sip_scan_t next = *scan;
+    const char *value, *end, *c;
+
+    if (!next.headers[SIP_SCAN_CSEQ].off)
+        return false;
+
+    do {
+        value = payload + next.headers[SIP_SCAN_CSEQ].off;
+        end = value + next.headers[SIP_SCAN_CSEQ].len;
+
+        while (value < end && *value == ' ')
+            value++;
+        for (c = value; c < end && sip_scan_digit(*c); c++);
+
+        // Up to 10 digits followed by a space and the method
+        if (c == value || c - value > 10 || c == end || *c != ' ')
+            continue;
+        if (end - c < 3 || end[-1] != '\r')
+            continue;
+
+        *cseq = (uint32_t) strtoul(value, NULL, 10);
+        return true;
+    } while (sip_scan_next(payload, &next, SIP_SCAN_CSEQ));
+
+    return false;
+}
+
+/**
+ * @brief Get user and host part of an URI header value
+ */
+static const char *
+sip_scan_uri_value(const char *value, const char *end, int *len)
+{
+    const char *user, *c;
+
+    // URI starts after its scheme
+    if (!(value = memchr(value, ':', end - value)))
+        return NULL;
+    value++;
+
+    // User part can't be empty
+    for (user = value; user < end && *user != '@' && *user != '>'; user++);
+    if (user == value)
+        return NULL;
+
+    if (user < end && *user == '@') {
+        // Host part ends before URI parameters or closing bracket
+        for (c = user + 1; c < end && *c != '\r' && *c != '>' && *c != ';'; c++);
+    } else {
+        // No host part, the URI ends in the last valid user character
+        for (c = user - 1; c > value && (*c == '\r' || *c == ';'); c--);
+        if (c == value)
+            return NULL;
+        c++;
+    }
+
+    *len = c - value;
+    return value;
+}
+
+const char *
+sip_scan_uri(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len)
+{
+    sip_scan_t next = *scan;
+    const char *value;
+
+    if (!next.headers[header].off)
+        return NULL;
+
+    do {
+        value = payload + next.headers[header].off;
+        if ((value = sip_scan_uri_value(value, value + next.headers[header].len, len)))
+            return value;
+    } while (sip_scan_next(payload, &next, header));
+
+    return NULL;
+}
+
+int
+sip_scan_content_length(const char *payload, const sip_scan_t *scan)
+{
+    sip_scan_t next = *scan;
+    const char *value;
+    long length;
+    int len;
+
+    if (!next.headers[SIP_SCAN_CONTENT_LENGTH].off)
+        return -1;
+
+    do {
+        value = payload + next.headers[SIP_SCAN_CONTENT_LENGTH].off;
+        if (!(value = sip_scan_token_value(value, value + next.headers[SIP_SCAN_CONTENT_LENGTH].len, &len)))
+            continue;
+
+        // Value must only contain digits
+        for (length = 0; len > 0 && sip_scan_digit(*value); value++, len--) {
+            if (length < INT_MAX)
+                length = length * 10 + (*value - '0');
+        }
+        if (len == 0)
+            return (length > INT_MAX) ? INT_MAX : (int) length;
+    } while (sip_scan_next(payload, &next, SIP_SCAN_CONTENT_LENGTH));
+
+    return -1;
+}
+
+const char *
+sip_scan_reason(const char *payload, const sip_scan_t *scan, int *len)
+{
+    sip_scan_t next = *scan;
+    const char *value, *end, *text, *quote;
+
+    if (!next.headers[SIP_SCAN_REASON].off)
+        return NULL;
+
+    do {
+        value = payload + next.headers[SIP_SCAN_REASON].off;
+        end = value + next.headers[SIP_SCAN_REASON].len;
+
+        // Text can not span after the line CR
+        if ((quote = memchr(value, '\r', end - value)))
+            end = quote;
+
+        // Text ends in the last quote of the line
+        for (quote = end - 1; quote > value && *quote != '"'; quote--);
+
+        // Use the last text parameter before that quote
+        for (text = quote - 7; text >= value; text--) {
+            if (!strncmp(text, ";text=\"", 7) && text + 7 < quote) {
+                *len = quote - text - 7;
+                return text + 7;
+            }
+        }
+    } while (sip_scan_next(payload, &next, SIP_SCAN_REASON));
+
+    return NULL;
+}
+
+bool
+sip_scan_warning(const char *payload, const sip_scan_t *scan, int *code)
+{
+    const char *value, *end, *c;
+
+    if (!scan->headers[SIP_SCAN_WARNING].off)
+        return false;
+
+    value = payload + scan->headers[SIP_SCAN_WARNING].off;
+    end = value + scan->headers[SIP_SCAN_WARNING].len;
+
+    while (value < end && *value == ' ')
+        value++;
+
+    // Only up to 9 digits fit in an int code
+    *code = 0;
+    for (c = value; c < end && c - value < 9 && sip_scan_digit(*c); c++)
+        *code = *code * 10 + (*c - '0');
+
+    return true;
+}
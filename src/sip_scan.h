@@ -0,0 +1,224 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file sip_scan.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to locate SIP headers in a message payload
+ *
+ * SIP message headers are walked once and the position of the headers
+ * sngrep is interested in is stored, so the rest of the parsing functions
+ * only need to read the value of each header.
+ *
+ */
+#ifndef __SNGREP_SIP_SCAN_H
+#define __SNGREP_SIP_SCAN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//! Max header names that can be used to get X-Call-ID
+#define SIP_SCAN_MAX_XCALLID 16
+//! Max length of each X-Call-ID header name
+#define SIP_SCAN_XCALLID_LEN 64
+
+//! Shorter declaration of sip_scan structure
+typedef struct sip_scan sip_scan_t;
+//! Shorter declaration of sip_scan_value structure
+typedef struct sip_scan_value sip_scan_value_t;
+
+/**
+ * @brief Headers located by the scanner
+ */
+enum sip_scan_header {
+    SIP_SCAN_CALLID = 0,
+    SIP_SCAN_XCALLID,
+    SIP_SCAN_CSEQ,
+    SIP_SCAN_FROM,
+    SIP_SCAN_TO,
+    SIP_SCAN_CONTENT_LENGTH,
+    SIP_SCAN_REASON,
+    SIP_SCAN_WARNING,
+    SIP_SCAN_HEADER_COUNT
+};
+
+/**
+ * @brief Position of a header value in the payload
+ *
+ * Value starts right after the header name colon and ends before the
+ * line feed, so it includes leading spaces and the trailing '\r'.
+ */
+struct sip_scan_value
+{
+    //! Value offset from payload start (0 if header is not present)
+    uint32_t off;
+    //! Value length
+    uint32_t len;
+};
+
+/**
+ * @brief Headers positions of a SIP message payload
+ */
+struct sip_scan
+{
+    //! Start line length (without line feed)
+    uint32_t start_len;
+    //! First value of each located header
+    sip_scan_value_t headers[SIP_SCAN_HEADER_COUNT];
+    //! Body offset after the empty line (0 if headers end was not found)
+    uint32_t body;
+};
+
+/**
+ * @brief Set the header names used to get the X-Call-ID
+ *
+ * @param names Header names separated by '|'
+ * @return 0 if all names have been added, 1 otherwise
+ */
+int
+sip_scan_set_xcallid(const char *names);
+
+/**
+ * @brief Check if payload starts with a SIP request or response line
+ *
+ * @param payload NUL terminated message payload
+ * @return true if payload start line looks like SIP
+ */
+bool
+sip_scan_is_sip(const char *payload);
+
+/**
+ * @brief Locate start line, headers and body of a SIP message payload
+ *
+ * Only the first occurrence of each header is stored. Scanning stops
+ * at the empty line that separates headers and body.
+ *
+ * @param payload NUL terminated message payload
+ * @param scan Headers positions filled by this function
+ */
+void
+sip_scan_payload(const char *payload, sip_scan_t *scan);
+
+/**
+ * @brief Get a header value without surrounding spaces
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param header Header to get
+ * @param len Value length
+ * @return Value start or NULL if header is not present
+ */
+const char *
+sip_scan_value(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len);
+
+/**
+ * @brief Get a single token header value (Call-ID, X-Call-ID)
+ *
+ * Value must not contain spaces, and surrounding spaces are ignored.
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param header Header to get
+ * @param len Value length
+ * @return Value start or NULL if header is not present or malformed
+ */
+const char *
+sip_scan_token(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len);
+
+/**
+ * @brief Get request method name from start line
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param len Method name length
+ * @return Method name start or NULL if start line is not a request
+ */
+const char *
+sip_scan_method(const char *payload, const sip_scan_t *scan, int *len);
+
+/**
+ * @brief Get response code and text from start line
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param len Response code and text length
+ * @return Response code start or NULL if start line is not a response
+ */
+const char *
+sip_scan_response(const char *payload, const sip_scan_t *scan, int *len);
+
+/**
+ * @brief Get CSeq header sequence number
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param cseq Sequence number
+ * @return true if CSeq header is present and well formed
+ */
+bool
+sip_scan_cseq(const char *payload, const sip_scan_t *scan, uint32_t *cseq);
+
+/**
+ * @brief Get user and host part of a From or To header URI
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param header SIP_SCAN_FROM or SIP_SCAN_TO
+ * @param len URI length
+ * @return URI start (after scheme) or NULL if malformed
+ */
+const char *
+sip_scan_uri(const char *payload, const sip_scan_t *scan, enum sip_scan_header header, int *len);
+
+/**
+ * @brief Get Content-Length header value
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @return Body length or -1 if header is not present or malformed
+ */
+int
+sip_scan_content_length(const char *payload, const sip_scan_t *scan);
+
+/**
+ * @brief Get Reason header text parameter
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param len Text length
+ * @return Text start (without quotes) or NULL if not found
+ */
+const char *
+sip_scan_reason(const char *payload, const sip_scan_t *scan, int *len);
+
+/**
+ * @brief Get Warning header code
+ *
+ * @param payload Scanned payload
+ * @param scan Headers positions
+ * @param code Warning code (0 if header has no code)
+ * @return true if Warning header is present
+ */
+bool
+sip_scan_warning(const char *payload, const sip_scan_t *scan, int *code);
+
+#endif /* __SNGREP_SIP_SCAN_H */
@@ -0,0 +1,271 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file slab.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in slab.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "slab.h"
+
+//! Shorter declaration of slab_block structure
+typedef struct slab_block slab_block_t;
+//! Shorter declaration of slab_cache structure
+typedef struct slab_cache slab_cache_t;
+
+/**
+ * Usable bytes of each size class: frame headers, packet structures,
+ * RTP frames, small SIP frames and full MTU SIP frames
+ */
+static const size_t slab_class_size[] = { 64, 256, 512, 1024, 1600 };
+
+//! Number of size classes
+#define SLAB_CLASSES (sizeof(slab_class_size) / sizeof(slab_class_size[0]))
+//! Class of blocks allocated directly with malloc
+#define SLAB_LARGE SLAB_CLASSES
+//! Next batch link, stored in the first free block of each depot batch
+#define SLAB_BATCH_NEXT(block) (*(slab_block_t **) ((block) + 1))
+
+/**
+ * @brief Header stored before each allocated block
+ */
+struct slab_block
+{
+    //! Size class of this block
+    size_t cls;
+    //! Next free block of the same class
+    slab_block_t *next;
+};
+
+/**
+ * @brief Free blocks owned by a thread
+ */
+struct slab_cache
+{
+    //! Free blocks of each size class
+    slab_block_t *free[SLAB_CLASSES];
+    //! Number of free blocks of each size class
+    int count[SLAB_CLASSES];
+};
+
+/**
+ * @brief Full batches of free blocks shared by all threads
+ */
+static struct
+{
+    //! First block of each batch
+    slab_block_t *batches[SLAB_CLASSES];
+    //! Number of batches of each size class
+    int count[SLAB_CLASSES];
+    //! Only one thread can move batches at a time
+    pthread_mutex_t lock;
+} depot = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+//! Free blocks of each thread
+static pthread_key_t slab_cache_key;
+//! Cache key is created the first time is requested
+static pthread_once_t slab_cache_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Release all blocks in a free list
+ */
+static void
+slab_list_free(slab_block_t *block)
+{
+    slab_block_t *next;
+
+    for (; block; block = next) {
+        next = block->next;
+        free(block);
+    }
+}
+
+static void
+slab_cache_destroy(void *data)
+{
+    slab_cache_t *cache = data;
+    size_t cls;
+
+    for (cls = 0; cls < SLAB_CLASSES; cls++)
+        slab_list_free(cache->free[cls]);
+    free(cache);
+}
+
+static void
+slab_cache_key_create()
+{
+    pthread_key_create(&slab_cache_key, slab_cache_destroy);
+}
+
+/**
+ * @brief Get free blocks of current thread
+ *
+ * @return thread cache or NULL if it can not be allocated
+ */
+static slab_cache_t *
+slab_cache()
+{
+    slab_cache_t *cache;
+
+    pthread_once(&slab_cache_once, slab_cache_key_create);
+    if (!(cache = pthread_getspecific(slab_cache_key))) {
+        if (!(cache = calloc(1, sizeof(slab_cache_t))))
+            return NULL;
+        pthread_setspecific(slab_cache_key, cache);
+    }
+
+    return cache;
+}
+
+/**
+ * @brief Move a full batch from the depot to the thread cache
+ *
+ * @return 0 if a batch has been moved, 1 if depot has no batches
+ */
+static int
+slab_depot_get(slab_cache_t *cache, size_t cls)
+{
+    slab_block_t *batch;
+
+    pthread_mutex_lock(&depot.lock);
+    if ((batch = depot.batches[cls])) {
+        depot.batches[cls] = SLAB_BATCH_NEXT(batch);
+        depot.count[cls]--;
+    }
+    pthread_mutex_unlock(&depot.lock);
+
+    if (!batch)
+        return 1;
+
+    cache->free[cls] = batch;
+    cache->count[cls] = SLAB_BATCH;
+    return 0;
+}
+
+/**
+ * @brief Move a batch from the thread cache to the depot
+ *
+ * First SLAB_BATCH blocks of the class list are moved. If the depot is
+ * already full they are returned to the system.
+ */
+static void
+slab_depot_put(slab_cache_t *cache, size_t cls)
+{
+    slab_block_t *batch, *last;
+    int i;
+
+    // Split the batch from the thread list
+    batch = last = cache->free[cls];
+    for (i = 1; i < SLAB_BATCH; i++)
+        last = last->next;
+    cache->free[cls] = last->next;
+    cache->count[cls] -= SLAB_BATCH;
+    last->next = NULL;
+
+    pthread_mutex_lock(&depot.lock);
+    if (depot.count[cls] < SLAB_DEPOT_MAX) {
+        SLAB_BATCH_NEXT(batch) = depot.batches[cls];
+        depot.batches[cls] = batch;
+        depot.count[cls]++;
+        batch = NULL;
+    }
+    pthread_mutex_unlock(&depot.lock);
+
+    slab_list_free(batch);
+}
+
+void *
+slab_alloc(size_t size)
+{
+    slab_cache_t *cache;
+    slab_block_t *block = NULL;
+    size_t cls;
+
+    // Get the smallest class where requested size fits
+    for (cls = 0; cls < SLAB_CLASSES; cls++) {
+        if (size <= slab_class_size[cls])
+            break;
+    }
+
+    if (cls == SLAB_LARGE) {
+        if (!(block = malloc(sizeof(slab_block_t) + size)))
+            return NULL;
+        block->cls = SLAB_LARGE;
+        return block + 1;
+    }
+
+    // Reuse a free block if possible
+    if ((cache = slab_cache())) {
+        if (cache->free[cls] || slab_depot_get(cache, cls) == 0) {
+            block = cache->free[cls];
+            cache->free[cls] = block->next;
+            cache->count[cls]--;
+        }
+    }
+
+    if (!block && !(block = malloc(sizeof(slab_block_t) + slab_class_size[cls])))
+        return NULL;
+
+    block->cls = cls;
+    return block + 1;
+}
+
+void *
+slab_zalloc(size_t size)
+{
+    void *ptr;
+
+    if ((ptr = slab_alloc(size)))
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void
+slab_free(void *ptr)
+{
+    slab_cache_t *cache;
+    slab_block_t *block;
+    size_t cls;
+
+    if (!ptr)
+        return;
+
+    block = (slab_block_t *) ptr - 1;
+    cls = block->cls;
+
+    if (cls == SLAB_LARGE || !(cache = slab_cache())) {
+        free(block);
+        return;
+    }
+
+    block->next = cache->free[cls];
+    cache->free[cls] = block;
+
+    // Share free blocks with other threads
+    if (++cache->count[cls] == SLAB_BATCH * 2)
+        slab_depot_put(cache, cls);
+}
@@ -0,0 +1,78 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file slab.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to reuse memory of short lived packets and frames
+ *
+ * Most captured packets are discarded right after being parsed, so
+ * their memory is kept in per-thread free lists grouped by size class
+ * instead of returning it to the system. Packets are usually created
+ * in capture threads and released in the parser thread, so full lists
+ * are moved in batches to a shared depot where allocating threads can
+ * take them from.
+ *
+ */
+#ifndef __SNGREP_SLAB_H
+#define __SNGREP_SLAB_H
+
+#include "config.h"
+#include <stddef.h>
+
+//! Number of blocks moved at once between thread lists and depot
+#define SLAB_BATCH          64
+//! Max number of batches kept in the depot for each size class
+#define SLAB_DEPOT_MAX      64
+
+/**
+ * @brief Allocate a memory block
+ *
+ * Block memory is not initialized. Sizes bigger than the biggest size
+ * class are allocated using malloc.
+ *
+ * @param size Requested size in bytes
+ * @return allocated block or NULL on error
+ */
+void *
+slab_alloc(size_t size);
+
+/**
+ * @brief Allocate a zeroed memory block
+ *
+ * @param size Requested size in bytes
+ * @return allocated block or NULL on error
+ */
+void *
+slab_zalloc(size_t size);
+
+/**
+ * @brief Release a block allocated with slab_alloc
+ *
+ * Block can be released from any thread.
+ *
+ * @param ptr Allocated block or NULL
+ */
+void
+slab_free(void *ptr);
+
+#endif /* __SNGREP_SLAB_H */
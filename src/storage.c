@@ -0,0 +1,559 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file storage.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in storage.h
+ *
+ */
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+#include "storage.h"
+#include "capture.h"
+#ifdef HAVE_MMAP
+#include "capture_mmap.h"
+#endif
+#include "setting.h"
+#include "util.h"
+
+/**
+ * @brief Compressed storage status
+ */
+static struct
+{
+    //! Calls with uncompressed packets, least recently updated first
+    sip_call_t *first, *last;
+    //! Expanded blocks
+    storage_block_t *loaded;
+    //! Time of the newest stored packet
+    struct timeval now;
+    //! Uncompressed size of compressed frames
+    uint64_t len;
+    //! Compressed size of compressed frames
+    uint64_t zlen;
+    //! Disk storage segments, current one first
+    storage_segment_t *segments;
+    //! Calls list and expanded blocks can be modified from multiple threads
+    pthread_mutex_t lock;
+} storage = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Remove a call from the uncompressed calls list
+ */
+static void
+storage_list_remove(sip_call_t *call)
+{
+    if (call->stored_prev) {
+        call->stored_prev->stored_next = call->stored_next;
+    } else if (storage.first == call) {
+        storage.first = call->stored_next;
+    } else {
+        // Call is not in the list
+        return;
+    }
+
+    if (call->stored_next) {
+        call->stored_next->stored_prev = call->stored_prev;
+    } else {
+        storage.last = call->stored_prev;
+    }
+
+    call->stored_prev = call->stored_next = NULL;
+}
+
+/**
+ * @brief Add a call at the end of the uncompressed calls list
+ */
+static void
+storage_list_append(sip_call_t *call)
+{
+    call->stored_prev = storage.last;
+    call->stored_next = NULL;
+    if (storage.last) {
+        storage.last->stored_next = call;
+    } else {
+        storage.first = call;
+    }
+    storage.last = call;
+}
+
+/**
+ * @brief Release uncompressed data of an expanded block
+ *
+ * Block must already be removed from the expanded blocks list.
+ */
+static void
+storage_block_unload(storage_block_t *block)
+{
+    int i;
+
+    for (i = 0; i < block->count; i++)
+        packet_set_data(block->packets[i], NULL);
+
+    free(block->data);
+    block->data = NULL;
+    block->used = false;
+}
+
+/**
+ * @brief Check if a packet is stored in its call memory
+ */
+static bool
+storage_packet_is_raw(packet_t *packet)
+{
+    return !packet->arena && !packet->block;
+}
+
+/**
+ * @brief Compress all uncompressed packets of a call in a new block
+ *
+ * @return 0 on success, 1 otherwise
+ */
+static int
+storage_call_compress(sip_call_t *call)
+{
+#ifdef WITH_ZLIB
+    storage_block_t *block;
+    sip_msg_t *msg;
+    packet_t *packet;
+    u_char *data, *zdata;
+    uLongf zlen;
+    uint32_t len = 0;
+    int count = 0, i;
+    vector_iter_t it;
+
+    // Count packets pending to be compressed
+    it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it))) {
+        if (storage_packet_is_raw(msg->packet)) {
+            len += packet_data_copy(msg->packet, NULL);
+            count++;
+        }
+    }
+    it = vector_iterator(call->rtp_packets);
+    while ((packet = vector_iterator_next(&it))) {
+        if (storage_packet_is_raw(packet)) {
+            len += packet_data_copy(packet, NULL);
+            count++;
+        }
+    }
+
+    if (!count)
+        return 0;
+
+    if (!(block = arena_alloc_tag(&call->arena, MEMSTAT_FRAMES, sizeof(storage_block_t))))
+        return 1;
+    block->packets = arena_alloc_tag(&call->arena, MEMSTAT_FRAMES, count * sizeof(packet_t *));
+    block->offsets = arena_alloc_tag(&call->arena, MEMSTAT_FRAMES, count * sizeof(uint32_t));
+    if (!block->packets || !block->offsets)
+        return 1;
+
+    // Copy all packets data in a single buffer
+    if (!(data = malloc(len)))
+        return 1;
+    len = 0;
+    it = vector_iterator(call->msgs);
+    while ((msg = vector_iterator_next(&it))) {
+        if (storage_packet_is_raw(msg->packet)) {
+            block->packets[block->count] = msg->packet;
+            block->offsets[block->count++] = len;
+            len += packet_data_copy(msg->packet, data + len);
+        }
+    }
+    it = vector_iterator(call->rtp_packets);
+    while ((packet = vector_iterator_next(&it))) {
+        if (storage_packet_is_raw(packet)) {
+            block->packets[block->count] = packet;
+            block->offsets[block->count++] = len;
+            len += packet_data_copy(packet, data + len);
+        }
+    }
+
+    // Compress buffer and store the result in call memory
+    zlen = compressBound(len);
+    if (!(zdata = malloc(zlen))) {
+        free(data);
+        return 1;
+    }
+    if (compress2(zdata, &zlen, data, len, Z_DEFAULT_COMPRESSION) != Z_OK
+            || !(block->zdata = arena_memdup(&call->arena, MEMSTAT_FRAMES, zdata, zlen))) {
+        free(zdata);
+        free(data);
+        return 1;
+    }
+    block->zlen = zlen;
+    block->len = len;
+    free(zdata);
+    free(data);
+
+    // Release packets memory, data will be restored from block
+    for (i = 0; i < count; i++) {
+        if (packet_drop_data(block->packets[i], &call->arena) != 0)
+            break;
+        block->packets[i]->block = block;
+    }
+    // Remaining packets will be compressed in a later block
+    block->count = i;
+    call->packets_memory -= (i == count) ? len : block->offsets[i];
+    call_update_memory(call);
+
+    block->next = call->blocks;
+    call->blocks = block;
+    storage.len += block->len;
+    storage.zlen += block->zlen;
+    return block->count != count;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * @brief Unmap a disk storage log segment and remove it from the list
+ *
+ * This must be invoked with storage locked.
+ */
+static void
+storage_segment_destroy(storage_segment_t *segment)
+{
+    storage_segment_t **prev;
+
+    for (prev = &storage.segments; *prev != segment; prev = &(*prev)->next);
+    *prev = segment->next;
+    munmap(segment->map, segment->size);
+    free(segment);
+}
+
+/**
+ * @brief Create a new disk storage log segment
+ *
+ * Segment file is removed as soon as it is mapped, so its disk space is
+ * released when the segment is unmapped.
+ *
+ * @param size Minimum segment size
+ * @return new segment or NULL on error
+ */
+static storage_segment_t *
+storage_segment_create(size_t size)
+{
+    storage_segment_t *segment;
+    char path[PATH_MAX];
+    void *map;
+    int fd;
+
+    if (size < STORAGE_SEGMENT_SIZE)
+        size = STORAGE_SEGMENT_SIZE;
+
+    snprintf(path, sizeof(path), "%s/sngrep-XXXXXX", setting_get_value(SETTING_CAPTURE_STORAGE_DIR));
+    if ((fd = mkstemp(path)) == -1)
+        return NULL;
+    unlink(path);
+
+    // Reserve disk space, writing to mapped memory can not fail later
+    if (posix_fallocate(fd, 0, size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    if (!(segment = malloc(sizeof(storage_segment_t)))) {
+        munmap(map, size);
+        return NULL;
+    }
+    segment->map = map;
+    segment->size = size;
+    segment->used = 0;
+    segment->packets = 0;
+    segment->next = storage.segments;
+    storage.segments = segment;
+
+    // Previous segment will not be written again
+    if (segment->next) {
+        if (segment->next->packets == 0) {
+            storage_segment_destroy(segment->next);
+        } else {
+            // Written data is no longer needed in memory
+            madvise(segment->next->map, segment->next->size, MADV_DONTNEED);
+        }
+    }
+
+    return segment;
+}
+
+int
+storage_packet_store(sip_call_t *call, packet_t *packet)
+{
+    storage_segment_t *segment;
+    uint32_t len = packet_data_copy(packet, NULL);
+    u_char *data;
+
+    pthread_mutex_lock(&storage.lock);
+    segment = storage.segments;
+    if (!segment || segment->used + len > segment->size) {
+        if (!(segment = storage_segment_create(len))) {
+            pthread_mutex_unlock(&storage.lock);
+            return 1;
+        }
+    }
+    data = segment->map + segment->used;
+    segment->used += len;
+    segment->packets++;
+    packet->segment = segment;
+    pthread_mutex_unlock(&storage.lock);
+
+    // Reserved space is only written by this thread
+    packet_data_copy(packet, data);
+    if (packet_drop_data(packet, &call->arena) != 0)
+        return 1;
+    packet_set_data(packet, data);
+    return 0;
+}
+
+int
+storage_packet_index(sip_call_t *call, packet_t *packet)
+{
+#ifdef HAVE_MMAP
+    capture_info_t *capinfo = packet->source;
+    frame_t *frame;
+    vector_iter_t it;
+
+    if (!capinfo || !capinfo->mmap)
+        return 1;
+
+    // All frames must have been read from the mapped file
+    it = vector_iterator(packet->frames);
+    while ((frame = vector_iterator_next(&it))) {
+        if (!frame->offset)
+            return 1;
+    }
+
+    return packet_index_data(packet, &call->arena, capinfo->mmap->map);
+#else
+    return 1;
+#endif
+}
+
+void
+storage_call_update(sip_call_t *call, packet_t *packet)
+{
+    struct timeval ts = packet_time(packet);
+
+    pthread_mutex_lock(&storage.lock);
+    storage_list_remove(call);
+    storage_list_append(call);
+    call->stored_time = ts;
+    if (timercmp(&ts, &storage.now, >=))
+        storage.now = ts;
+    pthread_mutex_unlock(&storage.lock);
+}
+
+void
+storage_call_remove(sip_call_t *call)
+{
+    storage_block_t **prev, *block;
+
+    pthread_mutex_lock(&storage.lock);
+    storage_list_remove(call);
+
+    for (block = call->blocks; block; block = block->next) {
+        // Remove block from expanded list
+        if (block->data) {
+            for (prev = &storage.loaded; *prev != block; prev = &(*prev)->loaded_next);
+            *prev = block->loaded_next;
+            free(block->data);
+            block->data = NULL;
+        }
+        storage.len -= block->len;
+        storage.zlen -= block->zlen;
+    }
+    pthread_mutex_unlock(&storage.lock);
+}
+
+/**
+ * @brief Release the disk storage segment reference of a packet
+ *
+ * This must be invoked with storage locked.
+ */
+static void
+storage_packet_release(packet_t *packet)
+{
+    storage_segment_t *segment = packet->segment;
+
+    if (!segment)
+        return;
+    packet->segment = NULL;
+
+    // Current segment is kept for next stored packets
+    if (--segment->packets == 0 && segment != storage.segments)
+        storage_segment_destroy(segment);
+}
+
+void
+storage_call_release(sip_call_t *call)
+{
+    sip_msg_t *msg;
+    packet_t *packet;
+    vector_iter_t it;
+
+    pthread_mutex_lock(&storage.lock);
+    if (storage.segments) {
+        it = vector_iterator(call->msgs);
+        while ((msg = vector_iterator_next(&it)))
+            storage_packet_release(msg->packet);
+        it = vector_iterator(call->rtp_packets);
+        while ((packet = vector_iterator_next(&it)))
+            storage_packet_release(packet);
+    }
+    pthread_mutex_unlock(&storage.lock);
+}
+
+void
+storage_clear()
+{
+    storage_block_t *block;
+
+    pthread_mutex_lock(&storage.lock);
+    storage.first = storage.last = NULL;
+
+    // Expanded blocks are few, release them now
+    while ((block = storage.loaded)) {
+        storage.loaded = block->loaded_next;
+        storage_block_unload(block);
+    }
+
+    storage.len = storage.zlen = 0;
+    pthread_mutex_unlock(&storage.lock);
+}
+
+int
+storage_packet_load(packet_t *packet)
+{
+    storage_block_t *block = packet->block;
+
+    if (!block)
+        return 0;
+
+    if (block->data) {
+        block->used = true;
+        return 0;
+    }
+
+#ifdef WITH_ZLIB
+    uLongf len = block->len;
+    int i;
+
+    if (!(block->data = malloc(block->len)))
+        return 1;
+
+    if (uncompress(block->data, &len, block->zdata, block->zlen) != Z_OK || len != block->len) {
+        free(block->data);
+        block->data = NULL;
+        return 1;
+    }
+
+    for (i = 0; i < block->count; i++)
+        packet_set_data(block->packets[i], block->data + block->offsets[i]);
+    block->used = true;
+
+    pthread_mutex_lock(&storage.lock);
+    block->loaded_next = storage.loaded;
+    storage.loaded = block;
+    pthread_mutex_unlock(&storage.lock);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+void
+storage_update()
+{
+    storage_block_t **prev, *block;
+    sip_call_t *call, *next;
+    time_t idle;
+
+    pthread_mutex_lock(&storage.lock);
+
+    // Release expanded blocks not used since last update
+    for (prev = &storage.loaded; (block = *prev);) {
+        if (block->used) {
+            block->used = false;
+            prev = &block->loaded_next;
+        } else {
+            *prev = block->loaded_next;
+            storage_block_unload(block);
+        }
+    }
+
+    // Compress calls without recent packets
+    for (call = storage.first; call; call = next) {
+        next = call->stored_next;
+        idle = storage.now.tv_sec - call->stored_time.tv_sec;
+        // Rest of the list has been updated later
+        if (idle < STORAGE_IDLE)
+            break;
+        // Calls in progress are expected to receive more packets
+        if (call_is_active(call) && idle < STORAGE_IDLE_ACTIVE)
+            continue;
+        // Calls that can not be compressed are retried on next update
+        if (storage_call_compress(call) == 0)
+            storage_list_remove(call);
+    }
+
+    pthread_mutex_unlock(&storage.lock);
+}
+
+void
+storage_deinit()
+{
+    storage_segment_t *segment, *next;
+
+    for (segment = storage.segments; segment; segment = next) {
+        next = segment->next;
+        munmap(segment->map, segment->size);
+        free(segment);
+    }
+    storage.segments = NULL;
+}
+
+void
+storage_stats(uint64_t *len, uint64_t *zlen)
+{
+    pthread_mutex_lock(&storage.lock);
+    *len = storage.len;
+    *zlen = storage.zlen;
+    pthread_mutex_unlock(&storage.lock);
+}
@@ -0,0 +1,219 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file storage.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to keep stored call frames out of process memory
+ *
+ * When capture storage is set to compressed, frames of calls that have
+ * not received packets for a while are compressed together in a block
+ * owned by the call. Blocks are expanded when their payloads are
+ * requested again and released when they have not been used for a
+ * while.
+ *
+ * When capture storage is set to disk, frames data are appended to log
+ * segments, temporary files mapped in memory, and packets point to the
+ * mapped data. Only frames headers and call data are kept in memory.
+ *
+ * When capture storage is set to index, frames read from mapped offline
+ * files only keep their position in the file, and their data is read
+ * again from the mapping when required. Only payloads, frames headers
+ * and call data are kept in memory.
+ *
+ * All functions that read or modify blocks must be called while the
+ * calls lock of the block call is held.
+ *
+ */
+#ifndef __SNGREP_STORAGE_H
+#define __SNGREP_STORAGE_H
+
+#include "config.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include "packet.h"
+#include "sip_call.h"
+
+//! Seconds without packets before a call is compressed
+#define STORAGE_IDLE            5
+//! Seconds without packets before a call in progress is compressed
+#define STORAGE_IDLE_ACTIVE     60
+//! Seconds between storage updates
+#define STORAGE_UPDATE_INTERVAL 1
+//! Size of each disk storage log segment
+#define STORAGE_SEGMENT_SIZE    (64 * 1024 * 1024)
+
+//! Shorter declaration of storage_block structure
+typedef struct storage_block storage_block_t;
+//! Shorter declaration of storage_segment structure
+typedef struct storage_segment storage_segment_t;
+
+/**
+ * @brief Compressed frames of some packets of a call
+ */
+struct storage_block
+{
+    //! Packets stored in this block
+    packet_t **packets;
+    //! Offset of each packet data in uncompressed block data
+    uint32_t *offsets;
+    //! Number of packets stored in this block
+    int count;
+    //! Compressed data
+    u_char *zdata;
+    //! Compressed data length
+    uint32_t zlen;
+    //! Uncompressed data length
+    uint32_t len;
+    //! Uncompressed data (only while block is expanded)
+    u_char *data;
+    //! Expanded block has been used since last update
+    bool used;
+    //! Next block of the same call
+    storage_block_t *next;
+    //! Next expanded block
+    storage_block_t *loaded_next;
+};
+
+/**
+ * @brief Disk storage log file mapped in memory
+ */
+struct storage_segment
+{
+    //! Mapped file data
+    u_char *map;
+    //! Mapped file size
+    size_t size;
+    //! Bytes already written
+    size_t used;
+    //! Stored packets whose data is in this segment
+    uint32_t packets;
+    //! Previous segment
+    storage_segment_t *next;
+};
+
+/**
+ * @brief Flag a call as having uncompressed packets
+ *
+ * Must be called each time a packet is added to a call.
+ *
+ * @param call Call receiving the packet
+ * @param packet Packet added to the call
+ */
+void
+storage_call_update(sip_call_t *call, packet_t *packet);
+
+/**
+ * @brief Move packet frames data to disk storage
+ *
+ * Frames data and payload are appended to the current log segment and
+ * released from memory. Frames are moved to call memory.
+ *
+ * @param call Call receiving the packet
+ * @param packet Packet added to the call
+ * @return 0 if packet data has been stored, 1 otherwise
+ */
+int
+storage_packet_store(sip_call_t *call, packet_t *packet);
+
+/**
+ * @brief Point packet frames data to their mapped input file
+ *
+ * Frames data copies are released and only their position in the file
+ * is kept. Payload is moved to call memory.
+ *
+ * @param call Call receiving the packet
+ * @param packet Packet added to the call
+ * @return 0 if packet frames have been indexed, 1 if they were not read
+ * from a mapped file
+ */
+int
+storage_packet_index(sip_call_t *call, packet_t *packet);
+
+/**
+ * @brief Remove all storage references to a call
+ *
+ * Must be called before the call is destroyed.
+ *
+ * @param call Call being destroyed
+ */
+void
+storage_call_remove(sip_call_t *call);
+
+/**
+ * @brief Release the disk storage of all packets of a call
+ *
+ * Segments are unmapped, releasing their disk space, once no stored
+ * packet points to their data and no more data will be written to them.
+ *
+ * @param call Call being destroyed
+ */
+void
+storage_call_release(sip_call_t *call);
+
+/**
+ * @brief Remove all storage references to all calls
+ *
+ * Used when all calls are removed at once, so they don't need to be
+ * removed one by one. Disk storage segments are released with the
+ * packets of the removed calls.
+ */
+void
+storage_clear();
+
+/**
+ * @brief Make packet frames and payload available
+ *
+ * If packet frames are compressed, the block storing them is expanded.
+ *
+ * @param packet Stored call packet
+ * @return 0 if packet data is available, 1 otherwise
+ */
+int
+storage_packet_load(packet_t *packet);
+
+/**
+ * @brief Compress idle calls and release unused expanded blocks
+ *
+ * This function must be called periodically while all calls are locked.
+ */
+void
+storage_update();
+
+/**
+ * @brief Get stored frames sizes
+ *
+ * @param len Uncompressed size of all compressed frames
+ * @param zlen Compressed size of all compressed frames
+ */
+void
+storage_stats(uint64_t *len, uint64_t *zlen);
+
+/**
+ * @brief Release all disk storage segments
+ *
+ * This function must be called once all stored calls have been destroyed.
+ */
+void
+storage_deinit();
+
+#endif /* __SNGREP_STORAGE_H */
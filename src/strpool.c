@@ -0,0 +1,192 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file strpool.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in strpool.h
+ *
+ */
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "strpool.h"
+
+//! Initial number of pool buckets
+#define STRPOOL_INITIAL_SIZE 1024
+
+//! Shorter declaration of strpool_entry structure
+typedef struct strpool_entry strpool_entry_t;
+
+/**
+ * @brief Shared string stored in the pool
+ */
+struct strpool_entry
+{
+    //! Next entry in the same bucket
+    strpool_entry_t *next;
+    //! String hash
+    uint32_t hash;
+    //! Number of users of this string
+    uint32_t refs;
+    //! String content
+    char str[];
+};
+
+/**
+ * @brief Pool of shared strings
+ */
+static struct
+{
+    //! Strings hash table
+    strpool_entry_t **buckets;
+    //! Number of buckets (always a power of 2)
+    size_t size;
+    //! Number of stored strings
+    size_t count;
+    //! Strings are shared by all parsing threads
+    pthread_mutex_t lock;
+} pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/**
+ * @brief Hash a string (FNV-1a)
+ */
+static uint32_t
+strpool_hash(const char *str, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * @brief Double the number of buckets of the pool
+ *
+ * @return 0 if buckets have been created, 1 otherwise
+ */
+static int
+strpool_grow()
+{
+    strpool_entry_t **buckets, *entry, *next;
+    size_t size = (pool.size) ? pool.size * 2 : STRPOOL_INITIAL_SIZE;
+    size_t i;
+
+    if (!(buckets = calloc(size, sizeof(strpool_entry_t *))))
+        return 1;
+
+    for (i = 0; i < pool.size; i++) {
+        for (entry = pool.buckets[i]; entry; entry = next) {
+            next = entry->next;
+            entry->next = buckets[entry->hash & (size - 1)];
+            buckets[entry->hash & (size - 1)] = entry;
+        }
+    }
+
+    free(pool.buckets);
+    pool.buckets = buckets;
+    pool.size = size;
+    return 0;
+}
+
+const char *
+strpool_get(const char *str, size_t len)
+{
+    strpool_entry_t *entry;
+    uint32_t hash = strpool_hash(str, len);
+
+    pthread_mutex_lock(&pool.lock);
+
+    // Check if this string is already shared
+    if (pool.size) {
+        for (entry = pool.buckets[hash & (pool.size - 1)]; entry; entry = entry->next) {
+            if (entry->hash == hash && !strncmp(entry->str, str, len) && !entry->str[len]) {
+                entry->refs++;
+                pthread_mutex_unlock(&pool.lock);
+                return entry->str;
+            }
+        }
+    }
+
+    // Keep buckets lists short
+    if (pool.count >= pool.size && strpool_grow() != 0 && !pool.size) {
+        pthread_mutex_unlock(&pool.lock);
+        return NULL;
+    }
+
+    if (!(entry = malloc(sizeof(strpool_entry_t) + len + 1))) {
+        pthread_mutex_unlock(&pool.lock);
+        return NULL;
+    }
+
+    entry->hash = hash;
+    entry->refs = 1;
+    memcpy(entry->str, str, len);
+    entry->str[len] = '\0';
+    entry->next = pool.buckets[hash & (pool.size - 1)];
+    pool.buckets[hash & (pool.size - 1)] = entry;
+    pool.count++;
+
+    pthread_mutex_unlock(&pool.lock);
+    return entry->str;
+}
+
+void
+strpool_put(const char *str)
+{
+    strpool_entry_t *entry, **prev;
+
+    if (!str)
+        return;
+
+    entry = (strpool_entry_t *) (str - offsetof(strpool_entry_t, str));
+
+    pthread_mutex_lock(&pool.lock);
+    if (--entry->refs == 0) {
+        // Unlink the string from its bucket
+        for (prev = &pool.buckets[entry->hash & (pool.size - 1)]; *prev != entry; prev = &(*prev)->next);
+        *prev = entry->next;
+        pool.count--;
+        free(entry);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+size_t
+strpool_count()
+{
+    size_t count;
+
+    pthread_mutex_lock(&pool.lock);
+    count = pool.count;
+    pthread_mutex_unlock(&pool.lock);
+
+    return count;
+}
@@ -0,0 +1,67 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file strpool.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to share repeated strings
+ *
+ * Header values like response texts, reasons or X-Call-IDs are repeated
+ * in lots of calls. Strings stored in the pool are kept only once and
+ * freed when the last user releases them.
+ *
+ */
+#ifndef __SNGREP_STRPOOL_H
+#define __SNGREP_STRPOOL_H
+
+#include "config.h"
+#include <stddef.h>
+
+/**
+ * @brief Get a shared copy of a string
+ *
+ * Each returned string must be released with strpool_put. Two strings
+ * from the pool have the same content if and only if they have the same
+ * address.
+ *
+ * @param str String to share (does not need to be NUL terminated)
+ * @param len String length
+ * @return shared NUL terminated copy or NULL if memory can not be allocated
+ */
+const char *
+strpool_get(const char *str, size_t len);
+
+/**
+ * @brief Release a shared string
+ *
+ * @param str String returned by strpool_get (or NULL)
+ */
+void
+strpool_put(const char *str);
+
+/**
+ * @brief Get the number of different strings in the pool
+ */
+size_t
+strpool_count();
+
+#endif /* __SNGREP_STRPOOL_H */
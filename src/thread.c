@@ -0,0 +1,152 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file thread.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in thread.h
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "thread.h"
+#include "setting.h"
+#include "util.h"
+
+//! CPU list setting of each thread class
+static const int thread_settings[THREAD_CLASS_COUNT] = {
+    SETTING_CAPTURE_CPUS_CAPTURE,
+    SETTING_CAPTURE_CPUS_PARSER,
+    SETTING_CAPTURE_CPUS_WORKER,
+    SETTING_CAPTURE_CPUS_IO,
+};
+
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+/**
+ * @brief Parse a CPU list like 0-3,8,10-11
+ *
+ * @return number of CPUs in the list, 0 if list is empty or invalid
+ */
+static int
+thread_parse_cpus(const char *list, cpu_set_t *set)
+{
+    char *end;
+    long first, last;
+
+    CPU_ZERO(set);
+    while (*list) {
+        first = strtol(list, &end, 10);
+        if (end == list || first < 0)
+            return 0;
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first)
+                return 0;
+        }
+        if (last >= CPU_SETSIZE)
+            return 0;
+        for (; first <= last; first++)
+            CPU_SET(first, set);
+
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return 0;
+        }
+        list = end;
+    }
+
+    return CPU_COUNT(set);
+}
+#endif
+
+/**
+ * @brief Thread start data
+ */
+struct thread_start {
+    //! Thread function
+    void *(*start)(void *);
+    //! Thread function argument
+    void *arg;
+    //! Thread name
+    char name[THREAD_NAME_MAXLEN];
+};
+
+/**
+ * @brief Name the running thread before invoking its function
+ *
+ * Naming the thread from itself avoids it running unnamed for a while.
+ */
+static void *
+thread_main(void *data)
+{
+    struct thread_start start = *(struct thread_start *) data;
+
+    sng_free(data);
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    pthread_setname_np(pthread_self(), start.name);
+#endif
+    return start.start(start.arg);
+}
+
+int
+thread_create(pthread_t *thread, enum thread_class tclass, const char *name,
+              void *(*start)(void *), void *arg)
+{
+    struct thread_start *data;
+    pthread_attr_t attr;
+    int ret;
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    const char *cpus = setting_get_value(thread_settings[tclass]);
+    cpu_set_t set;
+#endif
+
+    if (!(data = sng_malloc(sizeof(struct thread_start))))
+        return 1;
+    data->start = start;
+    data->arg = arg;
+    snprintf(data->name, sizeof(data->name), "%s", name);
+
+    pthread_attr_init(&attr);
+
+#ifdef HAVE_PTHREAD_ATTR_SETAFFINITY_NP
+    // Pin the thread before it runs, so its memory is allocated near its CPUs
+    if (cpus && strlen(cpus) && thread_parse_cpus(cpus, &set) > 0)
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+#else
+    (void) thread_settings;
+#endif
+
+    ret = pthread_create(thread, &attr, thread_main, data);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        sng_free(data);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file thread.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to create named threads pinned to configured CPUs
+ *
+ * Threads are grouped in classes, each one with its own CPU list
+ * setting. Threads of a class can run on any CPU of its list, so the
+ * scheduler can still balance them but they are kept close to the
+ * CPUs handling the NIC interrupts.
+ *
+ * Queues and buffers are allocated without touching their pages, so
+ * they are placed in the NUMA node of the pinned thread that uses
+ * them first.
+ *
+ */
+#ifndef __SNGREP_THREAD_H
+#define __SNGREP_THREAD_H
+
+#include "config.h"
+#include <pthread.h>
+
+//! Max thread name length (including NUL)
+#define THREAD_NAME_MAXLEN 16
+
+/**
+ * @brief Thread classes with their own CPU list
+ */
+enum thread_class {
+    //! Threads reading packets from capture sources
+    THREAD_CAPTURE = 0,
+    //! Thread parsing packets in order
+    THREAD_PARSER,
+    //! SIP parsing and TLS decryption workers
+    THREAD_WORKER,
+    //! Dump writer, HEP sender, metrics and call reaper threads
+    THREAD_IO,
+    THREAD_CLASS_COUNT
+};
+
+/**
+ * @brief Create a new thread of the given class
+ *
+ * Thread is named and pinned to the CPUs configured for its class when
+ * the system supports it. Invalid CPU lists are ignored.
+ *
+ * @param thread Created thread identifier
+ * @param tclass Thread class
+ * @param name Thread name displayed by system tools
+ * @param start Thread function
+ * @param arg Thread function argument
+ * @return 0 on success, 1 if thread can not be created
+ */
+int
+thread_create(pthread_t *thread, enum thread_class tclass, const char *name,
+              void *(*start)(void *), void *arg);
+
+#endif /* __SNGREP_THREAD_H */
@@ -0,0 +1,351 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file trigger.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Source of functions defined in trigger.h
+ *
+ * Capture threads only queue the Call-ID of triggered dialogs. The
+ * parser thread copies their packets with capture locked and writes
+ * them with capture unlocked, so dialogs rotated before being saved
+ * are just skipped.
+ *
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include "trigger.h"
+#include "capture.h"
+#include "match.h"
+#include "setting.h"
+#include "storage.h"
+#include "util.h"
+#include "vector.h"
+
+//! Shorter declaration of trigger structure
+typedef struct trigger trigger_t;
+
+/**
+ * @brief Trigger configuration and pending dialogs
+ */
+struct trigger {
+    //! Triggers are being checked
+    bool enabled;
+    //! Directory where triggered dialogs are saved
+    char dir[PATH_MAX];
+    //! Response codes that trigger a dialog save
+    bool codes[TRIGGER_MAXCODE];
+    //! Message payload patterns that trigger a dialog save
+    match_set_t *match;
+    //! Call-IDs of dialogs pending to be saved
+    vector_t *pending;
+    //! Lock for pending dialogs list
+    pthread_mutex_t lock;
+    //! Last time pending dialogs were saved
+    time_t last;
+    //! Number of saved dialogs
+    uint64_t saved;
+};
+
+//! Triggers status
+static trigger_t trigger = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * @brief Parse a comma separated list of response codes
+ *
+ * Each code can be an exact number (408) or a class (5xx).
+ *
+ * @return 0 on success, 1 if any code is invalid
+ */
+static int
+trigger_parse_codes(const char *value)
+{
+    char codes[MAX_SETTING_LEN];
+    char *code, *saveptr = NULL;
+    int i, num;
+
+    snprintf(codes, sizeof(codes), "%s", value);
+    for (code = strtok_r(codes, ", ", &saveptr); code; code = strtok_r(NULL, ", ", &saveptr)) {
+        if (strlen(code) == 3 && isdigit(code[0]) && !strcasecmp(code + 1, "xx")) {
+            num = (code[0] - '0') * 100;
+            if (num < 100 || num + 100 > TRIGGER_MAXCODE)
+                return 1;
+            for (i = num; i < num + 100; i++)
+                trigger.codes[i] = true;
+        } else {
+            num = atoi(code);
+            if (num < 100 || num >= TRIGGER_MAXCODE)
+                return 1;
+            trigger.codes[num] = true;
+        }
+    }
+
+    return 0;
+}
+
+int
+trigger_init(const char *dir)
+{
+    const char *match;
+
+    snprintf(trigger.dir, sizeof(trigger.dir), "%s", dir);
+    memset(trigger.codes, 0, sizeof(trigger.codes));
+    if (trigger_parse_codes(setting_get_value(SETTING_CAPTURE_TRIGGER_CODES)) != 0)
+        return 1;
+
+    if ((match = setting_get_value(SETTING_CAPTURE_TRIGGER_MATCH)) && strlen(match)) {
+        if (!(trigger.match = match_set_create(true))
+            || match_set_add(trigger.match, match) != 0
+            || match_set_compile(trigger.match) != 0) {
+            match_set_destroy(trigger.match);
+            trigger.match = NULL;
+            return 1;
+        }
+    }
+
+    trigger.pending = vector_create(0, 8);
+    vector_set_destroyer(trigger.pending, vector_generic_destroyer);
+    __atomic_store_n(&trigger.enabled, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void
+trigger_deinit()
+{
+    if (!__atomic_exchange_n(&trigger.enabled, false, __ATOMIC_ACQ_REL))
+        return;
+
+    pthread_mutex_lock(&trigger.lock);
+    vector_destroy(trigger.pending);
+    trigger.pending = NULL;
+    pthread_mutex_unlock(&trigger.lock);
+
+    match_set_destroy(trigger.match);
+    trigger.match = NULL;
+}
+
+void
+trigger_check_msg(sip_msg_t *msg, const char *payload)
+{
+    sip_call_t *call = msg->call;
+
+    if (!__atomic_load_n(&trigger.enabled, __ATOMIC_ACQUIRE) || call->triggered)
+        return;
+
+    if (msg_is_request(msg) || msg->reqresp >= TRIGGER_MAXCODE || !trigger.codes[msg->reqresp]) {
+        if (!trigger.match || !match_set_check(trigger.match, payload))
+            return;
+    }
+
+    // Each dialog is only saved once
+    call->triggered = true;
+    trigger_callid(call->callid);
+}
+
+void
+trigger_callid(const char *callid)
+{
+    char *pending;
+
+    if (!__atomic_load_n(&trigger.enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    if (!(pending = sng_malloc(strlen(callid) + 1)))
+        return;
+    strcpy(pending, callid);
+
+    pthread_mutex_lock(&trigger.lock);
+    if (trigger.pending) {
+        vector_append(trigger.pending, pending);
+    } else {
+        sng_free(pending);
+    }
+    pthread_mutex_unlock(&trigger.lock);
+}
+
+/**
+ * @brief Build the file name of a saved dialog
+ *
+ * Call-ID characters that are not safe in file names are replaced.
+ *
+ * @return 0 if the file name fits, 1 if it would be truncated
+ */
+static int
+trigger_filename(char *filename, size_t len, const char *callid, time_t now)
+{
+    char date[32], name[65];
+    struct tm tm;
+    int i;
+
+    localtime_r(&now, &tm);
+    strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+
+    for (i = 0; callid[i] && i < (int) sizeof(name) - 1; i++) {
+        name[i] = (isalnum((unsigned char) callid[i]) || strchr(".-_", callid[i])) ? callid[i] : '_';
+    }
+    name[i] = '\0';
+
+    if (snprintf(filename, len, "%s/%s-%s.pcap", trigger.dir, date, name) >= (int) len)
+        return 1;
+
+    return 0;
+}
+
+/**
+ * @brief Copy all stored packets of a dialog in time order
+ *
+ * This must be invoked with capture locked.
+ *
+ * @return number of copied packets
+ */
+static int
+trigger_copy_packets(sip_call_t *call, packet_t **packets)
+{
+    int nmsgs = vector_count(call->msgs), nrtp = vector_count(call->rtp_packets);
+    int i = 0, j = 0, count = 0;
+    uint64_t mts = 0, rts = 0;
+    sip_msg_t *msg = NULL;
+    packet_t *packet;
+
+    // Messages and RTP packets are already sorted, merge them
+    while (i < nmsgs || j < nrtp) {
+        if (i < nmsgs) {
+            msg = vector_item(call->msgs, i);
+            mts = packet_time_ns(msg->packet);
+        }
+        if (j < nrtp)
+            rts = packet_time_ns(vector_item(call->rtp_packets, j));
+
+        if (j >= nrtp || (i < nmsgs && mts <= rts)) {
+            packet = msg->packet;
+            i++;
+        } else {
+            packet = vector_item(call->rtp_packets, j++);
+        }
+
+        // Expand compressed frames if required
+        if (storage_packet_load(packet) == 0)
+            packets[count++] = packet_clone(packet);
+    }
+
+    return count;
+}
+
+/**
+ * @brief Save all stored packets of a dialog in its own file
+ */
+static void
+trigger_save(const char *callid, time_t now)
+{
+    char filename[PATH_MAX];
+    packet_t **packets;
+    pcap_dumper_t *pd;
+    sip_call_t *call;
+    frame_t *frame;
+    vector_iter_t it;
+    int count, i;
+
+    capture_lock();
+    // Dialog may have been rotated before being saved
+    if (!(call = sip_find_by_callid(callid))) {
+        capture_unlock();
+        return;
+    }
+
+    count = vector_count(call->msgs) + vector_count(call->rtp_packets);
+    if (!(packets = sng_malloc(sizeof(packet_t *) * (count + 1)))) {
+        capture_unlock();
+        return;
+    }
+    count = trigger_copy_packets(call, packets);
+    capture_unlock();
+
+    // Never write to a truncated path, just drop the copied packets
+    if (trigger_filename(filename, sizeof(filename), callid, now) == 0
+        && (pd = dump_open(filename, NULL))) {
+        for (i = 0; i < count; i++) {
+            it = vector_iterator(packets[i]->frames);
+            while ((frame = vector_iterator_next(&it)))
+                pcap_dump((u_char *) pd, frame->header, frame->data);
+        }
+        dump_close(pd);
+        trigger.saved++;
+    }
+
+    for (i = 0; i < count; i++)
+        packet_destroy(packets[i]);
+    sng_free(packets);
+}
+
+void
+trigger_update()
+{
+    time_t now = time(NULL);
+    vector_t *pending;
+    sip_call_t *call;
+    vector_iter_t it;
+    char *callid;
+
+    if (!__atomic_load_n(&trigger.enabled, __ATOMIC_ACQUIRE))
+        return;
+
+    if (trigger.last >= now)
+        return;
+    trigger.last = now;
+
+    // Save all active calls when requested by signal
+    if (was_sigusr2_received()) {
+        capture_lock();
+        it = vector_iterator(sip_active_calls_vector());
+        while ((call = vector_iterator_next(&it)))
+            trigger_callid(call->callid);
+        capture_unlock();
+    }
+
+    // Take pending dialogs, new triggers can be queued meanwhile
+    pthread_mutex_lock(&trigger.lock);
+    if (!vector_count(trigger.pending)) {
+        pthread_mutex_unlock(&trigger.lock);
+        return;
+    }
+    pending = trigger.pending;
+    trigger.pending = vector_create(0, 8);
+    vector_set_destroyer(trigger.pending, vector_generic_destroyer);
+    pthread_mutex_unlock(&trigger.lock);
+
+    it = vector_iterator(pending);
+    while ((callid = vector_iterator_next(&it)))
+        trigger_save(callid, now);
+    vector_destroy(pending);
+}
+
+uint64_t
+trigger_saved_count()
+{
+    return trigger.saved;
+}
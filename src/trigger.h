@@ -0,0 +1,98 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file trigger.h
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * @brief Functions to save dialogs when a trigger condition is met
+ *
+ * When capture.trigger.dir setting is configured, dialogs receiving a
+ * configured response code or a message matching the trigger pattern
+ * are saved in their own pcap file, including their RTP packets if
+ * they are being captured. Dialogs can also be requested by Call-ID
+ * through the metrics endpoint, and all active calls are saved when
+ * SIGUSR2 is received.
+ *
+ * Combined with rotated capture output files limited by size or time,
+ * this allows running unattended keeping only recent raw packets while
+ * failing dialogs are saved apart.
+ *
+ */
+#ifndef __SNGREP_TRIGGER_H
+#define __SNGREP_TRIGGER_H
+
+#include "config.h"
+#include <stdint.h>
+#include "sip.h"
+
+//! Max SIP response code that can trigger a dialog save
+#define TRIGGER_MAXCODE 700
+
+/**
+ * @brief Start saving dialogs matching configured triggers
+ *
+ * @param dir Directory where triggered dialogs are saved
+ * @return 0 on success, 1 if trigger settings are invalid
+ */
+int
+trigger_init(const char *dir);
+
+/**
+ * @brief Discard pending dialogs and release trigger data
+ */
+void
+trigger_deinit();
+
+/**
+ * @brief Check if a new message triggers saving its dialog
+ *
+ * This function is invoked by capture threads with message call locked.
+ *
+ * @param msg Parsed SIP message
+ * @param payload NUL terminated message payload
+ */
+void
+trigger_check_msg(sip_msg_t *msg, const char *payload);
+
+/**
+ * @brief Request saving a dialog by its Call-ID
+ *
+ * This function can be called from any thread.
+ */
+void
+trigger_callid(const char *callid);
+
+/**
+ * @brief Save pending triggered dialogs
+ *
+ * Invoked periodically by the parser thread, at most once per second.
+ */
+void
+trigger_update();
+
+/**
+ * @brief Get the number of saved triggered dialogs
+ */
+uint64_t
+trigger_saved_count();
+
+#endif /* __SNGREP_TRIGGER_H */
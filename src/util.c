@@ -46,11 +46,25 @@ typedef volatile sig_atomic_t signal_flag_type;
 
 static signal_flag_type sigterm_received = 0;
 
+static signal_flag_type sigusr1_received = 0;
+
+static signal_flag_type sigusr2_received = 0;
+
 static void sigterm_handler(int signum)
 {
     sigterm_received = 1;
 }
 
+static void sigusr1_handler(int signum)
+{
+    sigusr1_received = 1;
+}
+
+static void sigusr2_handler(int signum)
+{
+    sigusr2_received = 1;
+}
+
 void setup_sigterm_handler(void)
 {
     // set up SIGTERM handler (also used for SIGINT and SIGQUIT)
@@ -71,6 +85,14 @@ void setup_sigterm_handler(void)
     // dead ssh connections.
     if (signal(SIGCONT, sigterm_handler) == SIG_ERR)
         exit(EXIT_FAILURE);
+
+    // Handle SIGUSR1 signal, used to request a dump of timing counters
+    if (signal(SIGUSR1, sigusr1_handler) == SIG_ERR)
+        exit(EXIT_FAILURE);
+
+    // Handle SIGUSR2 signal, used to request saving all active calls
+    if (signal(SIGUSR2, sigusr2_handler) == SIG_ERR)
+        exit(EXIT_FAILURE);
 }
 
 bool was_sigterm_received(void)
@@ -78,6 +100,20 @@ bool was_sigterm_received(void)
     return (sigterm_received == 1);
 }
 
+bool was_sigusr1_received(void)
+{
+    bool received = (sigusr1_received == 1);
+    sigusr1_received = 0;
+    return received;
+}
+
+bool was_sigusr2_received(void)
+{
+    bool received = (sigusr2_received == 1);
+    sigusr2_received = 0;
+    return received;
+}
+
 void *
 sng_malloc(size_t size)
 {
@@ -103,6 +139,26 @@ sng_free(void *ptr)
         free(ptr);
 }
 
+void *
+sng_malloc_tag(enum memstat_tag tag, size_t size)
+{
+    void *data;
+
+    if ((data = sng_malloc(size)))
+        memstat_add(tag, size);
+    return data;
+}
+
+void
+sng_free_tag(enum memstat_tag tag, void *ptr, size_t size)
+{
+    if (!ptr)
+        return;
+
+    memstat_add(tag, -(int64_t) size);
+    free(ptr);
+}
+
 char *
 sng_basename(const char *name)
 {
@@ -117,15 +173,13 @@ sng_basename(const char *name)
     return (char *) base;
 }
 
-int
-timeval_is_older(struct timeval t1, struct timeval t2)
+struct timeval
+timestamp_to_timeval(uint64_t ts)
 {
-    long long int t1sec, t2sec;
-    t1sec = t1.tv_sec;
-    t1sec = t1sec * 1000000;
-    t2sec = t2.tv_sec;
-    t2sec = t2sec * 1000000;
-    return ((t2sec + t2.tv_usec) - (t1sec + t1.tv_usec) <= 0);
+    struct timeval time;
+    time.tv_sec = ts / 1000000000;
+    time.tv_usec = (ts % 1000000000) / 1000;
+    return time;
 }
 
 const char *
@@ -166,26 +220,172 @@ timeval_to_duration(struct timeval start, struct timeval end, char *out)
 }
 
 const char *
-timeval_to_delta(struct timeval start, struct timeval end, char *out)
+timestamp_to_delta(uint64_t start, uint64_t end, char *out)
 {
-    long diff;
-    int nsec, nusec;
+    uint64_t diff;
     int sign;
 
-    if (!out || !start.tv_sec || !end.tv_sec)
+    if (!out || !start || !end)
         return NULL;
 
-    diff = end.tv_sec  * 1000000 + end.tv_usec;
-    diff -= start.tv_sec * 1000000 + start.tv_usec;
+    // Difference in microseconds, sign is printed apart
+    if (end >= start) {
+        diff = (end - start) / 1000;
+        sign = '+';
+    } else {
+        diff = (start - end) / 1000;
+        sign = '-';
+    }
 
-    nsec = diff / 1000000;
-    nusec = labs(diff - (nsec * 1000000));
+    sprintf(out, "%c%d.%06d", sign, (int) (diff / 1000000), (int) (diff % 1000000));
+    return out;
+}
+/**
+ * @brief Skip a group or bracket expression
+ *
+ * @return position after the closing character or NULL if not closed
+ */
+static const char *
+expr_skip_group(const char *expr)
+{
+    int depth = 0;
 
-    sign = (diff >= 0) ? '+' : '-';
+    for (; *expr; expr++) {
+        if (*expr == '\\') {
+            if (!*++expr)
+                return NULL;
+        } else if (*expr == '[') {
+            // Closing bracket can be the first character of the list
+            expr++;
+            if (*expr == '^')
+                expr++;
+            if (*expr == ']')
+                expr++;
+            while (*expr && *expr != ']') {
+                if (*expr == '\\' && expr[1])
+                    expr++;
+                expr++;
+            }
+            if (!*expr)
+                return NULL;
+            if (depth == 0)
+                return expr + 1;
+        } else if (*expr == '(') {
+            depth++;
+        } else if (*expr == ')') {
+            if (--depth == 0)
+                return expr + 1;
+        }
+    }
 
-    sprintf(out, "%c%d.%06d", sign, abs(nsec), nusec);
-    return out;
+    return NULL;
 }
+
+int
+expr_required_literal(const char *expr, char *literal)
+{
+    char current[EXPR_LITERAL_MAXLEN];
+    size_t len = 0, best = 0;
+    int only = 1;
+    const char *c = expr;
+
+    literal[0] = '\0';
+
+    // Alternatives and inline options can make any text optional
+    if (strchr(expr, '|') || strstr(expr, "(?"))
+        return 0;
+
+#define LITERAL_END() \
+    do { \
+        if (len > best) { \
+            memcpy(literal, current, len); \
+            literal[best = len] = '\0'; \
+        } \
+        len = 0; \
+    } while (0)
+
+    while (*c) {
+        switch (*c) {
+            case '\\':
+                // Escaped punctuation characters are literals (but GNU word anchors)
+                if (c[1] && ispunct((unsigned char) c[1]) && !strchr("<>`'", c[1])) {
+                    if (len < EXPR_LITERAL_MAXLEN - 1) {
+                        current[len++] = c[1];
+                    } else {
+                        only = 0;
+                    }
+                    c += 2;
+                    continue;
+                }
+                LITERAL_END();
+                only = 0;
+                c += (c[1]) ? 2 : 1;
+                continue;
+            case '(':
+            case '[':
+                LITERAL_END();
+                only = 0;
+                if (!(c = expr_skip_group(c)))
+                    return 0;
+                continue;
+            case '{':
+                // Previous character may be optional, bounds are not text
+                if (len > 0)
+                    len--;
+                LITERAL_END();
+                only = 0;
+                if (!(c = strchr(c, '}')))
+                    return 0;
+                c++;
+                continue;
+            case '?':
+            case '*':
+                // Previous character is optional
+                if (len > 0)
+                    len--;
+                LITERAL_END();
+                only = 0;
+                break;
+            case '+':
+                // Previous character is required, but may be repeated
+                LITERAL_END();
+                only = 0;
+                break;
+            case '.':
+            case '^':
+            case '$':
+            case ')':
+            case ']':
+            case '}':
+                LITERAL_END();
+                only = 0;
+                break;
+            default:
+                if (len < EXPR_LITERAL_MAXLEN - 1) {
+                    current[len++] = *c;
+                } else {
+                    only = 0;
+                }
+                break;
+        }
+        c++;
+    }
+    LITERAL_END();
+
+#undef LITERAL_END
+
+    return only;
+}
+
+bool
+expr_literal_found(const char *data, const char *literal, bool caseless)
+{
+    if (!literal[0])
+        return true;
+
+    return (caseless) ? strcasestr(data, literal) != NULL : strstr(data, literal) != NULL;
+}
+
 char *
 strtrim(char *str)
 {
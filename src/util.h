@@ -31,10 +31,14 @@
 
 // Capture headers has some fixes for pcap timevals in BSD systems
 #include "capture.h"
+#include "memstat.h"
 
 // Max Memmory allocation
 #define MALLOC_MAX_SIZE 102400
 
+// Max length of the text required by an expression
+#define EXPR_LITERAL_MAXLEN 128
+
 // Stringify numbers for concatenation
 #define STRINGIFY_ARG(x)    #x
 #define STRINGIFY(x)        STRINGIFY_ARG(x)
@@ -51,6 +55,20 @@ sng_malloc(size_t size);
 void
 sng_free(void *ptr);
 
+/**
+ * @brief Wrapper for memory allocation accounted to a subsystem
+ */
+void *
+sng_malloc_tag(enum memstat_tag tag, size_t size);
+
+/**
+ * @brief Wrapper for deallocation of memory accounted to a subsystem
+ *
+ * @param size Same size used to allocate the memory
+ */
+void
+sng_free_tag(enum memstat_tag tag, void *ptr, size_t size);
+
 /*
  * @brief Generic implementation of basename
  */
@@ -58,14 +76,10 @@ char *
 sng_basename(const char *name);
 
 /**
- * @brief Compare two timeval structures
- *
- * @param t1 First timeval structure
- * @param t2 Second timval structure
- * @return 1 if t1 > t2, 0 if t1 <= t2
+ * @brief Convert a nanoseconds timestamp to timeval
  */
-int
-timeval_is_older(struct timeval t1, struct timeval t2);
+struct timeval
+timestamp_to_timeval(uint64_t ts);
 
 /**
  * @brief Convert timeval to yyyy/mm/dd format
@@ -88,10 +102,10 @@ const char *
 timeval_to_duration(struct timeval start, struct timeval end, char *out);
 
 /**
- * @brief Convert timeval diference to +mm:ss.mmmmmm
+ * @brief Convert nanoseconds timestamps diference to +ss.mmmmmm
  */
 const char *
-timeval_to_delta(struct timeval start, struct timeval end, char *out);
+timestamp_to_delta(uint64_t start, uint64_t end, char *out);
 
 /**
  * @brief Return a given string without trailing spaces
@@ -100,7 +114,32 @@ char *
 strtrim(char *str);
 
 /**
- * @brief Set up handler for SIGTERM, SIGINT and SIGQUIT
+ * @brief Get the literal text required by a regular expression
+ *
+ * Any data matching the expression will contain the returned text, so
+ * data without it can be discarded without running the expression.
+ * Expressions with alternatives or inline options are not checked.
+ *
+ * @param expr Regular expression
+ * @param literal Buffer to store the required text (EXPR_LITERAL_MAXLEN)
+ * @return 1 if the expression is just the literal text, 0 otherwise
+ */
+int
+expr_required_literal(const char *expr, char *literal);
+
+/**
+ * @brief Check if data contains the required text of an expression
+ *
+ * @param data NUL terminated data
+ * @param literal Required text from expr_required_literal
+ * @param caseless Ignore case when searching the text
+ * @return true if text is empty or it is contained in data
+ */
+bool
+expr_literal_found(const char *data, const char *literal, bool caseless);
+
+/**
+ * @brief Set up handler for SIGTERM, SIGINT, SIGQUIT and SIGUSR1
  */
 void setup_sigterm_handler(void);
 
@@ -111,4 +150,18 @@ void setup_sigterm_handler(void);
  */
 bool was_sigterm_received(void);
 
+/**
+ * @brief Check if SIGUSR1 was received since last check
+ *
+ * @return true if a timing counters dump was requested
+ */
+bool was_sigusr1_received(void);
+
+/**
+ * @brief Check if SIGUSR2 was received since last check
+ *
+ * @return true if saving all active calls was requested
+ */
+bool was_sigusr2_received(void);
+
 #endif /* __SNGREP_UTIL_H */
@@ -71,13 +71,11 @@ vector_destroy_items(vector_t *vector)
     // Nothing to free. Done
     if (!vector) return;
 
-    // If vector contains items
-    if (vector->count) {
-        for (i = 0; i < vector->count; i++) {
-            free(vector->list[i]);
-        }
-        free(vector->list);
+    // Free all vector items
+    for (i = 0; i < vector->count; i++) {
+        free(vector->list[i]);
     }
+    free(vector->list);
     free(vector);
 }
 
@@ -85,8 +83,6 @@ vector_t *
 vector_clone(vector_t *original)
 {
     vector_t *clone;
-    vector_iter_t it;
-    void *item;
 
     // Check we have a valid vector pointer
     if (!original)
@@ -98,9 +94,7 @@ vector_clone(vector_t *original)
     vector_set_sorter(clone, original->sorter);
 
     // Fill the clone vector with the same elements
-    it = vector_iterator(original);
-    while ((item = vector_iterator_next(&it)))
-        vector_append(clone, item);
+    vector_append_items(clone, original->list, original->count);
 
     // Return the cloned vector
     return clone;
@@ -132,9 +126,92 @@ vector_copy_if(vector_t *original, int (*filter)(void *item))
 void
 vector_clear(vector_t *vector)
 {
-    // Remove all items in the vector
-    while (vector_first(vector))
-        vector_remove(vector, vector_first(vector));
+    void **list = vector->list;
+    uint32_t count = vector->count;
+    uint32_t limit = vector->limit;
+    uint32_t i;
+
+    // Without destroyer, items can be just forgotten
+    if (!vector->destroyer) {
+        if (vector->list)
+            memset(vector->list, 0, sizeof(void *) * vector->count);
+        vector->count = 0;
+        return;
+    }
+
+    // Detach all items before destroying them
+    vector->list = NULL;
+    vector->count = vector->limit = 0;
+
+    for (i = 0; i < count; i++)
+        vector->destroyer(list[i]);
+
+    // Keep allocated space unless items were added while destroying
+    if (!vector->list) {
+        memset(list, 0, sizeof(void *) * count);
+        vector->list = list;
+        vector->limit = limit;
+    } else {
+        free(list);
+    }
+}
+
+int
+vector_reserve(vector_t *vector, int size)
+{
+    void **list;
+    uint32_t allocated, limit;
+
+    if (size < 0)
+        return 1;
+
+    // Initial space is not allocated until the vector is used
+    allocated = (vector->list) ? vector->limit : 0;
+    if (vector->list && allocated >= (uint32_t) size)
+        return 0;
+
+    limit = vector->limit;
+    if (limit < (uint32_t) size) {
+        // Grow geometrically so appending is amortized constant time
+        limit = vector->limit * 2;
+        if (limit < vector->limit + vector->step)
+            limit = vector->limit + vector->step;
+        if (limit < (uint32_t) size)
+            limit = size;
+    }
+    if (!limit)
+        limit = 1;
+
+    // Add more memory to the list
+    if (!(list = realloc(vector->list, sizeof(void *) * limit)))
+        return 1;
+
+    // Initialize new allocated memory
+    memset(list + allocated, 0, sizeof(void *) * (limit - allocated));
+    vector->list = list;
+    vector->limit = limit;
+    return 0;
+}
+
+void
+vector_shrink(vector_t *vector)
+{
+    void **list;
+
+    if (vector->count == vector->limit)
+        return;
+
+    if (!vector->count) {
+        free(vector->list);
+        vector->list = NULL;
+        vector->limit = 0;
+        return;
+    }
+
+    if ((list = realloc(vector->list, sizeof(void *) * vector->count))) {
+        vector->list = list;
+        vector->limit = vector->count;
+    }
 }
 
 int
@@ -144,21 +221,9 @@ vector_append(vector_t *vector, void *item)
     if (!item)
         return vector->count;
 
-    // Check if the vector has been initializated
-    if (!vector->list) {
-        vector->list = malloc(sizeof(void *) * vector->limit);
-        memset(vector->list, 0, sizeof(void *) * vector->limit);
-    }
-
     // Check if we need to increase vector size
-    if (vector->count == vector->limit) {
-        // Increase vector size
-        vector->limit += vector->step;
-        // Add more memory to the list
-        vector->list = realloc(vector->list, sizeof(void *) * vector->limit);
-        // Initialize new allocated memory
-        memset(vector->list + vector->limit - vector->step, 0, vector->step);
-    }
+    if (vector_reserve(vector, vector->count + 1) != 0)
+        return vector->count;
 
     // Add item to the end of the list
     vector->list[vector->count++] = item;
@@ -172,20 +237,39 @@ vector_append(vector_t *vector, void *item)
 }
 
 int
-vector_append_vector(vector_t *dst, vector_t *src)
+vector_append_items(vector_t *vector, void **items, int count)
 {
-    if (!dst || !src)
-        return 1;
+    int i;
 
-    vector_iter_t it = vector_iterator(src);
+    if (!count)
+        return 0;
 
-    void *item;
-    while ((item = vector_iterator_next(&it)))
-        vector_append(dst, item);
+    // Allocate space for all items at once
+    if (vector_reserve(vector, vector->count + count) != 0)
+        return 1;
+
+    for (i = 0; i < count; i++) {
+        if (!items[i])
+            continue;
+        vector->list[vector->count++] = items[i];
+        // Check if vector has a sorter
+        if (vector->sorter) {
+            vector->sorter(vector, items[i]);
+        }
+    }
 
     return 0;
 }
 
+int
+vector_append_vector(vector_t *dst, vector_t *src)
+{
+    if (!dst || !src)
+        return 1;
+
+    return vector_append_items(dst, src->list, src->count);
+}
+
 int
 vector_insert(vector_t *vector, void *item, int pos)
 {
@@ -214,16 +298,23 @@ vector_insert(vector_t *vector, void *item, int pos)
 void
 vector_remove(vector_t *vector, void *item)
 {
-    // Get item position
-    int idx = vector_index(vector, item);
+    vector_remove_index(vector, vector_index(vector, item));
+}
+
+void
+vector_remove_index(vector_t *vector, int index)
+{
+    void *item;
+
     // Not found in the vector
-    if (idx == -1)
+    if (index < 0 || index >= vector->count)
         return;
 
+    item = vector->list[index];
     // Decrease item counter
     vector->count--;
     // Move the rest of the elements one position up
-    memmove(vector->list + idx, vector->list + idx + 1, sizeof(void *) * (vector->count - idx));
+    memmove(vector->list + index, vector->list + index + 1, sizeof(void *) * (vector->count - index));
     // Reset vector last position
     vector->list[vector->count] = NULL;
 
@@ -233,6 +324,56 @@ vector_remove(vector_t *vector, void *item)
     }
 }
 
+void
+vector_remove_range(vector_t *vector, int index, int count)
+{
+    int i;
+
+    // Adjust range to vector items
+    if (index < 0 || index >= vector->count || count <= 0)
+        return;
+    if (count > vector->count - index)
+        count = vector->count - index;
+
+    // Destroy the items if vector has a destroyer
+    if (vector->destroyer) {
+        for (i = index; i < index + count; i++)
+            vector->destroyer(vector->list[i]);
+    }
+
+    // Move the rest of the elements up at once
+    vector->count -= count;
+    memmove(vector->list + index, vector->list + index + count, sizeof(void *) * (vector->count - index));
+    // Reset vector released positions
+    memset(vector->list + vector->count, 0, sizeof(void *) * count);
+}
+
+void
+vector_swap_remove(vector_t *vector, void *item)
+{
+    int idx = vector_index(vector, item);
+
+    // Not found in the vector
+    if (idx == -1)
+        return;
+
+    // Move last item to the removed position
+    vector->list[idx] = vector->list[--vector->count];
+    vector->list[vector->count] = NULL;
+
+    // Destroy the item if vector has a destroyer
+    if (vector->destroyer) {
+        vector->destroyer(item);
+    }
+}
+
+void
+vector_sort(vector_t *vector, int (*cmp)(const void *, const void *))
+{
+    if (vector->count > 1)
+        qsort(vector->list, vector->count, sizeof(void *), cmp);
+}
+
 void
 vector_set_destroyer(vector_t *vector, void (*destroyer) (void *item))
 {
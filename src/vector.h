@@ -47,7 +47,7 @@ struct vector {
     uint32_t count;
     //! Total space in list (available + elements)
     uint32_t limit;
-    //! Number of new spaces to be reallocated
+    //! Minimum number of new spaces to be reallocated
     uint8_t step;
     //! Elements of the vector
     void **list;
@@ -72,7 +72,8 @@ struct vector_iter {
  * @brief Create a new vector
  *
  * Create a new vector with initial size and
- * step increase settings.
+ * step increase settings. Vector space grows
+ * geometrically, step is only the minimum increase.
  */
 vector_t *
 vector_create(int limit, int step);
@@ -112,10 +113,28 @@ vector_copy_if(vector_t *original, int (*filter)(void *item));
 /**
  * @brief Remove all items of vector
  *
+ * Vector destroyer is invoked for each item after all
+ * of them have been removed.
  */
 void
 vector_clear(vector_t *vector);
 
+/**
+ * @brief Make sure vector has space for a number of items
+ *
+ * @param vector Vector to grow
+ * @param size Total number of items the vector must fit
+ * @return 0 in case of success, 1 otherwise
+ */
+int
+vector_reserve(vector_t *vector, int size);
+
+/**
+ * @brief Release vector space not used by its items
+ */
+void
+vector_shrink(vector_t *vector);
+
 /**
  * @brief Append an item to vector
  *
@@ -127,6 +146,20 @@ vector_clear(vector_t *vector);
 int
 vector_append(vector_t *vector, void *item);
 
+/**
+ * @brief Append multiple items to vector
+ *
+ * Space for all items is allocated once. NULL items
+ * are skipped.
+ *
+ * @param vector Vector that will append the new items
+ * @param items Array of items
+ * @param count Number of items in the array
+ * @return 0 in case of success, 1 otherwise
+ */
+int
+vector_append_items(vector_t *vector, void **items, int count);
+
 /**
  * @brief Append a vector to another vector
  * @param dst Vector that will append the new items
@@ -150,6 +183,43 @@ vector_insert(vector_t *vector, void *item, int pos);
 void
 vector_remove(vector_t *vector, void *item);
 
+/**
+ * @brief Remove the item in a given vector position
+ *
+ * Following items are moved one position up.
+ */
+void
+vector_remove_index(vector_t *vector, int index);
+
+/**
+ * @brief Remove a number of items starting at given vector position
+ *
+ * Following items are moved up with a single memory move.
+ */
+void
+vector_remove_range(vector_t *vector, int index, int count);
+
+/**
+ * @brief Remove item from vector without keeping items order
+ *
+ * Last item of the vector is moved to the removed item
+ * position, so no other items are moved.
+ */
+void
+vector_swap_remove(vector_t *vector, void *item);
+
+/**
+ * @brief Sort all vector items
+ *
+ * Items are sorted at once using qsort, vector sorter
+ * is not invoked.
+ *
+ * @param vector Vector to sort
+ * @param cmp qsort compare function, receiving pointers to items
+ */
+void
+vector_sort(vector_t *vector, int (*cmp)(const void *, const void *));
+
 /**
  * @brief Set the vector destroyer
  *
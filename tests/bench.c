@@ -0,0 +1,628 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file bench.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Microbenchmarks of packet parsing and storage kernels
+ *
+ * Each benchmark runs a fixed number of iterations BENCH_RUNS times over
+ * the same generated input and prints the median and minimum time per
+ * iteration, one tab separated line per benchmark, so results of two
+ * builds can be compared line by line.
+ *
+ * Usage: microbench [name-prefix]
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/capture.h"
+#include "../src/filter.h"
+#include "../src/hash.h"
+#include "../src/option.h"
+#include "../src/rtp.h"
+#include "../src/setting.h"
+#include "../src/sip.h"
+#include "../src/vector.h"
+
+//! Measured runs of each benchmark
+#define BENCH_RUNS 5
+//! Generated keys and items for container benchmarks
+#define BENCH_ITEMS 100000
+//! Max number of generated calls
+#define BENCH_CALLS 10000
+//! Ethernet header size of generated frames
+#define BENCH_LINK_HL 14
+
+//! Benchmark name prefix given in command line
+static const char *bench_prefix = NULL;
+//! Results are accumulated here so kernels are not optimized away
+static volatile uintptr_t bench_sink = 0;
+
+//! Capture source of generated frames
+static capture_info_t bench_capinfo;
+//! SIP INVITE with SDP used by parser benchmarks
+static char bench_invite[2048];
+//! Parsed packet and message of bench_invite
+static packet_t *bench_pkt;
+static sip_msg_t *bench_msg;
+//! Headers positions of bench_invite
+static sip_scan_t bench_scan;
+//! Generated container keys and items
+static char bench_keys[BENCH_ITEMS][32];
+static int bench_items[BENCH_ITEMS];
+//! Hash table and vector of container benchmarks
+static htable_t *bench_table;
+static vector_t *bench_vector;
+//! Stored calls and their first media destination
+static int bench_ncalls = 0;
+static address_t bench_media[BENCH_CALLS];
+
+/**
+ * @brief Get monotonic time in nanoseconds
+ */
+static uint64_t
+bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+bench_cmp_time(const void *a, const void *b)
+{
+    uint64_t ta = *(const uint64_t *) a, tb = *(const uint64_t *) b;
+    return (ta > tb) - (ta < tb);
+}
+
+/**
+ * @brief Check if a benchmark has been requested in command line
+ */
+static bool
+bench_enabled(const char *name)
+{
+    return !bench_prefix || !strncmp(name, bench_prefix, strlen(bench_prefix));
+}
+
+/**
+ * @brief Run a benchmark and print its result line
+ *
+ * Setup and teardown functions are invoked before and after each run
+ * and are not measured.
+ */
+static void
+bench_run(const char *name, int iterations, void (*setup)(int), void (*kernel)(int),
+          void (*teardown)(int))
+{
+    uint64_t times[BENCH_RUNS], start;
+    int run;
+
+    if (!bench_enabled(name))
+        return;
+
+    // Warm up caches and allocators
+    if (setup) setup(iterations);
+    kernel(iterations);
+    if (teardown) teardown(iterations);
+
+    for (run = 0; run < BENCH_RUNS; run++) {
+        if (setup) setup(iterations);
+        start = bench_now();
+        kernel(iterations);
+        times[run] = bench_now() - start;
+        if (teardown) teardown(iterations);
+    }
+
+    qsort(times, BENCH_RUNS, sizeof(uint64_t), bench_cmp_time);
+    printf("%s\t%d\t%.1f\t%.1f\n", name, iterations,
+           (double) times[BENCH_RUNS / 2] / iterations, (double) times[0] / iterations);
+    fflush(stdout);
+}
+
+/**
+ * @brief Build an Ethernet + IPv4 frame with the given IP payload
+ *
+ * @return frame length
+ */
+static uint32_t
+bench_frame(u_char *frame, uint8_t proto, uint32_t src, uint32_t dst, uint16_t id,
+            uint16_t off, const u_char *data, uint32_t len)
+{
+    struct ip *ip = (struct ip *) (frame + BENCH_LINK_HL);
+
+    memset(frame, 0, BENCH_LINK_HL + sizeof(struct ip));
+    frame[12] = 0x08;
+    ip->ip_v = 4;
+    ip->ip_hl = sizeof(struct ip) / 4;
+    ip->ip_len = htons(sizeof(struct ip) + len);
+    ip->ip_id = htons(id);
+    ip->ip_off = htons(off);
+    ip->ip_ttl = 64;
+    ip->ip_p = proto;
+    ip->ip_src.s_addr = htonl(src);
+    ip->ip_dst.s_addr = htonl(dst);
+    memcpy(frame + BENCH_LINK_HL + sizeof(struct ip), data, len);
+    return BENCH_LINK_HL + sizeof(struct ip) + len;
+}
+
+/**
+ * @brief Build an UDP datagram with the given payload
+ *
+ * @return datagram length
+ */
+static uint32_t
+bench_udp(u_char *data, uint16_t sport, uint16_t dport, const char *payload, uint32_t len)
+{
+    struct udphdr *udp = (struct udphdr *) data;
+
+    udp->uh_sport = htons(sport);
+    udp->uh_dport = htons(dport);
+    udp->uh_ulen = htons(sizeof(struct udphdr) + len);
+    udp->uh_sum = 0;
+    memcpy(data + sizeof(struct udphdr), payload, len);
+    return sizeof(struct udphdr) + len;
+}
+
+/**
+ * @brief Build a TCP segment with the given payload
+ *
+ * @return segment length
+ */
+static uint32_t
+bench_tcp(u_char *data, uint16_t sport, uint16_t dport, uint32_t seq, uint8_t flags,
+          const char *payload, uint32_t len)
+{
+    struct tcphdr *tcp = (struct tcphdr *) data;
+
+    memset(tcp, 0, sizeof(struct tcphdr));
+    tcp->th_sport = htons(sport);
+    tcp->th_dport = htons(dport);
+    tcp->th_seq = htonl(seq);
+    tcp->th_off = sizeof(struct tcphdr) / 4;
+    tcp->th_flags = flags;
+    memcpy(data + sizeof(struct tcphdr), payload, len);
+    return sizeof(struct tcphdr) + len;
+}
+
+/**
+ * @brief Create a packet from a generated frame
+ *
+ * This follows the same steps of capture parse_packet function, but
+ * returns the packet instead of queueing it.
+ *
+ * @return a packet ready to be parsed or NULL if it is not complete yet
+ */
+static packet_t *
+bench_packet(const u_char *frame, uint32_t len)
+{
+    struct pcap_pkthdr header = { { 1, 0 }, len, len };
+    u_char reasm[MAX_CAPTURE_LEN];
+    u_char *data = reasm, *payload;
+    uint32_t size_capture = len, size_payload = len - BENCH_LINK_HL;
+    struct udphdr *udp;
+    struct tcphdr *tcp;
+    packet_t *pkt;
+
+    if (!(pkt = capture_packet_reasm_ip(&bench_capinfo, &header, frame, &data,
+                                        &size_payload, &size_capture)))
+        return NULL;
+
+    pkt->source = &bench_capinfo;
+    if (pkt->proto == IPPROTO_UDP) {
+        udp = (struct udphdr *)(data + (size_capture - size_payload));
+        pkt->src.port = htons(udp->uh_sport);
+        pkt->dst.port = htons(udp->uh_dport);
+        payload = (u_char *) udp + sizeof(struct udphdr);
+        packet_set_type(pkt, PACKET_SIP_UDP);
+        packet_set_payload(pkt, payload, size_payload - sizeof(struct udphdr));
+        return pkt;
+    }
+
+    tcp = (struct tcphdr *)(data + (size_capture - size_payload));
+    pkt->src.port = htons(tcp->th_sport);
+    pkt->dst.port = htons(tcp->th_dport);
+    payload = (u_char *) tcp + tcp->th_off * 4;
+    size_payload -= tcp->th_off * 4;
+    packet_set_type(pkt, PACKET_SIP_TCP);
+    packet_set_payload(pkt, payload, size_payload);
+    return capture_packet_reasm_tcp(&bench_capinfo, pkt, tcp, payload, size_payload);
+}
+
+/**
+ * @brief Generate an INVITE with SDP for the given call number
+ *
+ * @return payload length
+ */
+static int
+bench_sip_invite(char *payload, int call)
+{
+    char sdp[512];
+    int sdplen;
+
+    sdplen = sprintf(sdp,
+        "v=0\r\n"
+        "o=alice 2890844526 2890844526 IN IP4 10.0.0.1\r\n"
+        "s=-\r\n"
+        "c=IN IP4 10.1.%d.%d\r\n"
+        "t=0 0\r\n"
+        "m=audio %d RTP/AVP 0 8 101\r\n"
+        "a=rtpmap:0 PCMU/8000\r\n"
+        "a=rtpmap:8 PCMA/8000\r\n"
+        "a=rtpmap:101 telephone-event/8000\r\n"
+        "a=sendrecv\r\n",
+        (call >> 8) & 0xff, call & 0xff, 10000 + (call % 20000) * 2);
+
+    return sprintf(payload,
+        "INVITE sip:bob%d@10.0.0.2 SIP/2.0\r\n"
+        "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK%08x\r\n"
+        "Max-Forwards: 70\r\n"
+        "From: \"Alice\" <sip:alice%d@10.0.0.1>;tag=%08x\r\n"
+        "To: <sip:bob%d@10.0.0.2>\r\n"
+        "Call-ID: %08x-bench@10.0.0.1\r\n"
+        "CSeq: 1 INVITE\r\n"
+        "Contact: <sip:alice%d@10.0.0.1:5060>\r\n"
+        "User-Agent: sngrep-bench\r\n"
+        "Content-Type: application/sdp\r\n"
+        "Content-Length: %d\r\n"
+        "\r\n"
+        "%s",
+        call, call, call, call, call, call, call, sdplen, sdp);
+}
+
+/**
+ * @brief Store generated calls until there are the given number of them
+ */
+static void
+bench_add_calls(int count)
+{
+    u_char frame[MAX_CAPTURE_LEN], data[MAX_CAPTURE_LEN];
+    char payload[2048];
+    packet_t *pkt;
+    sip_msg_t *msg;
+    int len, shard;
+
+    for (; bench_ncalls < count; bench_ncalls++) {
+        len = bench_sip_invite(payload, bench_ncalls);
+        len = bench_udp(data, 5060, 5060, payload, len);
+        len = bench_frame(frame, IPPROTO_UDP, 0x0a000001, 0x0a000002, 0, 0, data, len);
+        pkt = bench_packet(frame, len);
+        assert(pkt);
+
+        shard = sip_packet_shard(pkt);
+        sip_calls_lock_shard(shard);
+        msg = sip_check_packet(pkt);
+        sip_calls_unlock_shard(shard);
+        assert(msg && msg->medias);
+
+        bench_media[bench_ncalls] = ((sdp_media_t *) vector_first(msg->medias))->address;
+    }
+}
+
+static void
+bench_sip_validate_packet(int iterations)
+{
+    int i;
+    for (i = 0; i < iterations; i++)
+        bench_sink += sip_validate_packet(bench_pkt);
+}
+
+static void
+bench_sip_get_callid(int iterations)
+{
+    char callid[SIP_CALLID_MAXLEN];
+    int i;
+    for (i = 0; i < iterations; i++)
+        bench_sink += (uintptr_t) sip_get_callid(bench_invite, &bench_scan, callid)[0];
+}
+
+static void
+bench_sip_parse_msg_payload(int iterations)
+{
+    sip_msg_t msg = { };
+    int i;
+    for (i = 0; i < iterations; i++) {
+        sip_parse_msg_payload(&msg, (const u_char *) bench_invite, &bench_scan);
+        bench_sink += msg.hdrs[SIP_SCAN_CALLID].len;
+    }
+}
+
+static void
+bench_sip_parse_msg_media(int iterations)
+{
+    const u_char *payload = (const u_char *) msg_get_payload(bench_msg);
+    sip_scan_t scan;
+    int i;
+
+    sip_scan_payload((const char *) payload, &scan);
+    for (i = 0; i < iterations; i++) {
+        // Medias of each iteration are discarded, streams already exist in the call
+        vector_clear(bench_msg->medias);
+        sip_parse_msg_media(bench_msg, payload, &scan);
+    }
+    bench_sink += vector_count(bench_msg->medias);
+}
+
+static void
+bench_htable_setup(int iterations)
+{
+    bench_table = htable_create(0);
+}
+
+static void
+bench_htable_fill(int iterations)
+{
+    int i;
+    bench_table = htable_create(0);
+    for (i = 0; i < BENCH_ITEMS; i++)
+        htable_insert(bench_table, bench_keys[i], &bench_items[i]);
+}
+
+static void
+bench_htable_teardown(int iterations)
+{
+    htable_destroy(bench_table);
+}
+
+static void
+bench_htable_insert(int iterations)
+{
+    int i;
+    for (i = 0; i < iterations; i++)
+        bench_sink += htable_insert(bench_table, bench_keys[i], &bench_items[i]);
+}
+
+static void
+bench_htable_find(int iterations)
+{
+    int i;
+    for (i = 0; i < iterations; i++)
+        bench_sink += (uintptr_t) htable_find(bench_table, bench_keys[(i * 7919) % BENCH_ITEMS]);
+}
+
+static void
+bench_htable_find_miss(int iterations)
+{
+    char key[32];
+    int i;
+    for (i = 0; i < iterations; i++) {
+        sprintf(key, "%08x-miss@10.0.0.1", i);
+        bench_sink += (uintptr_t) htable_find(bench_table, key);
+    }
+}
+
+static void
+bench_vector_setup(int iterations)
+{
+    bench_vector = vector_create(200, 50);
+}
+
+static void
+bench_vector_fill(int iterations)
+{
+    int i;
+    bench_vector = vector_create(200, 50);
+    for (i = 0; i < iterations; i++)
+        vector_append(bench_vector, &bench_items[i]);
+}
+
+static void
+bench_vector_teardown(int iterations)
+{
+    vector_destroy(bench_vector);
+}
+
+static void
+bench_vector_append(int iterations)
+{
+    int i;
+    for (i = 0; i < iterations; i++)
+        vector_append(bench_vector, &bench_items[i]);
+}
+
+static void
+bench_vector_remove(int iterations)
+{
+    int i;
+    // Oldest items are removed first, like rotated calls
+    for (i = 0; i < iterations; i++)
+        vector_remove(bench_vector, &bench_items[i]);
+}
+
+static void
+bench_rtp_find_stream_format(int iterations)
+{
+    address_t src = { }, dst;
+    int i;
+
+    address_parse_ip(&src, "10.0.0.2");
+    src.port = 40000;
+    for (i = 0; i < iterations; i++) {
+        dst = bench_media[(i * 7919) % bench_ncalls];
+        bench_sink += (uintptr_t) rtp_find_stream_format(src, dst, 0);
+    }
+}
+
+static void
+bench_ip_reasm(int iterations)
+{
+    static u_char frag1[MAX_CAPTURE_LEN], frag2[MAX_CAPTURE_LEN];
+    u_char data[MAX_CAPTURE_LEN];
+    uint32_t len, len1, len2, half;
+    packet_t *pkt;
+    int i;
+
+    // Split the datagram in two fragments, first one 8 bytes aligned
+    len = bench_udp(data, 5060, 5060, bench_invite, strlen(bench_invite));
+    half = (len / 2) & ~7;
+
+    for (i = 0; i < iterations; i++) {
+        len1 = bench_frame(frag1, IPPROTO_UDP, 0x0a000001, 0x0a000002, i, IP_MF, data, half);
+        len2 = bench_frame(frag2, IPPROTO_UDP, 0x0a000001, 0x0a000002, i, half / 8,
+                           data + half, len - half);
+        pkt = bench_packet(frag1, len1);
+        assert(!pkt);
+        pkt = bench_packet(frag2, len2);
+        assert(pkt);
+        packet_destroy(pkt);
+    }
+}
+
+static void
+bench_tcp_reasm(int iterations)
+{
+    static u_char seg1[MAX_CAPTURE_LEN], seg2[MAX_CAPTURE_LEN];
+    u_char data[MAX_CAPTURE_LEN];
+    uint32_t len, len1, len2, half, seq = 1000;
+    packet_t *pkt;
+    int i;
+
+    // Split the message in two segments, the first one without body
+    len = strlen(bench_invite);
+    half = len / 2;
+
+    for (i = 0; i < iterations; i++, seq += len) {
+        len1 = bench_tcp(data, 5060, 5060, seq, TH_ACK, bench_invite, half);
+        len1 = bench_frame(seg1, IPPROTO_TCP, 0x0a000001, 0x0a000002, 0, 0, data, len1);
+        len2 = bench_tcp(data, 5060, 5060, seq + half, TH_ACK | TH_PUSH,
+                         bench_invite + half, len - half);
+        len2 = bench_frame(seg2, IPPROTO_TCP, 0x0a000001, 0x0a000002, 0, 0, data, len2);
+        pkt = bench_packet(seg1, len1);
+        assert(!pkt);
+        pkt = bench_packet(seg2, len2);
+        assert(pkt);
+        packet_destroy(pkt);
+    }
+}
+
+/**
+ * @brief Remove cached filter results of all calls
+ */
+static void
+bench_filter_setup(int iterations)
+{
+    sip_call_t *call;
+    vector_iter_t it = vector_iterator(sip_calls_vector());
+
+    while ((call = vector_iterator_next(&it))) {
+        CALL_SLOT(call, filtered) = -1;
+        CALL_SLOT(call, filter_checked) = CALL_SLOT(call, filter_matched) = 0;
+        call->filter_msgcnt = 0;
+    }
+}
+
+static void
+bench_filter_check_call(int iterations)
+{
+    vector_t *calls = sip_calls_vector();
+    int i;
+    for (i = 0; i < iterations; i++)
+        bench_sink += filter_check_call(vector_item(calls, i));
+}
+
+int main(int argc, char *argv[])
+{
+    u_char frame[MAX_CAPTURE_LEN], data[MAX_CAPTURE_LEN];
+    char name[64];
+    int i, len, counts[] = { 100, 1000, BENCH_CALLS };
+
+    if (argc > 1)
+        bench_prefix = argv[1];
+
+    // Default settings, without user configuration files
+    init_options(1);
+    setting_set_value(SETTING_CAPTURE_WORKERS, "1");
+    sip_init(0, 0, 0);
+    capture_init(0, false, false, 0);
+
+    bench_capinfo.link = DLT_EN10MB;
+    bench_capinfo.link_hl = BENCH_LINK_HL;
+    bench_capinfo.ip_reasm = capture_ip_reasm_create();
+    bench_capinfo.tcp_reasm = capture_tcp_reasm_create();
+
+    for (i = 0; i < BENCH_ITEMS; i++)
+        sprintf(bench_keys[i], "%08x-bench@10.0.0.1", i);
+
+    // Parser input, the first call of the storage
+    bench_sip_invite(bench_invite, 0);
+    bench_add_calls(1);
+    bench_msg = vector_first(sip_find_by_index(0)->msgs);
+    len = bench_udp(data, 5060, 5060, bench_invite, strlen(bench_invite));
+    len = bench_frame(frame, IPPROTO_UDP, 0x0a000001, 0x0a000002, 0, 0, data, len);
+    bench_pkt = bench_packet(frame, len);
+    sip_scan_payload(bench_invite, &bench_scan);
+
+    printf("# name\titerations\tns_per_op\tns_per_op_min\n");
+
+    bench_run("sip_validate_packet", 1000000, NULL, bench_sip_validate_packet, NULL);
+    bench_run("sip_get_callid", 1000000, NULL, bench_sip_get_callid, NULL);
+    bench_run("sip_parse_msg_payload", 1000000, NULL, bench_sip_parse_msg_payload, NULL);
+    bench_run("sip_parse_msg_media", 20000, NULL, bench_sip_parse_msg_media, NULL);
+
+    bench_run("htable_insert", BENCH_ITEMS, bench_htable_setup, bench_htable_insert,
+              bench_htable_teardown);
+    bench_run("htable_find", 1000000, bench_htable_fill, bench_htable_find,
+              bench_htable_teardown);
+    bench_run("htable_find_miss", 1000000, bench_htable_fill, bench_htable_find_miss,
+              bench_htable_teardown);
+
+    bench_run("vector_append", BENCH_ITEMS, bench_vector_setup, bench_vector_append,
+              bench_vector_teardown);
+    bench_run("vector_remove", 10000, bench_vector_fill, bench_vector_remove,
+              bench_vector_teardown);
+
+    bench_run("ip_reasm", 100000, NULL, bench_ip_reasm, NULL);
+    bench_run("tcp_reasm", 100000, NULL, bench_tcp_reasm, NULL);
+
+    // Lookups get slower as stored calls and their streams grow
+    for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        sprintf(name, "rtp_find_stream_format/calls=%d", counts[i]);
+        if (bench_enabled(name))
+            bench_add_calls(counts[i]);
+        bench_run(name, 1000000, NULL, bench_rtp_find_stream_format, NULL);
+    }
+
+    // Display filters evaluated against all stored calls
+    if (bench_enabled("filter_check_call"))
+        bench_add_calls(BENCH_CALLS);
+    filter_set(FILTER_SIPFROM, "alice");
+    bench_run("filter_check_call/sipfrom", bench_ncalls, bench_filter_setup,
+              bench_filter_check_call, NULL);
+    filter_set(FILTER_SIPFROM, NULL);
+    filter_set(FILTER_PAYLOAD, "m=audio [0-9]+ RTP/AVP 0");
+    bench_run("filter_check_call/payload", bench_ncalls, bench_filter_setup,
+              bench_filter_check_call, NULL);
+    filter_set(FILTER_PAYLOAD, NULL);
+
+    packet_destroy(bench_pkt);
+    capture_ip_reasm_destroy(bench_capinfo.ip_reasm);
+    capture_tcp_reasm_destroy(bench_capinfo.tcp_reasm);
+    capture_deinit();
+    deinit_options();
+    sip_deinit();
+
+    return 0;
+}
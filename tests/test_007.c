@@ -32,9 +32,18 @@
 #include "../src/vector.h"
 #include "../src/util.h"
 
+#define TEST_ITEMS 200000
+
 int main ()
 {
+    static int items[TEST_ITEMS];
+    static void *itemptrs[TEST_ITEMS];
     vector_t *vector;
+    void *last;
+    int i;
+
+    for (i = 0; i < TEST_ITEMS; i++)
+        itemptrs[i] = &items[i];
 
     // Basic Vector append/remove test
     vector = vector_create(10, 10);
@@ -45,7 +54,9 @@ int main ()
     vector_append(vector, sng_malloc(1024));
     assert(vector_count(vector) == 1);
     assert(vector_first(vector) == vector_item(vector, 0));
+    last = vector_first(vector);
     vector_remove(vector, vector_first(vector));
+    sng_free(last);
     assert(vector_count(vector) == 0);
     assert(vector_first(vector) == vector_item(vector, 0));
 
@@ -76,5 +87,51 @@ int main ()
     vector_remove(vector, vector_item(vector, 12));
     assert(vector_count(vector) == 15);
 
+    // Swap remove moves last item to removed position
+    last = vector_last(vector);
+    vector_swap_remove(vector, vector_item(vector, 3));
+    assert(vector_count(vector) == 14);
+    assert(vector_item(vector, 3) == last);
+
+    // Clear destroys all items and keeps vector usable
+    vector_clear(vector);
+    assert(vector_count(vector) == 0);
+    assert(vector_first(vector) == NULL);
+    vector_append(vector, sng_malloc(32));
+    assert(vector_count(vector) == 1);
+    vector_destroy(vector);
+
+    // Big vectors grow geometrically
+    vector = vector_create(0, 1);
+    for (i = 0; i < TEST_ITEMS; i++)
+        vector_append(vector, &items[i]);
+    assert(vector_count(vector) == TEST_ITEMS);
+    assert(vector_item(vector, TEST_ITEMS - 1) == &items[TEST_ITEMS - 1]);
+    assert(vector_item(vector, TEST_ITEMS) == NULL);
+
+    // Batch append and remove by position
+    vector_append_items(vector, itemptrs, TEST_ITEMS);
+    assert(vector_count(vector) == TEST_ITEMS * 2);
+    assert(vector_item(vector, TEST_ITEMS) == &items[0]);
+    vector_remove_index(vector, 0);
+    assert(vector_first(vector) == &items[1]);
+    assert(vector_count(vector) == TEST_ITEMS * 2 - 1);
+
+    // Remove a range of items at once
+    vector_remove_range(vector, 0, TEST_ITEMS - 1);
+    assert(vector_count(vector) == TEST_ITEMS);
+    assert(vector_first(vector) == &items[0]);
+    vector_remove_range(vector, TEST_ITEMS - 10, 100);
+    assert(vector_count(vector) == TEST_ITEMS - 10);
+    assert(vector_item(vector, TEST_ITEMS - 10) == NULL);
+
+    // Shrink releases unused space
+    vector_clear(vector);
+    vector_shrink(vector);
+    assert(vector_count(vector) == 0);
+    assert(vector_reserve(vector, 100) == 0);
+    assert(vector_first(vector) == NULL);
+    vector_destroy(vector);
+
     return 0;
 }
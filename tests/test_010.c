@@ -29,10 +29,29 @@
 #include "config.h"
 #include <assert.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include "../src/hash.h"
 
+#define TEST_KEYS 20000
+
+static uint32_t
+test_hash_int(const void *key)
+{
+    return *(const int *) key * 2654435761u;
+}
+
+static bool
+test_equal_int(const void *key1, const void *key2)
+{
+    return *(const int *) key1 == *(const int *) key2;
+}
+
 int main ()
 {
+    static char keys[TEST_KEYS][16];
+    static int ints[TEST_KEYS];
+    int i;
     htable_t *table;
     table = htable_create(10);
     assert(table);
@@ -100,5 +119,46 @@ int main ()
     // Destroy the table
     htable_destroy(table);
 
+    // Grow a table while adding and removing entries
+    table = htable_create(0);
+    for (i = 0; i < TEST_KEYS; i++) {
+        sprintf(keys[i], "key%d", i);
+        assert(htable_insert(table, keys[i], keys[i]) == 0);
+        // Remove one of each three keys while table is resized
+        if (i % 3 == 0)
+            htable_remove(table, keys[i / 3]);
+    }
+    // First third of the keys have been removed
+    for (i = 0; i < TEST_KEYS; i++) {
+        if (i < (TEST_KEYS + 2) / 3) {
+            assert(htable_find(table, keys[i]) == NULL);
+        } else {
+            assert(htable_find(table, keys[i]) == keys[i]);
+        }
+    }
+    assert(htable_count(table) == TEST_KEYS - (TEST_KEYS + 2) / 3);
+    htable_destroy(table);
+
+    // Custom keys
+    table = htable_create_custom(10, test_hash_int, test_equal_int);
+    for (i = 0; i < TEST_KEYS; i++) {
+        ints[i] = i * 7;
+        htable_insert(table, &ints[i], &ints[i]);
+    }
+    assert(htable_count(table) == TEST_KEYS);
+    i = 7 * 1234;
+    assert(htable_find(table, &i) == &ints[1234]);
+    htable_remove(table, &i);
+    assert(htable_find(table, &i) == NULL);
+    assert(htable_count(table) == TEST_KEYS - 1);
+    i = 3;
+    assert(htable_find(table, &i) == NULL);
+    htable_destroy(table);
+
+    // Memory blocks hashes
+    assert(hash_mem64("INVITE", 6) == hash_mem64("INVITE sip:", 6));
+    assert(hash_mem64("INVITE", 6) != hash_mem64("INVITE", 5));
+    assert(hash_mem64("INVITE", 6) != hash_mem64("invite", 6));
+
     return 0;
 }
@@ -0,0 +1,101 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_012.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of queue structures
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "../src/queue.h"
+
+#define QUEUE_ITEMS 100000
+
+void *
+producer(void *data)
+{
+    queue_t *queue = data;
+    uintptr_t i;
+
+    for (i = 1; i <= QUEUE_ITEMS; i++) {
+        while (!queue_push(queue, (void *) i));
+    }
+    queue_close(queue);
+    return NULL;
+}
+
+int main ()
+{
+    queue_t *queue;
+    pthread_t thread;
+    uintptr_t i, item;
+
+    // Queue size is rounded to a power of 2
+    queue = queue_create(5);
+    assert(queue);
+    assert(queue->size == 8);
+
+    // Check an empty queue
+    assert(queue_pop(queue) == NULL);
+    assert(queue_count(queue) == 0);
+
+    // Fill the queue
+    for (i = 1; i <= 8; i++)
+        assert(queue_push(queue, (void *) i));
+    assert(queue_count(queue) == 8);
+
+    // Queue is full
+    assert(!queue_push(queue, (void *) 9));
+
+    // Items are extracted in order
+    for (i = 1; i <= 8; i++) {
+        assert((uintptr_t) queue_peek(queue) == i);
+        assert((uintptr_t) queue_pop(queue) == i);
+    }
+    assert(queue_peek(queue) == NULL);
+    assert(queue_pop(queue) == NULL);
+
+    // Closed queues are finished once emptied
+    assert(queue_push(queue, (void *) 1));
+    queue_close(queue);
+    assert(!queue_finished(queue));
+    assert(queue_pop(queue) != NULL);
+    assert(queue_finished(queue));
+    queue_destroy(queue);
+
+    // Fill and empty the queue from different threads
+    queue = queue_create(64);
+    assert(pthread_create(&thread, NULL, producer, queue) == 0);
+    for (i = 1; i <= QUEUE_ITEMS; i++) {
+        while (!(item = (uintptr_t) queue_pop(queue)));
+        assert(item == i);
+    }
+    pthread_join(thread, NULL);
+    assert(queue_finished(queue));
+    queue_destroy(queue);
+
+    return 0;
+}
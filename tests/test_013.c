@@ -0,0 +1,133 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_013.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of SIP headers scanner
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "../src/sip_scan.h"
+
+#define CHECK_VALUE(value, len, expected) \
+    assert(value && len == strlen(expected) && !strncmp(value, expected, len))
+
+const char *request =
+    "INVITE sip:bob@10.0.0.2 SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK776asdhds\r\n"
+    "f: \"Alice\" <sip:alice@10.0.0.1>;tag=1928301774\r\n"
+    "To: <sip:bob@10.0.0.2>\r\n"
+    "i:  a84b4c76e66710@pc33  \r\n"
+    "X-CID: 1234@10.0.0.1\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Content-Length: 4\r\n"
+    "\r\n"
+    "v=0\n";
+
+const char *response =
+    "SIP/2.0 486 Busy Here\r\n"
+    "From: <sip:alice@10.0.0.1>;tag=1928301774\r\n"
+    "To: <sip:bob@10.0.0.2>;tag=a6c85cf\r\n"
+    "Call-ID: a84b4c76e66710@pc33\r\n"
+    "CSeq: bad INVITE\r\n"
+    "CSeq: 314159 INVITE\r\n"
+    "Reason: Q.850;cause=17;text=\"User busy\"\r\n"
+    "Warning: 399 sbc \"Busy\"\r\n"
+    "l: 0\r\n"
+    "\r\n";
+
+int main ()
+{
+    sip_scan_t scan;
+    const char *value;
+    char buffer[1024];
+    uint32_t cseq;
+    int len, code, i;
+
+    // Only SIP start lines are accepted
+    assert(sip_scan_is_sip(request));
+    assert(sip_scan_is_sip(response));
+    assert(!sip_scan_is_sip("GET / HTTP/1.1\r\n\r\n"));
+    assert(!sip_scan_is_sip("SIP/2.0 OK\r\n\r\n"));
+
+    // Request headers
+    assert(sip_scan_set_xcallid("X-Call-ID|X-CID") == 0);
+    sip_scan_payload(request, &scan);
+    value = sip_scan_method(request, &scan, &len);
+    CHECK_VALUE(value, len, "INVITE");
+    assert(!sip_scan_response(request, &scan, &len));
+    value = sip_scan_token(request, &scan, SIP_SCAN_CALLID, &len);
+    CHECK_VALUE(value, len, "a84b4c76e66710@pc33");
+    value = sip_scan_token(request, &scan, SIP_SCAN_XCALLID, &len);
+    CHECK_VALUE(value, len, "1234@10.0.0.1");
+    value = sip_scan_uri(request, &scan, SIP_SCAN_FROM, &len);
+    CHECK_VALUE(value, len, "alice@10.0.0.1");
+    value = sip_scan_uri(request, &scan, SIP_SCAN_TO, &len);
+    CHECK_VALUE(value, len, "bob@10.0.0.2");
+    assert(sip_scan_cseq(request, &scan, &cseq) && cseq == 314159);
+    assert(sip_scan_content_length(request, &scan) == 4);
+    assert(scan.body && !strcmp(request + scan.body, "v=0\n"));
+    assert(!sip_scan_reason(request, &scan, &len));
+    assert(!sip_scan_warning(request, &scan, &code));
+
+    // Response headers, malformed ones are skipped
+    sip_scan_payload(response, &scan);
+    assert(!sip_scan_method(response, &scan, &len));
+    value = sip_scan_response(response, &scan, &len);
+    CHECK_VALUE(value, len, "486 Busy Here");
+    assert(!sip_scan_token(response, &scan, SIP_SCAN_XCALLID, &len));
+    assert(sip_scan_cseq(response, &scan, &cseq) && cseq == 314159);
+    value = sip_scan_reason(response, &scan, &len);
+    CHECK_VALUE(value, len, "User busy");
+    assert(sip_scan_warning(response, &scan, &code) && code == 399);
+    assert(sip_scan_content_length(response, &scan) == 0);
+    assert(scan.body == strlen(response));
+
+    // Headers after the body separator are not scanned
+    sip_scan_payload("SIP/2.0 200 OK\r\n\r\nCall-ID: body\r\n", &scan);
+    assert(!scan.headers[SIP_SCAN_CALLID].off);
+    assert(sip_scan_content_length("SIP/2.0 200 OK\r\n\r\n", &scan) == -1);
+
+    // Incomplete headers have no body
+    sip_scan_payload("SIP/2.0 200 OK\r\nContent-Length: 0\r\n", &scan);
+    assert(!scan.body);
+
+    // Payloads are scanned in blocks, results must not depend on alignment
+    for (i = 0; i < 64; i++) {
+        strcpy(buffer + i, request);
+        sip_scan_payload(buffer + i, &scan);
+        value = sip_scan_token(buffer + i, &scan, SIP_SCAN_CALLID, &len);
+        CHECK_VALUE(value, len, "a84b4c76e66710@pc33");
+        assert(sip_scan_content_length(buffer + i, &scan) == 4);
+        assert(scan.body && !strcmp(buffer + i + scan.body, "v=0\n"));
+    }
+
+    // Custom X-Call-ID header names
+    assert(sip_scan_set_xcallid("X-Leg-ID") == 0);
+    sip_scan_payload(request, &scan);
+    assert(!sip_scan_token(request, &scan, SIP_SCAN_XCALLID, &len));
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_014.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of shared strings pool
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/strpool.h"
+
+#define POOL_STRINGS 5000
+
+int main ()
+{
+    const char *one, *two, *three;
+    const char *strings[POOL_STRINGS];
+    char value[32];
+    int i;
+
+    // Equal strings are shared
+    one = strpool_get("Busy Here", 9);
+    two = strpool_get("Busy Here\r\n", 9);
+    assert(one && one == two);
+    assert(!strcmp(one, "Busy Here"));
+    assert(strpool_count() == 1);
+
+    // Prefixes are different strings
+    three = strpool_get("Busy", 4);
+    assert(three != one && !strcmp(three, "Busy"));
+    assert(strpool_count() == 2);
+
+    // Strings are removed when all users release them
+    strpool_put(one);
+    assert(strpool_count() == 2);
+    assert(!strcmp(two, "Busy Here"));
+    strpool_put(two);
+    strpool_put(three);
+    assert(strpool_count() == 0);
+    strpool_put(NULL);
+
+    // Pool grows with lots of strings
+    for (i = 0; i < POOL_STRINGS; i++) {
+        sprintf(value, "string%d", i);
+        strings[i] = strpool_get(value, strlen(value));
+    }
+    assert(strpool_count() == POOL_STRINGS);
+    for (i = 0; i < POOL_STRINGS; i++) {
+        sprintf(value, "string%d", i);
+        assert(strpool_get(value, strlen(value)) == strings[i]);
+        strpool_put(strings[i]);
+        strpool_put(strings[i]);
+    }
+    assert(strpool_count() == 0);
+
+    return 0;
+}
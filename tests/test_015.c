@@ -0,0 +1,67 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_015.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of expressions required text
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "../src/util.h"
+
+int main ()
+{
+    char literal[EXPR_LITERAL_MAXLEN];
+
+    // Plain texts don't require the expression
+    assert(expr_required_literal("INVITE sip:", literal) == 1);
+    assert(!strcmp(literal, "INVITE sip:"));
+    assert(expr_required_literal("X-Call\\.ID", literal) == 1);
+    assert(!strcmp(literal, "X-Call.ID"));
+
+    // Longest required text of the expression
+    assert(expr_required_literal("^REGISTER .*@example", literal) == 0);
+    assert(!strcmp(literal, "REGISTER "));
+    assert(expr_required_literal("alic?e 486", literal) == 0);
+    assert(!strcmp(literal, "e 486"));
+    assert(expr_required_literal("(From)?: [a-z]+@domain", literal) == 0);
+    assert(!strcmp(literal, "@domain"));
+    assert(expr_required_literal("\\d+ Busy", literal) == 0);
+    assert(!strcmp(literal, " Busy"));
+
+    // Expressions with optional texts
+    assert(expr_required_literal("alice|bob", literal) == 0);
+    assert(!strcmp(literal, ""));
+    assert(expr_required_literal("(?i)alice", literal) == 0);
+    assert(!strcmp(literal, ""));
+
+    // Required text search
+    assert(expr_literal_found("Reason: Busy", "", false));
+    assert(expr_literal_found("Reason: Busy", "Busy", false));
+    assert(!expr_literal_found("Reason: Busy", "BUSY", false));
+    assert(expr_literal_found("Reason: Busy", "BUSY", true));
+
+    return 0;
+}
@@ -0,0 +1,85 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_016.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of multiple pattern matching
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "../src/match.h"
+
+int main ()
+{
+    match_set_t *set;
+    uint64_t hits;
+    char pattern[32];
+    int i;
+
+    // Overlapping texts and expressions
+    set = match_set_create(false);
+    assert(match_set_add(set, "he") == 0);
+    assert(match_set_add(set, "she") == 0);
+    assert(match_set_add(set, "hers") == 0);
+    assert(match_set_add(set, "sip:[0-9]+@example") == 0);
+    assert(match_set_add(set, "^BYE ") == 0);
+    assert(match_set_add(set, "([a-z") != 0);
+    assert(match_set_count(set) == 5);
+    assert(match_set_compile(set) == 0);
+
+    assert(match_set_check(set, "ushers"));
+    assert(match_set_check(set, "INVITE sip:1234@example.com"));
+    assert(match_set_check(set, "BYE sip:bob"));
+    assert(!match_set_check(set, "INVITE sip:alice@example.com"));
+    assert(!match_set_check(set, "Hi BYE HERS"));
+    assert(!match_set_check(set, ""));
+
+    assert(!strcmp(match_set_pattern(set, 0, &hits), "he"));
+    assert(hits == 1);
+    assert(match_set_pattern(set, 1, &hits) && hits == 1);
+    assert(match_set_pattern(set, 2, &hits) && hits == 1);
+    assert(match_set_pattern(set, 3, &hits) && hits == 1);
+    assert(match_set_pattern(set, 4, &hits) && hits == 1);
+    assert(match_set_pattern(set, 5, &hits) == NULL);
+    match_set_destroy(set);
+
+    // Case insensitive set with lots of patterns
+    set = match_set_create(true);
+    for (i = 0; i < 1000; i++) {
+        sprintf(pattern, "sip:%d@", 1000 + i);
+        assert(match_set_add(set, pattern) == 0);
+    }
+    assert(match_set_compile(set) == 0);
+    assert(match_set_check(set, "From: <SIP:1999@example.com>"));
+    assert(match_set_check(set, "To: <sip:1000@example.com>"));
+    assert(!match_set_check(set, "To: <sip:2000@example.com>"));
+    assert(!match_set_check(set, "To: <sip:999@example.com>"));
+    assert(match_set_pattern(set, 999, &hits) && hits == 1);
+    assert(match_set_pattern(set, 500, &hits) && hits == 0);
+    match_set_destroy(set);
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/**************************************************************************
+ **
+ ** sngrep - SIP Messages flow viewer
+ **
+ ** Copyright (C) 2013-2018 Ivan Alonso (Kaian)
+ ** Copyright (C) 2013-2018 Irontec SL. All rights reserved.
+ **
+ ** This program is free software: you can redistribute it and/or modify
+ ** it under the terms of the GNU General Public License as published by
+ ** the Free Software Foundation, either version 3 of the License, or
+ ** (at your option) any later version.
+ **
+ ** This program is distributed in the hope that it will be useful,
+ ** but WITHOUT ANY WARRANTY; without even the implied warranty of
+ ** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ ** GNU General Public License for more details.
+ **
+ ** You should have received a copy of the GNU General Public License
+ ** along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ **
+ ****************************************************************************/
+/**
+ * @file test_017.c
+ * @author Ivan Alonso [aka Kaian] <kaian@irontec.com>
+ *
+ * Basic testing of tagged memory accounting
+ */
+
+#include "config.h"
+#include <assert.h>
+#include <string.h>
+#include "../src/util.h"
+#include "../src/arena.h"
+
+int main ()
+{
+    arena_t arena;
+    int64_t live, peak, calls;
+    void *data;
+    int i;
+
+    // Tagged allocations
+    data = sng_malloc_tag(MEMSTAT_UI, 100);
+    assert(data);
+    memstat_get(MEMSTAT_UI, &live, &peak);
+    assert(live == 100 && peak == 100);
+    sng_free_tag(MEMSTAT_UI, data, 100);
+    memstat_get(MEMSTAT_UI, &live, &peak);
+    assert(live == 0 && peak == 100);
+
+    // High-water mark only moves forward
+    memstat_add(MEMSTAT_TLS, 50);
+    memstat_add(MEMSTAT_TLS, 70);
+    memstat_add(MEMSTAT_TLS, -120);
+    memstat_add(MEMSTAT_TLS, 10);
+    memstat_get(MEMSTAT_TLS, &live, &peak);
+    assert(live == 10 && peak == 120);
+
+    // Arena chunks are accounted to calls unless allocations are tagged
+    arena_init(&arena);
+    for (i = 0; i < 100; i++) {
+        assert(arena_alloc(&arena, 64));
+        assert(arena_alloc_tag(&arena, MEMSTAT_MSGS, 32));
+        assert(arena_memdup(&arena, MEMSTAT_PAYLOADS, "INVITE", 6));
+    }
+    memstat_get(MEMSTAT_MSGS, &live, NULL);
+    assert(live == 100 * 32);
+    memstat_get(MEMSTAT_PAYLOADS, &live, NULL);
+    assert(live >= 100 * 7);
+    memstat_get(MEMSTAT_CALLS, &calls, NULL);
+    assert(calls >= 100 * 64);
+    memstat_get(MEMSTAT_PAYLOADS, &live, NULL);
+    assert((size_t) (calls + live + 100 * 32) == arena.size);
+
+    // Released arena leaves nothing accounted
+    arena_release(&arena);
+    memstat_get(MEMSTAT_CALLS, &live, NULL);
+    assert(live == 0);
+    memstat_get(MEMSTAT_MSGS, &live, NULL);
+    assert(live == 0);
+    memstat_get(MEMSTAT_PAYLOADS, &live, NULL);
+    assert(live == 0);
+
+    // Names are available for every tag
+    for (i = 0; i < MEMSTAT_COUNT; i++)
+        assert(memstat_name(i) && *memstat_name(i));
+
+    return 0;
+}